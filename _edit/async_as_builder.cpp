@@ -0,0 +1,255 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "async_as_builder.hpp"
+
+#include <nvvk/error_vk.hpp>
+
+void AsyncAsBuilder::init(nvvk::ResourceAllocator* alloc,
+                          uint32_t                 computeQueueFamily,
+                          VkQueue                  computeQueue,
+                          uint32_t                 graphicsQueueFamily,
+                          VkQueue                  graphicsQueue)
+{
+  m_alloc          = alloc;
+  m_device         = alloc->getDevice();
+  m_computeFamily  = computeQueueFamily;
+  m_graphicsFamily = graphicsQueueFamily;
+  m_computeQueue   = computeQueue;
+  m_graphicsQueue  = graphicsQueue;
+
+  VkCommandPoolCreateInfo poolInfo{.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                                   .flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                                   .queueFamilyIndex = computeQueueFamily};
+  NVVK_CHECK(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_computePool));
+  poolInfo.queueFamilyIndex = graphicsQueueFamily;
+  NVVK_CHECK(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_graphicsPool));
+
+  VkCommandBufferAllocateInfo allocInfo{.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                        .commandPool        = m_computePool,
+                                        .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                        .commandBufferCount = 1};
+  NVVK_CHECK(vkAllocateCommandBuffers(m_device, &allocInfo, &m_cmdBuf));
+  allocInfo.commandPool = m_graphicsPool;
+  NVVK_CHECK(vkAllocateCommandBuffers(m_device, &allocInfo, &m_acquireCmdBuf));
+
+  const VkFenceCreateInfo fenceInfo{.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+  NVVK_CHECK(vkCreateFence(m_device, &fenceInfo, nullptr, &m_fence));
+  NVVK_CHECK(vkCreateFence(m_device, &fenceInfo, nullptr, &m_acquireFence));
+  const VkSemaphoreCreateInfo semaphoreInfo{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+  NVVK_CHECK(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_semaphore));
+  m_state = State::eIdle;
+}
+
+void AsyncAsBuilder::deinit()
+{
+  if(m_device == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  if(m_submitted)
+  {
+    NVVK_CHECK(vkWaitForFences(m_device, 1, &m_fence, VK_TRUE, UINT64_MAX));
+    m_submitted = false;
+  }
+  if(m_acquireSubmitted)
+  {
+    NVVK_CHECK(vkWaitForFences(m_device, 1, &m_acquireFence, VK_TRUE, UINT64_MAX));
+    m_acquireSubmitted = false;
+  }
+
+  // Throw away an unfinished or unacquired build
+  m_blasBuilder.deinit();
+  for(nvvk::AccelKHR& accel : m_blas)
+  {
+    m_alloc->destroy(accel);
+  }
+  m_blas.clear();
+  m_tlas.deinit();
+  m_state = State::eIdle;
+
+  vkDestroySemaphore(m_device, m_semaphore, nullptr);
+  vkDestroyFence(m_device, m_acquireFence, nullptr);
+  vkDestroyFence(m_device, m_fence, nullptr);
+  vkDestroyCommandPool(m_device, m_graphicsPool, nullptr);  // Also frees the command buffers
+  vkDestroyCommandPool(m_device, m_computePool, nullptr);
+  m_device = VK_NULL_HANDLE;
+}
+
+bool AsyncAsBuilder::start(const std::vector<nvvk::RaytracingBuilderKHR::BlasInput>& blasInputs,
+                           VkBuildAccelerationStructureFlagsKHR                      blasFlags,
+                           VkDeviceSize                                              blasBuildBudget,
+                           const std::vector<VkAccelerationStructureInstanceKHR>&    instances,
+                           uint32_t                                                  numFramesInFlight,
+                           VkDeviceSize                                              scratchAlignment)
+{
+  if(m_state != State::eIdle)
+  {
+    return false;
+  }
+  // The previous acquire has long finished, but its command buffer is about to be reused
+  if(m_acquireSubmitted)
+  {
+    NVVK_CHECK(vkWaitForFences(m_device, 1, &m_acquireFence, VK_TRUE, UINT64_MAX));
+    NVVK_CHECK(vkResetFences(m_device, 1, &m_acquireFence));
+    m_acquireSubmitted = false;
+  }
+
+  m_blasBuilder.init(m_alloc, blasInputs, blasFlags, blasBuildBudget, scratchAlignment);
+  m_instances         = instances;
+  m_numFramesInFlight = numFramesInFlight;
+  m_scratchAlignment  = scratchAlignment;
+  m_state             = State::eBuildBatch;
+  poll();  // Submits the first step right away
+  return true;
+}
+
+bool AsyncAsBuilder::poll()
+{
+  if(m_state == State::eIdle || m_state == State::eReady)
+  {
+    return m_state == State::eReady;
+  }
+  if(m_submitted)
+  {
+    if(vkGetFenceStatus(m_device, m_fence) != VK_SUCCESS)
+    {
+      return false;
+    }
+    NVVK_CHECK(vkResetFences(m_device, 1, &m_fence));
+    m_submitted = false;
+  }
+
+  switch(m_state)
+  {
+    case State::eBuildBatch:
+      recordNextBuild();
+      break;
+    case State::eCompactBatch: {
+      const VkCommandBufferBeginInfo beginInfo{.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                                               .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+      NVVK_CHECK(vkBeginCommandBuffer(m_cmdBuf, &beginInfo));
+      m_blasBuilder.cmdCompactBatch(m_cmdBuf);
+      submit(VK_NULL_HANDLE);
+      m_state = State::eFinishBatch;
+      break;
+    }
+    case State::eFinishBatch:
+      m_blasBuilder.finishBatch();
+      recordNextBuild();
+      break;
+    case State::eBuildTlas:
+      m_state = State::eReady;
+      return true;
+    default:
+      break;
+  }
+  return false;
+}
+
+void AsyncAsBuilder::recordNextBuild()
+{
+  const VkCommandBufferBeginInfo beginInfo{.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                                           .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+  NVVK_CHECK(vkBeginCommandBuffer(m_cmdBuf, &beginInfo));
+  if(!m_blasBuilder.isDone())
+  {
+    m_blasBuilder.cmdBuildBatch(m_cmdBuf);
+    submit(VK_NULL_HANDLE);
+    m_state = State::eCompactBatch;
+    return;
+  }
+
+  // All BLASes are compacted: point the instances at them and build the TLAS
+  m_stats = m_blasBuilder.getStats();
+  m_blas  = m_blasBuilder.takeBlas();
+  m_blasBuilder.deinit();
+  for(VkAccelerationStructureInstanceKHR& instance : m_instances)
+  {
+    const VkAccelerationStructureDeviceAddressInfoKHR addressInfo{
+        .sType                 = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+        .accelerationStructure = m_blas[instance.accelerationStructureReference].accel};
+    instance.accelerationStructureReference = vkGetAccelerationStructureDeviceAddressKHR(m_device, &addressInfo);
+  }
+  m_tlas.init(m_alloc, m_cmdBuf, m_instances, m_numFramesInFlight, m_scratchAlignment);
+  cmdTransferOwnership(m_cmdBuf, true);
+  submit(m_semaphore);
+  m_state = State::eBuildTlas;
+}
+
+void AsyncAsBuilder::submit(VkSemaphore signalSemaphore)
+{
+  NVVK_CHECK(vkEndCommandBuffer(m_cmdBuf));
+  const VkSubmitInfo submitInfo{.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                                .commandBufferCount   = 1,
+                                .pCommandBuffers      = &m_cmdBuf,
+                                .signalSemaphoreCount = (signalSemaphore != VK_NULL_HANDLE) ? 1u : 0u,
+                                .pSignalSemaphores    = &signalSemaphore};
+  NVVK_CHECK(vkQueueSubmit(m_computeQueue, 1, &submitInfo, m_fence));
+  m_submitted = true;
+}
+
+void AsyncAsBuilder::acquire(std::vector<nvvk::AccelKHR>& blas, DynamicTlas& tlas, BlasBuildStats* stats)
+{
+  // The release was on the compute queue; the graphics queue acquires the
+  // structures before any later submission of it uses them.
+  const VkCommandBufferBeginInfo beginInfo{.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                                           .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+  NVVK_CHECK(vkBeginCommandBuffer(m_acquireCmdBuf, &beginInfo));
+  cmdTransferOwnership(m_acquireCmdBuf, false);
+  NVVK_CHECK(vkEndCommandBuffer(m_acquireCmdBuf));
+  const VkPipelineStageFlags waitStage =
+      VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+  const VkSubmitInfo submitInfo{.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                                .waitSemaphoreCount = 1,
+                                .pWaitSemaphores    = &m_semaphore,
+                                .pWaitDstStageMask  = &waitStage,
+                                .commandBufferCount = 1,
+                                .pCommandBuffers    = &m_acquireCmdBuf};
+  NVVK_CHECK(vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, m_acquireFence));
+  m_acquireSubmitted = true;
+
+  blas = std::move(m_blas);
+  m_blas.clear();
+  tlas   = m_tlas;
+  m_tlas = DynamicTlas();  // `tlas` owns its resources now
+  if(stats != nullptr)
+  {
+    *stats = m_stats;
+  }
+  m_instances.clear();
+  m_state = State::eIdle;
+}
+
+void AsyncAsBuilder::cmdTransferOwnership(VkCommandBuffer cmdBuf, bool release)
+{
+  // Within one queue family, the semaphore is all the synchronization needed
+  if(m_computeFamily == m_graphicsFamily)
+  {
+    return;
+  }
+
+  // Scratch buffers aren't transferred, since their contents don't need to be kept
+  std::vector<VkBuffer> buffers = m_tlas.getPersistentBuffers();
+  for(const nvvk::AccelKHR& accel : m_blas)
+  {
+    buffers.push_back(accel.buffer.buffer);
+  }
+  std::vector<VkBufferMemoryBarrier> barriers;
+  for(VkBuffer buffer : buffers)
+  {
+    barriers.push_back({.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                        .srcAccessMask = release ? VkAccessFlags(VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR) : 0,
+                        .dstAccessMask =
+                            release ? 0 : VkAccessFlags(VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR),
+                        .srcQueueFamilyIndex = m_computeFamily,
+                        .dstQueueFamilyIndex = m_graphicsFamily,
+                        .buffer              = buffer,
+                        .offset              = 0,
+                        .size                = VK_WHOLE_SIZE});
+  }
+  const VkPipelineStageFlags asStages =
+      VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+  vkCmdPipelineBarrier(cmdBuf, release ? VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       release ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : asStages, 0, 0, nullptr,
+                       static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+}
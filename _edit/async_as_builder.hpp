@@ -0,0 +1,100 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Builds a new set of acceleration structures for a scene (compacted BLASes
+// and a DynamicTlas) on an async compute queue, while the current ones keep
+// being traced on the graphics queue.
+// The build is a sequence of small submissions: the build and compaction of
+// each BLAS batch, then the TLAS. poll() never waits; it checks the fence of
+// the last submission and records the next one, so the application calls it
+// once per frame and presentation never stalls on the build. The final
+// submission releases the new structures to the graphics queue family and
+// signals a semaphore, and acquire() submits the matching acquire to the
+// graphics queue, waiting on that semaphore. The caller then swaps the new
+// structures in and retires the old ones once the frames using them are done.
+// Build inputs (vertex and index buffers) must be readable by the compute
+// queue family, e.g. through concurrent sharing.
+#ifndef VK_MINI_PATH_TRACER_ASYNC_AS_BUILDER_HPP
+#define VK_MINI_PATH_TRACER_ASYNC_AS_BUILDER_HPP
+
+#include <vector>
+
+#include "blas_builder.hpp"
+#include "dynamic_tlas.hpp"
+
+class AsyncAsBuilder
+{
+public:
+  // `computeQueue` may be the graphics queue itself, in which case the build
+  // is still spread over frames but shares the queue with rendering.
+  void init(nvvk::ResourceAllocator* alloc,
+            uint32_t                 computeQueueFamily,
+            VkQueue                  computeQueue,
+            uint32_t                 graphicsQueueFamily,
+            VkQueue                  graphicsQueue);
+  // Waits for the build in progress, if any, and destroys what it made.
+  void deinit();
+
+  // Starts building one BLAS per input, then a TLAS of `instances`, whose
+  // accelerationStructureReference is the index of their BLAS in `blasInputs`.
+  // Returns false if a build is already in progress.
+  bool start(const std::vector<nvvk::RaytracingBuilderKHR::BlasInput>& blasInputs,
+             VkBuildAccelerationStructureFlagsKHR                      blasFlags,
+             VkDeviceSize                                              blasBuildBudget,
+             const std::vector<VkAccelerationStructureInstanceKHR>&    instances,
+             uint32_t                                                  numFramesInFlight,
+             VkDeviceSize                                              scratchAlignment);
+  // Submits the next step of the build if the previous one has finished.
+  // Returns true once the new structures can be acquired.
+  bool poll();
+  // Hands the new structures over to the graphics queue; work submitted to it
+  // afterwards can use them. Only valid after poll() returned true.
+  void acquire(std::vector<nvvk::AccelKHR>& blas, DynamicTlas& tlas, BlasBuildStats* stats = nullptr);
+
+  bool     isBuilding() const { return m_state != State::eIdle; }
+  uint32_t getQueueFamily() const { return m_computeFamily; }
+
+private:
+  enum class State
+  {
+    eIdle,
+    eBuildBatch,    // Next: build a BLAS batch, or the TLAS once all are done
+    eCompactBatch,  // Next: compact the batch that was built
+    eFinishBatch,   // Next: free the uncompacted batch
+    eBuildTlas,     // The TLAS build and the release are in flight
+    eReady          // Waiting for acquire()
+  };
+
+  // Ends and submits m_cmdBuf, signaling m_fence, and `signalSemaphore` unless it's null
+  void submit(VkSemaphore signalSemaphore);
+  void recordNextBuild();
+  // Ownership transfer barriers for the new structures
+  void cmdTransferOwnership(VkCommandBuffer cmdBuf, bool release);
+
+  nvvk::ResourceAllocator* m_alloc = nullptr;
+  VkDevice                 m_device{VK_NULL_HANDLE};
+  uint32_t                 m_computeFamily  = 0;
+  uint32_t                 m_graphicsFamily = 0;
+  VkQueue                  m_computeQueue{VK_NULL_HANDLE};
+  VkQueue                  m_graphicsQueue{VK_NULL_HANDLE};
+  VkCommandPool            m_computePool{VK_NULL_HANDLE};
+  VkCommandPool            m_graphicsPool{VK_NULL_HANDLE};
+  VkCommandBuffer          m_cmdBuf{VK_NULL_HANDLE};         // On the compute queue
+  VkCommandBuffer          m_acquireCmdBuf{VK_NULL_HANDLE};  // On the graphics queue
+  VkFence                  m_fence{VK_NULL_HANDLE};          // Signaled by m_cmdBuf
+  VkFence                  m_acquireFence{VK_NULL_HANDLE};   // Signaled by m_acquireCmdBuf
+  VkSemaphore              m_semaphore{VK_NULL_HANDLE};      // From the release to the acquire
+  bool                     m_submitted        = false;       // Whether m_fence is pending
+  bool                     m_acquireSubmitted = false;       // Whether m_acquireFence is pending
+
+  State                                           m_state = State::eIdle;
+  BlasBatchBuilder                                m_blasBuilder;
+  std::vector<nvvk::AccelKHR>                     m_blas;
+  DynamicTlas                                     m_tlas;
+  std::vector<VkAccelerationStructureInstanceKHR> m_instances;
+  uint32_t                                        m_numFramesInFlight = 1;
+  VkDeviceSize                                    m_scratchAlignment  = 1;
+  BlasBuildStats                                  m_stats;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_ASYNC_AS_BUILDER_HPP
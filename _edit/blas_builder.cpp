@@ -0,0 +1,241 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "blas_builder.hpp"
+
+#include <algorithm>
+
+#include <nvvk/buffers_vk.hpp>  // For nvvk::getBufferDeviceAddress
+#include <nvvk/error_vk.hpp>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void BlasBatchBuilder::init(nvvk::ResourceAllocator*                                  alloc,
+                            const std::vector<nvvk::RaytracingBuilderKHR::BlasInput>& inputs,
+                            VkBuildAccelerationStructureFlagsKHR                      flags,
+                            VkDeviceSize                                              budget,
+                            VkDeviceSize                                              scratchAlignment)
+{
+  const uint32_t count = static_cast<uint32_t>(inputs.size());
+  m_alloc              = alloc;
+  m_device             = alloc->getDevice();
+  m_inputs             = inputs;
+  m_budget             = budget;
+  m_scratchAlignment   = std::max<VkDeviceSize>(scratchAlignment, 1);
+  m_stats              = {.numBlas = count};
+  m_begin              = 0;
+  m_batchCount         = 0;
+  m_blas.assign(count, {});
+
+  // Get the size of each BLAS and of its scratch memory
+  m_buildInfos.resize(count);
+  m_sizeInfos.resize(count);
+  for(uint32_t i = 0; i < count; i++)
+  {
+    const nvvk::RaytracingBuilderKHR::BlasInput& input = m_inputs[i];
+    m_buildInfos[i] = {.sType         = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+                       .type          = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+                       .flags         = input.flags | flags | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR,
+                       .mode          = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+                       .geometryCount = static_cast<uint32_t>(input.asGeometry.size()),
+                       .pGeometries   = input.asGeometry.data()};
+    std::vector<uint32_t> maxPrimitiveCounts;
+    for(const VkAccelerationStructureBuildRangeInfoKHR& range : input.asBuildOffsetInfo)
+    {
+      maxPrimitiveCounts.push_back(range.primitiveCount);
+    }
+    m_sizeInfos[i] = {.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+    vkGetAccelerationStructureBuildSizesKHR(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &m_buildInfos[i],
+                                            maxPrimitiveCounts.data(), &m_sizeInfos[i]);
+  }
+
+  // One compacted size query per BLAS of a batch
+  if(count > 0)
+  {
+    const VkQueryPoolCreateInfo queryPoolInfo{.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                                              .queryType  = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+                                              .queryCount = count};
+    NVVK_CHECK(vkCreateQueryPool(m_device, &queryPoolInfo, nullptr, &m_queryPool));
+  }
+}
+
+void BlasBatchBuilder::deinit()
+{
+  if(m_alloc == nullptr)
+  {
+    return;
+  }
+  for(nvvk::AccelKHR& accel : m_uncompacted)
+  {
+    if(accel.accel != VK_NULL_HANDLE)
+    {
+      m_alloc->destroy(accel);
+    }
+  }
+  m_uncompacted.clear();
+  if(m_scratchBuffer.buffer != VK_NULL_HANDLE)
+  {
+    m_alloc->destroy(m_scratchBuffer);
+  }
+  for(nvvk::AccelKHR& accel : m_blas)
+  {
+    if(accel.accel != VK_NULL_HANDLE)
+    {
+      m_alloc->destroy(accel);
+    }
+  }
+  m_blas.clear();
+  if(m_queryPool != VK_NULL_HANDLE)
+  {
+    vkDestroyQueryPool(m_device, m_queryPool, nullptr);
+    m_queryPool = VK_NULL_HANDLE;
+  }
+  m_inputs.clear();
+  m_alloc = nullptr;
+}
+
+void BlasBatchBuilder::cmdBuildBatch(VkCommandBuffer cmdBuf)
+{
+  // Add BLASes to the batch while they fit in the budget; a batch always
+  // has at least one BLAS, even if that one doesn't fit.
+  const uint32_t            count       = static_cast<uint32_t>(m_inputs.size());
+  uint32_t                  end         = m_begin;
+  VkDeviceSize              batchSize   = 0;
+  VkDeviceSize              scratchSize = 0;
+  std::vector<VkDeviceSize> scratchOffsets;
+  while(end < count)
+  {
+    const VkDeviceSize blasScratchSize = alignUp(m_sizeInfos[end].buildScratchSize, m_scratchAlignment);
+    if(end > m_begin && batchSize + scratchSize + m_sizeInfos[end].accelerationStructureSize + blasScratchSize > m_budget)
+    {
+      break;
+    }
+    scratchOffsets.push_back(scratchSize);
+    batchSize += m_sizeInfos[end].accelerationStructureSize;
+    scratchSize += blasScratchSize;
+    end++;
+  }
+  m_batchCount = end - m_begin;
+
+  // The batch shares one scratch buffer; its start is aligned by hand,
+  // since the allocator doesn't know about the scratch alignment.
+  m_scratchBuffer = m_alloc->createBuffer(scratchSize + m_scratchAlignment,
+                                          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  const VkDeviceAddress scratchAddress = alignUp(nvvk::getBufferDeviceAddress(m_device, m_scratchBuffer.buffer), m_scratchAlignment);
+
+  m_uncompacted.assign(m_batchCount, {});
+  std::vector<VkAccelerationStructureKHR>                      uncompactedHandles(m_batchCount);
+  std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos(m_batchCount);
+  for(uint32_t j = 0; j < m_batchCount; j++)
+  {
+    const uint32_t                       i = m_begin + j;
+    VkAccelerationStructureCreateInfoKHR createInfo{.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+                                                    .size  = m_sizeInfos[i].accelerationStructureSize,
+                                                    .type  = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR};
+    m_uncompacted[j]                          = m_alloc->createAcceleration(createInfo);
+    uncompactedHandles[j]                     = m_uncompacted[j].accel;
+    m_buildInfos[i].dstAccelerationStructure  = m_uncompacted[j].accel;
+    m_buildInfos[i].scratchData.deviceAddress = scratchAddress + scratchOffsets[j];
+    rangeInfos[j]                             = m_inputs[i].asBuildOffsetInfo.data();
+  }
+
+  // Build the whole batch at once, then query the compacted sizes
+  vkCmdResetQueryPool(cmdBuf, m_queryPool, 0, m_batchCount);
+  vkCmdBuildAccelerationStructuresKHR(cmdBuf, m_batchCount, &m_buildInfos[m_begin], rangeInfos.data());
+  const VkMemoryBarrier barrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                                .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR};
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+  vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuf, m_batchCount, uncompactedHandles.data(),
+                                                VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, m_queryPool, 0);
+}
+
+void BlasBatchBuilder::cmdCompactBatch(VkCommandBuffer cmdBuf)
+{
+  std::vector<VkDeviceSize> compactSizes(m_batchCount);
+  NVVK_CHECK(vkGetQueryPoolResults(m_device, m_queryPool, 0, m_batchCount, m_batchCount * sizeof(VkDeviceSize),
+                                   compactSizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+  // Copy each BLAS into one of its compacted size
+  for(uint32_t j = 0; j < m_batchCount; j++)
+  {
+    const uint32_t i = m_begin + j;
+    m_stats.originalSize += m_sizeInfos[i].accelerationStructureSize;
+    // BLASes that can be updated are kept at full size, since they're
+    // periodically rebuilt in place
+    if(m_buildInfos[i].flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)
+    {
+      m_blas[i]        = m_uncompacted[j];
+      m_uncompacted[j] = {};
+      m_stats.compactSize += m_sizeInfos[i].accelerationStructureSize;
+      continue;
+    }
+    VkAccelerationStructureCreateInfoKHR createInfo{.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+                                                    .size  = compactSizes[j],
+                                                    .type  = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR};
+    m_blas[i] = m_alloc->createAcceleration(createInfo);
+    const VkCopyAccelerationStructureInfoKHR copyInfo{.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+                                                      .src   = m_uncompacted[j].accel,
+                                                      .dst   = m_blas[i].accel,
+                                                      .mode  = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR};
+    vkCmdCopyAccelerationStructureKHR(cmdBuf, &copyInfo);
+    m_stats.compactSize += compactSizes[j];
+  }
+}
+
+void BlasBatchBuilder::finishBatch()
+{
+  for(nvvk::AccelKHR& accel : m_uncompacted)
+  {
+    if(accel.accel != VK_NULL_HANDLE)
+    {
+      m_alloc->destroy(accel);
+    }
+  }
+  m_uncompacted.clear();
+  m_alloc->destroy(m_scratchBuffer);
+  m_scratchBuffer = {};
+  m_stats.numBatches++;
+  m_begin += m_batchCount;
+  m_batchCount = 0;
+}
+
+std::vector<nvvk::AccelKHR> BlasBatchBuilder::takeBlas()
+{
+  std::vector<nvvk::AccelKHR> blas = std::move(m_blas);
+  m_blas.clear();
+  return blas;
+}
+
+std::vector<nvvk::AccelKHR> buildBlasBatched(nvvk::ResourceAllocator&                                  alloc,
+                                             nvvk::CommandPool&                                        cmdPool,
+                                             const std::vector<nvvk::RaytracingBuilderKHR::BlasInput>& inputs,
+                                             VkBuildAccelerationStructureFlagsKHR                      flags,
+                                             VkDeviceSize                                              budget,
+                                             VkDeviceSize                                              scratchAlignment,
+                                             BlasBuildStats*                                           stats)
+{
+  BlasBatchBuilder builder;
+  builder.init(&alloc, inputs, flags, budget, scratchAlignment);
+  while(!builder.isDone())
+  {
+    VkCommandBuffer cmdBuf = cmdPool.createCommandBuffer();
+    builder.cmdBuildBatch(cmdBuf);
+    cmdPool.submitAndWait(cmdBuf);
+    cmdBuf = cmdPool.createCommandBuffer();
+    builder.cmdCompactBatch(cmdBuf);
+    cmdPool.submitAndWait(cmdBuf);
+    builder.finishBatch();
+  }
+
+  if(stats != nullptr)
+  {
+    *stats = builder.getStats();
+  }
+  std::vector<nvvk::AccelKHR> blas = builder.takeBlas();
+  builder.deinit();
+  return blas;
+}
@@ -0,0 +1,93 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Builds the bottom-level acceleration structures of a whole scene in
+// batches, compacting each batch before building the next one.
+// A batch holds as many BLASes as fit in a memory budget, counting both their
+// uncompacted sizes and their scratch memory. All BLASes of a batch are
+// built with a single vkCmdBuildAccelerationStructuresKHR call, so the
+// driver can build them in parallel; once the batch is done, each BLAS is
+// copied into a buffer of its compacted size and the uncompacted one is
+// freed. Peak memory is therefore the compacted size of the scene plus one
+// batch, instead of the uncompacted size of the scene.
+// BlasBatchBuilder records the steps of each batch without waiting, so that
+// they can be submitted and polled for asynchronously; buildBlasBatched()
+// runs all of them at once.
+#ifndef VK_MINI_PATH_TRACER_BLAS_BUILDER_HPP
+#define VK_MINI_PATH_TRACER_BLAS_BUILDER_HPP
+
+#include <vector>
+
+#include <nvvk/commands_vk.hpp>
+#include <nvvk/raytraceKHR_vk.hpp>  // For nvvk::RaytracingBuilderKHR::BlasInput
+#include <nvvk/resourceallocator_vk.hpp>
+
+struct BlasBuildStats
+{
+  uint32_t     numBlas      = 0;
+  uint32_t     numBatches   = 0;
+  VkDeviceSize originalSize = 0;  // Sum of the uncompacted sizes
+  VkDeviceSize compactSize  = 0;  // Sum of the compacted sizes
+};
+
+class BlasBatchBuilder
+{
+public:
+  // See buildBlasBatched() for the parameters. `inputs` are copied.
+  void init(nvvk::ResourceAllocator*                                  alloc,
+            const std::vector<nvvk::RaytracingBuilderKHR::BlasInput>& inputs,
+            VkBuildAccelerationStructureFlagsKHR                      flags,
+            VkDeviceSize                                              budget,
+            VkDeviceSize                                              scratchAlignment);
+  // Destroys the BLASes that weren't taken, and any batch in progress.
+  void deinit();
+
+  // Whether all batches have been built and compacted
+  bool isDone() const { return m_begin == m_inputs.size() && m_batchCount == 0; }
+
+  // Each batch is recorded in three steps, each of which must wait until the
+  // command buffer of the previous one has finished executing:
+  // builds the next batch and queries its compacted sizes,
+  void cmdBuildBatch(VkCommandBuffer cmdBuf);
+  // copies the batch into BLASes of their compacted sizes,
+  void cmdCompactBatch(VkCommandBuffer cmdBuf);
+  // and frees the uncompacted BLASes and the scratch memory.
+  void finishBatch();
+
+  // The BLASes, in the order of the inputs, once isDone()
+  std::vector<nvvk::AccelKHR> takeBlas();
+  const BlasBuildStats&       getStats() const { return m_stats; }
+
+private:
+  nvvk::ResourceAllocator*                                 m_alloc = nullptr;
+  VkDevice                                                 m_device{VK_NULL_HANDLE};
+  std::vector<nvvk::RaytracingBuilderKHR::BlasInput>       m_inputs;
+  std::vector<VkAccelerationStructureBuildGeometryInfoKHR> m_buildInfos;
+  std::vector<VkAccelerationStructureBuildSizesInfoKHR>    m_sizeInfos;
+  std::vector<nvvk::AccelKHR>                              m_blas;
+  VkDeviceSize                                             m_budget           = 0;
+  VkDeviceSize                                             m_scratchAlignment = 1;
+  VkQueryPool                                              m_queryPool{VK_NULL_HANDLE};
+  BlasBuildStats                                           m_stats;
+
+  // The batch in progress: inputs [m_begin, m_begin + m_batchCount)
+  uint32_t                    m_begin      = 0;
+  uint32_t                    m_batchCount = 0;
+  std::vector<nvvk::AccelKHR> m_uncompacted;
+  nvvk::Buffer                m_scratchBuffer;
+};
+
+// Builds one BLAS per input, with VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR
+// added to `flags`. Inputs whose flags include ALLOW_UPDATE aren't compacted,
+// so that they can be rebuilt in place. `scratchAlignment` is
+// VkPhysicalDeviceAccelerationStructurePropertiesKHR::minAccelerationStructureScratchOffsetAlignment.
+// Command buffers come from `cmdPool`, and each batch is waited for.
+std::vector<nvvk::AccelKHR> buildBlasBatched(nvvk::ResourceAllocator&                                  alloc,
+                                             nvvk::CommandPool&                                        cmdPool,
+                                             const std::vector<nvvk::RaytracingBuilderKHR::BlasInput>& inputs,
+                                             VkBuildAccelerationStructureFlagsKHR                      flags,
+                                             VkDeviceSize                                              budget,
+                                             VkDeviceSize                                              scratchAlignment,
+                                             BlasBuildStats*                                           stats = nullptr);
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_BLAS_BUILDER_HPP
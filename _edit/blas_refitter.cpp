@@ -0,0 +1,184 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "blas_refitter.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <nvvk/buffers_vk.hpp>  // For nvvk::getBufferDeviceAddress
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void BlasRefitter::init(nvvk::ResourceAllocator*  alloc,
+                        const std::vector<Entry>& entries,
+                        uint32_t                  numFramesInFlight,
+                        VkDeviceSize              scratchAlignment,
+                        VkDeviceSize              stagingSizePerFrame)
+{
+  m_alloc          = alloc;
+  m_device         = alloc->getDevice();
+  scratchAlignment = std::max<VkDeviceSize>(scratchAlignment, 1);
+
+  // Each BLAS gets its own part of the scratch buffer, large enough for both
+  // refits and rebuilds, so that all of them can be refit at once.
+  VkDeviceSize scratchSize = 0;
+  m_blas.clear();
+  m_indices.clear();
+  for(const Entry& entry : entries)
+  {
+    std::vector<uint32_t> maxPrimitiveCounts;
+    for(const VkAccelerationStructureBuildRangeInfoKHR& range : entry.input.asBuildOffsetInfo)
+    {
+      maxPrimitiveCounts.push_back(range.primitiveCount);
+    }
+    const VkAccelerationStructureBuildGeometryInfoKHR buildInfo{
+        .sType         = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type          = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .flags         = entry.flags,
+        .mode          = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+        .geometryCount = static_cast<uint32_t>(entry.input.asGeometry.size()),
+        .pGeometries   = entry.input.asGeometry.data()};
+    VkAccelerationStructureBuildSizesInfoKHR sizeInfo{.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+    vkGetAccelerationStructureBuildSizesKHR(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo,
+                                            maxPrimitiveCounts.data(), &sizeInfo);
+
+    m_indices[entry.id] = static_cast<uint32_t>(m_blas.size());
+    m_blas.push_back({.entry = entry, .scratchOffset = scratchSize});
+    scratchSize += alignUp(std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize), scratchAlignment);
+  }
+  if(!m_blas.empty())
+  {
+    m_scratchBuffer = m_alloc->createBuffer(scratchSize + scratchAlignment,
+                                            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    m_scratchAddress = alignUp(nvvk::getBufferDeviceAddress(m_device, m_scratchBuffer.buffer), scratchAlignment);
+  }
+
+  m_staging.resize(std::max(numFramesInFlight, 1u));
+  for(FrameStaging& staging : m_staging)
+  {
+    staging.buffer = m_alloc->createBuffer(stagingSizePerFrame, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    staging.mapped = static_cast<uint8_t*>(m_alloc->map(staging.buffer));
+    staging.used   = 0;
+  }
+}
+
+void BlasRefitter::deinit()
+{
+  if(m_alloc == nullptr)
+  {
+    return;
+  }
+  for(FrameStaging& staging : m_staging)
+  {
+    m_alloc->unmap(staging.buffer);
+    m_alloc->destroy(staging.buffer);
+  }
+  m_staging.clear();
+  if(!m_blas.empty())
+  {
+    m_alloc->destroy(m_scratchBuffer);
+  }
+  m_blas.clear();
+  m_indices.clear();
+  m_alloc = nullptr;
+}
+
+bool BlasRefitter::updateVertices(uint32_t frameIndex, uint32_t id, VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+  FrameStaging& staging = m_staging[frameIndex % m_staging.size()];
+  if(staging.used + size > staging.buffer.bufferSize)
+  {
+    return false;
+  }
+  memcpy(staging.mapped + staging.used, data, size_t(size));
+  staging.copies.push_back({dst, {.srcOffset = staging.used, .dstOffset = dstOffset, .size = size}});
+  staging.used = alignUp(staging.used + size, 16);
+  markDeformed(id);
+  return true;
+}
+
+void BlasRefitter::markDeformed(uint32_t id)
+{
+  m_blas[m_indices.at(id)].dirty = true;
+}
+
+std::vector<uint32_t> BlasRefitter::cmdRefit(VkCommandBuffer cmdBuf, uint32_t frameIndex)
+{
+  std::vector<uint32_t> refitIds;
+  FrameStaging&         staging = m_staging[frameIndex % m_staging.size()];
+
+  if(!staging.copies.empty())
+  {
+    // Earlier frames may still draw or trace the old vertices
+    vkCmdPipelineBarrier(cmdBuf,
+                         VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+                             | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+    for(const PendingCopy& copy : staging.copies)
+    {
+      vkCmdCopyBuffer(cmdBuf, staging.buffer.buffer, copy.dst, 1, &copy.region);
+    }
+    staging.copies.clear();
+  }
+  staging.used = 0;
+
+  std::vector<VkAccelerationStructureBuildGeometryInfoKHR>     buildInfos;
+  std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos;
+  for(Blas& blas : m_blas)
+  {
+    if(!blas.dirty)
+    {
+      continue;
+    }
+    const bool rebuild = blas.refits >= m_refitsBeforeRebuild;
+    buildInfos.push_back({.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+                          .type  = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+                          .flags = blas.entry.flags,
+                          .mode  = rebuild ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR,
+                          .srcAccelerationStructure = rebuild ? VK_NULL_HANDLE : blas.entry.accel,
+                          .dstAccelerationStructure = blas.entry.accel,
+                          .geometryCount            = static_cast<uint32_t>(blas.entry.input.asGeometry.size()),
+                          .pGeometries              = blas.entry.input.asGeometry.data(),
+                          .scratchData              = {.deviceAddress = m_scratchAddress + blas.scratchOffset}});
+    rangeInfos.push_back(blas.entry.input.asBuildOffsetInfo.data());
+    blas.refits = rebuild ? 0 : blas.refits + 1;
+    blas.dirty  = false;
+    refitIds.push_back(blas.entry.id);
+  }
+  if(buildInfos.empty())
+  {
+    return refitIds;
+  }
+
+  // The new vertices (copied above or written by compute shaders) must be
+  // visible to the builds, and the previous frames' rays and builds must be
+  // done with the BLASes.
+  const VkMemoryBarrier beforeBuild{
+      .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR};
+  vkCmdPipelineBarrier(cmdBuf,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                           | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &beforeBuild, 0, nullptr, 0, nullptr);
+
+  vkCmdBuildAccelerationStructuresKHR(cmdBuf, static_cast<uint32_t>(buildInfos.size()), buildInfos.data(), rangeInfos.data());
+
+  // The TLAS update and the rays read the BLASes; drawing and shading read the vertices.
+  const VkMemoryBarrier afterBuild{
+      .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+      .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT
+                       | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR};
+  vkCmdPipelineBarrier(cmdBuf,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                           | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+                           | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       0, 1, &afterBuild, 0, nullptr, 0, nullptr);
+  return refitIds;
+}
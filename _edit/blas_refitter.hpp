@@ -0,0 +1,86 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Refits the BLASes of deforming meshes after their vertices change.
+// New vertex data either comes from the host, through a persistently mapped
+// staging buffer per frame in flight, or is written by the application on
+// the GPU (e.g. by a skinning compute shader) before cmdRefit() is recorded.
+// Only the BLASes whose vertices changed are refit
+// (VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR), and only the changed
+// vertex ranges are copied, so the cost of a frame scales with what moved.
+// Refitting keeps the topology of the last build, which degrades as the mesh
+// deforms, so each BLAS is rebuilt in place after a number of refits.
+// The BLASes must have been built with ALLOW_UPDATE and not compacted.
+#ifndef VK_MINI_PATH_TRACER_BLAS_REFITTER_HPP
+#define VK_MINI_PATH_TRACER_BLAS_REFITTER_HPP
+
+#include <unordered_map>
+#include <vector>
+
+#include <nvvk/raytraceKHR_vk.hpp>  // For nvvk::RaytracingBuilderKHR::BlasInput
+#include <nvvk/resourceallocator_vk.hpp>
+
+class BlasRefitter
+{
+public:
+  struct Entry
+  {
+    uint32_t                              id    = 0;               // Chosen by the caller, e.g. the model index
+    VkAccelerationStructureKHR            accel = VK_NULL_HANDLE;  // Built from `input` with ALLOW_UPDATE
+    nvvk::RaytracingBuilderKHR::BlasInput input;                   // Its geometry, which stays valid
+    VkBuildAccelerationStructureFlagsKHR  flags = 0;               // Flags it was built with
+  };
+
+  void init(nvvk::ResourceAllocator*  alloc,
+            const std::vector<Entry>& entries,
+            uint32_t                  numFramesInFlight,
+            VkDeviceSize              scratchAlignment,
+            VkDeviceSize              stagingSizePerFrame = VkDeviceSize(16) << 20);
+  void deinit();
+  bool contains(uint32_t id) const { return m_indices.count(id) != 0; }
+
+  // Copies `size` bytes of `data` to `dstOffset` in `dst`, which holds the
+  // vertices of BLAS `id`, as part of frame `frameIndex`. That frame's fence
+  // must have been waited on. Returns false if the frame's staging memory is full.
+  bool updateVertices(uint32_t frameIndex, uint32_t id, VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+  // Marks BLAS `id` as changed by GPU writes that are recorded before cmdRefit().
+  void markDeformed(uint32_t id);
+
+  // Records the vertex copies of frame `frameIndex` and the refits of all
+  // changed BLASes, with the barriers around them. Returns the ids of the
+  // BLASes that were refit, so that the TLAS can be updated too.
+  std::vector<uint32_t> cmdRefit(VkCommandBuffer cmdBuf, uint32_t frameIndex);
+
+  uint32_t m_refitsBeforeRebuild = 16;  // A BLAS is rebuilt instead of refit after this many refits
+
+private:
+  struct Blas
+  {
+    Entry        entry;
+    VkDeviceSize scratchOffset = 0;
+    uint32_t     refits        = 0;
+    bool         dirty         = false;
+  };
+  struct PendingCopy
+  {
+    VkBuffer     dst;
+    VkBufferCopy region;
+  };
+  struct FrameStaging
+  {
+    nvvk::Buffer             buffer;
+    uint8_t*                 mapped = nullptr;
+    VkDeviceSize             used   = 0;
+    std::vector<PendingCopy> copies;
+  };
+
+  nvvk::ResourceAllocator*               m_alloc = nullptr;
+  VkDevice                               m_device{VK_NULL_HANDLE};
+  std::vector<Blas>                      m_blas;
+  std::unordered_map<uint32_t, uint32_t> m_indices;  // From ids to m_blas indices
+  std::vector<FrameStaging>              m_staging;
+  nvvk::Buffer                           m_scratchBuffer;
+  VkDeviceAddress                        m_scratchAddress = 0;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_BLAS_REFITTER_HPP
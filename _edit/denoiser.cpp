@@ -0,0 +1,141 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "denoiser.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include <nvvk/images_vk.hpp>
+#include <nvvk/shaders_vk.hpp>
+
+namespace {
+constexpr uint32_t k_workgroupSize = 16;  // local_size_x and _y of denoise.comp.glsl
+
+// Bindings of denoise.comp.glsl
+enum DenoiseBindings : uint32_t
+{
+  eInput       = 0,
+  eOutput      = 1,
+  eAlbedo      = 2,
+  eNormalDepth = 3
+};
+
+constexpr int k_firstIteration = 1;  // Demodulates the albedo out of the input
+constexpr int k_lastIteration  = 2;  // Modulates it back into the output
+}  // namespace
+
+void Denoiser::init(nvvk::ResourceAllocator* alloc, const std::string& spirv, VkPipelineCache pipelineCache)
+{
+  m_device = alloc->getDevice();
+
+  m_bindings.addBinding(eInput, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_bindings.addBinding(eOutput, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_bindings.addBinding(eAlbedo, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_bindings.addBinding(eNormalDepth, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_setLayout = m_bindings.createLayout(m_device);
+  m_pool      = m_bindings.createPool(m_device, static_cast<uint32_t>(m_sets.size()));
+  for(VkDescriptorSet& set : m_sets)
+  {
+    set = nvvk::allocateDescriptorSet(m_device, m_pool, m_setLayout);
+  }
+
+  const VkPushConstantRange        pushConstantRange{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants)};
+  const VkPipelineLayoutCreateInfo layoutInfo{.sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                                              .setLayoutCount         = 1,
+                                              .pSetLayouts            = &m_setLayout,
+                                              .pushConstantRangeCount = 1,
+                                              .pPushConstantRanges    = &pushConstantRange};
+  vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_pipelineLayout);
+
+  VkShaderModule                    module = nvvk::createShaderModule(m_device, spirv);
+  const VkComputePipelineCreateInfo pipelineInfo{.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+                                                 .stage  = {.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                                                            .stage  = VK_SHADER_STAGE_COMPUTE_BIT,
+                                                            .module = module,
+                                                            .pName  = "main"},
+                                                 .layout = m_pipelineLayout};
+  vkCreateComputePipelines(m_device, pipelineCache, 1, &pipelineInfo, nullptr, &m_pipeline);
+  vkDestroyShaderModule(m_device, module, nullptr);
+}
+
+void Denoiser::deinit()
+{
+  if(m_device == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  vkDestroyPipeline(m_device, m_pipeline, nullptr);
+  vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+  vkDestroyDescriptorPool(m_device, m_pool, nullptr);
+  vkDestroyDescriptorSetLayout(m_device, m_setLayout, nullptr);
+  m_pipeline       = VK_NULL_HANDLE;
+  m_pipelineLayout = VK_NULL_HANDLE;
+  m_pool           = VK_NULL_HANDLE;
+  m_setLayout      = VK_NULL_HANDLE;
+  m_bindings.clear();
+  m_device = VK_NULL_HANDLE;
+}
+
+VkImageCreateInfo Denoiser::makeImageCreateInfo(VkExtent2D size)
+{
+  return nvvk::makeImage2DCreateInfo(size, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT);
+}
+
+void Denoiser::setImages(VkExtent2D size, VkImageView color, VkImageView albedo, VkImageView normalDepth, VkImageView ping, VkImageView pong)
+{
+  m_size = size;
+  const VkDescriptorImageInfo colorInfo{VK_NULL_HANDLE, color, VK_IMAGE_LAYOUT_GENERAL};
+  const VkDescriptorImageInfo albedoInfo{VK_NULL_HANDLE, albedo, VK_IMAGE_LAYOUT_GENERAL};
+  const VkDescriptorImageInfo normalDepthInfo{VK_NULL_HANDLE, normalDepth, VK_IMAGE_LAYOUT_GENERAL};
+  const VkDescriptorImageInfo pingInfo{VK_NULL_HANDLE, ping, VK_IMAGE_LAYOUT_GENERAL};
+  const VkDescriptorImageInfo pongInfo{VK_NULL_HANDLE, pong, VK_IMAGE_LAYOUT_GENERAL};
+  const std::array<std::array<const VkDescriptorImageInfo*, 2>, 4> inputsOutputs{{{&colorInfo, &pingInfo},  //
+                                                                                  {&colorInfo, &pongInfo},
+                                                                                  {&pingInfo, &pongInfo},
+                                                                                  {&pongInfo, &pingInfo}}};
+  std::vector<VkWriteDescriptorSet> writes;
+  for(size_t i = 0; i < m_sets.size(); i++)
+  {
+    writes.push_back(m_bindings.makeWrite(m_sets[i], eInput, inputsOutputs[i][0]));
+    writes.push_back(m_bindings.makeWrite(m_sets[i], eOutput, inputsOutputs[i][1]));
+    writes.push_back(m_bindings.makeWrite(m_sets[i], eAlbedo, &albedoInfo));
+    writes.push_back(m_bindings.makeWrite(m_sets[i], eNormalDepth, &normalDepthInfo));
+  }
+  vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void Denoiser::cmdDenoise(VkCommandBuffer cmdBuf)
+{
+  // The next iteration reads what the one before wrote, and overwrites what it read
+  const VkMemoryBarrier2 barrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                                 .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                                 .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                                 .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                                 .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT};
+  const VkDependencyInfo betweenIterations{.sType              = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                                           .memoryBarrierCount = 1,
+                                           .pMemoryBarriers    = &barrier};
+
+  vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+  const int iterations = std::max(m_settings.iterations, 1);
+  for(int i = 0; i < iterations; i++)
+  {
+    if(i > 0)
+    {
+      vkCmdPipelineBarrier2(cmdBuf, &betweenIterations);
+    }
+
+    const bool            toPing = (iterations - 1 - i) % 2 == 0;
+    const VkDescriptorSet set    = m_sets[i == 0 ? (toPing ? 0 : 1) : (toPing ? 3 : 2)];
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &set, 0, nullptr);
+
+    PushConstants pushConstants{.stepWidth = 1 << i,
+                                .colorPhi  = m_settings.colorPhi / float(1 << i),
+                                .normalPhi = m_settings.normalPhi,
+                                .depthPhi  = m_settings.depthPhi,
+                                .flags     = (i == 0 ? k_firstIteration : 0) | (i == iterations - 1 ? k_lastIteration : 0)};
+    vkCmdPushConstants(cmdBuf, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+    vkCmdDispatch(cmdBuf, (m_size.width + k_workgroupSize - 1) / k_workgroupSize,
+                  (m_size.height + k_workgroupSize - 1) / k_workgroupSize, 1);
+  }
+}
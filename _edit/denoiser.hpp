@@ -0,0 +1,81 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// An edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) for the
+// accumulated output of the path tracer, so that previews at a few samples
+// per pixel are usable.
+// Each iteration is a 5x5 B3-spline blur in a compute shader, with its taps
+// spread twice as far apart as in the iteration before, so a few iterations
+// cover a large footprint at 25 taps per pixel each. Taps are weighted down
+// where the normal, the depth or the color of the pixel differ from those of
+// the center, which keeps edges and shadow boundaries sharp. The filter runs
+// on irradiance (the color divided by the albedo of the first hit) and the
+// albedo is multiplied back at the end, so that textures don't get blurred.
+// The iterations ping-pong between two images of the caller, which only hold
+// data during cmdDenoise, so they can share memory with other passes'.
+#ifndef VK_MINI_PATH_TRACER_DENOISER_HPP
+#define VK_MINI_PATH_TRACER_DENOISER_HPP
+
+#include <array>
+#include <string>
+
+#include <nvvk/descriptorsets_vk.hpp>
+#include <nvvk/resourceallocator_vk.hpp>
+
+class Denoiser
+{
+public:
+  struct Settings
+  {
+    int   iterations = 5;     // At least 1; the footprint is 4 * (2^iterations - 1) + 1 pixels wide
+    float colorPhi   = 0.6f;  // Larger blurs across more different colors; halved every iteration
+    float normalPhi  = 64.f;  // Exponent of the cosine between normals; larger keeps more edges
+    float depthPhi   = 0.1f;  // Larger blurs across larger depth differences, per pixel of distance
+  };
+
+  // `spirv` is the code of shaders/denoise.comp.glsl
+  void init(nvvk::ResourceAllocator* alloc, const std::string& spirv, VkPipelineCache pipelineCache = VK_NULL_HANDLE);
+  void deinit();
+
+  // The images the iterations ping-pong between are created with this
+  static VkImageCreateInfo makeImageCreateInfo(VkExtent2D size);
+
+  // Points the denoiser at the images to read, all in VK_IMAGE_LAYOUT_GENERAL:
+  // the noisy color, the albedo of the first hit, and its normal (xyz) and
+  // distance (w); and at the images of the iterations, of
+  // makeImageCreateInfo(size). The denoised image is written to `ping`.
+  void setImages(VkExtent2D size, VkImageView color, VkImageView albedo, VkImageView normalDepth, VkImageView ping, VkImageView pong);
+
+  // Records the iterations, with barriers between them. The caller orders
+  // them after the writes of the inputs, and the reads of the result after
+  // them, e.g. with its RenderGraph.
+  void cmdDenoise(VkCommandBuffer cmdBuf);
+
+  Settings m_settings;
+
+private:
+  // Must match the push constants of denoise.comp.glsl
+  struct PushConstants
+  {
+    int   stepWidth;
+    float colorPhi;
+    float normalPhi;
+    float depthPhi;
+    int   flags;  // First / last iteration, see denoise.comp.glsl
+  };
+
+  VkDevice   m_device{VK_NULL_HANDLE};
+  VkExtent2D m_size{0, 0};
+
+  nvvk::DescriptorSetBindings m_bindings;
+  VkDescriptorSetLayout       m_setLayout{VK_NULL_HANDLE};
+  VkDescriptorPool            m_pool{VK_NULL_HANDLE};
+  // Input to ping, input to pong, ping to pong and pong to ping. The last
+  // iteration always writes to ping, so that it's the output however many
+  // iterations there are.
+  std::array<VkDescriptorSet, 4> m_sets{};
+  VkPipelineLayout               m_pipelineLayout{VK_NULL_HANDLE};
+  VkPipeline                     m_pipeline{VK_NULL_HANDLE};
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_DENOISER_HPP
@@ -0,0 +1,191 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "dynamic_tlas.hpp"
+
+#include <algorithm>
+
+#include <nvvk/buffers_vk.hpp>  // For nvvk::getBufferDeviceAddress
+
+void DynamicTlas::init(nvvk::ResourceAllocator*                               alloc,
+                       VkCommandBuffer                                        cmdBuf,
+                       const std::vector<VkAccelerationStructureInstanceKHR>& instances,
+                       uint32_t                                               numFramesInFlight,
+                       VkDeviceSize                                           scratchAlignment,
+                       VkBuildAccelerationStructureFlagsKHR                   flags)
+{
+  m_alloc            = alloc;
+  m_device           = alloc->getDevice();
+  m_flags            = flags | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+  m_instances        = instances;
+  m_numCopies        = std::clamp(numFramesInFlight, 1u, 32u);  // One bit per copy in m_pendingMask
+  m_scratchAlignment = std::max<VkDeviceSize>(scratchAlignment, 1);
+  m_pendingWrites.assign(m_numCopies, {});
+  m_pendingMask.assign(m_instances.size(), 0);
+  m_changed          = false;
+  m_refitsSinceBuild = 0;
+  m_movesSinceBuild  = 0;
+
+  // Every copy starts out with all instances
+  const size_t instanceCount = m_instances.size();
+  m_instanceBuffer =
+      m_alloc->createBuffer(std::max<VkDeviceSize>(instanceCount * m_numCopies * sizeof(VkAccelerationStructureInstanceKHR), 1),
+                            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  m_instanceAddress = nvvk::getBufferDeviceAddress(m_device, m_instanceBuffer.buffer);
+  m_mappedInstances = static_cast<VkAccelerationStructureInstanceKHR*>(m_alloc->map(m_instanceBuffer));
+  for(uint32_t copy = 0; copy < m_numCopies; copy++)
+  {
+    std::copy(m_instances.begin(), m_instances.end(), m_mappedInstances + copy * instanceCount);
+  }
+
+  // The TLAS is sized for its instance count once; refits and rebuilds reuse it and its scratch buffer.
+  VkAccelerationStructureGeometryKHR geometry{.sType        = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+                                              .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+                                              .geometry     = {.instances = {.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR}}};
+  const VkAccelerationStructureBuildGeometryInfoKHR buildInfo{.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+                                                              .type  = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+                                                              .flags = m_flags,
+                                                              .mode  = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+                                                              .geometryCount = 1,
+                                                              .pGeometries   = &geometry};
+  const uint32_t                           maxInstanceCount = static_cast<uint32_t>(instanceCount);
+  VkAccelerationStructureBuildSizesInfoKHR sizeInfo{.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+  vkGetAccelerationStructureBuildSizesKHR(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo,
+                                          &maxInstanceCount, &sizeInfo);
+
+  VkAccelerationStructureCreateInfoKHR createInfo{.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+                                                  .size  = sizeInfo.accelerationStructureSize,
+                                                  .type  = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR};
+  m_tlas = m_alloc->createAcceleration(createInfo);
+  m_scratchBuffer =
+      m_alloc->createBuffer(std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize) + m_scratchAlignment,
+                            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+  cmdBuild(cmdBuf, 0, VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
+}
+
+void DynamicTlas::deinit()
+{
+  if(m_alloc == nullptr)
+  {
+    return;
+  }
+  m_alloc->unmap(m_instanceBuffer);
+  m_alloc->destroy(m_instanceBuffer);
+  m_alloc->destroy(m_scratchBuffer);
+  m_alloc->destroy(m_tlas);
+  m_mappedInstances = nullptr;
+  m_instances.clear();
+  m_pendingWrites.clear();
+  m_pendingMask.clear();
+  m_alloc = nullptr;
+}
+
+void DynamicTlas::setTransform(uint32_t instanceIndex, const VkTransformMatrixKHR& transform)
+{
+  m_instances[instanceIndex].transform = transform;
+  markDirty(instanceIndex);
+}
+
+void DynamicTlas::setInstance(uint32_t instanceIndex, const VkAccelerationStructureInstanceKHR& instance)
+{
+  m_instances[instanceIndex] = instance;
+  markDirty(instanceIndex);
+}
+
+void DynamicTlas::markDirty(uint32_t instanceIndex)
+{
+  m_changed = true;
+  m_movesSinceBuild++;
+  for(uint32_t copy = 0; copy < m_numCopies; copy++)
+  {
+    const uint32_t bit = 1u << copy;
+    if((m_pendingMask[instanceIndex] & bit) == 0)
+    {
+      m_pendingMask[instanceIndex] |= bit;
+      m_pendingWrites[copy].push_back(instanceIndex);
+    }
+  }
+}
+
+bool DynamicTlas::cmdUpdate(VkCommandBuffer cmdBuf, uint32_t frameIndex)
+{
+  // The fence of this frame has been waited on, so the GPU is done with its
+  // copy; catch it up on everything that changed since it was last used.
+  const uint32_t                      copy      = frameIndex % m_numCopies;
+  const uint32_t                      bit       = 1u << copy;
+  VkAccelerationStructureInstanceKHR* copyStart = m_mappedInstances + size_t(copy) * m_instances.size();
+  for(uint32_t instanceIndex : m_pendingWrites[copy])
+  {
+    copyStart[instanceIndex] = m_instances[instanceIndex];
+    m_pendingMask[instanceIndex] &= ~bit;
+  }
+  m_pendingWrites[copy].clear();
+
+  if(!m_changed)
+  {
+    return false;
+  }
+
+  const bool rebuild = (m_refitsSinceBuild >= m_maxRefitsBeforeRebuild)
+                       || (double(m_movesSinceBuild) >= double(m_maxMovesBeforeRebuild) * double(m_instances.size()));
+  if(rebuild)
+  {
+    cmdBuild(cmdBuf, copy, VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
+  }
+  else
+  {
+    cmdBuild(cmdBuf, copy, VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR);
+    m_refitsSinceBuild++;
+  }
+  m_changed = false;
+  return true;
+}
+
+void DynamicTlas::cmdBuild(VkCommandBuffer cmdBuf, uint32_t copyIndex, VkBuildAccelerationStructureModeKHR mode)
+{
+  if(mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR)
+  {
+    m_refitsSinceBuild = 0;
+    m_movesSinceBuild  = 0;
+  }
+
+  const VkDeviceAddress instancesAddress =
+      m_instanceAddress + VkDeviceSize(copyIndex) * m_instances.size() * sizeof(VkAccelerationStructureInstanceKHR);
+  VkAccelerationStructureGeometryKHR geometry{
+      .sType        = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+      .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+      .geometry     = {.instances = {.sType           = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+                                     .arrayOfPointers = VK_FALSE,
+                                     .data            = {.deviceAddress = instancesAddress}}}};
+  const VkDeviceAddress scratchAddress =
+      (nvvk::getBufferDeviceAddress(m_device, m_scratchBuffer.buffer) + m_scratchAlignment - 1) / m_scratchAlignment * m_scratchAlignment;
+  const VkAccelerationStructureBuildGeometryInfoKHR buildInfo{
+      .sType                    = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+      .type                     = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+      .flags                    = m_flags,
+      .mode                     = mode,
+      .srcAccelerationStructure = (mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR) ? m_tlas.accel : VK_NULL_HANDLE,
+      .dstAccelerationStructure = m_tlas.accel,
+      .geometryCount            = 1,
+      .pGeometries              = &geometry,
+      .scratchData              = {.deviceAddress = scratchAddress}};
+  const VkAccelerationStructureBuildRangeInfoKHR  rangeInfo{.primitiveCount = static_cast<uint32_t>(m_instances.size())};
+  const VkAccelerationStructureBuildRangeInfoKHR* pRangeInfo = &rangeInfo;
+
+  // The previous frames' rays, and the previous build (which used the same
+  // scratch buffer), must be done with the TLAS before it's rewritten.
+  const VkMemoryBarrier beforeBuild{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                    .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                                    .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR};
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &beforeBuild, 0, nullptr, 0, nullptr);
+
+  vkCmdBuildAccelerationStructuresKHR(cmdBuf, 1, &buildInfo, &pRangeInfo);
+
+  const VkMemoryBarrier afterBuild{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                   .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                                   .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR};
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &afterBuild, 0, nullptr, 0, nullptr);
+}
@@ -0,0 +1,80 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// A top-level acceleration structure whose instances can move every frame.
+// Instances live in a persistently mapped, host-visible buffer with one copy
+// per frame in flight, so the host never writes a copy the GPU may still be
+// reading. Changing an instance only marks it dirty; when a frame records its
+// update, only the instances that changed since that frame's copy was last
+// used are written, and the TLAS is refit in place
+// (VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR).
+// Refitting keeps the tree topology of the last full build, so its quality
+// drops as instances move away from where they were; the TLAS is rebuilt
+// from scratch after a number of refits, or once the instances have moved
+// about as much as a whole new scene would.
+#ifndef VK_MINI_PATH_TRACER_DYNAMIC_TLAS_HPP
+#define VK_MINI_PATH_TRACER_DYNAMIC_TLAS_HPP
+
+#include <vector>
+
+#include <nvvk/resourceallocator_vk.hpp>
+
+class DynamicTlas
+{
+public:
+  // Builds the TLAS from `instances` on `cmdBuf`, which must have been executed
+  // before the first call to cmdUpdate(). The number of instances is fixed.
+  void init(nvvk::ResourceAllocator*                               alloc,
+            VkCommandBuffer                                        cmdBuf,
+            const std::vector<VkAccelerationStructureInstanceKHR>& instances,
+            uint32_t                                               numFramesInFlight,
+            VkDeviceSize                                           scratchAlignment,
+            VkBuildAccelerationStructureFlagsKHR                   flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+  void deinit();
+
+  void setTransform(uint32_t instanceIndex, const VkTransformMatrixKHR& transform);
+  void setInstance(uint32_t instanceIndex, const VkAccelerationStructureInstanceKHR& instance);
+  // Requests a refit because BLASes changed in place (e.g. refit after their
+  // vertices moved); the instances themselves stay the same.
+  void markBlasChanged() { m_changed = true; }
+
+  // Writes the dirty instances of frame `frameIndex`'s copy and records a
+  // refit or rebuild of the TLAS, with barriers against the ray tracing of
+  // previous frames and the one after. Returns false, and records nothing, if
+  // no instance changed since the last call.
+  bool cmdUpdate(VkCommandBuffer cmdBuf, uint32_t frameIndex);
+
+  VkAccelerationStructureKHR getAccelerationStructure() const { return m_tlas.accel; }
+  // The buffers whose contents are kept between updates, e.g. for queue family ownership transfers
+  std::vector<VkBuffer> getPersistentBuffers() const { return {m_tlas.buffer.buffer, m_instanceBuffer.buffer}; }
+
+  // Heuristic for rebuilding instead of refitting
+  uint32_t m_maxRefitsBeforeRebuild = 256;  // Rebuild after this many refits in a row...
+  float    m_maxMovesBeforeRebuild  = 1.0f;  // ... or once this many moves per instance have happened since the last build
+
+private:
+  void markDirty(uint32_t instanceIndex);
+  void cmdBuild(VkCommandBuffer cmdBuf, uint32_t copyIndex, VkBuildAccelerationStructureModeKHR mode);
+
+  nvvk::ResourceAllocator*                        m_alloc = nullptr;
+  VkDevice                                        m_device{VK_NULL_HANDLE};
+  VkBuildAccelerationStructureFlagsKHR            m_flags = 0;
+  std::vector<VkAccelerationStructureInstanceKHR> m_instances;  // Current state of all instances
+
+  // One copy of the instances per frame in flight, one after the other in m_instanceBuffer
+  nvvk::Buffer                        m_instanceBuffer;
+  VkDeviceAddress                     m_instanceAddress = 0;
+  VkAccelerationStructureInstanceKHR* m_mappedInstances = nullptr;
+  uint32_t                            m_numCopies       = 0;
+  std::vector<std::vector<uint32_t>>  m_pendingWrites;    // Per copy, the instances it's missing changes of
+  std::vector<uint32_t>               m_pendingMask;      // Per instance, bit c is set if it's in m_pendingWrites[c]
+  bool                                m_changed = false;  // Whether an instance changed since the last update
+
+  nvvk::AccelKHR m_tlas;
+  nvvk::Buffer   m_scratchBuffer;
+  VkDeviceSize   m_scratchAlignment = 1;
+  uint32_t       m_refitsSinceBuild = 0;
+  uint64_t       m_movesSinceBuild  = 0;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_DYNAMIC_TLAS_HPP
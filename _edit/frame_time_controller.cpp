@@ -0,0 +1,149 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "frame_time_controller.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <nvvk/error_vk.hpp>
+
+namespace {
+// Weight of the newest frame in the smoothed times. Frames are measured a few
+// frames after they're recorded, so reacting fully to each one would oscillate.
+constexpr float k_smoothing = 0.2f;
+// The samples per frame grow by at most this factor per frame, so that a
+// frame that happened to be fast doesn't overshoot the budget
+constexpr float k_maxGrowth = 1.5f;
+}  // namespace
+
+void FrameTimeController::init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t numFramesInFlight)
+{
+  m_device = device;
+  m_frames.assign(std::max(numFramesInFlight, 1u), FrameQueries{});
+  m_samples     = m_settings.minSamples;
+  m_msPerSample = 0.f;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+  const uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+  if(validBits == 0)
+  {
+    return;
+  }
+  m_timestampPeriod = properties.limits.timestampPeriod;
+  m_timestampMask   = validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+
+  const VkQueryPoolCreateInfo queryPoolInfo{.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                                            .queryType  = VK_QUERY_TYPE_TIMESTAMP,
+                                            .queryCount = static_cast<uint32_t>(m_frames.size()) * eTimestampCount};
+  NVVK_CHECK(vkCreateQueryPool(m_device, &queryPoolInfo, nullptr, &m_queryPool));
+}
+
+void FrameTimeController::deinit()
+{
+  if(m_queryPool != VK_NULL_HANDLE)
+  {
+    vkDestroyQueryPool(m_device, m_queryPool, nullptr);
+    m_queryPool = VK_NULL_HANDLE;
+  }
+  m_frames.clear();
+  m_device = VK_NULL_HANDLE;
+}
+
+void FrameTimeController::cmdBeginFrame(VkCommandBuffer cmdBuf, uint32_t frameIndex)
+{
+  if(m_queryPool == VK_NULL_HANDLE)
+  {
+    m_samples = m_settings.minSamples;
+    return;
+  }
+  m_frameIndex         = frameIndex % static_cast<uint32_t>(m_frames.size());
+  FrameQueries&  frame = m_frames[m_frameIndex];
+  const uint32_t first = m_frameIndex * eTimestampCount;
+  if(frame.written)
+  {
+    // Without VK_QUERY_RESULT_WAIT_BIT; after the fence, the results are there
+    uint64_t timestamps[eTimestampCount];
+    if(vkGetQueryPoolResults(m_device, m_queryPool, first, eTimestampCount, sizeof(timestamps), timestamps,
+                             sizeof(uint64_t), VK_QUERY_RESULT_64_BIT)
+       == VK_SUCCESS)
+    {
+      update(timestamps, frame.samples);
+    }
+  }
+
+  if(!m_settings.enabled || m_msPerSample <= 0.f)
+  {
+    m_samples = m_settings.minSamples;
+  }
+  else
+  {
+    const float budgetMs = m_settings.targetMs - m_otherMs;
+    const int   fitting  = static_cast<int>(std::floor(budgetMs / m_msPerSample));
+    const int   maxGrown = std::max(static_cast<int>(std::floor(m_samples * k_maxGrowth)), m_samples + 1);
+    m_samples = std::clamp(std::min(fitting, maxGrown), m_settings.minSamples, std::max(m_settings.maxSamples, m_settings.minSamples));
+  }
+
+  vkCmdResetQueryPool(cmdBuf, m_queryPool, first, eTimestampCount);
+  vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPool, first + eFrameStart);
+  frame.written = true;
+  frame.samples = 0;
+}
+
+void FrameTimeController::cmdBeginTrace(VkCommandBuffer cmdBuf, int samples)
+{
+  if(m_queryPool == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  m_frames[m_frameIndex].samples = samples;
+  // Once everything before it is done, so the ray tracing doesn't overlap what's measured as the rest of the frame
+  vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, m_frameIndex * eTimestampCount + eTraceStart);
+}
+
+void FrameTimeController::cmdEndTrace(VkCommandBuffer cmdBuf)
+{
+  if(m_queryPool == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, m_frameIndex * eTimestampCount + eTraceEnd);
+}
+
+void FrameTimeController::cmdEndFrame(VkCommandBuffer cmdBuf)
+{
+  if(m_queryPool == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  const uint32_t first = m_frameIndex * eTimestampCount;
+  // Frames that don't ray trace still need all of their queries written to read them back
+  if(m_frames[m_frameIndex].samples == 0)
+  {
+    vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, first + eTraceStart);
+    vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, first + eTraceEnd);
+  }
+  vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, first + eFrameEnd);
+}
+
+void FrameTimeController::update(const uint64_t (&timestamps)[eTimestampCount], int samples)
+{
+  const auto elapsedMs = [&](Timestamp from, Timestamp to) {
+    const uint64_t ticks = (timestamps[to] - timestamps[from]) & m_timestampMask;
+    return static_cast<float>(static_cast<double>(ticks) * m_timestampPeriod * 1e-6);
+  };
+  const float frameMs = elapsedMs(eFrameStart, eFrameEnd);
+  const float traceMs = samples > 0 ? elapsedMs(eTraceStart, eTraceEnd) : 0.f;
+  const auto  smooth  = [](float& average, float value) { average = (average == 0.f) ? value : average + k_smoothing * (value - average); };
+  smooth(m_frameMs, frameMs);
+  smooth(m_otherMs, std::max(frameMs - traceMs, 0.f));
+  if(samples > 0)
+  {
+    smooth(m_traceMs, traceMs);
+    smooth(m_msPerSample, traceMs / static_cast<float>(samples));
+  }
+}
@@ -0,0 +1,87 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Picks how many paths per pixel the viewer traces each frame, so that the
+// GPU time of a frame stays within a budget: one sample per frame on a GPU
+// that can barely hold the target frame rate, more on one with headroom, so
+// that the image converges faster there.
+// Each frame writes timestamps at its start and end and around the ray
+// tracing. Once its fence has been waited on, the next use of the same frame
+// reads them back; the time per sample of the ray tracing and the time of
+// everything else are smoothed over frames, and the next frame gets as many
+// samples as fit into what the rest of the frame leaves of the budget.
+#ifndef VK_MINI_PATH_TRACER_FRAME_TIME_CONTROLLER_HPP
+#define VK_MINI_PATH_TRACER_FRAME_TIME_CONTROLLER_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+class FrameTimeController
+{
+public:
+  struct Settings
+  {
+    bool  enabled    = true;           // Otherwise, every frame traces minSamples
+    float targetMs   = 1000.f / 60.f;  // GPU time of a whole frame
+    int   minSamples = 1;
+    int   maxSamples = 16;
+  };
+
+  // Timestamps are written on `queueFamily`. Without timestamp support there,
+  // every frame traces minSamples.
+  void init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t numFramesInFlight);
+  void deinit();
+
+  // Reads back what frame `frameIndex` measured when it last ran (its fence
+  // must have been waited on), picks the samples of this frame, and writes
+  // its first timestamp. Call first in the command buffer.
+  void cmdBeginFrame(VkCommandBuffer cmdBuf, uint32_t frameIndex);
+  // Around the ray tracing of this frame, which traces `samples` per pixel
+  void cmdBeginTrace(VkCommandBuffer cmdBuf, int samples);
+  void cmdEndTrace(VkCommandBuffer cmdBuf);
+  // Call last in the command buffer
+  void cmdEndFrame(VkCommandBuffer cmdBuf);
+
+  int   getSamplesPerFrame() const { return m_samples; }
+  float getFrameMs() const { return m_frameMs; }  // Smoothed GPU time of a frame
+  float getTraceMs() const { return m_traceMs; }  // ... and of its ray tracing
+
+  Settings m_settings;
+
+private:
+  enum Timestamp : uint32_t
+  {
+    eFrameStart,
+    eTraceStart,
+    eTraceEnd,
+    eFrameEnd,
+    eTimestampCount
+  };
+
+  // What each frame in flight recorded the last time it ran
+  struct FrameQueries
+  {
+    bool written = false;  // The frame was recorded, so its queries have results
+    int  samples = 0;      // Samples per pixel it traced; 0 if it didn't ray trace
+  };
+
+  void update(const uint64_t (&timestamps)[eTimestampCount], int samples);
+
+  VkDevice    m_device{VK_NULL_HANDLE};
+  VkQueryPool m_queryPool{VK_NULL_HANDLE};
+  float       m_timestampPeriod = 0.f;  // Nanoseconds per tick
+  uint64_t    m_timestampMask   = 0;    // Of the valid bits of the queue family
+
+  std::vector<FrameQueries> m_frames;
+  uint32_t                  m_frameIndex = 0;  // Of the frame being recorded
+
+  int   m_samples     = 1;
+  float m_frameMs     = 0.f;
+  float m_traceMs     = 0.f;
+  float m_msPerSample = 0.f;  // 0 until the first frame that ray traced
+  float m_otherMs     = 0.f;  // Of the frame, outside of the ray tracing
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_FRAME_TIME_CONTROLLER_HPP
@@ -0,0 +1,121 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "geometry_arena.hpp"
+
+#include <algorithm>
+
+#include <nvh/nvprint.hpp>
+#include <nvvk/buffers_vk.hpp>  // For nvvk::getBufferDeviceAddress
+
+namespace {
+VkDeviceSize alignUp(VkDeviceSize size, VkDeviceSize alignment)
+{
+  return (size + alignment - 1) / alignment * alignment;
+}
+}  // namespace
+
+void GeometryArena::init(nvvk::ResourceAllocator* alloc, StreamingUploader* uploader, VkBufferUsageFlags usage, VkDeviceSize blockSize)
+{
+  m_alloc          = alloc;
+  m_uploader       = uploader;
+  m_usage          = usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+  m_blockSize      = alignUp(blockSize, k_alignment);
+  m_bytesAllocated = 0;
+}
+
+void GeometryArena::deinit()
+{
+  for(Block& block : m_blocks)
+  {
+    m_alloc->destroy(block.buffer);
+  }
+  m_blocks.clear();
+  m_bytesAllocated = 0;
+  m_alloc          = nullptr;
+  m_uploader       = nullptr;
+}
+
+GeometryArena::Allocation GeometryArena::allocate(VkDeviceSize size)
+{
+  size = alignUp(std::max<VkDeviceSize>(size, 1), k_alignment);
+  Allocation allocation;
+  for(uint32_t i = 0; i < static_cast<uint32_t>(m_blocks.size()); i++)
+  {
+    if(allocateFrom(i, size, allocation))
+    {
+      return allocation;
+    }
+  }
+
+  Block block;
+  block.size          = std::max(size, m_blockSize);
+  block.buffer        = m_uploader->createBuffer(block.size, nullptr, m_usage);
+  block.address       = nvvk::getBufferDeviceAddress(m_alloc->getDevice(), block.buffer.buffer);
+  block.freeRanges[0] = block.size;
+  m_blocks.push_back(std::move(block));
+  if(!allocateFrom(static_cast<uint32_t>(m_blocks.size()) - 1, size, allocation))
+  {
+    LOGE("Could not allocate %llu bytes of geometry\n", static_cast<unsigned long long>(size));
+  }
+  return allocation;
+}
+
+bool GeometryArena::allocateFrom(uint32_t blockIndex, VkDeviceSize size, Allocation& allocation)
+{
+  std::map<VkDeviceSize, VkDeviceSize>& freeRanges = m_blocks[blockIndex].freeRanges;
+  for(auto it = freeRanges.begin(); it != freeRanges.end(); ++it)
+  {
+    if(it->second < size)
+    {
+      continue;
+    }
+    allocation = {.block = blockIndex, .offset = it->first, .size = size};
+    const VkDeviceSize rest = it->second - size;
+    freeRanges.erase(it);
+    if(rest > 0)
+    {
+      freeRanges[allocation.offset + size] = rest;
+    }
+    m_bytesAllocated += size;
+    return true;
+  }
+  return false;
+}
+
+void GeometryArena::free(Allocation& allocation)
+{
+  if(allocation.block == ~0u)
+  {
+    return;
+  }
+  std::map<VkDeviceSize, VkDeviceSize>& freeRanges = m_blocks[allocation.block].freeRanges;
+  auto it = freeRanges.emplace(allocation.offset, allocation.size).first;
+  // Merge with the free ranges right after and right before it
+  auto next = std::next(it);
+  if(next != freeRanges.end() && it->first + it->second == next->first)
+  {
+    it->second += next->second;
+    freeRanges.erase(next);
+  }
+  if(it != freeRanges.begin())
+  {
+    auto prev = std::prev(it);
+    if(prev->first + prev->second == it->first)
+    {
+      prev->second += it->second;
+      freeRanges.erase(it);
+    }
+  }
+  m_bytesAllocated -= allocation.size;
+  allocation = {};
+}
+
+VkDeviceSize GeometryArena::getCapacity() const
+{
+  VkDeviceSize capacity = 0;
+  for(const Block& block : m_blocks)
+  {
+    capacity += block.size;
+  }
+  return capacity;
+}
@@ -0,0 +1,76 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Suballocates the geometry and material arrays of all models from a few large
+// device buffers ("blocks"), instead of creating buffers one by one per model.
+// Each model gets one range, which holds all of its arrays at offsets; the
+// shaders reach them from one base address per model, and the rasterizer
+// and acceleration structure builds from the block's buffer and the offsets.
+// Freed ranges go on a per-block free list, merged with their free
+// neighbours, and are reused first-fit by later allocations. A range larger
+// than the block size gets a block of its own.
+// Blocks are created through the StreamingUploader, so that they are shared
+// with the queue families it uploads on and builds acceleration structures on,
+// and filled with StreamingUploader::upload().
+#ifndef VK_MINI_PATH_TRACER_GEOMETRY_ARENA_HPP
+#define VK_MINI_PATH_TRACER_GEOMETRY_ARENA_HPP
+
+#include <map>
+#include <vector>
+
+#include <nvvk/resourceallocator_vk.hpp>
+
+#include "streaming_uploader.hpp"
+
+class GeometryArena
+{
+public:
+  // Ranges start at multiples of this, which covers the alignment of buffer
+  // references and of acceleration structure build inputs
+  static constexpr VkDeviceSize k_alignment = 256;
+
+  struct Allocation
+  {
+    uint32_t     block  = ~0u;  // ~0u if nothing is allocated
+    VkDeviceSize offset = 0;    // In the block's buffer
+    VkDeviceSize size   = 0;
+  };
+
+  void init(nvvk::ResourceAllocator* alloc, StreamingUploader* uploader, VkBufferUsageFlags usage,
+            VkDeviceSize blockSize = VkDeviceSize(64) << 20);
+  // All allocations must have been freed, or are freed with the blocks
+  void deinit();
+
+  // Returns a range of at least `size` bytes, creating a block if none has room
+  Allocation allocate(VkDeviceSize size);
+  void       free(Allocation& allocation);
+
+  VkBuffer        getBuffer(const Allocation& allocation) const { return m_blocks[allocation.block].buffer.buffer; }
+  VkDeviceAddress getAddress(const Allocation& allocation) const
+  {
+    return m_blocks[allocation.block].address + allocation.offset;
+  }
+
+  VkDeviceSize getBytesAllocated() const { return m_bytesAllocated; }
+  VkDeviceSize getCapacity() const;
+
+private:
+  struct Block
+  {
+    nvvk::Buffer                         buffer;
+    VkDeviceAddress                      address = 0;
+    VkDeviceSize                         size    = 0;
+    std::map<VkDeviceSize, VkDeviceSize> freeRanges;  // Offset -> size, of the ranges not in use
+  };
+
+  bool allocateFrom(uint32_t blockIndex, VkDeviceSize size, Allocation& allocation);
+
+  nvvk::ResourceAllocator* m_alloc          = nullptr;
+  StreamingUploader*       m_uploader       = nullptr;
+  VkBufferUsageFlags       m_usage          = 0;
+  VkDeviceSize             m_blockSize      = 0;
+  VkDeviceSize             m_bytesAllocated = 0;
+  std::vector<Block>       m_blocks;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_GEOMETRY_ARENA_HPP
@@ -0,0 +1,196 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "light_bvh.hpp"
+
+#include <cstring>
+#include <limits>
+
+void LightBvh::init(nvvk::ResourceAllocator*      alloc,
+                    const std::vector<Light>&     lights,
+                    const std::vector<glm::mat4>& transforms,
+                    uint32_t                      numFramesInFlight,
+                    VkDeviceSize                  offsetAlignment)
+{
+  m_alloc      = alloc;
+  m_lights     = lights;
+  m_transforms = transforms;
+  m_numCopies  = std::max(numFramesInFlight, 1u);
+  m_version    = 0;
+  m_triangles.assign(m_lights.size(), EmissiveTriangle{});
+  m_nodes.clear();
+  for(size_t i = 0; i < m_lights.size(); i++)
+  {
+    m_triangles[i].emission = m_lights[i].emission;
+  }
+
+  // The tree is built over the lights where they are now, then gets its bounds
+  // and powers from the same refit as later moves
+  m_dirty = true;
+  refit();
+  if(!m_lights.empty())
+  {
+    std::vector<uint32_t> order(m_lights.size());
+    for(uint32_t i = 0; i < static_cast<uint32_t>(order.size()); i++)
+    {
+      order[i] = i;
+    }
+    m_nodes.emplace_back();
+    m_nodes[0].children = build(order, 0, order.size(), 0, 0);
+  }
+  m_dirty = true;
+  refit();
+
+  // Every copy starts out with the whole tree
+  const VkDeviceSize alignment = std::max<VkDeviceSize>(offsetAlignment, 1);
+  const auto         alignUp   = [alignment](VkDeviceSize size) { return (size + alignment - 1) / alignment * alignment; };
+  m_nodesOffset = alignUp(sizeof(LightsHeader) + m_triangles.size() * sizeof(EmissiveTriangle));
+  m_copyStride  = alignUp(m_nodesOffset + std::max<size_t>(m_nodes.size(), 1) * sizeof(LightBvhNode));
+  m_buffer      = m_alloc->createBuffer(m_copyStride * m_numCopies, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  m_mapped      = static_cast<uint8_t*>(m_alloc->map(m_buffer));
+  m_copyVersions.assign(m_numCopies, 0);
+  const LightsHeader header{static_cast<uint32_t>(m_triangles.size()), static_cast<uint32_t>(m_nodes.size())};
+  for(uint32_t copy = 0; copy < m_numCopies; copy++)
+  {
+    memcpy(m_mapped + copy * m_copyStride, &header, sizeof(LightsHeader));
+    writeCopy(copy);
+  }
+}
+
+void LightBvh::deinit()
+{
+  if(m_alloc == nullptr)
+  {
+    return;
+  }
+  m_alloc->unmap(m_buffer);
+  m_alloc->destroy(m_buffer);
+  m_mapped = nullptr;
+  m_lights.clear();
+  m_transforms.clear();
+  m_triangles.clear();
+  m_nodes.clear();
+  m_copyVersions.clear();
+  m_alloc = nullptr;
+}
+
+// Splits the lights order[begin, end) at the median of their centroids along
+// the longest axis of the centroid bounds, and returns the `children` field of
+// their node. Both children of a node are allocated together, after it, so
+// refit() can go through the nodes backwards.
+uint32_t LightBvh::build(std::vector<uint32_t>& order, size_t begin, size_t end, uint32_t depth, uint32_t trail)
+{
+  if(end - begin == 1)
+  {
+    m_triangles[order[begin]].bvhTrail = trail;
+    return k_leaf | order[begin];
+  }
+
+  const auto centroid = [this](uint32_t light) {
+    const EmissiveTriangle& t = m_triangles[light];
+    return (t.v0 + t.v1 + t.v2) / 3.0f;
+  };
+  glm::vec3 centroidMin(std::numeric_limits<float>::max());
+  glm::vec3 centroidMax(-std::numeric_limits<float>::max());
+  for(size_t i = begin; i < end; i++)
+  {
+    centroidMin = glm::min(centroidMin, centroid(order[i]));
+    centroidMax = glm::max(centroidMax, centroid(order[i]));
+  }
+  const glm::vec3 extent = centroidMax - centroidMin;
+  const int       axis   = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+  const size_t    middle = begin + (end - begin) / 2;
+  std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                   [&](uint32_t a, uint32_t b) { return centroid(a)[axis] < centroid(b)[axis]; });
+
+  // Median splits keep the depth at log2 of the light count, well within the 32 bits of a trail
+  const uint32_t left = static_cast<uint32_t>(m_nodes.size());
+  m_nodes.emplace_back();
+  m_nodes.emplace_back();
+  const uint32_t leftChildren  = build(order, begin, middle, depth + 1, trail);
+  const uint32_t rightChildren = build(order, middle, end, depth + 1, trail | (1u << depth));
+  m_nodes[left].children       = leftChildren;
+  m_nodes[left + 1].children   = rightChildren;
+  return left;
+}
+
+void LightBvh::setTransform(uint32_t instanceIndex, const glm::mat4& transform)
+{
+  if(instanceIndex < m_transforms.size() && m_transforms[instanceIndex] != transform)
+  {
+    m_transforms[instanceIndex] = transform;
+    m_dirty                     = true;
+  }
+}
+
+void LightBvh::refit()
+{
+  if(!m_dirty)
+  {
+    return;
+  }
+  for(size_t i = 0; i < m_lights.size(); i++)
+  {
+    const Light&     light     = m_lights[i];
+    const glm::mat4& transform = m_transforms[light.instanceIndex];
+    m_triangles[i].v0          = glm::vec3(transform * glm::vec4(light.v0, 1));
+    m_triangles[i].v1          = glm::vec3(transform * glm::vec4(light.v1, 1));
+    m_triangles[i].v2          = glm::vec3(transform * glm::vec4(light.v2, 1));
+  }
+
+  // Backwards, so that both children of a node are done before it
+  const auto leafNode = [this](uint32_t light) {
+    const EmissiveTriangle& t    = m_triangles[light];
+    const float             area = 0.5f * glm::length(glm::cross(t.v1 - t.v0, t.v2 - t.v0));
+    LightBvhNode            node{};
+    node.boundsMin = glm::min(t.v0, glm::min(t.v1, t.v2));
+    node.boundsMax = glm::max(t.v0, glm::max(t.v1, t.v2));
+    node.power     = glm::dot(t.emission, glm::vec3(0.2126f, 0.7152f, 0.0722f)) * area;
+    node.children  = k_leaf | light;
+    return node;
+  };
+  for(size_t n = m_nodes.size(); n-- > 0;)
+  {
+    LightBvhNode& node = m_nodes[n];
+    if(node.children & k_leaf)
+    {
+      node = leafNode(node.children & ~k_leaf);
+      continue;
+    }
+    const LightBvhNode& left  = m_nodes[node.children];
+    const LightBvhNode& right = m_nodes[node.children + 1];
+    node.boundsMin            = glm::min(left.boundsMin, right.boundsMin);
+    node.boundsMax            = glm::max(left.boundsMax, right.boundsMax);
+    node.power                = left.power + right.power;
+  }
+  m_dirty = false;
+  m_version++;
+}
+
+bool LightBvh::update(uint32_t frameIndex)
+{
+  if(m_alloc == nullptr)
+  {
+    return false;
+  }
+  const bool moved = m_dirty;
+  refit();
+  // The fence of this frame has been waited on, so the GPU is done with its copy
+  const uint32_t copy = frameIndex % m_numCopies;
+  if(m_copyVersions[copy] != m_version)
+  {
+    writeCopy(copy);
+  }
+  return moved;
+}
+
+void LightBvh::writeCopy(uint32_t copy)
+{
+  uint8_t* copyStart = m_mapped + copy * m_copyStride;
+  if(!m_triangles.empty())
+  {
+    memcpy(copyStart + sizeof(LightsHeader), m_triangles.data(), m_triangles.size() * sizeof(EmissiveTriangle));
+    memcpy(copyStart + m_nodesOffset, m_nodes.data(), m_nodes.size() * sizeof(LightBvhNode));
+  }
+  m_copyVersions[copy] = m_version;
+}
@@ -0,0 +1,118 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// A bounding volume hierarchy over the emissive triangles of a scene, which
+// the closest-hit shader walks to pick a light for next-event estimation.
+// Each node keeps the bounds and the power of the triangles below it; a
+// traversal picks either child with a probability given by its power over
+// its squared distance to the shaded point, so that bright, near lights are
+// sampled often and lights behind the surface never are, and reaches a single
+// triangle in O(log n) steps however many lights there are.
+// The tree is built once on the host, by median splits, and refit when the
+// instances holding the triangles move; refitting keeps the topology, so the
+// tree gets looser as instances move away from where they were built.
+// The triangles and nodes live in a persistently mapped, host-visible buffer
+// with one copy per frame in flight, which the shaders see through dynamic
+// storage buffer offsets.
+#ifndef VK_MINI_PATH_TRACER_LIGHT_BVH_HPP
+#define VK_MINI_PATH_TRACER_LIGHT_BVH_HPP
+
+#include <algorithm>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <nvvk/resourceallocator_vk.hpp>
+
+// Device layouts of the light buffers, see shaders/host_device.h
+
+// An emissive triangle of an instance, in world space. The lights buffer is a
+// LightsHeader followed by all of them, in the order they were loaded in.
+struct EmissiveTriangle
+{
+  glm::vec3 v0;
+  uint32_t  bvhTrail;  // Bit d is set if the leaf of the triangle is the right child at depth d
+  glm::vec3 v1;
+  glm::vec3 v2;
+  glm::vec3 emission;
+};
+
+struct LightsHeader
+{
+  uint32_t count;     // Number of emissive triangles
+  uint32_t numNodes;  // Number of nodes of the light BVH; node 0 is the root
+};
+
+// A node of the light BVH. Inner nodes have their two children next to each
+// other, at `children` and `children + 1`; leaves are a single triangle.
+struct LightBvhNode
+{
+  glm::vec3 boundsMin;
+  float     power;     // Sum of the luminance of the emission times the area of the triangles in the node
+  glm::vec3 boundsMax;
+  uint32_t  children;  // First child, or LIGHT_BVH_LEAF | the index of the triangle
+};
+
+class LightBvh
+{
+public:
+  static constexpr uint32_t k_leaf = 0x80000000u;  // LIGHT_BVH_LEAF of shaders/host_device.h
+
+  // An emissive triangle, in the object space of its instance
+  struct Light
+  {
+    glm::vec3 v0, v1, v2;
+    glm::vec3 emission;
+    uint32_t  instanceIndex = 0;
+  };
+
+  // Builds the tree over `lights`, placed with `transforms` (one per
+  // instance). `offsetAlignment` is minStorageBufferOffsetAlignment.
+  void init(nvvk::ResourceAllocator*      alloc,
+            const std::vector<Light>&     lights,
+            const std::vector<glm::mat4>& transforms,
+            uint32_t                      numFramesInFlight,
+            VkDeviceSize                  offsetAlignment);
+  void deinit();
+
+  // Moves the lights of an instance; the tree is refit by the next update()
+  void setTransform(uint32_t instanceIndex, const glm::mat4& transform);
+
+  // Refits the tree if an instance moved, and brings frame `frameIndex`'s
+  // copy up to date. The fence of that frame must have been waited on.
+  // Returns true if the lights moved since the last call.
+  bool update(uint32_t frameIndex);
+
+  uint32_t getLightCount() const { return static_cast<uint32_t>(m_lights.size()); }
+  // Descriptors of the LightsHeader and triangles, and of the nodes, of copy
+  // 0; bind them with getDynamicOffset() for the others
+  VkDescriptorBufferInfo getLightsDescriptor() const { return {m_buffer.buffer, 0, m_nodesOffset}; }
+  VkDescriptorBufferInfo getNodesDescriptor() const
+  {
+    return {m_buffer.buffer, m_nodesOffset, std::max<VkDeviceSize>(m_nodes.size() * sizeof(LightBvhNode), sizeof(LightBvhNode))};
+  }
+  uint32_t getDynamicOffset(uint32_t frameIndex) const { return static_cast<uint32_t>((frameIndex % m_numCopies) * m_copyStride); }
+  VkBuffer getBuffer() const { return m_buffer.buffer; }
+
+private:
+  uint32_t build(std::vector<uint32_t>& order, size_t begin, size_t end, uint32_t depth, uint32_t trail);
+  void     refit();
+  void     writeCopy(uint32_t copy);
+
+  nvvk::ResourceAllocator*      m_alloc = nullptr;
+  std::vector<Light>            m_lights;
+  std::vector<glm::mat4>        m_transforms;  // Per instance
+  std::vector<EmissiveTriangle> m_triangles;   // m_lights in world space
+  std::vector<LightBvhNode>     m_nodes;
+  bool                          m_dirty = false;  // Whether an instance moved since the last refit
+
+  // One copy of the header, triangles and nodes per frame in flight, one after the other in m_buffer
+  nvvk::Buffer          m_buffer;
+  uint8_t*              m_mapped      = nullptr;
+  uint32_t              m_numCopies   = 0;
+  VkDeviceSize          m_nodesOffset = 0;  // Of the nodes in a copy
+  VkDeviceSize          m_copyStride  = 0;
+  uint64_t              m_version     = 0;  // Incremented by each refit
+  std::vector<uint64_t> m_copyVersions;     // Per copy, the version it holds
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_LIGHT_BVH_HPP
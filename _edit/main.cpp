@@ -23,6 +23,7 @@
 // at the top of imgui.cpp.
 
 #include <array>
+#include <cfloat>
 
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include "backends/imgui_impl_glfw.h"
@@ -53,7 +54,7 @@ static void onErrorCallback(int error, const char* description)
 }
 
 // Extra UI
-void renderUI(PathTracerWindow& app)
+void renderUI(PathTracerWindow& app, bool& useDenoiser)
 {
   ImGuiH::CameraWidget();
   if(ImGui::CollapsingHeader("Light"))
@@ -65,6 +66,122 @@ void renderUI(PathTracerWindow& app)
     ImGui::SliderFloat3("Position", &app.m_pcRaster.lightPosition.x, -20.f, 20.f);
     ImGui::SliderFloat("Intensity", &app.m_pcRaster.lightIntensity, 0.f, 150.f);
   }
+  if(ImGui::CollapsingHeader("Denoiser"))
+  {
+    // Only filters the ray tracer, whose output has the guides
+    ImGui::Checkbox("Enabled", &useDenoiser);
+    ImGui::SliderInt("Iterations", &app.m_denoiser.m_settings.iterations, 1, 8);
+    ImGui::SliderFloat("Color phi", &app.m_denoiser.m_settings.colorPhi, 0.01f, 4.f);
+    ImGui::SliderFloat("Normal phi", &app.m_denoiser.m_settings.normalPhi, 1.f, 128.f);
+    ImGui::SliderFloat("Depth phi", &app.m_denoiser.m_settings.depthPhi, 0.001f, 1.f);
+  }
+  if(ImGui::CollapsingHeader("Exposure"))
+  {
+    // Auto-exposure follows the luminance histogram of the displayed image
+    bool autoExposure = app.m_pcPost.autoExposure != 0;
+    ImGui::Checkbox("Auto", &autoExposure);
+    app.m_pcPost.autoExposure = autoExposure ? 1 : 0;
+    ImGui::SliderFloat("Compensation (EV)", &app.m_pcPost.exposureCompensation, -8.f, 8.f);
+    ImGui::SliderFloat("Adaptation", &app.m_pcPost.adaptation, 0.001f, 1.f, "%.3f", ImGuiSliderFlags_Logarithmic);
+  }
+  if(ImGui::CollapsingHeader("Frame time"))
+  {
+    // More samples per frame while the GPU has time left, fewer when it doesn't
+    FrameTimeController::Settings& settings = app.m_frameTime.m_settings;
+    ImGui::Checkbox("Hold target", &settings.enabled);
+    ImGui::SliderFloat("Target (ms)", &settings.targetMs, 4.f, 100.f);
+    ImGui::SliderInt("Min samples", &settings.minSamples, 1, 64);
+    ImGui::SliderInt("Max samples", &settings.maxSamples, 1, 64);
+    ImGui::Text("GPU %.2f ms/frame, ray tracing %.2f ms, %d samples/frame", app.m_frameTime.getFrameMs(),
+                app.m_frameTime.getTraceMs(), app.m_frameTime.getSamplesPerFrame());
+  }
+  if(ImGui::CollapsingHeader("Profiler"))
+  {
+    // GPU passes average the last frames; the setup work on the host was measured once
+    if(ImGui::BeginTable("Sections", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp))
+    {
+      ImGui::TableSetupColumn("Section");
+      ImGui::TableSetupColumn("ms");
+      ImGui::TableSetupColumn("Max ms");
+      ImGui::TableSetupColumn("Invocations");
+      ImGui::TableHeadersRow();
+      for(const GpuProfiler::Result& result : app.m_profiler.getResults())
+      {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%s%s", result.name.c_str(), result.gpu ? "" : " (host)");
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", result.averageMs);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", result.maxMs);
+        ImGui::TableNextColumn();
+        if(result.hasStatistics && result.count > 0)
+        {
+          ImGui::Text("%llu", static_cast<unsigned long long>((result.computeInvocations + result.fragmentInvocations) / result.count));
+        }
+      }
+      ImGui::EndTable();
+    }
+    if(!app.m_profiler.hasStatistics())
+    {
+      ImGui::Text("No pipeline statistics on this device");
+    }
+    if(ImGui::Button("Save"))
+    {
+      app.saveProfile("profile");
+    }
+    // What the render graph derived for the last frame
+    const RenderGraph::Stats& graphStats = app.m_renderGraph.getStats();
+    ImGui::Text("%u barrier batches, %u image and %u buffer barriers", graphStats.barrierBatches,
+                graphStats.imageBarriers, graphStats.bufferBarriers);
+    ImGui::Text("Transient images %.1f MB, aliased %.1f MB", double(graphStats.transientSize) / (1024. * 1024.),
+                double(graphStats.allocatedSize) / (1024. * 1024.));
+  }
+#ifdef PATH_TRACER_RAY_STATS
+  if(ImGui::CollapsingHeader("Ray statistics"))
+  {
+    // Counted in the last frame that finished; the rate is over the smoothed time of the ray tracing
+    const RayStats& stats   = app.m_rayStats;
+    const uint64_t  rays    = uint64_t(stats.primaryRays) + stats.secondaryRays + stats.shadowRays;
+    const float     traceMs = app.m_frameTime.getTraceMs();
+    ImGui::Text("Primary %u, secondary %u, shadow %u", stats.primaryRays, stats.secondaryRays, stats.shadowRays);
+    ImGui::Text("%.1f Mrays/s", traceMs > 0.f ? static_cast<double>(rays) / (traceMs * 1e3) : 0.0);
+    ImGui::Text("Russian roulette ended %u of %u paths", stats.rouletteTerminations, stats.primaryRays);
+    float segments[std::size(stats.pathSegments)];
+    for(size_t i = 0; i < std::size(segments); i++)
+    {
+      segments[i] = static_cast<float>(stats.pathSegments[i]);
+    }
+    ImGui::PlotHistogram("Path segments", segments, static_cast<int>(std::size(segments)), 0, nullptr, 0.f, FLT_MAX,
+                         ImVec2(0, 60));
+  }
+#endif
+  if(ImGui::CollapsingHeader("Textures"))
+  {
+    // Streamed in the background; the budget is of the mips kept in device memory
+    TextureStreamer::Settings& settings  = app.m_textureStreamer.m_settings;
+    const double               toMiB     = 1.0 / (1024.0 * 1024.0);
+    int                        budgetMiB = static_cast<int>(settings.budget >> 20);
+    if(ImGui::SliderInt("Budget (MiB)", &budgetMiB, 16, 4096))
+    {
+      settings.budget = VkDeviceSize(budgetMiB) << 20;
+    }
+    ImGui::Text("%.1f MiB resident, %u of %u textures pending", double(app.m_textureStreamer.getResidentBytes()) * toMiB,
+                app.m_textureStreamer.getPendingCount(), app.m_textureStreamer.size());
+  }
+  if(ImGui::CollapsingHeader("Acceleration structures"))
+  {
+    // Rebuilt in the background; the current ones are used until the new ones are ready
+    if(ImGui::Button("Rebuild"))
+    {
+      app.rebuildAccelerationStructures();
+    }
+    if(app.m_asyncAsBuilder.isBuilding())
+    {
+      ImGui::SameLine();
+      ImGui::Text("Building...");
+    }
+  }
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -157,15 +274,27 @@ int main(int argc, char** argv)
 
   // Setup Imgui
   app.initGUI(0);  // Using sub-pass 0
+  app.initProfiler();
 
   // Creation of the example
+  // Acceleration structures are rebuilt on the async compute queue, if there is one
+  const nvvk::Context::Queue& computeQueue = (vkctx.m_queueC.queue != VK_NULL_HANDLE) ? vkctx.m_queueC : vkctx.m_queueGCT;
+  app.initAsyncAsBuilds(computeQueue.familyIndex, computeQueue.queue);
+  // Model geometry is streamed on the dedicated transfer queue, if there is one
+  const nvvk::Context::Queue& transferQueue = (vkctx.m_queueT.queue != VK_NULL_HANDLE) ? vkctx.m_queueT : vkctx.m_queueGCT;
+  app.initGeometryUploader(transferQueue.familyIndex, transferQueue.queue);
+  app.initTextureStreaming();
   app.loadModel(nvh::findFile("scenes/colored-sub.obj", defaultSearchPaths, true));
+  app.finishGeometryUploads();
+  // More nodes placing the models would be added to the scene graph here, before all are flattened
+  app.flattenSceneGraph();
 
   app.createOffscreenRender();
   app.createDescriptorSetLayout();
   app.createGraphicsPipeline();
   app.createUniformBuffer();
   app.createObjDescriptionBuffer();
+  app.createLightBuffer();
   app.updateDescriptorSet();
 
   // #VKRay
@@ -176,13 +305,19 @@ int main(int argc, char** argv)
   app.createRtPipeline();
   app.createRtShaderBindingTable();
 
+  app.createDenoiser();
+  app.initFrameTimeController();
   app.createPostDescriptor();
   app.createPostPipeline();
+  app.createRenderGraph();
   app.updatePostDescriptorSet();
+  // Rebuilding the pipelines in the background when their shaders are edited
+  app.initShaderReload();
 
 
   glm::vec4 clearColor   = glm::vec4(1, 1, 1, 1.00f);
   bool      useRaytracer = true;
+  bool      useDenoiser  = false;
 
 
   app.setupGlfwCallbacks(window);
@@ -207,7 +342,7 @@ int main(int argc, char** argv)
       ImGui::ColorEdit3("Clear color", reinterpret_cast<float*>(&clearColor));
       ImGui::Checkbox("Ray Tracer mode", &useRaytracer);  // Switch between raster and ray tracing
 
-      renderUI(app);
+      renderUI(app, useDenoiser);
       ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
       ImGuiH::Control::Info("", "", "(F10) Toggle Pane", ImGuiH::Control::Flags::Disabled);
       ImGuiH::Panel::End();
@@ -215,6 +350,10 @@ int main(int argc, char** argv)
 
     // Start rendering the scene
     app.prepareFrame();
+    // Swapping in acceleration structures rebuilt on the compute queue, once they're ready
+    app.updateAccelerationStructureSwap();
+    // ... and the pipelines rebuilt from edited shaders
+    app.updateShaderReload();
 
     // Start command buffer of this frame
     auto                   curFrame = app.getCurFrame();
@@ -223,56 +362,34 @@ int main(int argc, char** argv)
     VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     vkBeginCommandBuffer(cmdBuf, &beginInfo);
-
-    // Updating camera buffer
-    app.updateUniformBuffer(cmdBuf);
-
-    // Clearing screen
-    std::array<VkClearValue, 2> clearValues{};
-    clearValues[0].color        = {{clearColor[0], clearColor[1], clearColor[2], clearColor[3]}};
-    clearValues[1].depthStencil = {1.0f, 0};
-
-    // Offscreen render pass
-    {
-      VkRenderPassBeginInfo offscreenRenderPassBeginInfo{VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
-      offscreenRenderPassBeginInfo.clearValueCount = 2;
-      offscreenRenderPassBeginInfo.pClearValues    = clearValues.data();
-      offscreenRenderPassBeginInfo.renderPass      = app.m_offscreenRenderPass;
-      offscreenRenderPassBeginInfo.framebuffer     = app.m_offscreenFramebuffer;
-      offscreenRenderPassBeginInfo.renderArea      = {{0, 0}, app.getSize()};
-
-      // Rendering Scene
-      if(useRaytracer)
-      {
-        app.raytrace(cmdBuf, clearColor);
-      }
-      else
-      {
-        vkCmdBeginRenderPass(cmdBuf, &offscreenRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-        app.rasterize(cmdBuf);
-        vkCmdEndRenderPass(cmdBuf);
-      }
-    }
-
-    // 2nd rendering pass: tone mapper, UI
-    {
-      VkRenderPassBeginInfo postRenderPassBeginInfo{VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
-      postRenderPassBeginInfo.clearValueCount = 2;
-      postRenderPassBeginInfo.pClearValues    = clearValues.data();
-      postRenderPassBeginInfo.renderPass      = app.getRenderPass();
-      postRenderPassBeginInfo.framebuffer     = app.getFramebuffers()[curFrame];
-      postRenderPassBeginInfo.renderArea      = {{0, 0}, app.getSize()};
-
-      // Rendering tonemapper
-      vkCmdBeginRenderPass(cmdBuf, &postRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-      app.drawPost(cmdBuf);
-      // Rendering UI
+    // Timing the frame on the GPU, and picking its samples per pixel from the last frames
+    app.beginFrameTiming(cmdBuf);
+    // Uploading the textures decoded in the background, and the mips the budget lets them keep
+    app.updateTextureStreaming(cmdBuf);
+
+    // Re-flattening the nodes changed with setNodeTransform and setNodeMask, and
+    // refitting the BLASes of the models deformed with updateModelVertices, then
+    // the TLAS for them and for the instances that moved
+    app.updateSceneGraph();
+    app.updateBottomLevelAS(cmdBuf);
+    app.updateTopLevelAS(cmdBuf);
+    // ... and the light BVH for the lights of the moved instances
+    app.updateLights();
+
+    // The passes of the frame, from updating the camera buffer, once it's known whether the
+    // accumulation restarts this frame, to the tone mapper and the UI over it
+    PathTracerWindow::FrameSettings frameSettings;
+    frameSettings.raytrace   = useRaytracer;
+    frameSettings.denoise    = useDenoiser;
+    frameSettings.clearColor = clearColor;
+    frameSettings.drawUi     = [](VkCommandBuffer uiCmdBuf) {
       ImGui::Render();
-      ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmdBuf);
-      vkCmdEndRenderPass(cmdBuf);
-    }
+      ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), uiCmdBuf);
+    };
+    app.renderFrame(cmdBuf, frameSettings);
 
     // Submit for display
+    app.endFrameTiming(cmdBuf);
     vkEndCommandBuffer(cmdBuf);
     app.submitFrame();
   }
@@ -0,0 +1,125 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "opacity.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "stb_image.h"
+
+namespace {
+// Triangles whose texel footprint is larger are left unknown, rather than spend the load on them
+constexpr int64_t k_maxTexelsPerTriangle = 64 * 64;
+
+// Triangle state from the alpha of the texels its texture coordinates can reach
+uint32_t classifyTriangle(const AlphaTexture& texture, const glm::vec2& t0, const glm::vec2& t1, const glm::vec2& t2)
+{
+  const glm::vec2 uvMin = glm::min(t0, glm::min(t1, t2));
+  const glm::vec2 uvMax = glm::max(t0, glm::max(t1, t2));
+  const glm::vec2 size(float(texture.width), float(texture.height));
+  // One texel more on each side, for the bilinear footprint
+  const glm::vec2 texelMin = glm::floor(uvMin * size) - 1.f;
+  const glm::vec2 texelMax = glm::floor(uvMax * size) + 1.f;
+  const glm::vec2 extent   = texelMax - texelMin + 1.f;
+  if(!std::isfinite(extent.x) || !std::isfinite(extent.y) || double(extent.x) * extent.y > double(k_maxTexelsPerTriangle))
+  {
+    return k_opacityUnknown;
+  }
+
+  // Texture coordinates repeat, as with the samplers of the texture streamer
+  const uint8_t cutoff = static_cast<uint8_t>(k_opacityAlphaCutoff * 255.f + 0.5f);
+  uint8_t       lo     = 255;
+  uint8_t       hi     = 0;
+  const int64_t w      = texture.width;
+  const int64_t h      = texture.height;
+  for(int64_t y = int64_t(texelMin.y); y <= int64_t(texelMax.y); y++)
+  {
+    const uint8_t* row = texture.alpha.data() + ((y % h + h) % h) * w;
+    for(int64_t x = int64_t(texelMin.x); x <= int64_t(texelMax.x); x++)
+    {
+      const uint8_t a = row[(x % w + w) % w];
+      lo              = std::min(lo, a);
+      hi              = std::max(hi, a);
+    }
+    if(lo < cutoff && hi >= cutoff)
+    {
+      return k_opacityUnknown;
+    }
+  }
+  return lo >= cutoff ? k_opacityOpaque : k_opacityTransparent;
+}
+}  // namespace
+
+bool loadAlphaTexture(const std::string& filename, AlphaTexture& texture)
+{
+  int width, height, channels;
+  if(filename.empty() || !stbi_info(filename.c_str(), &width, &height, &channels) || (channels != 2 && channels != 4))
+  {
+    return false;
+  }
+  stbi_uc* pixels = stbi_load(filename.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+  if(pixels == nullptr)
+  {
+    return false;
+  }
+  texture.width  = static_cast<uint32_t>(width);
+  texture.height = static_cast<uint32_t>(height);
+  texture.alpha.resize(size_t(width) * height);
+  bool opaque = true;
+  for(size_t i = 0; i < texture.alpha.size(); i++)
+  {
+    texture.alpha[i] = pixels[4 * i + 3];
+    opaque           = opaque && texture.alpha[i] == 255;
+  }
+  stbi_image_free(pixels);
+  return !opaque;
+}
+
+OpacityClass classifyOpacity(const VertexObj*                        vertices,
+                             const uint32_t*                         indices,
+                             const int32_t*                          materialIDs,
+                             size_t                                  triangleCount,
+                             const std::vector<MaterialObj>&         materials,
+                             const std::vector<const AlphaTexture*>& materialAlpha,
+                             std::vector<uint32_t>&                  states)
+{
+  OpacityClass result = OpacityClass::eOpaque;
+  for(const MaterialObj& material : materials)
+  {
+    if(material.dissolve < 1.f)
+    {
+      result = OpacityClass::eTransparent;
+    }
+  }
+
+  states.assign((triangleCount + 15) / 16, 0);
+  bool allOpaque = true;
+  for(size_t triangle = 0; triangle < triangleCount; triangle++)
+  {
+    const int32_t      materialID = std::clamp<int32_t>(materialIDs[triangle], 0, int32_t(materials.size()) - 1);
+    const MaterialObj& material   = materials[materialID];
+    uint32_t           state      = k_opacityOpaque;
+    if(material.dissolve <= 0.f)
+    {
+      state = k_opacityTransparent;
+    }
+    else if(material.dissolve < 1.f)
+    {
+      state = k_opacityUnknown;
+    }
+    else if(materialAlpha[materialID] != nullptr)
+    {
+      state = classifyTriangle(*materialAlpha[materialID], vertices[indices[3 * triangle + 0]].texCoord,
+                               vertices[indices[3 * triangle + 1]].texCoord, vertices[indices[3 * triangle + 2]].texCoord);
+    }
+    allOpaque = allOpaque && state == k_opacityOpaque;
+    states[triangle / 16] |= state << (2 * (triangle % 16));
+  }
+
+  if(allOpaque)
+  {
+    states.clear();
+    return OpacityClass::eOpaque;
+  }
+  return result == OpacityClass::eTransparent ? result : OpacityClass::eAlphaTested;
+}
@@ -0,0 +1,69 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Classification of the opacity of a model's geometry, so that rays only run
+// the any-hit shader where it can decide something. A model is opaque if all
+// of its triangles are: its BLAS geometry is built with
+// VK_GEOMETRY_OPAQUE_BIT_KHR, and hits on it never invoke the any-hit shader.
+// Otherwise it's alpha-tested, if its diffuse textures have an alpha channel
+// that cuts holes into it, or transparent, if a material has a dissolve below
+// 1, which the any-hit shader tests stochastically.
+// Triangles of models that aren't opaque get one of the states of
+// VK_EXT_opacity_micromap at subdivision level 0: transparent and opaque
+// triangles are decided from their state alone, and only the unknown ones
+// fetch their texture coordinates and sample the alpha. A triangle is decided
+// if the alpha of all texels within one texel of the bounding box of its
+// texture coordinates is on the same side of the cutoff; so bilinear
+// filtering anywhere on the triangle is too. Triangles covering too many
+// texels aren't looked at, and are unknown.
+// Compressed textures (see texture_compression.hpp) have no alpha left, and
+// the any-hit shader reads their unknown triangles as opaque.
+#ifndef VK_MINI_PATH_TRACER_OPACITY_HPP
+#define VK_MINI_PATH_TRACER_OPACITY_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "obj_loader.h"
+
+// OPACITY_* of shaders/host_device.h
+static constexpr uint32_t k_opacityTransparent = 0;
+static constexpr uint32_t k_opacityOpaque      = 1;
+static constexpr uint32_t k_opacityUnknown     = 2;
+static constexpr float    k_opacityAlphaCutoff = 0.5f;
+
+enum class OpacityClass
+{
+  eOpaque,
+  eAlphaTested,
+  eTransparent,
+};
+
+// The alpha channel of a texture, at level 0
+struct AlphaTexture
+{
+  uint32_t             width  = 0;
+  uint32_t             height = 0;
+  std::vector<uint8_t> alpha;  // Row by row, from the top, as the texture coordinates of VertexObj
+};
+
+// Reads the alpha of image `filename`. Returns false if it has no alpha
+// channel, or is opaque everywhere, without decoding it in the first case.
+bool loadAlphaTexture(const std::string& filename, AlphaTexture& texture);
+
+// Classifies the `triangleCount` triangles of a model, with the `indices` of
+// their corners in `vertices` and their material in `materialIDs`.
+// `materialAlpha` has the alpha of the diffuse texture of each material, or
+// nullptr if it has none or it's opaque. If the model isn't opaque, writes
+// the state of each triangle to `states`, 2 bits each and 16 to a uint32_t,
+// from the low bits; otherwise leaves it empty.
+OpacityClass classifyOpacity(const VertexObj*                        vertices,
+                             const uint32_t*                         indices,
+                             const int32_t*                          materialIDs,
+                             size_t                                  triangleCount,
+                             const std::vector<MaterialObj>&         materials,
+                             const std::vector<const AlphaTexture*>& materialAlpha,
+                             std::vector<uint32_t>&                  states);
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_OPACITY_HPP
@@ -18,6 +18,10 @@
  */
 
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iterator>
 #include <sstream>
 
 
@@ -26,12 +30,21 @@
 #include "stb_image.h"
 
 #include "path_tracer_window.hpp"
+#include "async_as_builder.hpp"
+#include "blas_builder.hpp"
+#include "blas_refitter.hpp"
+#include "dynamic_tlas.hpp"
+#include "mesh_cache.hpp"
+#include "obj_parser.hpp"
+#include "pipeline_cache.hpp"
+#include "streaming_uploader.hpp"
 #include "nvh/alignment.hpp"
 #include "nvh/cameracontrol.hpp"
 #include "nvh/cameramanipulator.hpp"
 #include "nvh/fileoperations.hpp"
 #include "nvvk/commands_vk.hpp"
 #include "nvvk/descriptorsets_vk.hpp"
+#include "nvvk/error_vk.hpp"
 #include "nvvk/images_vk.hpp"
 #include "nvvk/pipeline_vk.hpp"
 #include "nvvk/renderpasses_vk.hpp"
@@ -50,13 +63,18 @@ void PathTracerWindow::setup(const VkInstance& instance, const VkDevice& device,
     AppBaseVk::setup(instance, device, physicalDevice, queueFamily);
     m_alloc.init(instance, device, physicalDevice);
     m_debug.setup(m_device);
+    m_renderGraph.init(&m_alloc);
     m_offscreenDepthFormat = nvvk::findDepthFormat(physicalDevice);
+    m_pipelineCache = loadPipelineCache(m_device, m_physicalDevice, m_pipelineCacheFilename);
+    m_pipelineCompiler.init(m_device, m_pipelineCache);
 }
 
 //--------------------------------------------------------------------------------------------------
-// Called at each frame to update the camera matrix
+// Called at each frame to update the camera matrix, after the updates that may reset the
+// accumulation (updateTopLevelAS, updateShaderReload). Written to this frame's region of
+// m_uploadRing, which no frame in flight reads, so it needs no barrier.
 //
-void PathTracerWindow::updateUniformBuffer(const VkCommandBuffer& cmdBuf)
+void PathTracerWindow::updateUniformBuffer()
 {
     // Prepare new UBO contents on host.
     const float aspectRatio = m_size.width / static_cast<float>(m_size.height);
@@ -69,34 +87,17 @@ void PathTracerWindow::updateUniformBuffer(const VkCommandBuffer& cmdBuf)
     hostUBO.viewInverse = glm::inverse(view);
     hostUBO.projInverse = glm::inverse(proj);
 
-    // UBO on the device, and what stages access it.
-    VkBuffer deviceUBO = m_bGlobals.buffer;
-    auto uboUsageStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
-
-    // Ensure that the modified UBO is not visible to previous frames.
-    VkBufferMemoryBarrier beforeBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    beforeBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    beforeBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    beforeBarrier.buffer = deviceUBO;
-    beforeBarrier.offset = 0;
-    beforeBarrier.size = sizeof(hostUBO);
-    vkCmdPipelineBarrier(cmdBuf, uboUsageStages, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_DEPENDENCY_DEVICE_GROUP_BIT, 0,
-                         nullptr, 1, &beforeBarrier, 0, nullptr);
-
-
-    // Schedule the host-to-device upload. (hostUBO is copied into the cmd
-    // buffer so it is okay to deallocate when the function returns).
-    vkCmdUpdateBuffer(cmdBuf, m_bGlobals.buffer, 0, sizeof(GlobalUniforms), &hostUBO);
-
-    // Making sure the updated UBO will be visible.
-    VkBufferMemoryBarrier afterBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    afterBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    afterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    afterBarrier.buffer = deviceUBO;
-    afterBarrier.offset = 0;
-    afterBarrier.size = sizeof(hostUBO);
-    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, uboUsageStages, VK_DEPENDENCY_DEVICE_GROUP_BIT, 0,
-                         nullptr, 1, &afterBarrier, 0, nullptr);
+    // If only the camera changed, the ray tracer carries the last frame over to where it shows up
+    // now; if the scene changed, raytrace starts over
+    m_reprojectHistory = view != m_prevView && !m_resetAccumulation;
+    hostUBO.prevView = m_prevView;
+    hostUBO.reprojectHistory = m_reprojectHistory ? 1 : 0;
+    hostUBO.maxReprojectedSamples = m_maxReprojectedSamples;
+    hostUBO.samplesPerFrame = m_frameTime.getSamplesPerFrame();
+    m_prevView = view;
+
+    // Bound at m_globalsOffset by raytrace and rasterize
+    m_globalsOffset = m_uploadRing.push(hostUBO);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -104,23 +105,37 @@ void PathTracerWindow::updateUniformBuffer(const VkCommandBuffer& cmdBuf)
 //
 void PathTracerWindow::createDescriptorSetLayout()
 {
-    auto nbTxt = static_cast<uint32_t>(m_textures.size());
+    // The texture slots are fixed from here on
+    auto nbTxt = m_textureStreamer.size();
+    m_textureStreamer.createFeedbackBuffers();
 
-    // Camera matrices
-    m_descSetLayoutBind.addBinding(SceneBindings::eGlobals, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
+    // Camera matrices, in the region of m_uploadRing of the frame being drawn
+    m_descSetLayoutBind.addBinding(SceneBindings::eGlobals, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1,
                                    VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR);
     // Obj descriptions
     m_descSetLayoutBind.addBinding(SceneBindings::eObjDescs, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
                                    VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT |
-                                   VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
+                                   VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR);
     // Textures
     m_descSetLayoutBind.addBinding(SceneBindings::eTextures, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, nbTxt,
-                                   VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
+                                   VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR |
+                                   VK_SHADER_STAGE_ANY_HIT_BIT_KHR);
+    // Emissive triangles and the light BVH, at the copy of the frame being drawn
+    m_descSetLayoutBind.addBinding(SceneBindings::eLights, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1,
+                                   VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
+    m_descSetLayoutBind.addBinding(SceneBindings::eLightBvh, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1,
+                                   VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
+    // Marked by the shaders sampling each texture
+    m_descSetLayoutBind.addBinding(SceneBindings::eTextureFeedback, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                   VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR |
+                                   VK_SHADER_STAGE_ANY_HIT_BIT_KHR);
 
 
     m_descSetLayout = m_descSetLayoutBind.createLayout(m_device);
-    m_descPool = m_descSetLayoutBind.createPool(m_device, 1);
+    m_descPool = m_descSetLayoutBind.createPool(m_device, 2);
+    // Two sets, so that streamed textures can be written while frames still use the current one
     m_descSet = nvvk::allocateDescriptorSet(m_device, m_descPool, m_descSetLayout);
+    m_descSetSpare = nvvk::allocateDescriptorSet(m_device, m_descPool, m_descSetLayout);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -130,20 +145,24 @@ void PathTracerWindow::updateDescriptorSet()
 {
     std::vector<VkWriteDescriptorSet> writes;
 
-    // Camera matrices and scene description
-    VkDescriptorBufferInfo dbiUnif{m_bGlobals.buffer, 0, VK_WHOLE_SIZE};
-    writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, SceneBindings::eGlobals, &dbiUnif));
-
+    VkDescriptorBufferInfo dbiUnif = m_uploadRing.getDescriptor(sizeof(GlobalUniforms));
     VkDescriptorBufferInfo dbiSceneDesc{m_bObjDesc.buffer, 0, VK_WHOLE_SIZE};
-    writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, SceneBindings::eObjDescs, &dbiSceneDesc));
-
-    // All texture samplers
-    std::vector<VkDescriptorImageInfo> diit;
-    for (auto& texture : m_textures)
+    VkDescriptorBufferInfo dbiLights = m_lightBvh.getLightsDescriptor();
+    VkDescriptorBufferInfo dbiLightBvh = m_lightBvh.getNodesDescriptor();
+    VkDescriptorBufferInfo dbiFeedback = m_textureStreamer.getFeedbackDescriptor();
+    // All texture samplers, the placeholder for the textures not streamed in yet
+    std::vector<VkDescriptorImageInfo> diit = m_textureStreamer.getDescriptors();
+    for (VkDescriptorSet set : {m_descSet, m_descSetSpare})
     {
-        diit.emplace_back(texture.descriptor);
+        // Camera matrices and scene description
+        writes.emplace_back(m_descSetLayoutBind.makeWrite(set, SceneBindings::eGlobals, &dbiUnif));
+        writes.emplace_back(m_descSetLayoutBind.makeWrite(set, SceneBindings::eObjDescs, &dbiSceneDesc));
+        writes.emplace_back(m_descSetLayoutBind.makeWrite(set, SceneBindings::eLights, &dbiLights));
+        writes.emplace_back(m_descSetLayoutBind.makeWrite(set, SceneBindings::eLightBvh, &dbiLightBvh));
+        writes.emplace_back(m_descSetLayoutBind.makeWriteArray(set, SceneBindings::eTextures, diit.data()));
+        writes.emplace_back(m_descSetLayoutBind.makeWrite(set, SceneBindings::eTextureFeedback, &dbiFeedback));
     }
-    writes.emplace_back(m_descSetLayoutBind.makeWriteArray(m_descSet, SceneBindings::eTextures, diit.data()));
+    m_textureStreamer.commitDescriptors();
 
     // Writing the information
     vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
@@ -182,21 +201,154 @@ void PathTracerWindow::createGraphicsPipeline()
         {3, 0, VK_FORMAT_R32G32_SFLOAT, static_cast<uint32_t>(offsetof(VertexObj, texCoord))},
     });
 
-    m_graphicsPipeline = gpb.createPipeline();
+    m_graphicsPipeline = gpb.createPipeline(m_pipelineCache);
     m_debug.setObjectName(m_graphicsPipeline, "Graphics");
 }
 
 //--------------------------------------------------------------------------------------------------
 // Loading the OBJ file and setting up all buffers
 //
-void PathTracerWindow::loadModel(const std::string& filename, glm::mat4 transform)
+namespace {
+// What ObjLoader produces for a model, built from the output of parseObjParallel()
+struct ObjModelData
+{
+    std::vector<VertexObj> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<MaterialObj> materials;
+    std::vector<int32_t> matIndx;
+    std::vector<std::string> textures;
+};
+
+void buildObjModelData(const ObjData& obj, ObjModelData& model)
+{
+    // Collecting the material in the scene
+    for (const tinyobj::material_t& material : obj.materials)
+    {
+        MaterialObj m;
+        m.ambient = glm::vec3(material.ambient[0], material.ambient[1], material.ambient[2]);
+        m.diffuse = glm::vec3(material.diffuse[0], material.diffuse[1], material.diffuse[2]);
+        m.specular = glm::vec3(material.specular[0], material.specular[1], material.specular[2]);
+        m.emission = glm::vec3(material.emission[0], material.emission[1], material.emission[2]);
+        m.transmittance = glm::vec3(material.transmittance[0], material.transmittance[1], material.transmittance[2]);
+        m.dissolve = material.dissolve;
+        m.ior = material.ior;
+        m.shininess = material.shininess;
+        m.illum = material.illum;
+        if (!material.diffuse_texname.empty())
+        {
+            model.textures.push_back(material.diffuse_texname);
+            m.textureID = static_cast<int>(model.textures.size()) - 1;
+        }
+        model.materials.emplace_back(m);
+    }
+    // If there were none, add a default
+    if (model.materials.empty())
+        model.materials.emplace_back(MaterialObj());
+
+    // One vertex per triangle corner, as ObjLoader does
+    model.vertices.resize(obj.indices.size());
+    model.indices.resize(obj.indices.size());
+    for (size_t i = 0; i < obj.indices.size(); i++)
+    {
+        const ObjIndex& index = obj.indices[i];
+        VertexObj& vertex = model.vertices[i];
+        vertex = {};
+        const float* vp = &obj.positions[3 * size_t(index.vertex)];
+        vertex.pos = {vp[0], vp[1], vp[2]};
+        if (index.normal >= 0)
+        {
+            const float* np = &obj.normals[3 * size_t(index.normal)];
+            vertex.nrm = {np[0], np[1], np[2]};
+        }
+        if (index.texcoord >= 0)
+        {
+            const float* tp = &obj.texcoords[2 * size_t(index.texcoord)];
+            vertex.texCoord = {tp[0], 1.0f - tp[1]};
+        }
+        if (!obj.colors.empty())
+        {
+            const float* vc = &obj.colors[3 * size_t(index.vertex)];
+            vertex.color = {vc[0], vc[1], vc[2]};
+        }
+        model.indices[i] = static_cast<uint32_t>(i);
+    }
+
+    // Fixing material indices
+    model.matIndx = obj.materialIDs;
+    for (int32_t& mi : model.matIndx)
+    {
+        if (mi < 0 || mi >= static_cast<int32_t>(model.materials.size()))
+            mi = 0;
+    }
+
+    // Compute normal when no normal were provided.
+    if (obj.normals.empty())
+    {
+        for (size_t i = 0; i + 2 < model.vertices.size(); i += 3)
+        {
+            VertexObj& v0 = model.vertices[i + 0];
+            VertexObj& v1 = model.vertices[i + 1];
+            VertexObj& v2 = model.vertices[i + 2];
+            const glm::vec3 n = glm::normalize(glm::cross((v1.pos - v0.pos), (v2.pos - v0.pos)));
+            v0.nrm = n;
+            v1.nrm = n;
+            v2.nrm = n;
+        }
+    }
+}
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+// Load an OBJ model and add a mesh node placing it to the root of the scene
+// graph, which is returned. The model can be placed by more nodes with
+// m_sceneGraph, its index being the number of models loaded before. The
+// vertices of `deformable` models can be changed later with updateModelVertices.
+// Returns SceneGraph::k_none, and adds nothing, if the file can't be parsed.
+//
+uint32_t PathTracerWindow::loadModel(const std::string& filename, glm::mat4 transform, bool deformable)
 {
     LOGI("Loading File:  %s \n", filename.c_str());
-    ObjLoader loader;
-    loader.loadModel(filename);
+    // Parsing large OBJ files takes much longer than uploading them, so the
+    // parsed model is kept in a mesh cache next to the file. When the cache is
+    // up to date, it's memory-mapped and its sections are uploaded directly;
+    // otherwise the file is parsed on all threads and the cache is rewritten.
+    const std::string cacheFilename = getMeshCacheFilename(filename);
+    MeshCache cache;
+    ObjModelData parsed;
+    MeshCacheView mesh;
+    if (cache.open(cacheFilename, filename, MESH_CACHE_LAYOUT_VERTEX_OBJ, sizeof(VertexObj), sizeof(MaterialObj)))
+    {
+        mesh = cache.view();
+    }
+    else
+    {
+        ObjData obj;
+        // A half-parsed model may have unresolved indices, and mustn't be cached
+        if (!parseObjParallel(filename, obj))
+        {
+            LOGE("Could not load %s\n", filename.c_str());
+            return SceneGraph::k_none;
+        }
+        buildObjModelData(obj, parsed);
+        mesh.vertices = parsed.vertices.data();
+        mesh.vertexCount = parsed.vertices.size();
+        mesh.indices = parsed.indices.data();
+        mesh.indexCount = parsed.indices.size();
+        mesh.materialIDs = parsed.matIndx.data();
+        mesh.triangleCount = parsed.matIndx.size();
+        mesh.materials = parsed.materials.data();
+        mesh.materialCount = parsed.materials.size();
+        mesh.textures = parsed.textures;
+        if (!writeMeshCache(cacheFilename, filename, MESH_CACHE_LAYOUT_VERTEX_OBJ, sizeof(VertexObj), sizeof(MaterialObj), mesh))
+        {
+            LOGW("Could not write the mesh cache %s\n", cacheFilename.c_str());
+        }
+    }
 
     // Converting from Srgb to linear
-    for (auto& m : loader.m_materials)
+    const MaterialObj* cachedMaterials = static_cast<const MaterialObj*>(mesh.materials);
+    std::vector<MaterialObj> materials(cachedMaterials, cachedMaterials + mesh.materialCount);
+    for (auto& m : materials)
     {
         m.ambient = glm::pow(m.ambient, glm::vec3(2.2f));
         m.diffuse = glm::pow(m.diffuse, glm::vec3(2.2f));
@@ -204,64 +356,199 @@ void PathTracerWindow::loadModel(const std::string& filename, glm::mat4 transfor
     }
 
     ObjModel model;
-    model.nbIndices = static_cast<uint32_t>(loader.m_indices.size());
-    model.nbVertices = static_cast<uint32_t>(loader.m_vertices.size());
-
-    // Create the buffers on Device and copy vertices, indices and materials
-    nvvk::CommandPool cmdBufGet(m_device, m_graphicsQueueIndex);
-    VkCommandBuffer cmdBuf = cmdBufGet.createCommandBuffer();
-    VkBufferUsageFlags flag = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
-    VkBufferUsageFlags rayTracingFlags = // used also for building acceleration structures
-        flag | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    model.vertexBuffer = m_alloc.createBuffer(cmdBuf, loader.m_vertices,
-                                              VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | rayTracingFlags);
-    model.indexBuffer = m_alloc.createBuffer(cmdBuf, loader.m_indices,
-                                             VK_BUFFER_USAGE_INDEX_BUFFER_BIT | rayTracingFlags);
-    model.matColorBuffer = m_alloc.createBuffer(cmdBuf, loader.m_materials, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | flag);
-    model.matIndexBuffer = m_alloc.createBuffer(cmdBuf, loader.m_matIndx, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | flag);
-    // Creates all textures found and find the offset for this model
-    auto txtOffset = static_cast<uint32_t>(m_textures.size());
-    createTextureImages(cmdBuf, loader.m_textures);
-    cmdBufGet.submitAndWait(cmdBuf);
-    m_alloc.finalizeAndReleaseStaging();
+    model.nbIndices = static_cast<uint32_t>(mesh.indexCount);
+    model.nbVertices = static_cast<uint32_t>(mesh.vertexCount);
+    model.deformable = deformable;
+    // The materials go into the model's hit records as well, if they fit
+    if (materials.size() <= std::size(model.hitRecord.materials))
+    {
+        model.hitRecord.numMaterials = static_cast<uint32_t>(materials.size());
+        std::copy(materials.begin(), materials.end(), model.hitRecord.materials);
+    }
 
-    std::string objNb = std::to_string(m_objModel.size());
-    m_debug.setObjectName(model.vertexBuffer.buffer, (std::string("vertex_" + objNb)));
-    m_debug.setObjectName(model.indexBuffer.buffer, (std::string("index_" + objNb)));
-    m_debug.setObjectName(model.matColorBuffer.buffer, (std::string("mat_" + objNb)));
-    m_debug.setObjectName(model.matIndexBuffer.buffer, (std::string("matIdx_" + objNb)));
+    // The hit shader reads the attributes compressed; deforming models change the full precision vertices after this
+    const VertexObj* vertices = static_cast<const VertexObj*>(mesh.vertices);
+    std::vector<CompressedVertex> compressed;
+    CompressedVertexBounds compressedBounds;
+    if (m_compressVertices && !deformable)
+    {
+        compressedBounds = compressVertices(vertices, mesh.vertexCount, compressed);
+    }
+
+    // Collecting the emissive triangles of the instance, in object space, and
+    // where each triangle is in them for the shaders to find the lights they hit.
+    // They belong to the node until flattenSceneGraph gives them its instance
+    const uint32_t node = m_sceneGraph.addMesh(SceneGraph::k_root, static_cast<uint32_t>(m_objModel.size()), transform);
+    std::vector<uint32_t> lightIndices(mesh.triangleCount, ~0u);
+    for (uint64_t triangle = 0; triangle < mesh.triangleCount; triangle++)
+    {
+        const glm::vec3 emission = materials[mesh.materialIDs[triangle]].emission;
+        if (emission == glm::vec3(0))
+            continue;
+        LightBvh::Light light;
+        light.v0 = vertices[mesh.indices[3 * triangle + 0]].pos;
+        light.v1 = vertices[mesh.indices[3 * triangle + 1]].pos;
+        light.v2 = vertices[mesh.indices[3 * triangle + 2]].pos;
+        light.emission = emission;
+        light.instanceIndex = node;
+        lightIndices[triangle] = static_cast<uint32_t>(m_emissiveTriangles.size());
+        m_emissiveTriangles.push_back(light);
+    }
 
-    // Keeping transformation matrix of the instance
-    ObjInstance instance;
-    instance.transform = transform;
-    instance.objIndex = static_cast<uint32_t>(m_objModel.size());
-    m_instances.push_back(instance);
+    // Which triangles the any-hit shader has to look at: those whose material has a dissolve, or whose
+    // diffuse texture has an alpha that doesn't decide them, see opacity.hpp
+    std::vector<AlphaTexture> alphaTextures(mesh.textures.size());
+    std::vector<const AlphaTexture*> materialAlpha(materials.size(), nullptr);
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        const int textureID = materials[i].textureID;
+        if (textureID < 0 || textureID >= static_cast<int>(mesh.textures.size()) || materials[i].dissolve < 1.f)
+            continue;
+        const std::string textureFile = nvh::findFile("media/textures/" + mesh.textures[textureID], defaultSearchPaths, true);
+        if (loadAlphaTexture(textureFile, alphaTextures[textureID]))
+            materialAlpha[i] = &alphaTextures[textureID];
+    }
+    std::vector<uint32_t> opacityStates;
+    model.opacity = classifyOpacity(vertices, mesh.indices, mesh.materialIDs, mesh.triangleCount, materials, materialAlpha,
+                                    opacityStates);
+
+    // All arrays of the model in one range of the geometry arena, each at a multiple of 16 bytes
+    // for the buffer references, and streamed into it
+    VkDeviceSize rangeSize = 0;
+    const auto place = [&rangeSize](VkDeviceSize size) {
+        const VkDeviceSize offset = rangeSize;
+        rangeSize += (size + 15) / 16 * 16;
+        return offset;
+    };
+    const VkDeviceSize vertexSize = mesh.vertexCount * sizeof(VertexObj);
+    const VkDeviceSize indexSize = mesh.indexCount * sizeof(uint32_t);
+    const VkDeviceSize matColorSize = materials.size() * sizeof(MaterialObj);
+    const VkDeviceSize matIndexSize = mesh.triangleCount * sizeof(int32_t);
+    const VkDeviceSize lightIndexSize = lightIndices.size() * sizeof(uint32_t);
+    const VkDeviceSize compressedSize = compressed.size() * sizeof(CompressedVertex);
+    const VkDeviceSize opacitySize = opacityStates.size() * sizeof(uint32_t);
+    model.vertexOffset = place(vertexSize);
+    model.indexOffset = place(indexSize);
+    model.matColorOffset = place(matColorSize);
+    model.matIndexOffset = place(matIndexSize);
+    model.lightIndexOffset = place(lightIndexSize);
+    if (!compressed.empty())
+    {
+        model.compressedVertexOffset = place(compressedSize);
+    }
+    if (!opacityStates.empty())
+    {
+        model.opacityOffset = place(opacitySize);
+    }
+    model.geometry = m_geometryArena.allocate(rangeSize);
+    const VkBuffer arenaBuffer = m_geometryArena.getBuffer(model.geometry);
+    const VkDeviceSize base = model.geometry.offset;
+    m_uploader.upload(arenaBuffer, base + model.vertexOffset, vertexSize, mesh.vertices);
+    m_uploader.upload(arenaBuffer, base + model.indexOffset, indexSize, mesh.indices);
+    m_uploader.upload(arenaBuffer, base + model.matColorOffset, matColorSize, materials.data());
+    m_uploader.upload(arenaBuffer, base + model.matIndexOffset, matIndexSize, mesh.materialIDs);
+    m_uploader.upload(arenaBuffer, base + model.lightIndexOffset, lightIndexSize, lightIndices.data());
+    if (!compressed.empty())
+    {
+        m_uploader.upload(arenaBuffer, base + model.compressedVertexOffset, compressedSize, compressed.data());
+    }
+    if (!opacityStates.empty())
+    {
+        m_uploader.upload(arenaBuffer, base + model.opacityOffset, opacitySize, opacityStates.data());
+    }
+    // Adds all textures found to the streamer, and find the offset for this model
+    auto txtOffset = m_textureStreamer.size();
+    if (!mesh.textures.empty() || m_textureStreamer.size() == 0)
+    {
+        createTextureImages(mesh.textures);
+    }
 
     // Creating information for device access
     ObjDesc desc;
     desc.txtOffset = txtOffset;
-    desc.vertexAddress = nvvk::getBufferDeviceAddress(m_device, model.vertexBuffer.buffer);
-    desc.indexAddress = nvvk::getBufferDeviceAddress(m_device, model.indexBuffer.buffer);
-    desc.materialAddress = nvvk::getBufferDeviceAddress(m_device, model.matColorBuffer.buffer);
-    desc.materialIndexAddress = nvvk::getBufferDeviceAddress(m_device, model.matIndexBuffer.buffer);
+    desc.geometryAddress = m_geometryArena.getAddress(model.geometry);
+    desc.vertexOffset = static_cast<uint32_t>(model.vertexOffset);
+    desc.indexOffset = static_cast<uint32_t>(model.indexOffset);
+    desc.materialOffset = static_cast<uint32_t>(model.matColorOffset);
+    desc.materialIndexOffset = static_cast<uint32_t>(model.matIndexOffset);
+    desc.lightIndexOffset = static_cast<uint32_t>(model.lightIndexOffset);
+    desc.compressedVertexOffset = static_cast<uint32_t>(model.compressedVertexOffset);
+    desc.opacityOffset = static_cast<uint32_t>(model.opacityOffset);
+    desc.posMin = compressedBounds.posMin;
+    desc.posStep = compressedBounds.posStep;
 
     // Keeping the obj host model and device description
     m_objModel.emplace_back(model);
     m_objDesc.emplace_back(desc);
+    return node;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Flatten the scene graph into m_instances, once all models are loaded and
+// placed, and before the light buffer and the TLAS are created. The lights
+// of each model belong to the instance of the node loadModel added for it.
+//
+void PathTracerWindow::flattenSceneGraph()
+{
+    m_sceneGraph.flatten(m_instances);
+    for (LightBvh::Light& light : m_emissiveTriangles)
+    {
+        light.instanceIndex = m_sceneGraph.getInstanceIndex(light.instanceIndex);
+    }
+    LOGI("%u scene graph nodes, %u instances\n", m_sceneGraph.getNodeCount(), m_sceneGraph.getInstanceCount());
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Acceleration structures are rebuilt on `computeQueue`, which should be an
+// async compute queue if the device has one. Must be called before initGeometryUploader.
+//
+void PathTracerWindow::initAsyncAsBuilds(uint32_t computeQueueFamily, VkQueue computeQueue)
+{
+    m_asyncAsBuilder.init(&m_alloc, computeQueueFamily, computeQueue, m_graphicsQueueIndex, m_queue);
 }
 
+//--------------------------------------------------------------------------------------------------
+// Geometry is streamed to the GPU on `transferQueue`, which should be a
+// dedicated transfer queue if the device has one
+//
+void PathTracerWindow::initGeometryUploader(uint32_t transferQueueFamily, VkQueue transferQueue)
+{
+    m_uploader.init(&m_alloc, m_graphicsQueueIndex, transferQueueFamily, transferQueue);
+    // Acceleration structures are also rebuilt from the geometry on the compute queue
+    m_uploader.addQueueFamily(m_asyncAsBuilder.getQueueFamily());
+    // Vertices and indices are also read by the rasterizer and acceleration structure builds, and
+    // written by BLAS refits of deforming models
+    m_geometryArena.init(&m_alloc, &m_uploader,
+                         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                         VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+}
 
 //--------------------------------------------------------------------------------------------------
-// Creating the uniform buffer holding the camera matrices
-// - Buffer is host visible
+// Wait until the geometry of all loaded models is on the GPU
+//
+void PathTracerWindow::finishGeometryUploads()
+{
+    const auto start = std::chrono::steady_clock::now();
+    m_uploader.flush();
+    m_profiler.addHostTime("Upload", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    LOGI("Uploaded %.1f MiB of geometry\n", double(m_uploader.getBytesUploaded()) / (1024.0 * 1024.0));
+}
+
+//--------------------------------------------------------------------------------------------------
+// Creating the ring the camera matrices and the other data written every frame go to
+// - Buffer is host visible, with a region per frame in flight
 //
 void PathTracerWindow::createUniformBuffer()
 {
-    m_bGlobals = m_alloc.createBuffer(sizeof(GlobalUniforms),
-                                      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    m_debug.setObjectName(m_bGlobals.buffer, "Globals");
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    const VkDeviceSize alignment = std::max(properties.limits.minUniformBufferOffsetAlignment,
+                                            properties.limits.minStorageBufferOffsetAlignment);
+    m_uploadRing.init(&m_alloc, m_uploadRingFrameSize, m_swapChain.getImageCount(), alignment,
+                      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    m_debug.setObjectName(m_uploadRing.getBuffer(), "Upload ring");
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -282,77 +569,86 @@ void PathTracerWindow::createObjDescriptionBuffer()
 }
 
 //--------------------------------------------------------------------------------------------------
-// Creating all textures and samplers
+// Create the light BVH over the emissive triangles of all loaded models,
+// which the closest-hit shader walks for next-event estimation, picking
+// lights by their power and how close they are to the shaded point. The
+// lights follow the instances moved with setNodeTransform; deforming a
+// model doesn't move its lights.
 //
-void PathTracerWindow::createTextureImages(const VkCommandBuffer& cmdBuf, const std::vector<std::string>& textures)
+void PathTracerWindow::createLightBuffer()
 {
-    VkSamplerCreateInfo samplerCreateInfo{VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
-    samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
-    samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
-    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-    samplerCreateInfo.maxLod = FLT_MAX;
+    std::vector<glm::mat4> transforms;
+    for (const ObjInstance& instance : m_instances)
+    {
+        transforms.push_back(instance.transform);
+    }
 
-    VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    m_lightBvh.init(&m_alloc, m_emissiveTriangles, transforms, m_swapChain.getImageCount(),
+                    properties.limits.minStorageBufferOffsetAlignment);
+    m_debug.setObjectName(m_lightBvh.getBuffer(), "Lights");
+    LOGI("%u emissive triangles\n", m_lightBvh.getLightCount());
+}
+
+//--------------------------------------------------------------------------------------------------
+// Textures are decoded and uploaded in the background by m_textureStreamer, which must be
+// initialized before loadModel. Textures without mips are BC1 compressed if the device samples BC1.
+//
+void PathTracerWindow::initTextureStreaming()
+{
+    m_textureStreamer.init(&m_alloc, m_physicalDevice, m_graphicsQueueIndex, m_swapChain.getImageCount());
+}
 
+//--------------------------------------------------------------------------------------------------
+// Adding all textures to the streamer; they're sampled as a placeholder until they're uploaded
+//
+void PathTracerWindow::createTextureImages(const std::vector<std::string>& textures)
+{
     // If no textures are present, create a dummy one to accommodate the pipeline layout
-    if (textures.empty() && m_textures.empty())
+    if (textures.empty() && m_textureStreamer.size() == 0)
     {
-        nvvk::Texture texture;
+        const uint8_t white[4]{255u, 255u, 255u, 255u};
+        m_textureStreamer.addColor(white);
+        return;
+    }
 
-        std::array<uint8_t, 4> color{255u, 255u, 255u, 255u};
-        VkDeviceSize bufferSize = sizeof(color);
-        auto imgSize = VkExtent2D{1, 1};
-        auto imageCreateInfo = nvvk::makeImage2DCreateInfo(imgSize, format);
+    for (const auto& texture : textures)
+    {
+        std::stringstream o;
+        o << "media/textures/" << texture;
+        m_textureStreamer.addTexture(nvh::findFile(o.str(), defaultSearchPaths, true));
+    }
+}
 
-        // Creating the dummy texture
-        nvvk::Image image = m_alloc.createImage(cmdBuf, bufferSize, color.data(), imageCreateInfo);
-        VkImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
-        texture = m_alloc.createTexture(image, ivInfo, samplerCreateInfo);
+//--------------------------------------------------------------------------------------------------
+// Called at each frame after beginFrameTiming, outside render passes: reads which textures the
+// last use of this frame sampled, uploads the mips that became resident, and swaps in a
+// descriptor set with the new images once the frames in flight are done with the spare one
+//
+void PathTracerWindow::updateTextureStreaming(const VkCommandBuffer& cmdBuf)
+{
+    m_textureStreamer.readFeedback(getCurFrame());
+    m_textureStreamer.cmdUpdate(cmdBuf);
 
-        // The image format must be in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-        nvvk::cmdBarrierImageLayout(cmdBuf, texture.image, VK_IMAGE_LAYOUT_UNDEFINED,
-                                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        m_textures.push_back(texture);
+    if (m_textureSwapFrames > 0)
+    {
+        m_textureSwapFrames--;
     }
-    else
+    if (m_textureStreamer.descriptorsChanged() && m_textureSwapFrames == 0)
     {
-        // Uploading all images
-        for (const auto& texture : textures)
-        {
-            std::stringstream o;
-            int texWidth, texHeight, texChannels;
-            o << "media/textures/" << texture;
-            std::string txtFile = nvh::findFile(o.str(), defaultSearchPaths, true);
-
-            stbi_uc* stbi_pixels = stbi_load(txtFile.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-            std::array<stbi_uc, 4> color{255u, 0u, 255u, 255u};
-
-            stbi_uc* pixels = stbi_pixels;
-            // Handle failure
-            if (!stbi_pixels)
-            {
-                texWidth = texHeight = 1;
-                texChannels = 4;
-                pixels = reinterpret_cast<stbi_uc*>(color.data());
-            }
-
-            VkDeviceSize bufferSize = static_cast<uint64_t>(texWidth) * texHeight * sizeof(uint8_t) * 4;
-            auto imgSize = VkExtent2D{(uint32_t)texWidth, (uint32_t)texHeight};
-            auto imageCreateInfo = nvvk::makeImage2DCreateInfo(imgSize, format, VK_IMAGE_USAGE_SAMPLED_BIT, true);
-
-            {
-                nvvk::Image image = m_alloc.createImage(cmdBuf, bufferSize, pixels, imageCreateInfo);
-                nvvk::cmdGenerateMipmaps(cmdBuf, image.image, format, imgSize, imageCreateInfo.mipLevels);
-                VkImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
-                nvvk::Texture texture = m_alloc.createTexture(image, ivInfo, samplerCreateInfo);
-
-                m_textures.push_back(texture);
-            }
-
-            stbi_image_free(stbi_pixels);
-        }
+        std::vector<VkDescriptorImageInfo> diit = m_textureStreamer.getDescriptors();
+        VkWriteDescriptorSet wds = m_descSetLayoutBind.makeWriteArray(m_descSetSpare, SceneBindings::eTextures,
+                                                                      diit.data());
+        vkUpdateDescriptorSets(m_device, 1, &wds, 0, nullptr);
+        std::swap(m_descSet, m_descSetSpare);
+        m_textureStreamer.commitDescriptors();
+        // The frames in flight may still use the set that's now the spare one
+        m_textureSwapFrames = m_swapChain.getImageCount();
+        m_resetAccumulation = true;
     }
+
+    m_textureStreamer.cmdClearFeedback(cmdBuf);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -360,32 +656,55 @@ void PathTracerWindow::createTextureImages(const VkCommandBuffer& cmdBuf, const
 //
 void PathTracerWindow::destroyResources()
 {
+    // Stopped first, as it may be creating pipelines with the layouts below
+    m_shaderReloader.deinit();
+    for (auto& retired : m_retiredPipelines)
+    {
+        vkDestroyPipeline(m_device, retired.pipeline, nullptr);
+        m_alloc.destroy(retired.sbt);
+    }
+    m_retiredPipelines.clear();
+
     vkDestroyPipeline(m_device, m_graphicsPipeline, nullptr);
     vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
     vkDestroyDescriptorPool(m_device, m_descPool, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_descSetLayout, nullptr);
 
-    m_alloc.destroy(m_bGlobals);
+    m_uploadRing.deinit();
     m_alloc.destroy(m_bObjDesc);
+    m_lightBvh.deinit();
 
     for (auto& m : m_objModel)
     {
-        m_alloc.destroy(m.vertexBuffer);
-        m_alloc.destroy(m.indexBuffer);
-        m_alloc.destroy(m.matColorBuffer);
-        m_alloc.destroy(m.matIndexBuffer);
+        m_geometryArena.free(m.geometry);
     }
 
-    for (auto& t : m_textures)
-    {
-        m_alloc.destroy(t);
-    }
+    m_textureStreamer.deinit();
+    m_geometryArena.deinit();
+    m_uploader.deinit();
 
     //#Post
     m_alloc.destroy(m_offscreenColor);
     m_alloc.destroy(m_offscreenDepth);
+    m_alloc.destroy(m_offscreenAlbedo);
+    m_alloc.destroy(m_offscreenNormalDepth);
+    m_alloc.destroy(m_historyColor);
+    m_alloc.destroy(m_historyAlbedo);
+    m_alloc.destroy(m_historyNormalDepth);
+    m_alloc.destroy(m_bExposure);
+    m_renderGraph.deinit();
+    m_denoiser.deinit();
+    m_frameTime.deinit();
+    m_profiler.deinit();
+#ifdef PATH_TRACER_RAY_STATS
+    m_alloc.unmap(m_bRayStatsReadback);
+    m_alloc.destroy(m_bRayStatsReadback);
+    m_alloc.destroy(m_bRayStats);
+#endif
     vkDestroyPipeline(m_device, m_postPipeline, nullptr);
+    vkDestroyPipeline(m_device, m_exposurePipeline, nullptr);
     vkDestroyPipelineLayout(m_device, m_postPipelineLayout, nullptr);
+    vkDestroyRenderPass(m_device, m_uiRenderPass, nullptr);
     vkDestroyDescriptorPool(m_device, m_postDescPool, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_postDescSetLayout, nullptr);
     vkDestroyRenderPass(m_device, m_offscreenRenderPass, nullptr);
@@ -393,12 +712,37 @@ void PathTracerWindow::destroyResources()
 
 
     // #VKRay
-    m_rtBuilder.destroy();
+    m_asyncAsBuilder.deinit();
+    for (auto& retired : m_retiredAs)
+    {
+        retired.tlas.deinit();
+        retired.refitter.deinit();
+        for (auto& blas : retired.blas)
+        {
+            m_alloc.destroy(blas);
+        }
+    }
+    m_retiredAs.clear();
+    m_tlas.deinit();
+    m_blasRefitter.deinit();
+    for (auto& blas : m_blas)
+    {
+        m_alloc.destroy(blas);
+    }
+    m_blas.clear();
     vkDestroyPipeline(m_device, m_rtPipeline, nullptr);
     vkDestroyPipelineLayout(m_device, m_rtPipelineLayout, nullptr);
     vkDestroyDescriptorPool(m_device, m_rtDescPool, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_rtDescSetLayout, nullptr);
-    m_alloc.destroy(m_rtSBTBuffer);
+    m_sbt.deinit();
+
+    m_pipelineCompiler.deinit();
+    // Keep the compiled pipelines for the next run
+    if (!savePipelineCache(m_device, m_physicalDevice, m_pipelineCache, m_pipelineCacheFilename))
+    {
+        LOGW("Could not save the pipeline cache to %s\n", m_pipelineCacheFilename.c_str());
+    }
+    vkDestroyPipelineCache(m_device, m_pipelineCache, nullptr);
 
     m_alloc.deinit();
 }
@@ -408,8 +752,6 @@ void PathTracerWindow::destroyResources()
 //
 void PathTracerWindow::rasterize(const VkCommandBuffer& cmdBuf)
 {
-    VkDeviceSize offset{0};
-
     m_debug.beginLabel(cmdBuf, "Rasterize");
 
     // Dynamic Viewport
@@ -417,19 +759,26 @@ void PathTracerWindow::rasterize(const VkCommandBuffer& cmdBuf)
 
     // Drawing all triangles
     vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphicsPipeline);
-    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descSet, 0, nullptr);
+    const uint32_t lightOffset = m_lightBvh.getDynamicOffset(getCurFrame());
+    std::array<uint32_t, 3> dynamicOffsets{m_globalsOffset, lightOffset, lightOffset};  // eGlobals, eLights, eLightBvh
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descSet,
+                            (uint32_t)dynamicOffsets.size(), dynamicOffsets.data());
 
 
     for (const PathTracerWindow::ObjInstance& inst : m_instances)
     {
+        if ((inst.mask & SceneGraph::k_maskCamera) == 0)
+            continue;
         auto& model = m_objModel[inst.objIndex];
         m_pcRaster.objIndex = inst.objIndex; // Telling which object is drawn
         m_pcRaster.modelMatrix = inst.transform;
 
         vkCmdPushConstants(cmdBuf, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
                            sizeof(PushConstantRaster), &m_pcRaster);
-        vkCmdBindVertexBuffers(cmdBuf, 0, 1, &model.vertexBuffer.buffer, &offset);
-        vkCmdBindIndexBuffer(cmdBuf, model.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+        const VkBuffer arenaBuffer = m_geometryArena.getBuffer(model.geometry);
+        const VkDeviceSize vertexOffset = model.geometry.offset + model.vertexOffset;
+        vkCmdBindVertexBuffers(cmdBuf, 0, 1, &arenaBuffer, &vertexOffset);
+        vkCmdBindIndexBuffer(cmdBuf, arenaBuffer, model.geometry.offset + model.indexOffset, VK_INDEX_TYPE_UINT32);
         vkCmdDrawIndexed(cmdBuf, model.nbIndices, 1, 0, 0, 0);
     }
     m_debug.endLabel(cmdBuf);
@@ -441,8 +790,10 @@ void PathTracerWindow::rasterize(const VkCommandBuffer& cmdBuf)
 void PathTracerWindow::onResize(int /*w*/, int /*h*/)
 {
     createOffscreenRender();
+    createRenderGraph();
     updatePostDescriptorSet();
     updateRtDescriptorSet();
+    m_resetAccumulation = true;  // Nothing to accumulate onto or reproject in the new images
 }
 
 void PathTracerWindow::onKeyboardChar(unsigned char key)
@@ -497,13 +848,20 @@ void PathTracerWindow::createOffscreenRender()
 {
     m_alloc.destroy(m_offscreenColor);
     m_alloc.destroy(m_offscreenDepth);
+    m_alloc.destroy(m_offscreenAlbedo);
+    m_alloc.destroy(m_offscreenNormalDepth);
+    m_alloc.destroy(m_historyColor);
+    m_alloc.destroy(m_historyAlbedo);
+    m_alloc.destroy(m_historyNormalDepth);
 
     // Creating the color image
     {
         auto colorCreateInfo = nvvk::makeImage2DCreateInfo(m_size, m_offscreenColorFormat,
                                                            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
                                                            VK_IMAGE_USAGE_SAMPLED_BIT
-                                                           | VK_IMAGE_USAGE_STORAGE_BIT);
+                                                           | VK_IMAGE_USAGE_STORAGE_BIT
+                                                           | VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+                                                           | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
 
 
         nvvk::Image image = m_alloc.createImage(colorCreateInfo);
@@ -513,6 +871,26 @@ void PathTracerWindow::createOffscreenRender()
         m_offscreenColor.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
     }
 
+    // Creating the images of the denoiser guides and the history the ray tracer reprojects. They
+    // carry over between frames, unlike the transient images of m_renderGraph.
+    const std::array<std::pair<nvvk::Texture*, VkFormat>, 5> storageImages{{
+        {&m_offscreenAlbedo, m_offscreenGuideFormat},
+        {&m_offscreenNormalDepth, m_offscreenGuideFormat},
+        {&m_historyColor, m_offscreenColorFormat},
+        {&m_historyAlbedo, m_offscreenGuideFormat},
+        {&m_historyNormalDepth, m_offscreenGuideFormat}
+    }};
+    for (const auto& [texture, format] : storageImages)
+    {
+        auto createInfo = nvvk::makeImage2DCreateInfo(m_size, format,
+                                                      VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                                                      VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+        nvvk::Image image = m_alloc.createImage(createInfo);
+        VkImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, createInfo);
+        *texture = m_alloc.createTexture(image, ivInfo);
+        texture->descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    }
+
     // Creating the depth buffer
     auto depthCreateInfo = nvvk::makeImage2DCreateInfo(m_size, m_offscreenDepthFormat,
                                                        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
@@ -534,6 +912,10 @@ void PathTracerWindow::createOffscreenRender()
         nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
         auto cmdBuf = genCmdBuf.createCommandBuffer();
         nvvk::cmdBarrierImageLayout(cmdBuf, m_offscreenColor.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        for (const auto& [texture, format] : storageImages)
+        {
+            nvvk::cmdBarrierImageLayout(cmdBuf, texture->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        }
         nvvk::cmdBarrierImageLayout(cmdBuf, m_offscreenDepth.image, VK_IMAGE_LAYOUT_UNDEFINED,
                                     VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
 
@@ -566,12 +948,13 @@ void PathTracerWindow::createOffscreenRender()
 }
 
 //--------------------------------------------------------------------------------------------------
-// The pipeline is how things are rendered, which shaders, type of primitives, depth test and more
+// The post pass and the exposure pass are compute pipelines with the same layout. The swap chain
+// images get the post output copied to them, so the UI is drawn in a render pass that keeps it.
 //
 void PathTracerWindow::createPostPipeline()
 {
-    // Push constants in the fragment shader
-    VkPushConstantRange pushConstantRanges = {VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float)};
+    // Push constants in both compute shaders
+    VkPushConstantRange pushConstantRanges = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantPost)};
 
     // Creating the pipeline layout
     VkPipelineLayoutCreateInfo createInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
@@ -581,28 +964,71 @@ void PathTracerWindow::createPostPipeline()
     createInfo.pPushConstantRanges = &pushConstantRanges;
     vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_postPipelineLayout);
 
+    // The subgroup operations of the histogram and of the exposure reduction
+    VkPhysicalDeviceSubgroupProperties subgroupProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES};
+    VkPhysicalDeviceProperties2 properties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, &subgroupProperties};
+    vkGetPhysicalDeviceProperties2(m_physicalDevice, &properties);
+    const VkSubgroupFeatureFlags subgroupFeatures = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT |
+                                                    VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+    if ((subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) == 0 ||
+        (subgroupProperties.supportedOperations & subgroupFeatures) != subgroupFeatures)
+    {
+        throw std::runtime_error("Device lacks the subgroup operations of the post pass in compute shaders");
+    }
 
-    // Pipeline: completely generic, no vertices
-    nvvk::GraphicsPipelineGeneratorCombined pipelineGenerator(m_device, m_postPipelineLayout, m_renderPass);
-    pipelineGenerator.addShader(nvh::loadFile("shaders/passthrough.vert.glsl.spv", true, defaultSearchPaths, true),
-                                VK_SHADER_STAGE_VERTEX_BIT);
-    pipelineGenerator.addShader(nvh::loadFile("shaders/post.frag.glsl.spv", true, defaultSearchPaths, true),
-                                VK_SHADER_STAGE_FRAGMENT_BIT);
-    pipelineGenerator.rasterizationState.cullMode = VK_CULL_MODE_NONE;
-    m_postPipeline = pipelineGenerator.createPipeline();
+    std::vector<std::string> spirv{nvh::loadFile(std::string(m_postShaderSources[0]) + ".spv", true, defaultSearchPaths, true)};
+    m_postPipeline = buildPostPipeline(spirv);
     m_debug.setObjectName(m_postPipeline, "post");
+    spirv = {nvh::loadFile(std::string(m_exposureShaderSources[0]) + ".spv", true, defaultSearchPaths, true)};
+    m_exposurePipeline = buildPostPipeline(spirv);
+    m_debug.setObjectName(m_exposurePipeline, "exposure");
+
+    // Compatible with getRenderPass() and its framebuffers, which the UI is set up with; the copy
+    // leaves the image in the color attachment layout
+    m_uiRenderPass = nvvk::createRenderPass(m_device, {m_colorFormat}, m_depthFormat, 1, false, true,
+                                            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Creates a compute pipeline with the post layout from the SPIR-V of spirv[0], for the post and the
+// exposure passes. Also called on the shader reloader's thread.
+//
+VkPipeline PathTracerWindow::buildPostPipeline(const std::vector<std::string>& spirv)
+{
+    VkComputePipelineCreateInfo pipelineInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    pipelineInfo.stage = {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = nvvk::createShaderModule(m_device, spirv[0]);
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = m_postPipelineLayout;
+    VkPipeline pipeline{VK_NULL_HANDLE};
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
+    vkDestroyShaderModule(m_device, pipelineInfo.stage.module, nullptr);
+    return pipeline;
 }
 
 //--------------------------------------------------------------------------------------------------
-// The descriptor layout is the description of the data that is passed to the vertex or the
-// fragment program.
+// The descriptor layout is the description of the data that is passed to the compute programs,
+// and the exposure state they share from one frame to the next.
 //
 void PathTracerWindow::createPostDescriptor()
 {
-    m_postDescSetLayoutBind.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
+    m_postDescSetLayoutBind.addBinding(ePostInput, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_postDescSetLayoutBind.addBinding(ePostOutput, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_postDescSetLayoutBind.addBinding(ePostExposure, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
     m_postDescSetLayout = m_postDescSetLayoutBind.createLayout(m_device);
-    m_postDescPool = m_postDescSetLayoutBind.createPool(m_device);
+    m_postDescPool = m_postDescSetLayoutBind.createPool(m_device, 2);
     m_postDescSet = nvvk::allocateDescriptorSet(m_device, m_postDescPool, m_postDescSetLayout);
+    m_postDenoisedDescSet = nvvk::allocateDescriptorSet(m_device, m_postDescPool, m_postDescSetLayout);
+
+    // Starting out at an exposure of 1, with an empty histogram
+    nvvk::CommandPool cmdGen(m_device, m_graphicsQueueIndex);
+    auto cmdBuf = cmdGen.createCommandBuffer();
+    const ExposureState exposure{};
+    m_bExposure = m_alloc.createBuffer(cmdBuf, sizeof(ExposureState), &exposure, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    cmdGen.submitAndWait(cmdBuf);
+    m_alloc.finalizeAndReleaseStaging();
+    m_debug.setObjectName(m_bExposure.buffer, "exposure");
 }
 
 
@@ -611,27 +1037,366 @@ void PathTracerWindow::createPostDescriptor()
 //
 void PathTracerWindow::updatePostDescriptorSet()
 {
-    VkWriteDescriptorSet writeDescriptorSets = m_postDescSetLayoutBind.makeWrite(
-        m_postDescSet, 0, &m_offscreenColor.descriptor);
-    vkUpdateDescriptorSets(m_device, 1, &writeDescriptorSets, 0, nullptr);
+    const VkDescriptorBufferInfo exposureInfo{m_bExposure.buffer, 0, VK_WHOLE_SIZE};
+    const VkDescriptorImageInfo& denoisedInfo = m_renderGraph.getDescriptor(m_rgDenoiserImages[0]);
+    const VkDescriptorImageInfo& outputInfo = m_renderGraph.getDescriptor(m_rgPostOutput);
+    std::array<VkWriteDescriptorSet, 6> writeDescriptorSets{
+        m_postDescSetLayoutBind.makeWrite(m_postDescSet, ePostInput, &m_offscreenColor.descriptor),
+        m_postDescSetLayoutBind.makeWrite(m_postDescSet, ePostOutput, &outputInfo),
+        m_postDescSetLayoutBind.makeWrite(m_postDescSet, ePostExposure, &exposureInfo),
+        m_postDescSetLayoutBind.makeWrite(m_postDenoisedDescSet, ePostInput, &denoisedInfo),
+        m_postDescSetLayoutBind.makeWrite(m_postDenoisedDescSet, ePostOutput, &outputInfo),
+        m_postDescSetLayoutBind.makeWrite(m_postDenoisedDescSet, ePostExposure, &exposureInfo)
+    };
+    vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0,
+                           nullptr);
 }
 
 //--------------------------------------------------------------------------------------------------
-// Draw a full screen quad with the attached image
+// Tonemap the attached image, or the output of the denoiser if `denoised`, into the post output
+// of m_renderGraph, with the exposure adaptExposure found last frame
 //
-void PathTracerWindow::drawPost(VkCommandBuffer cmdBuf)
+void PathTracerWindow::postProcess(VkCommandBuffer cmdBuf, bool denoised)
 {
     m_debug.beginLabel(cmdBuf, "Post");
+    const uint32_t section = m_profiler.cmdBeginSection(cmdBuf, "Post", true);
 
-    setViewport(cmdBuf);
+    const VkDescriptorSet postDescSet = denoised ? m_postDenoisedDescSet : m_postDescSet;
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_postPipelineLayout, 0, 1, &postDescSet, 0,
+                            nullptr);
+    vkCmdPushConstants(cmdBuf, m_postPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantPost), &m_pcPost);
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_postPipeline);
+    const uint32_t workgroupSize = 16;  // POST_WORKGROUP_SIZE of shaders/host_device.h
+    vkCmdDispatch(cmdBuf, (m_size.width + workgroupSize - 1) / workgroupSize,
+                  (m_size.height + workgroupSize - 1) / workgroupSize, 1);
 
-    auto aspectRatio = static_cast<float>(m_size.width) / static_cast<float>(m_size.height);
-    vkCmdPushConstants(cmdBuf, m_postPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float), &aspectRatio);
-    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipeline);
-    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipelineLayout, 0, 1, &m_postDescSet, 0,
+    m_profiler.cmdEndSection(cmdBuf, section);
+    m_debug.endLabel(cmdBuf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Moves the exposure towards the one of the histogram postProcess made, for the next frame
+//
+void PathTracerWindow::adaptExposure(VkCommandBuffer cmdBuf)
+{
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_postPipelineLayout, 0, 1, &m_postDescSet, 0,
                             nullptr);
-    vkCmdDraw(cmdBuf, 3, 1, 0, 0);
+    vkCmdPushConstants(cmdBuf, m_postPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantPost), &m_pcPost);
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_exposurePipeline);
+    vkCmdDispatch(cmdBuf, 1, 1, 1);
+}
+
+//--------------------------------------------------------------------------------------------------
+// The swap chain images aren't created for storage, so the post pass writes the post output, and
+// a blit copies it over, converting it to the swap chain format
+//
+void PathTracerWindow::copyToSwapChain(VkCommandBuffer cmdBuf)
+{
+    const VkImageSubresourceLayers layers{VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    const VkOffset3D extent{static_cast<int32_t>(m_size.width), static_cast<int32_t>(m_size.height), 1};
+    const VkImageBlit region{layers, {{0, 0, 0}, extent}, layers, {{0, 0, 0}, extent}};
+    vkCmdBlitImage(cmdBuf, m_renderGraph.getImage(m_rgPostOutput), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   m_swapChain.getActiveImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_NEAREST);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Frame
+//////////////////////////////////////////////////////////////////////////
+
+//--------------------------------------------------------------------------------------------------
+// The passes of a frame, with what each does with the images and buffers of the others. Called
+// after createOffscreenRender, createDenoiser and createPostDescriptor, on resize too, and before
+// updatePostDescriptorSet, which points the post pass at its transient images.
+// The images the denoiser iterates on and the post output only hold data within the frame, and
+// the second denoiser image is done before the post pass starts, so it shares its memory.
+//
+void PathTracerWindow::createRenderGraph()
+{
+    using Use = RenderGraph::Use;
+    m_renderGraph.clear();
+
+    // createOffscreenRender leaves the images in the general layout, and waits for it
+    const auto importImage = [this](const char* name, const nvvk::Texture& texture) {
+        return m_renderGraph.importImage(name, texture.image, VK_IMAGE_LAYOUT_GENERAL);
+    };
+    const RenderGraph::Resource color = importImage("color", m_offscreenColor);
+    const RenderGraph::Resource albedo = importImage("albedo", m_offscreenAlbedo);
+    const RenderGraph::Resource normalDepth = importImage("normal depth", m_offscreenNormalDepth);
+    const RenderGraph::Resource historyColor = importImage("history color", m_historyColor);
+    const RenderGraph::Resource historyAlbedo = importImage("history albedo", m_historyAlbedo);
+    const RenderGraph::Resource historyNormalDepth = importImage("history normal depth", m_historyNormalDepth);
+    const RenderGraph::Resource exposure = m_renderGraph.importBuffer("exposure", m_bExposure.buffer);
+    // Set to the image of each frame by renderFrame
+    m_rgSwapChain = m_renderGraph.importImage("swap chain", VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED);
+
+    m_rgDenoiserImages[0] = m_renderGraph.createTransientImage("denoiser ping", Denoiser::makeImageCreateInfo(m_size));
+    m_rgDenoiserImages[1] = m_renderGraph.createTransientImage("denoiser pong", Denoiser::makeImageCreateInfo(m_size));
+    m_rgPostOutput = m_renderGraph.createTransientImage(
+        "post output", nvvk::makeImage2DCreateInfo(m_size, m_postOutputFormat,
+                                                   VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT));
+
+    const VkPipelineStageFlags2 rtStage = VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR;
+    const VkPipelineStageFlags2 computeStage = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    const VkAccessFlags2 storageRead = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+    const VkAccessFlags2 storageReadWrite = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+    // If instances moved, the accumulation starts over
+    m_renderGraph.addPass("Clear accumulation",
+                          {Use{color, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL}},
+                          [this](VkCommandBuffer cmdBuf) { clearAccumulation(cmdBuf); },
+                          [this] { return m_frameSettings.raytrace && m_resetAccumulation; });
+    // If only the camera moved, the ray tracer reprojects the last frame, see updateUniformBuffer
+    m_renderGraph.addPass("Copy to history",
+                          {Use{color, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT},
+                           Use{albedo, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT},
+                           Use{normalDepth, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT},
+                           Use{historyColor, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT},
+                           Use{historyAlbedo, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT},
+                           Use{historyNormalDepth, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT}},
+                          [this](VkCommandBuffer cmdBuf) { copyToHistory(cmdBuf); },
+                          [this] { return m_frameSettings.raytrace && m_reprojectHistory; });
+
+    m_renderGraph.addPass("Ray trace",
+                          {Use{color, rtStage, storageReadWrite},
+                           Use{albedo, rtStage, storageReadWrite},
+                           Use{normalDepth, rtStage, storageReadWrite},
+                           Use{historyColor, rtStage, storageRead},
+                           Use{historyAlbedo, rtStage, storageRead},
+                           Use{historyNormalDepth, rtStage, storageRead}},
+                          [this](VkCommandBuffer cmdBuf) { raytrace(cmdBuf, m_frameSettings.clearColor); },
+                          [this] { return m_frameSettings.raytrace; });
+    // The offscreen render pass starts and ends in the general layout
+    m_renderGraph.addPass("Rasterize",
+                          {Use{color, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                               VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT}},
+                          [this](VkCommandBuffer cmdBuf) {
+                              const glm::vec4& clearColor = m_frameSettings.clearColor;
+                              std::array<VkClearValue, 2> clearValues{};
+                              clearValues[0].color = {{clearColor[0], clearColor[1], clearColor[2], clearColor[3]}};
+                              clearValues[1].depthStencil = {1.0f, 0};
+                              VkRenderPassBeginInfo beginInfo{VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+                              beginInfo.clearValueCount = 2;
+                              beginInfo.pClearValues = clearValues.data();
+                              beginInfo.renderPass = m_offscreenRenderPass;
+                              beginInfo.framebuffer = m_offscreenFramebuffer;
+                              beginInfo.renderArea = {{0, 0}, m_size};
+                              vkCmdBeginRenderPass(cmdBuf, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+                              rasterize(cmdBuf);
+                              vkCmdEndRenderPass(cmdBuf);
+                          },
+                          [this] { return !m_frameSettings.raytrace; });
+
+    // Only the ray traced image is denoised
+    const auto denoised = [this] { return m_frameSettings.raytrace && m_frameSettings.denoise; };
+    m_renderGraph.addPass("Denoise",
+                          {Use{color, computeStage, storageRead},
+                           Use{albedo, computeStage, storageRead},
+                           Use{normalDepth, computeStage, storageRead},
+                           Use{m_rgDenoiserImages[0], computeStage, storageReadWrite},
+                           Use{m_rgDenoiserImages[1], computeStage, storageReadWrite}},
+                          [this](VkCommandBuffer cmdBuf) { denoise(cmdBuf); }, denoised);
+
+    // The post pass reads the last frame's exposure, and adds to the histogram the exposure pass
+    // clears after it
+    const Use postExposure{exposure, computeStage, storageReadWrite};
+    const Use postOutput{m_rgPostOutput, computeStage, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT};
+    m_renderGraph.addPass("Post", {Use{color, computeStage, storageRead}, postOutput, postExposure},
+                          [this](VkCommandBuffer cmdBuf) { postProcess(cmdBuf, false); },
+                          [denoised] { return !denoised(); });
+    m_renderGraph.addPass("Post denoised", {Use{m_rgDenoiserImages[0], computeStage, storageRead}, postOutput, postExposure},
+                          [this](VkCommandBuffer cmdBuf) { postProcess(cmdBuf, true); }, denoised);
+    m_renderGraph.addPass("Exposure", {postExposure}, [this](VkCommandBuffer cmdBuf) { adaptExposure(cmdBuf); });
+
+    m_renderGraph.addPass("Copy to swap chain",
+                          {Use{m_rgPostOutput, VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
+                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL},
+                           Use{m_rgSwapChain, VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL}},
+                          [this](VkCommandBuffer cmdBuf) { copyToSwapChain(cmdBuf); });
+    // m_uiRenderPass keeps the copied image, and leaves it in the present layout
+    m_renderGraph.addPass("UI",
+                          {Use{m_rgSwapChain, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                               VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                               VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}},
+                          [this](VkCommandBuffer cmdBuf) {
+                              std::array<VkClearValue, 2> clearValues{};
+                              clearValues[1].depthStencil = {1.0f, 0};
+                              VkRenderPassBeginInfo beginInfo{VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+                              beginInfo.clearValueCount = 2;
+                              beginInfo.pClearValues = clearValues.data();
+                              beginInfo.renderPass = m_uiRenderPass;
+                              beginInfo.framebuffer = getFramebuffers()[getCurFrame()];
+                              beginInfo.renderArea = {{0, 0}, m_size};
+                              vkCmdBeginRenderPass(cmdBuf, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+                              if (m_frameSettings.drawUi)
+                              {
+                                  m_frameSettings.drawUi(cmdBuf);
+                              }
+                              vkCmdEndRenderPass(cmdBuf);
+                          });
+
+    m_renderGraph.compile();
+    m_denoiser.setImages(m_size, m_offscreenColor.descriptor.imageView, m_offscreenAlbedo.descriptor.imageView,
+                         m_offscreenNormalDepth.descriptor.imageView,
+                         m_renderGraph.getDescriptor(m_rgDenoiserImages[0]).imageView,
+                         m_renderGraph.getDescriptor(m_rgDenoiserImages[1]).imageView);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Record the passes of m_renderGraph, from the ray tracing or rasterization to the UI, with
+// `settings`. Called after the updates of the scene and its acceleration structures.
+//
+void PathTracerWindow::renderFrame(const VkCommandBuffer& cmdBuf, const FrameSettings& settings)
+{
+    m_frameSettings = settings;
+    // This frame's fence was waited on, so its region of the ring is free again
+    m_uploadRing.begin(getCurFrame());
+    updateUniformBuffer();
+    // The acquire semaphore of the image is waited on at the color attachment output stage
+    m_renderGraph.setImportedImage(m_rgSwapChain, m_swapChain.getActiveImage(), VK_IMAGE_LAYOUT_UNDEFINED,
+                                   VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT);
+    m_renderGraph.execute(cmdBuf);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Denoising
+//////////////////////////////////////////////////////////////////////////
+
+//--------------------------------------------------------------------------------------------------
+// The denoiser reads the accumulated color and the guides written by the ray tracer, and
+// createRenderGraph points it at them. Must be called before createRenderGraph.
+//
+void PathTracerWindow::createDenoiser()
+{
+    m_denoiser.init(&m_alloc, nvh::loadFile("shaders/denoise.comp.glsl.spv", true, defaultSearchPaths, true),
+                    m_pipelineCache);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Measures the GPU time of each frame with timestamps on the graphics queue, to pick the samples
+// per frame of the ray tracer
+//
+void PathTracerWindow::initFrameTimeController()
+{
+    m_frameTime.init(m_device, m_physicalDevice, m_graphicsQueueIndex, m_swapChain.getImageCount());
+}
 
+//--------------------------------------------------------------------------------------------------
+// First and last in the command buffer of each frame; updateUniformBuffer must come after
+// beginFrameTiming, which picks the samples of the frame from what the last ones measured
+//
+void PathTracerWindow::beginFrameTiming(const VkCommandBuffer& cmdBuf)
+{
+    m_frameTime.cmdBeginFrame(cmdBuf, getCurFrame());
+#ifdef PATH_TRACER_RAY_STATS
+    readRayStats();
+#endif
+    // The sections the last use of this frame measured, then the queries of this one
+    m_profiler.collect(getCurFrame());
+    m_profiler.cmdBeginSet(cmdBuf, getCurFrame());
+}
+
+void PathTracerWindow::endFrameTiming(const VkCommandBuffer& cmdBuf)
+{
+    // Which textures this frame sampled, read when its command buffer is reused
+    m_textureStreamer.cmdCopyFeedback(cmdBuf, getCurFrame());
+    m_frameTime.cmdEndFrame(cmdBuf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Times the passes of each frame with timestamps on the graphics queue, one set of queries per
+// frame in flight. Must be called before loadModel, as the setup work is timed as well.
+//
+void PathTracerWindow::initProfiler()
+{
+    m_profiler.init(m_device, m_physicalDevice, m_graphicsQueueIndex, m_swapChain.getImageCount());
+}
+
+//--------------------------------------------------------------------------------------------------
+// Write what the profiler measured so far to `basename`.json and `basename`.csv
+//
+void PathTracerWindow::saveProfile(const std::string& basename)
+{
+    if (!m_profiler.writeJson(basename + ".json") || !m_profiler.writeCsv(basename + ".csv"))
+    {
+        LOGE("Could not write the profile to %s.json and %s.csv\n", basename.c_str(), basename.c_str());
+        return;
+    }
+    LOGI("Wrote the profile to %s.json and %s.csv\n", basename.c_str(), basename.c_str());
+}
+
+#ifdef PATH_TRACER_RAY_STATS
+//--------------------------------------------------------------------------------------------------
+// The counters of the instrumentation build, cleared before and copied out after the ray tracing
+// of each frame; the copy of a frame is read when its command buffer is reused, like the queries
+//
+void PathTracerWindow::createRayStatsBuffers()
+{
+    const uint32_t numFrames = m_swapChain.getImageCount();
+    m_bRayStats = m_alloc.createBuffer(sizeof(RayStats),
+                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                       VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_debug.setObjectName(m_bRayStats.buffer, "RayStats");
+    m_bRayStatsReadback = m_alloc.createBuffer(numFrames * sizeof(RayStats), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    m_rayStatsMapped = static_cast<const RayStats*>(m_alloc.map(m_bRayStatsReadback));
+    m_rayStatsWritten.assign(numFrames, false);
+}
+
+void PathTracerWindow::cmdClearRayStats(const VkCommandBuffer& cmdBuf)
+{
+    // After the copy of the last frame read them
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                         nullptr, 0, nullptr);
+    vkCmdFillBuffer(cmdBuf, m_bRayStats.buffer, 0, sizeof(RayStats), 0);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1,
+                         &barrier, 0, nullptr, 0, nullptr);
+}
+
+void PathTracerWindow::cmdCopyRayStats(const VkCommandBuffer& cmdBuf)
+{
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+                         &barrier, 0, nullptr, 0, nullptr);
+    const VkBufferCopy region{0, getCurFrame() * sizeof(RayStats), sizeof(RayStats)};
+    vkCmdCopyBuffer(cmdBuf, m_bRayStats.buffer, m_bRayStatsReadback.buffer, 1, &region);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0,
+                         nullptr, 0, nullptr);
+    m_rayStatsWritten[getCurFrame()] = true;
+}
+
+// Called once the fence of the current frame signaled, from beginFrameTiming
+void PathTracerWindow::readRayStats()
+{
+    if (m_rayStatsMapped != nullptr && m_rayStatsWritten[getCurFrame()])
+    {
+        m_rayStats = m_rayStatsMapped[getCurFrame()];
+        m_rayStatsWritten[getCurFrame()] = false;
+    }
+}
+#endif
+
+//--------------------------------------------------------------------------------------------------
+// Filter the image ray traced this frame; postProcess then shows it with `denoised`. Selectable per
+// frame, as the accumulation underneath goes on either way.
+//
+void PathTracerWindow::denoise(const VkCommandBuffer& cmdBuf)
+{
+    m_debug.beginLabel(cmdBuf, "Denoise");
+    const uint32_t section = m_profiler.cmdBeginSection(cmdBuf, "Denoise", true);
+    m_denoiser.cmdDenoise(cmdBuf);
+    m_profiler.cmdEndSection(cmdBuf, section);
     m_debug.endLabel(cmdBuf);
 }
 
@@ -647,9 +1412,8 @@ void PathTracerWindow::initRayTracing()
     // Requesting ray tracing properties
     VkPhysicalDeviceProperties2 prop2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
     prop2.pNext = &m_rtProperties;
+    m_rtProperties.pNext = &m_asProperties;
     vkGetPhysicalDeviceProperties2(m_physicalDevice, &prop2);
-
-    m_rtBuilder.setup(m_device, &m_alloc, m_graphicsQueueIndex);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -658,8 +1422,8 @@ void PathTracerWindow::initRayTracing()
 auto PathTracerWindow::objectToVkGeometryKHR(const ObjModel& model)
 {
     // BLAS builder requires raw device addresses.
-    VkDeviceAddress vertexAddress = nvvk::getBufferDeviceAddress(m_device, model.vertexBuffer.buffer);
-    VkDeviceAddress indexAddress = nvvk::getBufferDeviceAddress(m_device, model.indexBuffer.buffer);
+    VkDeviceAddress vertexAddress = m_geometryArena.getAddress(model.geometry) + model.vertexOffset;
+    VkDeviceAddress indexAddress = m_geometryArena.getAddress(model.geometry) + model.indexOffset;
 
     uint32_t maxPrimitiveCount = model.nbIndices / 3;
 
@@ -680,10 +1444,12 @@ auto PathTracerWindow::objectToVkGeometryKHR(const ObjModel& model)
     //triangles.transformData = {};
     triangles.maxVertex = model.nbVertices - 1;
 
-    // Identify the above data as containing opaque triangles.
+    // Opaque models never invoke the any-hit shader. The others invoke it at most once per triangle
+    // and ray, so that the stochastic test of a dissolve isn't drawn twice.
     VkAccelerationStructureGeometryKHR asGeom{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR};
     asGeom.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
-    asGeom.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+    asGeom.flags = model.opacity == OpacityClass::eOpaque ? VK_GEOMETRY_OPAQUE_BIT_KHR
+                                                          : VK_GEOMETRY_NO_DUPLICATE_ANY_HIT_INVOCATION_BIT_KHR;
     asGeom.geometry.triangles = triangles;
 
     // The entire array will be used to build the BLAS.
@@ -697,14 +1463,18 @@ auto PathTracerWindow::objectToVkGeometryKHR(const ObjModel& model)
     nvvk::RaytracingBuilderKHR::BlasInput input;
     input.asGeometry.emplace_back(asGeom);
     input.asBuildOffsetInfo.emplace_back(offset);
+    if (model.deformable)
+    {
+        input.flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;  // Refit when its vertices change
+    }
 
     return input;
 }
 
 //--------------------------------------------------------------------------------------------------
+// The BLAS input of each model, in model order
 //
-//
-void PathTracerWindow::createBottomLevelAS()
+std::vector<nvvk::RaytracingBuilderKHR::BlasInput> PathTracerWindow::getBlasInputs()
 {
     // BLAS - Storing each primitive in a geometry
     std::vector<nvvk::RaytracingBuilderKHR::BlasInput> allBlas;
@@ -716,28 +1486,321 @@ void PathTracerWindow::createBottomLevelAS()
         // We could add more geometry in each BLAS, but we add only one for now
         allBlas.emplace_back(blas);
     }
-    m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+    return allBlas;
 }
 
 //--------------------------------------------------------------------------------------------------
+// Deformable models were built with ALLOW_UPDATE and left uncompacted, so they can be refit
 //
+void PathTracerWindow::initBlasRefitter(const std::vector<nvvk::RaytracingBuilderKHR::BlasInput>& blasInputs)
+{
+    std::vector<BlasRefitter::Entry> deformable;
+    for (uint32_t i = 0; i < static_cast<uint32_t>(m_objModel.size()); i++)
+    {
+        if (m_objModel[i].deformable)
+        {
+            BlasRefitter::Entry entry;
+            entry.id = i;
+            entry.accel = m_blas[i].accel;
+            entry.input = blasInputs[i];
+            entry.flags = blasInputs[i].flags | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+                          | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+            deformable.push_back(entry);
+        }
+    }
+    m_blasRefitter.init(&m_alloc, deformable, m_swapChain.getImageCount(),
+                        m_asProperties.minAccelerationStructureScratchOffsetAlignment);
+}
+
+//--------------------------------------------------------------------------------------------------
 //
-void PathTracerWindow::createTopLevelAS()
+//
+void PathTracerWindow::createBottomLevelAS()
+{
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<nvvk::RaytracingBuilderKHR::BlasInput> allBlas = getBlasInputs();
+
+    // Build all models in batches of at most m_blasBuildBudget bytes, compacting each batch
+    nvvk::CommandPool cmdPool(m_device, m_graphicsQueueIndex);
+    BlasBuildStats stats;
+    m_blas = buildBlasBatched(m_alloc, cmdPool, allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+                              m_blasBuildBudget, m_asProperties.minAccelerationStructureScratchOffsetAlignment, &stats);
+    for (size_t i = 0; i < m_blas.size(); i++)
+    {
+        m_debug.setObjectName(m_blas[i].accel, "blas_" + std::to_string(i));
+    }
+    initBlasRefitter(allBlas);
+    m_profiler.addHostTime("BLAS build", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+    const double toMiB = 1.0 / (1024.0 * 1024.0);
+    const double saved = (stats.originalSize == 0) ? 0.0 : 100.0 * double(stats.originalSize - stats.compactSize) / double(stats.originalSize);
+    LOGI("Built %u BLAS in %u batches; compacted from %.2f MiB to %.2f MiB (%.1f%% saved)\n", stats.numBlas,
+         stats.numBatches, double(stats.originalSize) * toMiB, double(stats.compactSize) * toMiB, saved);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Device address of the BLAS of model `objIndex`, as referenced by TLAS instances
+//
+VkDeviceAddress PathTracerWindow::getBlasDeviceAddress(uint32_t objIndex) const
+{
+    VkAccelerationStructureDeviceAddressInfoKHR addressInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR};
+    addressInfo.accelerationStructure = m_blas[objIndex].accel;
+    return vkGetAccelerationStructureDeviceAddressKHR(m_device, &addressInfo);
+}
+
+//--------------------------------------------------------------------------------------------------
+// The TLAS instances of the scene, each referencing its BLAS by model index
+//
+VkAccelerationStructureInstanceKHR PathTracerWindow::getTlasInstance(const ObjInstance& inst) const
+{
+    VkAccelerationStructureInstanceKHR rayInst{};
+    rayInst.transform = nvvk::toTransformMatrixKHR(inst.transform); // Position of the instance
+    rayInst.instanceCustomIndex = inst.objIndex; // gl_InstanceCustomIndexEXT
+    rayInst.accelerationStructureReference = inst.objIndex; // Index of the BLAS, until replaced by its address
+    rayInst.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+    rayInst.mask = inst.mask; //  Only be hit if rayMask & instance.mask != 0, see INSTANCE_MASK_*
+    rayInst.instanceShaderBindingTableRecordOffset = inst.objIndex * eRayTypeCount; // The hit record set of its model
+    return rayInst;
+}
+
+std::vector<VkAccelerationStructureInstanceKHR> PathTracerWindow::getTlasInstances() const
 {
     std::vector<VkAccelerationStructureInstanceKHR> tlas;
     tlas.reserve(m_instances.size());
     for (const PathTracerWindow::ObjInstance& inst : m_instances)
     {
-        VkAccelerationStructureInstanceKHR rayInst{};
-        rayInst.transform = nvvk::toTransformMatrixKHR(inst.transform); // Position of the instance
-        rayInst.instanceCustomIndex = inst.objIndex; // gl_InstanceCustomIndexEXT
-        rayInst.accelerationStructureReference = m_rtBuilder.getBlasDeviceAddress(inst.objIndex);
-        rayInst.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-        rayInst.mask = 0xFF; //  Only be hit if rayMask & instance.mask != 0
-        rayInst.instanceShaderBindingTableRecordOffset = 0; // We will use the same hit group for all objects
-        tlas.emplace_back(rayInst);
+        tlas.emplace_back(getTlasInstance(inst));
+    }
+    return tlas;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Write instance `instanceIndex` of m_instances to the TLAS, with the address of its BLAS
+//
+void PathTracerWindow::setTlasInstance(uint32_t instanceIndex)
+{
+    VkAccelerationStructureInstanceKHR rayInst = getTlasInstance(m_instances[instanceIndex]);
+    rayInst.accelerationStructureReference = getBlasDeviceAddress(m_instances[instanceIndex].objIndex);
+    m_tlas.setInstance(instanceIndex, rayInst);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//
+void PathTracerWindow::createTopLevelAS()
+{
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<VkAccelerationStructureInstanceKHR> tlas = getTlasInstances();
+    for (VkAccelerationStructureInstanceKHR& rayInst : tlas)
+    {
+        rayInst.accelerationStructureReference = getBlasDeviceAddress(rayInst.instanceCustomIndex);
+    }
+    // The TLAS keeps one copy of the instances per frame in flight, so that they can move while frames render
+    nvvk::CommandPool cmdPool(m_device, m_graphicsQueueIndex);
+    VkCommandBuffer cmdBuf = cmdPool.createCommandBuffer();
+    m_tlas.init(&m_alloc, cmdBuf, tlas, m_swapChain.getImageCount(),
+                m_asProperties.minAccelerationStructureScratchOffsetAlignment);
+    cmdPool.submitAndWait(cmdBuf);
+    m_profiler.addHostTime("TLAS build", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    m_debug.setObjectName(m_tlas.getAccelerationStructure(), "tlas");
+}
+
+//--------------------------------------------------------------------------------------------------
+// Start rebuilding all BLASes and the TLAS on the async compute queue. The
+// current ones stay in use until updateAccelerationStructureSwap swaps them.
+//
+bool PathTracerWindow::rebuildAccelerationStructures()
+{
+    // The spare descriptor set and the retired structures are only free once the last swap is done with
+    if (m_asyncAsBuilder.isBuilding() || !m_retiredAs.empty())
+    {
+        LOGW("An acceleration structure rebuild is still in progress\n");
+        return false;
+    }
+    m_asyncBuildInstances = m_instances;
+    return m_asyncAsBuilder.start(getBlasInputs(), VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+                                  m_blasBuildBudget, getTlasInstances(), m_swapChain.getImageCount(),
+                                  m_asProperties.minAccelerationStructureScratchOffsetAlignment);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Called at each frame, after its fence was waited on and before its command
+// buffer is recorded: advances the async rebuild, swaps in its structures once
+// they're ready, and destroys the ones swapped out when no frame uses them anymore
+//
+void PathTracerWindow::updateAccelerationStructureSwap()
+{
+    for (auto it = m_retiredAs.begin(); it != m_retiredAs.end();)
+    {
+        if (--it->framesLeft == 0)
+        {
+            it->tlas.deinit();
+            it->refitter.deinit();
+            for (auto& blas : it->blas)
+            {
+                m_alloc.destroy(blas);
+            }
+            it = m_retiredAs.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    if (!m_asyncAsBuilder.poll())
+    {
+        return;
+    }
+
+    // The frames in flight still trace the current structures
+    RetiredAccelerationStructures retired;
+    retired.blas = std::move(m_blas);
+    retired.tlas = m_tlas;
+    retired.refitter = m_blasRefitter;
+    retired.framesLeft = m_swapChain.getImageCount();
+    m_retiredAs.push_back(std::move(retired));
+    m_tlas = DynamicTlas();
+    m_blasRefitter = BlasRefitter();
+
+    BlasBuildStats stats;
+    m_asyncAsBuilder.acquire(m_blas, m_tlas, &stats);
+    for (size_t i = 0; i < m_blas.size(); i++)
+    {
+        m_debug.setObjectName(m_blas[i].accel, "blas_" + std::to_string(i));
+    }
+    m_debug.setObjectName(m_tlas.getAccelerationStructure(), "tlas");
+
+    // Catch up on what changed while the rebuild was running
+    for (uint32_t i = 0; i < static_cast<uint32_t>(m_instances.size()); i++)
+    {
+        if (m_instances[i].transform != m_asyncBuildInstances[i].transform ||
+            m_instances[i].mask != m_asyncBuildInstances[i].mask)
+        {
+            setTlasInstance(i);
+        }
+    }
+    initBlasRefitter(getBlasInputs());
+    for (uint32_t i = 0; i < static_cast<uint32_t>(m_objModel.size()); i++)
+    {
+        markModelDeformed(i);
+    }
+
+    // m_rtDescSet may still be in use by the frames in flight, so the new TLAS goes into the spare set
+    VkAccelerationStructureKHR tlas = m_tlas.getAccelerationStructure();
+    VkWriteDescriptorSetAccelerationStructureKHR descASInfo{
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR
+    };
+    descASInfo.accelerationStructureCount = 1;
+    descASInfo.pAccelerationStructures = &tlas;
+    VkWriteDescriptorSet wds = m_rtDescSetLayoutBind.makeWrite(m_rtDescSetSpare, RtxBindings::eTlas, &descASInfo);
+    vkUpdateDescriptorSets(m_device, 1, &wds, 0, nullptr);
+    std::swap(m_rtDescSet, m_rtDescSetSpare);
+    m_resetAccumulation = true;
+
+    const double toMiB = 1.0 / (1024.0 * 1024.0);
+    LOGI("Swapped in %u BLAS rebuilt on the async compute queue in %u batches (%.2f MiB compacted)\n", stats.numBlas,
+         stats.numBatches, double(stats.compactSize) * toMiB);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Move a node of the scene graph, and everything below it, or change which
+// rays see it; the instances are only re-flattened by the next updateSceneGraph
+//
+void PathTracerWindow::setNodeTransform(uint32_t node, const glm::mat4& transform)
+{
+    m_sceneGraph.setTransform(node, transform);
+}
+
+void PathTracerWindow::setNodeMask(uint32_t node, uint8_t mask)
+{
+    m_sceneGraph.setMask(node, mask);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Re-flatten the subtrees of the scene graph below the nodes changed since
+// the last frame, before updateTopLevelAS and updateLights: the TLAS is refit
+// (or rebuilt) for the instances that moved, and the light BVH as well
+//
+void PathTracerWindow::updateSceneGraph()
+{
+    if (!m_sceneGraph.update(m_instances, m_changedInstances))
+        return;
+    for (uint32_t instanceIndex : m_changedInstances)
+    {
+        setTlasInstance(instanceIndex);
+        m_lightBvh.setTransform(instanceIndex, m_instances[instanceIndex].transform);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Replace vertices of a deformable model, e.g. for a CPU-animated mesh. The
+// copy and the BLAS refit are recorded by the next updateBottomLevelAS, so
+// this must be called after the fence of the current frame has been waited on.
+//
+void PathTracerWindow::updateModelVertices(uint32_t objIndex, uint32_t firstVertex, uint32_t vertexCount,
+                                           const VertexObj* vertices)
+{
+    const ObjModel& model = m_objModel[objIndex];
+    if (!model.deformable || firstVertex + vertexCount > model.nbVertices)
+    {
+        LOGW("Vertices %u..%u of model %u can't be updated\n", firstVertex, firstVertex + vertexCount, objIndex);
+        return;
+    }
+    if (!m_blasRefitter.updateVertices(getCurFrame(), objIndex, m_geometryArena.getBuffer(model.geometry),
+                                       model.geometry.offset + model.vertexOffset +
+                                       VkDeviceSize(firstVertex) * sizeof(VertexObj), vertices,
+                                       VkDeviceSize(vertexCount) * sizeof(VertexObj)))
+    {
+        LOGW("Out of staging memory for the vertices of model %u this frame\n", objIndex);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// The vertices of a deformable model were written on the GPU (e.g. by a
+// skinning shader recorded before updateBottomLevelAS); refit its BLAS
+//
+void PathTracerWindow::markModelDeformed(uint32_t objIndex)
+{
+    if (m_blasRefitter.contains(objIndex))
+    {
+        m_blasRefitter.markDeformed(objIndex);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Record the vertex copies and BLAS refits of the deformed models, before updateTopLevelAS
+//
+void PathTracerWindow::updateBottomLevelAS(const VkCommandBuffer& cmdBuf)
+{
+    const uint32_t section = m_profiler.cmdBeginSection(cmdBuf, "BLAS refit", true);
+    if (!m_blasRefitter.cmdRefit(cmdBuf, getCurFrame()).empty())
+    {
+        m_tlas.markBlasChanged();  // The instances of the refit models have new bounds
     }
-    m_rtBuilder.buildTlas(tlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+    m_profiler.cmdEndSection(cmdBuf, section);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Record the TLAS update for the instances moved since the last frame, before ray tracing
+//
+void PathTracerWindow::updateTopLevelAS(const VkCommandBuffer& cmdBuf)
+{
+    const uint32_t section = m_profiler.cmdBeginSection(cmdBuf, "TLAS update");
+    if (m_tlas.cmdUpdate(cmdBuf, getCurFrame()))
+    {
+        m_resetAccumulation = true;  // The accumulated image doesn't match the scene anymore
+    }
+    m_profiler.cmdEndSection(cmdBuf, section);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Refit the light BVH to the instances moved since the last frame, and write it to the copy of
+// this frame, before ray tracing
+//
+void PathTracerWindow::updateLights()
+{
+    m_lightBvh.update(getCurFrame());
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -750,29 +1813,53 @@ void PathTracerWindow::createRtDescriptorSet()
                                      VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR); // TLAS
     m_rtDescSetLayoutBind.addBinding(RtxBindings::eOutImage, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
                                      VK_SHADER_STAGE_RAYGEN_BIT_KHR); // Output image
+    m_rtDescSetLayoutBind.addBinding(RtxBindings::eAlbedoImage, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+                                     VK_SHADER_STAGE_RAYGEN_BIT_KHR); // Denoiser guides
+    m_rtDescSetLayoutBind.addBinding(RtxBindings::eNormalDepthImage, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+                                     VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+    for (uint32_t binding : {RtxBindings::eHistoryColor, RtxBindings::eHistoryAlbedo, RtxBindings::eHistoryNormalDepth})
+    {
+        m_rtDescSetLayoutBind.addBinding(binding, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+                                         VK_SHADER_STAGE_RAYGEN_BIT_KHR); // Last frame, for reprojection
+    }
+#ifdef PATH_TRACER_RAY_STATS
+    m_rtDescSetLayoutBind.addBinding(RtxBindings::eRayStats, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                     VK_SHADER_STAGE_RAYGEN_BIT_KHR); // Instrumentation counters
+#endif
 
-    m_rtDescPool = m_rtDescSetLayoutBind.createPool(m_device);
+    m_rtDescPool = m_rtDescSetLayoutBind.createPool(m_device, 2);
     m_rtDescSetLayout = m_rtDescSetLayoutBind.createLayout(m_device);
 
+    // Two sets, so that the TLAS of an async rebuild can be written while frames still use the current one
+    VkDescriptorSetLayout layouts[2]{m_rtDescSetLayout, m_rtDescSetLayout};
+    VkDescriptorSet sets[2];
     VkDescriptorSetAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
     allocateInfo.descriptorPool = m_rtDescPool;
-    allocateInfo.descriptorSetCount = 1;
-    allocateInfo.pSetLayouts = &m_rtDescSetLayout;
-    vkAllocateDescriptorSets(m_device, &allocateInfo, &m_rtDescSet);
+    allocateInfo.descriptorSetCount = 2;
+    allocateInfo.pSetLayouts = layouts;
+    vkAllocateDescriptorSets(m_device, &allocateInfo, sets);
+    m_rtDescSet = sets[0];
+    m_rtDescSetSpare = sets[1];
 
 
-    VkAccelerationStructureKHR tlas = m_rtBuilder.getAccelerationStructure();
+    VkAccelerationStructureKHR tlas = m_tlas.getAccelerationStructure();
     VkWriteDescriptorSetAccelerationStructureKHR descASInfo{
         VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR
     };
     descASInfo.accelerationStructureCount = 1;
     descASInfo.pAccelerationStructures = &tlas;
-    VkDescriptorImageInfo imageInfo{{}, m_offscreenColor.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL};
-
     std::vector<VkWriteDescriptorSet> writes;
     writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eTlas, &descASInfo));
-    writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eOutImage, &imageInfo));
+#ifdef PATH_TRACER_RAY_STATS
+    createRayStatsBuffers();
+    VkDescriptorBufferInfo rayStatsInfo{m_bRayStats.buffer, 0, VK_WHOLE_SIZE};
+    for (VkDescriptorSet set : {m_rtDescSet, m_rtDescSetSpare})
+    {
+        writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(set, RtxBindings::eRayStats, &rayStatsInfo));
+    }
+#endif
     vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    updateRtDescriptorSet();
 }
 
 
@@ -782,10 +1869,29 @@ void PathTracerWindow::createRtDescriptorSet()
 //
 void PathTracerWindow::updateRtDescriptorSet()
 {
-    // (1) Output buffer
-    VkDescriptorImageInfo imageInfo{{}, m_offscreenColor.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL};
-    VkWriteDescriptorSet wds = m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eOutImage, &imageInfo);
-    vkUpdateDescriptorSets(m_device, 1, &wds, 0, nullptr);
+    // (1) Output buffer, the guides of the denoiser, and the history of all three
+    const std::array<std::pair<uint32_t, const nvvk::Texture*>, 6> images{{
+        {RtxBindings::eOutImage, &m_offscreenColor},
+        {RtxBindings::eAlbedoImage, &m_offscreenAlbedo},
+        {RtxBindings::eNormalDepthImage, &m_offscreenNormalDepth},
+        {RtxBindings::eHistoryColor, &m_historyColor},
+        {RtxBindings::eHistoryAlbedo, &m_historyAlbedo},
+        {RtxBindings::eHistoryNormalDepth, &m_historyNormalDepth}
+    }};
+    std::vector<VkDescriptorImageInfo> imageInfos;
+    for (const auto& [binding, texture] : images)
+    {
+        imageInfos.push_back({{}, texture->descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL});
+    }
+    std::vector<VkWriteDescriptorSet> writes;
+    for (VkDescriptorSet set : {m_rtDescSet, m_rtDescSetSpare})
+    {
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(set, images[i].first, &imageInfos[i]));
+        }
+    }
+    vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
 
@@ -800,36 +1906,10 @@ void PathTracerWindow::createRtPipeline()
         eMiss,
         eMiss2,
         eClosestHit,
+        eAnyHit,
         eShaderGroupCount
     };
 
-    // All stages
-    std::array<VkPipelineShaderStageCreateInfo, eShaderGroupCount> stages{};
-    VkPipelineShaderStageCreateInfo stage{VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
-    stage.pName = "main"; // All the same entry point
-    // Raygen
-    stage.module = nvvk::createShaderModule(
-        m_device, nvh::loadFile("shaders/raytrace.rgen.glsl.spv", true, defaultSearchPaths, true));
-    stage.stage = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
-    stages[eRaygen] = stage;
-    // Miss
-    stage.module = nvvk::createShaderModule(
-        m_device, nvh::loadFile("shaders/raytrace.rmiss.glsl.spv", true, defaultSearchPaths, true));
-    stage.stage = VK_SHADER_STAGE_MISS_BIT_KHR;
-    stages[eMiss] = stage;
-    // The second miss shader is invoked when a shadow ray misses the geometry. It simply indicates that no occlusion has been found
-    stage.module =
-        nvvk::createShaderModule(
-            m_device, nvh::loadFile("shaders/raytraceShadow.rmiss.glsl.spv", true, defaultSearchPaths, true));
-    stage.stage = VK_SHADER_STAGE_MISS_BIT_KHR;
-    stages[eMiss2] = stage;
-    // Hit Group - Closest Hit
-    stage.module = nvvk::createShaderModule(
-        m_device, nvh::loadFile("shaders/raytrace.rchit.glsl.spv", true, defaultSearchPaths, true));
-    stage.stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
-    stages[eClosestHit] = stage;
-
-
     // Shader groups
     VkRayTracingShaderGroupCreateInfoKHR group{VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR};
     group.anyHitShader = VK_SHADER_UNUSED_KHR;
@@ -852,15 +1932,21 @@ void PathTracerWindow::createRtPipeline()
     group.generalShader = eMiss2;
     m_rtShaderGroups.push_back(group);
 
-    // closest hit shader
+    // closest hit shader, and the alpha test of the triangles of models that aren't opaque
     group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR;
     group.generalShader = VK_SHADER_UNUSED_KHR;
     group.closestHitShader = eClosestHit;
+    group.anyHitShader = eAnyHit;
+    m_rtShaderGroups.push_back(group);
+
+    // Shadow hit: only the alpha test, as shadow rays skip the closest hit shader
+    group.closestHitShader = VK_SHADER_UNUSED_KHR;
     m_rtShaderGroups.push_back(group);
 
     // Push constant: we want to be able to update constants used by the shaders
     VkPushConstantRange pushConstant{
-        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR |
+        VK_SHADER_STAGE_MISS_BIT_KHR,
         0, sizeof(PushConstantRay)
     };
 
@@ -877,13 +1963,55 @@ void PathTracerWindow::createRtPipeline()
     vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_rtPipelineLayout);
 
 
+    // Spec only guarantees 1 level of "recursion". Check for that sad possibility here.
+    if (m_rtProperties.maxRayRecursionDepth <= 1)
+    {
+        throw std::runtime_error("Device fails to support ray recursion (m_rtProperties.maxRayRecursionDepth <= 1)");
+    }
+
+    // The precompiled shaders, in the order of the stage indices
+    std::vector<std::string> spirv;
+    for (const char* name : m_rtShaderSources)
+    {
+        spirv.push_back(nvh::loadFile(std::string(name) + ".spv", true, defaultSearchPaths, true));
+    }
+    m_rtPipeline = buildRtPipeline(spirv);
+    if (m_rtPipeline == VK_NULL_HANDLE)
+    {
+        throw std::runtime_error("Could not create the ray tracing pipeline");
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Creates the ray tracing pipeline from the SPIR-V of m_rtShaderSources, with the groups and
+// layout of createRtPipeline. Also called on the shader reloader's thread.
+//
+VkPipeline PathTracerWindow::buildRtPipeline(const std::vector<std::string>& spirv)
+{
+    const VkShaderStageFlagBits stageFlags[] = {VK_SHADER_STAGE_RAYGEN_BIT_KHR, VK_SHADER_STAGE_MISS_BIT_KHR,
+                                                VK_SHADER_STAGE_MISS_BIT_KHR, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+                                                VK_SHADER_STAGE_ANY_HIT_BIT_KHR};
+
+    // All stages: raygen, miss, shadow miss, closest hit and any hit. The second miss shader is invoked
+    // when a shadow ray misses the geometry. It simply indicates that no occlusion has been found
+    std::vector<VkPipelineShaderStageCreateInfo> stages;
+    VkPipelineShaderStageCreateInfo stage{VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
+    stage.pName = "main"; // All the same entry point
+    for (size_t i = 0; i < spirv.size(); i++)
+    {
+        stage.module = nvvk::createShaderModule(m_device, spirv[i]);
+        stage.stage = stageFlags[i];
+        stages.push_back(stage);
+    }
+
+
     // Assemble the shader stages and recursion depth info into the ray tracing pipeline
     VkRayTracingPipelineCreateInfoKHR rayPipelineInfo{VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR};
     rayPipelineInfo.stageCount = static_cast<uint32_t>(stages.size()); // Stages are shaders
     rayPipelineInfo.pStages = stages.data();
 
-    // In this case, m_rtShaderGroups.size() == 4: we have one raygen group,
-    // two miss shader groups, and one hit group.
+    // In this case, m_rtShaderGroups.size() == 5: we have one raygen group,
+    // two miss shader groups, and two hit groups, in the order of m_sbt
     rayPipelineInfo.groupCount = static_cast<uint32_t>(m_rtShaderGroups.size());
     rayPipelineInfo.pGroups = m_rtShaderGroups.data();
 
@@ -894,95 +2022,77 @@ void PathTracerWindow::createRtPipeline()
     rayPipelineInfo.maxPipelineRayRecursionDepth = 2; // Ray depth
     rayPipelineInfo.layout = m_rtPipelineLayout;
 
-    vkCreateRayTracingPipelinesKHR(m_device, {}, {}, 1, &rayPipelineInfo, nullptr, &m_rtPipeline);
+    // Created as a deferred operation, so that the driver compiles it on all host cores
+    VkPipeline pipeline{VK_NULL_HANDLE};
+    const VkResult result = m_pipelineCompiler.create(rayPipelineInfo, &pipeline);
 
+    for (auto& s : stages)
+        vkDestroyShaderModule(m_device, s.module, nullptr);
 
-    // Spec only guarantees 1 level of "recursion". Check for that sad possibility here.
-    if (m_rtProperties.maxRayRecursionDepth <= 1)
+    if (result != VK_SUCCESS)
     {
-        throw std::runtime_error("Device fails to support ray recursion (m_rtProperties.maxRayRecursionDepth <= 1)");
+        LOGE("Could not create the ray tracing pipeline (VkResult %d)\n", result);
+        vkDestroyPipeline(m_device, pipeline, nullptr);
+        return VK_NULL_HANDLE;
     }
-
-    for (auto& s : stages)
-        vkDestroyShaderModule(m_device, s.module, nullptr);
+    return pipeline;
 }
 
 //--------------------------------------------------------------------------------------------------
-// The Shader Binding Table (SBT)
-// - getting all shader handles and write them in a SBT buffer
-// - Besides exception, this could be always done like this
+// The Shader Binding Table (SBT): for each model, one hit record per ray type, carrying its
+// materials. The instances pick the records of their model with their SBT record offset, see
+// getTlasInstance. Records set later are written to the copy of each frame by raytrace.
 //
 void PathTracerWindow::createRtShaderBindingTable()
 {
-    uint32_t missCount{2};
-    uint32_t hitCount{1};
-    auto handleCount = 1 + missCount + hitCount;
-    uint32_t handleSize = m_rtProperties.shaderGroupHandleSize;
-
-    // The SBT (buffer) need to have starting groups to be aligned and handles in the group to be aligned.
-    uint32_t handleSizeAligned = nvh::align_up(handleSize, m_rtProperties.shaderGroupHandleAlignment);
-
-    m_rgenRegion.stride = nvh::align_up(handleSizeAligned, m_rtProperties.shaderGroupBaseAlignment);
-    m_rgenRegion.size = m_rgenRegion.stride;
-    // The size member of pRayGenShaderBindingTable must be equal to its stride member
-    m_missRegion.stride = handleSizeAligned;
-    m_missRegion.size = nvh::align_up(missCount * handleSizeAligned, m_rtProperties.shaderGroupBaseAlignment);
-    m_hitRegion.stride = handleSizeAligned;
-    m_hitRegion.size = nvh::align_up(hitCount * handleSizeAligned, m_rtProperties.shaderGroupBaseAlignment);
-
-    // Get the shader group handles
-    uint32_t dataSize = handleCount * handleSize;
-    std::vector<uint8_t> handles(dataSize);
-    auto result =
-        vkGetRayTracingShaderGroupHandlesKHR(m_device, m_rtPipeline, 0, handleCount, dataSize, handles.data());
-    assert(result == VK_SUCCESS);
-
-    // Allocate a buffer for storing the SBT.
-    VkDeviceSize sbtSize = m_rgenRegion.size + m_missRegion.size + m_hitRegion.size + m_callRegion.size;
-    m_rtSBTBuffer = m_alloc.createBuffer(sbtSize,
-                                         VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-                                         | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR,
-                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    m_debug.setObjectName(m_rtSBTBuffer.buffer, std::string("SBT")); // Give it a debug name for NSight.
-
-    // Find the SBT addresses of each group
-    VkBufferDeviceAddressInfo info{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr, m_rtSBTBuffer.buffer};
-    VkDeviceAddress sbtAddress = vkGetBufferDeviceAddress(m_device, &info);
-    m_rgenRegion.deviceAddress = sbtAddress;
-    m_missRegion.deviceAddress = sbtAddress + m_rgenRegion.size;
-    m_hitRegion.deviceAddress = sbtAddress + m_rgenRegion.size + m_missRegion.size;
-
-    // Helper to retrieve the handle data
-    auto getHandle = [&](int i) { return handles.data() + i * handleSize; };
-
-    // Map the SBT buffer and write in the handles.
-    auto* pSBTBuffer = reinterpret_cast<uint8_t*>(m_alloc.map(m_rtSBTBuffer));
-    uint8_t* pData{nullptr};
-    uint32_t handleIdx{0};
-    // Raygen
-    pData = pSBTBuffer;
-    memcpy(pData, getHandle(handleIdx++), handleSize);
-    // Miss
-    pData = pSBTBuffer + m_rgenRegion.size;
-    for (uint32_t c = 0; c < missCount; c++)
+    const uint32_t numModels = static_cast<uint32_t>(m_objModel.size());
+    m_sbt.init(&m_alloc, m_rtProperties, eRayTypeCount, 2, numModels, sizeof(HitRecord), m_swapChain.getImageCount());
+    for (uint32_t objIndex = 0; objIndex < numModels; objIndex++)
     {
-        memcpy(pData, getHandle(handleIdx++), handleSize);
-        pData += m_missRegion.stride;
+        m_sbt.setHitGroup(objIndex, eRayTypeRadiance, 0);
+        m_sbt.setHitGroup(objIndex, eRayTypeShadow, 1);
+        m_sbt.setHitData(objIndex, &m_objModel[objIndex].hitRecord, sizeof(HitRecord));
     }
-    // Hit
-    pData = pSBTBuffer + m_rgenRegion.size + m_missRegion.size;
-    for (uint32_t c = 0; c < hitCount; c++)
+    m_sbt.build(m_rtPipeline);
+    m_debug.setObjectName(m_sbt.getBuffer(), "SBT"); // Give it a debug name for NSight.
+}
+
+//--------------------------------------------------------------------------------------------------
+// Copy the accumulated color and the guides of the last frame to the history images, which the
+// ray generation shader reads them back from at the pixels they've moved to
+//
+void PathTracerWindow::copyToHistory(const VkCommandBuffer& cmdBuf)
+{
+    VkImageCopy region{};
+    region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.extent = {m_size.width, m_size.height, 1};
+    const std::array<std::pair<const nvvk::Texture*, const nvvk::Texture*>, 3> copies{{
+        {&m_offscreenColor, &m_historyColor},
+        {&m_offscreenAlbedo, &m_historyAlbedo},
+        {&m_offscreenNormalDepth, &m_historyNormalDepth}
+    }};
+    for (const auto& [src, dst] : copies)
     {
-        memcpy(pData, getHandle(handleIdx++), handleSize);
-        pData += m_hitRegion.stride;
+        vkCmdCopyImage(cmdBuf, src->image, VK_IMAGE_LAYOUT_GENERAL, dst->image, VK_IMAGE_LAYOUT_GENERAL, 1, &region);
     }
+}
 
-    m_alloc.unmap(m_rtSBTBuffer);
-    m_alloc.finalizeAndReleaseStaging();
+//--------------------------------------------------------------------------------------------------
+// Start the accumulation over: the alpha of each pixel is the number of samples it accumulated
+//
+void PathTracerWindow::clearAccumulation(const VkCommandBuffer& cmdBuf)
+{
+    m_resetAccumulation = false;
+    m_pcRay.frame = 0;
+    VkImageSubresourceRange subresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    VkClearColorValue clearColorValue{0.f, 0.f, 0.f, 0.f};
+    vkCmdClearColorImage(cmdBuf, m_offscreenColor.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColorValue, 1,
+                         &subresourceRange);
 }
 
 //--------------------------------------------------------------------------------------------------
-// Ray Tracing the scene
+// Ray Tracing the scene, after clearAccumulation or copyToHistory if the frame needs either
 //
 void PathTracerWindow::raytrace(const VkCommandBuffer& cmdBuf, const glm::vec4& clearColor)
 {
@@ -991,24 +2101,6 @@ void PathTracerWindow::raytrace(const VkCommandBuffer& cmdBuf, const glm::vec4&
     // Get current camera position
     glm::vec3 currentCameraPos = glm::vec3(CameraManip.getMatrix()[3]);
 
-    // Check if camera has moved
-    bool cameraMoved = glm::distance(currentCameraPos, m_pcRay.prevCameraPosition) > 0.001f;
-
-    // If camera moved, reset frame counter and clear the image
-    if (cameraMoved)
-    {
-        m_pcRay.frame = 0;
-        // Clear the image to start fresh
-        VkImageSubresourceRange subresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-        nvvk::cmdBarrierImageLayout(cmdBuf, m_offscreenColor.image, VK_IMAGE_LAYOUT_GENERAL,
-                                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-        VkClearColorValue clearColorValue{clearColor.x, clearColor.y, clearColor.z, clearColor.w};
-        vkCmdClearColorImage(cmdBuf, m_offscreenColor.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColorValue, 1,
-                             &subresourceRange);
-        nvvk::cmdBarrierImageLayout(cmdBuf, m_offscreenColor.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                                    VK_IMAGE_LAYOUT_GENERAL);
-    }
-
     // Update camera positions
     m_pcRay.prevCameraPosition = m_pcRay.cameraPosition;
     m_pcRay.cameraPosition = currentCameraPos;
@@ -1019,19 +2111,115 @@ void PathTracerWindow::raytrace(const VkCommandBuffer& cmdBuf, const glm::vec4&
     m_pcRay.lightIntensity = m_pcRaster.lightIntensity;
     m_pcRay.lightType = m_pcRaster.lightType;
     m_pcRay.time = static_cast<float>(glfwGetTime());
-    m_pcRay.frame++; // Increment frame counter
+    // The index of the first sample of this frame; the ray generation shader traces samplesPerFrame from there
+    const int samples = m_frameTime.getSamplesPerFrame();
 
     std::vector<VkDescriptorSet> descSets{m_rtDescSet, m_descSet};
+    const uint32_t lightOffset = m_lightBvh.getDynamicOffset(getCurFrame());
+    std::array<uint32_t, 3> dynamicOffsets{m_globalsOffset, lightOffset, lightOffset};  // eGlobals, eLights, eLightBvh
     vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_rtPipeline);
     vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_rtPipelineLayout, 0,
-                            (uint32_t)descSets.size(), descSets.data(), 0, nullptr);
+                            (uint32_t)descSets.size(), descSets.data(), (uint32_t)dynamicOffsets.size(),
+                            dynamicOffsets.data());
     vkCmdPushConstants(cmdBuf, m_rtPipelineLayout,
                        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR |
-                       VK_SHADER_STAGE_MISS_BIT_KHR,
+                       VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR,
                        0, sizeof(PushConstantRay), &m_pcRay);
 
-    vkCmdTraceRaysKHR(cmdBuf, &m_rgenRegion, &m_missRegion, &m_hitRegion, &m_callRegion, m_size.width, m_size.height,
-                      1);
+#ifdef PATH_TRACER_RAY_STATS
+    cmdClearRayStats(cmdBuf);
+#endif
+    m_frameTime.cmdBeginTrace(cmdBuf, samples);
+    const uint32_t section = m_profiler.cmdBeginSection(cmdBuf, "Ray trace");
+    // This frame's fence was waited on, so its copy of the SBT can catch up on the records set since
+    m_sbt.update(getCurFrame());
+    VkStridedDeviceAddressRegionKHR rgenRegion, missRegion, hitRegion, callRegion;
+    m_sbt.getRegions(getCurFrame(), rgenRegion, missRegion, hitRegion, callRegion);
+    vkCmdTraceRaysKHR(cmdBuf, &rgenRegion, &missRegion, &hitRegion, &callRegion, m_size.width, m_size.height, 1);
+    m_profiler.cmdEndSection(cmdBuf, section);
+    m_frameTime.cmdEndTrace(cmdBuf);
+#ifdef PATH_TRACER_RAY_STATS
+    cmdCopyRayStats(cmdBuf);
+#endif
+    m_pcRay.frame += samples;
 
     m_debug.endLabel(cmdBuf);
 }
+
+//--------------------------------------------------------------------------------------------------
+// Watches the GLSL sources of the ray tracing and post pipelines, and rebuilds the pipelines in
+// the background when they are edited
+//
+void PathTracerWindow::initShaderReload()
+{
+    // The sources are looked up like the rest of the media; installed builds only have the .spv
+    auto findSources = [](const auto& names) {
+        std::vector<std::string> sources;
+        for (const char* name : names)
+        {
+            const std::string filename = nvh::findFile(name, defaultSearchPaths);
+            sources.push_back(filename.empty() ? name : filename);
+        }
+        return sources;
+    };
+
+    m_shaderReloader.init(m_device);
+    m_rtReloadId = m_shaderReloader.watch("ray tracing pipeline", findSources(m_rtShaderSources),
+                                          [this](const std::vector<std::string>& spirv) { return buildRtPipeline(spirv); });
+    m_postReloadId = m_shaderReloader.watch("post pipeline", findSources(m_postShaderSources),
+                                            [this](const std::vector<std::string>& spirv) { return buildPostPipeline(spirv); });
+    m_exposureReloadId = m_shaderReloader.watch("exposure pipeline", findSources(m_exposureShaderSources),
+                                                [this](const std::vector<std::string>& spirv) { return buildPostPipeline(spirv); });
+    m_shaderReloader.start();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Called at the start of each frame: swaps in the pipelines rebuilt since the last frame
+//
+void PathTracerWindow::updateShaderReload()
+{
+    for (auto it = m_retiredPipelines.begin(); it != m_retiredPipelines.end();)
+    {
+        if (--it->framesLeft == 0)
+        {
+            vkDestroyPipeline(m_device, it->pipeline, nullptr);
+            if (it->sbt.buffer != VK_NULL_HANDLE)
+            {
+                m_alloc.destroy(it->sbt);
+            }
+            it = m_retiredPipelines.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    // The frames in flight still use the current pipelines
+    const VkPipeline rtPipeline = m_shaderReloader.take(m_rtReloadId);
+    if (rtPipeline != VK_NULL_HANDLE)
+    {
+        // The shader group handles differ between pipelines; the records are kept
+        m_retiredPipelines.push_back({m_rtPipeline, m_sbt.build(rtPipeline), m_swapChain.getImageCount()});
+        m_rtPipeline = rtPipeline;
+        m_debug.setObjectName(m_sbt.getBuffer(), "SBT");
+        // The image accumulated so far was rendered by the old shaders
+        m_resetAccumulation = true;
+    }
+
+    // Tonemapping applies after accumulation, which carries on
+    const VkPipeline postPipeline = m_shaderReloader.take(m_postReloadId);
+    if (postPipeline != VK_NULL_HANDLE)
+    {
+        m_retiredPipelines.push_back({m_postPipeline, {}, m_swapChain.getImageCount()});
+        m_postPipeline = postPipeline;
+        m_debug.setObjectName(m_postPipeline, "post");
+    }
+    const VkPipeline exposurePipeline = m_shaderReloader.take(m_exposureReloadId);
+    if (exposurePipeline != VK_NULL_HANDLE)
+    {
+        m_retiredPipelines.push_back({m_exposurePipeline, {}, m_swapChain.getImageCount()});
+        m_exposurePipeline = exposurePipeline;
+        m_debug.setObjectName(m_exposurePipeline, "exposure");
+    }
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <array>
+#include <functional>
+
 #include <nvvk/resourceallocator_vk.hpp>
 #include <nvvk/swapchain_vk.hpp>
 #include <nvvk/context_vk.hpp>
@@ -10,6 +13,26 @@
 #include "nvvk/debug_util_vk.hpp"
 #include "nvvk/raytraceKHR_vk.hpp"
 #include "nvvkhl/appbase_vk.hpp"
+#include "obj_loader.h"
+
+#include "async_as_builder.hpp"
+#include "blas_refitter.hpp"
+#include "denoiser.hpp"
+#include "dynamic_tlas.hpp"
+#include "frame_time_controller.hpp"
+#include "geometry_arena.hpp"
+#include "gpu_profiler.hpp"
+#include "light_bvh.hpp"
+#include "opacity.hpp"
+#include "pipeline_compiler.hpp"
+#include "render_graph.hpp"
+#include "scene_graph.hpp"
+#include "shader_binding_table.hpp"
+#include "shader_reloader.hpp"
+#include "streaming_uploader.hpp"
+#include "texture_streamer.hpp"
+#include "upload_ring.hpp"
+#include "vertex_compression.hpp"
 
 struct PushConstantRaster
 {
@@ -38,10 +61,16 @@ struct PushConstantRay
 struct ObjDesc
 {
   int      txtOffset;             // Texture index offset in the array of textures
-  uint64_t vertexAddress;         // Address of the Vertex buffer
-  uint64_t indexAddress;          // Address of the index buffer
-  uint64_t materialAddress;       // Address of the material buffer
-  uint64_t materialIndexAddress;  // Address of the triangle material index buffer
+  uint64_t geometryAddress;         // Address of the model's range of the geometry arena
+  uint32_t vertexOffset;            // Offsets of the arrays in it: of the Vertex array
+  uint32_t indexOffset;             // Of the indices
+  uint32_t materialOffset;          // Of the materials
+  uint32_t materialIndexOffset;     // Of the material index of each triangle
+  uint32_t lightIndexOffset;        // Of the light index of each triangle, ~0 for triangles that don't emit
+  uint32_t compressedVertexOffset;  // Of the CompressedVertex array, ~0u if the model has none
+  uint32_t opacityOffset;           // Of the opacity state of each triangle, ~0u if the model is opaque
+  glm::vec3 posMin{0.f};            // Position of the quantized vertices: posMin + q * posStep
+  glm::vec3 posStep{0.f};
 };
 
 // Uniform buffer set at each frame
@@ -50,30 +79,96 @@ struct GlobalUniforms
   glm::mat4 viewProj;     // Camera view * projection
   glm::mat4 viewInverse;  // Camera inverse view matrix
   glm::mat4 projInverse;  // Camera inverse projection matrix
+  glm::mat4 prevView;     // Camera view matrix of the previous frame
+  int       reprojectHistory;       // Whether the camera moved, and the history images hold the last frame
+  int       maxReprojectedSamples;  // Samples a pixel keeps of the history it's reprojected from
+  int       samplesPerFrame;        // Paths the ray tracer traces per pixel this frame
 };
 
 enum SceneBindings {
   eGlobals  = 0,  // Global uniform containing camera matrices
   eObjDescs = 1,  // Access to the object descriptions
-  eTextures = 2   // Access to textures
+  eTextures = 2,  // Access to textures
+  eLights   = 3,  // The emissive triangles
+  eLightBvh = 4,  // The nodes of the light BVH over them
+  eTextureFeedback = 5  // Which textures the shaders sampled
+};
+
+enum PostBindings {
+  ePostInput = 0,
+  ePostOutput = 1,
+  ePostExposure = 2
+};
+
+// Auto-exposure state, see ExposureState of shaders/host_device.h
+struct ExposureState
+{
+  float    exposure{1.f};
+  float    averageLuminance{0.f};
+  uint32_t histogram[64]{};  // EXPOSURE_HISTOGRAM_BINS of shaders/host_device.h
+};
+
+// Push constant structure for the post and exposure passes
+struct PushConstantPost
+{
+  float exposureCompensation{0.f};  // In stops
+  int   autoExposure{1};
+  float adaptation{0.05f};          // Fraction of the way to the target exposure per frame
 };
 
 enum RtxBindings {
   eTlas = 0,
-  eOutImage = 1
+  eOutImage = 1,
+  eAlbedoImage = 2,
+  eNormalDepthImage = 3,
+  eHistoryColor = 4,
+  eHistoryAlbedo = 5,
+  eHistoryNormalDepth = 6,
+  eRayStats = 7  // Only in the build with PATH_TRACER_RAY_STATS
 };
 
+// Ray types, their hit records in each set of the SBT and their miss shaders, see RAY_TYPE_* of shaders/host_device.h
+enum RayTypes {
+  eRayTypeRadiance = 0,
+  eRayTypeShadow = 1,
+  eRayTypeCount = 2
+};
+
+// Inline data of the hit records of a model, see HitRecord of shaders/host_device.h
+struct HitRecord
+{
+  uint32_t    numMaterials{0};  // Inlined below; 0 if the model has more
+  MaterialObj materials[8];     // SBT_INLINE_MATERIALS of shaders/host_device.h
+};
+
+#ifdef PATH_TRACER_RAY_STATS
+// What the ray tracer traced in a frame, see RayStats of shaders/host_device.h
+struct RayStats
+{
+  uint32_t primaryRays;
+  uint32_t secondaryRays;
+  uint32_t shadowRays;
+  uint32_t rouletteTerminations;
+  uint32_t pathSegments[8];  // RAY_STATS_MAX_SEGMENTS of shaders/host_device.h
+};
+#endif
+
 class PathTracerWindow : public nvvkhl::AppBaseVk {
 public:
   void setup(const VkInstance& instance, const VkDevice& device, const VkPhysicalDevice& physicalDevice, uint32_t queueFamily) override;
   void createDescriptorSetLayout();
   void createGraphicsPipeline();
-  void loadModel(const std::string& filename, glm::mat4 transform = glm::mat4(1));
+  void initAsyncAsBuilds(uint32_t computeQueueFamily, VkQueue computeQueue);
+  void initGeometryUploader(uint32_t transferQueueFamily, VkQueue transferQueue);
+  uint32_t loadModel(const std::string& filename, glm::mat4 transform = glm::mat4(1), bool deformable = false);
+  void finishGeometryUploads();
+  void flattenSceneGraph();
   void updateDescriptorSet();
   void createUniformBuffer();
   void createObjDescriptionBuffer();
-  void createTextureImages(const VkCommandBuffer& cmdBuf, const std::vector<std::string>& textures);
-  void updateUniformBuffer(const VkCommandBuffer& cmdBuf);
+  void createLightBuffer();
+  void createTextureImages(const std::vector<std::string>& textures);
+  void updateUniformBuffer();
   void onResize(int /*w*/, int /*h*/) override;
   void onKeyboardChar(unsigned char key) override;
   void destroyResources();
@@ -84,17 +179,21 @@ public:
   {
     uint32_t     nbIndices{0};
     uint32_t     nbVertices{0};
-    nvvk::Buffer vertexBuffer;    // Device buffer of all 'Vertex'
-    nvvk::Buffer indexBuffer;     // Device buffer of the indices forming triangles
-    nvvk::Buffer matColorBuffer;  // Device buffer of array of 'Wavefront material'
-    nvvk::Buffer matIndexBuffer;  // Device buffer of array of 'Wavefront material'
+    GeometryArena::Allocation geometry;  // The range of the geometry arena holding all arrays below
+    VkDeviceSize vertexOffset{0};        // Offsets in it: of all 'Vertex'
+    VkDeviceSize indexOffset{0};         // Of the indices forming triangles
+    VkDeviceSize matColorOffset{0};      // Of the array of 'Wavefront material'
+    VkDeviceSize matIndexOffset{0};      // Of the material index of each triangle
+    VkDeviceSize lightIndexOffset{0};    // Of the index of each triangle in the lights, or ~0
+    VkDeviceSize compressedVertexOffset{~0u};  // Of the 'CompressedVertex' for the hit shader, ~0u if not compressed
+    VkDeviceSize opacityOffset{~0u};     // Of the opacity state of each triangle, ~0u if opaque
+    OpacityClass opacity{OpacityClass::eOpaque};  // Opaque models skip the any-hit shader
+    bool         deformable{false};  // Vertices can change after loading; its BLAS is refit
+    HitRecord    hitRecord;          // Inline data of its records in the SBT
   };
 
-  struct ObjInstance
-  {
-    glm::mat4 transform;    // Matrix of the instance
-    uint32_t  objIndex{0};  // Model index reference
-  };
+  // Transform, model index and mask, flattened from m_sceneGraph
+  using ObjInstance = SceneGraph::Instance;
 
 
   // Information pushed at each draw call
@@ -109,7 +208,11 @@ public:
   // Array of objects and instances in the scene
   std::vector<ObjModel>    m_objModel;   // Model on host
   std::vector<ObjDesc>     m_objDesc;    // Model description for device access
+  SceneGraph               m_sceneGraph;  // Nodes placing the models, flattened into m_instances
   std::vector<ObjInstance> m_instances;  // Scene model instances
+  std::vector<uint32_t>    m_changedInstances;  // By the last updateSceneGraph
+  std::vector<LightBvh::Light> m_emissiveTriangles;  // Of all instances, collected by loadModel
+  bool m_compressVertices{true};  // Whether loadModel gives models that don't deform a CompressedVertex buffer
 
 
   // Graphic pipeline
@@ -119,64 +222,206 @@ public:
   VkDescriptorPool            m_descPool;
   VkDescriptorSetLayout       m_descSetLayout;
   VkDescriptorSet             m_descSet;
+  VkDescriptorSet             m_descSetSpare;  // Gets the textures streamed in next, then swaps with m_descSet
 
-  nvvk::Buffer m_bGlobals;  // Device-Host of the camera matrices
+  UploadRing   m_uploadRing;  // Data written every frame: GlobalUniforms, at m_globalsOffset
+  VkDeviceSize m_uploadRingFrameSize{64 * 1024};  // Per frame in flight
+  uint32_t     m_globalsOffset{0};  // Dynamic offset of eGlobals for the frame being drawn
   nvvk::Buffer m_bObjDesc;  // Device buffer of the OBJ descriptions
-
-  std::vector<nvvk::Texture> m_textures;  // vector of all textures of the scene
+  LightBvh     m_lightBvh;  // The emissive triangles, and the tree light sampling walks
 
 
   nvvk::ResourceAllocatorDma m_alloc;  // Allocator for buffer, images, acceleration structures
   nvvk::DebugUtil            m_debug;  // Utility to name objects
+  StreamingUploader          m_uploader;  // Streams model geometry through a ring of staging memory
+  GeometryArena              m_geometryArena;  // The geometry and materials of all models, suballocated
 
+  // #Textures - Decoded in the background, their mips kept resident within a budget
+  void initTextureStreaming();
+  void updateTextureStreaming(const VkCommandBuffer& cmdBuf);
 
-  // #Post - Draw the rendered image on a quad using a tonemapper
+  TextureStreamer m_textureStreamer;  // All textures of the scene
+  uint32_t        m_textureSwapFrames{0};  // Frames until m_descSetSpare is unused and can take new textures
+
+  // All pipelines are created through this cache, which is loaded from and saved to disk
+  VkPipelineCache   m_pipelineCache{VK_NULL_HANDLE};
+  const std::string m_pipelineCacheFilename{PROJECT_NAME "_pipeline_cache.bin"};
+  PipelineCompiler  m_pipelineCompiler;  // Compiles ray tracing pipelines on all host cores; after setup, only from m_shaderReloader's thread
+
+  // #Reload - Rebuilds the ray tracing and post pipelines when their GLSL sources are edited
+  void initShaderReload();
+  void updateShaderReload();
+
+  ShaderReloader m_shaderReloader;
+  uint32_t       m_rtReloadId{~0u};
+  uint32_t       m_postReloadId{~0u};
+  uint32_t       m_exposureReloadId{~0u};
+  // Pipelines replaced by a reload, destroyed once the frames in flight are done with them
+  struct RetiredPipeline
+  {
+    VkPipeline   pipeline{VK_NULL_HANDLE};
+    nvvk::Buffer sbt;  // The SBT of a ray tracing pipeline
+    uint32_t     framesLeft{0};
+  };
+  std::vector<RetiredPipeline> m_retiredPipelines;
+
+
+  // #Post - Tonemaps the rendered image in a compute pass, with auto-exposure, and copies it to the swap chain
   void createOffscreenRender();
   void createPostPipeline();
+  VkPipeline buildPostPipeline(const std::vector<std::string>& spirv);
   void createPostDescriptor();
   void updatePostDescriptorSet();
-  void drawPost(VkCommandBuffer cmdBuf);
+  void postProcess(VkCommandBuffer cmdBuf, bool denoised = false);
+  void adaptExposure(VkCommandBuffer cmdBuf);
+  void copyToSwapChain(VkCommandBuffer cmdBuf);
 
   nvvk::DescriptorSetBindings m_postDescSetLayoutBind;
   VkDescriptorPool            m_postDescPool{VK_NULL_HANDLE};
   VkDescriptorSetLayout       m_postDescSetLayout{VK_NULL_HANDLE};
   VkDescriptorSet             m_postDescSet{VK_NULL_HANDLE};
+  VkDescriptorSet             m_postDenoisedDescSet{VK_NULL_HANDLE};  // Shows the output of m_denoiser instead
   VkPipeline                  m_postPipeline{VK_NULL_HANDLE};
+  VkPipeline                  m_exposurePipeline{VK_NULL_HANDLE};
   VkPipelineLayout            m_postPipelineLayout{VK_NULL_HANDLE};
+  const std::array<const char*, 1> m_postShaderSources{"shaders/post.comp.glsl"};
+  const std::array<const char*, 1> m_exposureShaderSources{"shaders/exposure.comp.glsl"};
+  VkFormat                    m_postOutputFormat{VK_FORMAT_R8G8B8A8_UNORM};  // Of the display-ready image
+  nvvk::Buffer                m_bExposure;       // ExposureState
+  VkRenderPass                m_uiRenderPass{VK_NULL_HANDLE};  // Like getRenderPass(), but keeps the copied image
+  PushConstantPost            m_pcPost{};
   VkRenderPass                m_offscreenRenderPass{VK_NULL_HANDLE};
   VkFramebuffer               m_offscreenFramebuffer{VK_NULL_HANDLE};
   nvvk::Texture               m_offscreenColor;
   nvvk::Texture               m_offscreenDepth;
+  nvvk::Texture               m_offscreenAlbedo;       // Guides of the denoiser, written by the ray tracer
+  nvvk::Texture               m_offscreenNormalDepth;
+  VkFormat                    m_offscreenGuideFormat{VK_FORMAT_R16G16B16A16_SFLOAT};
+  // The color and guides of the previous frame, which the ray tracer reprojects after the camera moved
+  nvvk::Texture               m_historyColor;
+  nvvk::Texture               m_historyAlbedo;
+  nvvk::Texture               m_historyNormalDepth;
   VkFormat                    m_offscreenColorFormat{VK_FORMAT_R32G32B32A32_SFLOAT};
   VkFormat                    m_offscreenDepthFormat{VK_FORMAT_X8_D24_UNORM_PACK32};
 
+  // #Denoise - Filters the accumulated ray tracing output, between raytrace and postProcess
+  void createDenoiser();
+  void denoise(const VkCommandBuffer& cmdBuf);
+
+  Denoiser m_denoiser;
+
+  // #Frame - The passes of a frame, and the barriers between them derived from what they use
+  struct FrameSettings
+  {
+    bool                                 raytrace{true};
+    bool                                 denoise{false};  // Only the ray traced image
+    glm::vec4                            clearColor{1.f};
+    std::function<void(VkCommandBuffer)> drawUi;  // Within m_uiRenderPass, over the tonemapped image
+  };
+  void createRenderGraph();
+  void renderFrame(const VkCommandBuffer& cmdBuf, const FrameSettings& settings);
+
+  RenderGraph                          m_renderGraph;
+  FrameSettings                        m_frameSettings;  // Of the frame renderFrame is recording
+  RenderGraph::Resource                m_rgSwapChain{0};
+  std::array<RenderGraph::Resource, 2> m_rgDenoiserImages{};  // Transient, the output of m_denoiser in the first
+  RenderGraph::Resource                m_rgPostOutput{0};     // Transient, display-ready
+
+  // #FrameTime - Traces as many samples per frame as fit the GPU time budget
+  void initFrameTimeController();
+  void beginFrameTiming(const VkCommandBuffer& cmdBuf);
+  void endFrameTiming(const VkCommandBuffer& cmdBuf);
+
+  FrameTimeController m_frameTime;
+
+  // #Profiler - GPU time of each pass of the frame, and host time of the synchronous setup work
+  void initProfiler();
+  void saveProfile(const std::string& basename);
+
+  GpuProfiler m_profiler;
+
+#ifdef PATH_TRACER_RAY_STATS
+  // #RayStats - Counts the rays the ray tracer traces each frame, in the instrumentation build
+  void createRayStatsBuffers();
+  void cmdClearRayStats(const VkCommandBuffer& cmdBuf);
+  void cmdCopyRayStats(const VkCommandBuffer& cmdBuf);
+  void readRayStats();
+
+  nvvk::Buffer      m_bRayStats;          // Device buffer of the counters the shaders add to
+  nvvk::Buffer      m_bRayStatsReadback;  // Host copy of them, one per frame in flight
+  const RayStats*   m_rayStatsMapped{nullptr};
+  std::vector<bool> m_rayStatsWritten;    // Which copies the ray tracer has written since they were read
+  RayStats          m_rayStats{};         // Of the last frame that ray traced and finished
+#endif
+
   // #VKRay
   void initRayTracing();
   auto objectToVkGeometryKHR(const ObjModel& model);
+  std::vector<nvvk::RaytracingBuilderKHR::BlasInput> getBlasInputs();
+  void initBlasRefitter(const std::vector<nvvk::RaytracingBuilderKHR::BlasInput>& blasInputs);
   void createBottomLevelAS();
+  VkDeviceAddress getBlasDeviceAddress(uint32_t objIndex) const;
+  VkAccelerationStructureInstanceKHR getTlasInstance(const ObjInstance& inst) const;
+  std::vector<VkAccelerationStructureInstanceKHR> getTlasInstances() const;
+  void setTlasInstance(uint32_t instanceIndex);
   void createTopLevelAS();
+  bool rebuildAccelerationStructures();
+  void updateAccelerationStructureSwap();
+  void setNodeTransform(uint32_t node, const glm::mat4& transform);
+  void setNodeMask(uint32_t node, uint8_t mask);
+  void updateSceneGraph();
+  void updateModelVertices(uint32_t objIndex, uint32_t firstVertex, uint32_t vertexCount, const VertexObj* vertices);
+  void markModelDeformed(uint32_t objIndex);
+  void updateBottomLevelAS(const VkCommandBuffer& cmdBuf);
+  void updateTopLevelAS(const VkCommandBuffer& cmdBuf);
+  void updateLights();
   void createRtDescriptorSet();
   void updateRtDescriptorSet();
   void createRtPipeline();
+  VkPipeline buildRtPipeline(const std::vector<std::string>& spirv);
   void createRtShaderBindingTable();
+  void copyToHistory(const VkCommandBuffer& cmdBuf);
+  void clearAccumulation(const VkCommandBuffer& cmdBuf);
   void raytrace(const VkCommandBuffer& cmdBuf, const glm::vec4& clearColor);
 
 
   VkPhysicalDeviceRayTracingPipelinePropertiesKHR m_rtProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
-  nvvk::RaytracingBuilderKHR                        m_rtBuilder;
+  VkPhysicalDeviceAccelerationStructurePropertiesKHR m_asProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR};
+  DynamicTlas                                       m_tlas;
+  bool                                              m_resetAccumulation{true};  // Whether the scene changed since the last frame, or the images are new
+  glm::mat4                                         m_prevView{1};  // Camera of the last frame
+  bool                                              m_reprojectHistory{false};  // Whether this frame reprojects the last one
+  int                                               m_maxReprojectedSamples{32};  // Lower adapts faster to what reprojection gets wrong
+  std::vector<nvvk::AccelKHR>                       m_blas;       // One BLAS per model, compacted unless deformable
+  BlasRefitter                                      m_blasRefitter;  // Refits the BLASes of deformable models
+  AsyncAsBuilder                                    m_asyncAsBuilder;  // Rebuilds all of them on the async compute queue
+  std::vector<ObjInstance>                          m_asyncBuildInstances;  // Instances the rebuild started with
+  // Structures replaced by a rebuild, destroyed once the frames in flight are done with them
+  struct RetiredAccelerationStructures
+  {
+    std::vector<nvvk::AccelKHR> blas;
+    DynamicTlas                 tlas;
+    BlasRefitter                refitter;
+    uint32_t                    framesLeft{0};
+  };
+  std::vector<RetiredAccelerationStructures>        m_retiredAs;
+  VkDeviceSize                                      m_blasBuildBudget{VkDeviceSize(256) << 20};  // Memory per BLAS build batch
   nvvk::DescriptorSetBindings                       m_rtDescSetLayoutBind;
   VkDescriptorPool                                  m_rtDescPool;
   VkDescriptorSetLayout                             m_rtDescSetLayout;
   VkDescriptorSet                                   m_rtDescSet;
+  VkDescriptorSet                                   m_rtDescSetSpare;  // Gets the TLAS of the next rebuild, then swaps with m_rtDescSet
   std::vector<VkRayTracingShaderGroupCreateInfoKHR> m_rtShaderGroups;
   VkPipelineLayout                                  m_rtPipelineLayout;
   VkPipeline                                        m_rtPipeline;
+  // Raygen, miss, shadow miss, closest hit and any hit; the .spv of each is compiled by the build
+  const std::array<const char*, 5> m_rtShaderSources{"shaders/raytrace.rgen.glsl", "shaders/raytrace.rmiss.glsl",
+                                                     "shaders/raytraceShadow.rmiss.glsl", "shaders/raytrace.rchit.glsl",
+                                                     "shaders/raytrace.rahit.glsl"};
 
-  nvvk::Buffer                    m_rtSBTBuffer;
-  VkStridedDeviceAddressRegionKHR m_rgenRegion{};
-  VkStridedDeviceAddressRegionKHR m_missRegion{};
-  VkStridedDeviceAddressRegionKHR m_hitRegion{};
-  VkStridedDeviceAddressRegionKHR m_callRegion{};
+  // One set of hit records per model, with its materials; the hit groups are
+  // the closest hit and alpha test of radiance rays, and the alpha test of shadow rays
+  ShaderBindingTable m_sbt;
 
   // Push constant for ray tracer
   PushConstantRay m_pcRay{};
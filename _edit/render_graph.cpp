@@ -0,0 +1,299 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "render_graph.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include <nvh/nvprint.hpp>
+#include <nvvk/images_vk.hpp>
+
+namespace {
+constexpr VkAccessFlags2 k_writeAccess =
+    VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT
+    | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT
+    | VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+
+constexpr size_t k_unused = std::numeric_limits<size_t>::max();
+}  // namespace
+
+void RenderGraph::init(nvvk::ResourceAllocator* alloc)
+{
+  m_alloc  = alloc;
+  m_device = alloc->getDevice();
+  m_debug.setup(m_device);
+}
+
+void RenderGraph::deinit()
+{
+  if(m_alloc == nullptr)
+  {
+    return;
+  }
+  clear();
+  m_alloc = nullptr;
+}
+
+void RenderGraph::clear()
+{
+  destroyTransients();
+  m_resources.clear();
+  m_states.clear();
+  m_passes.clear();
+  m_stats = {};
+}
+
+void RenderGraph::destroyTransients()
+{
+  for(ResourceInfo& resource : m_resources)
+  {
+    if(resource.transient)
+    {
+      vkDestroyImageView(m_device, resource.descriptor.imageView, nullptr);
+      vkDestroyImage(m_device, resource.image, nullptr);
+      resource.descriptor.imageView = VK_NULL_HANDLE;
+      resource.image                = VK_NULL_HANDLE;
+    }
+  }
+  for(const MemorySlot& slot : m_slots)
+  {
+    m_alloc->getMemoryAllocator()->freeMemory(slot.memory);
+  }
+  m_slots.clear();
+}
+
+RenderGraph::Resource RenderGraph::addResource(ResourceInfo&& info)
+{
+  info.state = static_cast<uint32_t>(m_states.size());
+  m_states.emplace_back();
+  m_resources.push_back(std::move(info));
+  return static_cast<Resource>(m_resources.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::importImage(const std::string& name, VkImage image, VkImageLayout layout, VkPipelineStageFlags2 stages)
+{
+  const Resource resource = addResource({.name = name});
+  setImportedImage(resource, image, layout, stages);
+  return resource;
+}
+
+void RenderGraph::setImportedImage(Resource resource, VkImage image, VkImageLayout layout, VkPipelineStageFlags2 stages)
+{
+  ResourceInfo& info = m_resources[resource];
+  info.image         = image;
+  info.layout        = layout;
+  // Taken for reads, so that the first use waits for them, without an access to make available
+  m_states[info.state] = {.readStages = stages};
+}
+
+RenderGraph::Resource RenderGraph::importBuffer(const std::string& name, VkBuffer buffer)
+{
+  return addResource({.name = name, .buffer = buffer});
+}
+
+RenderGraph::Resource RenderGraph::createTransientImage(const std::string& name, const VkImageCreateInfo& info)
+{
+  return addResource({.name = name, .transient = true, .createInfo = info});
+}
+
+void RenderGraph::addPass(const std::string&                   name,
+                          std::vector<Use>                     uses,
+                          std::function<void(VkCommandBuffer)> record,
+                          std::function<bool()>                isActive)
+{
+  m_passes.push_back({name, std::move(uses), std::move(record), std::move(isActive)});
+}
+
+void RenderGraph::compile()
+{
+  destroyTransients();
+
+  // The passes each transient image lives through, whether they're active or not
+  std::vector<size_t> firstPass(m_resources.size(), k_unused);
+  std::vector<size_t> lastPass(m_resources.size(), 0);
+  for(size_t pass = 0; pass < m_passes.size(); pass++)
+  {
+    for(const Use& use : m_passes[pass].uses)
+    {
+      firstPass[use.resource] = std::min(firstPass[use.resource], pass);
+      lastPass[use.resource]  = std::max(lastPass[use.resource], pass);
+    }
+  }
+
+  std::vector<Resource> transients;
+  for(Resource resource = 0; resource < m_resources.size(); resource++)
+  {
+    if(m_resources[resource].transient)
+    {
+      transients.push_back(resource);
+    }
+  }
+  std::stable_sort(transients.begin(), transients.end(),
+                   [&](Resource a, Resource b) { return firstPass[a] < firstPass[b]; });
+
+  // Each image goes into the first memory whose images are done before it starts, or new memory
+  m_stats.transientSize = 0;
+  std::vector<uint32_t> slotOf(m_resources.size(), 0);
+  for(Resource resource : transients)
+  {
+    ResourceInfo& info = m_resources[resource];
+    vkCreateImage(m_device, &info.createInfo, nullptr, &info.image);
+    m_debug.setObjectName(info.image, info.name);
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(m_device, info.image, &requirements);
+    m_stats.transientSize += requirements.size;
+
+    const bool unused = firstPass[resource] == k_unused;
+    auto       slot   = std::find_if(m_slots.begin(), m_slots.end(), [&](const MemorySlot& s) {
+      return !unused && s.lastPass < firstPass[resource]
+             && (s.requirements.memoryTypeBits & requirements.memoryTypeBits) != 0;
+    });
+    if(slot == m_slots.end())
+    {
+      m_slots.push_back({.requirements = requirements, .state = info.state});
+      slot = m_slots.end() - 1;
+    }
+    slot->requirements.size      = std::max(slot->requirements.size, requirements.size);
+    slot->requirements.alignment = std::max(slot->requirements.alignment, requirements.alignment);
+    slot->requirements.memoryTypeBits &= requirements.memoryTypeBits;
+    slot->lastPass   = unused ? k_unused : lastPass[resource];
+    info.state       = slot->state;
+    slotOf[resource] = static_cast<uint32_t>(slot - m_slots.begin());
+  }
+
+  m_stats.allocatedSize = 0;
+  for(MemorySlot& slot : m_slots)
+  {
+    slot.memory = m_alloc->getMemoryAllocator()->allocMemory(
+        nvvk::MemAllocateInfo(slot.requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true));
+    m_stats.allocatedSize += slot.requirements.size;
+  }
+  for(Resource resource : transients)
+  {
+    ResourceInfo&                      info       = m_resources[resource];
+    const nvvk::MemAllocator::MemInfo memoryInfo = m_alloc->getMemoryAllocator()->getMemoryInfo(m_slots[slotOf[resource]].memory);
+    vkBindImageMemory(m_device, info.image, memoryInfo.memory, memoryInfo.offset);
+    const VkImageViewCreateInfo viewInfo = nvvk::makeImageViewCreateInfo(info.image, info.createInfo);
+    vkCreateImageView(m_device, &viewInfo, nullptr, &info.descriptor.imageView);
+    info.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  }
+  LOGI("Render graph: %zu transient images in %zu allocations, %.1f of %.1f MB\n", transients.size(), m_slots.size(),
+       double(m_stats.allocatedSize) / (1024. * 1024.), double(m_stats.transientSize) / (1024. * 1024.));
+}
+
+void RenderGraph::addBarrier(const Use& use, std::vector<VkImageMemoryBarrier2>& imageBarriers, std::vector<VkBufferMemoryBarrier2>& bufferBarriers)
+{
+  ResourceInfo& info       = m_resources[use.resource];
+  AccessState&  state      = m_states[info.state];
+  const bool    isImage    = info.image != VK_NULL_HANDLE;
+  const bool    writes     = (use.access & k_writeAccess) != 0;
+  const bool    transition = isImage && info.layout != use.layout;
+
+  VkPipelineStageFlags2 srcStages = VK_PIPELINE_STAGE_2_NONE;
+  VkAccessFlags2        srcAccess = VK_ACCESS_2_NONE;
+  if(writes || transition)
+  {
+    // After the last write, and the reads since, whose data it overwrites
+    srcStages = state.writeStages | state.readStages;
+    srcAccess = state.writeAccess;
+    // A layout transition is a write the barrier makes visible to this use
+    state = {.writeStages   = use.stages,
+             .writeAccess   = use.access & k_writeAccess,
+             .readStages    = writes ? VK_PIPELINE_STAGE_2_NONE : use.stages,
+             .visibleStages = use.stages,
+             .visibleAccess = use.access};
+  }
+  else
+  {
+    // Reads of data the stages already see, or that nothing wrote, need nothing
+    if(state.writeStages != VK_PIPELINE_STAGE_2_NONE
+       && ((use.stages & ~state.visibleStages) != 0 || (use.access & ~state.visibleAccess) != 0))
+    {
+      srcStages = state.writeStages;
+      srcAccess = state.writeAccess;
+      state.visibleStages |= use.stages;
+      state.visibleAccess |= use.access;
+    }
+    state.readStages |= use.stages;
+  }
+  if(srcStages == VK_PIPELINE_STAGE_2_NONE && !transition)
+  {
+    return;
+  }
+
+  if(isImage)
+  {
+    imageBarriers.push_back({.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                             .srcStageMask        = srcStages,
+                             .srcAccessMask       = srcAccess,
+                             .dstStageMask        = use.stages,
+                             .dstAccessMask       = use.access,
+                             .oldLayout           = info.layout,
+                             .newLayout           = use.layout,
+                             .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                             .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                             .image               = info.image,
+                             .subresourceRange    = {VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0,
+                                                     VK_REMAINING_ARRAY_LAYERS}});
+    info.layout = use.layout;
+  }
+  else
+  {
+    bufferBarriers.push_back({.sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+                              .srcStageMask        = srcStages,
+                              .srcAccessMask       = srcAccess,
+                              .dstStageMask        = use.stages,
+                              .dstAccessMask       = use.access,
+                              .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                              .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                              .buffer              = info.buffer,
+                              .offset              = 0,
+                              .size                = VK_WHOLE_SIZE});
+  }
+}
+
+void RenderGraph::execute(VkCommandBuffer cmdBuf)
+{
+  // Transient images hold nothing from the last frame; their memory still waits on its last accesses
+  for(ResourceInfo& resource : m_resources)
+  {
+    if(resource.transient)
+    {
+      resource.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+  }
+
+  m_stats.barrierBatches = 0;
+  m_stats.imageBarriers  = 0;
+  m_stats.bufferBarriers = 0;
+  std::vector<VkImageMemoryBarrier2>  imageBarriers;
+  std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+  for(const Pass& pass : m_passes)
+  {
+    if(pass.isActive && !pass.isActive())
+    {
+      continue;
+    }
+
+    imageBarriers.clear();
+    bufferBarriers.clear();
+    for(const Use& use : pass.uses)
+    {
+      addBarrier(use, imageBarriers, bufferBarriers);
+    }
+    if(!imageBarriers.empty() || !bufferBarriers.empty())
+    {
+      const VkDependencyInfo dependencyInfo{.sType                    = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                                            .bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size()),
+                                            .pBufferMemoryBarriers    = bufferBarriers.data(),
+                                            .imageMemoryBarrierCount  = static_cast<uint32_t>(imageBarriers.size()),
+                                            .pImageMemoryBarriers     = imageBarriers.data()};
+      vkCmdPipelineBarrier2(cmdBuf, &dependencyInfo);
+      m_stats.barrierBatches++;
+      m_stats.imageBarriers += static_cast<uint32_t>(imageBarriers.size());
+      m_stats.bufferBarriers += static_cast<uint32_t>(bufferBarriers.size());
+    }
+
+    pass.record(cmdBuf);
+  }
+}
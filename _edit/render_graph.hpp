@@ -0,0 +1,139 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// A small render graph for the passes of a frame, which derives their
+// synchronization from what each pass declares it does with the resources,
+// instead of barriers written by hand around each command.
+// A pass lists its uses: the stages, the accesses, and for images the layout
+// it needs. The graph keeps the last accesses of each resource, across frames
+// too, and before a pass records one vkCmdPipelineBarrier2 with only the
+// barriers its uses need: none for reads of the data the last barrier already
+// made visible to their stages, an execution dependency alone for a write
+// after reads, and a layout transition where the layout differs.
+// The passes are added once, with an optional predicate telling whether they
+// run in a frame; the inactive ones are skipped along with their barriers.
+// Transient images only hold data within a frame, and the graph creates them:
+// they're undefined before their first pass each frame, and the ones whose
+// passes don't overlap, among all the passes added, share their memory.
+#ifndef VK_MINI_PATH_TRACER_RENDER_GRAPH_HPP
+#define VK_MINI_PATH_TRACER_RENDER_GRAPH_HPP
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <nvvk/debug_util_vk.hpp>
+#include <nvvk/resourceallocator_vk.hpp>
+
+class RenderGraph
+{
+public:
+  using Resource = uint32_t;
+
+  // What a pass does with a resource. `layout` is ignored for buffers.
+  struct Use
+  {
+    Resource              resource;
+    VkPipelineStageFlags2 stages;
+    VkAccessFlags2        access;
+    VkImageLayout         layout = VK_IMAGE_LAYOUT_GENERAL;
+  };
+
+  // Barriers recorded by the last execute, and the memory of the transient images
+  struct Stats
+  {
+    uint32_t     barrierBatches = 0;  // vkCmdPipelineBarrier2 calls
+    uint32_t     imageBarriers  = 0;
+    uint32_t     bufferBarriers = 0;
+    VkDeviceSize transientSize  = 0;  // What the transient images would take on their own
+    VkDeviceSize allocatedSize  = 0;  // What they take aliased
+  };
+
+  void init(nvvk::ResourceAllocator* alloc);
+  // Also destroys the transient images and drops the resources and passes
+  void deinit();
+  // Drops the resources and passes, to add them again, e.g. on resize
+  void clear();
+
+  // An image made outside the graph, in `layout`, whose last accesses
+  // before the next execute are at `stages`. Only color images.
+  Resource importImage(const std::string& name, VkImage image, VkImageLayout layout, VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE);
+  // Points an imported image at `image`, before execute, e.g. the swap chain
+  // image of the frame; the graph forgets what it knew of the last one
+  void setImportedImage(Resource resource, VkImage image, VkImageLayout layout, VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE);
+  Resource importBuffer(const std::string& name, VkBuffer buffer);
+  // An image the graph creates with `info` in compile, 2D and color only
+  Resource createTransientImage(const std::string& name, const VkImageCreateInfo& info);
+
+  // Passes are recorded in the order they are added; `isActive`, if set, is
+  // called as the pass comes up in execute, after the passes before it recorded
+  void addPass(const std::string&                   name,
+               std::vector<Use>                     uses,
+               std::function<void(VkCommandBuffer)> record,
+               std::function<bool()>                isActive = {});
+
+  // Creates the transient images, once all the passes are added
+  void compile();
+  // Records the active passes with their barriers
+  void execute(VkCommandBuffer cmdBuf);
+
+  VkImage getImage(Resource resource) const { return m_resources[resource].image; }
+  // The view of a transient image, in VK_IMAGE_LAYOUT_GENERAL, for a storage image
+  const VkDescriptorImageInfo& getDescriptor(Resource resource) const { return m_resources[resource].descriptor; }
+  const Stats&                 getStats() const { return m_stats; }
+
+private:
+  // The accesses since the last write, and what the barriers since made visible
+  struct AccessState
+  {
+    VkPipelineStageFlags2 writeStages   = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2        writeAccess   = VK_ACCESS_2_NONE;
+    VkPipelineStageFlags2 readStages    = VK_PIPELINE_STAGE_2_NONE;
+    VkPipelineStageFlags2 visibleStages = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2        visibleAccess = VK_ACCESS_2_NONE;
+  };
+
+  struct ResourceInfo
+  {
+    std::string           name;
+    VkImage               image{VK_NULL_HANDLE};
+    VkBuffer              buffer{VK_NULL_HANDLE};
+    VkImageLayout         layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkDescriptorImageInfo descriptor{};
+    bool                  transient = false;
+    VkImageCreateInfo     createInfo{};
+    uint32_t              state = 0;  // In m_states; transient images share the one of their memory
+  };
+
+  struct Pass
+  {
+    std::string                          name;
+    std::vector<Use>                     uses;
+    std::function<void(VkCommandBuffer)> record;
+    std::function<bool()>                isActive;
+  };
+
+  // Memory shared by transient images whose passes don't overlap
+  struct MemorySlot
+  {
+    nvvk::MemHandle      memory{nullptr};
+    VkMemoryRequirements requirements{};
+    size_t               lastPass = 0;
+    uint32_t             state    = 0;
+  };
+
+  void     destroyTransients();
+  Resource addResource(ResourceInfo&& info);
+  void     addBarrier(const Use& use, std::vector<VkImageMemoryBarrier2>& imageBarriers, std::vector<VkBufferMemoryBarrier2>& bufferBarriers);
+
+  nvvk::ResourceAllocator*  m_alloc = nullptr;
+  VkDevice                  m_device{VK_NULL_HANDLE};
+  nvvk::DebugUtil           m_debug;
+  std::vector<ResourceInfo> m_resources;
+  std::vector<AccessState>  m_states;
+  std::vector<Pass>         m_passes;
+  std::vector<MemorySlot>   m_slots;
+  Stats                     m_stats;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_RENDER_GRAPH_HPP
@@ -0,0 +1,233 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "scene_graph.hpp"
+
+#include <cassert>
+
+SceneGraph::SceneGraph()
+{
+  m_nodes.emplace_back();  // k_root
+}
+
+uint32_t SceneGraph::addNode(uint32_t parent, const glm::mat4& transform, uint8_t mask)
+{
+  assert(!m_flattened && (parent == k_none || parent < m_nodes.size()));
+  const uint32_t node = static_cast<uint32_t>(m_nodes.size());
+  m_nodes.emplace_back();
+  m_nodes[node].transform = transform;
+  m_nodes[node].mask      = mask;
+  m_nodes[node].parent    = parent;
+  if(parent != k_none)
+  {
+    m_nodes[parent].children.push_back(node);
+  }
+  return node;
+}
+
+uint32_t SceneGraph::addGroup(uint32_t parent, const glm::mat4& transform, uint8_t mask)
+{
+  return addNode(parent, transform, mask);
+}
+
+uint32_t SceneGraph::addMesh(uint32_t parent, uint32_t objIndex, const glm::mat4& transform, uint8_t mask)
+{
+  const uint32_t node    = addNode(parent, transform, mask);
+  m_nodes[node].objIndex = objIndex;
+  return node;
+}
+
+uint32_t SceneGraph::addPrototype()
+{
+  return addNode(k_none, glm::mat4(1), k_maskAll);
+}
+
+uint32_t SceneGraph::addReference(uint32_t parent, uint32_t prototype, const glm::mat4& transform, uint8_t mask)
+{
+  assert(prototype != k_root && m_nodes[prototype].parent == k_none);
+  const uint32_t node     = addNode(parent, transform, mask);
+  m_nodes[node].prototype = prototype;
+  m_nodes[prototype].referrers.push_back(node);
+  return node;
+}
+
+void SceneGraph::setTransform(uint32_t node, const glm::mat4& transform)
+{
+  m_nodes[node].transform = transform;
+  markDirty(node);
+}
+
+void SceneGraph::setMask(uint32_t node, uint8_t mask)
+{
+  m_nodes[node].mask = mask;
+  markDirty(node);
+}
+
+uint32_t SceneGraph::computeLayout(uint32_t node, uint32_t depth)
+{
+  // A prototype that references itself, directly or not, would place infinitely many instances
+  assert(depth <= m_nodes.size());
+  Node&    n     = m_nodes[node];
+  uint32_t count = (n.objIndex != k_none) ? 1 : 0;
+  if(n.prototype != k_none)
+  {
+    count += computeLayout(n.prototype, depth + 1);
+  }
+  for(uint32_t child : n.children)
+  {
+    m_nodes[child].offset = count;
+    count += computeLayout(child, depth + 1);
+  }
+  n.leafCount = count;
+  return count;
+}
+
+void SceneGraph::flatten(std::vector<Instance>& instances)
+{
+  // Prototypes placed by several references are laid out again by each; they come out the same
+  computeLayout(k_root, 0);
+  m_flattened = true;
+  instances.assign(m_nodes[k_root].leafCount, Instance{});
+  visit(k_root, glm::mat4(1), k_maskAll, 0, true, instances, nullptr);
+  clearDirty();
+}
+
+void SceneGraph::touch(uint32_t node)
+{
+  Node& n = m_nodes[node];
+  if(!n.dirty && !n.subtreeDirty && !n.prototypeDirty && !n.queued)
+  {
+    m_touched.push_back(node);
+  }
+}
+
+void SceneGraph::markDirty(uint32_t node)
+{
+  if(m_nodes[node].dirty)
+  {
+    return;
+  }
+  touch(node);
+  m_nodes[node].dirty = true;
+  propagateDirty(node);
+}
+
+void SceneGraph::propagateDirty(uint32_t node)
+{
+  // Mark the paths from the root (and from the references of prototypes) down to `node`
+  const uint32_t parent = m_nodes[node].parent;
+  if(parent != k_none)
+  {
+    if(!m_nodes[node].queued)
+    {
+      m_nodes[node].queued = true;
+      m_nodes[parent].dirtyChildren.push_back(node);
+    }
+    if(!m_nodes[parent].subtreeDirty)
+    {
+      touch(parent);
+      m_nodes[parent].subtreeDirty = true;
+      propagateDirty(parent);
+    }
+    return;
+  }
+  for(uint32_t referrer : m_nodes[node].referrers)
+  {
+    if(!m_nodes[referrer].prototypeDirty)
+    {
+      touch(referrer);
+      m_nodes[referrer].prototypeDirty = true;
+      if(!m_nodes[referrer].subtreeDirty)
+      {
+        m_nodes[referrer].subtreeDirty = true;
+        propagateDirty(referrer);
+      }
+    }
+  }
+}
+
+void SceneGraph::visit(uint32_t               node,
+                       const glm::mat4&       parentTransform,
+                       uint8_t                parentMask,
+                       uint32_t               first,
+                       bool                   force,
+                       std::vector<Instance>& instances,
+                       std::vector<uint32_t>* changed)
+{
+  const Node& n     = m_nodes[node];
+  const bool  dirty = force || n.dirty;
+  if(!dirty && !n.subtreeDirty)
+  {
+    return;
+  }
+  const glm::mat4 transform = parentTransform * n.transform;
+  const uint8_t   mask      = parentMask & n.mask;
+  uint32_t        next      = first;
+  if(n.objIndex != k_none)
+  {
+    if(dirty)
+    {
+      instances[next] = {transform, n.objIndex, mask};
+      if(changed != nullptr)
+      {
+        changed->push_back(next);
+      }
+    }
+    next++;
+  }
+  if(n.prototype != k_none && (dirty || n.prototypeDirty))
+  {
+    visit(n.prototype, transform, mask, next, dirty, instances, changed);
+  }
+  // Below a dirty node, everything moves; otherwise only the children on the way to dirty nodes
+  const std::vector<uint32_t>& children = dirty ? n.children : n.dirtyChildren;
+  for(uint32_t child : children)
+  {
+    visit(child, transform, mask, first + m_nodes[child].offset, dirty, instances, changed);
+  }
+}
+
+bool SceneGraph::update(std::vector<Instance>& instances, std::vector<uint32_t>& changed)
+{
+  assert(m_flattened);
+  changed.clear();
+  if(m_touched.empty())
+  {
+    return false;
+  }
+  visit(k_root, glm::mat4(1), k_maskAll, 0, false, instances, &changed);
+  clearDirty();
+  return !changed.empty();
+}
+
+void SceneGraph::clearDirty()
+{
+  // Prototypes are only clean once all of their references were visited
+  for(uint32_t node : m_touched)
+  {
+    Node& n          = m_nodes[node];
+    n.dirty          = false;
+    n.subtreeDirty   = false;
+    n.prototypeDirty = false;
+    n.queued         = false;
+    n.dirtyChildren.clear();
+  }
+  m_touched.clear();
+}
+
+uint32_t SceneGraph::getInstanceIndex(uint32_t node) const
+{
+  if(m_nodes[node].objIndex == k_none)
+  {
+    return k_none;
+  }
+  uint32_t index = 0;
+  for(uint32_t n = node; n != k_root; n = m_nodes[n].parent)
+  {
+    if(m_nodes[n].parent == k_none)
+    {
+      return k_none;  // In a prototype
+    }
+    index += m_nodes[n].offset;
+  }
+  return index;
+}
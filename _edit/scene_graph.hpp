@@ -0,0 +1,114 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// The hierarchy of the scene: nodes with a transform relative to their
+// parent and a visibility mask, some of which place a model. It's flattened
+// into one instance per placed model, in world space and with the masks of
+// all of its ancestors ANDed together, which become the instances of the TLAS.
+// A prototype is a subtree that isn't part of the scene itself, but is placed
+// by reference nodes, any number of times; prototypes can reference other
+// prototypes, so a forest of trees of branches of leaves only stores each
+// level once, and the flattened instances all share the models' BLASes.
+// The structure is fixed once flattened. Afterwards, changing a node's
+// transform or mask only marks it dirty, and update() re-flattens just the
+// subtrees below dirty nodes, walking down from the root along the paths to
+// them; changing a node of a prototype re-flattens all places it appears in.
+// The bits of the masks are the classes of rays that see an instance, see
+// INSTANCE_MASK_* of shaders/host_device.h.
+#ifndef VK_MINI_PATH_TRACER_SCENE_GRAPH_HPP
+#define VK_MINI_PATH_TRACER_SCENE_GRAPH_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class SceneGraph
+{
+public:
+  static constexpr uint32_t k_none = ~0u;
+  static constexpr uint32_t k_root = 0;  // The scene itself
+
+  // INSTANCE_MASK_* of shaders/host_device.h
+  static constexpr uint8_t k_maskCamera    = 0x01;  // Camera rays and the rasterizer
+  static constexpr uint8_t k_maskSecondary = 0x02;  // Bounces
+  static constexpr uint8_t k_maskShadow    = 0x04;  // Shadow rays; instances without it cast no shadows
+  static constexpr uint8_t k_maskAll       = 0xFF;
+
+  // A model placed by the flattened scene
+  struct Instance
+  {
+    glm::mat4 transform{1};     // World space
+    uint32_t  objIndex{0};      // Model index reference
+    uint8_t   mask{k_maskAll};  // Only hit by rays whose cull mask shares a bit with it
+  };
+
+  SceneGraph();
+
+  // Nodes under `parent`, which is k_root or a node added before. A group only
+  // places its children; a mesh places model `objIndex` as well; a reference
+  // places the nodes of `prototype`.
+  uint32_t addGroup(uint32_t parent, const glm::mat4& transform = glm::mat4(1), uint8_t mask = k_maskAll);
+  uint32_t addMesh(uint32_t parent, uint32_t objIndex, const glm::mat4& transform = glm::mat4(1), uint8_t mask = k_maskAll);
+  uint32_t addPrototype();
+  uint32_t addReference(uint32_t parent, uint32_t prototype, const glm::mat4& transform = glm::mat4(1), uint8_t mask = k_maskAll);
+
+  void setTransform(uint32_t node, const glm::mat4& transform);
+  void setMask(uint32_t node, uint8_t mask);
+
+  // Fixes the structure, and writes all of the instances
+  void flatten(std::vector<Instance>& instances);
+  // Writes the instances below the nodes changed since the last call, and
+  // lists their indices in `changed`. Returns false if none changed.
+  bool update(std::vector<Instance>& instances, std::vector<uint32_t>& changed);
+
+  // The index of the instance of a mesh node that's placed once, i.e. that
+  // isn't in a prototype; k_none for the others. Valid once flattened.
+  uint32_t getInstanceIndex(uint32_t node) const;
+  uint32_t getNodeCount() const { return static_cast<uint32_t>(m_nodes.size()); }
+  uint32_t getInstanceCount() const { return m_nodes[k_root].leafCount; }
+
+private:
+  struct Node
+  {
+    glm::mat4             transform{1};  // Relative to the parent
+    uint8_t               mask{k_maskAll};
+    uint32_t              parent{k_none};     // k_none for k_root and prototypes
+    uint32_t              objIndex{k_none};   // Of a mesh
+    uint32_t              prototype{k_none};  // Of a reference
+    std::vector<uint32_t> children;
+    std::vector<uint32_t> referrers;  // Of a prototype: the references placing it
+
+    // Layout of the flattened instances; the instances of a node are
+    // consecutive: its model, then its prototype's, then its children's
+    uint32_t leafCount{0};  // Instances below the node, itself included
+    uint32_t offset{0};     // Of its first instance, from the first of its parent
+
+    // What changed since the last update
+    bool                  dirty{false};           // Its transform or mask
+    bool                  subtreeDirty{false};    // That of a node below it
+    bool                  prototypeDirty{false};  // That of a node of its prototype
+    bool                  queued{false};          // Whether it's in its parent's dirtyChildren
+    std::vector<uint32_t> dirtyChildren;          // Children that are dirty, or have dirty nodes below
+  };
+
+  uint32_t addNode(uint32_t parent, const glm::mat4& transform, uint8_t mask);
+  uint32_t computeLayout(uint32_t node, uint32_t depth);
+  void     markDirty(uint32_t node);
+  void     propagateDirty(uint32_t node);
+  void     touch(uint32_t node);
+  void     visit(uint32_t               node,
+                 const glm::mat4&       parentTransform,
+                 uint8_t                parentMask,
+                 uint32_t               first,
+                 bool                   force,
+                 std::vector<Instance>& instances,
+                 std::vector<uint32_t>* changed);
+  void     clearDirty();
+
+  std::vector<Node>     m_nodes;
+  std::vector<uint32_t> m_touched;  // Nodes with any of the dirty state set
+  bool                  m_flattened{false};
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_SCENE_GRAPH_HPP
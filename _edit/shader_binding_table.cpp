@@ -0,0 +1,183 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "shader_binding_table.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include <nvh/nvprint.hpp>
+#include <nvvk/buffers_vk.hpp>  // For nvvk::getBufferDeviceAddress
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void ShaderBindingTable::init(nvvk::ResourceAllocator*                               alloc,
+                              const VkPhysicalDeviceRayTracingPipelinePropertiesKHR& properties,
+                              uint32_t                                               numRayTypes,
+                              uint32_t                                               numHitGroups,
+                              uint32_t                                               maxHitRecordSets,
+                              uint32_t                                               hitDataSize,
+                              uint32_t                                               numFramesInFlight)
+{
+  m_alloc         = alloc;
+  m_device        = alloc->getDevice();
+  m_handleSize    = properties.shaderGroupHandleSize;
+  m_numRayTypes   = numRayTypes;
+  m_numHitGroups  = numHitGroups;
+  m_numRecordSets = maxHitRecordSets;
+  m_hitDataSize   = hitDataSize;
+  m_numCopies     = std::clamp(numFramesInFlight, 1u, 32u);  // One bit per copy in m_pendingMask
+  m_hitGroups.assign(size_t(m_numRecordSets) * m_numRayTypes, 0);
+  m_hitData.assign(size_t(m_numRecordSets) * m_hitDataSize, 0);
+  m_pendingWrites.assign(m_numCopies, {});
+  m_pendingMask.assign(m_numRecordSets, 0);
+
+  // Each region starts at the base alignment, and the records in it at the handle alignment. The size of
+  // the raygen region must be equal to its stride.
+  const VkDeviceSize base = properties.shaderGroupBaseAlignment;
+  m_rgenSize              = alignUp(alignUp(m_handleSize, properties.shaderGroupHandleAlignment), base);
+  m_missStride            = alignUp(m_handleSize, properties.shaderGroupHandleAlignment);
+  m_missSize              = alignUp(m_numRayTypes * m_missStride, base);
+  m_hitStride             = alignUp(m_handleSize + m_hitDataSize, properties.shaderGroupHandleAlignment);
+  m_hitSize               = alignUp(std::max<VkDeviceSize>(m_hitGroups.size() * m_hitStride, 1), base);
+  m_copySize              = m_rgenSize + m_missSize + m_hitSize;
+  if(m_hitStride > properties.maxShaderGroupStride)
+  {
+    LOGE("Hit records of %u bytes exceed the maximum stride of %u bytes\n", uint32_t(m_hitStride),
+         properties.maxShaderGroupStride);
+  }
+  assert(m_hitStride <= properties.maxShaderGroupStride);
+}
+
+void ShaderBindingTable::deinit()
+{
+  if(m_alloc == nullptr)
+  {
+    return;
+  }
+  if(m_mapped != nullptr)
+  {
+    m_alloc->unmap(m_buffer);
+  }
+  m_alloc->destroy(m_buffer);
+  m_mapped = nullptr;
+  m_handles.clear();
+  m_hitGroups.clear();
+  m_hitData.clear();
+  m_pendingWrites.clear();
+  m_pendingMask.clear();
+  m_alloc = nullptr;
+}
+
+void ShaderBindingTable::setHitGroup(uint32_t recordSet, uint32_t rayType, uint32_t hitGroup)
+{
+  assert(recordSet < m_numRecordSets && rayType < m_numRayTypes && hitGroup < m_numHitGroups);
+  m_hitGroups[size_t(recordSet) * m_numRayTypes + rayType] = hitGroup;
+  markDirty(recordSet);
+}
+
+void ShaderBindingTable::setHitData(uint32_t recordSet, const void* data, size_t size)
+{
+  assert(recordSet < m_numRecordSets && size <= m_hitDataSize);
+  memcpy(m_hitData.data() + size_t(recordSet) * m_hitDataSize, data, size);
+  markDirty(recordSet);
+}
+
+void ShaderBindingTable::markDirty(uint32_t recordSet)
+{
+  for(uint32_t copy = 0; copy < m_numCopies; copy++)
+  {
+    const uint32_t bit = 1u << copy;
+    if((m_pendingMask[recordSet] & bit) == 0)
+    {
+      m_pendingMask[recordSet] |= bit;
+      m_pendingWrites[copy].push_back(recordSet);
+    }
+  }
+}
+
+void ShaderBindingTable::writeRecord(uint8_t* copyStart, uint32_t record) const
+{
+  const uint32_t group = 1 + m_numRayTypes + m_hitGroups[record];
+  uint8_t*       dst   = copyStart + m_rgenSize + m_missSize + record * m_hitStride;
+  memcpy(dst, m_handles.data() + size_t(group) * m_handleSize, m_handleSize);
+  memcpy(dst + m_handleSize, m_hitData.data() + size_t(record / m_numRayTypes) * m_hitDataSize, m_hitDataSize);
+}
+
+nvvk::Buffer ShaderBindingTable::build(VkPipeline pipeline)
+{
+  const uint32_t groupCount = 1 + m_numRayTypes + m_numHitGroups;
+  m_handles.resize(size_t(groupCount) * m_handleSize);
+  const VkResult result =
+      vkGetRayTracingShaderGroupHandlesKHR(m_device, pipeline, 0, groupCount, m_handles.size(), m_handles.data());
+  assert(result == VK_SUCCESS);
+
+  const nvvk::Buffer retired = m_buffer;
+  if(m_mapped != nullptr)
+  {
+    m_alloc->unmap(retired);
+  }
+  // Spare room at the start, for the regions to start at the base alignment wherever the buffer is
+  const VkDeviceSize base = m_rgenSize;  // A multiple of the base alignment, and at least that
+  m_buffer = m_alloc->createBuffer(m_copySize * m_numCopies + base,
+                                   VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR,
+                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  const VkDeviceAddress bufferAddress = nvvk::getBufferDeviceAddress(m_device, m_buffer.buffer);
+  m_address                           = alignUp(bufferAddress, base);
+  m_mapped = static_cast<uint8_t*>(m_alloc->map(m_buffer)) + (m_address - bufferAddress);
+
+  // Every copy starts out with all records
+  for(uint32_t copy = 0; copy < m_numCopies; copy++)
+  {
+    uint8_t* copyStart = m_mapped + copy * m_copySize;
+    memset(copyStart, 0, size_t(m_copySize));
+    memcpy(copyStart, m_handles.data(), m_handleSize);
+    for(uint32_t rayType = 0; rayType < m_numRayTypes; rayType++)
+    {
+      memcpy(copyStart + m_rgenSize + rayType * m_missStride, m_handles.data() + size_t(1 + rayType) * m_handleSize, m_handleSize);
+    }
+    for(uint32_t record = 0; record < static_cast<uint32_t>(m_hitGroups.size()); record++)
+    {
+      writeRecord(copyStart, record);
+    }
+    m_pendingWrites[copy].clear();
+  }
+  std::fill(m_pendingMask.begin(), m_pendingMask.end(), 0);
+  return retired;
+}
+
+void ShaderBindingTable::update(uint32_t frameIndex)
+{
+  if(m_mapped == nullptr)
+  {
+    return;
+  }
+  const uint32_t copy      = frameIndex % m_numCopies;
+  const uint32_t bit       = 1u << copy;
+  uint8_t*       copyStart = m_mapped + copy * m_copySize;
+  for(uint32_t recordSet : m_pendingWrites[copy])
+  {
+    for(uint32_t rayType = 0; rayType < m_numRayTypes; rayType++)
+    {
+      writeRecord(copyStart, recordSet * m_numRayTypes + rayType);
+    }
+    m_pendingMask[recordSet] &= ~bit;
+  }
+  m_pendingWrites[copy].clear();
+}
+
+void ShaderBindingTable::getRegions(uint32_t                         frameIndex,
+                                    VkStridedDeviceAddressRegionKHR& rgen,
+                                    VkStridedDeviceAddressRegionKHR& miss,
+                                    VkStridedDeviceAddressRegionKHR& hit,
+                                    VkStridedDeviceAddressRegionKHR& call) const
+{
+  const VkDeviceAddress copyStart = m_address + (frameIndex % m_numCopies) * m_copySize;
+  rgen = {.deviceAddress = copyStart, .stride = m_rgenSize, .size = m_rgenSize};
+  miss = {.deviceAddress = copyStart + m_rgenSize, .stride = m_missStride, .size = m_missSize};
+  hit  = {.deviceAddress = copyStart + m_rgenSize + m_missSize, .stride = m_hitStride, .size = m_hitSize};
+  call = {};
+}
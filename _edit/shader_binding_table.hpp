@@ -0,0 +1,90 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// The shader binding table of a ray tracing pipeline with N ray types: one
+// raygen record, one miss record per ray type, and a number of hit record
+// sets, each with one record per ray type. A TLAS instance selects a set
+// with its instanceShaderBindingTableRecordOffset (getInstanceOffset), and
+// the rays of type t trace with sbtRecordOffset t, sbtRecordStride N and
+// missIndex t. Hit records carry inline data after the group handle, which
+// the hit shaders read through shaderRecordEXT instead of fetching it.
+// The groups of the pipeline are expected in that order: raygen, the misses
+// of each ray type, then the hit groups.
+// Like DynamicTlas, the table has one copy per frame in flight, so records
+// can change while frames render: setting a record only marks it dirty, and
+// update() writes it to a frame's copy once that frame is done with it.
+#ifndef VK_MINI_PATH_TRACER_SHADER_BINDING_TABLE_HPP
+#define VK_MINI_PATH_TRACER_SHADER_BINDING_TABLE_HPP
+
+#include <vector>
+
+#include <nvvk/resourceallocator_vk.hpp>
+
+class ShaderBindingTable
+{
+public:
+  // Sizes the hit records for `hitDataSize` bytes of inline data, and up to
+  // `maxHitRecordSets` sets, which start out pointing at hit group 0 with no data.
+  void init(nvvk::ResourceAllocator*                               alloc,
+            const VkPhysicalDeviceRayTracingPipelinePropertiesKHR& properties,
+            uint32_t                                               numRayTypes,
+            uint32_t                                               numHitGroups,
+            uint32_t                                               maxHitRecordSets,
+            uint32_t                                               hitDataSize,
+            uint32_t                                               numFramesInFlight);
+  void deinit();
+
+  // Points the hit record of `rayType` in set `recordSet` at hit group
+  // `hitGroup`, i.e. pipeline group 1 + numRayTypes + hitGroup.
+  void setHitGroup(uint32_t recordSet, uint32_t rayType, uint32_t hitGroup);
+  // Sets the inline data of all records of `recordSet`, at most hitDataSize bytes
+  void setHitData(uint32_t recordSet, const void* data, size_t size);
+
+  // Writes the group handles of `pipeline` and all records to a new buffer.
+  // Returns the buffer it replaces, which frames in flight may still read,
+  // for the caller to destroy once they're done with it.
+  nvvk::Buffer build(VkPipeline pipeline);
+  // Writes the records that changed since frame `frameIndex`'s copy was last
+  // used; its fence must have been waited on.
+  void update(uint32_t frameIndex);
+
+  // The regions of frame `frameIndex`'s copy, for vkCmdTraceRaysKHR
+  void getRegions(uint32_t                         frameIndex,
+                  VkStridedDeviceAddressRegionKHR& rgen,
+                  VkStridedDeviceAddressRegionKHR& miss,
+                  VkStridedDeviceAddressRegionKHR& hit,
+                  VkStridedDeviceAddressRegionKHR& call) const;
+  uint32_t getInstanceOffset(uint32_t recordSet) const { return recordSet * m_numRayTypes; }
+  VkBuffer getBuffer() const { return m_buffer.buffer; }
+
+private:
+  void markDirty(uint32_t recordSet);
+  void writeRecord(uint8_t* copyStart, uint32_t record) const;
+
+  nvvk::ResourceAllocator* m_alloc = nullptr;
+  VkDevice                 m_device{VK_NULL_HANDLE};
+  uint32_t                 m_handleSize    = 0;
+  uint32_t                 m_numRayTypes   = 0;
+  uint32_t                 m_numHitGroups  = 0;
+  uint32_t                 m_numRecordSets = 0;
+  uint32_t                 m_hitDataSize   = 0;
+  VkDeviceSize             m_rgenSize      = 0;  // Sizes of the regions of a copy, each starting at the base alignment
+  VkDeviceSize             m_missStride    = 0;
+  VkDeviceSize             m_missSize      = 0;
+  VkDeviceSize             m_hitStride     = 0;
+  VkDeviceSize             m_hitSize       = 0;
+  VkDeviceSize             m_copySize      = 0;
+  std::vector<uint8_t>     m_handles;    // Of all groups of the pipeline of the last build
+  std::vector<uint32_t>    m_hitGroups;  // Per hit record
+  std::vector<uint8_t>     m_hitData;    // Per record set, hitDataSize bytes
+
+  // One copy of the table per frame in flight, one after the other in m_buffer
+  nvvk::Buffer                       m_buffer;
+  VkDeviceAddress                    m_address   = 0;
+  uint8_t*                           m_mapped    = nullptr;
+  uint32_t                           m_numCopies = 0;
+  std::vector<std::vector<uint32_t>> m_pendingWrites;  // Per copy, the record sets it's missing changes of
+  std::vector<uint32_t>              m_pendingMask;    // Per record set, bit c is set if it's in m_pendingWrites[c]
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_SHADER_BINDING_TABLE_HPP
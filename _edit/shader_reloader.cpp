@@ -0,0 +1,287 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "shader_reloader.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+#include <nvh/nvprint.hpp>
+
+#if NVP_SUPPORTS_SHADERC
+#include <shaderc/shaderc.h>
+#endif
+
+static std::filesystem::file_time_type lastWriteTime(const std::string& filename)
+{
+  std::error_code error;
+  const std::filesystem::file_time_type time = std::filesystem::last_write_time(filename, error);
+  // A file that's missing for a moment (editors often replace files) counts as unchanged
+  return error ? std::filesystem::file_time_type::min() : time;
+}
+
+static bool readFile(const std::string& filename, std::string& contents)
+{
+  std::ifstream file(filename, std::ios::binary);
+  if(!file)
+  {
+    return false;
+  }
+  std::stringstream stream;
+  stream << file.rdbuf();
+  contents = stream.str();
+  return true;
+}
+
+#if NVP_SUPPORTS_SHADERC
+static shaderc_shader_kind shaderKind(const std::string& filename)
+{
+  // The stage is the extension before .glsl, as in raytrace.rchit.glsl
+  const std::filesystem::path path(filename);
+  const std::string           stage = path.stem().extension().string();
+  if(stage == ".vert")
+    return shaderc_vertex_shader;
+  if(stage == ".frag")
+    return shaderc_fragment_shader;
+  if(stage == ".comp")
+    return shaderc_compute_shader;
+  if(stage == ".rgen")
+    return shaderc_raygen_shader;
+  if(stage == ".rmiss")
+    return shaderc_miss_shader;
+  if(stage == ".rchit")
+    return shaderc_closesthit_shader;
+  if(stage == ".rahit")
+    return shaderc_anyhit_shader;
+  if(stage == ".rint")
+    return shaderc_intersection_shader;
+  if(stage == ".rcall")
+    return shaderc_callable_shader;
+  return shaderc_glsl_infer_from_source;  // Needs a #pragma shader_stage
+}
+
+// Resolves #include "file" relative to the including file, and records each included file
+struct IncludeResolver
+{
+  struct Include
+  {
+    shaderc_include_result result{};
+    std::string            name;
+    std::string            contents;
+  };
+  std::vector<std::string> included;
+
+  static shaderc_include_result* resolve(void* userData, const char* requested, int /*type*/, const char* requesting, size_t /*depth*/)
+  {
+    IncludeResolver* resolver = static_cast<IncludeResolver*>(userData);
+    Include*         include  = new Include;
+    const std::filesystem::path path = std::filesystem::path(requesting).parent_path() / requested;
+    include->name                    = path.lexically_normal().string();
+    if(readFile(include->name, include->contents))
+    {
+      resolver->included.push_back(include->name);
+      include->result.source_name        = include->name.c_str();
+      include->result.source_name_length = include->name.size();
+    }
+    else
+    {
+      // An empty source name reports an error, with the contents as the message
+      include->contents = "could not open " + include->name;
+    }
+    include->result.content        = include->contents.c_str();
+    include->result.content_length = include->contents.size();
+    include->result.user_data      = include;
+    return &include->result;
+  }
+
+  static void release(void* /*userData*/, shaderc_include_result* result)
+  {
+    delete static_cast<Include*>(result->user_data);
+  }
+};
+#endif
+
+void ShaderReloader::init(VkDevice device)
+{
+  m_device = device;
+  m_stop   = false;
+}
+
+void ShaderReloader::deinit()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  if(m_thread.joinable())
+  {
+    m_thread.join();
+  }
+  for(Watched& watched : m_watched)
+  {
+    vkDestroyPipeline(m_device, watched.rebuilt, nullptr);
+  }
+  m_watched.clear();
+  m_device = VK_NULL_HANDLE;
+}
+
+uint32_t ShaderReloader::watch(const std::string& name, const std::vector<std::string>& sources, BuildFunction build)
+{
+  for(const std::string& source : sources)
+  {
+    if(!std::filesystem::exists(source))
+    {
+      LOGW("Not reloading %s: could not find its source %s\n", name.c_str(), source.c_str());
+      return ~0u;
+    }
+  }
+  Watched& watched = m_watched.emplace_back();
+  watched.name     = name;
+  watched.sources  = sources;
+  watched.build    = std::move(build);
+  return static_cast<uint32_t>(m_watched.size() - 1);
+}
+
+void ShaderReloader::start(uint32_t pollIntervalMs)
+{
+#if NVP_SUPPORTS_SHADERC
+  if(!m_watched.empty())
+  {
+    m_thread = std::thread(&ShaderReloader::threadLoop, this, std::chrono::milliseconds(pollIntervalMs));
+  }
+#else
+  LOGW("Shaders are not reloaded: built without shaderc\n");
+#endif
+}
+
+VkPipeline ShaderReloader::take(uint32_t id)
+{
+  if(id >= m_watched.size())
+  {
+    return VK_NULL_HANDLE;
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return std::exchange(m_watched[id].rebuilt, VK_NULL_HANDLE);
+}
+
+void ShaderReloader::threadLoop(std::chrono::milliseconds pollInterval)
+{
+  // The includes are only known once the sources have been preprocessed
+  std::vector<std::string> spirv;
+  for(Watched& watched : m_watched)
+  {
+    compile(watched, true, spirv);
+  }
+
+  while(true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if(m_wake.wait_for(lock, pollInterval, [this] { return m_stop; }))
+      {
+        return;
+      }
+    }
+
+    for(Watched& watched : m_watched)
+    {
+      if(!checkDependencies(watched))
+      {
+        continue;
+      }
+      if(!compile(watched, false, spirv))
+      {
+        LOGE("Could not reload %s, keeping the current pipeline\n", watched.name.c_str());
+        continue;
+      }
+      const VkPipeline pipeline = watched.build(spirv);
+      if(pipeline == VK_NULL_HANDLE)
+      {
+        LOGE("Could not create the reloaded %s pipeline, keeping the current one\n", watched.name.c_str());
+        continue;
+      }
+
+      // A pipeline that was never taken was never used, and can go right away
+      std::lock_guard<std::mutex> lock(m_mutex);
+      vkDestroyPipeline(m_device, watched.rebuilt, nullptr);
+      watched.rebuilt = pipeline;
+      LOGI("Reloaded %s\n", watched.name.c_str());
+    }
+  }
+}
+
+bool ShaderReloader::checkDependencies(Watched& watched)
+{
+  bool changed = false;
+  for(auto& [filename, time] : watched.dependencies)
+  {
+    const std::filesystem::file_time_type current = lastWriteTime(filename);
+    if(current != std::filesystem::file_time_type::min() && current != time)
+    {
+      time    = current;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool ShaderReloader::compile(Watched& watched, bool preprocessOnly, std::vector<std::string>& spirv)
+{
+  spirv.clear();
+  watched.dependencies.clear();
+#if NVP_SUPPORTS_SHADERC
+  // Same environment as the build's _compile_GLSL
+  shaderc_compiler_t        compiler = shaderc_compiler_initialize();
+  shaderc_compile_options_t options  = shaderc_compile_options_initialize();
+  shaderc_compile_options_set_target_env(options, shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+  shaderc_compile_options_set_generate_debug_info(options);
+#ifdef PATH_TRACER_RAY_STATS
+  // As the build compiled them, with the counters of the instrumentation build
+  shaderc_compile_options_add_macro_definition(options, "RAY_STATS", 9, nullptr, 0);
+#endif
+  IncludeResolver resolver;
+  shaderc_compile_options_set_include_callbacks(options, IncludeResolver::resolve, IncludeResolver::release, &resolver);
+
+  bool success = true;
+  for(const std::string& source : watched.sources)
+  {
+    // Recorded before reading, so that an edit made during compilation triggers another one
+    watched.dependencies[source] = lastWriteTime(source);
+    std::string text;
+    if(!readFile(source, text))
+    {
+      LOGE("Could not read %s\n", source.c_str());
+      success = false;
+      continue;
+    }
+
+    resolver.included.clear();
+    shaderc_compilation_result_t result =
+        preprocessOnly ?
+            shaderc_compile_into_preprocessed_text(compiler, text.data(), text.size(), shaderKind(source),
+                                                   source.c_str(), "main", options) :
+            shaderc_compile_into_spv(compiler, text.data(), text.size(), shaderKind(source), source.c_str(), "main", options);
+    for(const std::string& include : resolver.included)
+    {
+      watched.dependencies.emplace(include, lastWriteTime(include));
+    }
+    if(shaderc_result_get_compilation_status(result) == shaderc_compilation_status_success)
+    {
+      spirv.emplace_back(shaderc_result_get_bytes(result), shaderc_result_get_length(result));
+    }
+    else
+    {
+      LOGE("%s", shaderc_result_get_error_message(result));
+      success = false;
+    }
+    shaderc_result_release(result);
+  }
+
+  shaderc_compile_options_release(options);
+  shaderc_compiler_release(compiler);
+  return success;
+#else
+  return false;
+#endif
+}
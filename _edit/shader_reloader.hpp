@@ -0,0 +1,80 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Rebuilds pipelines while the application runs, when the GLSL sources of
+// their shaders are edited.
+// Each watched pipeline is a list of GLSL sources and a function that creates
+// the pipeline from their SPIR-V. A background thread polls the modification
+// times of the sources and of the files they #include; when one changes, it
+// recompiles the sources of each pipeline that depends on it with shaderc and
+// creates the new pipeline, still on the background thread, so rendering
+// carries on with the current one. Other pipelines are left alone. The render
+// thread takes the new pipeline at a frame boundary, and retires the old one
+// once the frames in flight are done with it. If a source fails to compile,
+// the errors are logged and the current pipeline stays.
+// Compiling at run time needs shaderc (NVP_SUPPORTS_SHADERC); without it,
+// start() logs a warning and nothing is ever rebuilt.
+#ifndef VK_MINI_PATH_TRACER_SHADER_RELOADER_HPP
+#define VK_MINI_PATH_TRACER_SHADER_RELOADER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+class ShaderReloader
+{
+public:
+  // Creates a pipeline from the SPIR-V of each source, in the order they were
+  // watched in. Called on the background thread; returns VK_NULL_HANDLE on failure.
+  using BuildFunction = std::function<VkPipeline(const std::vector<std::string>& spirv)>;
+
+  void init(VkDevice device);
+  // Stops the background thread and destroys the pipelines that were never taken.
+  void deinit();
+
+  // Watches `sources`, whose stages follow from their extensions (e.g.
+  // .rchit.glsl), for the pipeline `build` creates. Returns the id to take()
+  // the pipeline with, or ~0u if a source can't be found. All pipelines are
+  // watched before start().
+  uint32_t watch(const std::string& name, const std::vector<std::string>& sources, BuildFunction build);
+  // Starts polling the sources every `pollIntervalMs` milliseconds.
+  void start(uint32_t pollIntervalMs = 250);
+
+  // Returns the pipeline rebuilt since the last call, or VK_NULL_HANDLE; the
+  // caller then owns it. Only the latest rebuild is kept.
+  VkPipeline take(uint32_t id);
+
+private:
+  struct Watched
+  {
+    std::string                                            name;
+    std::vector<std::string>                               sources;
+    BuildFunction                                          build;
+    std::map<std::string, std::filesystem::file_time_type> dependencies;  // Sources and includes, with the time they were last seen
+    VkPipeline                                             rebuilt{VK_NULL_HANDLE};  // Not taken yet; guarded by m_mutex
+  };
+
+  void threadLoop(std::chrono::milliseconds pollInterval);
+  // Whether a dependency of `watched` changed since the last check; also records the new times
+  bool checkDependencies(Watched& watched);
+  // Compiles all sources of `watched`, or only preprocesses them to find their
+  // includes. Replaces watched.dependencies. Returns false on errors.
+  bool compile(Watched& watched, bool preprocessOnly, std::vector<std::string>& spirv);
+
+  VkDevice             m_device{VK_NULL_HANDLE};
+  std::vector<Watched> m_watched;
+  std::thread          m_thread;
+
+  std::mutex              m_mutex;
+  std::condition_variable m_wake;  // The thread must stop
+  bool                    m_stop = false;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_SHADER_RELOADER_HPP
@@ -0,0 +1,78 @@
+#version 460
+// One iteration of the edge-avoiding a-trous filter of Denoiser: a 5x5
+// B3-spline blur with taps `stepWidth` pixels apart, each weighted down by how
+// much its color, normal and depth differ from those of the center
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(set = 0, binding = 0, rgba32f) uniform readonly image2D inputImage;
+layout(set = 0, binding = 1, rgba32f) uniform writeonly image2D outputImage;
+layout(set = 0, binding = 2, rgba16f) uniform readonly image2D albedoImage;       // Of the first hit
+layout(set = 0, binding = 3, rgba16f) uniform readonly image2D normalDepthImage;  // Normal, and distance of the first hit
+
+const int k_firstIteration = 1;  // The input is the color; divide the albedo out of it
+const int k_lastIteration = 2;   // Multiply the albedo back into the output
+
+layout(push_constant) uniform _PushConstantDenoise {
+    int stepWidth;
+    float colorPhi;
+    float normalPhi;
+    float depthPhi;
+    int flags;
+} pc;
+
+const float k_kernel[3] = float[](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+// Irradiance: the color without the albedo, if it's the color
+vec3 loadInput(ivec2 pixel) {
+    const vec3 value = imageLoad(inputImage, pixel).rgb;
+    if ((pc.flags & k_firstIteration) != 0) {
+        return value / max(imageLoad(albedoImage, pixel).rgb, vec3(1e-3));
+    }
+    return value;
+}
+
+// Accumulation averages the normals of all samples, which shortens them
+vec3 unitNormal(vec4 normalDepth) {
+    return normalDepth.xyz == vec3(0) ? vec3(0) : normalize(normalDepth.xyz);
+}
+
+void main() {
+    const ivec2 size = imageSize(outputImage);
+    const ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(pixel, size))) {
+        return;
+    }
+
+    const vec3 centerColor = loadInput(pixel);
+    const vec4 centerNormalDepth = imageLoad(normalDepthImage, pixel);
+
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+    // Pixels of the sky have no normal, and only blur with each other
+    for (int y = -2; y <= 2; y++) {
+        for (int x = -2; x <= 2; x++) {
+            const ivec2 tap = clamp(pixel + ivec2(x, y) * pc.stepWidth, ivec2(0), size - 1);
+            const vec3 color = loadInput(tap);
+            const vec4 normalDepth = imageLoad(normalDepthImage, tap);
+
+            const vec3 colorDiff = color - centerColor;
+            const float colorWeight = exp(-dot(colorDiff, colorDiff) / max(pc.colorPhi * pc.colorPhi, 1e-8));
+            const float normalWeight = pow(clamp(dot(unitNormal(normalDepth), unitNormal(centerNormalDepth)), 0.0, 1.0), pc.normalPhi);
+            const float pixelDistance = length(vec2(x, y)) * float(pc.stepWidth);
+            const float depthWeight = exp(-abs(normalDepth.w - centerNormalDepth.w) / (pc.depthPhi * pixelDistance + 1e-4));
+            const bool bothSky = centerNormalDepth.xyz == vec3(0) && normalDepth.xyz == vec3(0);
+
+            const float weight = k_kernel[abs(x)] * k_kernel[abs(y)] * colorWeight * (bothSky ? 1.0 : normalWeight * depthWeight);
+            sum += color * weight;
+            weightSum += weight;
+        }
+    }
+
+    // The center always has a weight
+    vec3 result = sum / weightSum;
+    if ((pc.flags & k_lastIteration) != 0) {
+        result *= max(imageLoad(albedoImage, pixel).rgb, vec3(1e-3));
+    }
+    imageStore(outputImage, pixel, vec4(result, 1.0));
+}
@@ -0,0 +1,51 @@
+#version 460
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_arithmetic : require
+// Auto-exposure after the post pass: one invocation per bin of the luminance
+// histogram, which sum the pixels and their log luminance with subgroup
+// reductions, then one per subgroup in shared memory. Moves the exposure
+// towards the one for the average, and clears the histogram for the next frame.
+
+#include "host_device.h"
+
+layout(local_size_x = EXPOSURE_HISTOGRAM_BINS) in;
+
+layout(set = 0, binding = ePostExposure, std430) buffer Exposure_ {
+    ExposureState exposureState;
+};
+
+layout(push_constant) uniform _PushConstantPost {
+    PushConstantPost pcPost;
+};
+
+shared vec2 s_sums[EXPOSURE_HISTOGRAM_BINS];  // Of each subgroup: pixels, and pixels times log luminance
+
+void main() {
+    const uint bin = gl_LocalInvocationIndex;
+    const float count = float(exposureState.histogram[bin]);
+    exposureState.histogram[bin] = 0u;
+
+    // At the center of the bin; the dark pixels of bin 0 don't count
+    const float logLuminance = EXPOSURE_MIN_LOG_LUMINANCE
+                               + (float(bin) - 0.5) / float(EXPOSURE_HISTOGRAM_BINS - 2) * EXPOSURE_LOG_LUMINANCE_RANGE;
+    const vec2 sums = subgroupAdd(bin == 0u ? vec2(0.0) : vec2(count, count * logLuminance));
+    if (subgroupElect()) {
+        s_sums[gl_SubgroupID] = sums;
+    }
+    barrier();
+
+    if (bin == 0u) {
+        vec2 total = vec2(0.0);
+        for (uint i = 0u; i < gl_NumSubgroups; i++) {
+            total += s_sums[i];
+        }
+        // An empty image keeps the exposure it had
+        if (total.x > 0.0) {
+            const float averageLuminance = exp2(total.y / total.x);
+            const float target = EXPOSURE_KEY / averageLuminance;
+            exposureState.exposure = mix(exposureState.exposure, target, clamp(pcPost.adaptation, 0.0, 1.0));
+            exposureState.averageLuminance = averageLuminance;
+        }
+    }
+}
@@ -40,13 +40,16 @@ layout(binding = eObjDescs, scalar) buffer ObjDesc_ {
     ObjDesc i[];
 } objDesc;
 layout(binding = eTextures) uniform sampler2D[] textureSamplers;
+layout(binding = eTextureFeedback) buffer TextureFeedback_ {
+    uint used[];
+} textureFeedback; // Marks the textures sampled, for the texture streamer
 // clang-format on
 
 void main() {
     // Material of the object
     ObjDesc    objResource = objDesc.i[pcRaster.objIndex];
-    MatIndices matIndices  = MatIndices(objResource.materialIndexAddress);
-    Materials  materials   = Materials(objResource.materialAddress);
+    MatIndices matIndices  = MatIndices(objResource.geometryAddress + objResource.materialIndexOffset);
+    Materials  materials   = Materials(objResource.geometryAddress + objResource.materialOffset);
 
     int               matIndex = matIndices.i[gl_PrimitiveID];
     WaveFrontMaterial mat      = materials.m[matIndex];
@@ -72,6 +75,7 @@ void main() {
         int  txtOffset  = objDesc.i[pcRaster.objIndex].txtOffset;
         uint txtId      = txtOffset + mat.textureId;
         vec3 diffuseTxt = texture(textureSamplers[nonuniformEXT(txtId)], i_texCoord).xyz;
+        textureFeedback.used[txtId] = 1u;
         diffuse *= diffuseTxt;
     }
 
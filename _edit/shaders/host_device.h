@@ -24,12 +24,27 @@ using uint = unsigned int;
 START_BINDING(SceneBindings)
   eGlobals  = 0,  // Global uniform containing camera matrices
   eObjDescs = 1,  // Access to the object descriptions
-  eTextures = 2   // Access to textures
+  eTextures = 2,  // Access to textures
+  eLights   = 3,  // The emissive triangles
+  eLightBvh = 4,  // The nodes of the light BVH over them
+  eTextureFeedback = 5  // Which textures the shaders sampled, see TextureStreamer
+END_BINDING();
+
+START_BINDING(PostBindings)
+  ePostInput    = 0,  // The image to display: the accumulated color, or the denoiser's output
+  ePostOutput   = 1,  // Tonemapped, copied to the swap chain image
+  ePostExposure = 2   // ExposureState
 END_BINDING();
 
 START_BINDING(RtxBindings)
-  eTlas     = 0,  // Top-level acceleration structure
-  eOutImage = 1   // Ray tracer output image
+  eTlas             = 0,  // Top-level acceleration structure
+  eOutImage         = 1,  // Ray tracer output image
+  eAlbedoImage      = 2,  // Albedo of the first hits, for the denoiser
+  eNormalDepthImage = 3,  // Normal and distance of the first hits, for the denoiser
+  eHistoryColor     = 4,  // Copies of the three images above from the previous frame,
+  eHistoryAlbedo    = 5,  // for reprojecting them when the camera moves
+  eHistoryNormalDepth = 6,
+  eRayStats         = 7   // Counters of the instrumentation build, see RayStats
 END_BINDING();
 // clang-format on
 
@@ -38,10 +53,70 @@ END_BINDING();
 struct ObjDesc
 {
   int      txtOffset;             // Texture index offset in the array of textures
-  uint64_t vertexAddress;         // Address of the Vertex buffer
-  uint64_t indexAddress;          // Address of the index buffer
-  uint64_t materialAddress;       // Address of the material buffer
-  uint64_t materialIndexAddress;  // Address of the triangle material index buffer
+  uint64_t geometryAddress;         // Address of the model's range of the geometry arena
+  uint     vertexOffset;            // Offsets of the arrays in it: of the Vertex array
+  uint     indexOffset;             // Of the indices
+  uint     materialOffset;          // Of the materials
+  uint     materialIndexOffset;     // Of the material index of each triangle
+  uint     lightIndexOffset;        // Of the light index of each triangle, ~0 for triangles that don't emit
+  uint     compressedVertexOffset;  // Of the CompressedVertex array, ~0u if the model has none
+  uint     opacityOffset;           // Of the opacity state of each triangle, ~0u if the model is opaque
+  vec3     posMin;                  // Position of the quantized vertices: posMin + q * posStep
+  vec3     posStep;
+};
+
+// An emissive triangle of an instance, in world space. The lights buffer is a
+// LightsHeader followed by all of them, in the order they were loaded in.
+// See LightBvh, which keeps them up to date with the instance transforms.
+struct EmissiveTriangle
+{
+  vec3 v0;
+  uint bvhTrail;  // Bit d is set if the leaf of the triangle is the right child at depth d
+  vec3 v1;
+  vec3 v2;
+  vec3 emission;
+};
+
+struct LightsHeader
+{
+  uint count;     // Number of emissive triangles
+  uint numNodes;  // Number of nodes of the light BVH; node 0 is the root
+};
+
+// Set in LightBvhNode::children of leaves, with the index of their triangle
+#define LIGHT_BVH_LEAF 0x80000000u
+
+// Ray types: the offset of their hit record in each set of the SBT (the
+// sbtRecordOffset of traceRayEXT, with sbtRecordStride NUM_RAY_TYPES), and
+// their miss shader
+#define RAY_TYPE_RADIANCE 0
+#define RAY_TYPE_SHADOW 1
+#define NUM_RAY_TYPES 2
+
+// Bits of the TLAS instance masks, and of the cull masks of the rays that
+// see them; see SceneGraph, which ANDs the masks of a node's ancestors
+#define INSTANCE_MASK_CAMERA 0x01u     // Rays from the camera, and the rasterizer
+#define INSTANCE_MASK_SECONDARY 0x02u  // Bounces
+#define INSTANCE_MASK_SHADOW 0x04u     // Shadow rays
+
+// Opacity states of the triangles of models that aren't opaque, 2 bits each
+// and 16 to a uint, as those of VK_EXT_opacity_micromap at subdivision level
+// 0; see opacity.hpp. The any-hit shader decides unknown triangles itself,
+// from the alpha of their diffuse texture against the cutoff, and their
+// material's dissolve.
+#define OPACITY_TRANSPARENT 0u
+#define OPACITY_OPAQUE 1u
+#define OPACITY_UNKNOWN 2u
+#define OPACITY_ALPHA_CUTOFF 0.5
+
+// A node of the light BVH. Inner nodes have their two children next to each
+// other, at `children` and `children + 1`; leaves are a single triangle.
+struct LightBvhNode
+{
+  vec3  boundsMin;
+  float power;     // Sum of the luminance of the emission times the area of the triangles in the node
+  vec3  boundsMax;
+  uint  children;  // First child, or LIGHT_BVH_LEAF | the index of the triangle
 };
 
 // Uniform buffer set at each frame
@@ -50,6 +125,50 @@ struct GlobalUniforms
   mat4 viewProj;     // Camera view * projection
   mat4 viewInverse;  // Camera inverse view matrix
   mat4 projInverse;  // Camera inverse projection matrix
+  mat4 prevView;     // Camera view matrix of the previous frame
+  int  reprojectHistory;       // Whether the camera moved, and the history images hold the last frame
+  int  maxReprojectedSamples;  // Samples a pixel keeps of the history it's reprojected from
+  int  samplesPerFrame;        // Paths the ray tracer traces per pixel this frame
+};
+
+// What the ray tracer traced in a frame, counted by the instrumentation build (the CMake option
+// PATH_TRACER_RAY_STATS, which compiles the shaders with RAY_STATS); neither the counters nor the
+// binding exist otherwise.
+#define RAY_STATS_MAX_SEGMENTS 8  // The ray generation shader's limit on the segments of a path
+struct RayStats
+{
+  uint primaryRays;           // Camera rays
+  uint secondaryRays;         // Bounces
+  uint shadowRays;            // Visibility tests of the point light and of next-event estimation
+  uint rouletteTerminations;  // Paths Russian roulette ended
+  uint pathSegments[RAY_STATS_MAX_SEGMENTS];  // Number of paths with 1, 2, ... segments
+};
+
+// Auto-exposure, see post.comp.glsl and exposure.comp.glsl: the post pass
+// adds the log luminance of each pixel to the histogram, and exposes the image
+// with the exposure of the last frame; the exposure pass then moves the
+// exposure towards the one that maps the average luminance of the histogram
+// to EXPOSURE_KEY, and clears the histogram for the next frame.
+// Bin 0 counts the pixels too dark to have a log luminance, and bins 1 and up
+// EXPOSURE_LOG_LUMINANCE_RANGE stops from EXPOSURE_MIN_LOG_LUMINANCE.
+#define POST_WORKGROUP_SIZE 16  // local_size_x and _y of post.comp.glsl
+#define EXPOSURE_HISTOGRAM_BINS 64  // Also the local_size_x of exposure.comp.glsl
+#define EXPOSURE_MIN_LOG_LUMINANCE -10.0
+#define EXPOSURE_LOG_LUMINANCE_RANGE 22.0
+#define EXPOSURE_KEY 0.18  // Middle gray
+struct ExposureState
+{
+  float exposure;          // Scale of the color, before the exposure compensation
+  float averageLuminance;  // Of the last frame
+  uint  histogram[EXPOSURE_HISTOGRAM_BINS];
+};
+
+// Push constant structure for the post and exposure passes
+struct PushConstantPost
+{
+  float exposureCompensation;  // In stops, on top of the auto-exposure
+  int   autoExposure;          // Whether to use ExposureState::exposure, or 1
+  float adaptation;            // Fraction of the way to the target exposure it moves each frame
 };
 
 // Push constant structure for the raster
@@ -72,7 +191,7 @@ struct PushConstantRay
   vec3  lightPosition;
   float lightIntensity;
   int   lightType;
-  float time;  // Current time for random number generation
+  float time;  // Current time
   int frame;
   vec3 cameraPosition;
 };
@@ -85,6 +204,15 @@ struct Vertex  // See ObjLoader, copy of VertexObj, could be compressed for devi
   vec2 texCoord;
 };
 
+// The attributes of a Vertex the closest hit shader reads, in 16 bytes: see vertex_compression.hpp
+struct CompressedVertex
+{
+  uint posLo;     // Bits 0-20: x; bits 21-31: the low 11 bits of y
+  uint posHi;     // Bits 0-9: the high 10 bits of y; bits 10-30: z
+  uint normal;    // Octahedral encoding, as packSnorm2x16
+  uint texCoord;  // As packHalf2x16
+};
+
 struct WaveFrontMaterial  // See ObjLoader, copy of MaterialObj, could be compressed for device
 {
   vec3  ambient;
@@ -99,5 +227,14 @@ struct WaveFrontMaterial  // See ObjLoader, copy of MaterialObj, could be compre
   int   textureId;
 };
 
+// Inline data of the hit records of a model in the SBT, see ShaderBindingTable:
+// its materials, so that the closest-hit shader doesn't fetch them
+#define SBT_INLINE_MATERIALS 8
+struct HitRecord
+{
+  uint              numMaterials;  // Inlined below; 0 if the model has more, which are only in its materials buffer
+  WaveFrontMaterial materials[SBT_INLINE_MATERIALS];
+};
+
 
 #endif
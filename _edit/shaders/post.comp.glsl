@@ -0,0 +1,113 @@
+#version 460
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_ballot : require
+// The post pass, in one dispatch: a bilateral filter of the displayed image,
+// exposure, tonemapping, and the luminance histogram the next frame's
+// exposure comes from. Writes the display-ready image that's copied to the
+// swap chain.
+
+#include "host_device.h"
+
+layout(local_size_x = POST_WORKGROUP_SIZE, local_size_y = POST_WORKGROUP_SIZE) in;
+
+layout(set = 0, binding = ePostInput, rgba32f) uniform readonly image2D inputImage;
+layout(set = 0, binding = ePostOutput, rgba8) uniform writeonly image2D outputImage;
+layout(set = 0, binding = ePostExposure, std430) buffer Exposure_ {
+    ExposureState exposureState;
+};
+
+layout(push_constant) uniform _PushConstantPost {
+    PushConstantPost pcPost;
+};
+
+// Parameters for bilateral filter
+#define KERNEL_RADIUS 2 // Defines the size of the pixel window (KERNEL_RADIUS*2+1)^2
+#define SPATIAL_SIGMA 3.0 // Controls spatial influence (larger blurs more)
+#define RANGE_SIGMA 0.1   // Controls color similarity influence (smaller is more sensitive to color differences)
+
+// The histogram of the workgroup, added to the one of the frame at the end
+shared uint s_histogram[EXPOSURE_HISTOGRAM_BINS];
+
+// Gaussian function
+float gaussian(float x, float sigma) {
+    return exp(-(x * x) / (2.0 * sigma * sigma));
+}
+
+float luminance(vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+vec3 bilateralFilter(ivec2 pixel, ivec2 size) {
+    const vec3 centerColor = imageLoad(inputImage, pixel).rgb;
+    const float lumaCenter = dot(centerColor, vec3(0.299, 0.587, 0.114));
+    vec3 filteredColor = vec3(0.0);
+    float totalWeight = 0.0;
+    for (int x = -KERNEL_RADIUS; x <= KERNEL_RADIUS; ++x) {
+        for (int y = -KERNEL_RADIUS; y <= KERNEL_RADIUS; ++y) {
+            // Clamped to the edge, as the sampler of the fragment shader this replaced
+            const vec3 neighborColor = imageLoad(inputImage, clamp(pixel + ivec2(x, y), ivec2(0), size - 1)).rgb;
+            const float weightSpatial = gaussian(length(vec2(x, y)), SPATIAL_SIGMA);
+            const float lumaNeighbor = dot(neighborColor, vec3(0.299, 0.587, 0.114));
+            const float weightRange = gaussian(abs(lumaCenter - lumaNeighbor), RANGE_SIGMA);
+            const float weight = weightSpatial * weightRange;
+            filteredColor += neighborColor * weight;
+            totalWeight += weight;
+        }
+    }
+    return totalWeight > 0.0 ? filteredColor / totalWeight : centerColor;
+}
+
+// ACES filmic curve, fitted by Narkowicz 2015
+vec3 tonemap(vec3 x) {
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+uint histogramBin(float lum) {
+    if (lum < exp2(EXPOSURE_MIN_LOG_LUMINANCE)) {
+        return 0u;
+    }
+    const float t = (log2(lum) - EXPOSURE_MIN_LOG_LUMINANCE) / EXPOSURE_LOG_LUMINANCE_RANGE;
+    return 1u + uint(clamp(t, 0.0, 1.0) * float(EXPOSURE_HISTOGRAM_BINS - 2));
+}
+
+void main() {
+    if (gl_LocalInvocationIndex < EXPOSURE_HISTOGRAM_BINS) {
+        s_histogram[gl_LocalInvocationIndex] = 0u;
+    }
+    barrier();
+
+    const ivec2 size = imageSize(inputImage);
+    const ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (all(lessThan(pixel, size))) {
+        const vec3 color = bilateralFilter(pixel, size);
+
+        // With the exposure the last frame's histogram gave
+        const float exposure = (pcPost.autoExposure != 0 ? exposureState.exposure : 1.0) * exp2(pcPost.exposureCompensation);
+        const vec3 mapped = tonemap(color * exposure);
+        const float gamma = 1.0 / 2.2;
+        imageStore(outputImage, pixel, vec4(pow(mapped, vec3(gamma)), 1.0));
+
+        // Neighboring pixels mostly fall into the same few bins: each round,
+        // the invocations of the subgroup with the first one's bin add their
+        // count with one shared atomic, and drop out
+        const uint bin = histogramBin(luminance(color));
+        for (;;) {
+            if (bin == subgroupBroadcastFirst(bin)) {
+                const uint count = subgroupBallotBitCount(subgroupBallot(true));
+                if (subgroupElect()) {
+                    atomicAdd(s_histogram[bin], count);
+                }
+                break;
+            }
+        }
+    }
+
+    barrier();
+    if (gl_LocalInvocationIndex < EXPOSURE_HISTOGRAM_BINS) {
+        const uint count = s_histogram[gl_LocalInvocationIndex];
+        if (count > 0u) {
+            atomicAdd(exposureState.histogram[gl_LocalInvocationIndex], count);
+        }
+    }
+}
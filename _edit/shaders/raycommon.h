@@ -1,3 +1,5 @@
+#include "sampler.h"
+
 struct hitPayload
 {
   vec3 hitValue;      // Accumulated color
@@ -6,4 +8,14 @@ struct hitPayload
   vec3 throughput;    // Current path throughput
   int depth;          // Current path depth
   bool done;          // Whether path should terminate
+  Sampler sampler;    // Draws the random numbers of the path
+  float bsdfPdf;      // Solid-angle density the ray was sampled with; 0 for camera rays
+  vec3 bsdfNormal;    // Shading normal at the origin of the ray, which light sampling used there
+  vec3 aovAlbedo;     // Albedo, shading normal and distance of the first hit, for the denoiser
+  vec3 aovNormal;
+  float aovDepth;
+#ifdef RAY_STATS
+  uint shadowRays;           // Traced by the closest hit shader for this path
+  bool rouletteTerminated;
+#endif
 };
@@ -0,0 +1,110 @@
+#version 460
+#extension GL_EXT_ray_tracing : require
+#extension GL_EXT_nonuniform_qualifier : enable
+#extension GL_EXT_scalar_block_layout : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+#extension GL_EXT_buffer_reference2 : require
+
+// Alpha test of the triangles of models that aren't opaque, for radiance and
+// shadow rays alike; opaque models are built with VK_GEOMETRY_OPAQUE_BIT_KHR
+// and never get here. Most triangles are decided by their opacity state, see
+// opacity.hpp; only the unknown ones fetch their texture coordinates.
+
+#include "host_device.h"
+#include "sampler.h"
+#include "wavefront.h"
+
+hitAttributeEXT vec2 attribs;
+
+layout(buffer_reference, scalar) buffer Vertices {
+    Vertex v[];
+};
+layout(buffer_reference, scalar) buffer CompressedVertices {
+    CompressedVertex v[];
+};
+layout(buffer_reference, scalar) buffer Indices {
+    ivec3 i[];
+};
+layout(buffer_reference, scalar) buffer Materials {
+    WaveFrontMaterial m[];
+};
+layout(buffer_reference, scalar) buffer MatIndices {
+    int i[];
+};
+layout(buffer_reference, scalar) buffer OpacityStates {
+    uint s[];
+}; // 16 triangles per uint, OPACITY_* of host_device.h
+layout(shaderRecordEXT, scalar) buffer ShaderRecord_ {
+    HitRecord data;
+} shaderRecord; // Of the instance's model, see ShaderBindingTable
+layout(set = 1, binding = eObjDescs, scalar) buffer ObjDesc_ {
+    ObjDesc i[];
+} objDesc;
+layout(set = 1, binding = eTextures) uniform sampler2D textureSamplers[];
+layout(set = 1, binding = eTextureFeedback) buffer TextureFeedback_ {
+    uint used[];
+} textureFeedback; // Marks the textures sampled, for the texture streamer
+
+layout(push_constant) uniform _PushConstantRay {
+    PushConstantRay pcRay;
+};
+
+void main() {
+    ObjDesc objResource = objDesc.i[gl_InstanceCustomIndexEXT];
+    const uint state = (OpacityStates(objResource.geometryAddress + objResource.opacityOffset).s[gl_PrimitiveID / 16]
+                        >> (2 * (gl_PrimitiveID % 16))) & 3u;
+    if (state == OPACITY_OPAQUE) {
+        return;
+    }
+    if (state == OPACITY_TRANSPARENT) {
+        ignoreIntersectionEXT;
+    }
+
+    const uint        numInline = shaderRecord.data.numMaterials;
+    const int         matIdx    = numInline == 1 ? 0 :
+        MatIndices(objResource.geometryAddress + objResource.materialIndexOffset).i[gl_PrimitiveID];
+    WaveFrontMaterial mat;
+    if (numInline != 0) {
+        mat = shaderRecord.data.materials[matIdx];
+    } else {
+        mat = Materials(objResource.geometryAddress + objResource.materialOffset).m[matIdx];
+    }
+
+    // Stochastic transparency: the triangle is hit with probability `dissolve`, with a draw of its
+    // own for each ray, pixel and frame
+    if (mat.dissolve < 1.0) {
+        const uint seed = pcgHash(gl_LaunchIDEXT.x ^ pcgHash(gl_LaunchIDEXT.y ^ pcgHash(uint(pcRay.frame))));
+        const uint hit  = pcgHash(seed ^ pcgHash(uint(gl_PrimitiveID) ^ pcgHash(uint(gl_InstanceID)))
+                                  ^ floatBitsToUint(gl_HitTEXT));
+        if (toUnitFloat(pcgHash(hit)) >= mat.dissolve) {
+            ignoreIntersectionEXT;
+        }
+    }
+
+    if (mat.textureId >= 0) {
+        ivec3 ind = Indices(objResource.geometryAddress + objResource.indexOffset).i[gl_PrimitiveID];
+        vec2 t0, t1, t2;
+        if (objResource.compressedVertexOffset != ~0u) {
+            CompressedVertices vertices = CompressedVertices(objResource.geometryAddress + objResource.compressedVertexOffset);
+            t0 = decompressTexCoord(vertices.v[ind.x]);
+            t1 = decompressTexCoord(vertices.v[ind.y]);
+            t2 = decompressTexCoord(vertices.v[ind.z]);
+        } else {
+            Vertices vertices = Vertices(objResource.geometryAddress + objResource.vertexOffset);
+            t0 = vertices.v[ind.x].texCoord;
+            t1 = vertices.v[ind.y].texCoord;
+            t2 = vertices.v[ind.z].texCoord;
+        }
+        const vec3 barycentrics = vec3(1.0 - attribs.x - attribs.y, attribs.x, attribs.y);
+        const vec2 texCoord     = t0 * barycentrics.x + t1 * barycentrics.y + t2 * barycentrics.z;
+
+        // Level 0, which the opacity states were classified on
+        uint txtId = mat.textureId + objResource.txtOffset;
+        textureFeedback.used[txtId] = 1u;
+        if (textureLod(textureSamplers[nonuniformEXT(txtId)], texCoord, 0.0).a < OPACITY_ALPHA_CUTOFF) {
+            ignoreIntersectionEXT;
+        }
+    }
+}
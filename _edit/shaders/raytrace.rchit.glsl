@@ -19,6 +19,9 @@ layout(location = 1) rayPayloadEXT bool isShadowed;
 layout(buffer_reference, scalar) buffer Vertices {
     Vertex v[];
 }; // Positions of an object
+layout(buffer_reference, scalar) buffer CompressedVertices {
+    CompressedVertex v[];
+}; // Attributes of the vertices for shading, of models that don't deform
 layout(buffer_reference, scalar) buffer Indices {
     ivec3 i[];
 }; // Triangle indices
@@ -28,22 +31,112 @@ layout(buffer_reference, scalar) buffer Materials {
 layout(buffer_reference, scalar) buffer MatIndices {
     int i[];
 }; // Material ID for each triangle
+layout(buffer_reference, scalar) buffer LightIndices {
+    uint i[];
+}; // Index in the lights of each triangle, ~0 if it doesn't emit
+layout(shaderRecordEXT, scalar) buffer ShaderRecord_ {
+    HitRecord data;
+} shaderRecord; // Of the instance's model, see ShaderBindingTable
 layout(set = 0, binding = eTlas) uniform accelerationStructureEXT topLevelAS;
 layout(set = 1, binding = eObjDescs, scalar) buffer ObjDesc_ {
     ObjDesc i[];
 } objDesc;
 layout(set = 1, binding = eTextures) uniform sampler2D textureSamplers[];
+layout(set = 1, binding = eTextureFeedback) buffer TextureFeedback_ {
+    uint used[];
+} textureFeedback; // Marks the textures sampled, for the texture streamer
+layout(set = 1, binding = eLights, scalar) readonly buffer Lights_ {
+    LightsHeader header;
+    EmissiveTriangle t[];
+} lights;
+layout(set = 1, binding = eLightBvh, scalar) readonly buffer LightBvh_ {
+    LightBvhNode n[];  // See LightBvh
+} lightBvh;
 
 layout(push_constant) uniform _PushConstantRay {
     PushConstantRay pcRay;
 };
 
-// Random number generation with time-based seed
-float random(vec2 co, float time) {
-    return fract(sin(dot(co.xy + time, vec2(12.9898,78.233))) * 43758.5453);
+const float k_pi = 3.14159265359;
+
+// Power heuristic: the weight of a sample drawn with `pdf` that could also
+// have been drawn with `otherPdf`
+float misWeight(float pdf, float otherPdf) {
+    return (pdf * pdf) / (pdf * pdf + otherPdf * otherPdf);
+}
+
+// How much light a node of the light BVH may send to point `pos` with normal
+// `nrm`: its power over the squared distance to its center, clamped to the
+// size of its box for points near or inside it, and none if the box is
+// entirely behind the surface
+float lightBvhImportance(LightBvhNode node, vec3 pos, vec3 nrm) {
+    const vec3 center = 0.5 * (node.boundsMin + node.boundsMax);
+    const vec3 halfExtent = 0.5 * (node.boundsMax - node.boundsMin);
+    if (dot(center - pos, nrm) + dot(halfExtent, abs(nrm)) <= 0.0) {
+        return 0.0;
+    }
+    const vec3 toCenter = center - pos;
+    return node.power / max(dot(toCenter, toCenter), dot(halfExtent, halfExtent));
+}
+
+// Probability of going to the left child of inner node `node`
+float lightBvhLeftProbability(LightBvhNode node, vec3 pos, vec3 nrm) {
+    const float left = lightBvhImportance(lightBvh.n[node.children], pos, nrm);
+    const float right = lightBvhImportance(lightBvh.n[node.children + 1], pos, nrm);
+    return left + right > 0.0 ? left / (left + right) : -1.0;
+}
+
+// Picks an emissive triangle for lighting `pos` by going down the light BVH
+// from the root, into either child by its importance, reusing `u` for each
+// step. Returns the index of the triangle, or ~0u if no light can reach
+// `pos`, and the probability it was picked with in `pmf`.
+uint sampleLightBvh(vec3 pos, vec3 nrm, float u, out float pmf) {
+    pmf = 1.0;
+    LightBvhNode node = lightBvh.n[0];
+    for (uint depth = 0; depth < 32 && (node.children & LIGHT_BVH_LEAF) == 0; depth++) {
+        const float pLeft = lightBvhLeftProbability(node, pos, nrm);
+        if (pLeft < 0.0) {
+            return ~0u;
+        }
+        if (u < pLeft) {
+            u = u / pLeft;
+            pmf *= pLeft;
+            node = lightBvh.n[node.children];
+        } else {
+            u = min((u - pLeft) / (1.0 - pLeft), 0.99999994);
+            pmf *= 1.0 - pLeft;
+            node = lightBvh.n[node.children + 1];
+        }
+    }
+    return (node.children & LIGHT_BVH_LEAF) != 0 ? node.children & ~LIGHT_BVH_LEAF : ~0u;
+}
+
+// Probability with which sampleLightBvh picks the triangle with `trail` (see
+// EmissiveTriangle::bvhTrail) for lighting `pos`, going down the same path
+float lightBvhPmf(vec3 pos, vec3 nrm, uint trail) {
+    float pmf = 1.0;
+    LightBvhNode node = lightBvh.n[0];
+    for (uint depth = 0; depth < 32 && (node.children & LIGHT_BVH_LEAF) == 0; depth++) {
+        const float pLeft = lightBvhLeftProbability(node, pos, nrm);
+        if (pLeft < 0.0) {
+            return 0.0;
+        }
+        const bool right = ((trail >> depth) & 1u) != 0;
+        pmf *= right ? 1.0 - pLeft : pLeft;
+        node = lightBvh.n[right ? node.children + 1 : node.children];
+    }
+    return pmf;
+}
+
+// Solid-angle density with which light sampling picks a point of an emissive
+// triangle of area `area` at distance `dist`, seen under `cosLight`, after
+// picking the triangle with probability `pmf`
+float lightPdf(float pmf, float area, float dist, float cosLight) {
+    return pmf / area * dist * dist / max(cosLight, 1e-6);
 }
 
-vec3 randomDirection(vec3 normal, vec2 rand, float time) {
+// Cosine-weighted direction around `normal`, with density dot(normal, direction) / pi
+vec3 randomDirection(vec3 normal, vec2 rand) {
     float theta = 2.0 * 3.14159265359 * rand.x;
     float phi = acos(sqrt(rand.y));
     float sinPhi = sin(phi);
@@ -59,52 +152,120 @@ vec3 randomDirection(vec3 normal, vec2 rand, float time) {
 void main() {
     // Object data
     ObjDesc    objResource = objDesc.i[gl_InstanceCustomIndexEXT];
-    MatIndices matIndices  = MatIndices(objResource.materialIndexAddress);
-    Materials  materials   = Materials(objResource.materialAddress);
-    Indices    indices     = Indices(objResource.indexAddress);
-    Vertices   vertices    = Vertices(objResource.vertexAddress);
+    MatIndices matIndices  = MatIndices(objResource.geometryAddress + objResource.materialIndexOffset);
+    Materials  materials   = Materials(objResource.geometryAddress + objResource.materialOffset);
+    Indices    indices     = Indices(objResource.geometryAddress + objResource.indexOffset);
 
     // Indices of the triangle
     ivec3 ind = indices.i[gl_PrimitiveID];
 
-    // Vertex of the triangle
-    Vertex v0 = vertices.v[ind.x];
-    Vertex v1 = vertices.v[ind.y];
-    Vertex v2 = vertices.v[ind.z];
+    // Attributes of the vertices of the triangle: 16 bytes each from the compressed buffer if
+    // the model has one, otherwise the full Vertex
+    vec3 p0, p1, p2;
+    vec3 n0, n1, n2;
+    vec2 t0, t1, t2;
+    if (objResource.compressedVertexOffset != ~0u) {
+        CompressedVertices vertices = CompressedVertices(objResource.geometryAddress + objResource.compressedVertexOffset);
+        const CompressedVertex c0 = vertices.v[ind.x];
+        const CompressedVertex c1 = vertices.v[ind.y];
+        const CompressedVertex c2 = vertices.v[ind.z];
+        p0 = decompressPosition(c0, objResource.posMin, objResource.posStep);
+        p1 = decompressPosition(c1, objResource.posMin, objResource.posStep);
+        p2 = decompressPosition(c2, objResource.posMin, objResource.posStep);
+        n0 = decompressNormal(c0);
+        n1 = decompressNormal(c1);
+        n2 = decompressNormal(c2);
+        t0 = decompressTexCoord(c0);
+        t1 = decompressTexCoord(c1);
+        t2 = decompressTexCoord(c2);
+    } else {
+        Vertices vertices = Vertices(objResource.geometryAddress + objResource.vertexOffset);
+        const Vertex v0 = vertices.v[ind.x];
+        const Vertex v1 = vertices.v[ind.y];
+        const Vertex v2 = vertices.v[ind.z];
+        p0 = v0.pos;
+        p1 = v1.pos;
+        p2 = v2.pos;
+        n0 = v0.nrm;
+        n1 = v1.nrm;
+        n2 = v2.nrm;
+        t0 = v0.texCoord;
+        t1 = v1.texCoord;
+        t2 = v2.texCoord;
+    }
 
     const vec3 barycentrics = vec3(1.0 - attribs.x - attribs.y, attribs.x, attribs.y);
 
     // Computing the coordinates of the hit position
-    const vec3 pos      = v0.pos * barycentrics.x + v1.pos * barycentrics.y + v2.pos * barycentrics.z;
+    const vec3 pos      = p0 * barycentrics.x + p1 * barycentrics.y + p2 * barycentrics.z;
     const vec3 worldPos = vec3(gl_ObjectToWorldEXT * vec4(pos, 1.0));
 
     // Computing the normal at hit position
-    const vec3 nrm      = v0.nrm * barycentrics.x + v1.nrm * barycentrics.y + v2.nrm * barycentrics.z;
+    const vec3 nrm      = n0 * barycentrics.x + n1 * barycentrics.y + n2 * barycentrics.z;
     const vec3 worldNrm = normalize(vec3(nrm * gl_WorldToObjectEXT));
+    // Facing the incoming ray, so that both sides of a surface are lit
+    const vec3 shadingNrm = faceforward(worldNrm, prd.rayDir, worldNrm);
 
-    // Material of the object
-    int               matIdx = matIndices.i[gl_PrimitiveID];
-    WaveFrontMaterial mat    = materials.m[matIdx];
+    // Material of the object, from the hit record if the model's materials fit in it; models with a
+    // single material don't need the material index of the triangle either
+    const uint        numInline = shaderRecord.data.numMaterials;
+    int               matIdx    = numInline == 1 ? 0 : matIndices.i[gl_PrimitiveID];
+    WaveFrontMaterial mat;
+    if (numInline != 0) {
+        mat = shaderRecord.data.materials[matIdx];
+    } else {
+        mat = materials.m[matIdx];
+    }
 
     // Get material color
     vec3 albedo = mat.diffuse;
     if(mat.textureId >= 0) {
         uint txtId    = mat.textureId + objDesc.i[gl_InstanceCustomIndexEXT].txtOffset;
-        vec2 texCoord = v0.texCoord * barycentrics.x + v1.texCoord * barycentrics.y + v2.texCoord * barycentrics.z;
+        vec2 texCoord = t0 * barycentrics.x + t1 * barycentrics.y + t2 * barycentrics.z;
         albedo *= texture(textureSamplers[nonuniformEXT(txtId)], texCoord).xyz;
+        textureFeedback.used[txtId] = 1u;
+    }
+
+    // Guides of the denoiser
+    if (prd.depth == 0) {
+        prd.aovAlbedo = albedo;
+        prd.aovNormal = shadingNrm;
+        prd.aovDepth = gl_HitTEXT;
+    }
+
+    // Emission found by the BSDF sample of the previous bounce, weighted
+    // against light sampling, which could have found it too. Emitters are
+    // two-sided, like for light sampling. The camera sees emission directly.
+    if (mat.emission != vec3(0)) {
+        float weight = 1.0;
+        const uint lightIndex = LightIndices(objResource.geometryAddress + objResource.lightIndexOffset).i[gl_PrimitiveID];
+        if (prd.bsdfPdf > 0.0 && lightIndex != ~0u) {
+            // Light sampling ran at the origin of this ray
+            const EmissiveTriangle light = lights.t[lightIndex];
+            const vec3 lightCross = cross(light.v1 - light.v0, light.v2 - light.v0);
+            const float pmf = lightBvhPmf(prd.rayOrigin, prd.bsdfNormal, light.bvhTrail);
+            const float cosLight = abs(dot(normalize(lightCross), prd.rayDir));
+            if (pmf > 0.0) {
+                weight = misWeight(prd.bsdfPdf, lightPdf(pmf, 0.5 * length(lightCross), gl_HitTEXT, cosLight));
+            }
+        }
+        prd.hitValue += prd.throughput * mat.emission * weight;
     }
 
     // Russian roulette for path termination
     float p = max(albedo.x, max(albedo.y, albedo.z));
     if (prd.depth > 3) {
-        if (random(vec2(gl_LaunchIDEXT.xy) + vec2(prd.depth), pcRay.time) > p) {
+        if (sample1D(prd.sampler) > p) {
             prd.done = true;
+#ifdef RAY_STATS
+            prd.rouletteTerminated = true;
+#endif
             return;
         }
         prd.throughput /= p;
     }
 
-    // Direct lighting contribution
+    // Direct lighting contribution of the point light
     vec3 L = normalize(pcRay.lightPosition - worldPos);
     float lightDistance = length(pcRay.lightPosition - worldPos);
     float lightIntensity = pcRay.lightIntensity / (lightDistance * lightDistance);
@@ -114,18 +275,57 @@ void main() {
     float tMax = lightDistance;
     vec3 origin = worldPos;
     vec3 rayDir = L;
-    uint flags = gl_RayFlagsTerminateOnFirstHitEXT | gl_RayFlagsOpaqueEXT | gl_RayFlagsSkipClosestHitShaderEXT;
+    // Not opaque: the any-hit shader lets shadow rays through the cut-outs of alpha-tested models
+    uint flags = gl_RayFlagsTerminateOnFirstHitEXT | gl_RayFlagsSkipClosestHitShaderEXT;
     isShadowed = true;
-    traceRayEXT(topLevelAS, flags, 0xFF, 0, 0, 1, origin, tMin, rayDir, tMax, 1);
-    float shadowCoeff = isShadowed ? 0.3f : 1.0f;
+    traceRayEXT(topLevelAS, flags, INSTANCE_MASK_SHADOW, RAY_TYPE_SHADOW, NUM_RAY_TYPES, RAY_TYPE_SHADOW, origin, tMin, rayDir, tMax, 1);
+#ifdef RAY_STATS
+    prd.shadowRays++;
+#endif
     // Add direct lighting contribution if light is visible
-    vec3 viewDir = worldPos - pcRay.cameraPosition;
-    prd.hitValue += computeSpecular(mat, viewDir, L, worldNrm) * shadowCoeff * lightIntensity;
+    if (!isShadowed) {
+        prd.hitValue += prd.throughput * computeSpecular(mat, prd.rayDir, L, shadingNrm) * lightIntensity;
+    }
+
+    // Next-event estimation: pick an emissive triangle by walking the light
+    // BVH, then a uniform point on it, and add its light if it's visible,
+    // weighted against the BSDF sample of the next bounce
+    if (lights.header.count > 0) {
+        float pmf;
+        const uint lightIndex = sampleLightBvh(worldPos, shadingNrm, sample1D(prd.sampler), pmf);
+        vec2 b = sample2D(prd.sampler);  // Drawn either way, for the next dimensions to stay the same
+        if (lightIndex != ~0u && pmf > 0.0) {
+            const EmissiveTriangle light = lights.t[lightIndex];
+            if (b.x + b.y > 1.0) {
+                b = vec2(1.0) - b;  // Folds the square onto the triangle
+            }
+            const vec3 lightPos = light.v0 * (1.0 - b.x - b.y) + light.v1 * b.x + light.v2 * b.y;
+            const vec3 lightCross = cross(light.v1 - light.v0, light.v2 - light.v0);
+            const float lightDist = length(lightPos - worldPos);
+            const vec3 toLight = (lightPos - worldPos) / lightDist;
+            const float cosSurface = dot(shadingNrm, toLight);
+            const float cosLight = abs(dot(normalize(lightCross), toLight));
+            if (cosSurface > 0.0 && cosLight > 0.0) {
+                isShadowed = true;
+                traceRayEXT(topLevelAS, flags, INSTANCE_MASK_SHADOW, RAY_TYPE_SHADOW, NUM_RAY_TYPES, RAY_TYPE_SHADOW,
+                            worldPos, tMin, toLight, lightDist * 0.999, 1);
+#ifdef RAY_STATS
+                prd.shadowRays++;
+#endif
+                if (!isShadowed) {
+                    const float pdf = lightPdf(pmf, 0.5 * length(lightCross), lightDist, cosLight);
+                    const vec3 brdf = albedo / k_pi;  // Lambertian, which the bounce below samples
+                    prd.hitValue += prd.throughput * brdf * light.emission * cosSurface / pdf * misWeight(pdf, cosSurface / k_pi);
+                }
+            }
+        }
+    }
 
     // Generate next ray direction using importance sampling
-    vec2 rand = vec2(random(vec2(gl_LaunchIDEXT.xy) + vec2(prd.depth), pcRay.time),
-        random(vec2(gl_LaunchIDEXT.xy) + vec2(prd.depth + 1), pcRay.time));
-    vec3 nextDir = randomDirection(worldNrm, rand, pcRay.time);
+    vec2 rand = sample2D(prd.sampler);
+    vec3 nextDir = randomDirection(shadingNrm, rand);
+    prd.bsdfPdf = max(dot(shadingNrm, nextDir), 0.0) / k_pi;
+    prd.bsdfNormal = shadingNrm;
 
     // Update path state
     prd.rayOrigin = worldPos;
@@ -11,87 +11,184 @@ layout(location = 0) rayPayloadEXT hitPayload prd;
 
 layout(set = 0, binding = eTlas) uniform accelerationStructureEXT topLevelAS;
 layout(set = 0, binding = eOutImage, rgba32f) uniform image2D image;
+layout(set = 0, binding = eAlbedoImage, rgba16f) uniform image2D albedoImage;
+layout(set = 0, binding = eNormalDepthImage, rgba16f) uniform image2D normalDepthImage;
+layout(set = 0, binding = eHistoryColor, rgba32f) uniform readonly image2D historyColorImage;
+layout(set = 0, binding = eHistoryAlbedo, rgba16f) uniform readonly image2D historyAlbedoImage;
+layout(set = 0, binding = eHistoryNormalDepth, rgba16f) uniform readonly image2D historyNormalDepthImage;
 layout(set = 1, binding = eGlobals) uniform _GlobalUniforms {
     GlobalUniforms uni;
 };
 layout(push_constant) uniform _PushConstantRay {
     PushConstantRay pcRay;
 };
+#ifdef RAY_STATS
+layout(set = 0, binding = eRayStats, std430) buffer RayStats_ {
+    RayStats rayStats;
+};
+#endif
 // clang-format on
 
-// Random number generation with time-based seed
-float random(vec2 co, float time) {
-    return fract(sin(dot(co.xy + time, vec2(12.9898, 78.233))) * 43758.5453);
-}
-
-// Generate a random point within a pixel
-vec2 randomPixelOffset(vec2 pixelCenter, float time) {
-    vec2 offset = vec2(random(pixelCenter + vec2(0.1), time),
-    random(pixelCenter + vec2(0.2), time));
-    return offset - vec2(0.5);// Center the offset around 0
-}
-
 void main() {
     const vec2 pixelCenter = vec2(gl_LaunchIDEXT.xy);
     const vec2 inUV = pixelCenter / vec2(gl_LaunchSizeEXT.xy);
 
-    // Number of samples per pixel per frame
+    // Sums of the samples of this frame
     vec3 finalColor = vec3(0.0);
-
-    // Add random offset to pixel center for anti-aliasing
-    // Use both frame count and sample index for better randomization
-    vec2 offset = randomPixelOffset(pixelCenter, pcRay.time + float(pcRay.frame) * 0.1);
-    vec2 d = (pixelCenter + offset) / vec2(gl_LaunchSizeEXT.xy) * 2.0 - 1.0;
-
-    // Orthographic projection
-    vec4 origin = uni.viewInverse * vec4(d.x*1.1f, d.y*1.1f, 0, 1);
-    vec4 direction = uni.viewInverse * vec4(0, 0, -1, 0); // Assuming camera looks down -Z
-
-    // Initialize path tracing state
-    prd.hitValue = vec3(0.0);
-    prd.rayOrigin = origin.xyz;
-    prd.rayDir = direction.xyz;
-    prd.throughput = vec3(1.0);
-    prd.depth = 0;
-    prd.done = false;
-
-    // Start path tracing loop
-    while (!prd.done && prd.depth < 8) {
-        // Maximum 8 bounces
-        uint rayFlags = gl_RayFlagsOpaqueEXT;
-        float tMin = 0.001;
-        float tMax = 10000.0;
-
-        traceRayEXT(topLevelAS, // acceleration structure
-        rayFlags, // rayFlags
-        0xFF, // cullMask
-        0, // sbtRecordOffset
-        0, // sbtRecordStride
-        0, // missIndex
-        prd.rayOrigin, // ray origin
-        tMin, // ray min range
-        prd.rayDir, // ray direction
-        tMax, // ray max range
-        0// payload (location = 0
-        );
-
-        // If ray hit nothing or path should terminate, break
-        if (prd.done) break;
+    vec3 albedoSum = vec3(0.0);
+    vec4 normalDepthSum = vec4(0.0);
+    // The first sample's ray and hit, which reprojection follows
+    vec4 origin;
+    vec4 direction;
+    float firstDepth = 0.0;
+    vec3 firstNormal = vec3(0.0);
+
+    // The frame controller picks how many samples fit in the frame; pcRay.frame is the index of
+    // the first one
+    const int samplesPerFrame = max(uni.samplesPerFrame, 1);
+#ifdef RAY_STATS
+    // Counted over all samples of the pixel, so that each invocation adds to the buffer only a few times
+    uint secondaryRays = 0;
+    uint shadowRays = 0;
+    uint rouletteTerminations = 0;
+    uint pathSegments[RAY_STATS_MAX_SEGMENTS];
+    for (int i = 0; i < RAY_STATS_MAX_SEGMENTS; i++) {
+        pathSegments[i] = 0;
     }
-
-    finalColor = prd.hitValue;
-
-    // Get the current accumulated color
-    vec4 currentColor = imageLoad(image, ivec2(gl_LaunchIDEXT.xy));
-
-    // If this is the first frame, initialize with the new color
-    if (pcRay.frame == 0) {
-        imageStore(image, ivec2(gl_LaunchIDEXT.xy), vec4(finalColor, 1.0));
-    } else {
-        // Accumulate the new color with the existing color
-        // Use exponential moving average for better temporal stability
-        float alpha = 1.0/pcRay.frame;// Adjust this value to control the accumulation rate (0.0 to 1.0)
-        vec3 accumulatedColor = mix(currentColor.rgb, finalColor, alpha);
-        imageStore(image, ivec2(gl_LaunchIDEXT.xy), vec4(accumulatedColor, 1.0));
+#endif
+    for (int s = 0; s < samplesPerFrame; s++) {
+        prd.sampler = initSampler(gl_LaunchIDEXT.xy, uint(pcRay.frame + s));
+
+        // Add random offset to pixel center for anti-aliasing
+        vec2 offset = sample2D(prd.sampler) - vec2(0.5); // Center the offset around 0
+        vec2 d = (pixelCenter + offset) / vec2(gl_LaunchSizeEXT.xy) * 2.0 - 1.0;
+
+        // Orthographic projection
+        const vec4 sampleOrigin = uni.viewInverse * vec4(d.x*1.1f, d.y*1.1f, 0, 1);
+        const vec4 sampleDirection = uni.viewInverse * vec4(0, 0, -1, 0); // Assuming camera looks down -Z
+
+        // Initialize path tracing state
+        prd.hitValue = vec3(0.0);
+        prd.rayOrigin = sampleOrigin.xyz;
+        prd.rayDir = sampleDirection.xyz;
+        prd.throughput = vec3(1.0);
+        prd.depth = 0;
+        prd.done = false;
+        prd.bsdfPdf = 0.0;
+        prd.bsdfNormal = vec3(0.0);
+        // What the denoiser sees of pixels of the sky
+        prd.aovAlbedo = vec3(1.0);
+        prd.aovNormal = vec3(0.0);
+        prd.aovDepth = 0.0;
+#ifdef RAY_STATS
+        prd.shadowRays = 0;
+        prd.rouletteTerminated = false;
+        uint segments = 0;
+#endif
+
+        // Start path tracing loop
+        while (!prd.done && prd.depth < 8) {
+            // Maximum 8 bounces
+            // The geometry flags decide opacity: only models that aren't opaque run the any-hit shader
+            uint rayFlags = gl_RayFlagsNoneEXT;
+            float tMin = 0.001;
+            float tMax = 10000.0;
+
+            traceRayEXT(topLevelAS, // acceleration structure
+            rayFlags, // rayFlags
+            prd.depth == 0 ? INSTANCE_MASK_CAMERA : INSTANCE_MASK_SECONDARY, // cullMask
+            RAY_TYPE_RADIANCE, // sbtRecordOffset
+            NUM_RAY_TYPES, // sbtRecordStride
+            RAY_TYPE_RADIANCE, // missIndex
+            prd.rayOrigin, // ray origin
+            tMin, // ray min range
+            prd.rayDir, // ray direction
+            tMax, // ray max range
+            0// payload (location = 0
+            );
+#ifdef RAY_STATS
+            segments++;
+#endif
+
+            // If ray hit nothing or path should terminate, break
+            if (prd.done) break;
+        }
+
+#ifdef RAY_STATS
+        secondaryRays += segments - 1;
+        shadowRays += prd.shadowRays;
+        rouletteTerminations += prd.rouletteTerminated ? 1u : 0u;
+        pathSegments[segments - 1]++;
+#endif
+
+        finalColor += prd.hitValue;
+        albedoSum += prd.aovAlbedo;
+        normalDepthSum += vec4(prd.aovNormal, prd.aovDepth);
+        if (s == 0) {
+            origin = sampleOrigin;
+            direction = sampleDirection;
+            firstDepth = prd.aovDepth;
+            firstNormal = prd.aovNormal;
+        }
     }
+    finalColor /= float(samplesPerFrame);
+#ifdef RAY_STATS
+    atomicAdd(rayStats.primaryRays, uint(samplesPerFrame));
+    atomicAdd(rayStats.secondaryRays, secondaryRays);
+    atomicAdd(rayStats.shadowRays, shadowRays);
+    atomicAdd(rayStats.rouletteTerminations, rouletteTerminations);
+    for (int i = 0; i < RAY_STATS_MAX_SEGMENTS; i++) {
+        if (pathSegments[i] > 0) {
+            atomicAdd(rayStats.pathSegments[i], pathSegments[i]);
+        }
+    }
+#endif
+
+    // What the pixel accumulated so far: in place if the camera stayed,
+    // otherwise from where its first hit was seen in the last frame
+    const ivec2 pixel = ivec2(gl_LaunchIDEXT.xy);
+    const vec4 normalDepth = normalDepthSum / float(samplesPerFrame);
+    vec4 history = imageLoad(image, pixel);  // The alpha is the number of samples
+    vec4 historyAlbedo = imageLoad(albedoImage, pixel);
+    vec4 historyNormalDepth = imageLoad(normalDepthImage, pixel);
+    if (uni.reprojectHistory != 0) {
+        history = vec4(0.0);
+        ivec2 prevPixel = pixel;  // Sky stays where it is
+        float prevDepth = 0.0;
+        if (firstDepth > 0.0) {
+            // The inverse of the orthographic camera above, with the last view
+            const vec3 hitPos = origin.xyz + direction.xyz * firstDepth;
+            const vec4 prevViewPos = uni.prevView * vec4(hitPos, 1.0);
+            const vec2 prevD = prevViewPos.xy / 1.1;
+            prevPixel = ivec2(floor((prevD * 0.5 + 0.5) * vec2(gl_LaunchSizeEXT.xy) + 0.5));
+            prevDepth = -prevViewPos.z;
+        }
+        if (all(greaterThanEqual(prevPixel, ivec2(0))) && all(lessThan(prevPixel, ivec2(gl_LaunchSizeEXT.xy)))) {
+            const vec4 prevNormalDepth = imageLoad(historyNormalDepthImage, prevPixel);
+            // Disocclusion: the last frame saw something else there, nearer or
+            // farther, or facing another way
+            bool sameSurface;
+            if (firstDepth > 0.0) {
+                const float prevNormalLength = length(prevNormalDepth.xyz);
+                sameSurface = prevNormalDepth.w > 0.0
+                              && abs(prevNormalDepth.w - prevDepth) < 0.02 * prevDepth + 0.01
+                              && prevNormalLength > 0.0 && dot(firstNormal, prevNormalDepth.xyz / prevNormalLength) > 0.9;
+            } else {
+                sameSurface = prevNormalDepth.w == 0.0;
+            }
+            if (sameSurface) {
+                history = imageLoad(historyColorImage, prevPixel);
+                history.a = min(history.a, float(uni.maxReprojectedSamples));
+                historyAlbedo = imageLoad(historyAlbedoImage, prevPixel);
+                historyNormalDepth = prevNormalDepth;
+            }
+        }
+    }
+
+    // Averaging the new samples in, and the guides of the denoiser like the color
+    const float samples = history.a + float(samplesPerFrame);
+    const float alpha = float(samplesPerFrame) / samples;
+    imageStore(image, pixel, vec4(mix(history.rgb, finalColor, alpha), samples));
+    imageStore(albedoImage, pixel, mix(historyAlbedo, vec4(albedoSum / float(samplesPerFrame), 1.0), alpha));
+    imageStore(normalDepthImage, pixel, mix(historyNormalDepth, normalDepth, alpha));
 }
@@ -0,0 +1,101 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Low-discrepancy sampler: Owen-scrambled Sobol points, indexed by pixel,
+// sample index and dimension (Burley 2020, "Practical Hash-based Owen
+// Scrambling").
+// Each sample2D() call draws the next two dimensions of a path from the first
+// two Sobol dimensions, which are well stratified together. The points of
+// each pair of dimensions are Owen-scrambled, and their order shuffled, with
+// seeds hashed from the pixel and the dimension; so a pixel's samples are a
+// (0,2) sequence in each pair of dimensions, but uncorrelated across pixels
+// and across pairs of dimensions.
+// Only uses integer math and no stage-specific built-ins, so any shader can
+// include it.
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+struct Sampler
+{
+  uint index;      // Sample index of the pixel, e.g. the frame number
+  uint seed;       // Hash of the pixel
+  uint dimension;  // Next dimension to draw
+};
+
+// PCG hash (Jarzynski and Olano 2020, "Hash Functions for GPU Rendering").
+uint pcgHash(uint v)
+{
+  const uint state = v * 747796405u + 2891336453u;
+  const uint word  = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+// Permutes the bits of x so that each bit only depends on the bits below it.
+uint laineKarrasPermutation(uint x, uint seed)
+{
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+// Owen-scrambles x, seen as a fixed-point number in [0, 1).
+uint nestedUniformScramble(uint x, uint seed)
+{
+  return bitfieldReverse(laineKarrasPermutation(bitfieldReverse(x), seed));
+}
+
+// The second Sobol dimension of point `index`; the first one is bitfieldReverse(index).
+uint sobolDimension1(uint index)
+{
+  uint result = 0;
+  for(uint v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+  {
+    if((index & 1u) != 0)
+    {
+      result ^= v;
+    }
+  }
+  return result;
+}
+
+// Converts a fixed-point number to a float in [0, 1).
+float toUnitFloat(uint x)
+{
+  return float(x >> 8) * 5.96046448e-8;  // 2^-24
+}
+
+Sampler initSampler(uvec2 pixel, uint sampleIndex)
+{
+  Sampler sampler;
+  sampler.index     = sampleIndex;
+  sampler.seed      = pcgHash(pixel.x ^ pcgHash(pixel.y));
+  sampler.dimension = 0;
+  return sampler;
+}
+
+// Returns the next two dimensions of the sample, in [0, 1)^2.
+vec2 sample2D(inout Sampler sampler)
+{
+  const uint dimensionSeed = pcgHash(sampler.seed ^ pcgHash(sampler.dimension));
+  sampler.dimension += 2;
+
+  const uint index = nestedUniformScramble(sampler.index, dimensionSeed);
+  const uint x     = nestedUniformScramble(bitfieldReverse(index), pcgHash(dimensionSeed + 1u));
+  const uint y     = nestedUniformScramble(sobolDimension1(index), pcgHash(dimensionSeed + 2u));
+  return vec2(toUnitFloat(x), toUnitFloat(y));
+}
+
+// Returns the next dimension of the sample, in [0, 1).
+float sample1D(inout Sampler sampler)
+{
+  const uint dimensionSeed = pcgHash(sampler.seed ^ pcgHash(sampler.dimension));
+  sampler.dimension += 1;
+
+  const uint index = nestedUniformScramble(sampler.index, dimensionSeed);
+  return toUnitFloat(nestedUniformScramble(bitfieldReverse(index), pcgHash(dimensionSeed + 1u)));
+}
+
+#endif  // SAMPLER_H
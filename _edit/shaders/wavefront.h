@@ -1,6 +1,30 @@
 
 #include "host_device.h"
 
+// Decoding of CompressedVertex, see vertex_compression.hpp
+vec3 decompressPosition(CompressedVertex v, vec3 posMin, vec3 posStep)
+{
+  const uvec3 q = uvec3(v.posLo & 0x1FFFFFu, (v.posLo >> 21) | ((v.posHi & 0x3FFu) << 11), v.posHi >> 10);
+  return posMin + vec3(q) * posStep;
+}
+
+vec3 decompressNormal(CompressedVertex v)
+{
+  // Unfolds the octahedron
+  const vec2 e = unpackSnorm2x16(v.normal);
+  vec3       n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if(n.z < 0.0)
+  {
+    n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return normalize(n);
+}
+
+vec2 decompressTexCoord(CompressedVertex v)
+{
+  return unpackHalf2x16(v.texCoord);
+}
+
 vec3 computeDiffuse(WaveFrontMaterial mat, vec3 lightDir, vec3 normal)
 {
   // Lambertian
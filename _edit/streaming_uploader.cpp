@@ -0,0 +1,170 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "streaming_uploader.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <nvvk/error_vk.hpp>
+
+void StreamingUploader::init(nvvk::ResourceAllocator* alloc,
+                             uint32_t                 graphicsQueueFamily,
+                             uint32_t                 transferQueueFamily,
+                             VkQueue                  transferQueue,
+                             VkDeviceSize             chunkSize,
+                             uint32_t                 numChunks)
+{
+  m_alloc            = alloc;
+  m_device           = alloc->getDevice();
+  m_queue            = transferQueue;
+  m_queueFamilies    = {transferQueueFamily};
+  m_chunkSize        = chunkSize;
+  m_currentChunk     = 0;
+  m_bytesUploaded    = 0;
+  addQueueFamily(graphicsQueueFamily);
+
+  const VkCommandPoolCreateInfo poolInfo{.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                                         .flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                                         .queueFamilyIndex = transferQueueFamily};
+  NVVK_CHECK(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_cmdPool));
+
+  m_chunks.resize(numChunks);
+  for(Chunk& chunk : m_chunks)
+  {
+    chunk.buffer = m_alloc->createBuffer(chunkSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    chunk.mapped = static_cast<uint8_t*>(m_alloc->map(chunk.buffer));
+
+    const VkCommandBufferAllocateInfo allocInfo{.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                                .commandPool        = m_cmdPool,
+                                                .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                                .commandBufferCount = 1};
+    NVVK_CHECK(vkAllocateCommandBuffers(m_device, &allocInfo, &chunk.cmdBuffer));
+    const VkFenceCreateInfo fenceInfo{.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    NVVK_CHECK(vkCreateFence(m_device, &fenceInfo, nullptr, &chunk.fence));
+  }
+}
+
+void StreamingUploader::deinit()
+{
+  if(m_device == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  flush();
+  for(Chunk& chunk : m_chunks)
+  {
+    if(chunk.recording)
+    {
+      vkEndCommandBuffer(chunk.cmdBuffer);
+    }
+    vkDestroyFence(m_device, chunk.fence, nullptr);
+    m_alloc->unmap(chunk.buffer);
+    m_alloc->destroy(chunk.buffer);
+  }
+  m_chunks.clear();
+  vkDestroyCommandPool(m_device, m_cmdPool, nullptr);  // Also frees the command buffers
+  m_cmdPool = VK_NULL_HANDLE;
+  m_device  = VK_NULL_HANDLE;
+}
+
+void StreamingUploader::addQueueFamily(uint32_t queueFamily)
+{
+  if(std::find(m_queueFamilies.begin(), m_queueFamilies.end(), queueFamily) == m_queueFamilies.end())
+  {
+    m_queueFamilies.push_back(queueFamily);
+  }
+}
+
+nvvk::Buffer StreamingUploader::createBuffer(VkDeviceSize size, const void* data, VkBufferUsageFlags usage)
+{
+  const bool         concurrent = m_queueFamilies.size() > 1;
+  VkBufferCreateInfo info{.sType                 = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                          .size                  = std::max<VkDeviceSize>(size, 1),  // Buffers can't be empty
+                          .usage                 = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          .sharingMode           = concurrent ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+                          .queueFamilyIndexCount = concurrent ? static_cast<uint32_t>(m_queueFamilies.size()) : 0u,
+                          .pQueueFamilyIndices   = concurrent ? m_queueFamilies.data() : nullptr};
+  nvvk::Buffer       buffer = m_alloc->createBuffer(info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  if(data != nullptr)
+  {
+    upload(buffer.buffer, 0, size, data);
+  }
+  return buffer;
+}
+
+void StreamingUploader::upload(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, const void* data)
+{
+  const uint8_t* src = static_cast<const uint8_t*>(data);
+  while(size > 0)
+  {
+    Chunk& chunk = beginChunk();
+    if(chunk.used == m_chunkSize)
+    {
+      submitChunk();
+      continue;
+    }
+    const VkDeviceSize copySize = std::min(size, m_chunkSize - chunk.used);
+    memcpy(chunk.mapped + chunk.used, src, size_t(copySize));
+    const VkBufferCopy region{.srcOffset = chunk.used, .dstOffset = dstOffset, .size = copySize};
+    vkCmdCopyBuffer(chunk.cmdBuffer, chunk.buffer.buffer, dst, 1, &region);
+
+    chunk.used += copySize;
+    src += copySize;
+    dstOffset += copySize;
+    size -= copySize;
+    m_bytesUploaded += copySize;
+  }
+}
+
+void StreamingUploader::flush()
+{
+  if(!m_chunks.empty() && m_chunks[m_currentChunk].recording && m_chunks[m_currentChunk].used > 0)
+  {
+    submitChunk();
+  }
+  for(Chunk& chunk : m_chunks)
+  {
+    if(chunk.inFlight)
+    {
+      NVVK_CHECK(vkWaitForFences(m_device, 1, &chunk.fence, VK_TRUE, UINT64_MAX));
+      NVVK_CHECK(vkResetFences(m_device, 1, &chunk.fence));
+      chunk.inFlight = false;
+    }
+  }
+}
+
+StreamingUploader::Chunk& StreamingUploader::beginChunk()
+{
+  Chunk& chunk = m_chunks[m_currentChunk];
+  if(!chunk.recording)
+  {
+    // Wait until the GPU is done reading this chunk's previous copies
+    if(chunk.inFlight)
+    {
+      NVVK_CHECK(vkWaitForFences(m_device, 1, &chunk.fence, VK_TRUE, UINT64_MAX));
+      NVVK_CHECK(vkResetFences(m_device, 1, &chunk.fence));
+      chunk.inFlight = false;
+    }
+    NVVK_CHECK(vkResetCommandBuffer(chunk.cmdBuffer, 0));
+    const VkCommandBufferBeginInfo beginInfo{.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                                             .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    NVVK_CHECK(vkBeginCommandBuffer(chunk.cmdBuffer, &beginInfo));
+    chunk.used      = 0;
+    chunk.recording = true;
+  }
+  return chunk;
+}
+
+void StreamingUploader::submitChunk()
+{
+  Chunk& chunk = m_chunks[m_currentChunk];
+  NVVK_CHECK(vkEndCommandBuffer(chunk.cmdBuffer));
+  const VkSubmitInfo submitInfo{.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                                .commandBufferCount = 1,
+                                .pCommandBuffers    = &chunk.cmdBuffer};
+  NVVK_CHECK(vkQueueSubmit(m_queue, 1, &submitInfo, chunk.fence));
+  chunk.recording = false;
+  chunk.inFlight  = true;
+  m_currentChunk  = (m_currentChunk + 1) % static_cast<uint32_t>(m_chunks.size());
+}
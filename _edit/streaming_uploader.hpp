@@ -0,0 +1,72 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Streams data into device-local buffers through a fixed-size ring of
+// persistently mapped staging chunks, using a (preferably dedicated transfer)
+// queue. Data is copied from its source straight into a staging chunk, so
+// sources can be memory-mapped files and only the ring's memory is ever held
+// in staging, regardless of how much is uploaded. When all chunks are in
+// flight, uploads wait for the oldest one to finish.
+#ifndef VK_MINI_PATH_TRACER_STREAMING_UPLOADER_HPP
+#define VK_MINI_PATH_TRACER_STREAMING_UPLOADER_HPP
+
+#include <vector>
+
+#include <nvvk/resourceallocator_vk.hpp>
+
+class StreamingUploader
+{
+public:
+  // `graphicsQueueFamily` is the family that uses the buffers afterwards. If
+  // it differs from the transfer queue's family, buffers are created with
+  // concurrent sharing between both, so that no ownership transfers are needed.
+  void init(nvvk::ResourceAllocator* alloc,
+            uint32_t                 graphicsQueueFamily,
+            uint32_t                 transferQueueFamily,
+            VkQueue                  transferQueue,
+            VkDeviceSize             chunkSize = VkDeviceSize(8) << 20,
+            uint32_t                 numChunks = 4);
+  void deinit();
+  // Also shares the buffers created afterwards with `queueFamily`, e.g. one
+  // that builds acceleration structures from them.
+  void addQueueFamily(uint32_t queueFamily);
+
+  // Creates a device-local buffer of `size` bytes with `usage` and streams
+  // `data` into it, if it isn't null. The buffer can be used once flush() has returned.
+  nvvk::Buffer createBuffer(VkDeviceSize size, const void* data, VkBufferUsageFlags usage);
+  // Streams `size` bytes of `data` to `dstOffset` in `dst`.
+  void upload(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, const void* data);
+  // Submits all pending copies and waits until they have finished.
+  void flush();
+
+  // Bytes copied since init().
+  VkDeviceSize getBytesUploaded() const { return m_bytesUploaded; }
+
+private:
+  struct Chunk
+  {
+    nvvk::Buffer    buffer;
+    uint8_t*        mapped    = nullptr;
+    VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+    VkFence         fence     = VK_NULL_HANDLE;
+    VkDeviceSize    used      = 0;
+    bool            recording = false;
+    bool            inFlight  = false;
+  };
+
+  // Returns the current chunk, waiting for it and starting its command buffer if needed.
+  Chunk& beginChunk();
+  void   submitChunk();
+
+  nvvk::ResourceAllocator* m_alloc = nullptr;
+  VkDevice                 m_device{VK_NULL_HANDLE};
+  VkQueue                  m_queue{VK_NULL_HANDLE};
+  std::vector<uint32_t>    m_queueFamilies;  // Distinct families that use the buffers
+  VkCommandPool            m_cmdPool{VK_NULL_HANDLE};
+  std::vector<Chunk>       m_chunks;
+  uint32_t                 m_currentChunk  = 0;
+  VkDeviceSize             m_chunkSize     = 0;
+  VkDeviceSize             m_bytesUploaded = 0;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_STREAMING_UPLOADER_HPP
@@ -0,0 +1,287 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "texture_compression.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace {
+struct TextureCacheHeader
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t levelCount;
+  uint32_t padding;
+  // Identifies the source file
+  uint64_t sourceSize;
+  int64_t  sourceModTime;
+  uint64_t dataSize;  // The levels follow the header
+};
+
+const char     s_magic[8] = {'T', 'E', 'X', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t s_version  = 1;
+
+// Gets the size and modification time of `filename`; returns false if it doesn't exist.
+bool getSourceInfo(const std::string& filename, uint64_t& size, int64_t& modTime)
+{
+  std::error_code error;
+  size    = std::filesystem::file_size(filename, error);
+  modTime = error ? 0 : int64_t(std::filesystem::last_write_time(filename, error).time_since_epoch().count());
+  return !error;
+}
+
+FILE* openFile(const std::string& filename, const char* mode)
+{
+  FILE* file = nullptr;
+#ifdef _WIN32
+  if(fopen_s(&file, filename.c_str(), mode) != 0)
+  {
+    file = nullptr;
+  }
+#else
+  file = fopen(filename.c_str(), mode);
+#endif
+  return file;
+}
+
+uint16_t toRgb565(const uint8_t* rgb)
+{
+  return static_cast<uint16_t>(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3));
+}
+
+void fromRgb565(uint16_t color, int* rgb)
+{
+  const int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+  rgb[0]      = (r << 3) | (r >> 2);
+  rgb[1]      = (g << 2) | (g >> 4);
+  rgb[2]      = (b << 3) | (b >> 2);
+}
+
+// Encodes the 16 RGBA8 texels of `block`, row by row, into 8 bytes
+void encodeBc1Block(const uint8_t (&block)[16][4], uint8_t* out)
+{
+  // The bounding box of the colors, inset by a 16th of it on each side, as
+  // the extreme colors rarely need to be exact
+  uint8_t lo[3] = {255, 255, 255};
+  uint8_t hi[3] = {0, 0, 0};
+  for(const auto& texel : block)
+  {
+    for(int c = 0; c < 3; c++)
+    {
+      lo[c] = std::min(lo[c], texel[c]);
+      hi[c] = std::max(hi[c], texel[c]);
+    }
+  }
+  for(int c = 0; c < 3; c++)
+  {
+    const int inset = (hi[c] - lo[c]) >> 4;
+    lo[c]           = static_cast<uint8_t>(lo[c] + inset);
+    hi[c]           = static_cast<uint8_t>(hi[c] - inset);
+  }
+
+  // color0 > color1 selects the mode with four opaque colors
+  uint16_t color0 = toRgb565(hi);
+  uint16_t color1 = toRgb565(lo);
+  if(color0 < color1)
+  {
+    std::swap(color0, color1);
+  }
+  uint32_t indices = 0;
+  if(color0 != color1)
+  {
+    int palette[4][3];
+    fromRgb565(color0, palette[0]);
+    fromRgb565(color1, palette[1]);
+    for(int c = 0; c < 3; c++)
+    {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    for(uint32_t i = 0; i < 16; i++)
+    {
+      uint32_t best      = 0;
+      int      bestError = INT32_MAX;
+      for(uint32_t p = 0; p < 4; p++)
+      {
+        int error = 0;
+        for(int c = 0; c < 3; c++)
+        {
+          const int d = block[i][c] - palette[p][c];
+          error += d * d;
+        }
+        if(error < bestError)
+        {
+          best      = p;
+          bestError = error;
+        }
+      }
+      indices |= best << (2 * i);
+    }
+  }
+  // Little endian
+  const uint8_t bytes[8] = {uint8_t(color0),        uint8_t(color0 >> 8),  uint8_t(color1),        uint8_t(color1 >> 8),
+                            uint8_t(indices),       uint8_t(indices >> 8), uint8_t(indices >> 16), uint8_t(indices >> 24)};
+  memcpy(out, bytes, sizeof(bytes));
+}
+
+void encodeBc1(const uint8_t* pixels, uint32_t width, uint32_t height, uint8_t* out)
+{
+  for(uint32_t by = 0; by < height; by += 4)
+  {
+    for(uint32_t bx = 0; bx < width; bx += 4)
+    {
+      // Blocks past the edge repeat its texels
+      uint8_t block[16][4];
+      for(uint32_t i = 0; i < 16; i++)
+      {
+        const uint32_t x = std::min(bx + i % 4, width - 1);
+        const uint32_t y = std::min(by + i / 4, height - 1);
+        memcpy(block[i], pixels + 4 * (size_t(y) * width + x), 4);
+      }
+      encodeBc1Block(block, out);
+      out += 8;
+    }
+  }
+}
+
+// The next mip level of the RGBA8 `pixels`, averaging 2x2 texels
+std::vector<uint8_t> downsample(const std::vector<uint8_t>& pixels, uint32_t width, uint32_t height)
+{
+  const uint32_t       w = std::max(width / 2, 1u), h = std::max(height / 2, 1u);
+  std::vector<uint8_t> result(size_t(w) * h * 4);
+  for(uint32_t y = 0; y < h; y++)
+  {
+    const uint32_t y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+    for(uint32_t x = 0; x < w; x++)
+    {
+      const uint32_t x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+      for(uint32_t c = 0; c < 4; c++)
+      {
+        const uint32_t sum = pixels[4 * (size_t(y0) * width + x0) + c] + pixels[4 * (size_t(y0) * width + x1) + c]
+                             + pixels[4 * (size_t(y1) * width + x0) + c] + pixels[4 * (size_t(y1) * width + x1) + c];
+        result[4 * (size_t(y) * w + x) + c] = static_cast<uint8_t>((sum + 2) / 4);
+      }
+    }
+  }
+  return result;
+}
+}  // namespace
+
+uint32_t getMipLevelCount(uint32_t width, uint32_t height)
+{
+  uint32_t levels = 1;
+  while((std::max(width, height) >> levels) > 0)
+  {
+    levels++;
+  }
+  return levels;
+}
+
+uint64_t getMipLevelBytes(VkFormat format, uint32_t width, uint32_t height, uint32_t level)
+{
+  const uint64_t w = std::max(width >> level, 1u), h = std::max(height >> level, 1u);
+  if(format == VK_FORMAT_BC1_RGB_SRGB_BLOCK)
+  {
+    return ((w + 3) / 4) * ((h + 3) / 4) * 8;
+  }
+  return w * h * 4;
+}
+
+TextureMips generateMips(const uint8_t* pixels, uint32_t width, uint32_t height, VkFormat format)
+{
+  TextureMips mips{.format = format, .width = width, .height = height};
+  const uint32_t levels = getMipLevelCount(width, height);
+  uint64_t       size   = 0;
+  for(uint32_t level = 0; level < levels; level++)
+  {
+    mips.levelOffsets.push_back(size);
+    size += getMipLevelBytes(mips.format, width, height, level);
+  }
+  mips.data.resize(size);
+
+  std::vector<uint8_t> level(pixels, pixels + size_t(width) * height * 4);
+  for(uint32_t l = 0; l < levels; l++)
+  {
+    const uint32_t w = std::max(width >> l, 1u), h = std::max(height >> l, 1u);
+    if(format == VK_FORMAT_BC1_RGB_SRGB_BLOCK)
+    {
+      encodeBc1(level.data(), w, h, mips.data.data() + mips.levelOffsets[l]);
+    }
+    else
+    {
+      memcpy(mips.data.data() + mips.levelOffsets[l], level.data(), level.size());
+    }
+    if(l + 1 < levels)
+    {
+      level = downsample(level, w, h);
+    }
+  }
+  return mips;
+}
+
+bool readTextureCache(const std::string& cacheFilename, const std::string& sourceFilename, TextureMips& mips)
+{
+  uint64_t sourceSize;
+  int64_t  sourceModTime;
+  if(!getSourceInfo(sourceFilename, sourceSize, sourceModTime))
+  {
+    return false;
+  }
+  FILE* file = openFile(cacheFilename, "rb");
+  if(file == nullptr)
+  {
+    return false;
+  }
+  TextureCacheHeader header{};
+  bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, s_magic, sizeof(s_magic)) == 0
+               && header.version == s_version && header.format == VK_FORMAT_BC1_RGB_SRGB_BLOCK
+               && header.levelCount == getMipLevelCount(header.width, header.height)
+               && header.sourceSize == sourceSize && header.sourceModTime == sourceModTime;
+  if(valid)
+  {
+    mips = TextureMips{.format = VK_FORMAT_BC1_RGB_SRGB_BLOCK, .width = header.width, .height = header.height};
+    uint64_t size = 0;
+    for(uint32_t level = 0; level < header.levelCount; level++)
+    {
+      mips.levelOffsets.push_back(size);
+      size += getMipLevelBytes(mips.format, header.width, header.height, level);
+    }
+    valid = size == header.dataSize;
+    if(valid)
+    {
+      mips.data.resize(size);
+      valid = fread(mips.data.data(), 1, size, file) == size;
+    }
+  }
+  fclose(file);
+  return valid;
+}
+
+bool writeTextureCache(const std::string& cacheFilename, const std::string& sourceFilename, const TextureMips& mips)
+{
+  TextureCacheHeader header{};
+  memcpy(header.magic, s_magic, sizeof(s_magic));
+  header.version    = s_version;
+  header.format     = mips.format;
+  header.width      = mips.width;
+  header.height     = mips.height;
+  header.levelCount = mips.levelCount();
+  header.dataSize   = mips.data.size();
+  if(!getSourceInfo(sourceFilename, header.sourceSize, header.sourceModTime))
+  {
+    return false;
+  }
+  FILE* file = openFile(cacheFilename, "wb");
+  if(file == nullptr)
+  {
+    return false;
+  }
+  const bool written = fwrite(&header, sizeof(header), 1, file) == 1
+                       && fwrite(mips.data.data(), 1, mips.data.size(), file) == mips.data.size();
+  return (fclose(file) == 0) && written;
+}
@@ -0,0 +1,62 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Mip generation and BC1 compression of textures on the host, and a disk
+// cache of the result, so that a texture is decoded and compressed once and
+// later runs read its compressed mips straight from the cache.
+// The mips are box filtered, in the texture's sRGB encoding.
+// BC1 stores each 4x4 block of texels in 8 bytes, as two RGB565 endpoints
+// and a 2-bit index per texel into the four colors between them; that's an
+// eighth of the memory of RGBA8. Alpha is dropped: the path tracer only
+// reads the color of its textures.
+// The encoder picks the endpoints from the bounding box of the block's
+// colors, which is fast and good enough for albedo maps, but blurs sharp
+// two-color edges that a search over endpoints would keep.
+// The cache stores the size and modification time of the source image, and
+// is ignored if either changes, as for the mesh cache.
+#ifndef VK_MINI_PATH_TRACER_TEXTURE_COMPRESSION_HPP
+#define VK_MINI_PATH_TRACER_TEXTURE_COMPRESSION_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+// A texture, as the mip levels it's uploaded from
+struct TextureMips
+{
+  VkFormat              format = VK_FORMAT_R8G8B8A8_SRGB;  // Or VK_FORMAT_BC1_RGB_SRGB_BLOCK
+  uint32_t              width  = 0;                        // Of level 0
+  uint32_t              height = 0;
+  std::vector<uint8_t>  data;                              // All levels that are there, tightly packed
+  std::vector<uint64_t> levelOffsets;                      // Of each level in `data`
+
+  uint32_t levelCount() const { return static_cast<uint32_t>(levelOffsets.size()); }
+  uint64_t levelSize(uint32_t level) const
+  {
+    return (level + 1 < levelOffsets.size() ? levelOffsets[level + 1] : data.size()) - levelOffsets[level];
+  }
+};
+
+// Number of levels of a full mip chain of a `width` x `height` image
+uint32_t getMipLevelCount(uint32_t width, uint32_t height);
+// Bytes of mip `level` of a `width` x `height` image of `format`
+uint64_t getMipLevelBytes(VkFormat format, uint32_t width, uint32_t height, uint32_t level);
+
+// The full mip chain of the RGBA8 `pixels`, in `format`: VK_FORMAT_R8G8B8A8_SRGB,
+// or VK_FORMAT_BC1_RGB_SRGB_BLOCK to compress them
+TextureMips generateMips(const uint8_t* pixels, uint32_t width, uint32_t height, VkFormat format);
+
+// Reads `cacheFilename` if it's a valid cache of `sourceFilename`
+bool readTextureCache(const std::string& cacheFilename, const std::string& sourceFilename, TextureMips& mips);
+// Returns false on failure
+bool writeTextureCache(const std::string& cacheFilename, const std::string& sourceFilename, const TextureMips& mips);
+
+// Where the cache of `sourceFilename` is stored
+inline std::string getTextureCacheFilename(const std::string& sourceFilename)
+{
+  return sourceFilename + ".bc1cache";
+}
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_TEXTURE_COMPRESSION_HPP
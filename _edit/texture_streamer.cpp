@@ -0,0 +1,448 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "texture_streamer.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+#include <nvh/nvprint.hpp>
+#include <nvvk/commands_vk.hpp>
+#include <nvvk/images_vk.hpp>
+
+#include "stb_image.h"
+
+namespace {
+VkSamplerCreateInfo makeSamplerCreateInfo()
+{
+  VkSamplerCreateInfo info{VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+  info.minFilter  = VK_FILTER_LINEAR;
+  info.magFilter  = VK_FILTER_LINEAR;
+  info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  info.maxLod     = FLT_MAX;
+  return info;
+}
+}  // namespace
+
+void TextureStreamer::init(nvvk::ResourceAllocator* alloc, VkPhysicalDevice physicalDevice, uint32_t queueFamily,
+                           uint32_t numFrames, uint32_t numThreads)
+{
+  m_alloc     = alloc;
+  m_numFrames = numFrames;
+  m_frame     = 0;
+  m_stop      = false;
+
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_BC1_RGB_SRGB_BLOCK, &properties);
+  m_format = (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ?
+                 VK_FORMAT_BC1_RGB_SRGB_BLOCK :
+                 VK_FORMAT_R8G8B8A8_SRGB;
+  LOGI("Textures are %s\n", m_format == VK_FORMAT_BC1_RGB_SRGB_BLOCK ? "BC1 compressed" : "uncompressed");
+
+  // Sampled by the slots that have no image yet
+  {
+    nvvk::CommandPool cmdPool(m_alloc->getDevice(), queueFamily);
+    VkCommandBuffer   cmdBuf = cmdPool.createCommandBuffer();
+    const uint8_t     white[4]{255, 255, 255, 255};
+    const VkImageCreateInfo imageInfo = nvvk::makeImage2DCreateInfo({1, 1}, VK_FORMAT_R8G8B8A8_SRGB);
+    const nvvk::Image       image     = m_alloc->createImage(cmdBuf, sizeof(white), white, imageInfo);
+    const VkImageViewCreateInfo viewInfo = nvvk::makeImageViewCreateInfo(image.image, imageInfo);
+    m_placeholder = m_alloc->createTexture(image, viewInfo, makeSamplerCreateInfo());
+    nvvk::cmdBarrierImageLayout(cmdBuf, m_placeholder.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    cmdPool.submitAndWait(cmdBuf);
+    m_alloc->finalizeAndReleaseStaging();
+  }
+
+  if(numThreads == 0)
+  {
+    numThreads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+  }
+  for(uint32_t i = 0; i < numThreads; i++)
+  {
+    m_threads.emplace_back(&TextureStreamer::workerLoop, this);
+  }
+}
+
+void TextureStreamer::deinit()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for(std::thread& thread : m_threads)
+  {
+    thread.join();
+  }
+  m_threads.clear();
+  m_jobs.clear();
+  m_decoded.clear();
+
+  for(Texture& texture : m_textures)
+  {
+    m_alloc->destroy(texture.image);
+  }
+  m_textures.clear();
+  for(nvvk::Texture& image : m_replaced)
+  {
+    m_alloc->destroy(image);
+  }
+  m_replaced.clear();
+  for(Retired& retired : m_retired)
+  {
+    m_alloc->destroy(retired.staging);
+    m_alloc->destroy(retired.image);
+  }
+  m_retired.clear();
+  m_alloc->destroy(m_placeholder);
+
+  if(m_feedbackMapped != nullptr)
+  {
+    m_alloc->unmap(m_bFeedbackReadback);
+    m_feedbackMapped = nullptr;
+  }
+  m_alloc->destroy(m_bFeedbackReadback);
+  m_alloc->destroy(m_bFeedback);
+  m_residentBytes      = 0;
+  m_descriptorsChanged = false;
+  m_alloc              = nullptr;
+}
+
+uint32_t TextureStreamer::addTexture(const std::string& filename)
+{
+  const uint32_t slot = size();
+  m_textures.push_back({.filename = filename});
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_jobs.emplace_back(slot, filename);
+  }
+  m_wake.notify_one();
+  return slot;
+}
+
+uint32_t TextureStreamer::addColor(const uint8_t (&color)[4])
+{
+  const uint32_t slot = size();
+  m_textures.push_back({.decoded       = true,
+                        .mips          = generateMips(color, 1, 1, VK_FORMAT_R8G8B8A8_SRGB),
+                        .lastUsedFrame = m_frame});
+  return slot;
+}
+
+void TextureStreamer::workerLoop()
+{
+  for(;;)
+  {
+    std::pair<uint32_t, std::string> job;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+      if(m_stop)
+      {
+        return;
+      }
+      job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+    }
+    TextureMips mips = decode(job.second);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_decoded.push_back({job.first, std::move(mips)});
+  }
+}
+
+TextureMips TextureStreamer::decode(const std::string& filename) const
+{
+  const bool        compress      = m_format == VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+  const std::string cacheFilename = getTextureCacheFilename(filename);
+  TextureMips       mips;
+  if(compress && readTextureCache(cacheFilename, filename, mips))
+  {
+    return mips;
+  }
+
+  int      width, height, channels;
+  stbi_uc* pixels = filename.empty() ? nullptr : stbi_load(filename.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+  if(pixels == nullptr)
+  {
+    LOGW("Could not load the texture %s\n", filename.c_str());
+    const uint8_t magenta[4]{255, 0, 255, 255};
+    return generateMips(magenta, 1, 1, VK_FORMAT_R8G8B8A8_SRGB);
+  }
+  mips = generateMips(pixels, static_cast<uint32_t>(width), static_cast<uint32_t>(height), m_format);
+  stbi_image_free(pixels);
+  if(compress && !writeTextureCache(cacheFilename, filename, mips))
+  {
+    LOGW("Could not write the texture cache %s\n", cacheFilename.c_str());
+  }
+  return mips;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Feedback
+//
+void TextureStreamer::createFeedbackBuffers()
+{
+  const VkDeviceSize size = std::max(this->size(), 1u) * sizeof(uint32_t);
+  m_bFeedback = m_alloc->createBuffer(size,
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+                                          | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  m_bFeedbackReadback = m_alloc->createBuffer(m_numFrames * size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  m_feedbackMapped = static_cast<const uint32_t*>(m_alloc->map(m_bFeedbackReadback));
+  m_feedbackWritten.assign(m_numFrames, false);
+}
+
+void TextureStreamer::cmdClearFeedback(const VkCommandBuffer& cmdBuf)
+{
+  const VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+  // After the copy of the last frame read it
+  VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+  vkCmdFillBuffer(cmdBuf, m_bFeedback.buffer, 0, VK_WHOLE_SIZE, 0);
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, shaderStages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void TextureStreamer::cmdCopyFeedback(const VkCommandBuffer& cmdBuf, uint32_t frame)
+{
+  const VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+  const VkDeviceSize         size         = std::max(this->size(), 1u) * sizeof(uint32_t);
+  VkMemoryBarrier            barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(cmdBuf, shaderStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+  const VkBufferCopy region{0, frame * size, size};
+  vkCmdCopyBuffer(cmdBuf, m_bFeedback.buffer, m_bFeedbackReadback.buffer, 1, &region);
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr,
+                       0, nullptr);
+  m_feedbackWritten[frame] = true;
+}
+
+void TextureStreamer::readFeedback(uint32_t frame)
+{
+  if(m_feedbackMapped == nullptr || !m_feedbackWritten[frame])
+  {
+    return;
+  }
+  const uint32_t* used = m_feedbackMapped + size_t(frame) * std::max(size(), 1u);
+  for(uint32_t i = 0; i < size(); i++)
+  {
+    if(used[i] != 0)
+    {
+      m_textures[i].lastUsedFrame = m_frame;
+    }
+  }
+  m_feedbackWritten[frame] = false;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Residency
+//
+void TextureStreamer::cmdUpdate(const VkCommandBuffer& cmdBuf)
+{
+  m_frame++;
+  for(auto it = m_retired.begin(); it != m_retired.end();)
+  {
+    if(--it->framesLeft == 0)
+    {
+      m_alloc->destroy(it->staging);
+      m_alloc->destroy(it->image);
+      it = m_retired.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  std::vector<Decoded> decoded;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::swap(decoded, m_decoded);
+  }
+  for(Decoded& d : decoded)
+  {
+    Texture& texture      = m_textures[d.slot];
+    texture.mips          = std::move(d.mips);
+    texture.decoded       = true;
+    texture.lastUsedFrame = m_frame;
+  }
+
+  updateTargetMips();
+
+  // Textures dropping mips first, as they free memory, then the ones gaining
+  // mips; the most recently used first
+  std::vector<uint32_t> order;
+  for(uint32_t i = 0; i < size(); i++)
+  {
+    if(m_textures[i].decoded && m_textures[i].residentMip != m_textures[i].targetMip)
+    {
+      order.push_back(i);
+    }
+  }
+  std::sort(order.begin(), order.end(),
+            [this](uint32_t a, uint32_t b) { return m_textures[a].lastUsedFrame > m_textures[b].lastUsedFrame; });
+  VkDeviceSize budget = m_settings.uploadBytesPerFrame;
+  for(bool drop : {true, false})
+  {
+    for(uint32_t i : order)
+    {
+      Texture& texture = m_textures[i];
+      // A texture on the placeholder has residentMip ~0u, so it always gains mips
+      if((texture.targetMip > texture.residentMip) == drop)
+      {
+        cmdUpload(cmdBuf, texture, texture.targetMip, budget);
+      }
+    }
+  }
+}
+
+void TextureStreamer::updateTargetMips()
+{
+  std::vector<uint32_t> order;
+  VkDeviceSize          total = 0;
+  for(uint32_t i = 0; i < size(); i++)
+  {
+    Texture& texture = m_textures[i];
+    if(!texture.decoded)
+    {
+      continue;
+    }
+    const bool idle   = m_frame - texture.lastUsedFrame > m_settings.idleFrames;
+    texture.targetMip = std::min(idle ? m_settings.idleMipBias : 0u, texture.mips.levelCount() - 1);
+    total += getBytes(texture, texture.targetMip);
+    order.push_back(i);
+  }
+  if(total <= m_settings.budget)
+  {
+    return;
+  }
+
+  // Over the budget: each texture drops one more mip in turn, the least
+  // recently used first, until they fit or are down to their last mip
+  std::sort(order.begin(), order.end(),
+            [this](uint32_t a, uint32_t b) { return m_textures[a].lastUsedFrame < m_textures[b].lastUsedFrame; });
+  bool dropped = true;
+  while(total > m_settings.budget && dropped)
+  {
+    dropped = false;
+    for(uint32_t i : order)
+    {
+      Texture& texture = m_textures[i];
+      if(texture.targetMip + 1 >= texture.mips.levelCount())
+      {
+        continue;
+      }
+      total -= getBytes(texture, texture.targetMip) - getBytes(texture, texture.targetMip + 1);
+      texture.targetMip++;
+      dropped = true;
+      if(total <= m_settings.budget)
+      {
+        break;
+      }
+    }
+  }
+}
+
+bool TextureStreamer::cmdUpload(const VkCommandBuffer& cmdBuf, Texture& texture, uint32_t mip, VkDeviceSize& budget)
+{
+  // The first upload of a frame may exceed the budget, so that large textures get their turn
+  const VkDeviceSize bytes = getBytes(texture, mip);
+  if(bytes > budget && budget < m_settings.uploadBytesPerFrame)
+  {
+    return false;
+  }
+  budget -= std::min(bytes, budget);
+
+  const TextureMips& mips   = texture.mips;
+  const uint32_t     levels = mips.levelCount() - mip;
+  const VkExtent2D   extent{std::max(mips.width >> mip, 1u), std::max(mips.height >> mip, 1u)};
+  VkImageCreateInfo  imageInfo =
+      nvvk::makeImage2DCreateInfo(extent, mips.format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+  imageInfo.mipLevels = levels;
+  const nvvk::Image image = m_alloc->createImage(imageInfo);
+
+  Retired staging{.framesLeft = m_numFrames};
+  staging.staging = m_alloc->createBuffer(bytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  memcpy(m_alloc->map(staging.staging), mips.data.data() + mips.levelOffsets[mip], bytes);
+  m_alloc->unmap(staging.staging);
+
+  std::vector<VkBufferImageCopy> regions(levels);
+  for(uint32_t level = 0; level < levels; level++)
+  {
+    regions[level] = {.bufferOffset     = mips.levelOffsets[mip + level] - mips.levelOffsets[mip],
+                      .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+                      .imageExtent      = {std::max(extent.width >> level, 1u), std::max(extent.height >> level, 1u), 1}};
+  }
+  nvvk::cmdBarrierImageLayout(cmdBuf, image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  vkCmdCopyBufferToImage(cmdBuf, staging.staging.buffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, levels,
+                         regions.data());
+  nvvk::cmdBarrierImageLayout(cmdBuf, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  m_retired.push_back(std::move(staging));
+
+  // The frames may still sample the image it replaces until the descriptors are committed
+  if(texture.image.image != VK_NULL_HANDLE)
+  {
+    m_residentBytes -= getBytes(texture, texture.residentMip);
+    m_replaced.push_back(texture.image);
+  }
+  const VkImageViewCreateInfo viewInfo = nvvk::makeImageViewCreateInfo(image.image, imageInfo);
+  texture.image                        = m_alloc->createTexture(image, viewInfo, makeSamplerCreateInfo());
+  texture.residentMip                  = mip;
+  m_residentBytes += bytes;
+  m_descriptorsChanged = true;
+  return true;
+}
+
+VkDeviceSize TextureStreamer::getBytes(const Texture& texture, uint32_t mip) const
+{
+  VkDeviceSize bytes = 0;
+  for(uint32_t level = mip; level < texture.mips.levelCount(); level++)
+  {
+    bytes += texture.mips.levelSize(level);
+  }
+  return bytes;
+}
+
+std::vector<VkDescriptorImageInfo> TextureStreamer::getDescriptors() const
+{
+  std::vector<VkDescriptorImageInfo> descriptors;
+  for(const Texture& texture : m_textures)
+  {
+    descriptors.push_back(texture.image.image != VK_NULL_HANDLE ? texture.image.descriptor : m_placeholder.descriptor);
+  }
+  return descriptors;
+}
+
+void TextureStreamer::commitDescriptors()
+{
+  for(nvvk::Texture& image : m_replaced)
+  {
+    m_retired.push_back({.image = image, .framesLeft = m_numFrames});
+  }
+  m_replaced.clear();
+  m_descriptorsChanged = false;
+}
+
+uint32_t TextureStreamer::getPendingCount() const
+{
+  uint32_t pending = 0;
+  for(const Texture& texture : m_textures)
+  {
+    if(!texture.decoded || texture.residentMip != texture.targetMip)
+    {
+      pending++;
+    }
+  }
+  return pending;
+}
@@ -0,0 +1,144 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Loads the textures of the scene in the background and keeps as much of
+// their mip chains in device memory as a budget allows.
+// addTexture() returns a slot of the texture array right away; worker
+// threads decode the image, generate its mips and, if the device samples
+// BC1, compress them (or read them from the disk cache, see
+// texture_compression.hpp). Until a texture's mips are uploaded, its slot
+// samples a 1x1 placeholder.
+// Which textures are still used is fed back by the shaders: they mark each
+// texture they sample in a buffer, which is read back once its frame is
+// done. Textures used in the last idleFrames frames get all their mips,
+// the others drop their idleMipBias finest ones. When that exceeds the
+// budget, the least recently used textures drop more of their finest mips
+// until it fits. The mips of all textures stay in host memory, so a texture
+// dropping or regaining mips is a new image of the levels it keeps,
+// uploaded from there with at most uploadBytesPerFrame per frame.
+// New images are only sampled once their slots are written to a descriptor
+// set that no frame in flight uses; getDescriptors() lists them and
+// commitDescriptors() retires the images they replace, which are destroyed
+// once the frames in flight are done with them.
+#ifndef VK_MINI_PATH_TRACER_TEXTURE_STREAMER_HPP
+#define VK_MINI_PATH_TRACER_TEXTURE_STREAMER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nvvk/resourceallocator_vk.hpp>
+
+#include "texture_compression.hpp"
+
+class TextureStreamer
+{
+public:
+  struct Settings
+  {
+    VkDeviceSize budget              = VkDeviceSize(512) << 20;  // Of the resident mips of all textures
+    VkDeviceSize uploadBytesPerFrame = VkDeviceSize(32) << 20;
+    uint32_t     idleFrames          = 240;  // A texture not sampled for this many frames is idle
+    uint32_t     idleMipBias         = 2;    // Finest mips an idle texture drops
+  };
+
+  // Creates the placeholder and starts `numThreads` decoding threads, 0 for
+  // one per host core but one. `numFrames` are the frames in flight.
+  void init(nvvk::ResourceAllocator* alloc, VkPhysicalDevice physicalDevice, uint32_t queueFamily,
+            uint32_t numFrames, uint32_t numThreads = 0);
+  // The device must be idle
+  void deinit();
+
+  // Returns the slot of the image `filename`, which is decoded in the
+  // background; a texture that can't be decoded is magenta
+  uint32_t addTexture(const std::string& filename);
+  // Returns the slot of a 1x1 texture of `color`
+  uint32_t addColor(const uint8_t (&color)[4]);
+  uint32_t size() const { return static_cast<uint32_t>(m_textures.size()); }
+
+  // Creates the buffer the shaders mark the textures they sample in; the
+  // slots are fixed once it exists
+  void                   createFeedbackBuffers();
+  VkDescriptorBufferInfo getFeedbackDescriptor() const { return {m_bFeedback.buffer, 0, VK_WHOLE_SIZE}; }
+  // Before the shaders sample textures, and after they sampled all of them
+  void cmdClearFeedback(const VkCommandBuffer& cmdBuf);
+  void cmdCopyFeedback(const VkCommandBuffer& cmdBuf, uint32_t frame);
+  // Once the fence of `frame` signaled: which textures it sampled
+  void readFeedback(uint32_t frame);
+
+  // Once per frame, outside render passes: takes the decoded textures, and
+  // records the uploads of the mips that become resident
+  void cmdUpdate(const VkCommandBuffer& cmdBuf);
+
+  // The image of each slot, for eTextures
+  std::vector<VkDescriptorImageInfo> getDescriptors() const;
+  // Whether images were replaced since the last commitDescriptors()
+  bool descriptorsChanged() const { return m_descriptorsChanged; }
+  // The descriptors were written to a set, which the frames use from now on
+  void commitDescriptors();
+
+  Settings     m_settings;
+  VkDeviceSize getResidentBytes() const { return m_residentBytes; }
+  uint32_t     getPendingCount() const;  // Textures still decoding, or not at their resident mips
+
+private:
+  struct Texture
+  {
+    std::string   filename;
+    bool          decoded = false;
+    TextureMips   mips;     // Host copy of all levels, once decoded
+    nvvk::Texture image;    // Of the levels from residentMip on, if any
+    uint32_t      residentMip = ~0u;  // ~0u while it samples the placeholder
+    uint32_t      targetMip   = 0;
+    uint64_t      lastUsedFrame = 0;
+  };
+  struct Decoded
+  {
+    uint32_t    slot;
+    TextureMips mips;
+  };
+  // A staging buffer or image, destroyed once the frames in flight are done with it
+  struct Retired
+  {
+    nvvk::Buffer  staging;
+    nvvk::Texture image;
+    uint32_t      framesLeft{0};
+  };
+
+  void         workerLoop();
+  TextureMips  decode(const std::string& filename) const;
+  void         updateTargetMips();
+  // Uploads the levels of `texture` from `mip` on into a new image, if at most `budget` bytes
+  bool         cmdUpload(const VkCommandBuffer& cmdBuf, Texture& texture, uint32_t mip, VkDeviceSize& budget);
+  VkDeviceSize getBytes(const Texture& texture, uint32_t mip) const;
+
+  nvvk::ResourceAllocator*   m_alloc{nullptr};
+  VkFormat                   m_format{VK_FORMAT_R8G8B8A8_SRGB};  // Of the textures, BC1 if the device samples it
+  uint32_t                   m_numFrames{0};
+  nvvk::Texture              m_placeholder;
+  std::vector<Texture>       m_textures;
+  VkDeviceSize               m_residentBytes{0};
+  uint64_t                   m_frame{0};  // Counts cmdUpdate calls
+  bool                       m_descriptorsChanged{false};
+  std::vector<nvvk::Texture> m_replaced;  // Images the current descriptors may use, not the textures anymore
+  std::vector<Retired>       m_retired;
+
+  // One uint per slot, nonzero if a shader sampled it
+  nvvk::Buffer      m_bFeedback;
+  nvvk::Buffer      m_bFeedbackReadback;  // Host copy of it, one per frame in flight
+  const uint32_t*   m_feedbackMapped{nullptr};
+  std::vector<bool> m_feedbackWritten;    // Which copies were written since they were read
+
+  // Decoding threads; they take the filenames of m_jobs and put the mips into m_decoded
+  std::vector<std::thread>                     m_threads;
+  std::mutex                                   m_mutex;
+  std::condition_variable                      m_wake;  // Jobs were queued, or the threads must stop
+  std::deque<std::pair<uint32_t, std::string>> m_jobs;  // Slot and filename
+  std::vector<Decoded>                         m_decoded;
+  bool                                         m_stop{false};
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_TEXTURE_STREAMER_HPP
@@ -0,0 +1,49 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "upload_ring.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+void UploadRing::init(nvvk::ResourceAllocator* alloc,
+                      VkDeviceSize             frameCapacity,
+                      uint32_t                 numFramesInFlight,
+                      VkDeviceSize             offsetAlignment,
+                      VkBufferUsageFlags       usage)
+{
+  m_alloc         = alloc;
+  m_alignment     = std::max<VkDeviceSize>(offsetAlignment, 1);
+  m_frameCapacity = (frameCapacity + m_alignment - 1) / m_alignment * m_alignment;
+  m_numFrames     = std::max(numFramesInFlight, 1u);
+  m_buffer        = m_alloc->createBuffer(m_frameCapacity * m_numFrames, usage,
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  m_mapped        = static_cast<uint8_t*>(m_alloc->map(m_buffer));
+  m_begin         = 0;
+  m_used          = 0;
+}
+
+void UploadRing::deinit()
+{
+  if(m_alloc == nullptr)
+  {
+    return;
+  }
+  m_alloc->unmap(m_buffer);
+  m_alloc->destroy(m_buffer);
+  m_mapped = nullptr;
+  m_alloc  = nullptr;
+}
+
+void UploadRing::begin(uint32_t frameIndex)
+{
+  m_begin = (frameIndex % m_numFrames) * m_frameCapacity;
+  m_used  = 0;
+}
+
+UploadRing::Allocation UploadRing::allocate(VkDeviceSize size)
+{
+  assert(m_used + size <= m_frameCapacity);
+  const VkDeviceSize offset = m_begin + m_used;
+  m_used += (size + m_alignment - 1) / m_alignment * m_alignment;
+  return {m_mapped + offset, static_cast<uint32_t>(offset)};
+}
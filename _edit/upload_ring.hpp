@@ -0,0 +1,66 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// A ring of persistently mapped, host-visible memory for the data the host
+// writes every frame, such as the uniforms, so that it reaches the shaders
+// without a copy on the device, nor the barriers that would order the copy
+// against the last frame's reads. Each frame in flight has its own region, as
+// the copies of LightBvh and ShaderBindingTable do: begin() rewinds a frame's
+// region once its fence signaled, and the allocations of the frame follow
+// each other in it. All regions are in one buffer, which the shaders see
+// through dynamic descriptor offsets, so the descriptor sets stay the same.
+#ifndef VK_MINI_PATH_TRACER_UPLOAD_RING_HPP
+#define VK_MINI_PATH_TRACER_UPLOAD_RING_HPP
+
+#include <cstring>
+
+#include <nvvk/resourceallocator_vk.hpp>
+
+class UploadRing
+{
+public:
+  struct Allocation
+  {
+    void*    data   = nullptr;  // Mapped, to write before the frame is submitted
+    uint32_t offset = 0;        // In getBuffer(), the dynamic offset to bind it at
+  };
+
+  // `frameCapacity` bytes per frame in flight. `offsetAlignment` is the
+  // largest of the min*BufferOffsetAlignment limits of the descriptor types
+  // it is bound as, with `usage`.
+  void init(nvvk::ResourceAllocator* alloc,
+            VkDeviceSize             frameCapacity,
+            uint32_t                 numFramesInFlight,
+            VkDeviceSize             offsetAlignment,
+            VkBufferUsageFlags       usage);
+  void deinit();
+
+  // Rewinds the region of frame `frameIndex`, whose fence must have been
+  // waited on; following allocations are from it
+  void begin(uint32_t frameIndex);
+  // `size` bytes of the current frame's region, which must have them left
+  Allocation allocate(VkDeviceSize size);
+  template <typename T>
+  uint32_t push(const T& value)
+  {
+    const Allocation allocation = allocate(sizeof(T));
+    memcpy(allocation.data, &value, sizeof(T));
+    return allocation.offset;
+  }
+
+  // For a dynamic buffer descriptor of `range` bytes, bound at the offsets of allocations
+  VkDescriptorBufferInfo getDescriptor(VkDeviceSize range) const { return {m_buffer.buffer, 0, range}; }
+  VkBuffer               getBuffer() const { return m_buffer.buffer; }
+
+private:
+  nvvk::ResourceAllocator* m_alloc = nullptr;
+  nvvk::Buffer             m_buffer;
+  uint8_t*                 m_mapped        = nullptr;
+  VkDeviceSize             m_alignment     = 1;
+  VkDeviceSize             m_frameCapacity = 0;  // Of each region, aligned
+  uint32_t                 m_numFrames     = 0;
+  VkDeviceSize             m_begin         = 0;  // Of the current frame's region
+  VkDeviceSize             m_used          = 0;  // Of it
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_UPLOAD_RING_HPP
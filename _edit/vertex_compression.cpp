@@ -0,0 +1,61 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "vertex_compression.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/packing.hpp>
+
+namespace {
+constexpr uint32_t k_positionBits = 21;
+constexpr uint32_t k_positionMax  = (1u << k_positionBits) - 1;
+
+// Projects the unit vector `n` onto the octahedron |x| + |y| + |z| = 1, and
+// folds the lower half over the upper one, to a point in [-1, 1]^2
+glm::vec2 octEncode(glm::vec3 n)
+{
+  n /= std::max(std::abs(n.x) + std::abs(n.y) + std::abs(n.z), 1e-20f);
+  glm::vec2 p(n.x, n.y);
+  if(n.z < 0.f)
+  {
+    p = (glm::vec2(1.f) - glm::abs(glm::vec2(n.y, n.x)))
+        * glm::vec2(p.x >= 0.f ? 1.f : -1.f, p.y >= 0.f ? 1.f : -1.f);
+  }
+  return p;
+}
+}  // namespace
+
+CompressedVertexBounds compressVertices(const VertexObj* vertices, size_t count, std::vector<CompressedVertex>& compressed)
+{
+  CompressedVertexBounds bounds;
+  compressed.resize(count);
+  if(count == 0)
+  {
+    return bounds;
+  }
+
+  glm::vec3 posMax = vertices[0].pos;
+  bounds.posMin    = vertices[0].pos;
+  for(size_t i = 1; i < count; i++)
+  {
+    bounds.posMin = glm::min(bounds.posMin, vertices[i].pos);
+    posMax        = glm::max(posMax, vertices[i].pos);
+  }
+  // Flat meshes have no extent along an axis; any step decodes that to posMin
+  bounds.posStep = glm::max(posMax - bounds.posMin, glm::vec3(1e-20f)) / static_cast<float>(k_positionMax);
+
+  for(size_t i = 0; i < count; i++)
+  {
+    const VertexObj& v = vertices[i];
+    const glm::uvec3 q = glm::uvec3(glm::clamp(glm::round((v.pos - bounds.posMin) / bounds.posStep), glm::vec3(0.f),
+                                               glm::vec3(static_cast<float>(k_positionMax))));
+    const float      length = glm::length(v.nrm);
+    const glm::vec3  normal = length > 0.f ? v.nrm / length : glm::vec3(0.f, 0.f, 1.f);
+    compressed[i] = {.posLo    = q.x | (q.y << k_positionBits),
+                     .posHi    = (q.y >> (32 - k_positionBits)) | (q.z << (2 * k_positionBits - 32)),
+                     .normal   = glm::packSnorm2x16(octEncode(normal)),
+                     .texCoord = glm::packHalf2x16(v.texCoord)};
+  }
+  return bounds;
+}
@@ -0,0 +1,43 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// A compressed copy of the vertex attributes the closest-hit shader fetches,
+// 16 bytes per vertex instead of the 44 of VertexObj: the position quantized
+// to 21 bits per axis within the bounding box of the mesh, the normal
+// octahedral-encoded to two 16-bit snorms, and the texture coordinates as two
+// halfs. The acceleration structures and the rasterizer still use the full
+// precision vertex buffer; only the hit shading reads this one.
+// Quantizing the positions moves them by at most half a step, 1/2^22 of the
+// extent of the mesh, far below the offset rays leave surfaces with. Half
+// texture coordinates keep 11 significant bits, which is enough for the
+// usual [0, 1] range but not for textures tiled hundreds of times.
+#ifndef VK_MINI_PATH_TRACER_VERTEX_COMPRESSION_HPP
+#define VK_MINI_PATH_TRACER_VERTEX_COMPRESSION_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "obj_loader.h"
+
+// Device layout, see shaders/host_device.h
+struct CompressedVertex
+{
+  uint32_t posLo;     // Bits 0-20: x; bits 21-31: the low 11 bits of y
+  uint32_t posHi;     // Bits 0-9: the high 10 bits of y; bits 10-30: z
+  uint32_t normal;    // Octahedral encoding, as packSnorm2x16
+  uint32_t texCoord;  // As packHalf2x16
+};
+
+// Where the quantized positions are within the mesh: position = posMin + q * posStep
+struct CompressedVertexBounds
+{
+  glm::vec3 posMin{0.f};
+  glm::vec3 posStep{0.f};
+};
+
+// Compresses `count` vertices, and returns the bounds their positions were quantized in
+CompressedVertexBounds compressVertices(const VertexObj* vertices, size_t count, std::vector<CompressedVertex>& compressed);
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_VERTEX_COMPRESSION_HPP
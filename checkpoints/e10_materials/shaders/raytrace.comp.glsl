@@ -30,18 +30,6 @@ layout(push_constant) uniform PushConsts
 
 #include "shaderCommon.h"
 
-// Uses the Box-Muller transform to return a normally distributed (centered
-// at 0, standard deviation 1) 2D point.
-vec2 randomGaussian(inout uint rngState)
-{
-  // Almost uniform in (0, 1] - make sure the value is never 0:
-  const float u1    = max(1e-38, stepAndOutputRNGFloat(rngState));
-  const float u2    = stepAndOutputRNGFloat(rngState);  // In [0, 1]
-  const float r     = sqrt(-2.0 * log(u1));
-  const float theta = 2 * k_pi * u2;  // Random in [0, 2pi]
-  return r * vec2(cos(theta), sin(theta));
-}
-
 // Returns the color of the sky in a given direction (in linear color space)
 vec3 skyColor(vec3 direction)
 {
@@ -143,48 +131,23 @@ void main()
       // a generated object
       if(rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionTriangleEXT)
       {
-        // Get the ID of the shader:
-        const int sbtOffset = int(rayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetEXT(rayQuery, true));
-
-        // Get information about the absorption, new ray origin, and new ray color:
-        ReturnedInfo returnedInfo;
-        switch(sbtOffset)
-        {
-          case 0:
-            returnedInfo = material0(rayQuery, rngState);
-            break;
-          case 1:
-            returnedInfo = material1(rayQuery, rngState);
-            break;
-          case 2:
-            returnedInfo = material2(rayQuery, rngState);
-            break;
-          case 3:
-            returnedInfo = material3(rayQuery, rngState);
-            break;
-          case 4:
-            returnedInfo = material4(rayQuery, rngState);
-            break;
-          case 5:
-            returnedInfo = material5(rayQuery, rngState);
-            break;
-          case 6:
-            returnedInfo = material6(rayQuery, rngState);
-            break;
-          case 7:
-            returnedInfo = material7(rayQuery, rngState);
-            break;
-          default:
-            returnedInfo = material8(rayQuery, rngState);
-            break;
-        }
+        // The material is the instance's SBT record offset:
+        const uint material = rayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetEXT(rayQuery, true);
+
+        // Get the absorption, new ray origin, and new ray direction:
+        PassableInfo pld;
+        pld.rngState   = rngState;
+        pld.wavelength = 550.0;  // This chapter renders in RGB
+        pld.dispersed  = false;
+        shadeMaterial(material, getObjectHitInfo(rayQuery), pld);
+        rngState = pld.rngState;
 
         // Apply color absorption
-        accumulatedRayColor *= returnedInfo.color;
+        accumulatedRayColor *= pld.color;
 
         // Start a new segment
-        rayOrigin    = returnedInfo.rayOrigin;
-        rayDirection = returnedInfo.rayDirection;
+        rayOrigin    = pld.rayOrigin;
+        rayDirection = pld.rayDirection;
       }
       else
       {
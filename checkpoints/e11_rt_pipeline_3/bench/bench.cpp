@@ -0,0 +1,294 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// vk_path_tracer_bench: renders each configuration of bench_configs.txt
+// with the renderer of this chapter (headless, with --warmup, --frames and
+// --report), collects the measurements into one report, and compares them
+// with a baseline report, failing if any configuration got slower.
+//
+// Usage: vk_path_tracer_bench [--renderer <exe>] [--configs <file>]
+//          [--baseline <file>] [--tolerance <fraction>] [--output <file>]
+//          [--warmup <frames>] [--frames <frames>]
+//
+// The report (bench_report.json by default) has one object per line, so a
+// report of a known good build can be used as the baseline of later runs.
+// A configuration the renderer traced with another --reorder or --backend
+// than requested, since the device doesn't support it, is marked
+// "mismatched", with the requested modes next to the ones it used; it isn't
+// compared with the baseline, and isn't used as one.
+// Returns 0 if all configurations rendered and none regressed, 1 if one
+// regressed, and 2 on other errors.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+struct BenchConfig
+{
+  std::string name;
+  std::string scene;
+  std::string reorder;
+  unsigned    samples  = 64;
+  unsigned    segments = 32;
+  std::string resolution;
+  std::string backend = "pipeline";  // Optional
+  std::string color   = "rgb";       // Optional, after the backend
+};
+
+struct BenchResult
+{
+  std::string name;
+  std::string report;  // The renderer's line of JSON
+  double      msPerFrame = 0.0;
+  bool        mismatched = false;  // Rendered with other modes than requested
+};
+
+// Parses the lines of `filename` that aren't empty or comments
+bool readConfigs(const std::string& filename, std::vector<BenchConfig>& configs)
+{
+  std::ifstream file(filename);
+  if(!file)
+  {
+    return false;
+  }
+  std::string line;
+  while(std::getline(file, line))
+  {
+    if(line.empty() || line[0] == '#')
+    {
+      continue;
+    }
+    std::istringstream fields(line);
+    BenchConfig        config;
+    if(fields >> config.name >> config.scene >> config.reorder >> config.samples >> config.segments >> config.resolution)
+    {
+      fields >> config.backend >> config.color;
+      configs.push_back(config);
+    }
+    else if(line.find_first_not_of(" \t\r") != std::string::npos)
+    {
+      fprintf(stderr, "Ignoring invalid configuration: %s\n", line.c_str());
+    }
+  }
+  return true;
+}
+
+// The value of `"key": ` in a line of JSON; the reports are flat, so this doesn't parse nesting
+std::string findValue(const std::string& json, const char* key)
+{
+  const std::string quotedKey = std::string("\"") + key + "\":";
+  size_t            begin     = json.find(quotedKey);
+  if(begin == std::string::npos)
+  {
+    return {};
+  }
+  begin = json.find_first_not_of(' ', begin + quotedKey.size());
+  if(begin == std::string::npos)
+  {
+    return {};
+  }
+  if(json[begin] == '"')
+  {
+    return json.substr(begin + 1, json.find('"', begin + 1) - begin - 1);
+  }
+  return json.substr(begin, json.find_first_of(",}", begin) - begin);
+}
+
+// Name -> ms per frame of each configuration in the report `filename`
+bool readBaseline(const std::string& filename, std::map<std::string, double>& baseline)
+{
+  std::ifstream file(filename);
+  if(!file)
+  {
+    return false;
+  }
+  std::string line;
+  while(std::getline(file, line))
+  {
+    const std::string name       = findValue(line, "name");
+    const std::string msPerFrame = findValue(line, "msPerFrame");
+    if(!name.empty() && !msPerFrame.empty() && findValue(line, "mismatched") != "true")
+    {
+      baseline[name] = atof(msPerFrame.c_str());
+    }
+  }
+  return true;
+}
+
+// The last line of the renderer's report
+std::string readLastLine(const std::string& filename)
+{
+  std::ifstream file(filename);
+  std::string   line, last;
+  while(std::getline(file, line))
+  {
+    if(!line.empty())
+    {
+      last = line;
+    }
+  }
+  return last;
+}
+}  // namespace
+
+int main(int argc, const char** argv)
+{
+  const std::filesystem::path exeDir = std::filesystem::absolute(argv[0]).parent_path();
+#ifdef _WIN32
+  std::string rendererPath = (exeDir / BENCH_RENDERER_NAME ".exe").string();
+#else
+  std::string rendererPath = (exeDir / BENCH_RENDERER_NAME).string();
+#endif
+  std::string configsPath = (exeDir / "bench" / "bench_configs.txt").string();
+  if(!std::filesystem::exists(configsPath))
+  {
+    configsPath = BENCH_SOURCE_CONFIGS;
+  }
+  std::string baselinePath;
+  std::string outputPath   = "bench_report.json";
+  double      tolerance    = 0.1;  // Slower than the baseline by more than this fraction fails
+  unsigned    warmupFrames = 1;
+  unsigned    timedFrames  = 3;
+  for(int arg = 1; arg + 1 < argc; arg++)
+  {
+    if(strcmp(argv[arg], "--renderer") == 0)
+    {
+      rendererPath = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--configs") == 0)
+    {
+      configsPath = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--baseline") == 0)
+    {
+      baselinePath = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--tolerance") == 0)
+    {
+      tolerance = atof(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--output") == 0)
+    {
+      outputPath = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--warmup") == 0)
+    {
+      warmupFrames = static_cast<unsigned>(std::max(0, atoi(argv[++arg])));
+    }
+    else if(strcmp(argv[arg], "--frames") == 0)
+    {
+      timedFrames = static_cast<unsigned>(std::max(1, atoi(argv[++arg])));
+    }
+  }
+
+  std::vector<BenchConfig> configs;
+  if(!readConfigs(configsPath, configs) || configs.empty())
+  {
+    fprintf(stderr, "Could not read any configurations from %s.\n", configsPath.c_str());
+    return 2;
+  }
+  std::map<std::string, double> baseline;
+  if(!baselinePath.empty() && !readBaseline(baselinePath, baseline))
+  {
+    fprintf(stderr, "Could not read the baseline %s.\n", baselinePath.c_str());
+    return 2;
+  }
+
+  const std::string        reportPath = (std::filesystem::temp_directory_path() / "vk_path_tracer_bench_run.json").string();
+  std::vector<BenchResult> results;
+  for(const BenchConfig& config : configs)
+  {
+    std::filesystem::remove(reportPath);
+    const std::string command = "\"" + rendererPath + "\" --scene " + config.scene + " --reorder " + config.reorder
+                                + " --backend " + config.backend + " --color " + config.color + " --samples "
+                                + std::to_string(config.samples) + " --segments " + std::to_string(config.segments) + " --resolution "
+                                + config.resolution + " --warmup " + std::to_string(warmupFrames) + " --frames "
+                                + std::to_string(timedFrames) + " --report \"" + reportPath + "\"";
+    printf("[%s] %s\n", config.name.c_str(), command.c_str());
+    fflush(stdout);
+    const int         status = std::system(command.c_str());
+    const std::string report = readLastLine(reportPath);
+    if(status != 0 || report.empty())
+    {
+      fprintf(stderr, "[%s] The renderer failed (exit status %d).\n", config.name.c_str(), status);
+      return 2;
+    }
+    // The renderer may have fallen back to another reorder mode or backend on
+    // this device; its report has the ones it used
+    const std::string reorder    = findValue(report, "reorder");
+    const std::string backend    = findValue(report, "backend");
+    const bool        mismatched = (reorder != config.reorder || backend != config.backend);
+    if(mismatched)
+    {
+      fprintf(stderr, "[%s] Rendered with --reorder %s --backend %s instead of --reorder %s --backend %s.\n",
+              config.name.c_str(), reorder.c_str(), backend.c_str(), config.reorder.c_str(), config.backend.c_str());
+    }
+    // Name the renderer's object after the configuration
+    const std::string mismatch = mismatched ? "\"mismatched\": true, \"requestedReorder\": \"" + config.reorder
+                                                  + "\", \"requestedBackend\": \"" + config.backend + "\", " :
+                                              "";
+    results.push_back({.name       = config.name,
+                       .report     = "{\"name\": \"" + config.name + "\", " + mismatch + report.substr(report.find('{') + 1),
+                       .msPerFrame = atof(findValue(report, "msPerFrame").c_str()),
+                       .mismatched = mismatched});
+  }
+  std::filesystem::remove(reportPath);
+
+  FILE* output = fopen(outputPath.c_str(), "w");
+  if(output == nullptr)
+  {
+    fprintf(stderr, "Could not write the report %s.\n", outputPath.c_str());
+    return 2;
+  }
+  fprintf(output, "[\n");
+  for(size_t i = 0; i < results.size(); i++)
+  {
+    fprintf(output, "%s%s\n", results[i].report.c_str(), (i + 1 < results.size()) ? "," : "");
+  }
+  fprintf(output, "]\n");
+  fclose(output);
+
+  printf("\n%-32s %12s %12s %9s\n", "Configuration", "ms/frame", "Baseline", "Change");
+  int regressions = 0;
+  int mismatches  = 0;
+  for(const BenchResult& result : results)
+  {
+    if(result.mismatched)
+    {
+      printf("%-32s %12.3f %12s %9s  MISMATCHED\n", result.name.c_str(), result.msPerFrame, "-", "-");
+      mismatches++;
+      continue;
+    }
+    auto it = baseline.find(result.name);
+    if(it == baseline.end() || it->second <= 0.0)
+    {
+      printf("%-32s %12.3f %12s %9s\n", result.name.c_str(), result.msPerFrame, "-", "-");
+      continue;
+    }
+    const double change    = result.msPerFrame / it->second - 1.0;
+    const bool   regressed = change > tolerance;
+    printf("%-32s %12.3f %12.3f %+8.1f%%%s\n", result.name.c_str(), result.msPerFrame, it->second, 100.0 * change,
+           regressed ? "  REGRESSION" : "");
+    regressions += regressed ? 1 : 0;
+  }
+  printf("Wrote %s.\n", outputPath.c_str());
+  if(mismatches > 0)
+  {
+    fprintf(stderr, "%d of %zu configurations didn't render with the requested modes, and weren't compared.\n", mismatches,
+            results.size());
+  }
+  if(regressions > 0)
+  {
+    fprintf(stderr, "%d of %zu configurations are more than %.0f%% slower than %s!\n", regressions, results.size(),
+            100.0 * tolerance, baselinePath.c_str());
+    return 1;
+  }
+  return 0;
+}
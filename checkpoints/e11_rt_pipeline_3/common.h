@@ -7,20 +7,161 @@
 
 #ifdef __cplusplus
 #include <cstdint>
+#include <glm/glm.hpp>
 using uint = uint32_t;
+using vec3 = glm::vec3;
+using vec4 = glm::vec4;
 #endif  // #ifdef __cplusplus
 
+// The trace command buffers are recorded once and re-submitted, so the push
+// constants only hold values fixed at record time. Values that change per
+// submission live in submit_params[submit_slot], which the CPU writes before
+// each submission.
 struct PushConstants
 {
-  uint sample_batch;
+  uint  render_width;     // Size of the full image; the storage image only holds one tile
+  uint  render_height;    //
+  uint  submit_slot;      // Which ring slot (and entry of submit_params) this command buffer uses
+  uint  batch_in_submit;  // Index of this trace within its command buffer
+  uint  wave;             // --reorder sort only: which wave of SORTED_SAMPLES_PER_WAVE samples is traced
+  float noise_threshold;  // --noise-threshold: a pixel stops being traced once the relative standard
+                          // error of its mean luminance is below this; 0 traces every sample batch
+};
+
+// The sample batch index of a trace is sample_batch_base + batch_in_submit,
+// and the tile it renders starts at pixel (tile_offset_x, tile_offset_y).
+// The storage image averages the batches from accumulation_base on; it's 0
+// unless a render farm worker renders a later range of the tile's batches.
+// The camera and sky are those of jobs[job], and the scene is tlas[tlas].
+struct SubmitParams
+{
+  uint sample_batch_base;
+  uint tile_offset_x;
+  uint tile_offset_y;
+  uint accumulation_base;
+  uint job;
+  uint tlas;
+};
+// The TLAS binding is an array of this many, the slots of the TLAS ring of a
+// sequence (see tlas_ring.hpp); other renders use the first one.
+#define NUM_TLAS_SLOTS 3
+
+// The camera and sky of a job of the scene file (see scene_file.hpp), in a
+// uniform buffer with MAX_JOBS entries. It's std140, hence the vec4s.
+struct JobParams
+{
+  vec4 camera_origin;   // w is unused, as in all of these
+  vec4 camera_right;    // Scaled by the slope of the topmost rays, like camera_up
+  vec4 camera_up;       //
+  vec4 camera_forward;  // Normalized
+  vec4 sky_zenith;      // See SceneSky
+  vec4 sky_horizon;     //
+  vec4 sky_ground;      //
+};
+#define MAX_JOBS 128  // Fits the minimum maxUniformBufferRange
+
+// Instance i uses the vertices and indices of model gl_InstanceCustomIndexEXT;
+// all models share the vertex and index buffers.
+struct ModelRange
+{
+  uint first_vertex;
+  uint first_index;
+};
+
+// The arguments of vkCmdTraceRaysIndirectKHR, in the layout of
+// VkTraceRaysIndirectCommandKHR. The converge pass counts the pixels of the
+// tile that still need samples into `width`, one entry per submit slot.
+struct TraceArgs
+{
+  uint width;
+  uint height;
+  uint depth;
 };
 
 #define WORKGROUP_WIDTH 16
 #define WORKGROUP_HEIGHT 8
 
+// The size of the tiles the image is rendered in.
+#define TILE_WIDTH 256
+#define TILE_HEIGHT 256
+
+// Adaptive sampling: before each submission, the converge pass lists the
+// pixels of the tile that haven't converged yet, and only those get traced.
+// A pixel is traced for at least ADAPTIVE_MIN_SAMPLE_BATCHES sample batches,
+// so that its variance estimate is meaningful.
+#define ADAPTIVE_MIN_SAMPLE_BATCHES 4
+
+// Each instance gets one of NUM_MATERIALS closest-hit shaders, through its SBT record offset.
+#define NUM_MATERIALS 10
+// A grid picks from the materials of the earlier chapters, so that the default
+// scene stays the same; the dispersive glass (material 9) is for scene files.
+#define NUM_GRID_MATERIALS 9
+
+// With --backend query, the megakernel is a compute shader with workgroups
+// of QUERY_WORKGROUP_SIZE invocations, one per active pixel.
+#define QUERY_WORKGROUP_SIZE 64
+
+// With --reorder sort, each segment of the paths of a tile is traced in a
+// sequence of passes (see main.cpp). The paths of SORTED_SAMPLES_PER_WAVE
+// samples of each pixel are traced together; this is a wave.
+#define SORTED_SAMPLES_PER_WAVE 16
+#define SORTED_PATHS_PER_WAVE (TILE_WIDTH * TILE_HEIGHT * SORTED_SAMPLES_PER_WAVE)
+#define WAVEFRONT_WORKGROUP_SIZE 64
+
+// The classify pass gives each path a sort key: the material it hits next, or
+// SORT_KEY_MISS. Paths that reached the sky (or don't contribute) have
+// SORT_KEY_DONE and are no longer traced.
+#define SORT_KEY_MISS NUM_MATERIALS
+#define SORT_KEY_DONE (NUM_MATERIALS + 1)
+#define NUM_SORT_KEYS (NUM_MATERIALS + 2)
+
+// A path being traced in the sorted mode, in scalar layout.
+struct PathState
+{
+  vec3  origin;      // Origin of the next segment
+  uint  rngState;    // State of the random number generator
+  vec3  direction;   // Direction of the next segment
+  float wavelength;  // --color spectral only: the hero wavelength in nanometers, negated once the path
+                     // dispersed (see loadPathWavelengths in wavefrontCommon.h)
+  vec4  throughput;  // Product of the colors of the surfaces the path hit so far, in .rgb; with
+                     // --color spectral, at its wavelengths until it reaches the sky, then in .rgb
+  float hitT;        // Distance to the hit the classify pass found
+};
+
+struct SortCounters
+{
+  uint counts[NUM_SORT_KEYS];   // Paths with each sort key, counted by the classify pass
+  uint cursors[NUM_SORT_KEYS];  // Paths with each sort key placed by the scatter pass so far
+};
+
+// Specialization constant IDs of the ray generation shader; see TraceConfig in main.cpp.
+// The closest-hit shaders only get SPEC_CONSTANT_SPECTRAL.
+#define SPEC_CONSTANT_NUM_SAMPLES 0
+#define SPEC_CONSTANT_MAX_SEGMENTS 1
+#define SPEC_CONSTANT_SPECTRAL 2
+
+// With --color spectral, each path carries 4 wavelengths in this range, in
+// nanometers (see tracingCommon.h).
+#define SPECTRAL_MIN_WAVELENGTH 380.0f
+#define SPECTRAL_MAX_WAVELENGTH 780.0f
+
 #define BINDING_IMAGEDATA 0
-#define BINDING_TLAS 1
+#define BINDING_TLAS 1  // NUM_TLAS_SLOTS TLASes
 #define BINDING_VERTICES 2
 #define BINDING_INDICES 3
+#define BINDING_SUBMIT_PARAMS 4
+// Only used with --reorder sort:
+#define BINDING_PATHS 5          // PathState of each path of the wave
+#define BINDING_SORT_KEYS 6      // Sort key of each path
+#define BINDING_SORTED_PATHS 7   // Indices of the paths to shade, ordered by sort key
+#define BINDING_SORT_COUNTERS 8  // SortCounters
+#define BINDING_PIXEL_SUMS 9     // Sum of the finished paths of each pixel of the tile, over the waves so far
+// Adaptive sampling, not used with --reorder sort:
+#define BINDING_VARIANCE 10       // Per pixel of the tile: mean and M2 of the luminance of its sample batches, and their count
+#define BINDING_ACTIVE_PIXELS 11  // Indices in the tile, row by row, of the pixels to trace
+#define BINDING_TRACE_ARGS 12     // TraceArgs of each submit slot
+// Used by all modes:
+#define BINDING_JOBS 13           // JobParams of each job
+#define BINDING_MODELS 14         // ModelRange of each model
 
 #endif // #ifndef VK_MINI_PATH_TRACER_COMMON_H
\ No newline at end of file
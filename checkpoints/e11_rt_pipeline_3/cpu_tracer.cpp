@@ -0,0 +1,643 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "cpu_tracer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <numeric>
+#include <utility>
+
+#include "shaders/tracingCommon.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define CPU_TRACER_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Largest number of primitives in a leaf of a BVH
+const uint32_t k_maxLeafSize = 4;
+// The SAH candidates of a split are the borders between this many bins of the centroids
+const uint32_t k_numSahBins = 16;
+// Past this depth, ranges are split at their median, so the depth stays
+// within what the traversal stack holds even for degenerate geometry
+const uint32_t k_maxSahDepth = 48;
+// Each node traversed pushes at most 3 of its children; this is enough for
+// k_maxSahDepth levels of SAH splits and the median splits of 2^32 primitives
+const uint32_t k_traversalStackSize = 256;
+// A tile is traced in blocks of k_blockSize x k_blockSize pixels, whose
+// paths start close together, so they share more of the BVHs in the caches
+const uint32_t k_blockSize = 8;
+
+glm::vec3 loadVertex(const float* vertices, uint32_t index)
+{
+  return glm::vec3(vertices[3 * index + 0], vertices[3 * index + 1], vertices[3 * index + 2]);
+}
+
+Bvh4::Node makeEmptyNode()
+{
+  Bvh4::Node node;
+  for(uint32_t i = 0; i < 4; i++)
+  {
+    node.minX[i] = node.minY[i] = node.minZ[i] = INFINITY;
+    node.maxX[i] = node.maxY[i] = node.maxZ[i] = INFINITY;
+    node.first[i]                              = 0;
+    node.count[i]                              = 0;
+  }
+  return node;
+}
+
+// Splits primitives [begin, end) of `order` in two, and returns where the
+// second part starts. With `useSah`, at the bin border along the longest
+// axis of their centroids with the lowest surface area heuristic; at the
+// median along that axis otherwise, or if the SAH doesn't separate them.
+uint32_t splitRange(const std::vector<Aabb>&      bounds,
+                    const std::vector<glm::vec3>& centroids,
+                    std::vector<uint32_t>&        order,
+                    uint32_t                      begin,
+                    uint32_t                      end,
+                    bool                          useSah)
+{
+  Aabb centroidBounds;
+  for(uint32_t i = begin; i < end; i++)
+  {
+    centroidBounds.grow(centroids[order[i]]);
+  }
+  const glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+  const int       axis   = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+  const uint32_t  median = begin + (end - begin) / 2;
+  if(extent[axis] <= 0.0f)
+  {
+    return median;  // All centroids are at the same spot; any split is as good
+  }
+
+  if(useSah)
+  {
+    const float binScale = float(k_numSahBins) / extent[axis];
+    const auto  binOf    = [&](uint32_t primitive) {
+      return std::min(k_numSahBins - 1, uint32_t((centroids[primitive][axis] - centroidBounds.min[axis]) * binScale));
+    };
+    std::array<Aabb, k_numSahBins>     binBounds;
+    std::array<uint32_t, k_numSahBins> binCounts{};
+    for(uint32_t i = begin; i < end; i++)
+    {
+      const uint32_t bin = binOf(order[i]);
+      binBounds[bin].grow(bounds[order[i]]);
+      binCounts[bin]++;
+    }
+    // Sweep from the right for the cost of the primitives right of each border,
+    // then from the left for the total
+    std::array<float, k_numSahBins> rightCosts{};
+    Aabb                            rightBounds;
+    uint32_t                        rightCount = 0;
+    for(uint32_t bin = k_numSahBins - 1; bin > 0; bin--)
+    {
+      rightBounds.grow(binBounds[bin]);
+      rightCount += binCounts[bin];
+      rightCosts[bin] = (rightCount == 0) ? INFINITY : rightBounds.getArea() * float(rightCount);
+    }
+    Aabb     leftBounds;
+    uint32_t leftCount = 0;
+    float    bestCost  = INFINITY;
+    uint32_t bestBin   = 0;
+    for(uint32_t bin = 1; bin < k_numSahBins; bin++)
+    {
+      leftBounds.grow(binBounds[bin - 1]);
+      leftCount += binCounts[bin - 1];
+      const float cost = (leftCount == 0) ? INFINITY : leftBounds.getArea() * float(leftCount) + rightCosts[bin];
+      if(cost < bestCost)
+      {
+        bestCost = cost;
+        bestBin  = bin;
+      }
+    }
+    if(bestBin > 0)
+    {
+      const auto     split = std::partition(order.begin() + begin, order.begin() + end,
+                                            [&](uint32_t primitive) { return binOf(primitive) < bestBin; });
+      const uint32_t mid   = static_cast<uint32_t>(split - order.begin());
+      if(mid > begin && mid < end)
+      {
+        return mid;
+      }
+    }
+  }
+
+  std::nth_element(order.begin() + begin, order.begin() + median, order.begin() + end,
+                   [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+  return median;
+}
+
+// Returns the mask of the boxes of `node` that a ray enters before tMax,
+// and where it enters each one in tNear
+uint32_t intersectBoxes(const Bvh4::Node& node, const glm::vec3& origin, const glm::vec3& invDirection, float tMax, float* tNear)
+{
+#ifdef CPU_TRACER_SSE
+  const __m128 originX = _mm_set1_ps(origin.x);
+  const __m128 originY = _mm_set1_ps(origin.y);
+  const __m128 originZ = _mm_set1_ps(origin.z);
+  const __m128 invDirX = _mm_set1_ps(invDirection.x);
+  const __m128 invDirY = _mm_set1_ps(invDirection.y);
+  const __m128 invDirZ = _mm_set1_ps(invDirection.z);
+  // Where the ray crosses the planes of the boxes' faces
+  const __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), originX), invDirX);
+  const __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), originX), invDirX);
+  const __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), originY), invDirY);
+  const __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), originY), invDirY);
+  const __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), originZ), invDirZ);
+  const __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), originZ), invDirZ);
+  const __m128 nearT = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                                  _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+  const __m128 farT  = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                                  _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)));
+  _mm_store_ps(tNear, nearT);
+  return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(nearT, farT)));
+#else
+  uint32_t mask = 0;
+  for(uint32_t i = 0; i < 4; i++)
+  {
+    const float t0x   = (node.minX[i] - origin.x) * invDirection.x;
+    const float t1x   = (node.maxX[i] - origin.x) * invDirection.x;
+    const float t0y   = (node.minY[i] - origin.y) * invDirection.y;
+    const float t1y   = (node.maxY[i] - origin.y) * invDirection.y;
+    const float t0z   = (node.minZ[i] - origin.z) * invDirection.z;
+    const float t1z   = (node.maxZ[i] - origin.z) * invDirection.z;
+    const float nearT = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), 0.0f));
+    const float farT  = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), tMax));
+    tNear[i]          = nearT;
+    mask |= (nearT <= farT) ? (1u << i) : 0u;
+  }
+  return mask;
+#endif
+}
+
+// Möller-Trumbore, for both sides of the triangle; returns whether the ray
+// hits it with t in [0, tMax)
+bool intersectTriangle(const glm::vec3& origin,
+                       const glm::vec3& direction,
+                       const glm::vec3& v0,
+                       const glm::vec3& e1,
+                       const glm::vec3& e2,
+                       float            tMax,
+                       float&           t,
+                       glm::vec2&       barycentrics)
+{
+  const glm::vec3 p   = glm::cross(direction, e2);
+  const float     det = glm::dot(e1, p);
+  if(det == 0.0f)
+  {
+    return false;  // Parallel to the triangle
+  }
+  const float     invDet = 1.0f / det;
+  const glm::vec3 s      = origin - v0;
+  const float     u      = glm::dot(s, p) * invDet;
+  if(u < 0.0f || u > 1.0f)
+  {
+    return false;
+  }
+  const glm::vec3 q = glm::cross(s, e1);
+  const float     v = glm::dot(direction, q) * invDet;
+  if(v < 0.0f || u + v > 1.0f)
+  {
+    return false;
+  }
+  t = glm::dot(e2, q) * invDet;
+  if(t < 0.0f || t >= tMax)
+  {
+    return false;
+  }
+  barycentrics = glm::vec2(u, v);
+  return true;
+}
+
+}  // namespace
+
+void Aabb::grow(const glm::vec3& point)
+{
+  min = glm::min(min, point);
+  max = glm::max(max, point);
+}
+
+void Aabb::grow(const Aabb& box)
+{
+  min = glm::min(min, box.min);
+  max = glm::max(max, box.max);
+}
+
+float Aabb::getArea() const
+{
+  const glm::vec3 extent = max - min;
+  if(extent.x < 0.0f || extent.y < 0.0f || extent.z < 0.0f)
+  {
+    return 0.0f;
+  }
+  return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+void Bvh4::build(const std::vector<Aabb>& bounds, std::vector<uint32_t>& order)
+{
+  nodes.clear();
+  order.resize(bounds.size());
+  std::iota(order.begin(), order.end(), 0u);
+  if(bounds.empty())
+  {
+    return;
+  }
+  std::vector<glm::vec3> centroids(bounds.size());
+  for(size_t i = 0; i < bounds.size(); i++)
+  {
+    centroids[i] = 0.5f * (bounds[i].min + bounds[i].max);
+  }
+  buildNode(bounds, centroids, order, 0, static_cast<uint32_t>(bounds.size()), 0);
+}
+
+uint32_t Bvh4::buildNode(const std::vector<Aabb>&      bounds,
+                         const std::vector<glm::vec3>& centroids,
+                         std::vector<uint32_t>&        order,
+                         uint32_t                      begin,
+                         uint32_t                      end,
+                         uint32_t                      depth)
+{
+  // Split the range in two, and then the larger parts again, into up to 4
+  // children; the ones that are small enough become leaves.
+  std::array<std::pair<uint32_t, uint32_t>, 4> ranges;
+  uint32_t                                     numRanges = 1;
+  ranges[0]                                              = {begin, end};
+  while(numRanges < 4)
+  {
+    uint32_t largest     = numRanges;
+    uint32_t largestSize = k_maxLeafSize;
+    for(uint32_t r = 0; r < numRanges; r++)
+    {
+      const uint32_t size = ranges[r].second - ranges[r].first;
+      if(size > largestSize)
+      {
+        largest     = r;
+        largestSize = size;
+      }
+    }
+    if(largest == numRanges)
+    {
+      break;
+    }
+    const uint32_t mid = splitRange(bounds, centroids, order, ranges[largest].first, ranges[largest].second, depth < k_maxSahDepth);
+    ranges[numRanges++]    = {mid, ranges[largest].second};
+    ranges[largest].second = mid;
+  }
+
+  const uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+  nodes.push_back(makeEmptyNode());
+  for(uint32_t r = 0; r < numRanges; r++)
+  {
+    const auto [first, last] = ranges[r];
+    Aabb box;
+    for(uint32_t i = first; i < last; i++)
+    {
+      box.grow(bounds[order[i]]);
+    }
+    // The recursion grows `nodes`, so don't hold a reference to this one across it
+    uint32_t child = first;
+    uint32_t count = last - first;
+    if(count > k_maxLeafSize)
+    {
+      child = buildNode(bounds, centroids, order, first, last, depth + 1);
+      count = 0;
+    }
+    Node& node    = nodes[nodeIndex];
+    node.minX[r]  = box.min.x;
+    node.minY[r]  = box.min.y;
+    node.minZ[r]  = box.min.z;
+    node.maxX[r]  = box.max.x;
+    node.maxY[r]  = box.max.y;
+    node.maxZ[r]  = box.max.z;
+    node.first[r] = child;
+    node.count[r] = count;
+  }
+  return nodeIndex;
+}
+
+CpuTracer::Ray::Ray(const glm::vec3& rayOrigin, const glm::vec3& rayDirection)
+    : origin(rayOrigin)
+    , direction(rayDirection)
+{
+  // A zero component would make 0 * infinity = NaN in the slab tests
+  for(int i = 0; i < 3; i++)
+  {
+    const float d   = (std::abs(direction[i]) > 1e-20f) ? direction[i] : std::copysign(1e-20f, direction[i]);
+    invDirection[i] = 1.0f / d;
+  }
+}
+
+void CpuTracer::init(const std::vector<MeshCacheView>& models, const Config& config, uint32_t numThreads)
+{
+  m_config = config;
+  m_exit   = false;
+  for(uint32_t i = 1; i < numThreads; i++)
+  {
+    m_threads.emplace_back(&CpuTracer::workerLoop, this);
+  }
+
+  // The models' BVHs are built on all threads, one model per task
+  m_models.resize(models.size());
+  parallelFor(static_cast<uint32_t>(models.size()), [&](uint32_t m) {
+    const MeshCacheView& mesh         = models[m];
+    Model&               model        = m_models[m];
+    const float*         vertices     = static_cast<const float*>(mesh.vertices);
+    const uint32_t       numTriangles = static_cast<uint32_t>(mesh.indexCount / 3);
+    std::vector<Triangle> triangles(numTriangles);
+    std::vector<Aabb>     bounds(numTriangles);
+    for(uint32_t t = 0; t < numTriangles; t++)
+    {
+      const glm::vec3 v0 = loadVertex(vertices, mesh.indices[3 * t + 0]);
+      const glm::vec3 v1 = loadVertex(vertices, mesh.indices[3 * t + 1]);
+      const glm::vec3 v2 = loadVertex(vertices, mesh.indices[3 * t + 2]);
+      triangles[t]       = {.v0 = v0, .e1 = v1 - v0, .e2 = v2 - v0, .primitiveID = t};
+      bounds[t].grow(v0);
+      bounds[t].grow(v1);
+      bounds[t].grow(v2);
+      model.bounds.grow(bounds[t]);
+    }
+    std::vector<uint32_t> order;
+    model.bvh.build(bounds, order);
+    model.triangles.reserve(numTriangles);
+    for(uint32_t t : order)
+    {
+      model.triangles.push_back(triangles[t]);
+    }
+  });
+}
+
+void CpuTracer::deinit()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_exit = true;
+  }
+  m_taskReady.notify_all();
+  for(std::thread& thread : m_threads)
+  {
+    thread.join();
+  }
+  m_threads.clear();
+  m_models.clear();
+  m_instances.clear();
+  m_instanceBvh.nodes.clear();
+}
+
+void CpuTracer::setInstances(const std::vector<SceneInstance>& instances, uint32_t animationFrame)
+{
+  std::vector<Instance> unordered;
+  std::vector<Aabb>     bounds;
+  for(const SceneInstance& sceneInstance : instances)
+  {
+    const Model& model = m_models[sceneInstance.model];
+    if(model.triangles.empty())
+    {
+      continue;  // There's nothing to hit
+    }
+    const glm::mat4 objectToWorld = getInstanceTransform(sceneInstance, animationFrame);
+    const glm::mat4 worldToObject = glm::inverse(objectToWorld);
+    unordered.push_back({.worldToObject = worldToObject,
+                         .objectToWorld = objectToWorld,
+                         .normalToWorld = glm::transpose(glm::mat3(worldToObject)),
+                         .model         = sceneInstance.model,
+                         .material      = sceneInstance.material});
+    // The box around the corners of the model's box
+    Aabb& box = bounds.emplace_back();
+    for(uint32_t corner = 0; corner < 8; corner++)
+    {
+      const glm::vec3 objectCorner((corner & 1) ? model.bounds.max.x : model.bounds.min.x,
+                                   (corner & 2) ? model.bounds.max.y : model.bounds.min.y,
+                                   (corner & 4) ? model.bounds.max.z : model.bounds.min.z);
+      box.grow(glm::vec3(objectToWorld * glm::vec4(objectCorner, 1.0f)));
+    }
+  }
+  std::vector<uint32_t> order;
+  m_instanceBvh.build(bounds, order);
+  m_instances.clear();
+  m_instances.reserve(order.size());
+  for(uint32_t i : order)
+  {
+    m_instances.push_back(unordered[i]);
+  }
+}
+
+template <typename IntersectLeaf>
+void CpuTracer::traverse(const Bvh4& bvh, const Ray& ray, float& tMax, IntersectLeaf&& intersectLeaf)
+{
+  if(bvh.nodes.empty())
+  {
+    return;
+  }
+  std::array<uint32_t, k_traversalStackSize> stack;
+  uint32_t                                   stackSize = 0;
+  stack[stackSize++]                                   = 0;
+  while(stackSize > 0)
+  {
+    const Bvh4::Node& node = bvh.nodes[stack[--stackSize]];
+    alignas(16) float tNear[4];
+    const uint32_t    hitMask = intersectBoxes(node, ray.origin, ray.invDirection, tMax, tNear);
+    // Leaves are intersected right away; the inner nodes are sorted by
+    // distance and pushed farthest first, so that the nearest one is next
+    std::array<uint32_t, 4> inner;
+    uint32_t                numInner = 0;
+    for(uint32_t i = 0; i < 4; i++)
+    {
+      if((hitMask & (1u << i)) == 0)
+      {
+        continue;
+      }
+      if(node.count[i] > 0)
+      {
+        intersectLeaf(node.first[i], node.count[i], tMax);
+        continue;
+      }
+      uint32_t j = numInner++;
+      for(; j > 0 && tNear[inner[j - 1]] < tNear[i]; j--)
+      {
+        inner[j] = inner[j - 1];
+      }
+      inner[j] = i;
+    }
+    for(uint32_t j = 0; j < numInner; j++)
+    {
+      // A leaf may have found a hit closer than the box since
+      if(tNear[inner[j]] <= tMax)
+      {
+        assert(stackSize < k_traversalStackSize);
+        stack[stackSize++] = node.first[inner[j]];
+      }
+    }
+  }
+}
+
+bool CpuTracer::intersect(const Ray& ray, float tMax, Hit& hit) const
+{
+  bool found = false;
+  traverse(m_instanceBvh, ray, tMax, [&](uint32_t firstInstance, uint32_t numInstances, float& instanceTMax) {
+    for(uint32_t i = firstInstance; i < firstInstance + numInstances; i++)
+    {
+      const Instance& instance = m_instances[i];
+      const Model&    model    = m_models[instance.model];
+      // The direction isn't normalized in object space, so t is the same as in world space
+      const Ray objectRay(glm::vec3(instance.worldToObject * glm::vec4(ray.origin, 1.0f)),
+                          glm::mat3(instance.worldToObject) * ray.direction);
+      traverse(model.bvh, objectRay, instanceTMax, [&](uint32_t firstTriangle, uint32_t numTriangles, float& triangleTMax) {
+        for(uint32_t t = firstTriangle; t < firstTriangle + numTriangles; t++)
+        {
+          const Triangle& triangle = model.triangles[t];
+          float           hitT;
+          glm::vec2       barycentrics;
+          if(intersectTriangle(objectRay.origin, objectRay.direction, triangle.v0, triangle.e1, triangle.e2, triangleTMax, hitT, barycentrics))
+          {
+            triangleTMax = hitT;
+            hit          = {.t = hitT, .barycentrics = barycentrics, .triangle = t, .instance = i};
+            found        = true;
+          }
+        }
+      });
+    }
+  });
+  return found;
+}
+
+glm::vec3 CpuTracer::tracePixel(const TileTrace& trace, uint32_t x, uint32_t y) const
+{
+  const glm::ivec2 resolution(trace.renderWidth, trace.renderHeight);
+  const glm::ivec2 pixel(x, y);
+  const bool       spectral = m_config.spectral;
+
+  glm::vec3 summedBatchColors(0.0f);
+  for(uint32_t sampleBatch = trace.firstBatch; sampleBatch < trace.firstBatch + trace.batchCount; sampleBatch++)
+  {
+    shading::PassableInfo pld{};
+    pld.rngState = (sampleBatch * trace.renderHeight + y) * trace.renderWidth + x;
+
+    glm::vec3 summedPixelColor(0.0f);
+    for(uint32_t sampleIdx = 0; sampleIdx < m_config.numSamples; sampleIdx++)
+    {
+      glm::vec3 rayOrigin, rayDirection;
+      shading::generateCameraRay(pixel, resolution, trace.job, pld.rngState, rayOrigin, rayDirection);
+
+      glm::vec4 accumulatedRayColor(1.0f);
+      glm::vec4 wavelengths(0.0f);
+      if(spectral)
+      {
+        wavelengths = shading::sampleWavelengths(pld.rngState);
+      }
+
+      for(uint32_t tracedSegments = 0; tracedSegments < m_config.maxSegments; tracedSegments++)
+      {
+        pld.wavelength = spectral ? wavelengths.x : 550.0f;
+        pld.dispersed  = false;
+
+        // The closest-hit shader of the instance's material, or the miss shader
+        Hit hit;
+        if(intersect(Ray(rayOrigin, rayDirection), 10000.0f, hit))
+        {
+          const Instance& instance = m_instances[hit.instance];
+          const Triangle& triangle = m_models[instance.model].triangles[hit.triangle];
+          shading::HitInfo hitInfo;
+          hitInfo.rayDirection   = rayDirection;
+          hitInfo.primitiveID    = static_cast<int>(triangle.primitiveID);
+          hitInfo.objectPosition = triangle.v0 + hit.barycentrics.x * triangle.e1 + hit.barycentrics.y * triangle.e2;
+          hitInfo.worldPosition  = glm::vec3(instance.objectToWorld * glm::vec4(hitInfo.objectPosition, 1.0f));
+          hitInfo.worldNormal    = glm::normalize(instance.normalToWorld * glm::cross(triangle.e1, triangle.e2));
+          hitInfo.frontFace      = glm::dot(hitInfo.worldNormal, rayDirection) < 0.0f;
+          hitInfo.worldNormal    = glm::faceforward(hitInfo.worldNormal, rayDirection, hitInfo.worldNormal);
+          shading::shadeMaterial(instance.material, hitInfo, pld);
+        }
+        else
+        {
+          pld.color     = glm::vec3(1.0f);
+          pld.rayHitSky = true;
+        }
+
+        shading::multiplySurfaceColor(accumulatedRayColor, wavelengths, pld, spectral);
+        if(pld.rayHitSky)
+        {
+          summedPixelColor += shading::skyRadiance(trace.job, rayDirection, accumulatedRayColor, wavelengths, spectral);
+          break;
+        }
+        rayOrigin    = pld.rayOrigin;
+        rayDirection = pld.rayDirection;
+      }
+    }
+    summedBatchColors += summedPixelColor / float(m_config.numSamples);
+  }
+  // The average of the batches, which the GPU backends blend one at a time
+  return summedBatchColors / float(std::max(trace.batchCount, 1u));
+}
+
+void CpuTracer::traceTile(const TileTrace& trace, float* pixels)
+{
+  const uint32_t blocksX = (trace.width + k_blockSize - 1) / k_blockSize;
+  const uint32_t blocksY = (trace.height + k_blockSize - 1) / k_blockSize;
+  parallelFor(blocksX * blocksY, [&](uint32_t block) {
+    const uint32_t x0 = (block % blocksX) * k_blockSize;
+    const uint32_t y0 = (block / blocksX) * k_blockSize;
+    for(uint32_t y = y0; y < std::min(y0 + k_blockSize, trace.height); y++)
+    {
+      for(uint32_t x = x0; x < std::min(x0 + k_blockSize, trace.width); x++)
+      {
+        const glm::vec3 color = tracePixel(trace, trace.x + x, trace.y + y);
+        float*          pixel = pixels + (size_t(y) * trace.width + x) * 4;
+        pixel[0]              = color.r;
+        pixel[1]              = color.g;
+        pixel[2]              = color.b;
+        pixel[3]              = 0.0f;
+      }
+    }
+  });
+}
+
+void CpuTracer::parallelFor(uint32_t count, const std::function<void(uint32_t)>& task)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_task        = &task;
+    m_taskCount   = count;
+    m_nextTask    = 0;
+    m_busyWorkers = static_cast<uint32_t>(m_threads.size());
+    m_generation++;
+  }
+  m_taskReady.notify_all();
+  runTasks();
+  // The tasks are all taken; wait for the workers to finish theirs
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_taskDone.wait(lock, [&] { return m_busyWorkers == 0; });
+  m_task = nullptr;
+}
+
+void CpuTracer::runTasks()
+{
+  for(uint32_t i = m_nextTask.fetch_add(1); i < m_taskCount; i = m_nextTask.fetch_add(1))
+  {
+    (*m_task)(i);
+  }
+}
+
+void CpuTracer::workerLoop()
+{
+  uint64_t generation = 0;
+  while(true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_taskReady.wait(lock, [&] { return m_exit || m_generation != generation; });
+      if(m_exit)
+      {
+        return;
+      }
+      generation = m_generation;
+    }
+    runTasks();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(--m_busyWorkers == 0)
+    {
+      m_taskDone.notify_one();
+    }
+  }
+}
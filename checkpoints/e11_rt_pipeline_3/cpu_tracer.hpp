@@ -0,0 +1,192 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// The CPU backend (--backend cpu), for render nodes without a GPU that can
+// trace rays, and as a reference to check the GPU backends against. It traces
+// the paths of the megakernel (raytraceCommon.h) with the same seeds, camera
+// rays and materials, so, up to rounding, it renders the same samples.
+// Each model gets a 4-wide BVH of its triangles, built once with binned SAH
+// splits, and the instances get one each frame of the animation; a ray is
+// tested against the 4 boxes of a node at once with SSE. A tile is split into
+// blocks of pixels, which a pool of threads takes from a shared counter.
+#ifndef VK_MINI_PATH_TRACER_CPU_TRACER_HPP
+#define VK_MINI_PATH_TRACER_CPU_TRACER_HPP
+
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "mesh_cache.hpp"
+#include "scene_file.hpp"
+
+// An axis-aligned bounding box; empty until it grows
+struct Aabb
+{
+  glm::vec3 min = glm::vec3(INFINITY);
+  glm::vec3 max = glm::vec3(-INFINITY);
+
+  void  grow(const glm::vec3& point);
+  void  grow(const Aabb& box);
+  float getArea() const;  // Of the surface, for the SAH; 0 if empty
+};
+
+// A bounding volume hierarchy with up to 4 children per node. The boxes of
+// the children are stored side by side per coordinate, so that SIMD code can
+// load each coordinate of all 4 with one instruction; unused slots have a
+// box at infinity, which no ray hits.
+struct Bvh4
+{
+  struct Node
+  {
+    alignas(16) float minX[4];
+    alignas(16) float minY[4];
+    alignas(16) float minZ[4];
+    alignas(16) float maxX[4];
+    alignas(16) float maxY[4];
+    alignas(16) float maxZ[4];
+    uint32_t first[4];  // Of a leaf, its first primitive in leaf order; of an inner node, the child's index
+    uint32_t count[4];  // Primitives of a leaf; 0 for an inner node or an unused slot
+  };
+
+  std::vector<Node> nodes;  // nodes[0] is the root; empty without primitives
+
+  // Builds the hierarchy of the primitives with `bounds`. `order` gets the
+  // primitives in the order of the leaves, which is how they're numbered.
+  void build(const std::vector<Aabb>& bounds, std::vector<uint32_t>& order);
+
+private:
+  uint32_t buildNode(const std::vector<Aabb>&      bounds,
+                     const std::vector<glm::vec3>& centroids,
+                     std::vector<uint32_t>&        order,
+                     uint32_t                      begin,
+                     uint32_t                      end,
+                     uint32_t                      depth);
+};
+
+class CpuTracer
+{
+public:
+  // The parameters of the trace that the GPU backends specialize their shaders with (see TraceConfig)
+  struct Config
+  {
+    uint32_t numSamples  = 64;  // Samples per pixel in each sample batch
+    uint32_t maxSegments = 32;  // Maximum number of segments traced per sample
+    bool     spectral    = false;
+  };
+
+  // Sample batches [firstBatch, firstBatch + batchCount) of the pixels of a
+  // tile, which starts at pixel (x, y) of a renderWidth x renderHeight image
+  struct TileTrace
+  {
+    JobParams job;
+    uint32_t  renderWidth  = 0;
+    uint32_t  renderHeight = 0;
+    uint32_t  x            = 0;
+    uint32_t  y            = 0;
+    uint32_t  width        = 0;
+    uint32_t  height       = 0;
+    uint32_t  firstBatch   = 0;
+    uint32_t  batchCount   = 0;
+  };
+
+  // Builds the BVHs of `models`, which must outlive the tracer, and starts
+  // numThreads - 1 threads; the thread that traces a tile is the last one.
+  void init(const std::vector<MeshCacheView>& models, const Config& config, uint32_t numThreads);
+  // Stops the threads.
+  void deinit();
+
+  // Builds the BVH of the instances, where they are in a frame of the
+  // animation (see getInstanceTransform)
+  void setInstances(const std::vector<SceneInstance>& instances, uint32_t animationFrame);
+  // Writes the average of the batches of each pixel of the tile to `pixels`,
+  // as RGBA32F with `width` pixels per row. The alpha channel is 0, as in
+  // the GPU backends' storage images.
+  void traceTile(const TileTrace& trace, float* pixels);
+
+  uint32_t getThreadCount() const { return static_cast<uint32_t>(m_threads.size()) + 1; }
+
+private:
+  // A triangle of a model, in leaf order, prepared for the intersection test
+  struct Triangle
+  {
+    glm::vec3 v0;
+    glm::vec3 e1;  // v1 - v0
+    glm::vec3 e2;  // v2 - v0
+    uint32_t  primitiveID;
+  };
+
+  struct Model
+  {
+    Bvh4                  bvh;
+    std::vector<Triangle> triangles;
+    Aabb                  bounds;
+  };
+
+  // An instance, in leaf order of the instances' BVH
+  struct Instance
+  {
+    glm::mat4 worldToObject;
+    glm::mat4 objectToWorld;
+    glm::mat3 normalToWorld;  // The transpose of the inverse of objectToWorld's linear part
+    uint32_t  model;
+    uint32_t  material;
+  };
+
+  struct Ray
+  {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    glm::vec3 invDirection;  // Of the direction, where zero components are replaced by tiny ones
+
+    Ray(const glm::vec3& rayOrigin, const glm::vec3& rayDirection);
+  };
+
+  struct Hit
+  {
+    float     t = 0.0f;
+    glm::vec2 barycentrics;  // Of the second and third vertices, like the GPU's hit attributes
+    uint32_t  triangle = 0;  // In the model's leaf order
+    uint32_t  instance = 0;
+  };
+
+  // Finds the closest hit of a world space ray with t in [0, tMax)
+  bool intersect(const Ray& ray, float tMax, Hit& hit) const;
+  // Calls intersectLeaf(first, count, tMax) for each leaf of `bvh` whose
+  // box the ray enters before tMax, nearest nodes first; a hit in a leaf
+  // lowers tMax.
+  template <typename IntersectLeaf>
+  static void traverse(const Bvh4& bvh, const Ray& ray, float& tMax, IntersectLeaf&& intersectLeaf);
+
+  glm::vec3 tracePixel(const TileTrace& trace, uint32_t x, uint32_t y) const;
+
+  // Calls task(i) for each i in [0, count) on all threads, and returns once all calls did
+  void parallelFor(uint32_t count, const std::function<void(uint32_t)>& task);
+  void runTasks();
+  void workerLoop();
+
+  Config                m_config;
+  std::vector<Model>    m_models;
+  std::vector<Instance> m_instances;
+  Bvh4                  m_instanceBvh;
+
+  std::vector<std::thread>             m_threads;
+  std::mutex                           m_mutex;
+  std::condition_variable              m_taskReady;  // A new parallelFor started, or the threads should exit
+  std::condition_variable              m_taskDone;   // The last worker finished its part
+  const std::function<void(uint32_t)>* m_task      = nullptr;
+  uint32_t                             m_taskCount = 0;
+  std::atomic<uint32_t>                m_nextTask{0};
+  uint64_t                             m_generation  = 0;  // Counts the parallelFor calls
+  uint32_t                             m_busyWorkers = 0;  // Workers still running tasks of the current call
+  bool                                 m_exit        = false;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_CPU_TRACER_HPP
@@ -0,0 +1,28 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "device_functions.hpp"
+
+#include <cassert>
+
+namespace {
+template <typename Function>
+void loadFunction(VkDevice device, const char* name, Function& function)
+{
+  function = reinterpret_cast<Function>(vkGetDeviceProcAddr(device, name));
+  assert(function != nullptr);
+}
+}  // namespace
+
+void DeviceFunctions::load(VkDevice device)
+{
+  loadFunction(device, "vkCreateAccelerationStructureKHR", createAccelerationStructureKHR);
+  loadFunction(device, "vkDestroyAccelerationStructureKHR", destroyAccelerationStructureKHR);
+  loadFunction(device, "vkGetAccelerationStructureBuildSizesKHR", getAccelerationStructureBuildSizesKHR);
+  loadFunction(device, "vkGetAccelerationStructureDeviceAddressKHR", getAccelerationStructureDeviceAddressKHR);
+  loadFunction(device, "vkCmdBuildAccelerationStructuresKHR", cmdBuildAccelerationStructuresKHR);
+  loadFunction(device, "vkCmdCopyAccelerationStructureKHR", cmdCopyAccelerationStructureKHR);
+  loadFunction(device, "vkCmdWriteAccelerationStructuresPropertiesKHR", cmdWriteAccelerationStructuresPropertiesKHR);
+  loadFunction(device, "vkGetRayTracingShaderGroupHandlesKHR", getRayTracingShaderGroupHandlesKHR);
+  loadFunction(device, "vkCmdTraceRaysKHR", cmdTraceRaysKHR);
+  loadFunction(device, "vkCmdTraceRaysIndirectKHR", cmdTraceRaysIndirectKHR);
+}
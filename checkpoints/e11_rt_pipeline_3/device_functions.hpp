@@ -0,0 +1,36 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// The commands of device extensions that the renderer calls, loaded for one
+// device with vkGetDeviceProcAddr. nvvk::Context loads them into globals
+// (nvvk/extensions_vk.hpp), from the last device it initialized; but a
+// function from vkGetDeviceProcAddr of one device mustn't be called with
+// another, and several devices render at once (see RenderDevice). So each
+// device loads its own table, and its thread calls through that instead.
+// Core commands, which the Vulkan loader exports, dispatch on their first
+// parameter and are safe to call with any device.
+#ifndef VK_MINI_PATH_TRACER_DEVICE_FUNCTIONS_HPP
+#define VK_MINI_PATH_TRACER_DEVICE_FUNCTIONS_HPP
+
+#include <vulkan/vulkan_core.h>
+
+struct DeviceFunctions
+{
+  // VK_KHR_acceleration_structure
+  PFN_vkCreateAccelerationStructureKHR              createAccelerationStructureKHR              = nullptr;
+  PFN_vkDestroyAccelerationStructureKHR             destroyAccelerationStructureKHR             = nullptr;
+  PFN_vkGetAccelerationStructureBuildSizesKHR       getAccelerationStructureBuildSizesKHR       = nullptr;
+  PFN_vkGetAccelerationStructureDeviceAddressKHR    getAccelerationStructureDeviceAddressKHR    = nullptr;
+  PFN_vkCmdBuildAccelerationStructuresKHR           cmdBuildAccelerationStructuresKHR           = nullptr;
+  PFN_vkCmdCopyAccelerationStructureKHR             cmdCopyAccelerationStructureKHR             = nullptr;
+  PFN_vkCmdWriteAccelerationStructuresPropertiesKHR cmdWriteAccelerationStructuresPropertiesKHR = nullptr;
+  // VK_KHR_ray_tracing_pipeline
+  PFN_vkGetRayTracingShaderGroupHandlesKHR getRayTracingShaderGroupHandlesKHR = nullptr;
+  PFN_vkCmdTraceRaysKHR                    cmdTraceRaysKHR                    = nullptr;
+  PFN_vkCmdTraceRaysIndirectKHR            cmdTraceRaysIndirectKHR            = nullptr;
+
+  // Loads the commands for `device`, which must have enabled their extensions.
+  void load(VkDevice device);
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_DEVICE_FUNCTIONS_HPP
@@ -0,0 +1,152 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "exr_writer.hpp"
+
+#include <cassert>
+#include <cstring>
+
+// OpenEXR files are little-endian.
+static void appendU32(std::vector<uint8_t>& out, uint32_t value)
+{
+  for(int i = 0; i < 4; i++)
+  {
+    out.push_back(uint8_t(value >> (8 * i)));
+  }
+}
+
+static void appendU64(std::vector<uint8_t>& out, uint64_t value)
+{
+  for(int i = 0; i < 8; i++)
+  {
+    out.push_back(uint8_t(value >> (8 * i)));
+  }
+}
+
+static void appendFloat(std::vector<uint8_t>& out, float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  appendU32(out, bits);
+}
+
+static void appendString(std::vector<uint8_t>& out, const char* str)
+{
+  out.insert(out.end(), str, str + strlen(str) + 1);  // Including the null terminator
+}
+
+// Appends an attribute's name, type and size; the caller then appends its value.
+static void appendAttributeHeader(std::vector<uint8_t>& out, const char* name, const char* type, uint32_t size)
+{
+  appendString(out, name);
+  appendString(out, type);
+  appendU32(out, size);
+}
+
+// The channels, in the alphabetical order OpenEXR requires, and the RGB
+// component of each one.
+static const char* const s_channelNames[3]      = {"B", "G", "R"};
+static const uint32_t    s_channelComponents[3] = {2, 1, 0};
+
+bool ExrScanlineWriter::open(const char* filename, uint32_t width, uint32_t height)
+{
+  close();
+#ifdef _WIN32
+  if(fopen_s(&m_file, filename, "wb") != 0)
+  {
+    m_file = nullptr;
+  }
+#else
+  m_file = fopen(filename, "wb");
+#endif
+  if(m_file == nullptr)
+  {
+    return false;
+  }
+
+  m_width       = width;
+  m_height      = height;
+  m_rowsWritten = 0;
+
+  std::vector<uint8_t> header;
+  appendU32(header, 20000630);  // Magic number
+  appendU32(header, 2);         // Version 2, single-part scanline file
+
+  // 3 channels of (name, pixel type, pLinear + reserved, x sampling, y sampling), then a null byte
+  appendAttributeHeader(header, "channels", "chlist", 3 * (2 + 16) + 1);
+  for(const char* channelName : s_channelNames)
+  {
+    appendString(header, channelName);
+    appendU32(header, 2);  // FLOAT
+    appendU32(header, 0);  // pLinear and reserved bytes
+    appendU32(header, 1);  // x sampling
+    appendU32(header, 1);  // y sampling
+  }
+  header.push_back(0);
+
+  appendAttributeHeader(header, "compression", "compression", 1);
+  header.push_back(0);  // NO_COMPRESSION
+  for(const char* windowName : {"dataWindow", "displayWindow"})
+  {
+    appendAttributeHeader(header, windowName, "box2i", 16);
+    appendU32(header, 0);
+    appendU32(header, 0);
+    appendU32(header, width - 1);
+    appendU32(header, height - 1);
+  }
+  appendAttributeHeader(header, "lineOrder", "lineOrder", 1);
+  header.push_back(0);  // INCREASING_Y
+  appendAttributeHeader(header, "pixelAspectRatio", "float", 4);
+  appendFloat(header, 1.0f);
+  appendAttributeHeader(header, "screenWindowCenter", "v2f", 8);
+  appendFloat(header, 0.0f);
+  appendFloat(header, 0.0f);
+  appendAttributeHeader(header, "screenWindowWidth", "float", 4);
+  appendFloat(header, 1.0f);
+  header.push_back(0);  // End of header
+
+  // Each chunk holds one scanline, and they all have the same size.
+  const uint64_t chunkSize   = 8 + uint64_t(width) * 3 * sizeof(float);
+  const uint64_t firstOffset = header.size() + uint64_t(height) * sizeof(uint64_t);
+  for(uint32_t y = 0; y < height; y++)
+  {
+    appendU64(header, firstOffset + y * chunkSize);
+  }
+  fwrite(header.data(), 1, header.size(), m_file);
+
+  m_chunk.reserve(size_t(chunkSize));
+  return true;
+}
+
+void ExrScanlineWriter::writeRows(const float* pixels, uint32_t numRows, uint32_t numComponents, size_t rowStride)
+{
+  assert(m_file != nullptr);
+  assert(numComponents >= 3);
+  assert(m_rowsWritten + numRows <= m_height);
+
+  for(uint32_t row = 0; row < numRows; row++)
+  {
+    const float* rowPixels = pixels + row * rowStride;
+    m_chunk.clear();
+    appendU32(m_chunk, m_rowsWritten + row);
+    appendU32(m_chunk, m_width * 3 * uint32_t(sizeof(float)));
+    for(uint32_t component : s_channelComponents)
+    {
+      for(uint32_t x = 0; x < m_width; x++)
+      {
+        appendFloat(m_chunk, rowPixels[size_t(x) * numComponents + component]);
+      }
+    }
+    fwrite(m_chunk.data(), 1, m_chunk.size(), m_file);
+  }
+
+  m_rowsWritten += numRows;
+}
+
+void ExrScanlineWriter::close()
+{
+  if(m_file != nullptr)
+  {
+    fclose(m_file);
+    m_file = nullptr;
+  }
+}
@@ -0,0 +1,41 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Writes uncompressed scanline OpenEXR files a few scanlines at a time.
+// Without compression every scanline chunk has the same size, so the offset
+// table at the start of the file can be written before any pixels are known,
+// and rows can be streamed out in order like with HdrScanlineWriter.
+#ifndef VK_MINI_PATH_TRACER_EXR_WRITER_HPP
+#define VK_MINI_PATH_TRACER_EXR_WRITER_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+class ExrScanlineWriter
+{
+public:
+  ~ExrScanlineWriter() { close(); }
+
+  // Creates `filename` and writes the header and offset table for a
+  // `width` x `height` image with 32-bit float R, G, and B channels.
+  // Returns false if the file couldn't be opened.
+  bool open(const char* filename, uint32_t width, uint32_t height);
+
+  // Appends `numRows` scanlines. Row r starts at `pixels + r * rowStride`, and
+  // each pixel consists of `numComponents` floats, of which the first 3 are RGB.
+  void writeRows(const float* pixels, uint32_t numRows, uint32_t numComponents, size_t rowStride);
+
+  void close();
+
+  uint32_t getRowsWritten() const { return m_rowsWritten; }
+
+private:
+  FILE*                m_file = nullptr;
+  uint32_t             m_width{0};
+  uint32_t             m_height{0};
+  uint32_t             m_rowsWritten{0};
+  std::vector<uint8_t> m_chunk;  // One scanline chunk: y, data size, then the B, G, and R planes
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_EXR_WRITER_HPP
@@ -0,0 +1,142 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "hdr_writer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// Converts a linear RGB color to the shared-exponent RGBE format used by .hdr files.
+static void linearToRGBE(const float* rgb, uint8_t* rgbe)
+{
+  const float maxComponent = std::max(rgb[0], std::max(rgb[1], rgb[2]));
+  if(!(maxComponent >= 1e-32f))  // Also catches NaNs
+  {
+    rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+    return;
+  }
+  int         exponent;
+  const float normalize = float(std::frexp(maxComponent, &exponent)) * 256.0f / maxComponent;
+  for(int c = 0; c < 3; c++)
+  {
+    rgbe[c] = uint8_t(std::clamp(rgb[c] * normalize, 0.0f, 255.0f));
+  }
+  rgbe[3] = uint8_t(exponent + 128);
+}
+
+bool HdrScanlineWriter::open(const char* filename, uint32_t width, uint32_t height)
+{
+  close();
+#ifdef _WIN32
+  if(fopen_s(&m_file, filename, "wb") != 0)
+  {
+    m_file = nullptr;
+  }
+#else
+  m_file = fopen(filename, "wb");
+#endif
+  if(m_file == nullptr)
+  {
+    return false;
+  }
+
+  m_width       = width;
+  m_height      = height;
+  m_rowsWritten = 0;
+  m_rgbeRow.resize(size_t(width) * 4);
+  m_encodedRow.reserve(size_t(width) * 4 + 4);
+
+  fprintf(m_file, "#?RADIANCE\n# Written by vk_mini_path_tracer\nFORMAT=32-bit_rle_rgbe\n");
+  fprintf(m_file, "EXPOSURE=          1.0000000000000\n\n-Y %u +X %u\n", height, width);
+  return true;
+}
+
+void HdrScanlineWriter::writeRows(const float* pixels, uint32_t numRows, uint32_t numComponents, size_t rowStride)
+{
+  assert(m_file != nullptr);
+  assert(numComponents >= 3);
+  assert(m_rowsWritten + numRows <= m_height);
+
+  for(uint32_t row = 0; row < numRows; row++)
+  {
+    const float* rowPixels = pixels + row * rowStride;
+    for(uint32_t x = 0; x < m_width; x++)
+    {
+      linearToRGBE(rowPixels + size_t(x) * numComponents, &m_rgbeRow[size_t(x) * 4]);
+    }
+
+    // The new-style run-length encoding only supports widths in [8, 32767];
+    // use flat scanlines otherwise.
+    if(m_width < 8 || m_width > 32767)
+    {
+      fwrite(m_rgbeRow.data(), 1, m_rgbeRow.size(), m_file);
+      continue;
+    }
+
+    // Each component is run-length encoded separately. Runs of identical bytes
+    // are stored as (128 + length, value), and everything else as (length, values...).
+    m_encodedRow.clear();
+    m_encodedRow.insert(m_encodedRow.end(), {2, 2, uint8_t(m_width >> 8), uint8_t(m_width & 255)});
+    for(uint32_t c = 0; c < 4; c++)
+    {
+      auto component = [&](uint32_t x) { return m_rgbeRow[size_t(x) * 4 + c]; };
+
+      uint32_t x = 0;
+      while(x < m_width)
+      {
+        // Find the start of the next run of at least 3 identical values:
+        uint32_t runStart = x;
+        while(runStart + 2 < m_width
+              && !(component(runStart) == component(runStart + 1) && component(runStart) == component(runStart + 2)))
+        {
+          runStart++;
+        }
+        if(runStart + 2 >= m_width)
+        {
+          runStart = m_width;
+        }
+
+        // Dump the values up to the run:
+        while(x < runStart)
+        {
+          const uint32_t length = std::min(runStart - x, 128u);
+          m_encodedRow.push_back(uint8_t(length));
+          for(uint32_t i = 0; i < length; i++)
+          {
+            m_encodedRow.push_back(component(x + i));
+          }
+          x += length;
+        }
+
+        // Then write the run, if there is one:
+        if(runStart < m_width)
+        {
+          uint32_t runEnd = runStart;
+          while(runEnd < m_width && component(runEnd) == component(runStart))
+          {
+            runEnd++;
+          }
+          while(x < runEnd)
+          {
+            const uint32_t length = std::min(runEnd - x, 127u);
+            m_encodedRow.push_back(uint8_t(128 + length));
+            m_encodedRow.push_back(component(runStart));
+            x += length;
+          }
+        }
+      }
+    }
+    fwrite(m_encodedRow.data(), 1, m_encodedRow.size(), m_file);
+  }
+
+  m_rowsWritten += numRows;
+}
+
+void HdrScanlineWriter::close()
+{
+  if(m_file != nullptr)
+  {
+    fclose(m_file);
+    m_file = nullptr;
+  }
+}
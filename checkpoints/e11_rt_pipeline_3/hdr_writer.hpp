@@ -0,0 +1,41 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Writes Radiance .hdr files a few scanlines at a time.
+// stbi_write_hdr needs the whole image in memory at once; this writer lets the
+// tiled renderer stream out each row of tiles as soon as it's done, so that
+// host memory scales with the tile size instead of with the frame size.
+#ifndef VK_MINI_PATH_TRACER_HDR_WRITER_HPP
+#define VK_MINI_PATH_TRACER_HDR_WRITER_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+class HdrScanlineWriter
+{
+public:
+  ~HdrScanlineWriter() { close(); }
+
+  // Creates `filename` and writes the header for a `width` x `height` image.
+  // Returns false if the file couldn't be opened.
+  bool open(const char* filename, uint32_t width, uint32_t height);
+
+  // Appends `numRows` scanlines. Row r starts at `pixels + r * rowStride`, and
+  // each pixel consists of `numComponents` floats, of which the first 3 are RGB.
+  void writeRows(const float* pixels, uint32_t numRows, uint32_t numComponents, size_t rowStride);
+
+  void close();
+
+  uint32_t getRowsWritten() const { return m_rowsWritten; }
+
+private:
+  FILE*                m_file = nullptr;
+  uint32_t             m_width{0};
+  uint32_t             m_height{0};
+  uint32_t             m_rowsWritten{0};
+  std::vector<uint8_t> m_rgbeRow;     // RGBE values of one scanline, component-interleaved
+  std::vector<uint8_t> m_encodedRow;  // Run-length encoded scanline
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_HDR_WRITER_HPP
@@ -1,28 +1,162 @@
 // Copyright 2020-2024 NVIDIA Corporation
 // SPDX-License-Identifier: Apache-2.0
+#include <algorithm>
 #include <array>
-#include <random>
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <stb_image_write.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
 #include <glm/glm.hpp>
-#include <glm/gtx/transform.hpp>
 #include <nvh/fileoperations.hpp>  // For nvh::loadFile
 #include <nvvk/context_vk.hpp>
 #include <nvvk/descriptorsets_vk.hpp>  // For nvvk::DescriptorSetContainer
 #include <nvvk/error_vk.hpp>
 #include <nvvk/images_vk.hpp>
-#include <nvvk/raytraceKHR_vk.hpp>        // For nvvk::RaytracingBuilderKHR
+#include <nvvk/raytraceKHR_vk.hpp>        // For nvvk::toTransformMatrixKHR
 #include <nvvk/resourceallocator_vk.hpp>  // For NVVK memory allocators
 #include <nvvk/shaders_vk.hpp>            // For nvvk::createShaderModule
 
 #include "common.h"
+#include "cpu_tracer.hpp"
+#include "device_functions.hpp"
+#include "gpu_profiler.hpp"
+#include "mesh_cache.hpp"
+#include "obj_parser.hpp"
+#include "output_writer.hpp"
+#include "pipeline_cache.hpp"
+#include "pipeline_compiler.hpp"
+#include "render_farm.hpp"
+#include "render_server.hpp"
+#include "scene_file.hpp"
+#include "tile_scheduler.hpp"
+#include "tlas_ring.hpp"
 
-PushConstants  pushConstants;
-const uint32_t render_width  = 800;
-const uint32_t render_height = 600;
+// Selected with --resolution <width>x<height>
+uint32_t render_width  = 800;
+uint32_t render_height = 600;
+
+// The image is rendered as a sequence of tile_width x tile_height tiles, in
+// row-major order. Each vkCmdTraceRaysKHR call covers a single tile, and GPU
+// image memory only scales with the tile size. Once a row of tiles is done,
+// it's written out to the output file.
+const uint32_t tile_width  = TILE_WIDTH;
+const uint32_t tile_height = TILE_HEIGHT;
+
+// The sample batch loop submits NUM_SAMPLE_BATCHES / BATCHES_PER_SUBMIT times,
+// cycling through NUM_CMD_BUFFERS_IN_FLIGHT command buffers that are recorded once.
+const uint32_t NUM_SAMPLE_BATCHES        = 32;
+const uint32_t BATCHES_PER_SUBMIT        = 4;
+const uint32_t NUM_CMD_BUFFERS_IN_FLIGHT = 3;
+static_assert(NUM_SAMPLE_BATCHES % BATCHES_PER_SUBMIT == 0, "NUM_SAMPLE_BATCHES must be a multiple of BATCHES_PER_SUBMIT!");
+// The formats the storage image can have. It holds the running average of the
+// tile's samples and is read back as-is, so smaller formats reduce memory
+// bandwidth and readback size, at the cost of precision (and range, for
+// B10G11R11). Selected with --format <name>.
+struct StorageFormat
+{
+  const char*               name;
+  VkFormat                  format;
+  const char*               rgenShader;  // Declares the storage image with a matching format qualifier
+  const char*               rgenReorderShader;  // rgenShader, with --reorder ser
+  const char*               resolveShader;      // Writes the storage image with --reorder sort
+  const char*               queryShader;        // rgenShader as a compute shader, with --backend query
+  OutputWriter::PixelFormat pixelFormat;
+};
+const StorageFormat storage_formats[] = {
+    {"rgba32f", VK_FORMAT_R32G32B32A32_SFLOAT, "shaders/raytrace.rgen.glsl.spv", "shaders/raytrace_reorder.rgen.glsl.spv",
+     "shaders/resolve.comp.glsl.spv", "shaders/raytrace_query.comp.glsl.spv", OutputWriter::PIXEL_FORMAT_RGBA32F},
+    {"rgba16f", VK_FORMAT_R16G16B16A16_SFLOAT, "shaders/raytrace_rgba16f.rgen.glsl.spv",
+     "shaders/raytrace_rgba16f_reorder.rgen.glsl.spv", "shaders/resolve_rgba16f.comp.glsl.spv",
+     "shaders/raytrace_query_rgba16f.comp.glsl.spv", OutputWriter::PIXEL_FORMAT_RGBA16F},
+    {"r11g11b10f", VK_FORMAT_B10G11R11_UFLOAT_PACK32, "shaders/raytrace_r11g11b10f.rgen.glsl.spv",
+     "shaders/raytrace_r11g11b10f_reorder.rgen.glsl.spv", "shaders/resolve_r11g11b10f.comp.glsl.spv",
+     "shaders/raytrace_query_r11g11b10f.comp.glsl.spv", OutputWriter::PIXEL_FORMAT_B10G11R11F}};
+
+// Instances get random materials, so without reordering, neighboring rays
+// run different closest-hit shaders and the GPU's SIMD lanes diverge. How
+// rays are regrouped by material before shading is selected with
+// --reorder <name>.
+enum class ReorderMode
+{
+  eOff,                // "off": each invocation shades what its own ray hits
+  eInvocationReorder,  // "ser": the ray generation shader reorders invocations by hit object and
+                       // material before shading, using VK_NV_ray_tracing_invocation_reorder
+  eSort                // "sort": the fallback; each segment is traced in a wavefront of passes: a ray
+                       // query pass finds the hits, the paths are sorted by material, and then shaded
+};
+
+// How the megakernel traces and shades its rays. Both GPU backends shade
+// with the materials of shared/shaders/shadingLibrary.h, so they render the same
+// image; which one is faster depends on the GPU and the scene, so it's
+// selected with --backend <name>. The CPU backend traces the same paths
+// without a GPU (see cpu_tracer.hpp).
+enum class TraceBackend
+{
+  ePipeline,  // "pipeline": the ray tracing pipeline, with a closest-hit shader per material
+  eRayQuery,  // "query": a compute shader that traces with ray queries and shades inline
+              // (VK_KHR_ray_query); it doesn't reorder rays by material
+  eCpu        // "cpu": all cores of the host, with no Vulkan device; for render nodes without
+              // a GPU that can trace rays, and as a reference for the GPU backends
+};
+
+// Parameters of the trace kernel that are baked into the ray generation shader
+// as specialization constants, so that the driver can unroll and constant-fold
+// its loops for each configuration. Selected with --samples and --segments.
+// --color spectral traces 4 wavelengths per path instead of RGB (see
+// tracingCommon.h); it specializes the closest-hit shaders too, so RGB renders
+// compile without any of it.
+struct TraceConfig
+{
+  uint32_t numSamples  = 64;     // Samples per pixel in each sample batch
+  uint32_t maxSegments = 32;     // Maximum number of segments traced per sample
+  VkBool32 spectral    = false;  // --color: "rgb" or "spectral"
+};
+
+// How often the frame is rendered, for benchmarking (see bench/bench.cpp):
+// the warmup frames render the first job and aren't timed; then each job of
+// the scene is rendered timedFrames times in a row, and only its last frame
+// is written out. Selected with --warmup and --frames.
+// A sequence (--sequence) animates the instances instead: the timed frames
+// of each job are the frames of the animation, and each one is written out.
+struct RunConfig
+{
+  uint32_t    warmupFrames = 0;
+  uint32_t    timedFrames  = 1;
+  uint32_t    numJobs      = 1;
+  bool        sequence     = false;
+  std::string reportFilename;  // --report: appends a line of JSON with the measurements
+
+  uint32_t getFrameCount() const { return warmupFrames + timedFrames * numJobs; }
+  uint32_t getJob(uint32_t frame) const { return (frame < warmupFrames) ? 0 : (frame - warmupFrames) / timedFrames; }
+  // The frame of the animation the instances are in; always 0 without a sequence
+  uint32_t getAnimationFrame(uint32_t frame) const
+  {
+    return (sequence && frame >= warmupFrames) ? (frame - warmupFrames) % timedFrames : 0;
+  }
+  bool isWrittenOut(uint32_t frame) const
+  {
+    return frame >= warmupFrames && (sequence || (frame - warmupFrames) % timedFrames == timedFrames - 1);
+  }
+};
+
+// Number of staging buffers finished tiles are read back through. With more
+// than 2, the GPU can keep going while the output writer falls behind a bit.
+const uint32_t NUM_READBACK_BUFFERS = 3;
+
+// The profiler has a set of queries per command buffer that can be in flight:
+// one per sample batch slot, one per readback buffer, and one for the upload.
+// They're written to out_profile.json and out_profile.csv at the end.
+const uint32_t PROFILER_READBACK_SET = NUM_CMD_BUFFERS_IN_FLIGHT;
+const uint32_t PROFILER_UPLOAD_SET   = PROFILER_READBACK_SET + NUM_READBACK_BUFFERS;
+const uint32_t PROFILER_NUM_SETS     = PROFILER_UPLOAD_SET + 1;
 
 VkCommandBuffer AllocateAndBeginOneTimeCommandBuffer(VkDevice device, VkCommandPool cmdPool)
 {
@@ -47,27 +181,188 @@ void EndSubmitWaitAndFreeCommandBuffer(VkDevice device, VkQueue queue, VkCommand
   vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
 }
 
+// For the host-timed sections of the profiler
+double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
 VkDeviceAddress GetBufferDeviceAddress(VkDevice device, VkBuffer buffer)
 {
   VkBufferDeviceAddressInfo addressInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = buffer};
   return vkGetBufferDeviceAddress(device, &addressInfo);
 }
 
-int main(int argc, const char** argv)
+// Builds one BLAS per geometry, all in one call, and then compacts them.
+// `ranges` has the primitive count of each geometry. nvvk's
+// RaytracingBuilderKHR would call nvvk's global extension functions, which
+// are those of the last device initialized; this goes through `functions`.
+std::vector<nvvk::AccelKHR> BuildCompactedBlases(nvvk::Context&                                               context,
+                                                 const DeviceFunctions&                                       functions,
+                                                 nvvk::ResourceAllocator&                                     allocator,
+                                                 VkCommandPool                                                cmdPool,
+                                                 const std::vector<VkAccelerationStructureGeometryKHR>&       geometries,
+                                                 const std::vector<VkAccelerationStructureBuildRangeInfoKHR>& ranges)
 {
-  // Create the Vulkan context, consisting of an instance, device, physical device, and queues.
-  nvvk::ContextCreateInfo deviceInfo;  // One can modify this to load different extensions or pick the Vulkan core version
-  deviceInfo.apiMajor = 1;             // Specify the version of Vulkan we'll use
-  deviceInfo.apiMinor = 2;
-  // Required by KHR_acceleration_structure; allows work to be offloaded onto background threads and parallelized
-  deviceInfo.addDeviceExtension(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME);
-  VkPhysicalDeviceAccelerationStructureFeaturesKHR asFeatures{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR};
-  deviceInfo.addDeviceExtension(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME, false, &asFeatures);
-  VkPhysicalDeviceRayTracingPipelineFeaturesKHR rtPipelineFeatures{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR};
-  deviceInfo.addDeviceExtension(VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME, false, &rtPipelineFeatures);
+  const uint32_t                             count = static_cast<uint32_t>(geometries.size());
+  const VkBuildAccelerationStructureFlagsKHR flags =
+      VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+  auto createBlas = [&](VkDeviceSize size) {
+    nvvk::AccelKHR blas;
+    blas.buffer = allocator.createBuffer(size, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR
+                                                   | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+    const VkAccelerationStructureCreateInfoKHR createInfo{.sType  = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+                                                          .buffer = blas.buffer.buffer,
+                                                          .size   = size,
+                                                          .type   = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR};
+    NVVK_CHECK(functions.createAccelerationStructureKHR(context, &createInfo, nullptr, &blas.accel));
+    return blas;
+  };
+
+  VkPhysicalDeviceAccelerationStructurePropertiesKHR asProperties{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR};
+  VkPhysicalDeviceProperties2 properties{.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, .pNext = &asProperties};
+  vkGetPhysicalDeviceProperties2(context.m_physicalDevice, &properties);
+  const VkDeviceSize scratchAlignment = asProperties.minAccelerationStructureScratchOffsetAlignment;
+
+  // Each build gets its own part of one scratch buffer, since they run at once
+  std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos(count);
+  std::vector<nvvk::AccelKHR>                              uncompacted(count);
+  std::vector<VkDeviceSize>                                scratchOffsets(count);
+  VkDeviceSize                                             scratchSize = 0;
+  for(uint32_t i = 0; i < count; i++)
+  {
+    buildInfos[i] = {.sType         = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+                     .type          = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+                     .flags         = flags,
+                     .mode          = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+                     .geometryCount = 1,
+                     .pGeometries   = &geometries[i]};
+    VkAccelerationStructureBuildSizesInfoKHR sizeInfo{.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+    functions.getAccelerationStructureBuildSizesKHR(context, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfos[i],
+                                                    &ranges[i].primitiveCount, &sizeInfo);
+    uncompacted[i]                         = createBlas(sizeInfo.accelerationStructureSize);
+    buildInfos[i].dstAccelerationStructure = uncompacted[i].accel;
+    scratchOffsets[i]                      = scratchSize;
+    scratchSize += (sizeInfo.buildScratchSize + scratchAlignment - 1) / scratchAlignment * scratchAlignment;
+  }
+  nvvk::Buffer scratch = allocator.createBuffer(scratchSize + scratchAlignment,
+                                                VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  const VkDeviceAddress scratchBase = GetBufferDeviceAddress(context, scratch.buffer);
+  const VkDeviceAddress scratchAddress = (scratchBase + scratchAlignment - 1) / scratchAlignment * scratchAlignment;
+  std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangePointers(count);
+  std::vector<VkAccelerationStructureKHR>                      uncompactedHandles(count);
+  for(uint32_t i = 0; i < count; i++)
+  {
+    buildInfos[i].scratchData.deviceAddress = scratchAddress + scratchOffsets[i];
+    rangePointers[i]                        = &ranges[i];
+    uncompactedHandles[i]                   = uncompacted[i].accel;
+  }
 
-  nvvk::Context context;     // Encapsulates device state in a single object
-  context.init(deviceInfo);  // Initialize the context
+  // Build, and query the compacted sizes once the builds are done
+  const VkQueryPoolCreateInfo queryPoolInfo{.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                                            .queryType  = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+                                            .queryCount = count};
+  VkQueryPool                 queryPool;
+  NVVK_CHECK(vkCreateQueryPool(context, &queryPoolInfo, nullptr, &queryPool));
+  VkCommandBuffer cmdBuffer = AllocateAndBeginOneTimeCommandBuffer(context, cmdPool);
+  vkCmdResetQueryPool(cmdBuffer, queryPool, 0, count);
+  functions.cmdBuildAccelerationStructuresKHR(cmdBuffer, count, buildInfos.data(), rangePointers.data());
+  const VkMemoryBarrier buildBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                     .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                                     .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR};
+  vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &buildBarrier, 0, nullptr, 0, nullptr);
+  functions.cmdWriteAccelerationStructuresPropertiesKHR(cmdBuffer, count, uncompactedHandles.data(),
+                                                        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, 0);
+  EndSubmitWaitAndFreeCommandBuffer(context, context.m_queueGCT, cmdPool, cmdBuffer);
+  std::vector<VkDeviceSize> compactedSizes(count);
+  NVVK_CHECK(vkGetQueryPoolResults(context, queryPool, 0, count, count * sizeof(VkDeviceSize), compactedSizes.data(),
+                                   sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+  vkDestroyQueryPool(context, queryPool, nullptr);
+
+  // Copy each BLAS into one of its compacted size
+  std::vector<nvvk::AccelKHR> compacted(count);
+  cmdBuffer = AllocateAndBeginOneTimeCommandBuffer(context, cmdPool);
+  for(uint32_t i = 0; i < count; i++)
+  {
+    compacted[i] = createBlas(compactedSizes[i]);
+    const VkCopyAccelerationStructureInfoKHR copyInfo{.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+                                                      .src   = uncompacted[i].accel,
+                                                      .dst   = compacted[i].accel,
+                                                      .mode  = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR};
+    functions.cmdCopyAccelerationStructureKHR(cmdBuffer, &copyInfo);
+  }
+  EndSubmitWaitAndFreeCommandBuffer(context, context.m_queueGCT, cmdPool, cmdBuffer);
+
+  for(nvvk::AccelKHR& blas : uncompacted)
+  {
+    functions.destroyAccelerationStructureKHR(context, blas.accel, nullptr);
+    allocator.destroy(blas.buffer);
+  }
+  allocator.destroy(scratch);
+  return compacted;
+}
+
+// The settings all devices render with; main() falls back to what all of them support
+struct RenderSettings
+{
+  const StorageFormat*     storageFormat = &storage_formats[0];
+  TraceConfig              traceConfig;
+  ReorderMode              reorderMode      = ReorderMode::eOff;
+  TraceBackend             traceBackend     = TraceBackend::ePipeline;
+  float                    noiseThreshold   = 0.0f;
+  bool                     adaptiveSampling = false;  // noiseThreshold > 0
+  RunConfig                runConfig;
+  std::vector<std::string> searchPaths;  // Where the shaders are found
+  // The scene's instances of the models, and its jobs
+  std::vector<SceneInstance> instances;
+  std::vector<JobParams>     jobs;
+};
+
+// A device the frames are rendered on. Each one has a thread that renders
+// the work units its WorkSource gives it, with its own copy of the scene's
+// buffers, acceleration structures, pipelines and tile images; only the
+// models are loaded once, on the host.
+struct RenderDevice
+{
+  std::unique_ptr<nvvk::Context> context;    // Null for the CPU backend, which renders on the host
+  DeviceFunctions                functions;  // Of the context; its thread calls extension commands through these
+  std::string                    name;
+  bool                           traceIndirect = false;
+  // The staging buffers its tiles are read back through. It outlives the
+  // device's thread, since the output writer releases the last of them.
+  std::unique_ptr<BufferPool> readbackBufferPool;
+  // Measured by its thread
+  std::vector<GpuProfiler::Result> profile;
+  double                           blasBuildMs     = 0.0;
+  double                           tlasBuildMs     = 0.0;
+  double                           timedGpuMs      = 0.0;  // GPU time of the timed frames
+  double                           deviceMemoryMiB = 0.0;
+};
+
+// Sets up device `deviceIndex`, renders the work units `work` gives it, and
+// cleans up once there are none left for it.
+void RenderOnDevice(uint32_t                          deviceIndex,
+                    RenderDevice&                     device,
+                    const RenderSettings&             settings,
+                    const std::vector<MeshCacheView>& models,
+                    WorkSource&                       work)
+{
+  nvvk::Context&                  context          = *device.context;
+  const DeviceFunctions&          vk               = device.functions;
+  const StorageFormat*            storageFormat    = settings.storageFormat;
+  const TraceConfig&              traceConfig      = settings.traceConfig;
+  const ReorderMode               reorderMode      = settings.reorderMode;
+  const TraceBackend              traceBackend     = settings.traceBackend;
+  const float                     noiseThreshold   = settings.noiseThreshold;
+  const bool                      adaptiveSampling = settings.adaptiveSampling;
+  const bool                      traceIndirect    = device.traceIndirect;
+  const RunConfig&                runConfig        = settings.runConfig;
+  const std::vector<std::string>& searchPaths      = settings.searchPaths;
+  const uint32_t                  num_tiles_x      = (render_width + tile_width - 1) / tile_width;
+  const uint32_t                  num_tiles_y      = (render_height + tile_height - 1) / tile_height;
+  PushConstants                   pushConstants{};  // Of the command buffers being recorded
 
   // Get the properties of ray tracing pipelines on this device. We do this by
   // using vkGetPhysicalDeviceProperties2, and extending this by chaining on a
@@ -82,6 +377,8 @@ int main(int argc, const char** argv)
   const VkDeviceSize sbtBaseAlignment   = rtPipelineProperties.shaderGroupBaseAlignment;
   const VkDeviceSize sbtHandleAlignment = rtPipelineProperties.shaderGroupHandleAlignment;
 
+  const uint32_t bytesPerPixel = OutputWriter::getBytesPerPixel(storageFormat->pixelFormat);
+
   // Compute the stride between shader binding table (SBT) records.
   // This must be:
   // - Greater than rtPipelineProperties.shaderGroupHandleSize (since a record
@@ -115,10 +412,11 @@ int main(int argc, const char** argv)
   VkImageCreateInfo imageCreateInfo =  //
       {.sType     = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
        .imageType = VK_IMAGE_TYPE_2D,
-       // RGB32 images aren't usually supported, so we change this to a RGBA32 image.
-       .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-       // Defines the size of the image:
-       .extent = {render_width, render_height, 1},
+       // One of storage_formats. RGB32 images aren't usually supported, so
+       // the full-precision format is RGBA32.
+       .format = storageFormat->format,
+       // Defines the size of the image; it holds one tile:
+       .extent = {tile_width, tile_height, 1},
        // The image is an array of length 1, and each element contains only 1 mip:
        .mipLevels   = 1,
        .arrayLayers = 1,
@@ -164,38 +462,38 @@ int main(int argc, const char** argv)
   NVVK_CHECK(vkCreateImageView(context, &imageViewCreateInfo, nullptr, &imageView));
   debugUtil.setObjectName(imageView, "imageView");
 
-  // Also create an image using linear tiling that can be accessed from the CPU,
-  // much like how we created the buffer in the main tutorial. The first image
-  // will be entirely local to the GPU for performance, while this image can
-  // be mapped to CPU memory. We'll copy data from the first image to this
-  // image in order to read the image data back on the CPU.
-  // As before, we'll transition the image layout in the same command buffer
-  // used to upload the vertex and index buffers.
-  imageCreateInfo.tiling  = VK_IMAGE_TILING_LINEAR;
-  imageCreateInfo.usage   = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-  nvvk::Image imageLinear = allocator.createImage(imageCreateInfo,                           //
-                                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT       //
-                                                      | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT  //
-                                                      | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-  debugUtil.setObjectName(imageLinear.image, "imageLinear");
-
-  // Load the mesh of the first shape from an OBJ file
-  const std::string        exePath(argv[0], std::string(argv[0]).find_last_of("/\\") + 1);
-  std::vector<std::string> searchPaths = {exePath + PROJECT_RELDIRECTORY, exePath + PROJECT_RELDIRECTORY "..",
-                                          exePath + PROJECT_RELDIRECTORY "../..", exePath + PROJECT_NAME};
-  tinyobj::ObjReader       reader;  // Used to read an OBJ file
-  reader.ParseFromFile(nvh::findFile("scenes/CornellBox-Original-Merged.obj", searchPaths));
-  assert(reader.Valid());  // Make sure tinyobj was able to parse this file
-  const std::vector<tinyobj::real_t>   objVertices = reader.GetAttrib().GetVertices();
-  const std::vector<tinyobj::shape_t>& objShapes   = reader.GetShapes();  // All shapes in the file
-  assert(objShapes.size() == 1);                                          // Check that this file has only one shape
-  const tinyobj::shape_t& objShape = objShapes[0];                        // Get the first shape
-  // Get the indices of the vertices of the first mesh of `objShape` in `attrib.vertices`:
-  std::vector<uint32_t> objIndices;
-  objIndices.reserve(objShape.mesh.indices.size());
-  for(const tinyobj::index_t& index : objShape.mesh.indices)
+  // The variance image holds the running statistics of adaptive sampling for
+  // each pixel of the tile. It's rgba32f whatever the storage format is, since
+  // M2 needs the precision, and it's only read and written on the GPU.
+  VkImageCreateInfo varianceImageCreateInfo = imageCreateInfo;
+  varianceImageCreateInfo.format            = VK_FORMAT_R32G32B32A32_SFLOAT;
+  varianceImageCreateInfo.usage             = VK_IMAGE_USAGE_STORAGE_BIT;
+  nvvk::Image varianceImage                 = allocator.createImage(varianceImageCreateInfo);
+  debugUtil.setObjectName(varianceImage.image, "varianceImage");
+  VkImageViewCreateInfo varianceImageViewCreateInfo = imageViewCreateInfo;
+  varianceImageViewCreateInfo.image                 = varianceImage.image;
+  varianceImageViewCreateInfo.format                = varianceImageCreateInfo.format;
+  VkImageView varianceImageView;
+  NVVK_CHECK(vkCreateImageView(context, &varianceImageViewCreateInfo, nullptr, &varianceImageView));
+  debugUtil.setObjectName(varianceImageView, "varianceImageView");
+
+  // Finished tiles are read back through buffers in host-visible, cached
+  // memory that stay mapped for the whole run. vkCmdCopyImageToBuffer can copy
+  // from `image` in any usable layout, so unlike a linear-tiled image these
+  // don't need layout transitions or row pitch queries (and host-visible
+  // linear images with these formats aren't guaranteed to be supported).
+  // There are several, so that the output writer can encode earlier tiles
+  // while the GPU traces the next one and copies it into another buffer.
+  const VkDeviceSize stagingBufferSize = VkDeviceSize(tile_width) * tile_height * bytesPerPixel;
+  std::array<nvvk::Buffer, NUM_READBACK_BUFFERS> stagingBuffers;
+  std::array<const void*, NUM_READBACK_BUFFERS>  mappedStagingBuffers;
+  for(uint32_t i = 0; i < NUM_READBACK_BUFFERS; i++)
   {
-    objIndices.push_back(index.vertex_index);
+    stagingBuffers[i] = allocator.createBuffer(stagingBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+                                                   | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    debugUtil.setObjectName(stagingBuffers[i].buffer, "Staging buffer " + std::to_string(i));
+    mappedStagingBuffers[i] = allocator.map(stagingBuffers[i]);
   }
 
   // Create the command pool
@@ -205,73 +503,103 @@ int main(int argc, const char** argv)
   NVVK_CHECK(vkCreateCommandPool(context, &cmdPoolInfo, nullptr, &cmdPool));
   debugUtil.setObjectName(cmdPool, "cmdPool");
 
-  // Upload the vertex and index buffers to the GPU.
-  nvvk::Buffer vertexBuffer, indexBuffer;
+  // Times the upload, the acceleration structure builds, and each pass of the
+  // sample batches and readbacks
+  GpuProfiler profiler;
+  profiler.init(context, context.m_physicalDevice, context.m_queueGCT, PROFILER_NUM_SETS);
+
+  // All models share one vertex and one index buffer; modelRanges says
+  // where each one starts. Indices stay relative to their model.
+  std::vector<ModelRange> modelRanges;
+  uint64_t                vertexCount = 0, indexCount = 0;
+  for(const MeshCacheView& model : models)
+  {
+    modelRanges.push_back({.first_vertex = static_cast<uint32_t>(vertexCount), .first_index = static_cast<uint32_t>(indexCount)});
+    vertexCount += model.vertexCount;
+    indexCount += model.indexCount;
+  }
+
+  // Upload the scene's buffers to the GPU. The scene is compiled into them
+  // once, and all jobs render it.
+  nvvk::Buffer vertexBuffer, indexBuffer, modelsBuffer;
   {
     // Start a command buffer for uploading the buffers
     VkCommandBuffer uploadCmdBuffer = AllocateAndBeginOneTimeCommandBuffer(context, cmdPool);
+    profiler.cmdBeginSet(uploadCmdBuffer, PROFILER_UPLOAD_SET);
+    const uint32_t uploadSection = profiler.cmdBeginSection(uploadCmdBuffer, "Upload");
     // We get these buffers' device addresses, and use them as storage buffers and build inputs.
     const VkBufferUsageFlags usage = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
                                      | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
-    vertexBuffer = allocator.createBuffer(uploadCmdBuffer, objVertices, usage);
-    indexBuffer  = allocator.createBuffer(uploadCmdBuffer, objIndices, usage);
-
-    // Also, let's transition the layout of `image` to `VK_IMAGE_LAYOUT_GENERAL`,
-    // and the layout of `imageLinear` to `VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL`.
-    // Although we use `imageLinear` later, we're transferring its layout as
-    // early as possible. For more complex applications, tracking images and
-    // operations using a graph is a good way to handle these types of images
-    // automatically. However, for this tutorial, we'll show how to write
-    // image transitions by hand.
-
-    // To do this, we combine both transitions in a single pipeline barrier.
+    vertexBuffer = allocator.createBuffer(vertexCount * 3 * sizeof(float), usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    indexBuffer  = allocator.createBuffer(indexCount * sizeof(uint32_t), usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    // Each model is copied to its range through the allocator's staging memory
+    nvvk::StagingMemoryManager& staging = *allocator.getStaging();
+    for(size_t m = 0; m < models.size(); m++)
+    {
+      staging.cmdToBuffer(uploadCmdBuffer, vertexBuffer.buffer, VkDeviceSize(modelRanges[m].first_vertex) * 3 * sizeof(float),
+                          models[m].vertexCount * 3 * sizeof(float), models[m].vertices);
+      staging.cmdToBuffer(uploadCmdBuffer, indexBuffer.buffer, VkDeviceSize(modelRanges[m].first_index) * sizeof(uint32_t),
+                          models[m].indexCount * sizeof(uint32_t), models[m].indices);
+    }
+    modelsBuffer = allocator.createBuffer(uploadCmdBuffer, modelRanges, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    debugUtil.setObjectName(modelsBuffer.buffer, "modelsBuffer");
+    profiler.cmdEndSection(uploadCmdBuffer, uploadSection);
+
+    // Also, let's transition the layout of `image` (and `varianceImage`) to `VK_IMAGE_LAYOUT_GENERAL`.
+    // It stays in this layout for the rest of the program: the ray tracing
+    // shaders read and write it, and the readback copies read from it.
+    // For more complex applications, tracking images and operations using a
+    // graph is a good way to handle these types of images automatically.
+    // However, for this tutorial, we'll show how to write image transitions by hand.
+
     // This pipeline barrier will say "Make it so that all writes to memory by
-    const VkAccessFlags srcAccesses = 0;  // Since image and imageLinear aren't initially accessible
+    const VkAccessFlags srcAccesses = 0;  // Since image isn't initially accessible
     // finish and can be read correctly by
-    const VkAccessFlags dstImageAccesses       = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;  // for image
-    const VkAccessFlags dstImageLinearAccesses = VK_ACCESS_TRANSFER_WRITE_BIT;  // for imageLinear
+    const VkAccessFlags dstImageAccesses = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;  // for image
     // "
 
     // Here's how to do that:
     const VkPipelineStageFlags srcStages = nvvk::makeAccessMaskPipelineStageFlags(srcAccesses);
-    const VkPipelineStageFlags dstStages = nvvk::makeAccessMaskPipelineStageFlags(dstImageAccesses | dstImageLinearAccesses);
-    VkImageMemoryBarrier imageBarriers[2];
-    // Image memory barrier for `image` from UNDEFINED to GENERAL layout:
-    imageBarriers[0] = nvvk::makeImageMemoryBarrier(image.image,                    // The VkImage
-                                                    srcAccesses, dstImageAccesses,  // Source and destination access masks
-                                                    VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,  // Source and destination layouts
-                                                    VK_IMAGE_ASPECT_COLOR_BIT);  // Aspects of an image (color, depth, etc.)
-    // Image memory barrier for `imageLinear` from UNDEFINED to TRANSFER_DST_OPTIMAL layout:
-    imageBarriers[1] = nvvk::makeImageMemoryBarrier(imageLinear.image,                    // The VkImage
-                                                    srcAccesses, dstImageLinearAccesses,  // Source and destination access masks
-                                                    VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,  // Source and dst layouts
-                                                    VK_IMAGE_ASPECT_COLOR_BIT);  // Aspects of an image (color, depth, etc.)
-    // Include the two image barriers in the pipeline barrier:
-    vkCmdPipelineBarrier(uploadCmdBuffer,       // The command buffer
-                         srcStages, dstStages,  // Src and dst pipeline stages
-                         0,                     // Flags for memory dependencies
-                         0, nullptr,            // Global memory barrier objects
-                         0, nullptr,            // Buffer memory barrier objects
-                         2, imageBarriers);     // Image barrier objects
+    const VkPipelineStageFlags dstStages = nvvk::makeAccessMaskPipelineStageFlags(dstImageAccesses);
+    // Image memory barriers for `image` and `varianceImage` from UNDEFINED to GENERAL layout:
+    const std::array<VkImageMemoryBarrier, 2> imageBarriers{
+        nvvk::makeImageMemoryBarrier(image.image,                                        // The VkImage
+                                     srcAccesses, dstImageAccesses,                      // Source and destination access masks
+                                     VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,  // Source and destination layouts
+                                     VK_IMAGE_ASPECT_COLOR_BIT),  // Aspects of an image (color, depth, etc.)
+        nvvk::makeImageMemoryBarrier(varianceImage.image, srcAccesses, dstImageAccesses, VK_IMAGE_LAYOUT_UNDEFINED,
+                                     VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT)};
+    vkCmdPipelineBarrier(uploadCmdBuffer,                                   // The command buffer
+                         srcStages, dstStages,                              // Src and dst pipeline stages
+                         0,                                                 // Flags for memory dependencies
+                         0, nullptr,                                        // Global memory barrier objects
+                         0, nullptr,                                        // Buffer memory barrier objects
+                         static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());  // Image barrier objects
 
     EndSubmitWaitAndFreeCommandBuffer(context, context.m_queueGCT, cmdPool, uploadCmdBuffer);
+    profiler.collect(PROFILER_UPLOAD_SET);
     allocator.finalizeAndReleaseStaging();
   }
 
-  // Describe the bottom-level acceleration structure (BLAS)
-  std::vector<nvvk::RaytracingBuilderKHR::BlasInput> blases;
+  // Describe the bottom-level acceleration structures (BLAS), one per model
+  std::vector<VkAccelerationStructureGeometryKHR>       blasGeometries;
+  std::vector<VkAccelerationStructureBuildRangeInfoKHR> blasRanges;
+  for(size_t m = 0; m < models.size(); m++)
   {
-    nvvk::RaytracingBuilderKHR::BlasInput blas;
-    // Get the device addresses of the vertex and index buffers
-    VkDeviceAddress vertexBufferAddress = GetBufferDeviceAddress(context, vertexBuffer.buffer);
-    VkDeviceAddress indexBufferAddress  = GetBufferDeviceAddress(context, indexBuffer.buffer);
+    // Get the device addresses of the model's vertices and indices
+    VkDeviceAddress vertexBufferAddress =
+        GetBufferDeviceAddress(context, vertexBuffer.buffer) + VkDeviceSize(modelRanges[m].first_vertex) * 3 * sizeof(float);
+    VkDeviceAddress indexBufferAddress =
+        GetBufferDeviceAddress(context, indexBuffer.buffer) + VkDeviceSize(modelRanges[m].first_index) * sizeof(uint32_t);
     // Specify where the builder can find the vertices and indices for triangles, and their formats:
     VkAccelerationStructureGeometryTrianglesDataKHR triangles{
         .sType         = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
         .vertexFormat  = VK_FORMAT_R32G32B32_SFLOAT,
         .vertexData    = {.deviceAddress = vertexBufferAddress},
         .vertexStride  = 3 * sizeof(float),
-        .maxVertex     = static_cast<uint32_t>(objVertices.size() / 3 - 1),
+        .maxVertex     = static_cast<uint32_t>(models[m].vertexCount - 1),
         .indexType     = VK_INDEX_TYPE_UINT32,
         .indexData     = {.deviceAddress = indexBufferAddress},
         .transformData = {.deviceAddress = 0}  // No transform
@@ -281,103 +609,237 @@ int main(int argc, const char** argv)
                                                 .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
                                                 .geometry     = {.triangles = triangles},
                                                 .flags        = VK_GEOMETRY_OPAQUE_BIT_KHR};
-    blas.asGeometry.push_back(geometry);
+    blasGeometries.push_back(geometry);
     // Create offset info that allows us to say how many triangles and vertices to read
     VkAccelerationStructureBuildRangeInfoKHR offsetInfo{
-        .primitiveCount  = static_cast<uint32_t>(objIndices.size() / 3),  // Number of triangles
-        .primitiveOffset = 0,                                             // Offset added when looking up triangles
+        .primitiveCount  = static_cast<uint32_t>(models[m].indexCount / 3),  // Number of triangles
+        .primitiveOffset = 0,                                           // Offset added when looking up triangles
         .firstVertex     = 0,  // Offset added when looking up vertices in the vertex buffer
         .transformOffset = 0   // Offset added when looking up transformation matrices, if we used them
     };
-    blas.asBuildOffsetInfo.push_back(offsetInfo);
-    blases.push_back(blas);
+    blasRanges.push_back(offsetInfo);
+  }
+  // Create the BLAS. The builds are submitted and waited for, so they're timed on the host.
+  const auto                  blasStart = std::chrono::steady_clock::now();
+  std::vector<nvvk::AccelKHR> blases    = BuildCompactedBlases(context, vk, allocator, cmdPool, blasGeometries, blasRanges);
+  std::vector<VkDeviceAddress> blasAddresses;
+  for(const nvvk::AccelKHR& blas : blases)
+  {
+    const VkAccelerationStructureDeviceAddressInfoKHR addressInfo{
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR, .accelerationStructure = blas.accel};
+    blasAddresses.push_back(vk.getAccelerationStructureDeviceAddressKHR(context, &addressInfo));
   }
-  // Create the BLAS
-  nvvk::RaytracingBuilderKHR raytracingBuilder;
-  raytracingBuilder.setup(context, &allocator, context.m_queueGCT);
-  raytracingBuilder.buildBlas(blases, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
-                                          | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
+  const double blasBuildMs = MillisecondsSince(blasStart);
+  profiler.addHostTime("BLAS build", blasBuildMs);
 
-  // Create 441 instances with random rotations pointing to BLAS 0, and build these instances into a TLAS:
+  // Create the scene's instances of the models in a frame of the animation:
   std::vector<VkAccelerationStructureInstanceKHR> instances;
-  std::default_random_engine                      randomEngine;  // The random number generator
-  std::uniform_real_distribution<float>           uniformDist(-0.5f, 0.5f);
-  std::uniform_int_distribution<int>              uniformIntDist(0, 8);
-  for(int x = -10; x <= 10; x++)
-  {
-    for(int y = -10; y <= 10; y++)
+  auto makeInstances = [&](uint32_t animationFrame) -> const std::vector<VkAccelerationStructureInstanceKHR>& {
+    instances.clear();
+    for(const SceneInstance& sceneInstance : settings.instances)
     {
-      glm::mat4 transform = glm::translate(glm::vec3(0.0f, -1.0f, 0.0f));
-      transform           = glm::rotate(uniformDist(randomEngine), glm::vec3(1.0f, 0.0f, 0.0f)) * transform;
-      transform           = glm::rotate(uniformDist(randomEngine), glm::vec3(0.0f, 1.0f, 0.0f)) * transform;
-      transform           = glm::scale(glm::vec3(1.0f / 2.7f)) * transform;
-      transform           = glm::translate(glm::vec3(float(x), float(y), 0.0f)) * transform;
-
       VkAccelerationStructureInstanceKHR instance{};
-      instance.transform = nvvk::toTransformMatrixKHR(transform);
-      instance.instanceCustomIndex = 0;  // 24 bits accessible to ray shaders via rayQueryGetIntersectionInstanceCustomIndexEXT
+      instance.transform = nvvk::toTransformMatrixKHR(getInstanceTransform(sceneInstance, animationFrame));
+      // 24 bits accessible to ray shaders via gl_InstanceCustomIndexEXT; the model, for its ModelRange
+      instance.instanceCustomIndex = sceneInstance.model;
       // The address of the BLAS in `blases` that this instance points to
-      instance.accelerationStructureReference = raytracingBuilder.getBlasDeviceAddress(0);
+      instance.accelerationStructureReference = blasAddresses[sceneInstance.model];
       // An offset that will be added when looking up the instance's shader in the SBT.
-      instance.instanceShaderBindingTableRecordOffset = uniformIntDist(randomEngine);
+      instance.instanceShaderBindingTableRecordOffset = sceneInstance.material;
       instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;  // How to trace this instance
       instance.mask  = 0xFF;
       instances.push_back(instance);
     }
+    return instances;
+  };
+  // And build them into the TLASes of the ring (see tlas_ring.hpp). A
+  // sequence builds the next frame's TLAS while the current one traces, on
+  // the async compute queue if there is one; other renders only ever need one.
+  const nvvk::Context::Queue& tlasQueue =
+      (runConfig.sequence && context.m_queueC.queue != VK_NULL_HANDLE) ? context.m_queueC : context.m_queueGCT;
+  TlasRing tlasRing;
+  tlasRing.init(context, vk, allocator, tlasQueue, context.m_queueGCT.familyIndex, runConfig.sequence ? NUM_TLAS_SLOTS : 1,
+                static_cast<uint32_t>(settings.instances.size()));
+  // The frame of the animation each slot of the ring holds, and the value of
+  // the ring's semaphore once its build is done
+  std::vector<uint32_t> tlasFrames(tlasRing.getSlotCount(), UINT32_MAX);
+  std::vector<uint64_t> tlasValues(tlasRing.getSlotCount(), 0);
+  // The first frame's TLAS is built up front, like the BLASes
+  const auto tlasStart = std::chrono::steady_clock::now();
+  tlasValues[0]        = tlasRing.build(0, makeInstances(0));
+  tlasFrames[0]        = 0;
+  tlasRing.wait(tlasValues[0]);
+  const double tlasBuildMs = MillisecondsSince(tlasStart);
+  profiler.addHostTime("TLAS build", tlasBuildMs);
+  if(runConfig.sequence)
+  {
+    nvprintf("Device %u builds the TLASes of the sequence %s.\n", deviceIndex,
+             tlasRing.isAsync() ? "on its async compute queue" : "on its main queue");
   }
-  raytracingBuilder.buildTlas(instances, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
 
   // Here's the list of bindings for the descriptor set layout, from raytrace.comp.glsl:
   // 0 - a storage image (the image `image`)
-  // 1 - an acceleration structure (the TLAS)
+  // 1 - NUM_TLAS_SLOTS acceleration structures (the TLASes of the ring)
   // 2 - a storage buffer (the vertex buffer)
   // 3 - a storage buffer (the index buffer)
+  // 4 - a storage buffer (the first sample batch index and tile of each submission)
+  // 5 to 9 - storage buffers of the passes of --reorder sort, only written in that mode
+  // 10 - a storage image (the variance image of adaptive sampling)
+  // 11, 12 - storage buffers (the active pixels of the tile, and how many there are)
+  // 13 - a uniform buffer (the camera and sky of each job)
+  // 14 - a storage buffer (where each model starts in the vertex and index buffers)
+  // The compute shaders of --reorder sort, the converge pass and the ray query
+  // megakernel use the same layout, so that the hit group libraries can be
+  // linked into any of the pipelines. The ray query megakernel shades inline,
+  // so it reads the geometry like the closest-hit shaders.
+  const VkShaderStageFlags     rayGenStages = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
   nvvk::DescriptorSetContainer descriptorSetContainer(context);
-  descriptorSetContainer.addBinding(BINDING_IMAGEDATA, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
-  descriptorSetContainer.addBinding(BINDING_TLAS, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
-  descriptorSetContainer.addBinding(BINDING_VERTICES, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
-  descriptorSetContainer.addBinding(BINDING_INDICES, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
+  descriptorSetContainer.addBinding(BINDING_IMAGEDATA, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, rayGenStages);
+  descriptorSetContainer.addBinding(BINDING_TLAS, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, NUM_TLAS_SLOTS, rayGenStages);
+  const VkShaderStageFlags shadingStages = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
+  descriptorSetContainer.addBinding(BINDING_VERTICES, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, shadingStages);
+  descriptorSetContainer.addBinding(BINDING_INDICES, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, shadingStages);
+  descriptorSetContainer.addBinding(BINDING_SUBMIT_PARAMS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, rayGenStages);
+  for(uint32_t binding : {BINDING_PATHS, BINDING_SORT_KEYS, BINDING_SORTED_PATHS, BINDING_SORT_COUNTERS, BINDING_PIXEL_SUMS})
+  {
+    descriptorSetContainer.addBinding(binding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, rayGenStages);
+  }
+  descriptorSetContainer.addBinding(BINDING_VARIANCE, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, rayGenStages);
+  descriptorSetContainer.addBinding(BINDING_ACTIVE_PIXELS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, rayGenStages);
+  descriptorSetContainer.addBinding(BINDING_TRACE_ARGS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, rayGenStages);
+  descriptorSetContainer.addBinding(BINDING_JOBS, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, rayGenStages);
+  descriptorSetContainer.addBinding(BINDING_MODELS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, shadingStages);
   // Create a layout from the list of bindings
   descriptorSetContainer.initLayout();
   // Create a descriptor pool from the list of bindings with space for 1 set, and allocate that set
   descriptorSetContainer.initPool(1);
   // Create a push constant range describing the amount of data for the push constants.
   static_assert(sizeof(PushConstants) % 4 == 0, "Push constant size must be a multiple of 4 per the Vulkan spec!");
-  VkPushConstantRange pushConstantRange{.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,  //
-                                        .offset     = 0,                               //
+  VkPushConstantRange pushConstantRange{.stageFlags = rayGenStages,  //
+                                        .offset     = 0,             //
                                         .size       = sizeof(PushConstants)};
   // Create a pipeline layout from the descriptor set layout and push constant range:
   descriptorSetContainer.initPipeLayout(1,                    // Number of push constant ranges
                                         &pushConstantRange);  // Pointer to push constant ranges
 
+  // The trace command buffers are recorded once, so the index of the first
+  // sample batch and the tile of each submission come from this small buffer
+  // instead of from push constants. It's persistently mapped; the CPU writes
+  // entry `slot` right before submitting the command buffer of that slot.
+  nvvk::Buffer submitParamsBuffer =
+      allocator.createBuffer(NUM_CMD_BUFFERS_IN_FLIGHT * sizeof(SubmitParams), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  debugUtil.setObjectName(submitParamsBuffer.buffer, "submitParamsBuffer");
+  SubmitParams* mappedSubmitParams = reinterpret_cast<SubmitParams*>(allocator.map(submitParamsBuffer));
+
+  // The camera and sky of each job. The shaders declare all MAX_JOBS
+  // entries; it's persistently mapped, so that the frames of the render
+  // server (see render_server.hpp) can each set an entry in turn.
+  nvvk::Buffer jobsBuffer = allocator.createBuffer(MAX_JOBS * sizeof(JobParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  debugUtil.setObjectName(jobsBuffer.buffer, "jobsBuffer");
+  JobParams* mappedJobs = reinterpret_cast<JobParams*>(allocator.map(jobsBuffer));
+  std::copy(settings.jobs.begin(), settings.jobs.end(), mappedJobs);
+
+  // The converge pass writes the pixels of the tile that haven't converged
+  // yet to the active pixels buffer, and counts them into the trace arguments
+  // of its slot. Those are the arguments of vkCmdTraceRaysIndirectKHR, and
+  // the CPU reads them back after waiting on the slot's fence, to stop a tile
+  // once none of its pixels are left.
+  nvvk::Buffer activePixelsBuffer = allocator.createBuffer(VkDeviceSize(tile_width) * tile_height * sizeof(uint32_t),
+                                                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  debugUtil.setObjectName(activePixelsBuffer.buffer, "activePixelsBuffer");
+  nvvk::Buffer traceArgsBuffer =
+      allocator.createBuffer(NUM_CMD_BUFFERS_IN_FLIGHT * sizeof(TraceArgs),
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                                 | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  debugUtil.setObjectName(traceArgsBuffer.buffer, "traceArgsBuffer");
+  TraceArgs* mappedTraceArgs = reinterpret_cast<TraceArgs*>(allocator.map(traceArgsBuffer));
+  for(uint32_t slot = 0; slot < NUM_CMD_BUFFERS_IN_FLIGHT; slot++)
+  {
+    mappedTraceArgs[slot] = {.width = 0, .height = 1, .depth = 1};
+  }
+  const VkDeviceAddress traceArgsAddress = GetBufferDeviceAddress(context, traceArgsBuffer.buffer);
+
   // Write values into the descriptor set.
-  std::array<VkWriteDescriptorSet, 4> writeDescriptorSets;
+  std::array<VkWriteDescriptorSet, 10> writeDescriptorSets;
   // Color image
   VkDescriptorImageInfo descriptorImageInfo{.imageView   = imageView,  // How the image should be accessed
                                             .imageLayout = VK_IMAGE_LAYOUT_GENERAL};  // The image's layout
   writeDescriptorSets[0] = descriptorSetContainer.makeWrite(0 /*set index*/, BINDING_IMAGEDATA /*binding*/, &descriptorImageInfo);
-  // Top-level acceleration structure (TLAS)
-  VkAccelerationStructureKHR tlasCopy = raytracingBuilder.getAccelerationStructure();  // So that we can take its address
+  // Top-level acceleration structures (TLASes); with fewer slots in the ring,
+  // the other entries repeat them
+  std::array<VkAccelerationStructureKHR, NUM_TLAS_SLOTS> tlasHandles;
+  for(uint32_t i = 0; i < NUM_TLAS_SLOTS; i++)
+  {
+    tlasHandles[i] = tlasRing.getTlas(i % tlasRing.getSlotCount());
+  }
   VkWriteDescriptorSetAccelerationStructureKHR descriptorAS{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR,
-                                                            .accelerationStructureCount = 1,
-                                                            .pAccelerationStructures    = &tlasCopy};
-  writeDescriptorSets[1] = descriptorSetContainer.makeWrite(0, BINDING_TLAS, &descriptorAS);
+                                                            .accelerationStructureCount = NUM_TLAS_SLOTS,
+                                                            .pAccelerationStructures    = tlasHandles.data()};
+  writeDescriptorSets[1] = descriptorSetContainer.makeWriteArray(0, BINDING_TLAS, &descriptorAS);
   // Vertex buffer
   VkDescriptorBufferInfo vertexDescriptorBufferInfo{.buffer = vertexBuffer.buffer, .range = VK_WHOLE_SIZE};
   writeDescriptorSets[2] = descriptorSetContainer.makeWrite(0, BINDING_VERTICES, &vertexDescriptorBufferInfo);
   // Index buffer
   VkDescriptorBufferInfo indexDescriptorBufferInfo{.buffer = indexBuffer.buffer, .range = VK_WHOLE_SIZE};
   writeDescriptorSets[3] = descriptorSetContainer.makeWrite(0, BINDING_INDICES, &indexDescriptorBufferInfo);
+  // Per-submission parameters
+  VkDescriptorBufferInfo submitParamsDescriptorBufferInfo{.buffer = submitParamsBuffer.buffer, .range = VK_WHOLE_SIZE};
+  writeDescriptorSets[4] = descriptorSetContainer.makeWrite(0, BINDING_SUBMIT_PARAMS, &submitParamsDescriptorBufferInfo);
+  // Adaptive sampling
+  VkDescriptorImageInfo varianceDescriptorImageInfo{.imageView = varianceImageView, .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+  writeDescriptorSets[5] = descriptorSetContainer.makeWrite(0, BINDING_VARIANCE, &varianceDescriptorImageInfo);
+  VkDescriptorBufferInfo activePixelsDescriptorBufferInfo{.buffer = activePixelsBuffer.buffer, .range = VK_WHOLE_SIZE};
+  writeDescriptorSets[6] = descriptorSetContainer.makeWrite(0, BINDING_ACTIVE_PIXELS, &activePixelsDescriptorBufferInfo);
+  VkDescriptorBufferInfo traceArgsDescriptorBufferInfo{.buffer = traceArgsBuffer.buffer, .range = VK_WHOLE_SIZE};
+  writeDescriptorSets[7] = descriptorSetContainer.makeWrite(0, BINDING_TRACE_ARGS, &traceArgsDescriptorBufferInfo);
+  // Scene
+  VkDescriptorBufferInfo jobsDescriptorBufferInfo{.buffer = jobsBuffer.buffer, .range = VK_WHOLE_SIZE};
+  writeDescriptorSets[8] = descriptorSetContainer.makeWrite(0, BINDING_JOBS, &jobsDescriptorBufferInfo);
+  VkDescriptorBufferInfo modelsDescriptorBufferInfo{.buffer = modelsBuffer.buffer, .range = VK_WHOLE_SIZE};
+  writeDescriptorSets[9] = descriptorSetContainer.makeWrite(0, BINDING_MODELS, &modelsDescriptorBufferInfo);
   vkUpdateDescriptorSets(context,                                            // The context
                          static_cast<uint32_t>(writeDescriptorSets.size()),  // Number of VkWriteDescriptorSet objects
                          writeDescriptorSets.data(),                         // Pointer to VkWriteDescriptorSet objects
                          0, nullptr);  // An array of VkCopyDescriptorSet objects (unused)
 
+  // The buffers the passes of --reorder sort communicate through. Paths are
+  // traced a wave at a time, so they scale with the tile size, not the image.
+  std::array<nvvk::Buffer, 5> wavefrontBuffers;
+  nvvk::Buffer&               sortCountersBuffer = wavefrontBuffers[3];
+  if(reorderMode == ReorderMode::eSort)
+  {
+    const std::array<uint32_t, 5>     bindings{BINDING_PATHS, BINDING_SORT_KEYS, BINDING_SORTED_PATHS, BINDING_SORT_COUNTERS,
+                                           BINDING_PIXEL_SUMS};
+    const std::array<VkDeviceSize, 5> sizes{SORTED_PATHS_PER_WAVE * sizeof(PathState), SORTED_PATHS_PER_WAVE * sizeof(uint32_t),
+                                            SORTED_PATHS_PER_WAVE * sizeof(uint32_t), sizeof(SortCounters),
+                                            tile_width * tile_height * sizeof(vec3)};
+    const std::array<const char*, 5>  names{"pathsBuffer", "sortKeysBuffer", "sortedPathsBuffer", "sortCountersBuffer",
+                                           "pixelSumsBuffer"};
+    std::array<VkDescriptorBufferInfo, 5> bufferInfos;
+    std::array<VkWriteDescriptorSet, 5>   writes;
+    for(size_t i = 0; i < wavefrontBuffers.size(); i++)
+    {
+      // The sort counters are cleared with vkCmdFillBuffer before each segment
+      wavefrontBuffers[i] = allocator.createBuffer(sizes[i], VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      debugUtil.setObjectName(wavefrontBuffers[i].buffer, names[i]);
+      bufferInfos[i] = {.buffer = wavefrontBuffers[i].buffer, .range = VK_WHOLE_SIZE};
+      writes[i]      = descriptorSetContainer.makeWrite(0, bindings[i], &bufferInfos[i]);
+    }
+    vkUpdateDescriptorSets(context, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+  }
+
   // Shader loading and pipeline creation
-  const size_t                                      NUM_C_HIT_SHADERS = 9;
+  const size_t                                      NUM_C_HIT_SHADERS = NUM_MATERIALS;
   std::array<VkShaderModule, 2 + NUM_C_HIT_SHADERS> modules;
-  modules[0] = nvvk::createShaderModule(context, nvh::loadFile("shaders/raytrace.rgen.glsl.spv", true, searchPaths));
-  debugUtil.setObjectName(modules[0], "Ray generation module (raytrace.rgen.glsl.spv)");
+  const char* rgenShader = (reorderMode == ReorderMode::eInvocationReorder) ? storageFormat->rgenReorderShader :
+                           (reorderMode == ReorderMode::eSort)              ? "shaders/raytrace_sorted.rgen.glsl.spv" :
+                                                                              storageFormat->rgenShader;
+  modules[0] = nvvk::createShaderModule(context, nvh::loadFile(rgenShader, true, searchPaths));
+  debugUtil.setObjectName(modules[0], std::string("Ray generation module (") + rgenShader + ")");
   modules[1] = nvvk::createShaderModule(context, nvh::loadFile("shaders/raytrace.rmiss.glsl.spv", true, searchPaths));
   debugUtil.setObjectName(modules[1], "Miss module (raytrace.rmiss.glsl.spv)");
   for(int closestHitShaderIdx = 0; closestHitShaderIdx < NUM_C_HIT_SHADERS; closestHitShaderIdx++)
@@ -389,19 +851,132 @@ int main(int argc, const char** argv)
     const std::string debugName = "Material " + std::to_string(closestHitShaderIdx) + " shader module";
     debugUtil.setObjectName(modules[moduleIdx], debugName);
   }
+  // The compute passes around the shading pass of --reorder sort
+  enum WavefrontPass
+  {
+    eGenerate,
+    eClassify,
+    eScatter,
+    eResolve,
+    eWavefrontPassCount
+  };
+  std::array<VkShaderModule, eWavefrontPassCount> wavefrontModules{};
+  if(reorderMode == ReorderMode::eSort)
+  {
+    const std::array<const char*, eWavefrontPassCount> filenames{"shaders/generate.comp.glsl.spv", "shaders/classify.comp.glsl.spv",
+                                                                 "shaders/scatter.comp.glsl.spv", storageFormat->resolveShader};
+    for(uint32_t pass = 0; pass < eWavefrontPassCount; pass++)
+    {
+      wavefrontModules[pass] = nvvk::createShaderModule(context, nvh::loadFile(filenames[pass], true, searchPaths));
+      debugUtil.setObjectName(wavefrontModules[pass], std::string("Wavefront module (") + filenames[pass] + ")");
+    }
+  }
+  // The megakernel of --backend query
+  VkShaderModule queryModule = VK_NULL_HANDLE;
+  if(traceBackend == TraceBackend::eRayQuery)
+  {
+    queryModule = nvvk::createShaderModule(context, nvh::loadFile(storageFormat->queryShader, true, searchPaths));
+    debugUtil.setObjectName(queryModule, std::string("Ray query module (") + storageFormat->queryShader + ")");
+  }
 
   // Create the shader binding table and ray tracing pipeline.
   // We'll create the ray tracing pipeline by specifying the shaders + layout,
   // and then get the handles of the shaders for the shader binding table from
-  // the pipeline.
-  VkPipeline   rtPipeline;
-  nvvk::Buffer rtSBTBuffer;  // The buffer for the Shader Binding Table
+  // the pipeline. Since shader group handles belong to a pipeline, each
+  // specialized pipeline gets its own shader binding table.
+  struct TracePipeline
+  {
+    VkPipeline   rayGenLibrary;  // The ray generation and miss shaders, specialized for this configuration
+    VkPipeline   pipeline;
+    nvvk::Buffer sbtBuffer;  // The buffer for the Shader Binding Table
+    // --reorder sort only: the compute passes, specialized the same way
+    std::array<VkPipeline, eWavefrontPassCount> wavefrontPipelines{};
+    // --backend query only: the megakernel, specialized the same way
+    VkPipeline queryPipeline = VK_NULL_HANDLE;
+  };
+  // Pipelines are compiled through a VkPipelineCache that's saved to disk at
+  // the end, so that later runs skip compilation in the driver.
+  // Each device has its own cache file, since the cache is only valid for
+  // the device it was saved on.
+  const std::string pipelineCacheFilename =
+      std::string(PROJECT_NAME "_pipeline_cache") + (deviceIndex > 0 ? "_" + std::to_string(deviceIndex) : "") + ".bin";
+  VkPipelineCache pipelineCache = loadPipelineCache(context, context.m_physicalDevice, pipelineCacheFilename);
+  // Pipelines are created as deferred operations, which the driver compiles
+  // on one thread per host core.
+  PipelineCompiler pipelineCompiler;
+  pipelineCompiler.init(context, pipelineCache);
+
+  // Pipelines are linked from pipeline libraries (VK_KHR_pipeline_library):
+  // one with the ray generation and miss shaders, per configuration since the
+  // configuration specializes the ray generation shader, and one per material
+  // with its hit group. Each library is compiled once and kept, so a new
+  // configuration only compiles the ray generation and miss shaders, a new
+  // material only its closest-hit shader, and the pipeline itself is just a
+  // link step. All libraries of a pipeline must agree on the largest payload
+  // and hit attributes they use.
+  const VkRayTracingPipelineInterfaceCreateInfoKHR libraryInterface{
+      .sType                          = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_INTERFACE_CREATE_INFO_KHR,
+      .maxPipelineRayPayloadSize      = 3 * sizeof(glm::vec3) + 4 * sizeof(uint32_t),  // PassableInfo in tracingCommon.h
+      .maxPipelineRayHitAttributeSize = sizeof(glm::vec2)};                             // Barycentrics of a triangle hit
+  const uint32_t maxRecursionDepth = 1;  // Depth of call tree; the same for the libraries and the pipeline
+
+  // The hit group libraries only depend on the color mode, which is the same
+  // for all the configurations of a run, so they're all compiled up front, in
+  // parallel.
+  // A VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR group type
+  // is for an instance containing triangles. It can point to closest hit and
+  // any hit shaders.
+  // A VK_RAY_TRACING_SHADER_GROUP_TYPE_PROCEDURAL_HIT_GROUP_KHR group type
+  // is for a procedural instance, and can point to an intersection, any hit,
+  // and closest hit shader.
+  std::array<VkPipeline, NUM_C_HIT_SHADERS>                           hitLibraries;
+  std::array<VkPipelineShaderStageCreateInfo, NUM_C_HIT_SHADERS>      hitStages;
+  std::array<VkRayTracingShaderGroupCreateInfoKHR, NUM_C_HIT_SHADERS> hitGroups;
+  const VkSpecializationMapEntry hitSpecializationMapEntry{.constantID = SPEC_CONSTANT_SPECTRAL,
+                                                           .offset     = offsetof(TraceConfig, spectral),
+                                                           .size       = sizeof(VkBool32)};
+  const VkSpecializationInfo     hitSpecializationInfo{.mapEntryCount = 1,
+                                                       .pMapEntries   = &hitSpecializationMapEntry,
+                                                       .dataSize      = sizeof(TraceConfig),
+                                                       .pData         = &traceConfig};
+  for(uint32_t closestHitShaderIdx = 0; closestHitShaderIdx < NUM_C_HIT_SHADERS; closestHitShaderIdx++)
+  {
+    hitStages[closestHitShaderIdx] = {.sType               = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                                      .stage               = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+                                      .module              = modules[2 + closestHitShaderIdx],
+                                      .pName               = "main",
+                                      .pSpecializationInfo = &hitSpecializationInfo};
+    hitGroups[closestHitShaderIdx] = {.sType              = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+                                      .type               = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR,
+                                      .generalShader      = VK_SHADER_UNUSED_KHR,   // No ray gen, miss, or callable shader
+                                      .closestHitShader   = 0,                      // Index of closest-hit in the library's stages
+                                      .anyHitShader       = VK_SHADER_UNUSED_KHR,   // No any-hit shader
+                                      .intersectionShader = VK_SHADER_UNUSED_KHR};  // No intersection shader
+    const VkRayTracingPipelineCreateInfoKHR libraryCreateInfo{.sType      = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR,
+                                                              .stageCount = 1,
+                                                              .pStages    = &hitStages[closestHitShaderIdx],
+                                                              .groupCount = 1,
+                                                              .pGroups    = &hitGroups[closestHitShaderIdx],
+                                                              .maxPipelineRayRecursionDepth = maxRecursionDepth,
+                                                              .layout = descriptorSetContainer.getPipeLayout()};
+    pipelineCompiler.addLibrary(libraryCreateInfo, libraryInterface, &hitLibraries[closestHitShaderIdx]);
+  }
+  NVVK_CHECK(pipelineCompiler.wait());
+  for(uint32_t closestHitShaderIdx = 0; closestHitShaderIdx < NUM_C_HIT_SHADERS; closestHitShaderIdx++)
   {
+    debugUtil.setObjectName(hitLibraries[closestHitShaderIdx], "Material " + std::to_string(closestHitShaderIdx) + " hit library");
+  }
+
+  TracePipeline tracePipeline;
+  {
+    VkPipeline   rayGenLibrary;
+    VkPipeline   rtPipeline;
+    nvvk::Buffer rtSBTBuffer;
     // First, we create objects that point to each of our shaders.
     // These are called "shader stages" in this context.
     // These are shader module + entry point + stage combinations, because each
     // shader module can contain multiple entry points (e.g. main1, main2...)
-    std::array<VkPipelineShaderStageCreateInfo, 2 + NUM_C_HIT_SHADERS> stages;  // Pointers to shaders
+    std::array<VkPipelineShaderStageCreateInfo, 2> stages;  // Pointers to shaders
 
     // Stage 0 will be the raygen shader.
     stages[0] = {.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -412,35 +987,34 @@ int main(int argc, const char** argv)
     stages[1]        = stages[0];
     stages[1].stage  = VK_SHADER_STAGE_MISS_BIT_KHR;  // Kind of shader
     stages[1].module = modules[1];                    // Contains the shader
-    // Stages 2 through the end will be closest-hit shaders.
-    for(int closestHitShaderIdx = 0; closestHitShaderIdx < NUM_C_HIT_SHADERS; closestHitShaderIdx++)
-    {
-      const int moduleIdx      = 2 + closestHitShaderIdx;
-      stages[moduleIdx]        = stages[0];
-      stages[moduleIdx].stage  = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
-      stages[moduleIdx].module = modules[moduleIdx];
-    }
+
+    // The ray generation shader's specialization constants come from traceConfig.
+    // (Set this after copying stages[0], since the other stages don't use them.)
+    const std::array<VkSpecializationMapEntry, 3> specializationMapEntries{
+        {{.constantID = SPEC_CONSTANT_NUM_SAMPLES, .offset = offsetof(TraceConfig, numSamples), .size = sizeof(uint32_t)},
+         {.constantID = SPEC_CONSTANT_MAX_SEGMENTS, .offset = offsetof(TraceConfig, maxSegments), .size = sizeof(uint32_t)},
+         {.constantID = SPEC_CONSTANT_SPECTRAL, .offset = offsetof(TraceConfig, spectral), .size = sizeof(VkBool32)}}};
+    const VkSpecializationInfo specializationInfo{.mapEntryCount = static_cast<uint32_t>(specializationMapEntries.size()),
+                                                  .pMapEntries   = specializationMapEntries.data(),
+                                                  .dataSize      = sizeof(TraceConfig),
+                                                  .pData         = &traceConfig};
+    stages[0].pSpecializationInfo = &specializationInfo;
 
     // Then we make groups point to the shader stages. Each group can point to
     // 1-3 shader stages depending on the type, by specifying the index in the
     // stages array. These groups of handles then become the most important
     // part of the entries in the shader binding table.
     // Stores the indices of stages in each group:
-    std::array<VkRayTracingShaderGroupCreateInfoKHR, 2 + NUM_C_HIT_SHADERS> groups;
+    std::array<VkRayTracingShaderGroupCreateInfoKHR, 2> groups;
 
     // The vkCmdTraceRays call will eventually refer to ray gen, miss, hit, and
     // callable shader binding tables and ranges.
     // A VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR group type is for a group
     // of one shader (a ray gen shader in a ray gen SBT region, a miss shader in
     // a miss SBT region, and so on.)
-    // A VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR group type
-    // is for an instance containing triangles. It can point to closest hit and
-    // any hit shaders.
-    // A VK_RAY_TRACING_SHADER_GROUP_TYPE_PROCEDURAL_HIT_GROUP_KHR group type
-    // is for a procedural instance, and can point to an intersection, any hit,
-    // and closest hit shader.
-
-    // We lay out our shader binding table like this:
+
+    // A linked pipeline has the groups of its libraries in order, so we lay
+    // out our shader binding table like this:
     // RAY GEN REGION
     // Group 0 - points to Stage 0
     groups[0] = {.sType              = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
@@ -458,19 +1032,10 @@ int main(int argc, const char** argv)
                  .anyHitShader       = VK_SHADER_UNUSED_KHR,   // No any-hit shader
                  .intersectionShader = VK_SHADER_UNUSED_KHR};  // No intersection shader
     // CLOSEST-HIT REGION
-    // Group N - uses Stage N as its closest-hit shader
-    for(uint32_t closestHitShaderIdx = 0; closestHitShaderIdx < NUM_C_HIT_SHADERS; closestHitShaderIdx++)
-    {
-      const uint32_t moduleIdx = 2 + closestHitShaderIdx;
-      groups[moduleIdx]        = {.sType              = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
-                                  .type               = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR,
-                                  .generalShader      = VK_SHADER_UNUSED_KHR,   // No ray gen, miss, or callable shader
-                                  .closestHitShader   = moduleIdx,              // Index of closest-hit in `stages`
-                                  .anyHitShader       = VK_SHADER_UNUSED_KHR,   // No any-hit shader
-                                  .intersectionShader = VK_SHADER_UNUSED_KHR};  // No intersection shader
-    }
+    // Group 2 + N - the hit group of material N, from hitLibraries[N]
+    const uint32_t numGroups = static_cast<uint32_t>(2 + NUM_C_HIT_SHADERS);
 
-    // Now, describe the ray tracing pipeline, ike creating a compute pipeline:
+    // Now, describe the ray generation library, like creating a compute pipeline:
     VkRayTracingPipelineCreateInfoKHR pipelineCreateInfo =  //
         {.sType                        = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR,
          .flags                        = 0,  // No flags to set
@@ -478,45 +1043,102 @@ int main(int argc, const char** argv)
          .pStages                      = stages.data(),
          .groupCount                   = static_cast<uint32_t>(groups.size()),
          .pGroups                      = groups.data(),
-         .maxPipelineRayRecursionDepth = 1,  // Depth of call tree
+         .maxPipelineRayRecursionDepth = maxRecursionDepth,
          .layout                       = descriptorSetContainer.getPipeLayout()};
-    NVVK_CHECK(vkCreateRayTracingPipelinesKHR(context,                 // Device
-                                              VK_NULL_HANDLE,          // Deferred operation or VK_NULL_HANDLE
-                                              VK_NULL_HANDLE,          // Pipeline cache or VK_NULL_HANDLE
-                                              1, &pipelineCreateInfo,  // Array of create infos
-                                              nullptr,                 // Allocator
-                                              &rtPipeline));
-    debugUtil.setObjectName(rtPipeline, "rtPipeline");
+    pipelineCompiler.addLibrary(pipelineCreateInfo, libraryInterface, &rayGenLibrary);
+    NVVK_CHECK(pipelineCompiler.wait());
+
+    // Then link it with the hit group libraries; the pipeline has no shaders of its own.
+    std::vector<VkPipeline> libraries{rayGenLibrary};
+    libraries.insert(libraries.end(), hitLibraries.begin(), hitLibraries.end());
+    const VkRayTracingPipelineCreateInfoKHR linkCreateInfo{.sType = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR,
+                                                           .maxPipelineRayRecursionDepth = maxRecursionDepth,
+                                                           .layout = descriptorSetContainer.getPipeLayout()};
+    pipelineCompiler.addLinked(linkCreateInfo, libraries, libraryInterface, &rtPipeline);
+    NVVK_CHECK(pipelineCompiler.wait());
+    debugUtil.setObjectName(rtPipeline, "rtPipeline (" + std::to_string(traceConfig.numSamples) + " samples, "
+                                            + std::to_string(traceConfig.maxSegments) + " segments)");
+    debugUtil.setObjectName(rayGenLibrary, "Ray generation library (" + std::to_string(traceConfig.numSamples) + " samples, "
+                                               + std::to_string(traceConfig.maxSegments) + " segments)");
 
     // Now create and write the shader binding table, by getting the shader
     // group handles from the ray tracing pipeline and writing them into a
     // Vulkan buffer object.
 
     // Get the shader group handles:
-    std::vector<uint8_t> cpuShaderHandleStorage(sbtHeaderSize * groups.size());
-    NVVK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(context,                               // Device
-                                                    rtPipeline,                            // Pipeline
-                                                    0,                                     // First group
-                                                    static_cast<uint32_t>(groups.size()),  // Number of groups
-                                                    cpuShaderHandleStorage.size(),         // Size of buffer
-                                                    cpuShaderHandleStorage.data()));       // Data buffer
+    std::vector<uint8_t> cpuShaderHandleStorage(sbtHeaderSize * numGroups);
+    NVVK_CHECK(vk.getRayTracingShaderGroupHandlesKHR(context,                          // Device
+                                                     rtPipeline,                       // Pipeline
+                                                     0,                                // First group
+                                                     numGroups,                        // Number of groups
+                                                     cpuShaderHandleStorage.size(),    // Size of buffer
+                                                     cpuShaderHandleStorage.data()));  // Data buffer
     // Allocate the shader binding table. We get its device address, and
     // use it as a shader binding table. As before, we set its memory property
     // flags so that it can be read and written from the CPU.
-    const uint32_t sbtSize = static_cast<uint32_t>(sbtStride * groups.size());
+    const uint32_t sbtSize = static_cast<uint32_t>(sbtStride * numGroups);
     rtSBTBuffer            = allocator.createBuffer(
         sbtSize, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
     debugUtil.setObjectName(rtSBTBuffer.buffer, "rtSBTBuffer");
     // Copy the shader group handles to the SBT:
     uint8_t* mappedSBT = reinterpret_cast<uint8_t*>(allocator.map(rtSBTBuffer));
-    for(size_t groupIndex = 0; groupIndex < groups.size(); groupIndex++)
+    for(size_t groupIndex = 0; groupIndex < numGroups; groupIndex++)
     {
       memcpy(&mappedSBT[groupIndex * sbtStride], &cpuShaderHandleStorage[groupIndex * sbtHeaderSize], sbtHeaderSize);
     }
     allocator.unmap(rtSBTBuffer);
     // Clean up:
     allocator.finalizeAndReleaseStaging();
+
+    tracePipeline = {rayGenLibrary, rtPipeline, rtSBTBuffer};
+    if(reorderMode == ReorderMode::eSort)
+    {
+      std::array<VkComputePipelineCreateInfo, eWavefrontPassCount> computeCreateInfos;
+      for(uint32_t pass = 0; pass < eWavefrontPassCount; pass++)
+      {
+        computeCreateInfos[pass] = {.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+                                    .stage  = {.sType               = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                                               .stage               = VK_SHADER_STAGE_COMPUTE_BIT,
+                                               .module              = wavefrontModules[pass],
+                                               .pName               = "main",
+                                               .pSpecializationInfo = &specializationInfo},
+                                    .layout = descriptorSetContainer.getPipeLayout()};
+      }
+      NVVK_CHECK(vkCreateComputePipelines(context, pipelineCache, eWavefrontPassCount, computeCreateInfos.data(), nullptr,
+                                          tracePipeline.wavefrontPipelines.data()));
+    }
+    if(traceBackend == TraceBackend::eRayQuery)
+    {
+      const VkPipelineShaderStageCreateInfo queryStage{.sType               = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                                                       .stage               = VK_SHADER_STAGE_COMPUTE_BIT,
+                                                       .module              = queryModule,
+                                                       .pName               = "main",
+                                                       .pSpecializationInfo = &specializationInfo};
+      const VkComputePipelineCreateInfo     queryCreateInfo{.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+                                                            .stage  = queryStage,
+                                                            .layout = descriptorSetContainer.getPipeLayout()};
+      NVVK_CHECK(vkCreateComputePipelines(context, pipelineCache, 1, &queryCreateInfo, nullptr, &tracePipeline.queryPipeline));
+      debugUtil.setObjectName(tracePipeline.queryPipeline, "queryPipeline (" + std::to_string(traceConfig.numSamples) + " samples, "
+                                                               + std::to_string(traceConfig.maxSegments) + " segments)");
+    }
+  }
+
+  // The converge pass of adaptive sampling doesn't depend on the configuration.
+  VkShaderModule convergeModule   = VK_NULL_HANDLE;
+  VkPipeline     convergePipeline = VK_NULL_HANDLE;
+  if(adaptiveSampling)
+  {
+    convergeModule = nvvk::createShaderModule(context, nvh::loadFile("shaders/converge.comp.glsl.spv", true, searchPaths));
+    debugUtil.setObjectName(convergeModule, "Converge module (converge.comp.glsl.spv)");
+    const VkComputePipelineCreateInfo convergeCreateInfo{.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+                                                         .stage  = {.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                                                                    .stage  = VK_SHADER_STAGE_COMPUTE_BIT,
+                                                                    .module = convergeModule,
+                                                                    .pName  = "main"},
+                                                         .layout = descriptorSetContainer.getPipeLayout()};
+    NVVK_CHECK(vkCreateComputePipelines(context, pipelineCache, 1, &convergeCreateInfo, nullptr, &convergePipeline));
+    debugUtil.setObjectName(convergePipeline, "convergePipeline");
   }
 
   // vkCmdTraceRaysKHR uses VkStridedDeviceAddressregionKHR objects to say
@@ -524,7 +1146,7 @@ int main(int argc, const char** argv)
   // draw call, but let's create them up front since they're the same
   // every time here:
   VkStridedDeviceAddressRegionKHR sbtRayGenRegion, sbtMissRegion, sbtHitRegion, sbtCallableRegion;
-  const VkDeviceAddress           sbtStartAddress = GetBufferDeviceAddress(context, rtSBTBuffer.buffer);
+  const VkDeviceAddress           sbtStartAddress = GetBufferDeviceAddress(context, tracePipeline.sbtBuffer.buffer);
   {
     // The ray generation shader region:
     sbtRayGenRegion.deviceAddress = sbtStartAddress;  // Starts here
@@ -543,120 +1165,1390 @@ int main(int argc, const char** argv)
     sbtCallableRegion.size = 0;                // Is empty
   }
 
-  const uint32_t NUM_SAMPLE_BATCHES = 32;
-  for(uint32_t sampleBatch = 0; sampleBatch < NUM_SAMPLE_BATCHES; sampleBatch++)
-  {
-    // Create and start recording a command buffer
-    VkCommandBuffer cmdBuffer = AllocateAndBeginOneTimeCommandBuffer(context, cmdPool);
-
-    // Bind the ray tracing pipeline:
-    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rtPipeline);
-    // Bind the descriptor set
-    VkDescriptorSet descriptorSet = descriptorSetContainer.getSet(0);
-    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, descriptorSetContainer.getPipeLayout(),
-                            0, 1, &descriptorSet, 0, nullptr);
-
-    // Push push constants:
-    pushConstants.sample_batch = sampleBatch;
-    vkCmdPushConstants(cmdBuffer,                               // Command buffer
-                       descriptorSetContainer.getPipeLayout(),  // Pipeline layout
-                       VK_SHADER_STAGE_RAYGEN_BIT_KHR,          // Stage flags
-                       0,                                       // Offset
-                       sizeof(PushConstants),                   // Size in bytes
-                       &pushConstants);                         // Data
-
-    // Run the ray tracing pipeline and trace rays
-    vkCmdTraceRaysKHR(cmdBuffer,           // Command buffer
-                      &sbtRayGenRegion,    // Region of memory with ray generation groups
-                      &sbtMissRegion,      // Region of memory with miss groups
-                      &sbtHitRegion,       // Region of memory with hit groups
-                      &sbtCallableRegion,  // Region of memory with callable groups
-                      render_width,        // Width of dispatch
-                      render_height,       // Height of dispatch
-                      1);                  // Depth of dispatch
-
-    // On the last sample batch:
-    if(sampleBatch == NUM_SAMPLE_BATCHES - 1)
-    {
-      // Transition `image` from GENERAL to TRANSFER_SRC_OPTIMAL layout. See the
-      // code for uploadCmdBuffer above to see a description of what this does:
-      const VkAccessFlags        srcAccesses = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
-      const VkAccessFlags        dstAccesses = VK_ACCESS_TRANSFER_READ_BIT;
-      const VkPipelineStageFlags srcStages   = nvvk::makeAccessMaskPipelineStageFlags(srcAccesses);
-      const VkPipelineStageFlags dstStages   = nvvk::makeAccessMaskPipelineStageFlags(dstAccesses);
-      const VkImageMemoryBarrier barrier =
-          nvvk::makeImageMemoryBarrier(image.image,               // The VkImage
-                                       srcAccesses, dstAccesses,  // Src and dst access masks
-                                       VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,  // Src and dst layouts
-                                       VK_IMAGE_ASPECT_COLOR_BIT);
-      vkCmdPipelineBarrier(cmdBuffer,             // Command buffer
-                           srcStages, dstStages,  // Src and dst pipeline stages
-                           0,                     // Dependency flags
-                           0, nullptr,            // Global memory barriers
-                           0, nullptr,            // Buffer memory barriers
-                           1, &barrier);          // Image memory barriers
-
-      // Now, copy the image (which has layout TRANSFER_SRC_OPTIMAL) to imageLinear
-      // (which has layout TRANSFER_DST_OPTIMAL).
-      {
-        // We copy image color, mip 0, layer 0:
-        VkImageCopy region{.srcSubresource = {.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,  //
-                                              .mipLevel       = 0,                          //
-                                              .baseArrayLayer = 0,                          //
-                                              .layerCount     = 1},
-                           // (0, 0, 0) in the first image corresponds to (0, 0, 0) in the second image:
-                           .srcOffset      = {0, 0, 0},
-                           .dstSubresource = region.srcSubresource,
-                           .dstOffset      = {0, 0, 0},
-                           // Copy the entire image:
-                           .extent = {render_width, render_height, 1}};
-        vkCmdCopyImage(cmdBuffer,                             // Command buffer
-                       image.image,                           // Source image
-                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,  // Source image layout
-                       imageLinear.image,                     // Destination image
-                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,  // Destination image layout
-                       1, &region);                           // Regions
-      }
-
-      // Add a command that says "Make it so that memory writes by transfers
-      // are available to read from the CPU." (In other words, "Flush the GPU caches
-      // so the CPU can read the data.") To do this, we use a memory barrier.
+  // With --reorder sort, a sample batch is traced a wave of samples at a
+  // time, and each segment of the wave's paths takes three passes: classify
+  // (find each path's hit and count the paths per material), scatter (sort
+  // the paths by material), and shading (trace the sorted paths again, close
+  // to their hits, so the closest-hit shaders run in material order). The
+  // sort counters are cleared before each segment.
+  // The push constants of the batch have been pushed, except for the wave.
+  auto recordSortedTrace = [&](VkCommandBuffer cmdBuffer) {
+    // Each pass reads what the previous ones wrote
+    auto passBarrier = [&]() {
+      const VkPipelineStageFlags stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+                                          | VK_PIPELINE_STAGE_TRANSFER_BIT;
       VkMemoryBarrier memoryBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
-                                    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,  // Make transfer writes
-                                    .dstAccessMask = VK_ACCESS_HOST_READ_BIT};      // Readable by the CPU
-      vkCmdPipelineBarrier(cmdBuffer,                                               // The command buffer
-                           VK_PIPELINE_STAGE_TRANSFER_BIT,                          // From transfers
-                           VK_PIPELINE_STAGE_HOST_BIT,                              // To the CPU
-                           0,                                                       // No special flags
-                           1, &memoryBarrier,                                       // An array of memory barriers
-                           0, nullptr, 0, nullptr);                                 // No other barriers
+                                    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                                    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT};
+      vkCmdPipelineBarrier(cmdBuffer, stages, stages, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    };
+    const std::array<VkPipeline, eWavefrontPassCount>& passes = tracePipeline.wavefrontPipelines;
+    VkDescriptorSet                                     descriptorSet = descriptorSetContainer.getSet(0);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, descriptorSetContainer.getPipeLayout(), 0, 1,
+                            &descriptorSet, 0, nullptr);
+    const uint32_t numWaves       = (traceConfig.numSamples + SORTED_SAMPLES_PER_WAVE - 1) / SORTED_SAMPLES_PER_WAVE;
+    const uint32_t pathWorkgroups = SORTED_PATHS_PER_WAVE / WAVEFRONT_WORKGROUP_SIZE;
+    static_assert(SORTED_PATHS_PER_WAVE % WAVEFRONT_WORKGROUP_SIZE == 0, "Waves must be a whole number of workgroups!");
+    for(uint32_t wave = 0; wave < numWaves; wave++)
+    {
+      pushConstants.wave = wave;
+      vkCmdPushConstants(cmdBuffer, descriptorSetContainer.getPipeLayout(), rayGenStages, 0, sizeof(PushConstants), &pushConstants);
+
+      vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, passes[eGenerate]);
+      vkCmdDispatch(cmdBuffer, pathWorkgroups, 1, 1);
+      for(uint32_t segment = 0; segment < traceConfig.maxSegments; segment++)
+      {
+        passBarrier();
+        vkCmdFillBuffer(cmdBuffer, sortCountersBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+        passBarrier();
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, passes[eClassify]);
+        vkCmdDispatch(cmdBuffer, pathWorkgroups, 1, 1);
+        passBarrier();
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, passes[eScatter]);
+        vkCmdDispatch(cmdBuffer, pathWorkgroups, 1, 1);
+        passBarrier();
+        // One invocation per path; the ones past the number of live paths return right away
+        vk.cmdTraceRaysKHR(cmdBuffer, &sbtRayGenRegion, &sbtMissRegion, &sbtHitRegion, &sbtCallableRegion,
+                           SORTED_PATHS_PER_WAVE, 1, 1);
+      }
+      passBarrier();
+      vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, passes[eResolve]);
+      vkCmdDispatch(cmdBuffer, (tile_width + WORKGROUP_WIDTH - 1) / WORKGROUP_WIDTH,
+                    (tile_height + WORKGROUP_HEIGHT - 1) / WORKGROUP_HEIGHT, 1);
+      // The next wave's generate pass overwrites the paths the resolve pass reads
+      passBarrier();
+    }
+  };
+
+  // Every sample batch runs the same bind-pipeline, bind-descriptor,
+  // push-constant and trace sequence; only the sample batch index changes.
+  // So we record the trace commands only once, into a ring of
+  // NUM_CMD_BUFFERS_IN_FLIGHT command buffers, each containing
+  // BATCHES_PER_SUBMIT traces of one tile. Command buffer `slot` reads the
+  // index of its first batch and its tile from submitParams[slot], which the
+  // CPU writes after waiting on the slot's fence and before re-submitting it. This means the
+  // CPU does almost no work per batch, and the GPU never waits on a CPU round
+  // trip.
+  std::array<VkCommandBuffer, NUM_CMD_BUFFERS_IN_FLIGHT> batchCmdBuffers;
+  std::array<VkFence, NUM_CMD_BUFFERS_IN_FLIGHT>         batchFences;
+  {
+    VkCommandBufferAllocateInfo cmdAllocInfo{.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                             .commandPool        = cmdPool,
+                                             .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                             .commandBufferCount = NUM_CMD_BUFFERS_IN_FLIGHT};
+    NVVK_CHECK(vkAllocateCommandBuffers(context, &cmdAllocInfo, batchCmdBuffers.data()));
+    // Fences start signaled, so that the first use of each slot doesn't wait.
+    VkFenceCreateInfo fenceCreateInfo{.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, .flags = VK_FENCE_CREATE_SIGNALED_BIT};
+    for(uint32_t slot = 0; slot < NUM_CMD_BUFFERS_IN_FLIGHT; slot++)
+    {
+      NVVK_CHECK(vkCreateFence(context, &fenceCreateInfo, nullptr, &batchFences[slot]));
+      debugUtil.setObjectName(batchCmdBuffers[slot], "Sample batch command buffer " + std::to_string(slot));
+      debugUtil.setObjectName(batchFences[slot], "Sample batch fence " + std::to_string(slot));
+
+      // No ONE_TIME_SUBMIT flag: these command buffers are submitted many times.
+      VkCommandBuffer          cmdBuffer = batchCmdBuffers[slot];
+      VkCommandBufferBeginInfo beginInfo{.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+      NVVK_CHECK(vkBeginCommandBuffer(cmdBuffer, &beginInfo));
+      // Resets the queries each time it runs, so that each submission can be collected
+      profiler.cmdBeginSet(cmdBuffer, slot);
+
+      pushConstants.render_width    = render_width;
+      pushConstants.render_height   = render_height;
+      pushConstants.submit_slot     = slot;
+      pushConstants.batch_in_submit = 0;
+      pushConstants.wave            = 0;
+      pushConstants.noise_threshold = noiseThreshold;
+      if(adaptiveSampling)
+      {
+        // List the pixels this submission traces. The previous submission's
+        // traces must be done with the list and the variance image first.
+        const VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        VkMemoryBarrier            toClear{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                           .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                                           .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+        vkCmdPipelineBarrier(cmdBuffer, shaderStages, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                             &toClear, 0, nullptr, 0, nullptr);
+        vkCmdFillBuffer(cmdBuffer, traceArgsBuffer.buffer, slot * sizeof(TraceArgs) + offsetof(TraceArgs, width), sizeof(uint32_t), 0);
+        VkMemoryBarrier toConverge{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                   .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                                   .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &toConverge, 0,
+                             nullptr, 0, nullptr);
+
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, convergePipeline);
+        VkDescriptorSet descriptorSet = descriptorSetContainer.getSet(0);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, descriptorSetContainer.getPipeLayout(), 0, 1,
+                                &descriptorSet, 0, nullptr);
+        vkCmdPushConstants(cmdBuffer, descriptorSetContainer.getPipeLayout(), rayGenStages, 0, sizeof(PushConstants), &pushConstants);
+        const uint32_t convergeSection = profiler.cmdBeginSection(cmdBuffer, "Converge", true);
+        vkCmdDispatch(cmdBuffer, (tile_width + WORKGROUP_WIDTH - 1) / WORKGROUP_WIDTH,
+                      (tile_height + WORKGROUP_HEIGHT - 1) / WORKGROUP_HEIGHT, 1);
+        profiler.cmdEndSection(cmdBuffer, convergeSection);
+
+        // The traces read the list, and the count as their indirect arguments
+        VkMemoryBarrier toTrace{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT};
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                                 | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                             0, 1, &toTrace, 0, nullptr, 0, nullptr);
+      }
+
+      // Bind the ray tracing pipeline, or the megakernel of --backend query:
+      const bool                rayQuery  = (traceBackend == TraceBackend::eRayQuery);
+      const VkPipelineBindPoint bindPoint = rayQuery ? VK_PIPELINE_BIND_POINT_COMPUTE : VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR;
+      vkCmdBindPipeline(cmdBuffer, bindPoint, rayQuery ? tracePipeline.queryPipeline : tracePipeline.pipeline);
+      // Bind the descriptor set
+      VkDescriptorSet descriptorSet = descriptorSetContainer.getSet(0);
+      vkCmdBindDescriptorSets(cmdBuffer, bindPoint, descriptorSetContainer.getPipeLayout(), 0, 1, &descriptorSet, 0, nullptr);
+
+      // With --reorder sort, the statistics count the invocations of its compute passes
+      const uint32_t traceSection = profiler.cmdBeginSection(cmdBuffer, "Trace", true);
+      for(uint32_t batchInSubmit = 0; batchInSubmit < BATCHES_PER_SUBMIT; batchInSubmit++)
+      {
+        // Each trace blends with the result of the previous one, so it must
+        // make the previous trace's writes to `image` visible first (this also
+        // covers the previous submission's last trace).
+        const VkAccessFlags        accesses = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        const VkPipelineStageFlags stages   = nvvk::makeAccessMaskPipelineStageFlags(accesses);
+        VkMemoryBarrier            memoryBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                                 .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                                                 .dstAccessMask = accesses};
+        vkCmdPipelineBarrier(cmdBuffer,                // Command buffer
+                             stages, stages,           // Src and dst pipeline stages
+                             0,                        // Dependency flags
+                             1, &memoryBarrier,        // Global memory barriers
+                             0, nullptr, 0, nullptr);  // No other barriers
+
+        // Push push constants:
+        pushConstants.batch_in_submit = batchInSubmit;
+        pushConstants.wave            = 0;
+        vkCmdPushConstants(cmdBuffer,                               // Command buffer
+                           descriptorSetContainer.getPipeLayout(),  // Pipeline layout
+                           rayGenStages,                            // Stage flags
+                           0,                                       // Offset
+                           sizeof(PushConstants),                   // Size in bytes
+                           &pushConstants);                         // Data
+
+        if(reorderMode == ReorderMode::eSort)
+        {
+          recordSortedTrace(cmdBuffer);
+          continue;
+        }
+
+        // The megakernel of --backend query covers the whole tile. The
+        // indirect arguments count pixels, not workgroups, so it can't be
+        // dispatched from them; the invocations past the active pixels return
+        // right away instead.
+        if(rayQuery)
+        {
+          vkCmdDispatch(cmdBuffer, (tile_width * tile_height + QUERY_WORKGROUP_SIZE - 1) / QUERY_WORKGROUP_SIZE, 1, 1);
+          continue;
+        }
+
+        // Run the ray tracing pipeline and trace rays, one invocation per
+        // active pixel of the tile
+        if(traceIndirect)
+        {
+          vk.cmdTraceRaysIndirectKHR(cmdBuffer,                                     // Command buffer
+                                     &sbtRayGenRegion,                              // Region of memory with ray generation groups
+                                     &sbtMissRegion,                                // Region of memory with miss groups
+                                     &sbtHitRegion,                                 // Region of memory with hit groups
+                                     &sbtCallableRegion,                            // Region of memory with callable groups
+                                     traceArgsAddress + slot * sizeof(TraceArgs));  // Size of dispatch
+        }
+        else
+        {
+          vk.cmdTraceRaysKHR(cmdBuffer,                 // Command buffer
+                             &sbtRayGenRegion,          // Region of memory with ray generation groups
+                             &sbtMissRegion,            // Region of memory with miss groups
+                             &sbtHitRegion,             // Region of memory with hit groups
+                             &sbtCallableRegion,        // Region of memory with callable groups
+                             tile_width * tile_height,  // Width of dispatch
+                             1,                         // Height of dispatch
+                             1);                        // Depth of dispatch
+        }
+      }
+      profiler.cmdEndSection(cmdBuffer, traceSection);
+
+      if(adaptiveSampling)
+      {
+        // Make the count of active pixels visible to the CPU once the fence is signaled
+        VkMemoryBarrier toHost{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                               .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                               .dstAccessMask = VK_ACCESS_HOST_READ_BIT};
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &toHost, 0, nullptr,
+                             0, nullptr);
+      }
+
+      NVVK_CHECK(vkEndCommandBuffer(cmdBuffer));
+    }
+  }
+
+  // The command buffers that copy a finished tile to stagingBuffers[i]; they're
+  // recorded once as well. Each one signals readbackFences[i] when done.
+  std::array<VkCommandBuffer, NUM_READBACK_BUFFERS> readbackCmdBuffers;
+  std::array<VkFence, NUM_READBACK_BUFFERS>         readbackFences;
+  {
+    VkCommandBufferAllocateInfo cmdAllocInfo{.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                             .commandPool        = cmdPool,
+                                             .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                             .commandBufferCount = NUM_READBACK_BUFFERS};
+    NVVK_CHECK(vkAllocateCommandBuffers(context, &cmdAllocInfo, readbackCmdBuffers.data()));
+
+    VkFenceCreateInfo fenceInfo{.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    for(uint32_t i = 0; i < NUM_READBACK_BUFFERS; i++)
+    {
+      NVVK_CHECK(vkCreateFence(context, &fenceInfo, nullptr, &readbackFences[i]));
+      debugUtil.setObjectName(readbackFences[i], "Readback fence " + std::to_string(i));
+
+      VkCommandBuffer cmdBuffer = readbackCmdBuffers[i];
+      debugUtil.setObjectName(cmdBuffer, "Tile readback command buffer " + std::to_string(i));
+      VkCommandBufferBeginInfo beginInfo{.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+      NVVK_CHECK(vkBeginCommandBuffer(cmdBuffer, &beginInfo));
+      profiler.cmdBeginSet(cmdBuffer, PROFILER_READBACK_SET + i);
+
+      // Make the ray tracing shaders' writes to `image` visible to the copy.
+      // Submissions on a queue execute in order, so this waits for all of the
+      // sample batches submitted before it.
+      VkMemoryBarrier memoryBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                                    .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT};
+      vkCmdPipelineBarrier(cmdBuffer,  // Command buffer
+                           // From ray tracing shaders (or the resolve pass of --reorder sort, or --backend query)
+                           VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,  // To transfers
+                           0,                                             // Dependency flags
+                           1, &memoryBarrier,                             // Global memory barriers
+                           0, nullptr, 0, nullptr);                       // No other barriers
+
+      // Copy the image (which has layout GENERAL) to the staging buffer.
+      // Texels are tightly packed in the buffer, row after row.
+      // We copy image color, mip 0, layer 0:
+      VkBufferImageCopy region{.bufferOffset      = 0,
+                               .bufferRowLength   = 0,  // Tightly packed
+                               .bufferImageHeight = 0,
+                               .imageSubresource  = {.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,  //
+                                                     .mipLevel       = 0,                          //
+                                                     .baseArrayLayer = 0,                          //
+                                                     .layerCount     = 1},
+                               .imageOffset       = {0, 0, 0},
+                               // Copy the entire tile:
+                               .imageExtent = {tile_width, tile_height, 1}};
+      const uint32_t readbackSection = profiler.cmdBeginSection(cmdBuffer, "Readback");
+      vkCmdCopyImageToBuffer(cmdBuffer,                 // Command buffer
+                             image.image,               // Source image
+                             VK_IMAGE_LAYOUT_GENERAL,   // Source image layout
+                             stagingBuffers[i].buffer,  // Destination buffer
+                             1, &region);               // Regions
+      profiler.cmdEndSection(cmdBuffer, readbackSection);
+
+      // Make the results of the copy visible to the CPU. The next tile's first
+      // sample batch overwrites `image`, so ray tracing shaders must also wait
+      // for the copy to finish reading it.
+      VkMemoryBarrier postCopyBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,  // Make transfer writes
+                                      .dstAccessMask = VK_ACCESS_HOST_READ_BIT};      // Readable by the CPU
+      vkCmdPipelineBarrier(cmdBuffer,                       // Command buffer
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,  // From transfers
+                           // To the CPU and shaders
+                           VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           0,                                                                          // No special flags
+                           1, &postCopyBarrier,                                                        // Memory barriers
+                           0, nullptr, 0, nullptr);                                                    // No other barriers
+
+      NVVK_CHECK(vkEndCommandBuffer(cmdBuffer));
+    }
+  }
+
+  // Finished tiles are handed to the output writer through `work`, in
+  // order, and encoded and written to out.hdr, out.exr and out.png on the
+  // output writer's thread. It takes ownership of a tile's staging buffer
+  // until it has copied the tile, and then returns it to
+  // `readbackBufferPool`; the render loop only blocks if all staging buffers
+  // are still waiting to be written.
+  BufferPool& readbackBufferPool = *device.readbackBufferPool;
+
+  const uint32_t numFrames       = runConfig.getFrameCount();
+  uint32_t       submissionIndex = 0;
+  // The unit the last submission of each slot traced, to tell whether its
+  // count of active pixels is about the current unit
+  std::array<uint32_t, NUM_CMD_BUFFERS_IN_FLIGHT> slotUnits;
+  slotUnits.fill(UINT32_MAX);
+  // Whether each slot and readback command buffer was submitted since the
+  // profiler last collected its queries
+  std::array<bool, NUM_CMD_BUFFERS_IN_FLIGHT> slotProfiled{};
+  std::array<bool, NUM_READBACK_BUFFERS>      readbackProfiled{};
+  // The last submissions of each slot and readback buffer; the output writer
+  // has waited on the readbacks once it released all staging buffers.
+  const auto collectInFlight = [&]() {
+    for(uint32_t i = 0; i < NUM_READBACK_BUFFERS; i++)
+    {
+      if(readbackProfiled[i])
+      {
+        profiler.collect(PROFILER_READBACK_SET + i);
+        readbackProfiled[i] = false;
+      }
+    }
+    NVVK_CHECK(vkWaitForFences(context, NUM_CMD_BUFFERS_IN_FLIGHT, batchFences.data(), VK_TRUE, UINT64_MAX));
+    for(uint32_t slot = 0; slot < NUM_CMD_BUFFERS_IN_FLIGHT; slot++)
+    {
+      if(slotProfiled[slot])
+      {
+        profiler.collect(slot);
+        slotProfiled[slot] = false;
+      }
+    }
+  };
+  // GPU time of all frames so far, to tell the GPU time of the timed frames
+  const auto totalGpuMs = [&]() {
+    double total = 0.0;
+    for(const GpuProfiler::Result& result : profiler.getResults())
+    {
+      total += result.gpu ? result.totalMs : 0.0;
+    }
+    return total;
+  };
+  // GPU time when this device took its first tile of the timed frames
+  double timedGpuStartMs = 0.0;
+  bool   timing          = false;
+  // The last frame whose camera and sky `work` set (see WorkSource::getJobParams)
+  uint32_t jobParamsFrame = ~0u;
+  // The slot of the TLAS ring the last submission of each slot traced
+  std::array<uint32_t, NUM_CMD_BUFFERS_IN_FLIGHT> slotTlas;
+  slotTlas.fill(UINT32_MAX);
+  // Returns the slot of the ring with the TLAS of a frame of the animation,
+  // after submitting its build if it isn't there yet. The submissions that
+  // traced the frame the slot held before must be done with it first; in a
+  // sequence, that's the frame before the previous one.
+  const auto prepareTlas = [&](uint32_t animationFrame) {
+    const uint32_t tlasSlot = animationFrame % tlasRing.getSlotCount();
+    if(tlasFrames[tlasSlot] != animationFrame)
+    {
+      for(uint32_t slot = 0; slot < NUM_CMD_BUFFERS_IN_FLIGHT; slot++)
+      {
+        if(slotTlas[slot] == tlasSlot)
+        {
+          NVVK_CHECK(vkWaitForFences(context, 1, &batchFences[slot], VK_TRUE, UINT64_MAX));
+          slotTlas[slot] = UINT32_MAX;
+        }
+      }
+      tlasValues[tlasSlot] = tlasRing.build(tlasSlot, makeInstances(animationFrame));
+      tlasFrames[tlasSlot] = animationFrame;
+    }
+    return tlasSlot;
+  };
+
+  work.waitUntilAllReady();
+  WorkUnit unit;
+  while(work.next(deviceIndex, unit))
+  {
+    const uint32_t tileX    = unit.tile % num_tiles_x;
+    const uint32_t tileY    = unit.tile / num_tiles_x;
+    const uint32_t endBatch = unit.firstBatch + unit.batchCount;
+    uint32_t       job      = runConfig.getJob(unit.frame);
+    if(const JobParams* jobParams = work.getJobParams(unit.frame))
+    {
+      // The entry was last used MAX_JOBS frames ago, which are done by now
+      job = unit.frame % MAX_JOBS;
+      if(jobParamsFrame != unit.frame)
+      {
+        mappedJobs[job] = *jobParams;
+        jobParamsFrame  = unit.frame;
+      }
+    }
+    // Frame N+1's TLAS builds while frame N traces
+    const uint32_t animationFrame = runConfig.getAnimationFrame(unit.frame);
+    const uint32_t tlasSlot       = prepareTlas(animationFrame);
+    if(runConfig.sequence && animationFrame + 1 < runConfig.timedFrames)
+    {
+      prepareTlas(animationFrame + 1);
     }
+    if(!timing && unit.frame >= runConfig.warmupFrames)
+    {
+      timing          = true;
+      timedGpuStartMs = totalGpuMs();
+    }
+    for(uint32_t firstBatch = unit.firstBatch; firstBatch < endBatch; firstBatch += BATCHES_PER_SUBMIT)
+    {
+      // Wait until the GPU is done with the last submission that used this slot;
+      // then it's safe to overwrite its parameters and submit it again.
+      const uint32_t slot = submissionIndex % NUM_CMD_BUFFERS_IN_FLIGHT;
+      NVVK_CHECK(vkWaitForFences(context, 1, &batchFences[slot], VK_TRUE, UINT64_MAX));
+      if(slotProfiled[slot])
+      {
+        profiler.collect(slot);
+        slotProfiled[slot] = false;
+      }
+      // If that submission found no pixels of this tile left to trace, the
+      // tile has converged. The submissions still in flight only run the
+      // converge pass, and trace nothing.
+      if(adaptiveSampling && slotUnits[slot] == unit.id && mappedTraceArgs[slot].width == 0)
+      {
+        nvprintf("Tile (%u, %u) converged; skipped %u of %u sample batches.\n", tileX, tileY, endBatch - firstBatch,
+                 unit.batchCount);
+        break;
+      }
+      submissionIndex++;
+      NVVK_CHECK(vkResetFences(context, 1, &batchFences[slot]));
+      slotUnits[slot]          = unit.id;
+      slotTlas[slot]           = tlasSlot;
+      mappedSubmitParams[slot] = {.sample_batch_base = firstBatch,
+                                  .tile_offset_x     = tileX * tile_width,
+                                  .tile_offset_y     = tileY * tile_height,
+                                  .accumulation_base = unit.firstBatch,
+                                  .job               = job,
+                                  .tlas              = tlasSlot};
 
-    // End and submit the command buffer, then wait for it to finish:
-    EndSubmitWaitAndFreeCommandBuffer(context, context.m_queueGCT, cmdPool, cmdBuffer);
+      // The traces wait for the build of their TLAS, which may still run on the build queue
+      const VkSemaphore          tlasSemaphore = tlasRing.getSemaphore();
+      const VkPipelineStageFlags tlasStages    = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+      const VkTimelineSemaphoreSubmitInfo timelineInfo{.sType                   = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+                                                       .waitSemaphoreValueCount = 1,
+                                                       .pWaitSemaphoreValues    = &tlasValues[tlasSlot]};
+      VkSubmitInfo submitInfo{.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                              .pNext              = &timelineInfo,
+                              .waitSemaphoreCount = 1,
+                              .pWaitSemaphores    = &tlasSemaphore,
+                              .pWaitDstStageMask  = &tlasStages,
+                              .commandBufferCount = 1,
+                              .pCommandBuffers    = &batchCmdBuffers[slot]};
+      NVVK_CHECK(vkQueueSubmit(context.m_queueGCT, 1, &submitInfo, batchFences[slot]));
+      slotProfiled[slot] = true;
+    }
+
+    // Copy the tile to a free staging buffer, and hand it to the output writer.
+    // The writer waits on (and resets) the buffer's fence before releasing it,
+    // so the fence isn't in use when the buffer is acquired again.
+    const uint32_t readbackSlot = readbackBufferPool.acquire();
+    // The output writer waited on the fence of its last readback before releasing it
+    if(readbackProfiled[readbackSlot])
+    {
+      profiler.collect(PROFILER_READBACK_SET + readbackSlot);
+    }
+    readbackProfiled[readbackSlot] = true;
+    VkSubmitInfo submitInfo{.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                            .commandBufferCount = 1,
+                            .pCommandBuffers    = &readbackCmdBuffers[readbackSlot]};
+    NVVK_CHECK(vkQueueSubmit(context.m_queueGCT, 1, &submitInfo, readbackFences[readbackSlot]));
 
-    nvprintf("Rendered sample batch index %d.\n", sampleBatch);
+    const uint32_t x0 = tileX * tile_width;
+    const uint32_t y0 = tileY * tile_height;
+    work.submit(unit, {.pixels         = mappedStagingBuffers[readbackSlot],
+                       .rowPitch       = size_t(tile_width) * bytesPerPixel,
+                       .format         = storageFormat->pixelFormat,
+                       .x              = x0,
+                       .y              = y0,
+                       .width          = std::min(tile_width, render_width - x0),
+                       .height         = std::min(tile_height, render_height - y0),
+                       .waitUntilReady = [&, readbackSlot]() {
+                         NVVK_CHECK(vkWaitForFences(context, 1, &readbackFences[readbackSlot], VK_TRUE, UINT64_MAX));
+                         NVVK_CHECK(vkResetFences(context, 1, &readbackFences[readbackSlot]));
+                       },
+                       .release = [&, readbackSlot]() { readbackBufferPool.release(readbackSlot); }});
+    if(numFrames == 1)
+    {
+      nvprintf("Submitted tile (%u, %u) of (%u, %u) on device %u.\n", tileX, tileY, num_tiles_x, num_tiles_y, deviceIndex);
+    }
+  }
+  // Once the output writer released all staging buffers, it's done with the
+  // tiles of this device. Until the other devices submitted the tiles before
+  // them, `work` may still hold some.
+  for(uint32_t i = 0; i < NUM_READBACK_BUFFERS; i++)
+  {
+    readbackBufferPool.acquire();
+  }
+  collectInFlight();
+  device.timedGpuMs  = timing ? totalGpuMs() - timedGpuStartMs : 0.0;
+  device.blasBuildMs = blasBuildMs;
+  device.tlasBuildMs = tlasBuildMs;
+  device.profile     = profiler.getResults();
+  // The first device's profile is written to out_profile.json and
+  // out_profile.csv, the others' to out_profile_<device index>.*
+  const std::string profileName = (deviceIndex == 0) ? "out_profile" : "out_profile_" + std::to_string(deviceIndex);
+  if(!profiler.writeJson(profileName + ".json") || !profiler.writeCsv(profileName + ".csv"))
+  {
+    LOGW("Could not write the profile to %s.json and %s.csv.\n", profileName.c_str(), profileName.c_str());
+  }
+
+  // Device-local memory this process uses, with VK_EXT_memory_budget
+  if(context.hasDeviceExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+  {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT};
+    VkPhysicalDeviceMemoryProperties2 memoryProperties{.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+                                                       .pNext = &budget};
+    vkGetPhysicalDeviceMemoryProperties2(context.m_physicalDevice, &memoryProperties);
+    for(uint32_t heap = 0; heap < memoryProperties.memoryProperties.memoryHeapCount; heap++)
+    {
+      if(memoryProperties.memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+      {
+        device.deviceMemoryMiB += double(budget.heapUsage[heap]) / (1024.0 * 1024.0);
+      }
+    }
+  }
+  for(uint32_t i = 0; i < NUM_READBACK_BUFFERS; i++)
+  {
+    vkDestroyFence(context, readbackFences[i], nullptr);
+    allocator.unmap(stagingBuffers[i]);
   }
+  vkFreeCommandBuffers(context, cmdPool, NUM_READBACK_BUFFERS, readbackCmdBuffers.data());
 
-  // Get the image data back from the GPU
-  void* data = allocator.map(imageLinear);
-  stbi_write_hdr("out.hdr", render_width, render_height, 4, reinterpret_cast<float*>(data));
-  allocator.unmap(imageLinear);
+  for(VkFence& fence : batchFences)
+  {
+    vkDestroyFence(context, fence, nullptr);
+  }
+  vkFreeCommandBuffers(context, cmdPool, NUM_CMD_BUFFERS_IN_FLIGHT, batchCmdBuffers.data());
+  allocator.unmap(submitParamsBuffer);
+  allocator.unmap(traceArgsBuffer);
+  allocator.unmap(jobsBuffer);
 
-  allocator.destroy(rtSBTBuffer);
-  vkDestroyPipeline(context, rtPipeline, nullptr);
+  allocator.destroy(submitParamsBuffer);
+  allocator.destroy(jobsBuffer);
+  allocator.destroy(activePixelsBuffer);
+  allocator.destroy(traceArgsBuffer);
+  vkDestroyPipeline(context, convergePipeline, nullptr);
+  vkDestroyShaderModule(context, convergeModule, nullptr);
+  for(nvvk::Buffer& buffer : wavefrontBuffers)
+  {
+    allocator.destroy(buffer);
+  }
+  pipelineCompiler.deinit();
+  if(!savePipelineCache(context, context.m_physicalDevice, pipelineCache, pipelineCacheFilename))
+  {
+    LOGW("Could not save the pipeline cache to %s.\n", pipelineCacheFilename.c_str());
+  }
+  vkDestroyPipelineCache(context, pipelineCache, nullptr);
+  allocator.destroy(tracePipeline.sbtBuffer);
+  vkDestroyPipeline(context, tracePipeline.pipeline, nullptr);
+  vkDestroyPipeline(context, tracePipeline.rayGenLibrary, nullptr);
+  for(VkPipeline pipeline : tracePipeline.wavefrontPipelines)
+  {
+    vkDestroyPipeline(context, pipeline, nullptr);
+  }
+  vkDestroyPipeline(context, tracePipeline.queryPipeline, nullptr);
+  for(VkPipeline library : hitLibraries)
+  {
+    vkDestroyPipeline(context, library, nullptr);
+  }
   for(VkShaderModule& shaderModule : modules)
   {
     vkDestroyShaderModule(context, shaderModule, nullptr);
   }
+  for(VkShaderModule& shaderModule : wavefrontModules)
+  {
+    vkDestroyShaderModule(context, shaderModule, nullptr);
+  }
+  vkDestroyShaderModule(context, queryModule, nullptr);
   descriptorSetContainer.deinit();
-  raytracingBuilder.destroy();
+  tlasRing.deinit();
+  for(nvvk::AccelKHR& blas : blases)
+  {
+    vk.destroyAccelerationStructureKHR(context, blas.accel, nullptr);
+    allocator.destroy(blas.buffer);
+  }
   allocator.destroy(vertexBuffer);
   allocator.destroy(indexBuffer);
+  allocator.destroy(modelsBuffer);
+  profiler.deinit();
   vkDestroyCommandPool(context, cmdPool, nullptr);
-  allocator.destroy(imageLinear);
+  for(nvvk::Buffer& stagingBuffer : stagingBuffers)
+  {
+    allocator.destroy(stagingBuffer);
+  }
   vkDestroyImageView(context, imageView, nullptr);
   allocator.destroy(image);
+  vkDestroyImageView(context, varianceImageView, nullptr);
+  allocator.destroy(varianceImage);
   allocator.deinit();
-  context.deinit();  // Don't forget to clean up at the end of the program!
+}
+
+// The CPU backend's RenderOnDevice: renders the work units `work` gives it
+// with a CpuTracer on all cores of the host. Its tiles are always RGBA32F,
+// and are handed over in NUM_READBACK_BUFFERS host buffers, like the staging
+// buffers of a device.
+void RenderOnCpu(uint32_t                          deviceIndex,
+                 RenderDevice&                     device,
+                 const RenderSettings&             settings,
+                 const std::vector<MeshCacheView>& models,
+                 WorkSource&                       work)
+{
+  const TraceConfig& traceConfig = settings.traceConfig;
+  const RunConfig&   runConfig   = settings.runConfig;
+  const uint32_t     num_tiles_x = (render_width + tile_width - 1) / tile_width;
+  const uint32_t     num_tiles_y = (render_height + tile_height - 1) / tile_height;
+  const uint32_t     numFrames   = runConfig.getFrameCount();
+
+  CpuTracer  tracer;
+  const auto blasStart = std::chrono::steady_clock::now();
+  tracer.init(models,
+              {.numSamples  = traceConfig.numSamples,
+               .maxSegments = traceConfig.maxSegments,
+               .spectral    = traceConfig.spectral != VK_FALSE},
+              std::max(1u, std::thread::hardware_concurrency()));
+  device.blasBuildMs = MillisecondsSince(blasStart);
+  // The instances' BVH is rebuilt for each frame of a sequence; the report has the first build
+  const auto tlasStart = std::chrono::steady_clock::now();
+  tracer.setInstances(settings.instances, 0);
+  device.tlasBuildMs     = MillisecondsSince(tlasStart);
+  uint32_t instanceFrame = 0;
+
+  const uint32_t bytesPerPixel = OutputWriter::getBytesPerPixel(OutputWriter::PIXEL_FORMAT_RGBA32F);
+  std::array<std::vector<float>, NUM_READBACK_BUFFERS> tileBuffers;
+  for(std::vector<float>& buffer : tileBuffers)
+  {
+    buffer.resize(size_t(tile_width) * tile_height * 4);
+  }
+  BufferPool& readbackBufferPool = *device.readbackBufferPool;
+
+  work.waitUntilAllReady();
+  WorkUnit unit;
+  while(work.next(deviceIndex, unit))
+  {
+    const uint32_t tileX = unit.tile % num_tiles_x;
+    const uint32_t tileY = unit.tile / num_tiles_x;
+    JobParams      job   = settings.jobs[runConfig.getJob(unit.frame)];
+    if(const JobParams* jobParams = work.getJobParams(unit.frame))
+    {
+      job = *jobParams;
+    }
+    const uint32_t animationFrame = runConfig.getAnimationFrame(unit.frame);
+    if(animationFrame != instanceFrame)
+    {
+      tracer.setInstances(settings.instances, animationFrame);
+      instanceFrame = animationFrame;
+    }
+
+    // The output writer releases the buffer once it converted the tile
+    const uint32_t readbackSlot = readbackBufferPool.acquire();
+    const uint32_t x0           = tileX * tile_width;
+    const uint32_t y0           = tileY * tile_height;
+    const uint32_t width        = std::min(tile_width, render_width - x0);
+    const uint32_t height       = std::min(tile_height, render_height - y0);
+    tracer.traceTile({.job          = job,
+                      .renderWidth  = render_width,
+                      .renderHeight = render_height,
+                      .x            = x0,
+                      .y            = y0,
+                      .width        = width,
+                      .height       = height,
+                      .firstBatch   = unit.firstBatch,
+                      .batchCount   = unit.batchCount},
+                     tileBuffers[readbackSlot].data());
+    work.submit(unit, {.pixels         = tileBuffers[readbackSlot].data(),
+                       .rowPitch       = size_t(width) * bytesPerPixel,
+                       .format         = OutputWriter::PIXEL_FORMAT_RGBA32F,
+                       .x              = x0,
+                       .y              = y0,
+                       .width          = width,
+                       .height         = height,
+                       .waitUntilReady = []() {},
+                       .release        = [&, readbackSlot]() { readbackBufferPool.release(readbackSlot); }});
+    if(numFrames == 1)
+    {
+      nvprintf("Submitted tile (%u, %u) of (%u, %u) on the CPU.\n", tileX, tileY, num_tiles_x, num_tiles_y);
+    }
+  }
+  // As for a device: once the output writer released all buffers, it's done with the tiles
+  for(uint32_t i = 0; i < NUM_READBACK_BUFFERS; i++)
+  {
+    readbackBufferPool.acquire();
+  }
+  tracer.deinit();
+}
+
+int main(int argc, const char** argv)
+{
+  const StorageFormat* storageFormat = &storage_formats[0];
+  TraceConfig          traceConfig;
+  ReorderMode          reorderMode    = ReorderMode::eOff;
+  TraceBackend         traceBackend   = TraceBackend::ePipeline;
+  float                noiseThreshold = 0.0f;  // Adaptive sampling is off by default
+  const char*          sceneName      = "scenes/CornellBox-Original-Merged.obj";
+  RunConfig            runConfig;
+  uint32_t             maxDevices = 0;  // --devices: how many devices render; 0 for all of them
+  // Render farm: --coordinator <port> hands out work units to the workers,
+  // which connect with --worker <host>:<port>
+  uint16_t    coordinatorPort = 0;
+  std::string coordinatorAddress;
+  uint32_t    farmPasses     = 1;                   // --passes: passes of NUM_SAMPLE_BATCHES batches over each tile
+  uint32_t    unitBatches    = NUM_SAMPLE_BATCHES;  // --unit-batches: sample batches of each work unit
+  uint32_t    workerTimeoutS = 120;                 // --worker-timeout
+  uint16_t    servePort      = 0;                   // --serve <port>: renders requests from local clients
+  uint32_t    sequenceFrames = 0;                   // --sequence <frames>: renders an animation of that many frames
+
+  // --scene-file describes the models, instances and jobs (see
+  // scene_file.hpp); without one, the scene is the grid of instances of the
+  // --scene OBJ file. The command line overrides the scene file's resolution,
+  // samples and segments, so it's read first.
+  std::string sceneFilename;
+  for(int arg = 1; arg + 1 < argc; arg++)
+  {
+    if(strcmp(argv[arg], "--scene-file") == 0)
+    {
+      sceneFilename = argv[++arg];
+    }
+  }
+  SceneDescription scene;
+  if(!sceneFilename.empty())
+  {
+    if(!parseSceneFile(sceneFilename, scene))
+    {
+      exit(1);
+    }
+    render_width            = (scene.width != 0) ? scene.width : render_width;
+    render_height           = (scene.height != 0) ? scene.height : render_height;
+    traceConfig.numSamples  = (scene.samples != 0) ? scene.samples : traceConfig.numSamples;
+    traceConfig.maxSegments = (scene.segments != 0) ? scene.segments : traceConfig.maxSegments;
+    sequenceFrames          = scene.sequenceFrames;
+  }
+
+  for(int arg = 1; arg + 1 < argc; arg++)
+  {
+    if(strcmp(argv[arg], "--scene-file") == 0)
+    {
+      arg++;  // Read above
+    }
+    else if(strcmp(argv[arg], "--samples") == 0)
+    {
+      traceConfig.numSamples = std::max(1, atoi(argv[++arg]));
+    }
+    else if(strcmp(argv[arg], "--segments") == 0)
+    {
+      traceConfig.maxSegments = std::max(1, atoi(argv[++arg]));
+    }
+    else if(strcmp(argv[arg], "--reorder") == 0)
+    {
+      const char* name = argv[++arg];
+      if(strcmp(name, "off") == 0)
+      {
+        reorderMode = ReorderMode::eOff;
+      }
+      else if(strcmp(name, "ser") == 0)
+      {
+        reorderMode = ReorderMode::eInvocationReorder;
+      }
+      else if(strcmp(name, "sort") == 0)
+      {
+        reorderMode = ReorderMode::eSort;
+      }
+      else
+      {
+        LOGE("Unknown reorder mode %s; it must be off, ser or sort.\n", name);
+        exit(1);
+      }
+    }
+    else if(strcmp(argv[arg], "--backend") == 0)
+    {
+      const char* name = argv[++arg];
+      if(strcmp(name, "pipeline") == 0)
+      {
+        traceBackend = TraceBackend::ePipeline;
+      }
+      else if(strcmp(name, "query") == 0)
+      {
+        traceBackend = TraceBackend::eRayQuery;
+      }
+      else if(strcmp(name, "cpu") == 0)
+      {
+        traceBackend = TraceBackend::eCpu;
+      }
+      else
+      {
+        LOGE("Unknown backend %s; it must be pipeline, query or cpu.\n", name);
+        exit(1);
+      }
+    }
+    else if(strcmp(argv[arg], "--color") == 0)
+    {
+      const char* name = argv[++arg];
+      if(strcmp(name, "rgb") == 0)
+      {
+        traceConfig.spectral = false;
+      }
+      else if(strcmp(name, "spectral") == 0)
+      {
+        traceConfig.spectral = true;
+      }
+      else
+      {
+        LOGE("Unknown color mode %s; it must be rgb or spectral.\n", name);
+        exit(1);
+      }
+    }
+    else if(strcmp(argv[arg], "--noise-threshold") == 0)
+    {
+      noiseThreshold = std::max(0.0f, float(atof(argv[++arg])));
+    }
+    else if(strcmp(argv[arg], "--format") == 0)
+    {
+      const char* name = argv[++arg];
+      auto        it   = std::find_if(std::begin(storage_formats), std::end(storage_formats),
+                                      [&](const StorageFormat& f) { return strcmp(f.name, name) == 0; });
+      if(it == std::end(storage_formats))
+      {
+        LOGE("Unknown storage format %s; it must be rgba32f, rgba16f or r11g11b10f.\n", name);
+        exit(1);
+      }
+      storageFormat = &(*it);
+    }
+    else if(strcmp(argv[arg], "--scene") == 0)
+    {
+      sceneName = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--resolution") == 0)
+    {
+      const char* resolution = argv[++arg];
+      if(sscanf(resolution, "%ux%u", &render_width, &render_height) != 2 || render_width == 0 || render_height == 0)
+      {
+        LOGE("Invalid resolution %s; it must be <width>x<height>.\n", resolution);
+        exit(1);
+      }
+    }
+    else if(strcmp(argv[arg], "--warmup") == 0)
+    {
+      runConfig.warmupFrames = std::max(0, atoi(argv[++arg]));
+    }
+    else if(strcmp(argv[arg], "--frames") == 0)
+    {
+      runConfig.timedFrames = std::max(1, atoi(argv[++arg]));
+    }
+    else if(strcmp(argv[arg], "--sequence") == 0)
+    {
+      sequenceFrames = uint32_t(std::max(0, atoi(argv[++arg])));
+    }
+    else if(strcmp(argv[arg], "--report") == 0)
+    {
+      runConfig.reportFilename = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--devices") == 0)
+    {
+      const char* count = argv[++arg];
+      maxDevices        = (strcmp(count, "all") == 0) ? 0 : uint32_t(std::max(1, atoi(count)));
+    }
+    else if(strcmp(argv[arg], "--coordinator") == 0)
+    {
+      const int port = atoi(argv[++arg]);
+      if(port <= 0 || port > 65535)
+      {
+        LOGE("Invalid port %s.\n", argv[arg]);
+        exit(1);
+      }
+      coordinatorPort = uint16_t(port);
+    }
+    else if(strcmp(argv[arg], "--serve") == 0)
+    {
+      const int port = atoi(argv[++arg]);
+      if(port <= 0 || port > 65535)
+      {
+        LOGE("Invalid port %s.\n", argv[arg]);
+        exit(1);
+      }
+      servePort = uint16_t(port);
+    }
+    else if(strcmp(argv[arg], "--worker") == 0)
+    {
+      coordinatorAddress = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--passes") == 0)
+    {
+      farmPasses = uint32_t(std::max(1, atoi(argv[++arg])));
+    }
+    else if(strcmp(argv[arg], "--unit-batches") == 0)
+    {
+      unitBatches = uint32_t(std::max(0, atoi(argv[++arg])));
+      if(unitBatches == 0 || unitBatches % BATCHES_PER_SUBMIT != 0 || NUM_SAMPLE_BATCHES % unitBatches != 0)
+      {
+        LOGE("Invalid --unit-batches %s; it must be a multiple of %u that divides %u.\n", argv[arg], BATCHES_PER_SUBMIT,
+             NUM_SAMPLE_BATCHES);
+        exit(1);
+      }
+    }
+    else if(strcmp(argv[arg], "--worker-timeout") == 0)
+    {
+      workerTimeoutS = uint32_t(std::max(1, atoi(argv[++arg])));
+    }
+  }
+  const uint32_t num_tiles_x = (render_width + tile_width - 1) / tile_width;
+  const uint32_t num_tiles_y = (render_height + tile_height - 1) / tile_height;
+  if(sceneFilename.empty())
+  {
+    scene = makeDefaultScene(sceneName);
+  }
+  const std::string sceneLabel = sceneFilename.empty() ? sceneName : sceneFilename;  // Names the scene in the report
+
+  // Where the shaders are found, and the models; the scene file's directory is searched first for those
+  const std::string        exePath(argv[0], std::string(argv[0]).find_last_of("/\\") + 1);
+  std::vector<std::string> searchPaths = {exePath + PROJECT_RELDIRECTORY, exePath + PROJECT_RELDIRECTORY "..",
+                                          exePath + PROJECT_RELDIRECTORY "../..", exePath + PROJECT_NAME};
+  std::vector<std::string> modelSearchPaths = searchPaths;
+  if(!sceneFilename.empty())
+  {
+    modelSearchPaths.insert(modelSearchPaths.begin(), sceneFilename.substr(0, sceneFilename.find_last_of("/\\") + 1));
+  }
+
+  // The units of a farm's tile are merged by their sample counts, so all the
+  // pixels of a unit must get all of its sample batches
+  const bool farm = (coordinatorPort != 0 || !coordinatorAddress.empty());
+  if(farm && servePort != 0)
+  {
+    LOGE("--serve can't be used with --coordinator or --worker.\n");
+    exit(1);
+  }
+  if(farm && noiseThreshold > 0.0f)
+  {
+    LOGW("--noise-threshold isn't supported in a render farm; every pixel gets every sample batch.\n");
+    noiseThreshold = 0.0f;
+  }
+  if(farm && scene.jobs.size() > 1)
+  {
+    LOGW("A render farm only renders the first job of %s.\n", sceneFilename.c_str());
+    scene.jobs.resize(1);
+  }
+  // Devices that don't support the requested --reorder, --backend or --format
+  // fall back later; the hash is of what was requested
+  const uint64_t configHash = getFarmConfigHash(sceneFilename, scene, modelSearchPaths,
+                                                {.width          = render_width,
+                                                 .height         = render_height,
+                                                 .samples        = traceConfig.numSamples,
+                                                 .segments       = traceConfig.maxSegments,
+                                                 .spectral       = traceConfig.spectral,
+                                                 .noiseThreshold = noiseThreshold,
+                                                 .backend        = uint32_t(traceBackend),
+                                                 .reorderMode    = uint32_t(reorderMode),
+                                                 .pixelFormat    = uint32_t(storageFormat->pixelFormat)});
+  if((farm || servePort != 0) && sequenceFrames > 0)
+  {
+    LOGW("Sequences aren't supported by --serve, --coordinator or --worker; the instances don't move.\n");
+    sequenceFrames = 0;
+  }
+  // A sequence's frames replace the timed frames of each job
+  if(sequenceFrames > 0)
+  {
+    runConfig.sequence    = true;
+    runConfig.timedFrames = sequenceFrames;
+  }
+  runConfig.numJobs = static_cast<uint32_t>(scene.jobs.size());
+  // The coordinator doesn't render; it merges what the workers render, and
+  // writes the first job's output after each pass of the last frame.
+  if(coordinatorPort != 0)
+  {
+    OutputWriter    outputWriter;
+    FarmCoordinator coordinator;
+    const bool      coordinated = coordinator.run(coordinatorPort,
+                                                  {.width           = render_width,
+                                                   .height          = render_height,
+                                                   .tileWidth       = tile_width,
+                                                   .tileHeight      = tile_height,
+                                                   .numFrames       = runConfig.getFrameCount(),
+                                                   .samplesPerBatch = traceConfig.numSamples,
+                                                   .batchesPerPass  = NUM_SAMPLE_BATCHES,
+                                                   .numPasses       = farmPasses,
+                                                   .unitBatches     = unitBatches,
+                                                   .timeoutSeconds  = workerTimeoutS,
+                                                   .configHash      = configHash,
+                                                   .output          = scene.jobs[0].output},
+                                                  outputWriter);
+    outputWriter.flush();
+    return coordinated ? 0 : 1;
+  }
+
+  // Create the Vulkan context, consisting of an instance, device, physical device, and queues.
+  nvvk::ContextCreateInfo deviceInfo;  // One can modify this to load different extensions or pick the Vulkan core version
+  deviceInfo.apiMajor = 1;             // Specify the version of Vulkan we'll use
+  deviceInfo.apiMinor = 2;
+  // Required by KHR_acceleration_structure; allows work to be offloaded onto background threads and parallelized
+  deviceInfo.addDeviceExtension(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME);
+  VkPhysicalDeviceAccelerationStructureFeaturesKHR asFeatures{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR};
+  deviceInfo.addDeviceExtension(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME, false, &asFeatures);
+  VkPhysicalDeviceRayTracingPipelineFeaturesKHR rtPipelineFeatures{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR};
+  deviceInfo.addDeviceExtension(VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME, false, &rtPipelineFeatures);
+  // Ray tracing pipelines are linked from separately compiled libraries
+  deviceInfo.addDeviceExtension(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+  // Optional: --reorder ser reorders invocations, and --reorder sort finds hits with ray queries
+  VkPhysicalDeviceRayTracingInvocationReorderFeaturesNV reorderFeatures{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_INVOCATION_REORDER_FEATURES_NV};
+  deviceInfo.addDeviceExtension(VK_NV_RAY_TRACING_INVOCATION_REORDER_EXTENSION_NAME, true, &reorderFeatures);
+  VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR};
+  deviceInfo.addDeviceExtension(VK_KHR_RAY_QUERY_EXTENSION_NAME, true, &rayQueryFeatures);
+  // Optional: reports how much device memory the renderer uses
+  deviceInfo.addDeviceExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME, true);
+
+  // Every compatible device renders, up to --devices of them. Each one gets
+  // its own context (with its own instance), and loads the commands of its
+  // device extensions for itself (see device_functions.hpp), since nvvk's
+  // globals only hold the last device's.
+  std::vector<RenderDevice> devices;
+  bool                      supportsInvocationReorder = true;
+  bool                      supportsRayQuery          = true;
+  std::vector<bool>         supportsTraceIndirect;
+  if(traceBackend == TraceBackend::eCpu)
+  {
+    // The host renders on its own, without a Vulkan context
+    devices.push_back({.name = "CPU (" + std::to_string(std::max(1u, std::thread::hardware_concurrency())) + " threads)"});
+    supportsTraceIndirect.push_back(false);
+  }
+  else
+  {
+    std::unique_ptr<nvvk::Context> firstContext = std::make_unique<nvvk::Context>();
+    firstContext->initInstance(deviceInfo);
+    const std::vector<uint32_t> compatibleDevices = firstContext->getCompatibleDevices(deviceInfo);
+    if(compatibleDevices.empty())
+    {
+      LOGE("No device supports the required extensions.\n");
+      exit(1);
+    }
+    const size_t numCandidates =
+        (maxDevices == 0) ? compatibleDevices.size() : std::min<size_t>(maxDevices, compatibleDevices.size());
+    for(size_t i = 0; i < numCandidates; i++)
+    {
+      std::unique_ptr<nvvk::Context> context = firstContext ? std::move(firstContext) : std::make_unique<nvvk::Context>();
+      if(context->m_instance == VK_NULL_HANDLE)
+      {
+        context->initInstance(deviceInfo);
+      }
+      if(!context->initDevice(compatibleDevices[i], deviceInfo))
+      {
+        LOGW("Could not create compatible device %u; skipping it.\n", compatibleDevices[i]);
+        context->deinit();
+        continue;
+      }
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(context->m_physicalDevice, &properties);
+      // initDevice() wrote the features of this device to the structs chained to deviceInfo
+      supportsInvocationReorder = supportsInvocationReorder
+                                  && context->hasDeviceExtension(VK_NV_RAY_TRACING_INVOCATION_REORDER_EXTENSION_NAME)
+                                  && reorderFeatures.rayTracingInvocationReorder;
+      supportsRayQuery =
+          supportsRayQuery && context->hasDeviceExtension(VK_KHR_RAY_QUERY_EXTENSION_NAME) && rayQueryFeatures.rayQuery;
+      supportsTraceIndirect.push_back(rtPipelineFeatures.rayTracingPipelineTraceRaysIndirect);
+      DeviceFunctions functions;
+      functions.load(*context);
+      devices.push_back({.context = std::move(context), .functions = functions, .name = properties.deviceName});
+    }
+    // nvvk::DebugUtil names objects through nvvk's globals too, so only one device gets names
+    if(devices.size() > 1)
+    {
+      nvvk::DebugUtil::setEnabled(false);
+    }
+  }
+  if(devices.empty())
+  {
+    LOGE("Could not create any device.\n");
+    exit(1);
+  }
+  for(size_t d = 0; d < devices.size(); d++)
+  {
+    nvprintf("Device %zu: %s\n", d, devices[d].name.c_str());
+  }
+
+  // All devices render the same image, so they use the modes all of them support.
+  if(traceBackend == TraceBackend::eRayQuery && !supportsRayQuery)
+  {
+    LOGW("Not every device supports ray queries; tracing with the ray tracing pipeline instead.\n");
+    traceBackend = TraceBackend::ePipeline;
+  }
+  if(traceBackend == TraceBackend::eRayQuery && reorderMode != ReorderMode::eOff)
+  {
+    LOGW("--reorder isn't supported with --backend query; rays are not reordered by material.\n");
+    reorderMode = ReorderMode::eOff;
+  }
+  if(traceBackend == TraceBackend::eCpu && reorderMode != ReorderMode::eOff)
+  {
+    LOGW("--reorder isn't supported with --backend cpu; rays are not reordered by material.\n");
+    reorderMode = ReorderMode::eOff;
+  }
+  if(reorderMode == ReorderMode::eInvocationReorder && !supportsInvocationReorder)
+  {
+    LOGW("Not every device supports invocation reordering; sorting rays by material instead.\n");
+    reorderMode = ReorderMode::eSort;
+  }
+  if(reorderMode == ReorderMode::eSort && !supportsRayQuery)
+  {
+    LOGW("Not every device supports ray queries; rays are not sorted by material.\n");
+    reorderMode = ReorderMode::eOff;
+  }
+  // The passes of --reorder sort trace every pixel of the tile.
+  if(reorderMode == ReorderMode::eSort && noiseThreshold > 0.0f)
+  {
+    LOGW("--noise-threshold isn't supported with --reorder sort; every pixel gets every sample batch.\n");
+    noiseThreshold = 0.0f;
+  }
+  if(traceBackend == TraceBackend::eCpu && noiseThreshold > 0.0f)
+  {
+    LOGW("--noise-threshold isn't supported with --backend cpu; every pixel gets every sample batch.\n");
+    noiseThreshold = 0.0f;
+  }
+  // With --noise-threshold, each submission only traces the pixels of the tile
+  // that haven't converged yet: a converge pass lists them first (see
+  // converge.comp.glsl), the megakernel traces just those, and a tile stops
+  // early once all of its pixels have. Without it, there's no converge pass,
+  // and the megakernel traces the whole tile directly.
+  const bool adaptiveSampling = (noiseThreshold > 0.0f);
+  // With vkCmdTraceRaysIndirectKHR, only as many invocations as there are
+  // active pixels are launched; otherwise, the others return right away.
+  for(size_t d = 0; d < devices.size(); d++)
+  {
+    devices[d].traceIndirect = adaptiveSampling && supportsTraceIndirect[d];
+  }
+
+  // The CPU backend accumulates in 32-bit floats, and hands its tiles over as they are
+  if(traceBackend == TraceBackend::eCpu && storageFormat != &storage_formats[0])
+  {
+    LOGW("--format %s isn't supported with --backend cpu; using %s instead.\n", storageFormat->name, storage_formats[0].name);
+    storageFormat = &storage_formats[0];
+  }
+  // Storage image support is only guaranteed for R32G32B32A32_SFLOAT, so
+  // check whether the devices can trace into and copy from the selected format.
+  for(const RenderDevice& device : devices)
+  {
+    if(!device.context)
+    {
+      continue;  // The CPU
+    }
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(device.context->m_physicalDevice, storageFormat->format, &formatProperties);
+    const VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT;
+    if((formatProperties.optimalTilingFeatures & requiredFeatures) != requiredFeatures)
+    {
+      LOGW("%s doesn't support %s storage images; using %s instead.\n", device.name.c_str(), storageFormat->name,
+           storage_formats[0].name);
+      storageFormat = &storage_formats[0];
+      break;
+    }
+  }
+
+  // Load the models from their OBJ files, once for all devices.
+  // If the mesh cache next to an OBJ file is up to date, we map it and upload
+  // its sections directly. Otherwise, we parse the OBJ file on all threads
+  // (all of its shapes are merged into one mesh), and write the cache for the
+  // next run. The deque keeps the models' storage in place as it grows.
+  struct HostModel
+  {
+    MeshCache             meshCache;
+    ObjData               objData;
+    std::vector<uint32_t> objIndices;
+  };
+  std::deque<HostModel>      hostModels;
+  std::vector<MeshCacheView> models;
+  for(const SceneModel& sceneModel : scene.models)
+  {
+    const std::string objFilename = nvh::findFile(sceneModel.filename, modelSearchPaths);
+    if(objFilename.empty())
+    {
+      LOGE("Could not find the OBJ file %s of model %s.\n", sceneModel.filename.c_str(), sceneModel.name.c_str());
+      exit(1);
+    }
+    HostModel&    hostModel = hostModels.emplace_back();
+    MeshCacheView mesh;
+    if(hostModel.meshCache.open(getMeshCacheFilename(objFilename), objFilename, MESH_CACHE_LAYOUT_POSITIONS, 3 * sizeof(float), 0))
+    {
+      mesh = hostModel.meshCache.view();
+    }
+    else
+    {
+      ObjData& objData = hostModel.objData;
+      // A half-parsed model may have unresolved indices, and mustn't be cached
+      if(!parseObjParallel(objFilename, objData))
+      {
+        LOGE("Could not parse the OBJ file %s of model %s.\n", objFilename.c_str(), sceneModel.name.c_str());
+        exit(1);
+      }
+      // Get the indices of the vertices of each triangle in `objData.positions`:
+      hostModel.objIndices.reserve(objData.indices.size());
+      for(const ObjIndex& index : objData.indices)
+      {
+        hostModel.objIndices.push_back(static_cast<uint32_t>(index.vertex));
+      }
+      mesh.vertices      = objData.positions.data();
+      mesh.vertexCount   = objData.positions.size() / 3;
+      mesh.indices       = hostModel.objIndices.data();
+      mesh.indexCount    = hostModel.objIndices.size();
+      mesh.materialIDs   = objData.materialIDs.data();
+      mesh.triangleCount = objData.materialIDs.size();
+      if(!writeMeshCache(getMeshCacheFilename(objFilename), objFilename, MESH_CACHE_LAYOUT_POSITIONS, 3 * sizeof(float), 0, mesh))
+      {
+        LOGW("Could not write the mesh cache for %s.\n", objFilename.c_str());
+      }
+    }
+    models.push_back(mesh);
+  }
+
+  RenderSettings settings{.storageFormat    = storageFormat,
+                          .traceConfig      = traceConfig,
+                          .reorderMode      = reorderMode,
+                          .traceBackend     = traceBackend,
+                          .noiseThreshold   = noiseThreshold,
+                          .adaptiveSampling = adaptiveSampling,
+                          .runConfig        = runConfig,
+                          .searchPaths      = searchPaths,
+                          .instances        = scene.instances};
+  for(const SceneJob& job : scene.jobs)
+  {
+    settings.jobs.push_back(makeJobParams(job));
+  }
+
+  const auto renderOnAllDevices = [&](WorkSource& work) {
+    std::vector<std::thread> threads;
+    for(uint32_t d = 0; d < devices.size(); d++)
+    {
+      devices[d].readbackBufferPool = std::make_unique<BufferPool>(NUM_READBACK_BUFFERS);
+      threads.emplace_back(devices[d].context ? RenderOnDevice : RenderOnCpu, d, std::ref(devices[d]), std::cref(settings),
+                           std::cref(models), std::ref(work));
+    }
+    for(std::thread& thread : threads)
+    {
+      thread.join();
+    }
+  };
+
+  // A worker renders the coordinator's units until it has none left, with
+  // the scene, acceleration structures and pipelines set up once
+  if(!coordinatorAddress.empty())
+  {
+    FarmWorker worker;
+    // Two units per device keep each one busy while the next ones are on their way
+    if(!worker.connect(coordinatorAddress, configHash, 2 * static_cast<uint32_t>(devices.size())))
+    {
+      exit(1);
+    }
+    renderOnAllDevices(worker);
+    const bool finished = worker.disconnect();
+    nvprintf("Rendered %u work units for %s.\n", worker.getSentUnitCount(), coordinatorAddress.c_str());
+    for(RenderDevice& device : devices)
+    {
+      if(device.context)
+      {
+        device.context->deinit();
+      }
+    }
+    return finished ? 0 : 1;
+  }
+
+  // The server renders the camera and sky of each request with everything
+  // else set up once, until a client shuts it down
+  if(servePort != 0)
+  {
+    OutputWriter outputWriter;
+    RenderServer server;
+    if(!server.start(servePort,
+                     {.width          = render_width,
+                      .height         = render_height,
+                      .tileWidth      = tile_width,
+                      .tileHeight     = tile_height,
+                      .batchesPerTile = NUM_SAMPLE_BATCHES,
+                      .defaultJob     = scene.jobs[0]},
+                     outputWriter))
+    {
+      exit(1);
+    }
+    renderOnAllDevices(server);
+    server.close();
+    outputWriter.flush();
+    nvprintf("Rendered %u requests.\n", server.getRenderedCount());
+    for(RenderDevice& device : devices)
+    {
+      if(device.context)
+      {
+        device.context->deinit();
+      }
+    }
+    return 0;
+  }
+
+  // Each device renders on its own thread; `scheduler` splits the tiles of
+  // all frames between them, and hands the finished tiles to the output
+  // writer, which encodes them and writes them to <output>.hdr, .exr and
+  // .png of each job on its own thread.
+  OutputWriter   outputWriter;
+  const uint32_t numTiles  = num_tiles_x * num_tiles_y;
+  const uint32_t numFrames = runConfig.getFrameCount();
+  TileScheduler  scheduler(
+      outputWriter, static_cast<uint32_t>(devices.size()), numTiles, numFrames, runConfig.warmupFrames, NUM_SAMPLE_BATCHES,
+      [&](uint32_t frame) {
+        // Only the last frame of each job is written out, or each frame of a
+        // sequence to <output>_<frame>; the others are still read back and converted
+        const bool  writtenOut = runConfig.isWrittenOut(frame);
+        std::string output     = scene.jobs[runConfig.getJob(frame)].output;
+        if(runConfig.sequence)
+        {
+          std::array<char, 16> suffix;
+          snprintf(suffix.data(), suffix.size(), "_%04u", runConfig.getAnimationFrame(frame));
+          output += suffix.data();
+        }
+        outputWriter.beginFrame(output, render_width, render_height, tile_height,
+                                writtenOut ? (OutputWriter::FORMAT_HDR | OutputWriter::FORMAT_EXR | OutputWriter::FORMAT_PNG) : 0);
+      },
+      [&](uint32_t frame) {
+        outputWriter.endFrame();
+        if(numFrames > 1)
+        {
+          nvprintf("Submitted frame %u of %u%s.\n", frame + 1, numFrames, (frame < runConfig.warmupFrames) ? " (warmup)" : "");
+        }
+      });
+  renderOnAllDevices(scheduler);
+  outputWriter.flush();
+  const double timedMs = MillisecondsSince(scheduler.getTimedStart());
+
+  // The devices build their acceleration structures at the same time; the
+  // report has the slowest builds, the GPU time and memory of all devices,
+  // and all of their names.
+  double      timedGpuMs      = 0.0;
+  double      blasBuildMs     = 0.0;
+  double      tlasBuildMs     = 0.0;
+  double      deviceMemoryMiB = 0.0;
+  std::string deviceNames;
+  for(uint32_t d = 0; d < devices.size(); d++)
+  {
+    const RenderDevice& device = devices[d];
+    nvprintf("Device %u (%s): %u of %u tiles\n", d, device.name.c_str(), scheduler.getTileCount(d), numTiles * numFrames);
+    for(const GpuProfiler::Result& result : device.profile)
+    {
+      nvprintf("%-12s %s %6u x, mean %9.3f ms, total %10.3f ms\n", result.name.c_str(), result.gpu ? "gpu " : "host", result.count,
+               result.totalMs / std::max(result.count, 1u), result.totalMs);
+    }
+    timedGpuMs += device.timedGpuMs;
+    blasBuildMs = std::max(blasBuildMs, device.blasBuildMs);
+    tlasBuildMs = std::max(tlasBuildMs, device.tlasBuildMs);
+    deviceMemoryMiB += device.deviceMemoryMiB;
+    deviceNames += (d > 0 ? ", " : "") + device.name;
+  }
+
+  // Each frame traces one camera ray per sample; with --noise-threshold, that's an upper bound.
+  const uint32_t timedFrames   = runConfig.timedFrames * runConfig.numJobs;
+  const double   msPerFrame    = timedMs / timedFrames;
+  const double   gpuMsPerFrame = timedGpuMs / timedFrames;
+  const double   primaryRays   = double(render_width) * render_height * NUM_SAMPLE_BATCHES * traceConfig.numSamples;
+  const double   primaryMrays  = primaryRays / (msPerFrame * 1000.0);
+  nvprintf("%u timed frames on %zu devices: %.3f ms/frame (GPU %.3f ms/frame), %.1f primary Mrays/s, BLAS %.3f ms, TLAS %.3f ms, %.1f MiB\n",
+           timedFrames, devices.size(), msPerFrame, gpuMsPerFrame, primaryMrays, blasBuildMs, tlasBuildMs, deviceMemoryMiB);
+  if(!runConfig.reportFilename.empty())
+  {
+    static const char* reorder_names[] = {"off", "ser", "sort"};
+    static const char* backend_names[] = {"pipeline", "query", "cpu"};
+    FILE*              report          = fopen(runConfig.reportFilename.c_str(), "a");
+    if(report == nullptr)
+    {
+      LOGE("Could not open the report %s.\n", runConfig.reportFilename.c_str());
+      exit(1);
+    }
+    fprintf(report,
+            "{\"scene\": \"%s\", \"reorder\": \"%s\", \"backend\": \"%s\", \"color\": \"%s\", \"samples\": %u, "
+            "\"segments\": %u, \"width\": %u, \"height\": %u, \"frames\": %u, \"msPerFrame\": %.6f, \"gpuMsPerFrame\": %.6f, "
+            "\"primaryMraysPerSecond\": %.6f, \"blasBuildMs\": %.6f, \"tlasBuildMs\": %.6f, \"deviceMemoryMiB\": %.3f, "
+            "\"devices\": %zu, \"device\": \"%s\"}\n",
+            sceneLabel.c_str(), reorder_names[static_cast<int>(reorderMode)], backend_names[static_cast<int>(traceBackend)],
+            traceConfig.spectral ? "spectral" : "rgb", traceConfig.numSamples, traceConfig.maxSegments, render_width,
+            render_height, timedFrames, msPerFrame, gpuMsPerFrame, primaryMrays, blasBuildMs, tlasBuildMs, deviceMemoryMiB,
+            devices.size(), deviceNames.c_str());
+    fclose(report);
+  }
+
+  for(RenderDevice& device : devices)
+  {
+    if(device.context)
+    {
+      device.context->deinit();  // Don't forget to clean up at the end of the program!
+    }
+  }
 }
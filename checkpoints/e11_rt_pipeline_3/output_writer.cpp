@@ -0,0 +1,300 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "output_writer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <glm/gtc/packing.hpp>
+#include <nvh/nvprint.hpp>
+
+#include "exr_writer.hpp"
+#include "hdr_writer.hpp"
+
+BufferPool::BufferPool(uint32_t count)
+{
+  for(uint32_t i = 0; i < count; i++)
+  {
+    m_free.push_back(i);
+  }
+}
+
+uint32_t BufferPool::acquire()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_released.wait(lock, [&] { return !m_free.empty(); });
+  const uint32_t index = m_free.back();
+  m_free.pop_back();
+  return index;
+}
+
+void BufferPool::release(uint32_t index)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_free.push_back(index);
+  }
+  m_released.notify_one();
+}
+
+// The state of the frame the worker is writing.
+struct OutputWriter::Frame
+{
+  std::string       basePath;
+  uint32_t          width = 0, height = 0, tileHeight = 0, formats = 0;
+  HdrScanlineWriter hdr;
+  ExrScanlineWriter exr;
+  // Tiles are gathered into a strip of tileHeight full-width rows, which
+  // is encoded once all of its tiles have arrived.
+  std::vector<float> strip;
+  uint32_t           stripY               = 0;
+  uint64_t           stripPixelsRemaining = 0;
+  // The tonemapped frame, for formats that can't be streamed.
+  std::vector<uint8_t> ldr;
+};
+
+// Maps linear HDR values to [0, 1] using Krzysztof Narkowicz's fit of the
+// ACES filmic curve, then applies the sRGB transfer function.
+static uint8_t tonemapToSRGB8(float linear)
+{
+  const float x      = std::max(linear, 0.0f);
+  const float mapped = std::clamp((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f), 0.0f, 1.0f);
+  const float srgb   = (mapped <= 0.0031308f) ? 12.92f * mapped : 1.055f * std::pow(mapped, 1.0f / 2.4f) - 0.055f;
+  return uint8_t(srgb * 255.0f + 0.5f);
+}
+
+uint32_t OutputWriter::getBytesPerPixel(PixelFormat format)
+{
+  switch(format)
+  {
+    case PIXEL_FORMAT_RGBA16F:
+      return 8;
+    case PIXEL_FORMAT_B10G11R11F:
+      return 4;
+    default:
+      return 16;
+  }
+}
+
+void OutputWriter::decodePixels(const void* src, PixelFormat format, uint32_t count, float* dst)
+{
+  switch(format)
+  {
+    case OutputWriter::PIXEL_FORMAT_RGBA32F:
+      memcpy(dst, src, size_t(count) * 4 * sizeof(float));
+      break;
+    case OutputWriter::PIXEL_FORMAT_RGBA16F:
+      for(uint32_t i = 0; i < count; i++)
+      {
+        uint64_t packed;
+        memcpy(&packed, static_cast<const uint8_t*>(src) + size_t(i) * sizeof(packed), sizeof(packed));
+        const glm::vec4 color = glm::unpackHalf4x16(packed);
+        memcpy(dst + size_t(i) * 4, &color, sizeof(color));
+      }
+      break;
+    case OutputWriter::PIXEL_FORMAT_B10G11R11F:
+      // R is in the lowest 11 bits, then G in 11 bits and B in the top 10 bits.
+      for(uint32_t i = 0; i < count; i++)
+      {
+        uint32_t packed;
+        memcpy(&packed, static_cast<const uint8_t*>(src) + size_t(i) * sizeof(packed), sizeof(packed));
+        const glm::vec3 color = glm::unpackF2x11_1x10(packed);
+        dst[size_t(i) * 4 + 0] = color.r;
+        dst[size_t(i) * 4 + 1] = color.g;
+        dst[size_t(i) * 4 + 2] = color.b;
+        dst[size_t(i) * 4 + 3] = 1.0f;
+      }
+      break;
+  }
+}
+
+OutputWriter::OutputWriter(size_t maxQueuedJobs)
+    : m_maxQueuedJobs(maxQueuedJobs)
+{
+  m_worker = std::thread(&OutputWriter::workerLoop, this);
+}
+
+OutputWriter::~OutputWriter()
+{
+  push(Job{.type = Job::EXIT});
+  m_worker.join();
+}
+
+void OutputWriter::beginFrame(const std::string& basePath, uint32_t width, uint32_t height, uint32_t tileHeight, uint32_t formats)
+{
+  push(Job{.type       = Job::BEGIN_FRAME,
+           .basePath   = basePath,
+           .width      = width,
+           .height     = height,
+           .tileHeight = std::min(tileHeight, height),
+           .formats    = formats});
+}
+
+void OutputWriter::writeTile(Tile tile)
+{
+  push(Job{.type = Job::TILE, .tile = std::move(tile)});
+}
+
+void OutputWriter::endFrame()
+{
+  push(Job{.type = Job::END_FRAME});
+}
+
+void OutputWriter::flush()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_queueChanged.wait(lock, [&] { return m_queue.empty() && !m_busy; });
+}
+
+void OutputWriter::push(Job&& job)
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_queueChanged.wait(lock, [&] { return m_queue.size() < m_maxQueuedJobs; });
+    m_queue.push_back(std::move(job));
+  }
+  m_queueChanged.notify_all();
+}
+
+void OutputWriter::workerLoop()
+{
+  while(true)
+  {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_queueChanged.wait(lock, [&] { return !m_queue.empty(); });
+      job = std::move(m_queue.front());
+      m_queue.pop_front();
+      m_busy = true;
+    }
+    m_queueChanged.notify_all();
+
+    if(job.type == Job::EXIT)
+    {
+      return;
+    }
+
+    switch(job.type)
+    {
+      case Job::BEGIN_FRAME: {
+        assert(!m_frame);
+        m_frame             = std::make_unique<Frame>();
+        m_frame->basePath   = job.basePath;
+        m_frame->width      = job.width;
+        m_frame->height     = job.height;
+        m_frame->tileHeight = job.tileHeight;
+        m_frame->formats    = job.formats;
+        m_frame->strip.resize(size_t(job.width) * job.tileHeight * 4);
+        m_frame->stripPixelsRemaining = uint64_t(job.width) * job.tileHeight;
+        if((job.formats & FORMAT_HDR) && !m_frame->hdr.open((job.basePath + ".hdr").c_str(), job.width, job.height))
+        {
+          LOGE("Could not open %s.hdr for writing!\n", job.basePath.c_str());
+          m_frame->formats &= ~FORMAT_HDR;  // So that no strip is written to it
+        }
+        if((job.formats & FORMAT_EXR) && !m_frame->exr.open((job.basePath + ".exr").c_str(), job.width, job.height))
+        {
+          LOGE("Could not open %s.exr for writing!\n", job.basePath.c_str());
+          m_frame->formats &= ~FORMAT_EXR;
+        }
+        if(job.formats & FORMAT_PNG)
+        {
+          m_frame->ldr.resize(size_t(job.width) * job.height * 3);
+        }
+        break;
+      }
+      case Job::TILE:
+        processTile(job.tile);
+        break;
+      case Job::END_FRAME:
+        assert(m_frame && m_frame->stripY == m_frame->height);
+        m_frame->hdr.close();
+        m_frame->exr.close();
+        if(m_frame->formats & FORMAT_PNG)
+        {
+          const std::string filename = m_frame->basePath + ".png";
+          if(!stbi_write_png(filename.c_str(), int(m_frame->width), int(m_frame->height), 3, m_frame->ldr.data(),
+                             int(m_frame->width * 3)))
+          {
+            LOGE("Could not write %s!\n", filename.c_str());
+          }
+        }
+        m_frame.reset();
+        break;
+      default:
+        break;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_busy = false;
+    }
+    m_queueChanged.notify_all();
+  }
+}
+
+void OutputWriter::processTile(Tile& tile)
+{
+  assert(m_frame);
+  Frame& frame = *m_frame;
+  assert(tile.y == frame.stripY && tile.x + tile.width <= frame.width);
+  assert(tile.height == std::min(frame.tileHeight, frame.height - frame.stripY));
+
+  if(tile.waitUntilReady)
+  {
+    tile.waitUntilReady();
+  }
+  for(uint32_t y = 0; y < tile.height; y++)
+  {
+    decodePixels(static_cast<const uint8_t*>(tile.pixels) + y * tile.rowPitch, tile.format, tile.width,
+                 &frame.strip[(size_t(y) * frame.width + tile.x) * 4]);
+  }
+  if(tile.release)
+  {
+    tile.release();
+  }
+
+  frame.stripPixelsRemaining -= uint64_t(tile.width) * tile.height;
+  if(frame.stripPixelsRemaining == 0)
+  {
+    finishStrip();
+  }
+}
+
+void OutputWriter::finishStrip()
+{
+  Frame&         frame     = *m_frame;
+  const uint32_t numRows   = std::min(frame.tileHeight, frame.height - frame.stripY);
+  const size_t   rowStride = size_t(frame.width) * 4;
+
+  if(frame.formats & FORMAT_HDR)
+  {
+    frame.hdr.writeRows(frame.strip.data(), numRows, 4, rowStride);
+  }
+  if(frame.formats & FORMAT_EXR)
+  {
+    frame.exr.writeRows(frame.strip.data(), numRows, 4, rowStride);
+  }
+  if(frame.formats & FORMAT_PNG)
+  {
+    for(uint32_t y = 0; y < numRows; y++)
+    {
+      const float* src = frame.strip.data() + y * rowStride;
+      uint8_t*     dst = frame.ldr.data() + (size_t(frame.stripY) + y) * frame.width * 3;
+      for(uint32_t x = 0; x < frame.width; x++)
+      {
+        for(uint32_t c = 0; c < 3; c++)
+        {
+          dst[x * 3 + c] = tonemapToSRGB8(src[x * 4 + c]);
+        }
+      }
+    }
+  }
+
+  frame.stripY += numRows;
+  frame.stripPixelsRemaining = uint64_t(frame.width) * std::min(frame.tileHeight, frame.height - frame.stripY);
+}
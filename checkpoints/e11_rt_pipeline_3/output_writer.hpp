@@ -0,0 +1,122 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Encodes and writes rendered frames on a worker thread, so that rendering
+// never waits on image encoding or file I/O.
+// The render loop hands over finished tiles without copying them: each tile
+// comes with a callback that waits until its pixels are ready (e.g. waits on
+// a readback fence) and one that returns its memory to the render loop
+// (e.g. to a BufferPool). Both are called on the worker thread.
+#ifndef VK_MINI_PATH_TRACER_OUTPUT_WRITER_HPP
+#define VK_MINI_PATH_TRACER_OUTPUT_WRITER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Hands out the indices of a fixed number of buffers, blocking while all of
+// them are in use. Indices can be released from any thread.
+class BufferPool
+{
+public:
+  explicit BufferPool(uint32_t count);
+
+  uint32_t acquire();
+  void     release(uint32_t index);
+
+private:
+  std::mutex              m_mutex;
+  std::condition_variable m_released;
+  std::vector<uint32_t>   m_free;
+};
+
+class OutputWriter
+{
+public:
+  enum Format : uint32_t
+  {
+    FORMAT_HDR = 1 << 0,  // Radiance .hdr, streamed out row by row
+    FORMAT_EXR = 1 << 1,  // Uncompressed 32-bit float .exr, streamed out row by row
+    FORMAT_PNG = 1 << 2,  // Tonemapped 8-bit sRGB .png, written at the end of the frame
+  };
+
+  // How the pixels of a tile are stored; matches the storage image formats
+  // the renderer supports. The writer converts them to 32-bit floats.
+  enum PixelFormat : uint32_t
+  {
+    PIXEL_FORMAT_RGBA32F,     // VK_FORMAT_R32G32B32A32_SFLOAT
+    PIXEL_FORMAT_RGBA16F,     // VK_FORMAT_R16G16B16A16_SFLOAT
+    PIXEL_FORMAT_B10G11R11F,  // VK_FORMAT_B10G11R11_UFLOAT_PACK32
+  };
+  static uint32_t getBytesPerPixel(PixelFormat format);
+  // Converts `count` pixels in `format` to RGBA 32-bit floats.
+  static void decodePixels(const void* src, PixelFormat format, uint32_t count, float* dst);
+
+  // A rectangle of pixels of the current frame that belongs to the caller.
+  struct Tile
+  {
+    const void*           pixels   = nullptr;
+    size_t                rowPitch = 0;  // In bytes
+    PixelFormat           format   = PIXEL_FORMAT_RGBA32F;
+    uint32_t              x = 0, y = 0, width = 0, height = 0;
+    std::function<void()> waitUntilReady;  // Called before reading `pixels`
+    std::function<void()> release;         // Called once `pixels` isn't needed anymore
+  };
+
+  // At most `maxQueuedJobs` frame starts, tiles and frame ends can be waiting
+  // for the worker; the functions below block while the queue is full.
+  explicit OutputWriter(size_t maxQueuedJobs = 8);
+  // Finishes all queued work.
+  ~OutputWriter();
+
+  // Starts a frame; its files are `basePath` followed by each format's extension.
+  // The tiles of a frame must cover it exactly. Rows of tiles (of height
+  // `tileHeight`) must be submitted from top to bottom, but the tiles within a
+  // row can be submitted in any order.
+  void beginFrame(const std::string& basePath, uint32_t width, uint32_t height, uint32_t tileHeight, uint32_t formats);
+  void writeTile(Tile tile);
+  void endFrame();
+
+  // Blocks until all queued work has been done.
+  void flush();
+
+private:
+  struct Job
+  {
+    enum Type
+    {
+      BEGIN_FRAME,
+      TILE,
+      END_FRAME,
+      EXIT
+    } type;
+    Tile        tile;
+    std::string basePath;
+    uint32_t    width = 0, height = 0, tileHeight = 0, formats = 0;
+  };
+  struct Frame;
+
+  void push(Job&& job);
+  void workerLoop();
+  void processTile(Tile& tile);
+  void finishStrip();
+
+  const size_t            m_maxQueuedJobs;
+  std::mutex              m_mutex;
+  std::condition_variable m_queueChanged;
+  std::deque<Job>         m_queue;
+  bool                    m_busy = false;  // Whether the worker is processing a job
+
+  // Only accessed by the worker thread:
+  std::unique_ptr<Frame> m_frame;
+
+  std::thread m_worker;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_OUTPUT_WRITER_HPP
@@ -0,0 +1,660 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "render_farm.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+
+#include <nvh/fileoperations.hpp>  // For nvh::findFile and nvh::loadFile
+#include <nvh/nvprint.hpp>
+
+namespace {
+
+// Bumped whenever the messages change
+const uint32_t s_protocolVersion = 1;
+
+enum MessageType : uint32_t
+{
+  MESSAGE_HELLO = 1,  // Worker -> coordinator: HelloMessage, first
+  MESSAGE_REQUEST,    // Worker -> coordinator: asks for a unit
+  MESSAGE_UNIT,       // Coordinator -> worker: a WorkUnit, for a request
+  MESSAGE_DONE,       // Coordinator -> worker: no units are left, for a request
+  MESSAGE_RESULT,     // Worker -> coordinator: ResultHeader, then the rows of pixels
+};
+
+struct MessageHeader
+{
+  uint32_t type;
+  uint32_t size;  // Of the payload after the header
+};
+
+struct HelloMessage
+{
+  uint32_t version;
+  uint32_t padding;
+  uint64_t configHash;
+};
+
+struct ResultHeader
+{
+  uint32_t unitId;
+  uint32_t pixelFormat;  // OutputWriter::PixelFormat
+  uint32_t width;
+  uint32_t height;
+};
+
+// No message is larger than a tile of RGBA32F pixels; anything larger is garbage
+const uint32_t s_maxMessageSize = 64u << 20;
+
+bool sendMessage(TcpSocket socket, uint32_t type, const void* payload, size_t size)
+{
+  std::vector<char> message(sizeof(MessageHeader) + size);
+  const MessageHeader header{.type = type, .size = uint32_t(size)};
+  memcpy(message.data(), &header, sizeof(header));
+  if(size > 0)
+  {
+    memcpy(message.data() + sizeof(header), payload, size);
+  }
+  return sendAll(socket, message.data(), message.size());
+}
+
+ReceiveResult receiveMessage(TcpSocket socket, MessageHeader& header, std::vector<uint8_t>& payload)
+{
+  const ReceiveResult result = receiveAll(socket, &header, sizeof(header));
+  if(result != ReceiveResult::eOk)
+  {
+    return result;
+  }
+  if(header.size > s_maxMessageSize)
+  {
+    return ReceiveResult::eClosed;
+  }
+  payload.resize(header.size);
+  if(header.size > 0 && receiveAll(socket, payload.data(), payload.size()) != ReceiveResult::eOk)
+  {
+    return ReceiveResult::eClosed;
+  }
+  return ReceiveResult::eOk;
+}
+
+}  // namespace
+
+uint64_t getFarmConfigHash(const std::string&              sceneFilename,
+                           const SceneDescription&         scene,
+                           const std::vector<std::string>& modelSearchPaths,
+                           const FarmImageSettings&        settings)
+{
+  // FNV-1a over the scene and the settings. The resolved scene is hashed as
+  // well as the file, so that builds that resolve a file differently (say,
+  // with other grid materials) don't render together. Members are hashed
+  // one by one, since structs may have padding.
+  uint64_t   hash      = 14695981039346656037ull;
+  const auto hashBytes = [&](const void* data, size_t size) {
+    for(size_t i = 0; i < size; i++)
+    {
+      hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 1099511628211ull;
+    }
+  };
+  const auto hashString = [&](const std::string& string) {
+    const uint64_t size = string.size();
+    hashBytes(&size, sizeof(size));
+    hashBytes(string.data(), string.size());
+  };
+
+  if(!sceneFilename.empty())
+  {
+    hashString(nvh::loadFile(sceneFilename, true));
+  }
+  for(const SceneModel& model : scene.models)
+  {
+    hashString(model.filename);
+    // A model that isn't found only has its name hashed; rendering it fails anyway
+    const std::string objFilename = nvh::findFile(model.filename, modelSearchPaths);
+    if(!objFilename.empty())
+    {
+      hashString(nvh::loadFile(objFilename, true));
+    }
+  }
+  for(const SceneInstance& instance : scene.instances)
+  {
+    hashBytes(&instance.model, sizeof(instance.model));
+    hashBytes(&instance.material, sizeof(instance.material));
+    hashBytes(&instance.transform, sizeof(instance.transform));
+    hashBytes(&instance.spinDegrees, sizeof(instance.spinDegrees));
+    hashBytes(&instance.spinAxis, sizeof(instance.spinAxis));
+  }
+  if(!scene.jobs.empty())
+  {
+    const JobParams job = makeJobParams(scene.jobs[0]);
+    hashBytes(&job, sizeof(job));
+  }
+  for(const uint32_t value : {settings.width, settings.height, settings.samples, settings.segments, settings.spectral,
+                              settings.backend, settings.reorderMode, settings.pixelFormat})
+  {
+    hashBytes(&value, sizeof(value));
+  }
+  hashBytes(&settings.noiseThreshold, sizeof(settings.noiseThreshold));
+  return hash;
+}
+
+bool FarmCoordinator::run(uint16_t port, const FarmSettings& settings, OutputWriter& outputWriter)
+{
+  assert(settings.unitBatches > 0 && settings.batchesPerPass % settings.unitBatches == 0);
+  m_settings     = settings;
+  m_outputWriter = &outputWriter;
+  m_tilesX       = (settings.width + settings.tileWidth - 1) / settings.tileWidth;
+  m_tilesY       = (settings.height + settings.tileHeight - 1) / settings.tileHeight;
+
+  // Units are handed out in order: by frame, then pass, then tile, then the
+  // sample batches within the pass
+  const uint32_t tilesPerFrame = m_tilesX * m_tilesY;
+  const uint32_t unitsPerTile  = settings.batchesPerPass / settings.unitBatches;
+  m_unitsPerPass               = tilesPerFrame * unitsPerTile;
+  for(uint32_t frame = 0; frame < settings.numFrames; frame++)
+  {
+    for(uint32_t pass = 0; pass < settings.numPasses; pass++)
+    {
+      for(uint32_t tile = 0; tile < tilesPerFrame; tile++)
+      {
+        for(uint32_t u = 0; u < unitsPerTile; u++)
+        {
+          const uint32_t id = uint32_t(m_units.size());
+          m_units.push_back({.work = {.id         = id,
+                                      .frame      = frame,
+                                      .tile       = tile,
+                                      .firstBatch = pass * settings.batchesPerPass + u * settings.unitBatches,
+                                      .batchCount = settings.unitBatches},
+                             .pass = pass});
+          m_pending.push_back(id);
+        }
+      }
+    }
+  }
+  m_passUnitsDone.assign(size_t(settings.numFrames) * settings.numPasses, 0);
+  m_tiles.resize(tilesPerFrame);
+
+  if(!initSockets())
+  {
+    LOGE("Could not initialize sockets.\n");
+    return false;
+  }
+  const TcpSocket listener = listenOn(port, false);
+  if(listener == INVALID_TCP_SOCKET)
+  {
+    LOGE("Could not listen on port %u.\n", uint32_t(port));
+    return false;
+  }
+  nvprintf("Coordinating %zu work units (%u frames, %u passes, %u tiles, %u sample batches per unit) on port %u.\n",
+           m_units.size(), settings.numFrames, settings.numPasses, tilesPerFrame, settings.unitBatches, uint32_t(port));
+
+  // Accept workers until all units are merged; each connection is served on its own thread
+  while(true)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(m_doneUnits == m_units.size())
+      {
+        break;
+      }
+    }
+    auto            connection = std::make_shared<Connection>();
+    const TcpSocket socket     = acceptFor(listener, 200, connection->name);
+    if(socket == INVALID_TCP_SOCKET)
+    {
+      continue;
+    }
+    connection->socket = socket;
+    setNoDelay(socket);
+    setReceiveTimeout(socket, settings.timeoutSeconds);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_connections.push_back(connection);
+    }
+    m_threads.emplace_back(&FarmCoordinator::serve, this, connection);
+  }
+  closeSocket(listener);
+
+  // Workers disconnect once they got no more work, or time out
+  for(std::thread& thread : m_threads)
+  {
+    thread.join();
+  }
+  m_threads.clear();
+  m_connections.clear();
+  nvprintf("Merged all %zu work units.\n", m_units.size());
+  return true;
+}
+
+void FarmCoordinator::serve(std::shared_ptr<Connection> connection)
+{
+  MessageHeader        header{};
+  std::vector<uint8_t> payload;
+  HelloMessage         hello{};
+  if(receiveMessage(connection->socket, header, payload) != ReceiveResult::eOk || header.type != MESSAGE_HELLO
+     || payload.size() != sizeof(hello))
+  {
+    LOGW("%s is not a render farm worker; disconnecting it.\n", connection->name.c_str());
+    hello.version = 0;
+  }
+  else
+  {
+    memcpy(&hello, payload.data(), sizeof(hello));
+    if(hello.version != s_protocolVersion || hello.configHash != m_settings.configHash)
+    {
+      LOGW("%s renders with other settings or another version; disconnecting it.\n", connection->name.c_str());
+      hello.version = 0;
+    }
+  }
+  if(hello.version == 0)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    connection->open = false;
+    closeSocket(connection->socket);
+    return;
+  }
+  nvprintf("Worker %s connected.\n", connection->name.c_str());
+
+  bool lost = false;
+  while(true)
+  {
+    const ReceiveResult result = receiveMessage(connection->socket, header, payload);
+    if(result == ReceiveResult::eTimeout)
+    {
+      // Waiting for work is fine; taking this long for a unit isn't
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(connection->assigned.empty())
+      {
+        if(m_doneUnits == m_units.size())
+        {
+          break;
+        }
+        continue;
+      }
+      LOGW("Worker %s sent nothing for %u s.\n", connection->name.c_str(), m_settings.timeoutSeconds);
+      lost = true;
+      break;
+    }
+    if(result != ReceiveResult::eOk)
+    {
+      // Once the worker got DONE, disconnecting is how it says goodbye
+      std::lock_guard<std::mutex> lock(m_mutex);
+      lost = !connection->assigned.empty() || m_doneUnits != m_units.size();
+      break;
+    }
+    if(header.type == MESSAGE_REQUEST)
+    {
+      std::vector<Answer> answers;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        connection->requests++;
+        answers = dispatch();
+      }
+      send(answers);
+    }
+    else if(header.type == MESSAGE_RESULT)
+    {
+      merge(*connection, payload);
+    }
+    else
+    {
+      LOGW("Worker %s sent an unknown message %u.\n", connection->name.c_str(), header.type);
+      lost = true;
+      break;
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  // Requeue the worker's units at the front, so that they're handed out next
+  for(auto it = connection->assigned.rbegin(); it != connection->assigned.rend(); ++it)
+  {
+    m_units[*it].state = Unit::ePending;
+    m_pending.push_front(*it);
+  }
+  if(lost)
+  {
+    LOGW("Lost worker %s; handing its %zu units to other workers.\n", connection->name.c_str(), connection->assigned.size());
+  }
+  else
+  {
+    nvprintf("Worker %s disconnected.\n", connection->name.c_str());
+  }
+  connection->assigned.clear();
+  connection->requests = 0;
+  connection->open     = false;
+  {
+    // Answers that were picked before it closed aren't sent
+    std::lock_guard<std::mutex> sendLock(connection->sendMutex);
+    closeSocket(connection->socket);
+    connection->socket = INVALID_TCP_SOCKET;
+  }
+  const std::vector<Answer> answers = dispatch();
+  lock.unlock();
+  send(answers);
+}
+
+std::vector<FarmCoordinator::Answer> FarmCoordinator::dispatch()
+{
+  std::vector<Answer> answers;
+  const bool          allDone = (m_doneUnits == m_units.size());
+  for(const std::shared_ptr<Connection>& connection : m_connections)
+  {
+    while(connection->open && connection->requests > 0 && (allDone || !m_pending.empty()))
+    {
+      connection->requests--;
+      if(allDone)
+      {
+        answers.push_back({.connection = connection, .type = MESSAGE_DONE});
+        continue;
+      }
+      const uint32_t id = m_pending.front();
+      m_pending.pop_front();
+      m_units[id].state = Unit::eAssigned;
+      connection->assigned.push_back(id);
+      answers.push_back({.connection = connection, .type = MESSAGE_UNIT, .unit = m_units[id].work});
+    }
+  }
+  return answers;
+}
+
+void FarmCoordinator::send(const std::vector<Answer>& answers)
+{
+  for(const Answer& answer : answers)
+  {
+    std::lock_guard<std::mutex> sendLock(answer.connection->sendMutex);
+    if(answer.connection->socket == INVALID_TCP_SOCKET)
+    {
+      continue;
+    }
+    const bool unit = (answer.type == MESSAGE_UNIT);
+    if(!sendMessage(answer.connection->socket, answer.type, unit ? &answer.unit : nullptr, unit ? sizeof(WorkUnit) : 0))
+    {
+      // Makes the worker's thread see a closed connection, which requeues its units
+      shutdownSocket(answer.connection->socket);
+    }
+  }
+}
+
+void FarmCoordinator::merge(Connection& connection, const std::vector<uint8_t>& payload)
+{
+  ResultHeader result{};
+  if(payload.size() >= sizeof(result))
+  {
+    memcpy(&result, payload.data(), sizeof(result));
+  }
+  const OutputWriter::PixelFormat format = OutputWriter::PixelFormat(result.pixelFormat);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  const auto assigned = std::find(connection.assigned.begin(), connection.assigned.end(), result.unitId);
+  if(payload.size() < sizeof(result) || assigned == connection.assigned.end() || format > OutputWriter::PIXEL_FORMAT_B10G11R11F)
+  {
+    LOGW("Worker %s sent a result for a unit it wasn't rendering; ignoring it.\n", connection.name.c_str());
+    return;
+  }
+  Unit&          unit       = m_units[result.unitId];
+  const uint32_t x0         = (unit.work.tile % m_tilesX) * m_settings.tileWidth;
+  const uint32_t y0         = (unit.work.tile / m_tilesX) * m_settings.tileHeight;
+  const uint32_t width      = std::min(m_settings.tileWidth, m_settings.width - x0);
+  const uint32_t height     = std::min(m_settings.tileHeight, m_settings.height - y0);
+  const size_t   pixelCount = size_t(width) * height;
+  if(result.width != width || result.height != height
+     || payload.size() != sizeof(result) + pixelCount * OutputWriter::getBytesPerPixel(format))
+  {
+    LOGW("Worker %s sent a result of the wrong size; ignoring it.\n", connection.name.c_str());
+    return;
+  }
+  connection.assigned.erase(assigned);
+  unit.state = Unit::eDone;
+  m_doneUnits++;
+
+  // Only the last frame is written out; the others are rendered for timing
+  const bool lastFrame = (unit.work.frame + 1 == m_settings.numFrames);
+  if(lastFrame)
+  {
+    // Decoding doesn't touch the coordinator's state
+    lock.unlock();
+    std::vector<float> pixels(pixelCount * 4);
+    OutputWriter::decodePixels(payload.data() + sizeof(result), format, uint32_t(pixelCount), pixels.data());
+    lock.lock();
+
+    // The tile's average over all units so far, weighted by their samples
+    TileAccumulation& tile    = m_tiles[unit.work.tile];
+    const uint64_t    samples = uint64_t(unit.work.batchCount) * m_settings.samplesPerBatch;
+    if(tile.samples == 0)
+    {
+      tile.average = std::move(pixels);
+    }
+    else
+    {
+      const float weight = float(double(samples) / double(tile.samples + samples));
+      for(size_t i = 0; i < tile.average.size(); i++)
+      {
+        tile.average[i] += (pixels[i] - tile.average[i]) * weight;
+      }
+    }
+    tile.samples += samples;
+  }
+
+  const uint32_t passDone = ++m_passUnitsDone[size_t(unit.work.frame) * m_settings.numPasses + unit.pass];
+  if(passDone == m_unitsPerPass)
+  {
+    nvprintf("Finished pass %u of %u of frame %u of %u.\n", unit.pass + 1, m_settings.numPasses, unit.work.frame + 1,
+             m_settings.numFrames);
+    if(lastFrame)
+    {
+      writeFrame();
+    }
+  }
+  const std::vector<Answer> answers = dispatch();
+  lock.unlock();
+  send(answers);
+}
+
+void FarmCoordinator::writeFrame()
+{
+  // Every pass covers all tiles, so each tile has samples once one pass is
+  // done; tiles can already have some of the next pass's. The writer gets a
+  // copy, so that merging goes on while it encodes.
+  const uint32_t formats = OutputWriter::FORMAT_HDR | OutputWriter::FORMAT_EXR | OutputWriter::FORMAT_PNG;
+  m_outputWriter->beginFrame(m_settings.output, m_settings.width, m_settings.height, m_settings.tileHeight, formats);
+  for(uint32_t tile = 0; tile < m_tiles.size(); tile++)
+  {
+    const uint32_t x0     = (tile % m_tilesX) * m_settings.tileWidth;
+    const uint32_t y0     = (tile / m_tilesX) * m_settings.tileHeight;
+    const uint32_t width  = std::min(m_settings.tileWidth, m_settings.width - x0);
+    const uint32_t height = std::min(m_settings.tileHeight, m_settings.height - y0);
+    auto           pixels = std::make_shared<std::vector<float>>(m_tiles[tile].average);
+    m_outputWriter->writeTile({.pixels   = pixels->data(),
+                               .rowPitch = size_t(width) * 4 * sizeof(float),
+                               .format   = OutputWriter::PIXEL_FORMAT_RGBA32F,
+                               .x        = x0,
+                               .y        = y0,
+                               .width    = width,
+                               .height   = height,
+                               .release  = [pixels]() mutable { pixels.reset(); }});
+  }
+  m_outputWriter->endFrame();
+}
+
+FarmWorker::~FarmWorker()
+{
+  if(m_socket != INVALID_TCP_SOCKET)
+  {
+    disconnect();
+  }
+}
+
+bool FarmWorker::connect(const std::string& address, uint64_t configHash, uint32_t prefetch)
+{
+  m_prefetch = std::max(prefetch, 1u);
+  if(!initSockets())
+  {
+    LOGE("Could not initialize sockets.\n");
+    return false;
+  }
+  m_socket = connectTo(address);
+  if(m_socket == INVALID_TCP_SOCKET)
+  {
+    LOGE("Could not connect to the coordinator at %s; it must be <host>:<port>.\n", address.c_str());
+    return false;
+  }
+  setNoDelay(m_socket);
+  const HelloMessage hello{.version = s_protocolVersion, .padding = 0, .configHash = configHash};
+  if(!send(MESSAGE_HELLO, &hello, sizeof(hello)))
+  {
+    LOGE("Could not connect to the coordinator at %s.\n", address.c_str());
+    closeSocket(m_socket);
+    m_socket = INVALID_TCP_SOCKET;
+    return false;
+  }
+  m_receiver = std::thread(&FarmWorker::receiveLoop, this);
+  m_sender   = std::thread(&FarmWorker::sendLoop, this);
+  return true;
+}
+
+bool FarmWorker::disconnect()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_resultMutex);
+    m_stopSending = true;
+  }
+  m_resultsChanged.notify_all();
+  m_sender.join();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closing = true;
+  }
+  shutdownSocket(m_socket);
+  m_receiver.join();
+  closeSocket(m_socket);
+  m_socket = INVALID_TCP_SOCKET;
+  return !m_lost;
+}
+
+bool FarmWorker::send(uint32_t type, const void* payload, size_t size)
+{
+  std::lock_guard<std::mutex> lock(m_sendMutex);
+  return sendMessage(m_socket, type, payload, size);
+}
+
+bool FarmWorker::next(uint32_t /*device*/, WorkUnit& unit)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  // Keep `m_prefetch` units queued or on their way
+  while(!m_noMoreWork && !m_lost && m_units.size() + m_requested < m_prefetch)
+  {
+    if(!send(MESSAGE_REQUEST, nullptr, 0))
+    {
+      m_lost = true;
+      break;
+    }
+    m_requested++;
+  }
+  // The coordinator answers with DONE once all units are merged, so every
+  // unit sent before it is queued by then
+  m_changed.wait(lock, [&] { return !m_units.empty() || m_noMoreWork || m_lost; });
+  if(m_units.empty() || m_lost)
+  {
+    return false;
+  }
+  unit = m_units.front();
+  m_units.pop_front();
+  return true;
+}
+
+void FarmWorker::submit(const WorkUnit& unit, OutputWriter::Tile&& pixels)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_resultMutex);
+    m_results.emplace_back(unit, std::move(pixels));
+  }
+  m_resultsChanged.notify_all();
+}
+
+void FarmWorker::receiveLoop()
+{
+  MessageHeader        header{};
+  std::vector<uint8_t> payload;
+  while(true)
+  {
+    const ReceiveResult result = receiveMessage(m_socket, header, payload);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(result != ReceiveResult::eOk || (header.type != MESSAGE_UNIT && header.type != MESSAGE_DONE)
+       || (header.type == MESSAGE_UNIT && payload.size() != sizeof(WorkUnit)))
+    {
+      if(!m_closing && !m_noMoreWork)
+      {
+        LOGE("Lost the connection to the coordinator.\n");
+        m_lost = true;
+      }
+      m_changed.notify_all();
+      return;
+    }
+    m_requested--;
+    if(header.type == MESSAGE_UNIT)
+    {
+      WorkUnit unit;
+      memcpy(&unit, payload.data(), sizeof(unit));
+      m_units.push_back(unit);
+    }
+    else
+    {
+      m_noMoreWork = true;
+    }
+    m_changed.notify_all();
+  }
+}
+
+void FarmWorker::sendLoop()
+{
+  std::vector<uint8_t> payload;
+  while(true)
+  {
+    std::unique_lock<std::mutex> lock(m_resultMutex);
+    m_resultsChanged.wait(lock, [&] { return !m_results.empty() || m_stopSending; });
+    if(m_results.empty())
+    {
+      return;
+    }
+    auto [unit, tile] = std::move(m_results.front());
+    m_results.pop_front();
+    lock.unlock();
+
+    // The coordinator gets the rows without their padding
+    if(tile.waitUntilReady)
+    {
+      tile.waitUntilReady();
+    }
+    const size_t       rowSize = size_t(tile.width) * OutputWriter::getBytesPerPixel(tile.format);
+    const ResultHeader result{.unitId = unit.id, .pixelFormat = tile.format, .width = tile.width, .height = tile.height};
+    payload.resize(sizeof(result) + rowSize * tile.height);
+    memcpy(payload.data(), &result, sizeof(result));
+    for(uint32_t y = 0; y < tile.height; y++)
+    {
+      memcpy(payload.data() + sizeof(result) + y * rowSize, static_cast<const uint8_t*>(tile.pixels) + y * tile.rowPitch, rowSize);
+    }
+    if(tile.release)
+    {
+      tile.release();
+    }
+
+    // Results of a lost connection are dropped; the coordinator hands their units to others
+    bool lost;
+    {
+      std::lock_guard<std::mutex> stateLock(m_mutex);
+      lost = m_lost;
+    }
+    if(!lost && send(MESSAGE_RESULT, payload.data(), payload.size()))
+    {
+      m_sentUnits++;
+    }
+    else if(!lost)
+    {
+      std::lock_guard<std::mutex> stateLock(m_mutex);
+      LOGE("Lost the connection to the coordinator.\n");
+      m_lost = true;
+      m_changed.notify_all();
+    }
+  }
+}
@@ -0,0 +1,194 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Renders across machines. A coordinator splits the frames into work units
+// of a tile and a range of its sample batches, and hands them out over TCP
+// to workers. The workers render them on their devices, like the offline
+// renderer (see main.cpp), and send back each unit's average with its
+// sample count. A worker sets up its scene, acceleration structures and
+// pipelines once, and keeps them for all the units it renders.
+// The coordinator merges the units of each tile weighted by their sample
+// counts. Units are handed out pass by pass, and each pass adds
+// batchesPerPass sample batches to every tile of a frame. This way a still
+// refines progressively across the farm, and the last frame is written out
+// after each of its passes.
+// A worker that disconnects, or doesn't send anything for timeoutSeconds
+// while it has units, is dropped, and its units are handed to other workers.
+// Messages are a type and a size followed by the payload, in the byte order
+// of the hosts, which must agree. Workers send a hash of the settings that
+// change the image, and the coordinator turns away workers whose hash isn't
+// its own.
+#ifndef VK_MINI_PATH_TRACER_RENDER_FARM_HPP
+#define VK_MINI_PATH_TRACER_RENDER_FARM_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "output_writer.hpp"
+#include "scene_file.hpp"
+#include "tcp_socket.hpp"
+#include "work_source.hpp"
+
+struct FarmSettings
+{
+  uint32_t    width = 0, height = 0;
+  uint32_t    tileWidth = 0, tileHeight = 0;
+  uint32_t    numFrames       = 1;  // Only the last one is written out
+  uint32_t    samplesPerBatch = 0;  // Samples of each pixel in a sample batch
+  uint32_t    batchesPerPass  = 0;
+  uint32_t    numPasses       = 1;
+  uint32_t    unitBatches     = 0;  // Sample batches of each unit; divides batchesPerPass
+  uint32_t    timeoutSeconds  = 120;
+  uint64_t    configHash      = 0;
+  std::string output          = "out";  // Base path of the .hdr, .exr and .png files
+};
+
+// The render settings that change the image, as given on the command line. The enums of main.cpp are passed as
+// their values.
+struct FarmImageSettings
+{
+  uint32_t width = 0, height = 0;
+  uint32_t samples        = 0;
+  uint32_t segments       = 0;
+  uint32_t spectral       = 0;
+  float    noiseThreshold = 0.0f;
+  uint32_t backend        = 0;  // TraceBackend
+  uint32_t reorderMode    = 0;  // ReorderMode
+  uint32_t pixelFormat    = 0;  // OutputWriter::PixelFormat of the storage image
+};
+
+// Hash of the settings that change the rendered image, which the coordinator and workers must agree on: the contents
+// of the scene file, unless `sceneFilename` is empty, and of the OBJ files of its models, as found in
+// `modelSearchPaths`; `scene` as it was resolved from the file or from the command line; and `settings`.
+// Of the jobs, only the first one's camera and sky matter, since a farm only renders it.
+uint64_t getFarmConfigHash(const std::string&              sceneFilename,
+                           const SceneDescription&         scene,
+                           const std::vector<std::string>& modelSearchPaths,
+                           const FarmImageSettings&        settings);
+
+class FarmCoordinator
+{
+public:
+  // Listens on `port`, and hands out the units of all frames until all of
+  // them are merged. Returns false if it can't listen on `port`.
+  bool run(uint16_t port, const FarmSettings& settings, OutputWriter& outputWriter);
+
+private:
+  struct Unit
+  {
+    WorkUnit work;
+    uint32_t pass = 0;
+    enum State
+    {
+      ePending,
+      eAssigned,
+      eDone
+    } state = ePending;
+  };
+  // The merged units of a tile of the last frame
+  struct TileAccumulation
+  {
+    std::vector<float> average;  // RGBA
+    uint64_t           samples = 0;
+  };
+  struct Connection
+  {
+    TcpSocket             socket = INVALID_TCP_SOCKET;
+    std::string           name;
+    std::mutex            sendMutex;
+    uint32_t              requests = 0;  // Not answered yet
+    std::vector<uint32_t> assigned;      // Units it's rendering
+    bool                  open = true;
+  };
+  // A message for a request: MESSAGE_UNIT with `unit`, or MESSAGE_DONE
+  struct Answer
+  {
+    std::shared_ptr<Connection> connection;
+    uint32_t                    type = 0;
+    WorkUnit                    unit{};
+  };
+
+  void serve(std::shared_ptr<Connection> connection);
+  // Hands out units for the requests they can be answered for, and returns
+  // the answers to send; with m_mutex locked
+  std::vector<Answer> dispatch();
+  // Sends the answers of dispatch(); without m_mutex locked, since sends block
+  void send(const std::vector<Answer>& answers);
+  // Merges the result `payload` of a unit that `connection` was rendering
+  void merge(Connection& connection, const std::vector<uint8_t>& payload);
+  // Writes out the last frame as it is; with m_mutex locked
+  void writeFrame();
+
+  FarmSettings  m_settings;
+  OutputWriter* m_outputWriter = nullptr;
+  uint32_t      m_tilesX = 0, m_tilesY = 0;
+  uint32_t      m_unitsPerPass = 0;  // Of a frame
+
+  std::mutex                               m_mutex;
+  std::vector<Unit>                        m_units;  // Indexed by id
+  std::deque<uint32_t>                     m_pending;
+  uint32_t                                 m_doneUnits = 0;
+  std::vector<uint32_t>                    m_passUnitsDone;  // Per frame and pass
+  std::vector<TileAccumulation>            m_tiles;
+  std::vector<std::shared_ptr<Connection>> m_connections;
+  std::vector<std::thread>                 m_threads;  // One per connection
+};
+
+class FarmWorker : public WorkSource
+{
+public:
+  ~FarmWorker() override;
+
+  // Connects to the coordinator at `address` (<host>:<port>) and keeps
+  // `prefetch` units requested ahead, so that devices don't wait for the
+  // network. Returns false if it can't connect.
+  bool connect(const std::string& address, uint64_t configHash, uint32_t prefetch);
+  // Sends the results that are left, and disconnects. Returns false if the
+  // connection was lost before.
+  bool disconnect();
+
+  // Workers start on their units right away
+  void waitUntilAllReady() override {}
+  bool next(uint32_t device, WorkUnit& unit) override;
+  // Sends the unit's result once its pixels are ready
+  void submit(const WorkUnit& unit, OutputWriter::Tile&& pixels) override;
+
+  uint32_t getSentUnitCount() const { return m_sentUnits; }
+
+private:
+  void receiveLoop();
+  void sendLoop();
+  bool send(uint32_t type, const void* payload, size_t size);
+
+  TcpSocket  m_socket   = INVALID_TCP_SOCKET;
+  uint32_t   m_prefetch = 1;
+
+  std::mutex m_sendMutex;  // Of the socket
+
+  // Units from the coordinator
+  std::mutex              m_mutex;
+  std::condition_variable m_changed;
+  std::deque<WorkUnit>    m_units;
+  uint32_t                m_requested  = 0;  // Requests that weren't answered yet
+  bool                    m_noMoreWork = false;
+  bool                    m_lost       = false;
+  bool                    m_closing    = false;
+
+  // Results to send, on the sending thread
+  std::mutex                                         m_resultMutex;
+  std::condition_variable                            m_resultsChanged;
+  std::deque<std::pair<WorkUnit, OutputWriter::Tile>> m_results;
+  bool                                               m_stopSending = false;
+  uint32_t                                           m_sentUnits   = 0;
+
+  std::thread m_receiver;
+  std::thread m_sender;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_RENDER_FARM_HPP
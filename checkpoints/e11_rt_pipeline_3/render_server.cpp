@@ -0,0 +1,266 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "render_server.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <sstream>
+
+#include <nvh/nvprint.hpp>
+
+namespace {
+
+// Lines longer than this aren't requests
+const size_t s_maxLineLength = 4096;
+
+// Requests are a few short lines, so they're received a byte at a time
+bool receiveLine(TcpSocket socket, std::string& line)
+{
+  line.clear();
+  char c = 0;
+  while(receiveAll(socket, &c, 1) == ReceiveResult::eOk)
+  {
+    if(c == '\n')
+    {
+      if(!line.empty() && line.back() == '\r')
+      {
+        line.pop_back();
+      }
+      return true;
+    }
+    line.push_back(c);
+    if(line.size() > s_maxLineLength)
+    {
+      return false;
+    }
+  }
+  return false;
+}
+
+bool sendLine(TcpSocket socket, const std::string& line)
+{
+  const std::string message = line + "\n";
+  return sendAll(socket, message.data(), message.size());
+}
+
+}  // namespace
+
+RenderServer::~RenderServer()
+{
+  close();
+}
+
+bool RenderServer::start(uint16_t port, const ServerSettings& settings, OutputWriter& outputWriter)
+{
+  m_settings      = settings;
+  m_outputWriter  = &outputWriter;
+  m_tilesPerFrame = ((settings.width + settings.tileWidth - 1) / settings.tileWidth)
+                    * ((settings.height + settings.tileHeight - 1) / settings.tileHeight);
+  if(!initSockets())
+  {
+    LOGE("Could not initialize sockets.\n");
+    return false;
+  }
+  m_listener = listenOn(port, true);
+  if(m_listener == INVALID_TCP_SOCKET)
+  {
+    LOGE("Could not listen on port %u.\n", uint32_t(port));
+    return false;
+  }
+  nvprintf("Listening for render requests on port %u.\n", uint32_t(port));
+  m_acceptor = std::thread(&RenderServer::acceptLoop, this);
+  return true;
+}
+
+void RenderServer::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+    m_changed.notify_all();
+  }
+  if(m_acceptor.joinable())
+  {
+    m_acceptor.join();
+  }
+  if(m_listener != INVALID_TCP_SOCKET)
+  {
+    closeSocket(m_listener);
+    m_listener = INVALID_TCP_SOCKET;
+  }
+}
+
+bool RenderServer::next(uint32_t device, WorkUnit& unit)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_changed.wait(lock, [&] { return m_stopping || (m_current != nullptr && m_nextTile < m_tilesPerFrame); });
+  if(m_current == nullptr || m_nextTile == m_tilesPerFrame)
+  {
+    return false;
+  }
+  unit = {.id         = m_nextId++,
+          .frame      = m_current->frame,
+          .tile       = m_nextTile++,
+          .firstBatch = 0,
+          .batchCount = m_settings.batchesPerTile};
+  return true;
+}
+
+void RenderServer::submit(const WorkUnit& unit, OutputWriter::Tile&& pixels)
+{
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  assert(unit.tile >= m_nextWrite && m_queued.count(unit.tile) == 0);
+  m_queued.emplace(unit.tile, std::move(pixels));
+  for(auto it = m_queued.begin(); it != m_queued.end() && it->first == m_nextWrite; it = m_queued.erase(it))
+  {
+    if(m_nextWrite == 0)
+    {
+      std::string output;
+      {
+        std::lock_guard<std::mutex> requestLock(m_mutex);
+        assert(m_current != nullptr && m_current->frame == unit.frame);
+        output = m_current->output;
+      }
+      m_outputWriter->beginFrame(output, m_settings.width, m_settings.height, m_settings.tileHeight,
+                                 OutputWriter::FORMAT_HDR | OutputWriter::FORMAT_EXR | OutputWriter::FORMAT_PNG);
+    }
+    m_outputWriter->writeTile(std::move(it->second));
+    m_nextWrite++;
+    if(m_nextWrite == m_tilesPerFrame)
+    {
+      // The request's tiles are all handed over; the next one can start
+      m_outputWriter->endFrame();
+      m_nextWrite = 0;
+      std::lock_guard<std::mutex> requestLock(m_mutex);
+      m_current->done = true;
+      m_rendered++;
+      startNext();
+      m_changed.notify_all();
+    }
+  }
+}
+
+const JobParams* RenderServer::getJobParams(uint32_t frame)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return (m_current != nullptr && m_current->frame == frame) ? &m_current->job : nullptr;
+}
+
+void RenderServer::startNext()
+{
+  m_current  = nullptr;
+  m_nextTile = 0;
+  if(!m_requests.empty())
+  {
+    m_current = m_requests.front();
+    m_requests.pop_front();
+    m_current->start = std::chrono::steady_clock::now();
+  }
+}
+
+bool RenderServer::render(const SceneJob& job, double& ms)
+{
+  Request request{.job = makeJobParams(job), .output = job.output};
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_stopping)
+    {
+      return false;
+    }
+    request.frame = m_nextFrame++;
+    m_requests.push_back(&request);
+    if(m_current == nullptr)
+    {
+      startNext();
+    }
+    m_changed.notify_all();
+    m_changed.wait(lock, [&] { return request.done; });
+  }
+  // The frame's files are written once the output writer is done with it
+  m_outputWriter->flush();
+  ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - request.start).count();
+  return true;
+}
+
+void RenderServer::acceptLoop()
+{
+  while(true)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(m_stopping)
+      {
+        break;
+      }
+    }
+    std::string     peerName;
+    const TcpSocket socket = acceptFor(m_listener, 200, peerName);
+    if(socket == INVALID_TCP_SOCKET)
+    {
+      continue;
+    }
+    nvprintf("Serving %s.\n", peerName.c_str());
+    setNoDelay(socket);
+    const bool open = serve(socket);
+    closeSocket(socket);
+    if(!open)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+      m_changed.notify_all();
+    }
+  }
+}
+
+bool RenderServer::serve(TcpSocket socket)
+{
+  SceneJob    job = m_settings.defaultJob;
+  std::string line;
+  while(receiveLine(socket, line))
+  {
+    std::istringstream fields(line);
+    std::string        command;
+    if(!(fields >> command) || command[0] == '#')
+    {
+      continue;
+    }
+    if(command == "camera" || command == "sky")
+    {
+      sendLine(socket, parseJobStatement(line, job) ? "ok" : "error invalid " + command + " statement");
+    }
+    else if(command == "render")
+    {
+      double ms = 0.0;
+      if(!(fields >> job.output))
+      {
+        sendLine(socket, "error render needs an output path");
+      }
+      else if(!render(job, ms))
+      {
+        sendLine(socket, "error the server is shutting down");
+      }
+      else
+      {
+        char reply[64];
+        snprintf(reply, sizeof(reply), " %.3f", ms);
+        nvprintf("Rendered %s in %.3f ms.\n", job.output.c_str(), ms);
+        sendLine(socket, "done " + job.output + reply);
+      }
+    }
+    else if(command == "quit")
+    {
+      sendLine(socket, "ok");
+      break;
+    }
+    else if(command == "shutdown")
+    {
+      sendLine(socket, "ok");
+      return false;
+    }
+    else
+    {
+      sendLine(socket, "error unknown command " + command);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,112 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Renders requests from local clients without starting over for each one.
+// The devices set up the scene, acceleration structures, pipelines and
+// descriptor sets once, like for the offline renderer (see main.cpp), and
+// then wait for requests. A request only changes the camera, sky and output
+// of a frame: the devices write them to an entry of the jobs uniform buffer,
+// and render with everything else as it is.
+// Clients connect over TCP to the loopback interface, and send lines of text:
+//   camera ... and sky ...   as in scene files (see scene_file.hpp); they
+//                            apply to the following renders of the connection
+//   render <output>          renders a frame to <output>.hdr, .exr and .png
+//   quit                     closes the connection
+//   shutdown                 stops the server once its requests are done
+// Each connection starts with the camera and sky of the scene's first job.
+// The server answers each line with one line: "ok", "done <output> <ms>"
+// once a frame's files are written, or "error <reason>".
+// Connections are served one after the other.
+#ifndef VK_MINI_PATH_TRACER_RENDER_SERVER_HPP
+#define VK_MINI_PATH_TRACER_RENDER_SERVER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "common.h"
+#include "output_writer.hpp"
+#include "scene_file.hpp"
+#include "tcp_socket.hpp"
+#include "work_source.hpp"
+
+struct ServerSettings
+{
+  uint32_t width = 0, height = 0;
+  uint32_t tileWidth = 0, tileHeight = 0;
+  uint32_t batchesPerTile = 0;
+  SceneJob defaultJob;  // Where each connection starts
+};
+
+// Work units are whole tiles; a unit's frame is the index of its request.
+class RenderServer : public WorkSource
+{
+public:
+  ~RenderServer() override;
+
+  // Listens on `port` of the loopback interface. Returns false if it can't.
+  bool start(uint16_t port, const ServerSettings& settings, OutputWriter& outputWriter);
+  // Stops listening; call once the devices stopped
+  void close();
+
+  // The devices start on the first request once it comes in
+  void waitUntilAllReady() override {}
+  // Blocks until there's a request; returns false once the server shut down
+  bool next(uint32_t device, WorkUnit& unit) override;
+  // Hands the tiles of the request to the output writer in order
+  void submit(const WorkUnit& unit, OutputWriter::Tile&& pixels) override;
+  const JobParams* getJobParams(uint32_t frame) override;
+
+  uint32_t getRenderedCount() const { return m_rendered; }
+
+private:
+  struct Request
+  {
+    JobParams                             job;
+    std::string                           output;
+    uint32_t                              frame = 0;
+    std::chrono::steady_clock::time_point start;  // When its first tile was handed out
+    double                                ms   = 0.0;
+    bool                                  done = false;
+  };
+
+  void acceptLoop();
+  // Answers the lines of a connection until it's closed; returns false after
+  // a shutdown
+  bool serve(TcpSocket socket);
+  // Queues a frame, and waits until its files are written
+  bool render(const SceneJob& job, double& ms);
+  // Starts on the next queued request, if any; with m_mutex locked
+  void startNext();
+
+  ServerSettings m_settings;
+  OutputWriter*  m_outputWriter  = nullptr;
+  uint32_t       m_tilesPerFrame = 0;
+  TcpSocket      m_listener      = INVALID_TCP_SOCKET;
+
+  // Handing out tiles
+  std::mutex              m_mutex;
+  std::condition_variable m_changed;
+  std::deque<Request*>    m_requests;  // Waiting for the current one
+  Request*                m_current   = nullptr;
+  uint32_t                m_nextTile  = 0;  // Of the current request
+  uint32_t                m_nextFrame = 0;
+  uint32_t                m_nextId    = 0;
+  uint32_t                m_rendered  = 0;
+  bool                    m_stopping  = false;
+
+  // Writing out tiles in order; a separate lock, since writing can block
+  // while the output writer's queue is full
+  std::mutex                             m_writeMutex;
+  std::map<uint32_t, OutputWriter::Tile> m_queued;  // Submitted tiles after the first one that wasn't
+  uint32_t                               m_nextWrite = 0;
+
+  std::thread m_acceptor;  // Serves one connection at a time
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_RENDER_SERVER_HPP
@@ -0,0 +1,253 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "scene_file.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include <glm/gtx/transform.hpp>
+#include <nvh/nvprint.hpp>
+
+namespace {
+bool readVec3(std::istringstream& fields, glm::vec3& v)
+{
+  return static_cast<bool>(fields >> v.x >> v.y >> v.z);
+}
+
+bool findModel(const SceneDescription& scene, const std::string& name, uint32_t& model)
+{
+  for(model = 0; model < scene.models.size(); model++)
+  {
+    if(scene.models[model].name == name)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The camera or sky statement `statement`, followed by `fields`
+bool readJobStatement(const std::string& statement, std::istringstream& fields, SceneJob& job)
+{
+  if(statement == "camera")
+  {
+    SceneCamera& camera = job.camera;
+    return readVec3(fields, camera.position) && readVec3(fields, camera.target) && (fields >> camera.verticalFovDegrees)
+           && camera.verticalFovDegrees > 0.0f && camera.verticalFovDegrees < 180.0f;
+  }
+  if(statement == "sky")
+  {
+    SceneSky& sky = job.sky;
+    return readVec3(fields, sky.zenith) && readVec3(fields, sky.horizon) && readVec3(fields, sky.ground);
+  }
+  return false;
+}
+
+// The transforms and spin after an instance's model and material
+bool readTransform(std::istringstream& fields, SceneInstance& instance)
+{
+  glm::mat4&  transform = instance.transform;
+  std::string op;
+  while(fields >> op)
+  {
+    glm::vec3 v;
+    float     f;
+    if(op == "translate" && readVec3(fields, v))
+    {
+      transform = glm::translate(v) * transform;
+    }
+    else if(op == "spin" && (fields >> f) && readVec3(fields, v) && glm::length(v) > 0.0f)
+    {
+      instance.spinDegrees = f;
+      instance.spinAxis    = glm::normalize(v);
+    }
+    else if(op == "rotate" && (fields >> f) && readVec3(fields, v) && glm::length(v) > 0.0f)
+    {
+      transform = glm::rotate(glm::radians(f), glm::normalize(v)) * transform;
+    }
+    else if(op == "scale" && (fields >> f))
+    {
+      transform = glm::scale(glm::vec3(f)) * transform;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+bool parseSceneFile(const std::string& filename, SceneDescription& scene)
+{
+  std::ifstream file(filename);
+  if(!file)
+  {
+    LOGE("Could not open the scene file %s.\n", filename.c_str());
+    return false;
+  }
+  scene = {};
+  SceneJob    defaults;             // The camera and sky of jobs that don't set them
+  SceneJob*   current = &defaults;  // Where camera and sky statements go
+  std::string line;
+  uint32_t    lineNumber = 0;
+  while(std::getline(file, line))
+  {
+    lineNumber++;
+    std::istringstream fields(line);
+    std::string        statement;
+    if(!(fields >> statement) || statement[0] == '#')
+    {
+      continue;
+    }
+
+    bool        valid = false;
+    std::string name;
+    uint32_t    model = 0;
+    if(statement == "resolution")
+    {
+      valid = (fields >> name) && sscanf(name.c_str(), "%ux%u", &scene.width, &scene.height) == 2 && scene.width > 0
+              && scene.height > 0;
+    }
+    else if(statement == "samples")
+    {
+      valid = (fields >> scene.samples) && scene.samples > 0;
+    }
+    else if(statement == "segments")
+    {
+      valid = (fields >> scene.segments) && scene.segments > 0;
+    }
+    else if(statement == "sequence")
+    {
+      valid = (fields >> scene.sequenceFrames) && scene.sequenceFrames > 0;
+    }
+    else if(statement == "model")
+    {
+      SceneModel newModel;
+      valid = (fields >> newModel.name >> newModel.filename) && !findModel(scene, newModel.name, model);
+      scene.models.push_back(newModel);
+    }
+    else if(statement == "instance")
+    {
+      SceneInstance instance;
+      valid = (fields >> name >> instance.material) && findModel(scene, name, instance.model)
+              && instance.material < NUM_MATERIALS && readTransform(fields, instance);
+      scene.instances.push_back(instance);
+    }
+    else if(statement == "grid")
+    {
+      uint32_t columns = 0, rows = 0, seed = std::default_random_engine::default_seed;
+      float    spinDegrees = 0.0f;
+      valid = (fields >> name >> columns >> rows) && findModel(scene, name, model) && columns > 0 && rows > 0;
+      if(valid && !(fields >> seed))
+      {
+        seed = std::default_random_engine::default_seed;  // The seed is optional
+      }
+      else if(valid && !(fields >> spinDegrees))
+      {
+        spinDegrees = 0.0f;  // So is the spin
+      }
+      if(valid)
+      {
+        addInstanceGrid(scene, model, columns, rows, seed, spinDegrees);
+      }
+    }
+    else if(statement == "camera" || statement == "sky")
+    {
+      valid = readJobStatement(statement, fields, *current);
+    }
+    else if(statement == "job")
+    {
+      SceneJob job = defaults;
+      valid        = static_cast<bool>(fields >> job.output) && scene.jobs.size() < MAX_JOBS;
+      scene.jobs.push_back(job);
+      current = &scene.jobs.back();
+    }
+
+    if(!valid)
+    {
+      LOGE("%s:%u: invalid statement: %s\n", filename.c_str(), lineNumber, line.c_str());
+      return false;
+    }
+  }
+
+  if(scene.instances.empty())
+  {
+    LOGE("The scene file %s has no instances.\n", filename.c_str());
+    return false;
+  }
+  if(scene.jobs.empty())
+  {
+    scene.jobs.push_back(defaults);
+  }
+  return true;
+}
+
+bool parseJobStatement(const std::string& line, SceneJob& job)
+{
+  std::istringstream fields(line);
+  std::string        statement;
+  return (fields >> statement) && readJobStatement(statement, fields, job);
+}
+
+JobParams makeJobParams(const SceneJob& job)
+{
+  const SceneCamera& camera  = job.camera;
+  const glm::vec3    forward = glm::normalize(camera.target - camera.position);
+  const glm::vec3    right   = glm::normalize(glm::cross(forward, camera.up));
+  const glm::vec3    up      = glm::cross(right, forward);
+  const float        slope   = std::tan(glm::radians(camera.verticalFovDegrees) / 2.0f);
+  return {.camera_origin  = vec4(camera.position, 0.0f),
+          .camera_right   = vec4(slope * right, 0.0f),
+          .camera_up      = vec4(slope * up, 0.0f),
+          .camera_forward = vec4(forward, 0.0f),
+          .sky_zenith     = vec4(job.sky.zenith, 0.0f),
+          .sky_horizon    = vec4(job.sky.horizon, 0.0f),
+          .sky_ground     = vec4(job.sky.ground, 0.0f)};
+}
+
+glm::mat4 getInstanceTransform(const SceneInstance& instance, uint32_t frame)
+{
+  if(instance.spinDegrees == 0.0f || frame == 0)
+  {
+    return instance.transform;
+  }
+  return instance.transform * glm::rotate(glm::radians(instance.spinDegrees * float(frame)), instance.spinAxis);
+}
+
+void addInstanceGrid(SceneDescription& scene, uint32_t model, uint32_t columns, uint32_t rows, uint32_t seed, float spinDegrees)
+{
+  std::default_random_engine            randomEngine(seed);  // The random number generator
+  std::uniform_real_distribution<float> uniformDist(-0.5f, 0.5f);
+  std::uniform_int_distribution<int>    uniformIntDist(0, NUM_GRID_MATERIALS - 1);
+  for(uint32_t column = 0; column < columns; column++)
+  {
+    for(uint32_t row = 0; row < rows; row++)
+    {
+      const float x = float(column) - float(columns - 1) / 2.0f;
+      const float y = float(row) - float(rows - 1) / 2.0f;
+
+      glm::mat4 transform = glm::translate(glm::vec3(0.0f, -1.0f, 0.0f));
+      transform           = glm::rotate(uniformDist(randomEngine), glm::vec3(1.0f, 0.0f, 0.0f)) * transform;
+      transform           = glm::rotate(uniformDist(randomEngine), glm::vec3(0.0f, 1.0f, 0.0f)) * transform;
+      transform           = glm::scale(glm::vec3(1.0f / 2.7f)) * transform;
+      transform           = glm::translate(glm::vec3(x, y, 0.0f)) * transform;
+      scene.instances.push_back({.model       = model,
+                                 .material    = uint32_t(uniformIntDist(randomEngine)),
+                                 .transform   = transform,
+                                 .spinDegrees = spinDegrees});
+    }
+  }
+}
+
+SceneDescription makeDefaultScene(const std::string& objFilename)
+{
+  SceneDescription scene;
+  scene.models.push_back({.name = "mesh", .filename = objFilename});
+  addInstanceGrid(scene, 0, 21, 21, std::default_random_engine::default_seed, 2.0f);
+  scene.jobs.emplace_back();
+  return scene;
+}
@@ -0,0 +1,118 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Describes what the offline renderer renders: the models, their instances,
+// and one or more jobs, each with its own camera, sky and output file.
+// The scene is set up once on each device, and all of the jobs render it;
+// a job only changes an entry of the jobs uniform buffer (see JobParams in
+// common.h), so a worker renders many jobs without rebuilding anything.
+//
+// Scene files (--scene-file) have one statement per line, and lines starting
+// with # are comments:
+//   resolution <width>x<height>
+//   samples <samples per pixel in each sample batch>
+//   segments <maximum segments per sample>
+//   model <name> <OBJ file>
+//   sequence <frames>
+//   instance <model> <material> [translate <x> <y> <z>] [rotate <degrees> <axis x> <axis y> <axis z>] [scale <s>]
+//            [spin <degrees per frame> <axis x> <axis y> <axis z>]
+//   grid <model> <columns> <rows> [<seed> [<degrees per frame>]]
+//   camera <x> <y> <z> <target x> <target y> <target z> <vertical field of view in degrees>
+//   sky <zenith r g b> <horizon r g b> <ground r g b>
+//   job <output path without extension>
+// The transforms of an instance are applied in the order they're listed.
+// A spinning instance turns about the axis through its model's origin, before
+// its transforms, by the given angle each frame of a sequence.
+// A grid is the scene of the earlier chapters: instances of the model with
+// random rotations and materials, one unit apart in x and y, spinning about
+// the model's y axis.
+// A sequence renders that many frames of each job, to the job's output
+// followed by _0000, _0001 and so on (see --sequence).
+// The camera and sky before the first job are the defaults of all jobs;
+// after a job, they're that job's. Without a job, the scene renders one to
+// "out". The command line overrides the resolution, samples and segments.
+#ifndef VK_MINI_PATH_TRACER_SCENE_FILE_HPP
+#define VK_MINI_PATH_TRACER_SCENE_FILE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+
+struct SceneModel
+{
+  std::string name;
+  std::string filename;  // Of the OBJ file
+};
+
+struct SceneInstance
+{
+  uint32_t  model    = 0;
+  uint32_t  material = 0;  // One of NUM_MATERIALS closest-hit shaders
+  glm::mat4 transform{1.0f};
+  float     spinDegrees = 0.0f;  // Per frame of a sequence
+  glm::vec3 spinAxis{0.0f, 1.0f, 0.0f};
+};
+
+// Looks down -z from (-0.001, 0, 53) by default
+struct SceneCamera
+{
+  glm::vec3 position{-0.001f, 0.0f, 53.0f};
+  glm::vec3 target{-0.001f, 0.0f, 0.0f};
+  glm::vec3 up{0.0f, 1.0f, 0.0f};
+  float     verticalFovDegrees = 22.619865f;  // The topmost rays have a slope of 1/5
+};
+
+// Rays that leave the scene upwards get a blend of the zenith and horizon
+// colors by their height; the others get the ground color
+struct SceneSky
+{
+  glm::vec3 zenith{0.25f, 0.5f, 1.0f};
+  glm::vec3 horizon{1.0f};
+  glm::vec3 ground{0.03f};
+};
+
+struct SceneJob
+{
+  std::string output = "out";  // Files are this followed by each format's extension
+  SceneCamera camera;
+  SceneSky    sky;
+};
+
+struct SceneDescription
+{
+  std::vector<SceneModel>    models;
+  std::vector<SceneInstance> instances;
+  std::vector<SceneJob>      jobs;
+  // 0 if the file doesn't set them
+  uint32_t width = 0, height = 0;
+  uint32_t samples = 0, segments = 0;
+  uint32_t sequenceFrames = 0;
+};
+
+// Parses `filename`. Returns false, after logging the line, on errors.
+bool parseSceneFile(const std::string& filename, SceneDescription& scene);
+
+// Parses a camera or sky statement of a scene file into `job`; the render
+// server (render_server.hpp) takes them in its requests. Returns false if
+// `line` isn't one.
+bool parseJobStatement(const std::string& line, SceneJob& job);
+
+// A job's camera and sky, as the shaders get them
+JobParams makeJobParams(const SceneJob& job);
+
+// The transform of `instance` in frame `frame` of a sequence
+glm::mat4 getInstanceTransform(const SceneInstance& instance, uint32_t frame);
+
+// Adds `columns` x `rows` instances of `model`, centered on the origin, with
+// random rotations and materials (of the first NUM_GRID_MATERIALS) from `seed`, spinning by `spinDegrees` per frame
+void addInstanceGrid(SceneDescription& scene, uint32_t model, uint32_t columns, uint32_t rows, uint32_t seed, float spinDegrees);
+
+// The scene of the earlier chapters: a 21 x 21 grid of `objFilename`, rendered
+// to "out", spinning by 2 degrees per frame of a sequence
+SceneDescription makeDefaultScene(const std::string& objFilename);
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_SCENE_FILE_HPP
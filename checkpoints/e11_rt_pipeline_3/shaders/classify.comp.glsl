@@ -0,0 +1,53 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_EXT_ray_query : require
+#extension GL_GOOGLE_include_directive : require
+
+// Finds the next hit of each live path with a ray query, and gives the path
+// the hit's material as its sort key (--reorder sort). The material is the
+// hit instance's SBT record offset, i.e. the closest-hit shader the shading
+// pass will run.
+#include "wavefrontCommon.h"
+
+layout(local_size_x = WAVEFRONT_WORKGROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+// Paths per sort key in this workgroup, so that there's only one global atomic per key and workgroup
+shared uint localCounts[NUM_SORT_KEYS];
+
+void main()
+{
+  if(gl_LocalInvocationIndex < NUM_SORT_KEYS)
+  {
+    localCounts[gl_LocalInvocationIndex] = 0;
+  }
+  barrier();
+
+  const uint pathIndex = gl_GlobalInvocationID.x;
+  if(pathIndex < SORTED_PATHS_PER_WAVE && sortKeys[pathIndex] != SORT_KEY_DONE)
+  {
+    const PathState path     = paths[pathIndex];
+    const uint      tlasSlot = submitParams[pushConstants.submit_slot].tlas;
+    rayQueryEXT     rayQuery;
+    rayQueryInitializeEXT(rayQuery, tlas[tlasSlot], gl_RayFlagsOpaqueEXT, 0xFF, path.origin, 0.0, path.direction, 10000.0);
+    // All geometry is opaque, so this finds the closest hit in one go
+    while(rayQueryProceedEXT(rayQuery))
+    {
+    }
+
+    uint key = SORT_KEY_MISS;
+    if(rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionTriangleEXT)
+    {
+      key                   = rayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetEXT(rayQuery, true);
+      paths[pathIndex].hitT = rayQueryGetIntersectionTEXT(rayQuery, true);
+    }
+    sortKeys[pathIndex] = key;
+    atomicAdd(localCounts[key], 1);
+  }
+  barrier();
+
+  if(gl_LocalInvocationIndex < NUM_SORT_KEYS && localCounts[gl_LocalInvocationIndex] != 0)
+  {
+    atomicAdd(sortCounters.counts[gl_LocalInvocationIndex], localCounts[gl_LocalInvocationIndex]);
+  }
+}
@@ -0,0 +1,99 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_EXT_scalar_block_layout : require
+#extension GL_GOOGLE_include_directive : require
+
+// Lists the pixels of the tile that still need samples, before the traces of
+// each submission (adaptive sampling). A pixel has converged once it has had
+// at least ADAPTIVE_MIN_SAMPLE_BATCHES sample batches and the standard error
+// of its mean luminance, estimated from the variance of its batches, is below
+// noise_threshold times that mean. At the start of a tile, every pixel is
+// listed and its variance is cleared.
+// The list is written a workgroup at a time, so that the pixels of a
+// workgroup stay next to each other, and the traces of neighboring
+// invocations stay coherent.
+#include "../common.h"
+
+layout(binding = BINDING_VARIANCE, set = 0, rgba32f) uniform image2D varianceImage;
+
+layout(binding = BINDING_SUBMIT_PARAMS, set = 0, scalar) readonly buffer SubmitParamsBuffer
+{
+  SubmitParams submitParams[];
+};
+
+layout(binding = BINDING_ACTIVE_PIXELS, set = 0, scalar) writeonly buffer ActivePixelsBuffer
+{
+  uint activePixels[];
+};
+
+// traceArgs[submit_slot].width is cleared right before this pass.
+layout(binding = BINDING_TRACE_ARGS, set = 0, scalar) buffer TraceArgsBuffer
+{
+  TraceArgs traceArgs[];
+};
+
+layout(push_constant) uniform PushConsts
+{
+  PushConstants pushConstants;
+};
+
+layout(local_size_x = WORKGROUP_WIDTH, local_size_y = WORKGROUP_HEIGHT, local_size_z = 1) in;
+
+// Active pixels in this workgroup, and where they start in activePixels
+shared uint localCount;
+shared uint localBase;
+
+// Luminances below this count as this, so that dark pixels don't need a tiny absolute error.
+const float MIN_RELATIVE_LUMINANCE = 1e-2;
+
+void main()
+{
+  if(gl_LocalInvocationIndex == 0)
+  {
+    localCount = 0;
+  }
+  barrier();
+
+  const ivec2        resolution = ivec2(pushConstants.render_width, pushConstants.render_height);
+  const SubmitParams params     = submitParams[pushConstants.submit_slot];
+  const ivec2        tilePixel  = ivec2(gl_GlobalInvocationID.xy);
+  const ivec2        pixel      = ivec2(params.tile_offset_x, params.tile_offset_y) + tilePixel;
+  bool active = (tilePixel.x < TILE_WIDTH) && (tilePixel.y < TILE_HEIGHT) && (pixel.x < resolution.x) && (pixel.y < resolution.y);
+  if(active)
+  {
+    if(params.sample_batch_base == params.accumulation_base)
+    {
+      imageStore(varianceImage, tilePixel, vec4(0.0));
+    }
+    else
+    {
+      // x: mean, y: M2, z: number of batches; see raytraceCommon.h
+      const vec4  variance      = imageLoad(varianceImage, tilePixel);
+      const float numBatches    = variance.z;
+      const float batchVariance = variance.y / max(numBatches - 1.0, 1.0);
+      const float standardError = sqrt(batchVariance / max(numBatches, 1.0));
+      // Strictly below, so that a threshold of 0 never stops a pixel
+      active = (numBatches < ADAPTIVE_MIN_SAMPLE_BATCHES)
+               || !(standardError < pushConstants.noise_threshold * max(variance.x, MIN_RELATIVE_LUMINANCE));
+    }
+  }
+
+  uint indexInWorkgroup = 0;
+  if(active)
+  {
+    indexInWorkgroup = atomicAdd(localCount, 1);
+  }
+  barrier();
+
+  if(gl_LocalInvocationIndex == 0 && localCount != 0)
+  {
+    localBase = atomicAdd(traceArgs[pushConstants.submit_slot].width, localCount);
+  }
+  barrier();
+
+  if(active)
+  {
+    activePixels[localBase + indexInWorkgroup] = tilePixel.y * TILE_WIDTH + tilePixel.x;
+  }
+}
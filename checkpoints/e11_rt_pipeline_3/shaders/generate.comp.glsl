@@ -0,0 +1,53 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_EXT_ray_query : require
+#extension GL_GOOGLE_include_directive : require
+
+// Starts the paths of a wave at the camera (--reorder sort). Path i traces
+// sample i / (TILE_WIDTH * TILE_HEIGHT) of the wave, for tile pixel
+// i % (TILE_WIDTH * TILE_HEIGHT).
+#include "wavefrontCommon.h"
+
+layout(local_size_x = WAVEFRONT_WORKGROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+void main()
+{
+  const uint pathIndex = gl_GlobalInvocationID.x;
+  if(pathIndex >= SORTED_PATHS_PER_WAVE)
+  {
+    return;
+  }
+
+  const ivec2        resolution = ivec2(pushConstants.render_width, pushConstants.render_height);
+  const SubmitParams params     = submitParams[pushConstants.submit_slot];
+  const uint         tilePixel  = pathIndex % (TILE_WIDTH * TILE_HEIGHT);
+  const uint         sampleIdx  = pushConstants.wave * SORTED_SAMPLES_PER_WAVE + pathIndex / (TILE_WIDTH * TILE_HEIGHT);
+  const ivec2        pixel = ivec2(params.tile_offset_x, params.tile_offset_y) + ivec2(tilePixel % TILE_WIDTH, tilePixel / TILE_WIDTH);
+
+  PathState path;
+  path.wavelength = 0.0;
+  path.throughput = vec4(1.0);
+  path.hitT       = 0.0;
+
+  // Paths outside of the image, or past the last sample in the last wave, contribute nothing:
+  if((pixel.x >= resolution.x) || (pixel.y >= resolution.y) || (sampleIdx >= NUM_SAMPLES))
+  {
+    path.throughput     = vec4(0.0);
+    paths[pathIndex]    = path;
+    sortKeys[pathIndex] = SORT_KEY_DONE;
+    return;
+  }
+
+  // Each sample gets its own seed, since the samples of a pixel are traced in parallel.
+  const uint sampleBatch = params.sample_batch_base + pushConstants.batch_in_submit;
+  path.rngState          = uint(((sampleBatch * NUM_SAMPLES + sampleIdx) * resolution.y + pixel.y) * resolution.x + pixel.x);
+  generateCameraRay(pixel, resolution, jobs[params.job], path.rngState, path.origin, path.direction);
+  if(SPECTRAL)
+  {
+    path.wavelength = sampleWavelengths(path.rngState).x;
+  }
+
+  paths[pathIndex]    = path;
+  sortKeys[pathIndex] = 0;  // Live; the classify pass finds the actual key
+}
@@ -6,10 +6,5 @@
 
 void main()
 {
-  HitInfo hitInfo = getObjectHitInfo();
-
-  pld.color        = vec3(0.7);
-  pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
-  pld.rayDirection = reflect(gl_WorldRayDirectionEXT, hitInfo.worldNormal);
-  pld.rayHitSky    = false;
+  shadeMaterial1(getObjectHitInfo(), pld);
 }
\ No newline at end of file
@@ -6,17 +6,5 @@
 
 void main()
 {
-  HitInfo hitInfo = getObjectHitInfo();
-
-  pld.color     = vec3(0.7);
-  pld.rayOrigin = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
-  if(stepAndOutputRNGFloat(pld.rngState) < 0.2)
-  {
-    pld.rayDirection = reflect(gl_WorldRayDirectionEXT, hitInfo.worldNormal);
-  }
-  else
-  {
-    pld.rayDirection = diffuseReflection(hitInfo.worldNormal, pld.rngState);
-  }
-  pld.rayHitSky = false;
+  shadeMaterial3(getObjectHitInfo(), pld);
 }
\ No newline at end of file
@@ -6,18 +6,5 @@
 
 void main()
 {
-  HitInfo hitInfo = getObjectHitInfo();
-
-  pld.color = vec3(0.7);
-  if(stepAndOutputRNGFloat(pld.rngState) < 0.5)
-  {
-    pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
-    pld.rayDirection = diffuseReflection(hitInfo.worldNormal, pld.rngState);
-  }
-  else
-  {
-    pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, -hitInfo.worldNormal);
-    pld.rayDirection = gl_WorldRayDirectionEXT;
-  }
-  pld.rayHitSky = false;
+  shadeMaterial4(getObjectHitInfo(), pld);
 }
\ No newline at end of file
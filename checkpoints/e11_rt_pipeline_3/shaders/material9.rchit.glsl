@@ -0,0 +1,10 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_GOOGLE_include_directive : require
+#include "closestHitCommon.h"
+
+void main()
+{
+  shadeMaterial9(getObjectHitInfo(), pld);
+}
\ No newline at end of file
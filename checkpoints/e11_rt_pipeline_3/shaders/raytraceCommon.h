@@ -0,0 +1,274 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// The ray generation shader. The format qualifier of a storage image that's
+// read from has to match the image's format, so there's one small
+// raytrace*.rgen.glsl file per supported storage image format; each one
+// defines STORAGE_IMAGE_FORMAT and then includes this file.
+// The raytrace*_reorder.rgen.glsl files also define REORDER_INVOCATIONS, to
+// reorder invocations by material before shading each hit, using
+// GL_NV_shader_invocation_reorder (--reorder ser).
+// The raytrace_query*.comp.glsl files define RAY_QUERY instead (--backend
+// query): the same loop becomes a compute shader, which finds each hit with
+// a ray query and shades it inline with the code of the closest-hit shaders
+// (shared/shaders/shadingLibrary.h), without going through the ray tracing
+// pipeline.
+#ifndef VK_MINI_PATH_TRACER_RAYTRACE_COMMON_H
+#define VK_MINI_PATH_TRACER_RAYTRACE_COMMON_H
+
+#ifdef RAY_QUERY
+#extension GL_EXT_ray_query : require
+#else
+#extension GL_EXT_ray_tracing : require
+#endif
+#ifdef REORDER_INVOCATIONS
+#extension GL_NV_shader_invocation_reorder : require
+// Enough bits for the keys 0 to SORT_KEY_MISS
+#define REORDER_KEY_BITS 4
+#endif
+#extension GL_EXT_scalar_block_layout : require
+#include "../common.h"
+#include "shaderCommon.h"
+#ifdef RAY_QUERY
+#include "shadingCommon.h"
+
+// One invocation per active pixel, like the launch of the ray generation shader
+layout(local_size_x = QUERY_WORKGROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+#define LAUNCH_INDEX gl_GlobalInvocationID.x
+#else
+#define LAUNCH_INDEX gl_LaunchIDEXT.x
+#endif
+
+// Binding BINDING_IMAGEDATA in set 0 is a storage image with STORAGE_IMAGE_FORMAT texels,
+// defined using a uniform image2D variable. It holds the tile being rendered.
+layout(binding = BINDING_IMAGEDATA, set = 0, STORAGE_IMAGE_FORMAT) uniform image2D storageImage;
+layout(binding = BINDING_TLAS, set = 0) uniform accelerationStructureEXT tlas[NUM_TLAS_SLOTS];
+
+layout(binding = BINDING_SUBMIT_PARAMS, set = 0, scalar) readonly buffer SubmitParamsBuffer
+{
+  SubmitParams submitParams[];
+};
+
+// The camera and sky of each job; submitParams[...].job selects one.
+layout(binding = BINDING_JOBS, set = 0) uniform JobsBuffer
+{
+  JobParams jobs[MAX_JOBS];
+};
+
+// With --noise-threshold, written by the converge pass (converge.comp.glsl)
+// before the traces of each submission: the pixels of the tile that still
+// need samples, and how many there are. Invocation i traces activePixels[i].
+layout(binding = BINDING_VARIANCE, set = 0, rgba32f) uniform image2D varianceImage;
+layout(binding = BINDING_ACTIVE_PIXELS, set = 0, scalar) readonly buffer ActivePixelsBuffer
+{
+  uint activePixels[];
+};
+layout(binding = BINDING_TRACE_ARGS, set = 0, scalar) readonly buffer TraceArgsBuffer
+{
+  TraceArgs traceArgs[];
+};
+
+// These are specialization constants, so that each configuration of the
+// renderer gets a pipeline with these loop bounds known at compile time.
+layout(constant_id = SPEC_CONSTANT_NUM_SAMPLES) const int NUM_SAMPLES = 64;
+layout(constant_id = SPEC_CONSTANT_MAX_SEGMENTS) const int MAX_SEGMENTS = 32;
+
+layout(push_constant) uniform PushConsts
+{
+  PushConstants pushConstants;
+};
+
+#ifdef RAY_QUERY
+// Written by shadeMaterial, or by the miss code of traceRayQuery.
+PassableInfo pld;
+
+// The ray query version of traceRayEXT: finds the closest hit of the ray,
+// and shades it with its material, or does what the miss shader
+// (raytrace.rmiss.glsl) does if there's none.
+void traceRayQuery(uint tlasSlot, vec3 rayOrigin, vec3 rayDirection)
+{
+  rayQueryEXT rayQuery;
+  rayQueryInitializeEXT(rayQuery, tlas[tlasSlot], gl_RayFlagsOpaqueEXT, 0xFF, rayOrigin, 0.0, rayDirection, 10000.0);
+  // All geometry is opaque, so this finds the closest hit in one go
+  while(rayQueryProceedEXT(rayQuery))
+  {
+  }
+
+  if(rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionTriangleEXT)
+  {
+    const HitInfo hitInfo = computeHitInfo(uint(rayQueryGetIntersectionInstanceCustomIndexEXT(rayQuery, true)),
+                                           rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, true),
+                                           rayQueryGetIntersectionBarycentricsEXT(rayQuery, true),
+                                           rayQueryGetIntersectionObjectToWorldEXT(rayQuery, true),
+                                           rayQueryGetIntersectionWorldToObjectEXT(rayQuery, true), rayDirection);
+    // The material is the instance's SBT record offset, as for the closest-hit shaders
+    shadeMaterial(rayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetEXT(rayQuery, true), hitInfo, pld);
+  }
+  else
+  {
+    pld.color     = vec3(1.0f);
+    pld.rayHitSky = true;
+  }
+}
+#else
+// Ray payloads are used to send information between shaders.
+layout(location = 0) rayPayloadEXT PassableInfo pld;
+#endif
+
+void main()
+{
+  // The resolution of the full image:
+  const ivec2 resolution = ivec2(pushConstants.render_width, pushConstants.render_height);
+
+  const SubmitParams params = submitParams[pushConstants.submit_slot];
+  const JobParams    job    = jobs[params.job];
+
+  // The launch is one-dimensional. With --noise-threshold, it's over the
+  // active pixels; without vkCmdTraceRaysIndirectKHR (and always with
+  // --backend query), it covers the whole tile, and the invocations past the
+  // number of active pixels don't do anything. Otherwise, invocation i
+  // traces pixel i of the tile.
+  const bool adaptiveSampling = (pushConstants.noise_threshold > 0.0);
+  uint       tilePixelIndex   = LAUNCH_INDEX;
+  if(adaptiveSampling)
+  {
+    if(LAUNCH_INDEX >= traceArgs[pushConstants.submit_slot].width)
+    {
+      return;
+    }
+    tilePixelIndex = activePixels[LAUNCH_INDEX];
+  }
+  else if(LAUNCH_INDEX >= TILE_WIDTH * TILE_HEIGHT)
+  {
+    return;
+  }
+
+  // Get the coordinates of the pixel for this invocation, within the tile:
+  //
+  // .-------.-> x
+  // |       |
+  // |       |
+  // '-------'
+  // v
+  // y
+  const ivec2 tilePixel = ivec2(tilePixelIndex % TILE_WIDTH, tilePixelIndex / TILE_WIDTH);
+  // and within the full image:
+  const ivec2 pixel = ivec2(params.tile_offset_x, params.tile_offset_y) + tilePixel;
+
+  // If the pixel is outside of the image, don't do anything:
+  if((pixel.x >= resolution.x) || (pixel.y >= resolution.y))
+  {
+    return;
+  }
+
+  // Index of the sample batch this trace computes.
+  const uint sampleBatch = params.sample_batch_base + pushConstants.batch_in_submit;
+
+  // State of the random number generator with an initial seed.
+  pld.rngState = uint((sampleBatch * resolution.y + pixel.y) * resolution.x + pixel.x);
+
+  // The sum of the colors of all of the samples.
+  vec3 summedPixelColor = vec3(0.0);
+
+  // Limit the kernel to trace at most NUM_SAMPLES samples.
+  for(int sampleIdx = 0; sampleIdx < NUM_SAMPLES; sampleIdx++)
+  {
+    vec3 rayOrigin, rayDirection;
+    generateCameraRay(pixel, resolution, job, pld.rngState, rayOrigin, rayDirection);
+
+    // The amount of light that made it to the end of the current ray: in
+    // .rgb, or with SPECTRAL, at the sample's wavelengths.
+    vec4 accumulatedRayColor = vec4(1.0);
+    vec4 wavelengths         = vec4(0.0);
+    if(SPECTRAL)
+    {
+      wavelengths = sampleWavelengths(pld.rngState);
+    }
+
+    // Limit the kernel to trace at most MAX_SEGMENTS segments.
+    for(int tracedSegments = 0; tracedSegments < MAX_SEGMENTS; tracedSegments++)
+    {
+      pld.wavelength = SPECTRAL ? wavelengths.x : 550.0f;
+      pld.dispersed  = false;
+#ifdef REORDER_INVOCATIONS
+      // Find the hit without shading it yet:
+      hitObjectNV hitObject;
+      hitObjectTraceRayNV(hitObject, tlas[params.tlas], gl_RayFlagsOpaqueEXT, 0xFF, 0, 0, 0, rayOrigin, 0.0, rayDirection, 10000.0, 0);
+      // Then regroup the invocations across the launch so that the ones that
+      // run the same closest-hit shader (the material, which is the hit's SBT
+      // record) or the miss shader are shaded together:
+      const uint materialKey = hitObjectIsHitNV(hitObject) ? hitObjectGetShaderBindingTableRecordIndexNV(hitObject) : SORT_KEY_MISS;
+      reorderThreadNV(hitObject, materialKey, REORDER_KEY_BITS);
+      hitObjectExecuteShaderNV(hitObject, 0);
+#elif defined(RAY_QUERY)
+      // Find the hit and shade it, in this invocation:
+      traceRayQuery(params.tlas, rayOrigin, rayDirection);
+#else
+      // Trace the ray into the scene and get data back!
+      traceRayEXT(tlas[params.tlas],      // Top-level acceleration structure
+                  gl_RayFlagsOpaqueEXT,  // Ray flags, here saying "treat all geometry as opaque"
+                  0xFF,                  // 8-bit instance mask, here saying "trace against all instances"
+                  0,                     // SBT record offset
+                  0,                     // SBT record stride for offset
+                  0,                     // Miss index
+                  rayOrigin,             // Ray origin
+                  0.0,                   // Minimum t-value
+                  rayDirection,          // Ray direction
+                  10000.0,               // Maximum t-value
+                  0);                    // Location of payload
+#endif
+
+      // Compute the amount of light that returns to this sample from the ray
+      multiplySurfaceColor(accumulatedRayColor, wavelengths, pld, SPECTRAL);
+
+      if(pld.rayHitSky)
+      {
+        // Done tracing this ray.
+        // Sum this with the pixel's other samples.
+        // (Note that we treat a ray that didn't find a light source as if it had
+        // an accumulated color of (0, 0, 0)).
+        summedPixelColor += skyRadiance(job, rayDirection, accumulatedRayColor, wavelengths, SPECTRAL);
+
+        break;
+      }
+      else
+      {
+        // Start a new segment
+        rayOrigin    = pld.rayOrigin;
+        rayDirection = pld.rayDirection;
+      }
+    }
+  }
+
+  // Blend with the averaged image in the buffer. With --noise-threshold,
+  // converged pixels stop being traced, so the number of batches averaged so
+  // far is per pixel; it's kept in the variance image.
+  const vec3  batchColor        = summedPixelColor / float(NUM_SAMPLES);
+  vec3        averagePixelColor = batchColor;
+  const vec4  variance          = adaptiveSampling ? imageLoad(varianceImage, tilePixel) : vec4(0.0);
+  const float numBatches        = adaptiveSampling ? variance.z : float(sampleBatch - params.accumulation_base);
+  if(numBatches != 0.0)
+  {
+    // Read the storage image:
+    const vec3 previousAverageColor = imageLoad(storageImage, tilePixel).rgb;
+    // Compute the new average:
+    averagePixelColor = (numBatches * previousAverageColor + batchColor) / (numBatches + 1.0);
+  }
+  // Set the color of the pixel `pixel` in the tile to `averagePixelColor`:
+  imageStore(storageImage, tilePixel, vec4(averagePixelColor, 0.0));
+  if(!adaptiveSampling)
+  {
+    return;
+  }
+
+  // Update the running mean and M2 of the luminance of the pixel's batches
+  // (Welford's algorithm), which the converge pass turns into the standard
+  // error of the pixel's mean:
+  const float batchLuminance = dot(batchColor, vec3(0.2126, 0.7152, 0.0722));
+  const float delta          = batchLuminance - variance.x;
+  const float mean           = variance.x + delta / (numBatches + 1.0);
+  const float m2             = variance.y + delta * (batchLuminance - mean);
+  imageStore(varianceImage, tilePixel, vec4(mean, m2, numBatches + 1.0, 0.0));
+}
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_RAYTRACE_COMMON_H
\ No newline at end of file
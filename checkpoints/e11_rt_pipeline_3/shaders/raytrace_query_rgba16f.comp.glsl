@@ -0,0 +1,9 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+// Ray query megakernel of --backend query for a storage image with four 16-bit floating-point channels.
+#define STORAGE_IMAGE_FORMAT rgba16f
+#define RAY_QUERY
+#include "raytraceCommon.h"
\ No newline at end of file
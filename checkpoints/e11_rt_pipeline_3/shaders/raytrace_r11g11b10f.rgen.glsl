@@ -0,0 +1,8 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+// Ray generation shader for a storage image with packed 11-, 11- and 10-bit unsigned floating-point channels.
+#define STORAGE_IMAGE_FORMAT r11f_g11f_b10f
+#include "raytraceCommon.h"
\ No newline at end of file
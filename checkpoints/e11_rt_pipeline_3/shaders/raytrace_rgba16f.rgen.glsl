@@ -0,0 +1,8 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+// Ray generation shader for a storage image with four 16-bit floating-point channels.
+#define STORAGE_IMAGE_FORMAT rgba16f
+#include "raytraceCommon.h"
\ No newline at end of file
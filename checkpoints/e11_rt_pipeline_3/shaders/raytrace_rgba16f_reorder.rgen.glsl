@@ -0,0 +1,10 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+// Ray generation shader for a storage image with four 16-bit floating-point channels,
+// which reorders invocations by material before shading (--reorder ser).
+#define STORAGE_IMAGE_FORMAT rgba16f
+#define REORDER_INVOCATIONS
+#include "raytraceCommon.h"
\ No newline at end of file
@@ -0,0 +1,60 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_EXT_ray_tracing : require
+#extension GL_GOOGLE_include_directive : require
+
+// Shades one segment of each live path (--reorder sort). Invocation i shades
+// sortedPaths[i], so the invocations of a warp mostly hit the same material
+// and run the same closest-hit shader. The classify pass already found the
+// hit; tracing again within a small interval around it culls almost all of
+// the acceleration structure, and runs the hit's closest-hit shader.
+#include "wavefrontCommon.h"
+
+layout(location = 0) rayPayloadEXT PassableInfo pld;
+
+void main()
+{
+  const uint sortedIndex = gl_LaunchIDEXT.x;
+  if(sortedIndex >= firstSortedPath(SORT_KEY_DONE))
+  {
+    return;
+  }
+  const SubmitParams params    = submitParams[pushConstants.submit_slot];
+  const uint         pathIndex = sortedPaths[sortedIndex];
+  PathState          path      = paths[pathIndex];
+
+  // A ray with tMax = 0 can't hit anything, so missed paths go straight to the miss shader.
+  const bool  hit  = (sortKeys[pathIndex] != SORT_KEY_MISS);
+  const float tMin = hit ? path.hitT * 0.999 : 0.0;
+  const float tMax = hit ? path.hitT * 1.001 : 0.0;
+  pld.rngState     = path.rngState;
+  vec4 wavelengths = vec4(0.0);
+  if(SPECTRAL)
+  {
+    wavelengths = loadPathWavelengths(path);
+  }
+  pld.wavelength = SPECTRAL ? wavelengths.x : 550.0f;
+  pld.dispersed  = false;
+  traceRayEXT(tlas[params.tlas], gl_RayFlagsOpaqueEXT, 0xFF, 0, 0, 0, path.origin, tMin, path.direction, tMax, 0);
+
+  // The same as a segment of the megakernel in raytraceCommon.h
+  multiplySurfaceColor(path.throughput, wavelengths, pld, SPECTRAL);
+  path.rngState = pld.rngState;
+  if(pld.rayHitSky)
+  {
+    // The resolve pass sums the RGB colors of the finished paths
+    path.throughput.rgb = skyRadiance(jobs[params.job], path.direction, path.throughput, wavelengths, SPECTRAL);
+    sortKeys[pathIndex] = SORT_KEY_DONE;
+  }
+  else
+  {
+    path.origin    = pld.rayOrigin;
+    path.direction = pld.rayDirection;
+  }
+  if(SPECTRAL)
+  {
+    storePathWavelengths(path, wavelengths);
+  }
+  paths[pathIndex] = path;
+}
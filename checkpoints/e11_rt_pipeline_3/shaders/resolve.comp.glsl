@@ -0,0 +1,8 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+// Resolve pass of --reorder sort for a storage image with four 32-bit floating-point channels.
+#define STORAGE_IMAGE_FORMAT rgba32f
+#include "resolveCommon.h"
\ No newline at end of file
@@ -0,0 +1,61 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Adds the paths of a wave that reached the sky to the sums of their pixels
+// (--reorder sort). After the last wave of a sample batch, it blends the
+// batch's average into the tile, like the end of the megakernel ray
+// generation shader. Like there, there's one small resolve*.comp.glsl file
+// per storage image format; each one defines STORAGE_IMAGE_FORMAT and then
+// includes this file.
+#ifndef VK_MINI_PATH_TRACER_RESOLVE_COMMON_H
+#define VK_MINI_PATH_TRACER_RESOLVE_COMMON_H
+
+#extension GL_EXT_ray_query : require
+#include "wavefrontCommon.h"
+
+layout(binding = BINDING_IMAGEDATA, set = 0, STORAGE_IMAGE_FORMAT) uniform image2D storageImage;
+
+layout(local_size_x = WORKGROUP_WIDTH, local_size_y = WORKGROUP_HEIGHT, local_size_z = 1) in;
+
+void main()
+{
+  const ivec2        resolution = ivec2(pushConstants.render_width, pushConstants.render_height);
+  const SubmitParams params     = submitParams[pushConstants.submit_slot];
+  const ivec2        tilePixel  = ivec2(gl_GlobalInvocationID.xy);
+  const ivec2        pixel      = ivec2(params.tile_offset_x, params.tile_offset_y) + tilePixel;
+  if((tilePixel.x >= TILE_WIDTH) || (tilePixel.y >= TILE_HEIGHT) || (pixel.x >= resolution.x) || (pixel.y >= resolution.y))
+  {
+    return;
+  }
+
+  // Paths that didn't reach the sky within MAX_SEGMENTS segments count as (0, 0, 0).
+  const uint tilePixelIndex   = tilePixel.y * TILE_WIDTH + tilePixel.x;
+  vec3       summedPixelColor = (pushConstants.wave == 0) ? vec3(0.0) : pixelSums[tilePixelIndex];
+  for(uint sampleInWave = 0; sampleInWave < SORTED_SAMPLES_PER_WAVE; sampleInWave++)
+  {
+    const uint pathIndex = sampleInWave * (TILE_WIDTH * TILE_HEIGHT) + tilePixelIndex;
+    if(sortKeys[pathIndex] == SORT_KEY_DONE)
+    {
+      summedPixelColor += paths[pathIndex].throughput.rgb;
+    }
+  }
+
+  const uint numWaves = (NUM_SAMPLES + SORTED_SAMPLES_PER_WAVE - 1) / SORTED_SAMPLES_PER_WAVE;
+  if(pushConstants.wave + 1 < numWaves)
+  {
+    pixelSums[tilePixelIndex] = summedPixelColor;
+    return;
+  }
+
+  // Blend with the averaged image in the buffer:
+  const uint numBatches        = params.sample_batch_base + pushConstants.batch_in_submit - params.accumulation_base;
+  vec3       averagePixelColor = summedPixelColor / float(NUM_SAMPLES);
+  if(numBatches != 0)
+  {
+    const vec3 previousAverageColor = imageLoad(storageImage, tilePixel).rgb;
+    averagePixelColor               = (numBatches * previousAverageColor + averagePixelColor) / (numBatches + 1);
+  }
+  imageStore(storageImage, tilePixel, vec4(averagePixelColor, 0.0));
+}
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_RESOLVE_COMMON_H
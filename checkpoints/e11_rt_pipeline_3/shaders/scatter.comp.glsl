@@ -0,0 +1,46 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_EXT_ray_query : require
+#extension GL_GOOGLE_include_directive : require
+
+// Writes the index of each live path into sortedPaths, in the range of its
+// sort key (--reorder sort): a counting sort, from the counts of the
+// classify pass. The order of the paths within a key doesn't matter.
+#include "wavefrontCommon.h"
+
+layout(local_size_x = WAVEFRONT_WORKGROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+shared uint localCounts[NUM_SORT_KEYS];  // Paths per sort key in this workgroup
+shared uint localFirst[NUM_SORT_KEYS];   // Where this workgroup's paths of each key go in sortedPaths
+
+void main()
+{
+  if(gl_LocalInvocationIndex < NUM_SORT_KEYS)
+  {
+    localCounts[gl_LocalInvocationIndex] = 0;
+  }
+  barrier();
+
+  const uint pathIndex = gl_GlobalInvocationID.x;
+  const uint key       = (pathIndex < SORTED_PATHS_PER_WAVE) ? sortKeys[pathIndex] : SORT_KEY_DONE;
+  uint       localSlot = 0;
+  if(key != SORT_KEY_DONE)
+  {
+    localSlot = atomicAdd(localCounts[key], 1);
+  }
+  barrier();
+
+  // One global atomic per key reserves the workgroup's range of it
+  if(gl_LocalInvocationIndex < NUM_SORT_KEYS && localCounts[gl_LocalInvocationIndex] != 0)
+  {
+    localFirst[gl_LocalInvocationIndex] = firstSortedPath(gl_LocalInvocationIndex)
+                                          + atomicAdd(sortCounters.cursors[gl_LocalInvocationIndex], localCounts[gl_LocalInvocationIndex]);
+  }
+  barrier();
+
+  if(key != SORT_KEY_DONE)
+  {
+    sortedPaths[localFirst[key] + localSlot] = pathIndex;
+  }
+}
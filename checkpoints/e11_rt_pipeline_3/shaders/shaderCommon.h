@@ -5,25 +5,15 @@
 #ifndef VK_MINI_PATH_TRACER_SHADER_COMMON_H
 #define VK_MINI_PATH_TRACER_SHADER_COMMON_H
 
-struct PassableInfo
-{
-  vec3 color;         // The reflectivity of the surface.
-  vec3 rayOrigin;     // The new ray origin in world-space.
-  vec3 rayDirection;  // The new ray direction in world-space.
-  uint rngState;      // State of the random number generator.
-  bool rayHitSky;     // True if the ray hit the sky.
-};
+#include "../common.h"
 
-// Steps the RNG and returns a floating-point value between 0 and 1 inclusive.
-float stepAndOutputRNGFloat(inout uint rngState)
-{
-  // Condensed version of pcg_output_rxs_m_xs_32_32, with simple conversion to floating-point [0,1].
-  rngState  = rngState * 747796405 + 1;
-  uint word = ((rngState >> ((rngState >> 28) + 4)) ^ rngState) * 277803737;
-  word      = (word >> 22) ^ word;
-  return float(word) / 4294967295.0f;
-}
+// A compile-time variant: with --color spectral, paths carry 4 wavelengths in
+// a vec4 instead of RGB, and the pipelines are specialized with SPECTRAL
+// true. With it false, the branches on it are dead code, and RGB renders
+// trace as before. It's passed on to the functions of tracingCommon.h that
+// depend on it, since the CPU backend runs those too.
+layout(constant_id = SPEC_CONSTANT_SPECTRAL) const bool SPECTRAL = false;
 
-const float k_pi = 3.14159265;
+#include "tracingCommon.h"
 
 #endif  // #ifndef VK_MINI_PATH_TRACER_SHADER_COMMON_H
\ No newline at end of file
@@ -0,0 +1,89 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// What both tracing backends (--backend, see main.cpp) need to shade a hit:
+// the closest-hit shaders material*.rchit.glsl of the ray tracing pipeline,
+// and the ray query compute shaders raytrace_query*.comp.glsl, which trace
+// and shade inline. A backend finds the hit, turns it into a HitInfo with
+// computeHitInfo, and calls the material's function from the shading library
+// (shared/shaders/shadingLibrary.h); material N is the hit instance's SBT
+// record offset.
+#ifndef VK_MINI_PATH_TRACER_SHADING_COMMON_H
+#define VK_MINI_PATH_TRACER_SHADING_COMMON_H
+
+#extension GL_EXT_scalar_block_layout : require
+#include "../common.h"
+#include "shaderCommon.h"
+
+// These shaders can access the vertex and index buffers:
+// The scalar layout qualifier here means to align types according to the alignment
+// of their scalar components, instead of e.g. padding them to std140 rules.
+layout(binding = BINDING_VERTICES, set = 0, scalar) buffer Vertices
+{
+  vec3 vertices[];
+};
+layout(binding = BINDING_INDICES, set = 0, scalar) buffer Indices
+{
+  uint indices[];
+};
+// Where the vertices and indices of each model start:
+layout(binding = BINDING_MODELS, set = 0, scalar) readonly buffer Models
+{
+  ModelRange models[];
+};
+
+// Gets hit info about the intersection of a ray with direction `rayDirection`
+// and triangle `primitiveID` of model `modelIndex`, at barycentrics `attributes`.
+// The matrices are those of the instance the triangle is in.
+HitInfo computeHitInfo(uint modelIndex, int primitiveID, vec2 attributes, mat4x3 objectToWorld, mat4x3 worldToObject, vec3 rayDirection)
+{
+  HitInfo result;
+  result.rayDirection = rayDirection;
+  result.primitiveID  = primitiveID;
+  // Get the model of the instance the triangle is in
+  const ModelRange model = models[modelIndex];
+
+  // Get the indices of the vertices of the triangle
+  const uint firstIndex = model.first_index + 3 * primitiveID;
+  const uint i0         = model.first_vertex + indices[firstIndex + 0];
+  const uint i1         = model.first_vertex + indices[firstIndex + 1];
+  const uint i2         = model.first_vertex + indices[firstIndex + 2];
+
+  // Get the vertices of the triangle
+  const vec3 v0 = vertices[i0];
+  const vec3 v1 = vertices[i1];
+  const vec3 v2 = vertices[i2];
+
+
+  // Get the barycentric coordinates of the intersection
+  vec3 barycentrics = vec3(0.0, attributes.x, attributes.y);
+  barycentrics.x    = 1.0 - barycentrics.y - barycentrics.z;
+
+  // Compute the coordinates of the intersection
+  result.objectPosition = v0 * barycentrics.x + v1 * barycentrics.y + v2 * barycentrics.z;
+  // Transform from object space to world space:
+  result.worldPosition = objectToWorld * vec4(result.objectPosition, 1.0f);
+
+
+  // Compute the normal of the triangle in object space, using the right-hand rule:
+  //    v2      .
+  //    |\      .
+  //    | \     .
+  //    |/ \    .
+  //    /   \   .
+  //   /|    \  .
+  //  L v0---v1 .
+  // n
+  const vec3 objectNormal = cross(v1 - v0, v2 - v0);
+  // Transform normals from object space to world space. These use the transpose of the inverse matrix,
+  // because they're directions of normals, not positions:
+  result.worldNormal = normalize((objectNormal * worldToObject).xyz);
+
+  // Flip the normal so it points against the ray direction:
+  result.frontFace   = dot(result.worldNormal, rayDirection) < 0.0;
+  result.worldNormal = faceforward(result.worldNormal, rayDirection, result.worldNormal);
+
+  return result;
+}
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_SHADING_COMMON_H
@@ -0,0 +1,164 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// The path tracing code that runs on both the GPU and the CPU backend
+// (cpu_tracer.cpp): the camera, the sky and the spectral conversions, on top
+// of the RNG and the materials of the shading library
+// (shared/shaders/shadingLibrary.h). Like common.h, it compiles as GLSL and
+// as C++, so that each sample draws the same random numbers for the same
+// decisions on both, and it keeps to the rules the shading library gives for
+// that. C++ can't see SPECTRAL, so the functions that depend on it take it as
+// a parameter.
+#ifndef VK_MINI_PATH_TRACER_TRACING_COMMON_H
+#define VK_MINI_PATH_TRACER_TRACING_COMMON_H
+
+#include "../common.h"
+#include "../../../shared/shaders/shadingLibrary.h"
+
+#ifdef __cplusplus
+namespace shading {
+#endif  // #ifdef __cplusplus
+
+// Generates the first ray of a sample of `pixel`, from the camera of `job`.
+void generateCameraRay(ivec2 pixel, ivec2 resolution, JobParams job, INOUT(uint) rngState, OUT(vec3) rayOrigin, OUT(vec3) rayDirection)
+{
+  // This scene uses a right-handed coordinate system like the OBJ file format, where the
+  // +y axis points up. The camera looks along camera_forward; camera_right and camera_up
+  // span the screen, and are scaled by the vertical slope of the topmost rays, which
+  // defines the field of view.
+
+  // Rays always originate at the camera for now. In the future, they'll
+  // bounce around the scene.
+  rayOrigin = vec3(job.camera_origin);
+  // Compute the direction of the ray for this pixel. To do this, we first
+  // transform the screen coordinates to look like this, where a is the
+  // aspect ratio (width/height) of the screen:
+  //           1
+  //    .------+------.
+  //    |      |      |
+  // -a + ---- 0 ---- + a
+  //    |      |      |
+  //    '------+------'
+  //          -1
+  // Use a Gaussian with standard deviation 0.375 centered at the center of
+  // the pixel:
+  const vec2 randomPixelCenter = vec2(pixel) + vec2(0.5f) + 0.375f * randomGaussian(rngState);
+  const vec2 screenUV          = vec2((2.0f * randomPixelCenter.x - resolution.x) / resolution.y,    //
+                             -(2.0f * randomPixelCenter.y - resolution.y) / resolution.y);  // Flip the y axis
+  // Create a ray direction:
+  rayDirection = screenUV.x * vec3(job.camera_right) + screenUV.y * vec3(job.camera_up) + vec3(job.camera_forward);
+  rayDirection = normalize(rayDirection);
+}
+
+// Returns the color of the sky of `job` in a given direction (in linear color
+// space). The miss shader returns white; the ray generation shaders multiply
+// the paths that reached the sky by this, since they know the job.
+vec3 skyColor(JobParams job, vec3 rayDirection)
+{
+  // +y in world space is up, so:
+  if(rayDirection.y > 0.0f)
+  {
+    return mix(vec3(job.sky_horizon), vec3(job.sky_zenith), rayDirection.y);
+  }
+  return vec3(job.sky_ground);
+}
+
+// Hero wavelength sampling (Wilkie et al. 2014): the first wavelength is
+// uniform in [SPECTRAL_MIN_WAVELENGTH, SPECTRAL_MAX_WAVELENGTH], and the
+// other 3 are spaced evenly after it, wrapping around. The first one is the
+// hero: a material that disperses light follows it.
+vec4 sampleWavelengths(INOUT(uint) rngState)
+{
+  const float range = SPECTRAL_MAX_WAVELENGTH - SPECTRAL_MIN_WAVELENGTH;
+  const float hero  = range * stepAndOutputRNGFloat(rngState);
+  return SPECTRAL_MIN_WAVELENGTH + mod(hero + vec4(0.0f, 0.25f, 0.5f, 0.75f) * range, range);
+}
+
+// The wavelengths sampleWavelengths returns with the hero wavelength `hero`
+vec4 getHeroWavelengths(float hero)
+{
+  const float range = SPECTRAL_MAX_WAVELENGTH - SPECTRAL_MIN_WAVELENGTH;
+  return SPECTRAL_MIN_WAVELENGTH + mod(hero - SPECTRAL_MIN_WAVELENGTH + vec4(0.0f, 0.25f, 0.5f, 0.75f) * range, range);
+}
+
+// The spectrum of a linear RGB color, at `wavelengths`: a mix of one basis
+// spectrum per channel, which sum to 1 at every wavelength, so that gray
+// stays constant and colors in [0, 1] stay valid reflectances. The bases are
+// Gaussians, flat past their peak for red and blue, normalized by their sum;
+// they're fitted so that spectrumToRgb returns the colors within a few percent.
+vec4 rgbToSpectrum(vec3 rgb, vec4 wavelengths)
+{
+  const vec4 dr = min(wavelengths - 603.0f, 0.0f) / 8.0f;
+  const vec4 dg = (wavelengths - 528.0f) / 29.0f;
+  const vec4 db = max(wavelengths - 451.0f, 0.0f) / 29.0f;
+  const vec4 r  = exp(-0.5f * dr * dr);
+  const vec4 g  = exp(-0.5f * dg * dg);
+  const vec4 b  = exp(-0.5f * db * db);
+  return (rgb.r * r + rgb.g * g + rgb.b * b) / (r + g + b);
+}
+
+// One lobe of the fit below, with inverse widths `t1` below `mu` and `t2` above.
+vec4 cieLobe(vec4 wavelengths, float mu, float t1, float t2)
+{
+  const vec4 t = (wavelengths - mu) * mix(vec4(t2), vec4(t1), lessThan(wavelengths, vec4(mu)));
+  return exp(-0.5f * t * t);
+}
+
+// The linear RGB color of a spectrum known at `wavelengths`, as sampled by
+// sampleWavelengths: the CIE 1931 color matching functions, in the
+// multi-lobe fit of Wyman et al. 2013, give XYZ, which goes to linear sRGB
+// scaled so that a constant spectrum of 1 is white.
+vec3 spectrumToRgb(vec4 radiance, vec4 wavelengths)
+{
+  const vec4 xBar = 1.056f * cieLobe(wavelengths, 599.8f, 0.0264f, 0.0323f)
+                    + 0.362f * cieLobe(wavelengths, 442.0f, 0.0624f, 0.0374f)
+                    - 0.065f * cieLobe(wavelengths, 501.1f, 0.0490f, 0.0382f);
+  const vec4 yBar = 0.821f * cieLobe(wavelengths, 568.8f, 0.0213f, 0.0247f) + 0.286f * cieLobe(wavelengths, 530.9f, 0.0613f, 0.0322f);
+  const vec4 zBar = 1.217f * cieLobe(wavelengths, 437.0f, 0.0845f, 0.0278f) + 0.681f * cieLobe(wavelengths, 459.0f, 0.0385f, 0.0725f);
+  // The average over the 4 wavelengths, divided by their density
+  const float range = SPECTRAL_MAX_WAVELENGTH - SPECTRAL_MIN_WAVELENGTH;
+  const vec3  xyz   = 0.25f * range * vec3(dot(radiance, xBar), dot(radiance, yBar), dot(radiance, zBar));
+  // Columns of the XYZ to linear sRGB matrix:
+  const mat3 xyzToRgb = mat3(3.2404542f, -0.9692660f, 0.0556434f,  //
+                             -1.5371385f, 1.8760108f, -0.2040259f,  //
+                             -0.4985314f, 0.0415560f, 1.0572252f);
+  // xyzToRgb times the integrals of the color matching functions over the range
+  const vec3 white = vec3(128.167f, 101.632f, 97.037f);
+  return (xyzToRgb * xyz) / white;
+}
+
+// Multiplies the throughput of a path by the color of the surface it hit,
+// which the material wrote to `pld`. With SPECTRAL, a dispersing material
+// only got the direction right for the hero wavelength, so the path drops
+// the others: all 4 become the hero, which also weights it by 4.
+void multiplySurfaceColor(INOUT(vec4) throughput, INOUT(vec4) wavelengths, PassableInfo pld, bool spectral)
+{
+  if(!spectral)
+  {
+    throughput *= vec4(pld.color, 1.0f);
+    return;
+  }
+  if(pld.dispersed)
+  {
+    throughput  = vec4(throughput.x);
+    wavelengths = vec4(wavelengths.x);
+  }
+  throughput *= rgbToSpectrum(pld.color, wavelengths);
+}
+
+// The linear RGB color a path with `throughput` brings back from the sky of `job`.
+vec3 skyRadiance(JobParams job, vec3 rayDirection, vec4 throughput, vec4 wavelengths, bool spectral)
+{
+  const vec3 sky = skyColor(job, rayDirection);
+  if(!spectral)
+  {
+    return vec3(throughput) * sky;
+  }
+  return spectrumToRgb(throughput * rgbToSpectrum(sky, wavelengths), wavelengths);
+}
+
+#ifdef __cplusplus
+}  // namespace shading
+#endif  // #ifdef __cplusplus
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_TRACING_COMMON_H
@@ -0,0 +1,92 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Common file of the passes that trace each segment with --reorder sort:
+// - generate.comp.glsl starts the paths of a wave at the camera;
+// - then, for each segment, classify.comp.glsl finds the hit of each path
+//   with a ray query and counts the paths per material, scatter.comp.glsl
+//   sorts the paths by material, and raytrace_sorted.rgen.glsl shades them
+//   in that order, so that neighboring invocations run the same closest-hit
+//   shader;
+// - resolve*.comp.glsl sums the finished paths into the tile.
+// Including files enable GL_EXT_ray_tracing or GL_EXT_ray_query first.
+#ifndef VK_MINI_PATH_TRACER_WAVEFRONT_COMMON_H
+#define VK_MINI_PATH_TRACER_WAVEFRONT_COMMON_H
+
+#extension GL_EXT_scalar_block_layout : require
+#include "../common.h"
+#include "shaderCommon.h"
+
+layout(binding = BINDING_TLAS, set = 0) uniform accelerationStructureEXT tlas[NUM_TLAS_SLOTS];
+
+layout(binding = BINDING_SUBMIT_PARAMS, set = 0, scalar) readonly buffer SubmitParamsBuffer
+{
+  SubmitParams submitParams[];
+};
+
+// The camera and sky of each job; submitParams[...].job selects one.
+layout(binding = BINDING_JOBS, set = 0) uniform JobsBuffer
+{
+  JobParams jobs[MAX_JOBS];
+};
+
+layout(binding = BINDING_PATHS, set = 0, scalar) buffer PathsBuffer
+{
+  PathState paths[];
+};
+
+// With SPECTRAL, the 4 wavelengths of `path`. A path stores only its hero
+// wavelength, since the other 3 follow from it, and negates it once it
+// disperses; then all 4 are the hero (see multiplySurfaceColor).
+vec4 loadPathWavelengths(PathState path)
+{
+  return (path.wavelength < 0.0) ? vec4(-path.wavelength) : getHeroWavelengths(path.wavelength);
+}
+
+// The inverse of loadPathWavelengths. Only a dispersed path has equal wavelengths.
+void storePathWavelengths(inout PathState path, vec4 wavelengths)
+{
+  path.wavelength = (wavelengths.y == wavelengths.x) ? -wavelengths.x : wavelengths.x;
+}
+
+layout(binding = BINDING_SORT_KEYS, set = 0, scalar) buffer SortKeysBuffer
+{
+  uint sortKeys[];
+};
+
+layout(binding = BINDING_SORTED_PATHS, set = 0, scalar) buffer SortedPathsBuffer
+{
+  uint sortedPaths[];
+};
+
+layout(binding = BINDING_SORT_COUNTERS, set = 0, scalar) buffer SortCountersBuffer
+{
+  SortCounters sortCounters;
+};
+
+layout(binding = BINDING_PIXEL_SUMS, set = 0, scalar) buffer PixelSumsBuffer
+{
+  vec3 pixelSums[];
+};
+
+// The same specialization constants as the megakernel ray generation shader.
+layout(constant_id = SPEC_CONSTANT_NUM_SAMPLES) const int NUM_SAMPLES = 64;
+layout(constant_id = SPEC_CONSTANT_MAX_SEGMENTS) const int MAX_SEGMENTS = 32;
+
+layout(push_constant) uniform PushConsts
+{
+  PushConstants pushConstants;
+};
+
+// The index of the first path with `key` in sortedPaths.
+uint firstSortedPath(uint key)
+{
+  uint first = 0;
+  for(uint k = 0; k < key; k++)
+  {
+    first += sortCounters.counts[k];
+  }
+  return first;
+}
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_WAVEFRONT_COMMON_H
@@ -0,0 +1,220 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "tcp_socket.hpp"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <cerrno>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef _WIN32
+using NativeSocket = SOCKET;
+#else
+using NativeSocket = int;
+#endif
+NativeSocket native(TcpSocket socket)
+{
+  return static_cast<NativeSocket>(socket);
+}
+
+}  // namespace
+
+void closeSocket(TcpSocket socket)
+{
+#ifdef _WIN32
+  closesocket(native(socket));
+#else
+  close(native(socket));
+#endif
+}
+
+void shutdownSocket(TcpSocket socket)
+{
+#ifdef _WIN32
+  shutdown(native(socket), SD_BOTH);
+#else
+  shutdown(native(socket), SHUT_RDWR);
+#endif
+}
+
+bool initSockets()
+{
+#ifdef _WIN32
+  static const bool initialized = []() {
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+  }();
+  return initialized;
+#else
+  return true;
+#endif
+}
+
+void setNoDelay(TcpSocket socket)
+{
+  // Requests and units are small; send them right away
+  const int enable = 1;
+  setsockopt(native(socket), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+}
+
+void setReceiveTimeout(TcpSocket socket, uint32_t seconds)
+{
+#ifdef _WIN32
+  const DWORD milliseconds = seconds * 1000;
+  setsockopt(native(socket), SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&milliseconds), sizeof(milliseconds));
+#else
+  const timeval timeout{.tv_sec = time_t(seconds), .tv_usec = 0};
+  setsockopt(native(socket), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#endif
+}
+
+bool sendAll(TcpSocket socket, const void* data, size_t size)
+{
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;  // Report a closed connection as an error instead of raising SIGPIPE
+#else
+  const int flags = 0;
+#endif
+  const char* bytes = static_cast<const char*>(data);
+  while(size > 0)
+  {
+    const auto sent = ::send(native(socket), bytes, int(std::min<size_t>(size, 1u << 30)), flags);
+    if(sent <= 0)
+    {
+      return false;
+    }
+    bytes += sent;
+    size -= size_t(sent);
+  }
+  return true;
+}
+
+ReceiveResult receiveAll(TcpSocket socket, void* data, size_t size)
+{
+  char*  bytes    = static_cast<char*>(data);
+  size_t received = 0;
+  while(received < size)
+  {
+    const auto count = recv(native(socket), bytes + received, int(std::min<size_t>(size - received, 1u << 30)), 0);
+    if(count > 0)
+    {
+      received += size_t(count);
+      continue;
+    }
+    if(count < 0)
+    {
+#ifdef _WIN32
+      const bool timedOut = (WSAGetLastError() == WSAETIMEDOUT);
+#else
+      if(errno == EINTR)
+      {
+        continue;
+      }
+      const bool timedOut = (errno == EAGAIN || errno == EWOULDBLOCK);
+#endif
+      // A message that stops halfway is as good as a closed connection
+      if(timedOut && received == 0)
+      {
+        return ReceiveResult::eTimeout;
+      }
+    }
+    return ReceiveResult::eClosed;
+  }
+  return ReceiveResult::eOk;
+}
+
+TcpSocket listenOn(uint16_t port, bool loopbackOnly)
+{
+  const NativeSocket listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if(TcpSocket(listener) == INVALID_TCP_SOCKET)
+  {
+    return INVALID_TCP_SOCKET;
+  }
+  const int enable = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&enable), sizeof(enable));
+  sockaddr_in address{};
+  address.sin_family      = AF_INET;
+  address.sin_addr.s_addr = htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+  address.sin_port        = htons(port);
+  if(bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+  {
+    closeSocket(TcpSocket(listener));
+    return INVALID_TCP_SOCKET;
+  }
+  return TcpSocket(listener);
+}
+
+TcpSocket acceptFor(TcpSocket listener, uint32_t milliseconds, std::string& peerName)
+{
+  fd_set readable;
+  FD_ZERO(&readable);
+  FD_SET(native(listener), &readable);
+  timeval timeout{.tv_sec = 0, .tv_usec = int(milliseconds) * 1000};
+  if(select(int(native(listener)) + 1, &readable, nullptr, nullptr, &timeout) <= 0)
+  {
+    return INVALID_TCP_SOCKET;
+  }
+  sockaddr_storage address{};
+  socklen_t        addressSize = sizeof(address);
+  const TcpSocket  connection  = TcpSocket(accept(native(listener), reinterpret_cast<sockaddr*>(&address), &addressSize));
+  if(connection == INVALID_TCP_SOCKET)
+  {
+    return INVALID_TCP_SOCKET;
+  }
+  char host[NI_MAXHOST] = "?", service[NI_MAXSERV] = "?";
+  getnameinfo(reinterpret_cast<const sockaddr*>(&address), addressSize, host, sizeof(host), service, sizeof(service),
+              NI_NUMERICHOST | NI_NUMERICSERV);
+  peerName = std::string(host) + ":" + service;
+  return connection;
+}
+
+TcpSocket connectTo(const std::string& address)
+{
+  const size_t colon = address.find_last_of(':');
+  if(colon == std::string::npos)
+  {
+    return INVALID_TCP_SOCKET;
+  }
+  const std::string host = address.substr(0, colon);
+  const std::string port = address.substr(colon + 1);
+  addrinfo          hints{};
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  addrinfo* results = nullptr;
+  if(getaddrinfo(host.c_str(), port.c_str(), &hints, &results) != 0)
+  {
+    return INVALID_TCP_SOCKET;
+  }
+  TcpSocket connection = INVALID_TCP_SOCKET;
+  for(const addrinfo* result = results; result != nullptr && connection == INVALID_TCP_SOCKET; result = result->ai_next)
+  {
+    connection = TcpSocket(socket(result->ai_family, result->ai_socktype, result->ai_protocol));
+    if(connection != INVALID_TCP_SOCKET && ::connect(native(connection), result->ai_addr, int(result->ai_addrlen)) != 0)
+    {
+      closeSocket(connection);
+      connection = INVALID_TCP_SOCKET;
+    }
+  }
+  freeaddrinfo(results);
+  return connection;
+}
@@ -0,0 +1,43 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Blocking TCP sockets on Windows (Winsock) and POSIX systems, for the
+// render farm (render_farm.hpp) and the render server (render_server.hpp).
+// Call initSockets() before anything else.
+#ifndef VK_MINI_PATH_TRACER_TCP_SOCKET_HPP
+#define VK_MINI_PATH_TRACER_TCP_SOCKET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A TCP socket: a SOCKET on Windows, a file descriptor elsewhere
+using TcpSocket = intptr_t;
+// INVALID_SOCKET is ~0 on Windows, which is -1 as a TcpSocket
+const TcpSocket INVALID_TCP_SOCKET = -1;
+
+bool initSockets();
+void closeSocket(TcpSocket socket);
+// Makes receives (e.g. from a blocked recv()) on `socket` fail
+void shutdownSocket(TcpSocket socket);
+void setNoDelay(TcpSocket socket);
+void setReceiveTimeout(TcpSocket socket, uint32_t seconds);
+
+bool sendAll(TcpSocket socket, const void* data, size_t size);
+
+enum class ReceiveResult
+{
+  eOk,
+  eClosed,   // Or failed
+  eTimeout,  // Nothing was received
+};
+ReceiveResult receiveAll(TcpSocket socket, void* data, size_t size);
+
+// Listens on `port` of all interfaces, or only of the loopback interface
+TcpSocket listenOn(uint16_t port, bool loopbackOnly);
+// Accepts a connection if one comes in within `milliseconds`
+TcpSocket acceptFor(TcpSocket listener, uint32_t milliseconds, std::string& peerName);
+// Connects to <host>:<port>
+TcpSocket connectTo(const std::string& address);
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_TCP_SOCKET_HPP
@@ -0,0 +1,106 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "tile_scheduler.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+TileScheduler::TileScheduler(OutputWriter& outputWriter, uint32_t numDevices, uint32_t tilesPerFrame, uint32_t numFrames,
+                             uint32_t warmupFrames, uint32_t batchesPerTile, FrameCallback beginFrame, FrameCallback endFrame)
+    : m_outputWriter(outputWriter)
+    , m_tilesPerFrame(tilesPerFrame)
+    , m_tileCount(tilesPerFrame * numFrames)
+    , m_warmupTiles(tilesPerFrame * warmupFrames)
+    , m_batchesPerTile(batchesPerTile)
+    , m_beginFrame(std::move(beginFrame))
+    , m_endFrame(std::move(endFrame))
+    , m_devices(numDevices)
+{
+}
+
+void TileScheduler::waitUntilAllReady()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_readyDevices++;
+  if(m_readyDevices == m_devices.size())
+  {
+    m_start = std::chrono::steady_clock::now();
+    m_allReady.notify_all();
+  }
+  m_allReady.wait(lock, [&] { return m_readyDevices == m_devices.size(); });
+}
+
+bool TileScheduler::next(uint32_t device, WorkUnit& unit)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Device& self = m_devices[device];
+  if(m_nextTile == m_tileCount)
+  {
+    self.active = false;
+    return false;
+  }
+
+  // Whether the other devices that are still rendering would render all of
+  // the remaining tiles before this one renders another. They take at least
+  // as long as the fastest of them takes for one tile.
+  const double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+  if(self.tiles > 0 && elapsedMs > 0.0)
+  {
+    const double selfMs          = elapsedMs / self.tiles;
+    double       otherTilesPerMs = 0.0;
+    double       fastestOtherMs  = 0.0;
+    for(const Device& other : m_devices)
+    {
+      if(&other == &self || !other.active || other.tiles == 0)
+      {
+        continue;
+      }
+      const double otherMs = elapsedMs / other.tiles;
+      otherTilesPerMs += 1.0 / otherMs;
+      fastestOtherMs = (fastestOtherMs == 0.0) ? otherMs : std::min(fastestOtherMs, otherMs);
+    }
+    if(otherTilesPerMs > 0.0)
+    {
+      const double othersMs = std::max(double(m_tileCount - m_nextTile) / otherTilesPerMs, fastestOtherMs);
+      if(othersMs < selfMs)
+      {
+        self.active = false;
+        return false;
+      }
+    }
+  }
+
+  const uint32_t tile = m_nextTile++;
+  unit                = {.id         = tile,
+                         .frame      = tile / m_tilesPerFrame,
+                         .tile       = tile % m_tilesPerFrame,
+                         .firstBatch = 0,
+                         .batchCount = m_batchesPerTile};
+  self.tiles++;
+  if(tile == m_warmupTiles)
+  {
+    m_timedStart = std::chrono::steady_clock::now();
+  }
+  return true;
+}
+
+void TileScheduler::submit(const WorkUnit& unit, OutputWriter::Tile&& pixels)
+{
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  assert(unit.id >= m_nextWrite && m_queued.count(unit.id) == 0);
+  m_queued.emplace(unit.id, std::move(pixels));
+  for(auto it = m_queued.begin(); it != m_queued.end() && it->first == m_nextWrite; it = m_queued.erase(it))
+  {
+    const uint32_t frame = m_nextWrite / m_tilesPerFrame;
+    if(m_nextWrite % m_tilesPerFrame == 0)
+    {
+      m_beginFrame(frame);
+    }
+    m_outputWriter.writeTile(std::move(it->second));
+    if(m_nextWrite % m_tilesPerFrame == m_tilesPerFrame - 1)
+    {
+      m_endFrame(frame);
+    }
+    m_nextWrite++;
+  }
+}
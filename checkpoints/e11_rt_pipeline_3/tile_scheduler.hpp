@@ -0,0 +1,86 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Splits the tiles of all frames between the devices rendering them, and
+// hands the finished tiles to the output writer in order.
+// Each device's thread takes the next tile whenever it has room to submit
+// one, so a faster device takes more tiles; over a run, each device renders a
+// share of the tiles proportional to its throughput. Tiles are counted over
+// all frames, so a device that's done with its last tile of a frame starts on
+// the next frame instead of waiting for the others.
+// The last tiles of the run are balanced with the measured throughput of
+// each device (tiles it took by the time since rendering started): a device
+// stops taking tiles once the other devices would render all of the
+// remaining ones before it would render one.
+// Devices finish their tiles out of order, but the output writer needs the
+// rows of each frame from top to bottom, so tiles are queued until all the
+// tiles before them have been submitted. A device keeps rendering while its
+// tiles are queued, until its readback buffers run out.
+#ifndef VK_MINI_PATH_TRACER_TILE_SCHEDULER_HPP
+#define VK_MINI_PATH_TRACER_TILE_SCHEDULER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "output_writer.hpp"
+#include "work_source.hpp"
+
+// Work units are whole tiles, with `batchesPerTile` sample batches each; a
+// unit's id is its tile counted over all frames.
+class TileScheduler : public WorkSource
+{
+public:
+  // Called before the first and after the last tile of each frame is handed
+  // to the output writer, to begin and end the frame there
+  using FrameCallback = std::function<void(uint32_t frame)>;
+
+  TileScheduler(OutputWriter& outputWriter, uint32_t numDevices, uint32_t tilesPerFrame, uint32_t numFrames,
+                uint32_t warmupFrames, uint32_t batchesPerTile, FrameCallback beginFrame, FrameCallback endFrame);
+
+  void waitUntilAllReady() override;
+  bool next(uint32_t device, WorkUnit& unit) override;
+  // Hands the tile to the output writer once the tiles before it have been
+  void submit(const WorkUnit& unit, OutputWriter::Tile&& pixels) override;
+
+  // When the first tile after the warmup frames was taken
+  std::chrono::steady_clock::time_point getTimedStart() const { return m_timedStart; }
+  // Tiles `device` took; call once all devices are done
+  uint32_t getTileCount(uint32_t device) const { return m_devices[device].tiles; }
+
+private:
+  struct Device
+  {
+    uint32_t tiles  = 0;  // Tiles it took
+    bool     active = true;
+  };
+
+  OutputWriter&  m_outputWriter;
+  const uint32_t m_tilesPerFrame;
+  const uint32_t m_tileCount;  // Over all frames
+  const uint32_t m_warmupTiles;
+  const uint32_t m_batchesPerTile;
+  FrameCallback  m_beginFrame;
+  FrameCallback  m_endFrame;
+
+  // Handing out tiles
+  std::mutex                            m_mutex;
+  std::condition_variable               m_allReady;
+  uint32_t                              m_readyDevices = 0;
+  std::vector<Device>                   m_devices;
+  uint32_t                              m_nextTile = 0;
+  std::chrono::steady_clock::time_point m_start;  // When all devices were ready
+  std::chrono::steady_clock::time_point m_timedStart;
+
+  // Writing out tiles in order; a separate lock, since writing can block
+  // while the output writer's queue is full
+  std::mutex                             m_writeMutex;
+  std::map<uint32_t, OutputWriter::Tile> m_queued;  // Submitted tiles after the first one that wasn't
+  uint32_t                               m_nextWrite = 0;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_TILE_SCHEDULER_HPP
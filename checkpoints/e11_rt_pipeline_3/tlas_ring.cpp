@@ -0,0 +1,172 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "tlas_ring.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+
+#include <nvvk/buffers_vk.hpp>  // For nvvk::getBufferDeviceAddress
+#include <nvvk/error_vk.hpp>
+
+void TlasRing::init(nvvk::Context&              context,
+                    const DeviceFunctions&      functions,
+                    nvvk::ResourceAllocator&    allocator,
+                    const nvvk::Context::Queue& buildQueue,
+                    uint32_t                    traceQueueFamily,
+                    uint32_t                    numSlots,
+                    uint32_t                    numInstances)
+{
+  m_device       = context;
+  m_functions    = &functions;
+  m_allocator    = &allocator;
+  m_queue        = buildQueue.queue;
+  m_async        = (buildQueue.queue != context.m_queueGCT.queue);
+  m_numInstances = numInstances;
+
+  const VkCommandPoolCreateInfo poolInfo{.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                                         .flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                                         .queueFamilyIndex = buildQueue.familyIndex};
+  NVVK_CHECK(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_cmdPool));
+  VkSemaphoreTypeCreateInfo semaphoreType{.sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+                                          .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+                                          .initialValue  = 0};
+  const VkSemaphoreCreateInfo semaphoreInfo{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, .pNext = &semaphoreType};
+  NVVK_CHECK(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_semaphore));
+  m_lastValue = 0;
+
+  // All slots have the same size, for `numInstances` instances
+  VkAccelerationStructureGeometryKHR geometry{.sType        = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+                                              .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+                                              .geometry = {.instances = {.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR}}};
+  const VkAccelerationStructureBuildGeometryInfoKHR buildInfo{.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+                                                              .type  = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+                                                              .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+                                                              .mode  = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+                                                              .geometryCount = 1,
+                                                              .pGeometries   = &geometry};
+  VkAccelerationStructureBuildSizesInfoKHR sizeInfo{.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+  functions.getAccelerationStructureBuildSizesKHR(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo,
+                                                  &m_numInstances, &sizeInfo);
+  VkPhysicalDeviceAccelerationStructurePropertiesKHR asProperties{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR};
+  VkPhysicalDeviceProperties2 properties{.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, .pNext = &asProperties};
+  vkGetPhysicalDeviceProperties2(context.m_physicalDevice, &properties);
+  const VkDeviceSize scratchAlignment = asProperties.minAccelerationStructureScratchOffsetAlignment;
+
+  // The TLASes are written on the build queue and read on the trace queue
+  const std::array<uint32_t, 2> queueFamilies{buildQueue.familyIndex, traceQueueFamily};
+  const bool                    concurrent = (buildQueue.familyIndex != traceQueueFamily);
+
+  m_slots.resize(numSlots);
+  for(Slot& slot : m_slots)
+  {
+    const VkBufferCreateInfo tlasBufferInfo{
+        .sType                 = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size                  = sizeInfo.accelerationStructureSize,
+        .usage                 = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        .sharingMode           = concurrent ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = concurrent ? static_cast<uint32_t>(queueFamilies.size()) : 0u,
+        .pQueueFamilyIndices   = queueFamilies.data()};
+    slot.tlas.buffer = allocator.createBuffer(tlasBufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    const VkAccelerationStructureCreateInfoKHR createInfo{.sType  = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+                                                          .buffer = slot.tlas.buffer.buffer,
+                                                          .size   = sizeInfo.accelerationStructureSize,
+                                                          .type   = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR};
+    NVVK_CHECK(functions.createAccelerationStructureKHR(m_device, &createInfo, nullptr, &slot.tlas.accel));
+
+    slot.instances = allocator.createBuffer(std::max<VkDeviceSize>(numInstances * sizeof(VkAccelerationStructureInstanceKHR), 1),
+                                            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                                                | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    slot.mappedInstances = static_cast<VkAccelerationStructureInstanceKHR*>(allocator.map(slot.instances));
+    slot.scratch = allocator.createBuffer(sizeInfo.buildScratchSize + scratchAlignment,
+                                          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    const VkDeviceAddress scratchBase = nvvk::getBufferDeviceAddress(m_device, slot.scratch.buffer);
+    slot.scratchAddress               = (scratchBase + scratchAlignment - 1) / scratchAlignment * scratchAlignment;
+
+    const VkCommandBufferAllocateInfo allocInfo{.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                                .commandPool        = m_cmdPool,
+                                                .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                                .commandBufferCount = 1};
+    NVVK_CHECK(vkAllocateCommandBuffers(m_device, &allocInfo, &slot.cmdBuffer));
+    slot.buildValue = 0;
+  }
+}
+
+void TlasRing::deinit()
+{
+  if(m_device == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  wait(m_lastValue);
+  for(Slot& slot : m_slots)
+  {
+    m_allocator->unmap(slot.instances);
+    m_allocator->destroy(slot.instances);
+    m_allocator->destroy(slot.scratch);
+    m_functions->destroyAccelerationStructureKHR(m_device, slot.tlas.accel, nullptr);
+    m_allocator->destroy(slot.tlas.buffer);
+  }
+  m_slots.clear();
+  vkDestroySemaphore(m_device, m_semaphore, nullptr);
+  vkDestroyCommandPool(m_device, m_cmdPool, nullptr);  // Also frees the command buffers
+  m_device = VK_NULL_HANDLE;
+}
+
+uint64_t TlasRing::build(uint32_t slotIndex, const std::vector<VkAccelerationStructureInstanceKHR>& instances)
+{
+  assert(instances.size() == m_numInstances);
+  Slot& slot = m_slots[slotIndex];
+  // Its last build must be done with the command buffer and the instances
+  wait(slot.buildValue);
+  // Host writes before the submission are visible to it
+  memcpy(slot.mappedInstances, instances.data(), instances.size() * sizeof(VkAccelerationStructureInstanceKHR));
+
+  const VkCommandBufferBeginInfo beginInfo{.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                                           .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+  NVVK_CHECK(vkBeginCommandBuffer(slot.cmdBuffer, &beginInfo));
+  VkAccelerationStructureGeometryKHR geometry{
+      .sType        = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+      .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+      .geometry     = {.instances = {.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+                                     .arrayOfPointers = VK_FALSE,
+                                     .data = {.deviceAddress = nvvk::getBufferDeviceAddress(m_device, slot.instances.buffer)}}}};
+  const VkAccelerationStructureBuildGeometryInfoKHR buildInfo{.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+                                                              .type  = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+                                                              .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+                                                              .mode  = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+                                                              .dstAccelerationStructure = slot.tlas.accel,
+                                                              .geometryCount            = 1,
+                                                              .pGeometries              = &geometry,
+                                                              .scratchData = {.deviceAddress = slot.scratchAddress}};
+  const VkAccelerationStructureBuildRangeInfoKHR  range{.primitiveCount = m_numInstances};
+  const VkAccelerationStructureBuildRangeInfoKHR* ranges = &range;
+  m_functions->cmdBuildAccelerationStructuresKHR(slot.cmdBuffer, 1, &buildInfo, &ranges);
+  NVVK_CHECK(vkEndCommandBuffer(slot.cmdBuffer));
+
+  // The semaphore's signal makes the build visible to the submissions that wait on it
+  slot.buildValue = ++m_lastValue;
+  const VkTimelineSemaphoreSubmitInfo timelineInfo{.sType                     = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+                                                   .signalSemaphoreValueCount = 1,
+                                                   .pSignalSemaphoreValues    = &slot.buildValue};
+  const VkSubmitInfo submitInfo{.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                                .pNext                = &timelineInfo,
+                                .commandBufferCount   = 1,
+                                .pCommandBuffers      = &slot.cmdBuffer,
+                                .signalSemaphoreCount = 1,
+                                .pSignalSemaphores    = &m_semaphore};
+  NVVK_CHECK(vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE));
+  return slot.buildValue;
+}
+
+void TlasRing::wait(uint64_t value)
+{
+  const VkSemaphoreWaitInfo waitInfo{.sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                                     .semaphoreCount = 1,
+                                     .pSemaphores    = &m_semaphore,
+                                     .pValues        = &value};
+  NVVK_CHECK(vkWaitSemaphores(m_device, &waitInfo, UINT64_MAX));
+}
@@ -0,0 +1,76 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// The TLASes of the frames of a sequence (--sequence), in a ring of slots
+// per device. Frame N+1's TLAS is built on the async compute queue, if the
+// device has one, while frame N traces on the main queue and frame N-1 is
+// read back and encoded on the output writer's thread.
+// Each build signals the ring's timeline semaphore with the build's number,
+// and the trace submissions of a frame wait on the number of its TLAS's
+// build. The TLAS buffers are shared concurrently by the build and trace
+// queue families, so they don't need ownership transfers; the instances and
+// scratch memory of each slot are only used by its builds.
+#ifndef VK_MINI_PATH_TRACER_TLAS_RING_HPP
+#define VK_MINI_PATH_TRACER_TLAS_RING_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <nvvk/context_vk.hpp>
+#include <nvvk/resourceallocator_vk.hpp>
+
+#include "device_functions.hpp"
+
+class TlasRing
+{
+public:
+  // Makes `numSlots` TLASes of `numInstances` instances each, built on
+  // `buildQueue` and traced on queue family `traceQueueFamily`. `functions`
+  // are the context's, and must outlive the ring.
+  void init(nvvk::Context&              context,
+            const DeviceFunctions&      functions,
+            nvvk::ResourceAllocator&    allocator,
+            const nvvk::Context::Queue& buildQueue,
+            uint32_t                    traceQueueFamily,
+            uint32_t                    numSlots,
+            uint32_t                    numInstances);
+  // Waits for the builds in flight, and destroys everything.
+  void deinit();
+
+  // Submits a build of the TLAS of `slot` from `instances`. The caller makes
+  // sure that no submission that traces the slot is still running. Returns
+  // the value the semaphore has once the build is done.
+  uint64_t build(uint32_t slot, const std::vector<VkAccelerationStructureInstanceKHR>& instances);
+  // Blocks until the semaphore has `value`
+  void wait(uint64_t value);
+
+  VkAccelerationStructureKHR getTlas(uint32_t slot) const { return m_slots[slot].tlas.accel; }
+  VkSemaphore                getSemaphore() const { return m_semaphore; }
+  uint32_t                   getSlotCount() const { return static_cast<uint32_t>(m_slots.size()); }
+  bool                       isAsync() const { return m_async; }
+
+private:
+  struct Slot
+  {
+    nvvk::AccelKHR                      tlas;
+    nvvk::Buffer                        instances;  // Host visible, written right before each build
+    VkAccelerationStructureInstanceKHR* mappedInstances = nullptr;
+    nvvk::Buffer                        scratch;
+    VkDeviceAddress                     scratchAddress = 0;  // Aligned for builds
+    VkCommandBuffer                     cmdBuffer      = VK_NULL_HANDLE;
+    uint64_t                            buildValue     = 0;  // Of its last build
+  };
+
+  VkDevice                 m_device       = VK_NULL_HANDLE;
+  const DeviceFunctions*   m_functions    = nullptr;
+  nvvk::ResourceAllocator* m_allocator    = nullptr;
+  VkQueue                  m_queue        = VK_NULL_HANDLE;
+  bool                     m_async        = false;  // Whether builds run on their own queue
+  VkCommandPool            m_cmdPool      = VK_NULL_HANDLE;
+  VkSemaphore              m_semaphore    = VK_NULL_HANDLE;  // Timeline
+  uint64_t                 m_lastValue    = 0;
+  uint32_t                 m_numInstances = 0;
+  std::vector<Slot>        m_slots;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_TLAS_RING_HPP
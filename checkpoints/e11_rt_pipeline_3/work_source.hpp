@@ -0,0 +1,49 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Where the devices of a renderer get their work from, and hand the finished
+// tiles to: the TileScheduler when rendering on this machine, the FarmWorker
+// when rendering units of a render farm's coordinator (see render_farm.hpp),
+// or the RenderServer when rendering requests (see render_server.hpp).
+// Each device's thread calls next() and submit() on its own, so both must be
+// thread-safe.
+#ifndef VK_MINI_PATH_TRACER_WORK_SOURCE_HPP
+#define VK_MINI_PATH_TRACER_WORK_SOURCE_HPP
+
+#include <cstdint>
+
+#include "output_writer.hpp"
+
+struct JobParams;
+
+// Sample batches [firstBatch, firstBatch + batchCount) of tile `tile` (in
+// row-major order) of frame `frame`. batchCount is a multiple of the batches
+// of one submission.
+struct WorkUnit
+{
+  uint32_t id         = 0;  // Unique over the run
+  uint32_t frame      = 0;
+  uint32_t tile       = 0;
+  uint32_t firstBatch = 0;
+  uint32_t batchCount = 0;
+};
+
+class WorkSource
+{
+public:
+  virtual ~WorkSource() = default;
+
+  // Blocks until all devices called it, so that they start rendering together
+  virtual void waitUntilAllReady() = 0;
+  // Gets the next unit for `device`. Returns false once `device` should stop;
+  // it must submit all the units it got.
+  virtual bool next(uint32_t device, WorkUnit& unit) = 0;
+  // Hands over the average of the unit's sample batches; see OutputWriter::Tile
+  virtual void submit(const WorkUnit& unit, OutputWriter::Tile&& pixels) = 0;
+  // The camera and sky of the units of `frame`, if the source sets them;
+  // otherwise, they're those of the scene's job the frame renders (see
+  // RunConfig in main.cpp). Valid until the frame's units are submitted.
+  virtual const JobParams* getJobParams(uint32_t frame) { return nullptr; }
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_WORK_SOURCE_HPP
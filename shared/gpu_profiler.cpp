@@ -0,0 +1,259 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "gpu_profiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <nvh/nvprint.hpp>
+#include <nvvk/error_vk.hpp>
+
+namespace {
+// Results are written in the order of their bits
+constexpr VkQueryPipelineStatisticFlags k_statistics =
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+constexpr uint32_t k_statisticCount = 2;
+
+// Weight of the newest measurement in Result::averageMs
+constexpr double k_smoothing = 0.1;
+}  // namespace
+
+void GpuProfiler::init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t numSets, uint32_t maxSectionsPerSet)
+{
+  m_device      = device;
+  m_maxSections = maxSectionsPerSet;
+  m_sets.assign(std::max(numSets, 1u), Set{});
+
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+  const uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+  if(validBits == 0)
+  {
+    LOGW("The queue family has no timestamps; only host times are profiled\n");
+    return;
+  }
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  m_timestampPeriod = properties.limits.timestampPeriod;
+  m_timestampMask   = validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+
+  const uint32_t              numQueries = static_cast<uint32_t>(m_sets.size()) * m_maxSections;
+  const VkQueryPoolCreateInfo timestampPoolInfo{.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                                                .queryType  = VK_QUERY_TYPE_TIMESTAMP,
+                                                .queryCount = 2 * numQueries};
+  NVVK_CHECK(vkCreateQueryPool(m_device, &timestampPoolInfo, nullptr, &m_timestampPool));
+
+  // The context enables all the core features the device has
+  VkPhysicalDeviceFeatures features;
+  vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+  if(features.pipelineStatisticsQuery)
+  {
+    const VkQueryPoolCreateInfo statisticsPoolInfo{.sType              = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                                                   .queryType          = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+                                                   .queryCount         = numQueries,
+                                                   .pipelineStatistics = k_statistics};
+    NVVK_CHECK(vkCreateQueryPool(m_device, &statisticsPoolInfo, nullptr, &m_statisticsPool));
+  }
+}
+
+void GpuProfiler::deinit()
+{
+  if(m_statisticsPool != VK_NULL_HANDLE)
+  {
+    vkDestroyQueryPool(m_device, m_statisticsPool, nullptr);
+    m_statisticsPool = VK_NULL_HANDLE;
+  }
+  if(m_timestampPool != VK_NULL_HANDLE)
+  {
+    vkDestroyQueryPool(m_device, m_timestampPool, nullptr);
+    m_timestampPool = VK_NULL_HANDLE;
+  }
+  m_sets.clear();
+  m_device = VK_NULL_HANDLE;
+}
+
+void GpuProfiler::cmdBeginSet(VkCommandBuffer cmdBuf, uint32_t set)
+{
+  m_recordingSet = set % static_cast<uint32_t>(m_sets.size());
+  m_sets[m_recordingSet].sections.clear();
+  if(m_timestampPool == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  vkCmdResetQueryPool(cmdBuf, m_timestampPool, 2 * m_recordingSet * m_maxSections, 2 * m_maxSections);
+  if(m_statisticsPool != VK_NULL_HANDLE)
+  {
+    vkCmdResetQueryPool(cmdBuf, m_statisticsPool, m_recordingSet * m_maxSections, m_maxSections);
+  }
+}
+
+uint32_t GpuProfiler::cmdBeginSection(VkCommandBuffer cmdBuf, const char* name, bool statistics)
+{
+  std::vector<Section>& sections = m_sets[m_recordingSet].sections;
+  if(m_timestampPool == VK_NULL_HANDLE || sections.size() >= m_maxSections)
+  {
+    if(m_timestampPool != VK_NULL_HANDLE && !m_warnedFull)
+    {
+      LOGW("More than %u profiled sections in a command buffer; the others aren't measured\n", m_maxSections);
+      m_warnedFull = true;
+    }
+    return ~0u;
+  }
+  const uint32_t section = static_cast<uint32_t>(sections.size());
+  const uint32_t query   = m_recordingSet * m_maxSections + section;
+  sections.push_back({name, statistics && m_statisticsPool != VK_NULL_HANDLE});
+  vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_timestampPool, 2 * query);
+  if(sections.back().statistics)
+  {
+    vkCmdBeginQuery(cmdBuf, m_statisticsPool, query, 0);
+  }
+  return section;
+}
+
+void GpuProfiler::cmdEndSection(VkCommandBuffer cmdBuf, uint32_t section)
+{
+  if(section == ~0u)
+  {
+    return;
+  }
+  const uint32_t query = m_recordingSet * m_maxSections + section;
+  if(m_sets[m_recordingSet].sections[section].statistics)
+  {
+    vkCmdEndQuery(cmdBuf, m_statisticsPool, query);
+  }
+  vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_timestampPool, 2 * query + 1);
+}
+
+bool GpuProfiler::collect(uint32_t set)
+{
+  set = set % static_cast<uint32_t>(m_sets.size());
+  const std::vector<Section>& sections = m_sets[set].sections;
+  if(m_timestampPool == VK_NULL_HANDLE || sections.empty())
+  {
+    return false;
+  }
+  const uint32_t count      = static_cast<uint32_t>(sections.size());
+  const uint32_t firstQuery = set * m_maxSections;
+
+  // Without VK_QUERY_RESULT_WAIT_BIT; the command buffer has finished
+  std::vector<uint64_t> timestamps(2 * count);
+  if(vkGetQueryPoolResults(m_device, m_timestampPool, 2 * firstQuery, 2 * count, timestamps.size() * sizeof(uint64_t),
+                           timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT)
+     != VK_SUCCESS)
+  {
+    return false;
+  }
+  std::vector<uint64_t> statistics(k_statisticCount * count, 0);
+  if(m_statisticsPool != VK_NULL_HANDLE)
+  {
+    for(uint32_t i = 0; i < count; i++)
+    {
+      if(sections[i].statistics)
+      {
+        vkGetQueryPoolResults(m_device, m_statisticsPool, firstQuery + i, 1, k_statisticCount * sizeof(uint64_t),
+                              &statistics[k_statisticCount * i], k_statisticCount * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+      }
+    }
+  }
+
+  for(uint32_t i = 0; i < count; i++)
+  {
+    const uint64_t ticks  = (timestamps[2 * i + 1] - timestamps[2 * i]) & m_timestampMask;
+    Result&        result = getResult(sections[i].name, true);
+    addTime(result, static_cast<double>(ticks) * m_timestampPeriod * 1e-6);
+    if(sections[i].statistics)
+    {
+      result.hasStatistics = true;
+      result.fragmentInvocations += statistics[k_statisticCount * i];
+      result.computeInvocations += statistics[k_statisticCount * i + 1];
+    }
+  }
+  return true;
+}
+
+void GpuProfiler::addHostTime(const char* name, double ms)
+{
+  addTime(getResult(name, false), ms);
+}
+
+void GpuProfiler::clearResults()
+{
+  m_results.clear();
+  m_resultIndices.clear();
+}
+
+GpuProfiler::Result& GpuProfiler::getResult(const std::string& name, bool gpu)
+{
+  // Host and GPU sections of the same name are kept apart
+  const std::string key = (gpu ? "gpu:" : "host:") + name;
+  auto              it  = m_resultIndices.find(key);
+  if(it == m_resultIndices.end())
+  {
+    it = m_resultIndices.emplace(key, m_results.size()).first;
+    m_results.push_back({.name = name, .gpu = gpu});
+  }
+  return m_results[it->second];
+}
+
+void GpuProfiler::addTime(Result& result, double ms)
+{
+  result.minMs     = (result.count == 0) ? ms : std::min(result.minMs, ms);
+  result.maxMs     = (result.count == 0) ? ms : std::max(result.maxMs, ms);
+  result.averageMs = (result.count == 0) ? ms : result.averageMs + k_smoothing * (ms - result.averageMs);
+  result.lastMs    = ms;
+  result.totalMs += ms;
+  result.count++;
+}
+
+bool GpuProfiler::writeJson(const std::string& filename) const
+{
+  FILE* file = fopen(filename.c_str(), "w");
+  if(file == nullptr)
+  {
+    return false;
+  }
+  fprintf(file, "{\n  \"sections\": [\n");
+  for(size_t i = 0; i < m_results.size(); i++)
+  {
+    const Result& r = m_results[i];
+    fprintf(file,
+            "    {\"name\": \"%s\", \"timer\": \"%s\", \"count\": %u, \"meanMs\": %.6f, \"minMs\": %.6f, \"maxMs\": %.6f, "
+            "\"totalMs\": %.6f",
+            r.name.c_str(), r.gpu ? "gpu" : "host", r.count, r.totalMs / std::max(r.count, 1u), r.minMs, r.maxMs, r.totalMs);
+    if(r.hasStatistics)
+    {
+      fprintf(file, ", \"computeInvocations\": %llu, \"fragmentInvocations\": %llu",
+              static_cast<unsigned long long>(r.computeInvocations), static_cast<unsigned long long>(r.fragmentInvocations));
+    }
+    fprintf(file, "}%s\n", (i + 1 < m_results.size()) ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  return fclose(file) == 0;
+}
+
+bool GpuProfiler::writeCsv(const std::string& filename) const
+{
+  FILE* file = fopen(filename.c_str(), "w");
+  if(file == nullptr)
+  {
+    return false;
+  }
+  fprintf(file, "name,timer,count,mean_ms,min_ms,max_ms,total_ms,compute_invocations,fragment_invocations\n");
+  for(const Result& r : m_results)
+  {
+    fprintf(file, "%s,%s,%u,%.6f,%.6f,%.6f,%.6f,", r.name.c_str(), r.gpu ? "gpu" : "host", r.count,
+            r.totalMs / std::max(r.count, 1u), r.minMs, r.maxMs, r.totalMs);
+    if(r.hasStatistics)
+    {
+      fprintf(file, "%llu,%llu\n", static_cast<unsigned long long>(r.computeInvocations),
+              static_cast<unsigned long long>(r.fragmentInvocations));
+    }
+    else
+    {
+      fprintf(file, ",\n");
+    }
+  }
+  return fclose(file) == 0;
+}
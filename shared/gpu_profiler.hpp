@@ -0,0 +1,104 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Times named sections of command buffers with timestamp queries, and sums
+// the results per name over the frames or submissions they ran in, to spot
+// where GPU time goes and when that changes.
+// The queries are in sets, one per command buffer that's in flight at the
+// same time (one per frame in flight, or one per slot of a ring of
+// pre-recorded command buffers). cmdBeginSet() starts recording a set;
+// collect() reads back and accumulates what it measured, once the command
+// buffer it was recorded into has finished. A pre-recorded command buffer
+// re-resets its queries each time it runs, so it can be collected after each
+// submission.
+// Sections can also count the compute and fragment shader invocations they
+// ran, with pipeline statistics queries, if the device supports them. Vulkan
+// has no statistics for ray tracing shaders, so sections of ray tracing
+// only get their time. Pipeline statistics queries can't nest.
+// Work the host waits on, like synchronous acceleration structure builds,
+// can be added as host-timed sections.
+#ifndef VK_MINI_PATH_TRACER_GPU_PROFILER_HPP
+#define VK_MINI_PATH_TRACER_GPU_PROFILER_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+class GpuProfiler
+{
+public:
+  // The accumulated measurements of all sections with the same name
+  struct Result
+  {
+    std::string name;
+    bool        gpu                 = true;  // Timed with timestamp queries, or on the host
+    uint32_t    count               = 0;     // Number of times it was measured
+    double      lastMs              = 0.0;
+    double      averageMs           = 0.0;  // Over the last few measurements, for display
+    double      totalMs             = 0.0;
+    double      minMs               = 0.0;
+    double      maxMs               = 0.0;
+    bool        hasStatistics       = false;
+    uint64_t    computeInvocations  = 0;  // Totals over all measurements
+    uint64_t    fragmentInvocations = 0;
+  };
+
+  // Timestamps are written on `queueFamily`; without timestamp support there,
+  // only host sections are measured.
+  void init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t numSets, uint32_t maxSectionsPerSet = 32);
+  void deinit();
+
+  // Resets the queries of `set` in `cmdBuf` and makes it the set the next
+  // sections are recorded into. Outside of render passes.
+  void cmdBeginSet(VkCommandBuffer cmdBuf, uint32_t set);
+  // Returns the section, for cmdEndSection
+  uint32_t cmdBeginSection(VkCommandBuffer cmdBuf, const char* name, bool statistics = false);
+  void     cmdEndSection(VkCommandBuffer cmdBuf, uint32_t section);
+
+  // Accumulates what `set` measured when it last ran. The command buffer it
+  // was recorded into must have finished, and it must have run once since the
+  // last collect() of `set`. Returns false if there was nothing to read.
+  bool collect(uint32_t set);
+  void addHostTime(const char* name, double ms);
+
+  const std::vector<Result>& getResults() const { return m_results; }
+  bool                       hasStatistics() const { return m_statisticsPool != VK_NULL_HANDLE; }
+  void                       clearResults();
+
+  // One line or object per result; return false if the file can't be written
+  bool writeJson(const std::string& filename) const;
+  bool writeCsv(const std::string& filename) const;
+
+private:
+  struct Section
+  {
+    std::string name;
+    bool        statistics = false;
+  };
+  struct Set
+  {
+    std::vector<Section> sections;
+  };
+
+  Result& getResult(const std::string& name, bool gpu);
+  void    addTime(Result& result, double ms);
+
+  VkDevice    m_device{VK_NULL_HANDLE};
+  VkQueryPool m_timestampPool{VK_NULL_HANDLE};   // 2 timestamps per section
+  VkQueryPool m_statisticsPool{VK_NULL_HANDLE};  // 1 query per section
+  float       m_timestampPeriod = 0.f;           // Nanoseconds per tick
+  uint64_t    m_timestampMask   = 0;             // Of the valid bits of the queue family
+  uint32_t    m_maxSections     = 0;
+
+  std::vector<Set> m_sets;
+  uint32_t         m_recordingSet = 0;
+  bool             m_warnedFull   = false;
+
+  std::vector<Result>           m_results;  // In the order they were first measured
+  std::map<std::string, size_t> m_resultIndices;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_GPU_PROFILER_HPP
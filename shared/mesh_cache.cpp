@@ -0,0 +1,311 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "mesh_cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const std::string& filename)
+{
+  close();
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if(file == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+  LARGE_INTEGER size;
+  if(!GetFileSizeEx(file, &size))
+  {
+    CloseHandle(file);
+    return false;
+  }
+  m_file = file;
+  m_size = size_t(size.QuadPart);
+  if(m_size == 0)
+  {
+    m_data = "";  // Can't map empty files
+    return true;
+  }
+  m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  m_data    = (m_mapping != nullptr) ? MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+  m_fd = ::open(filename.c_str(), O_RDONLY);
+  if(m_fd < 0)
+  {
+    return false;
+  }
+  struct stat info;
+  if(fstat(m_fd, &info) != 0)
+  {
+    close();
+    return false;
+  }
+  m_size = size_t(info.st_size);
+  if(m_size == 0)
+  {
+    m_data = "";  // Can't map empty files
+    return true;
+  }
+  void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+  m_data     = (data != MAP_FAILED) ? data : nullptr;
+  if(m_data != nullptr)
+  {
+    // Both the parser and the GPU upload read the file front to back.
+    madvise(data, m_size, MADV_SEQUENTIAL);
+  }
+#endif
+  if(m_data == nullptr)
+  {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+  if(m_mapping != nullptr)
+  {
+    UnmapViewOfFile(m_data);
+    CloseHandle(m_mapping);
+  }
+  if(m_file != nullptr)
+  {
+    CloseHandle(m_file);
+  }
+  m_file    = nullptr;
+  m_mapping = nullptr;
+#else
+  if(m_data != nullptr && m_size != 0)
+  {
+    munmap(const_cast<void*>(m_data), m_size);
+  }
+  if(m_fd >= 0)
+  {
+    ::close(m_fd);
+  }
+  m_fd = -1;
+#endif
+  m_data = nullptr;
+  m_size = 0;
+}
+
+namespace {
+struct MeshCacheHeader
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t vertexLayout;
+  uint32_t vertexStride;
+  uint32_t materialStride;
+  // Identifies the source file
+  uint64_t sourceSize;
+  int64_t  sourceModTime;
+  uint64_t vertexCount;
+  uint64_t indexCount;
+  uint64_t triangleCount;
+  uint64_t materialCount;
+  uint64_t textureNamesSize;  // In bytes; each name is null-terminated
+  // Offsets of the sections from the start of the file, aligned to SECTION_ALIGNMENT
+  uint64_t vertexOffset;
+  uint64_t indexOffset;
+  uint64_t materialIDOffset;
+  uint64_t materialOffset;
+  uint64_t textureNamesOffset;
+};
+
+const char     s_magic[8]        = {'M', 'E', 'S', 'H', 'C', 'A', 'C', 'H'};
+const uint32_t s_version         = 1;
+const uint64_t SECTION_ALIGNMENT = 16;
+
+uint64_t alignUp(uint64_t value)
+{
+  return (value + SECTION_ALIGNMENT - 1) & ~(SECTION_ALIGNMENT - 1);
+}
+
+// Gets the size and modification time of `filename`; returns false if it doesn't exist.
+bool getSourceInfo(const std::string& filename, uint64_t& size, int64_t& modTime)
+{
+  std::error_code error;
+  size    = std::filesystem::file_size(filename, error);
+  modTime = error ? 0 : int64_t(std::filesystem::last_write_time(filename, error).time_since_epoch().count());
+  return !error;
+}
+
+FILE* openFile(const std::string& filename, const char* mode)
+{
+  FILE* file = nullptr;
+#ifdef _WIN32
+  if(fopen_s(&file, filename.c_str(), mode) != 0)
+  {
+    file = nullptr;
+  }
+#else
+  file = fopen(filename.c_str(), mode);
+#endif
+  return file;
+}
+}  // namespace
+
+bool writeMeshCache(const std::string&    cacheFilename,
+                    const std::string&    sourceFilename,
+                    MeshCacheVertexLayout vertexLayout,
+                    uint32_t              vertexStride,
+                    uint32_t              materialStride,
+                    const MeshCacheView&  view)
+{
+  std::string textureNames;
+  for(const std::string& texture : view.textures)
+  {
+    textureNames.append(texture.c_str(), texture.size() + 1);
+  }
+
+  MeshCacheHeader header{};
+  memcpy(header.magic, s_magic, sizeof(s_magic));
+  header.version        = s_version;
+  header.vertexLayout   = vertexLayout;
+  header.vertexStride   = vertexStride;
+  header.materialStride = materialStride;
+  if(!getSourceInfo(sourceFilename, header.sourceSize, header.sourceModTime))
+  {
+    return false;
+  }
+  header.vertexCount        = view.vertexCount;
+  header.indexCount         = view.indexCount;
+  header.triangleCount      = view.triangleCount;
+  header.materialCount      = view.materialCount;
+  header.textureNamesSize   = textureNames.size();
+  header.vertexOffset       = alignUp(sizeof(header));
+  header.indexOffset        = alignUp(header.vertexOffset + view.vertexCount * vertexStride);
+  header.materialIDOffset   = alignUp(header.indexOffset + view.indexCount * sizeof(uint32_t));
+  header.materialOffset     = alignUp(header.materialIDOffset + view.triangleCount * sizeof(int32_t));
+  header.textureNamesOffset = alignUp(header.materialOffset + view.materialCount * materialStride);
+
+  const struct
+  {
+    const void* data;
+    uint64_t    offset, size;
+  } sections[] = {
+      {&header, 0, sizeof(header)},
+      {view.vertices, header.vertexOffset, view.vertexCount * vertexStride},
+      {view.indices, header.indexOffset, view.indexCount * sizeof(uint32_t)},
+      {view.materialIDs, header.materialIDOffset, view.triangleCount * sizeof(int32_t)},
+      {view.materials, header.materialOffset, view.materialCount * materialStride},
+      {textureNames.data(), header.textureNamesOffset, textureNames.size()},
+  };
+
+  // As with the pipeline cache, write to a temporary file and rename it, so
+  // that a partially written cache is never picked up.
+  const std::string tempFilename = cacheFilename + ".tmp";
+  FILE*             file         = openFile(tempFilename, "wb");
+  if(file == nullptr)
+  {
+    return false;
+  }
+  bool     written  = true;
+  uint64_t position = 0;
+  for(const auto& section : sections)
+  {
+    static const char padding[SECTION_ALIGNMENT] = {};
+    written = written && fwrite(padding, 1, size_t(section.offset - position), file) == section.offset - position
+              && (section.size == 0 || fwrite(section.data, 1, size_t(section.size), file) == section.size);
+    position = section.offset + section.size;
+  }
+  written = (fclose(file) == 0) && written;
+  if(!written)
+  {
+    remove(tempFilename.c_str());
+    return false;
+  }
+#ifdef _WIN32
+  remove(cacheFilename.c_str());  // rename() doesn't replace existing files on Windows
+#endif
+  return rename(tempFilename.c_str(), cacheFilename.c_str()) == 0;
+}
+
+bool MeshCache::open(const std::string&    cacheFilename,
+                     const std::string&    sourceFilename,
+                     MeshCacheVertexLayout vertexLayout,
+                     uint32_t              vertexStride,
+                     uint32_t              materialStride)
+{
+  close();
+  uint64_t sourceSize;
+  int64_t  sourceModTime;
+  if(!getSourceInfo(sourceFilename, sourceSize, sourceModTime) || !m_file.open(cacheFilename))
+  {
+    return false;
+  }
+
+  MeshCacheHeader header;
+  if(m_file.size() < sizeof(header))
+  {
+    close();
+    return false;
+  }
+  memcpy(&header, m_file.data(), sizeof(header));
+  if(memcmp(header.magic, s_magic, sizeof(s_magic)) != 0 || header.version != s_version
+     || header.vertexLayout != vertexLayout || header.vertexStride != vertexStride
+     || header.materialStride != materialStride || header.sourceSize != sourceSize || header.sourceModTime != sourceModTime)
+  {
+    close();
+    return false;
+  }
+
+  // Check that all sections are inside the file, in case it was truncated.
+  const uint64_t fileSize = m_file.size();
+  const uint64_t ends[]   = {header.vertexOffset + header.vertexCount * vertexStride,
+                             header.indexOffset + header.indexCount * sizeof(uint32_t),
+                             header.materialIDOffset + header.triangleCount * sizeof(int32_t),
+                             header.materialOffset + header.materialCount * materialStride,
+                             header.textureNamesOffset + header.textureNamesSize};
+  for(uint64_t end : ends)
+  {
+    if(end > fileSize)
+    {
+      close();
+      return false;
+    }
+  }
+
+  const uint8_t* base    = static_cast<const uint8_t*>(m_file.data());
+  m_view.vertices        = base + header.vertexOffset;
+  m_view.vertexCount     = header.vertexCount;
+  m_view.indices         = reinterpret_cast<const uint32_t*>(base + header.indexOffset);
+  m_view.indexCount      = header.indexCount;
+  m_view.materialIDs     = reinterpret_cast<const int32_t*>(base + header.materialIDOffset);
+  m_view.triangleCount   = header.triangleCount;
+  m_view.materials       = base + header.materialOffset;
+  m_view.materialCount   = header.materialCount;
+
+  const char* names    = reinterpret_cast<const char*>(base + header.textureNamesOffset);
+  const char* namesEnd = names + header.textureNamesSize;
+  while(names < namesEnd)
+  {
+    const size_t length = strnlen(names, size_t(namesEnd - names));
+    m_view.textures.emplace_back(names, length);
+    names += length + 1;
+  }
+  return true;
+}
+
+void MeshCache::close()
+{
+  m_file.close();
+  m_view = MeshCacheView();
+}
@@ -0,0 +1,104 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// A binary cache of a parsed mesh, so that large OBJ files only need to be
+// parsed once. The cache is a single file of sections that can be uploaded to
+// the GPU as they are: vertices, 32-bit indices, per-triangle material IDs,
+// materials and texture names. It's memory-mapped when loaded, so loading it
+// costs little more than the page faults of reading it.
+// The cache stores the size and modification time of the source file, and is
+// ignored if either changes, or if it was written with a different vertex or
+// material layout.
+#ifndef VK_MINI_PATH_TRACER_MESH_CACHE_HPP
+#define VK_MINI_PATH_TRACER_MESH_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+  MappedFile(const MappedFile&)            = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool open(const std::string& filename);
+  void close();
+
+  const void* data() const { return m_data; }
+  size_t      size() const { return m_size; }
+
+private:
+  const void* m_data = nullptr;
+  size_t      m_size = 0;
+#ifdef _WIN32
+  void* m_file    = nullptr;
+  void* m_mapping = nullptr;
+#else
+  int m_fd = -1;
+#endif
+};
+
+// Identifies how the vertices of a cache are laid out.
+enum MeshCacheVertexLayout : uint32_t
+{
+  MESH_CACHE_LAYOUT_POSITIONS  = 1,  // 3 floats per vertex
+  MESH_CACHE_LAYOUT_VERTEX_OBJ = 2,  // VertexObj of the interactive path tracer
+};
+
+// Pointers to the sections of a mesh; either into a mapped cache, or into
+// arrays that are about to be written to one.
+struct MeshCacheView
+{
+  const void*              vertices      = nullptr;
+  uint64_t                 vertexCount   = 0;
+  const uint32_t*          indices       = nullptr;
+  uint64_t                 indexCount    = 0;
+  const int32_t*           materialIDs   = nullptr;  // One per triangle
+  uint64_t                 triangleCount = 0;
+  const void*              materials     = nullptr;
+  uint64_t                 materialCount = 0;
+  std::vector<std::string> textures;
+};
+
+// Writes `view` to `cacheFilename`, recording the size and modification time
+// of `sourceFilename`. Returns false on failure.
+bool writeMeshCache(const std::string&    cacheFilename,
+                    const std::string&    sourceFilename,
+                    MeshCacheVertexLayout vertexLayout,
+                    uint32_t              vertexStride,
+                    uint32_t              materialStride,
+                    const MeshCacheView&  view);
+
+class MeshCache
+{
+public:
+  // Maps `cacheFilename` if it is a valid cache of `sourceFilename` with the
+  // given layout. Returns false if it isn't, in which case the source has to
+  // be parsed.
+  bool open(const std::string&    cacheFilename,
+            const std::string&    sourceFilename,
+            MeshCacheVertexLayout vertexLayout,
+            uint32_t              vertexStride,
+            uint32_t              materialStride);
+  void close();
+
+  // Valid while the cache is open.
+  const MeshCacheView& view() const { return m_view; }
+
+private:
+  MappedFile    m_file;
+  MeshCacheView m_view;
+};
+
+// Where the cache of `sourceFilename` is stored.
+inline std::string getMeshCacheFilename(const std::string& sourceFilename)
+{
+  return sourceFilename + ".meshcache";
+}
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_MESH_CACHE_HPP
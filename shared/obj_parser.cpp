@@ -0,0 +1,406 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "obj_parser.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <thread>
+
+#include "mesh_cache.hpp"  // For MappedFile
+
+namespace {
+// Material index of triangles before a chunk's first `usemtl`; they use the
+// material that was current at the end of the previous chunk.
+const int32_t MATERIAL_INHERIT = -2;
+
+// A face corner as written in the file. Relative (negative) indices can only
+// be resolved once the number of elements in the previous chunks is known,
+// so they're stored relative to the start of the chunk and flagged.
+struct RawIndex
+{
+  int32_t index[3];     // Vertex, normal, texcoord; -1 if absent
+  uint8_t relativeMask;  // Bit i is set if index[i] is relative to the start of the chunk
+};
+
+struct Chunk
+{
+  const char*              begin;
+  const char*              end;
+  std::vector<float>       positions;
+  std::vector<float>       colors;  // Always filled; defaults to white
+  bool                     hasColors = false;
+  std::vector<float>       normals;
+  std::vector<float>       texcoords;
+  std::vector<RawIndex>    corners;            // 3 per triangle
+  std::vector<int32_t>     triangleMaterials;  // Index into materialNames, or MATERIAL_INHERIT
+  std::vector<std::string> materialNames;
+  std::vector<std::string> mtllibs;
+  bool                     valid = true;
+};
+
+// Runs func(i) for i in [0, count) on `numThreads` threads.
+template <class Func>
+void parallelFor(uint32_t count, uint32_t numThreads, const Func& func)
+{
+  std::atomic<uint32_t>    next{0};
+  std::vector<std::thread> threads;
+  for(uint32_t t = 0; t < std::min(count, numThreads); t++)
+  {
+    threads.emplace_back([&]() {
+      for(uint32_t i = next++; i < count; i = next++)
+      {
+        func(i);
+      }
+    });
+  }
+  for(std::thread& thread : threads)
+  {
+    thread.join();
+  }
+}
+
+inline bool isSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skipSpaces(const char* p, const char* end)
+{
+  while(p < end && isSpace(*p))
+  {
+    p++;
+  }
+  return p;
+}
+
+// Parses a number after optional spaces; returns nullptr if there isn't one.
+template <class T>
+const char* parseNumber(const char* p, const char* end, T& value)
+{
+  p = skipSpaces(p, end);
+  if(p < end && *p == '+')  // std::from_chars doesn't accept a leading +
+  {
+    p++;
+  }
+  const std::from_chars_result result = std::from_chars(p, end, value);
+  return (result.ec == std::errc()) ? result.ptr : nullptr;
+}
+
+// Returns the rest of the line after spaces, without trailing spaces.
+std::string parseName(const char* p, const char* end)
+{
+  p = skipSpaces(p, end);
+  while(end > p && isSpace(end[-1]))
+  {
+    end--;
+  }
+  return std::string(p, end);
+}
+
+// Parses one corner of a face (v, v/vt, v//vn or v/vt/vn). Returns nullptr at the end of the line.
+const char* parseCorner(const char* p, const char* end, Chunk& chunk, RawIndex& corner)
+{
+  corner = {{-1, -1, -1}, 0};
+  p      = skipSpaces(p, end);
+  if(p == end)
+  {
+    return nullptr;
+  }
+
+  // File order is vertex/texcoord/normal; `corner` stores vertex, normal, texcoord.
+  const size_t counts[3] = {chunk.positions.size() / 3, chunk.texcoords.size() / 2, chunk.normals.size() / 3};
+  const int    slots[3]  = {0, 2, 1};
+  for(int element = 0; element < 3; element++)
+  {
+    if(element > 0)
+    {
+      if(p == end || *p != '/')
+      {
+        break;
+      }
+      p++;
+      if(p < end && *p == '/')  // Empty texcoord, as in v//vn
+      {
+        continue;
+      }
+    }
+    // Not parseNumber(), since there mustn't be spaces around the slashes
+    int32_t                      value  = 0;
+    const std::from_chars_result result = std::from_chars(p, end, value);
+    const char*                  next   = (result.ec == std::errc()) ? result.ptr : nullptr;
+    if(next == nullptr || value == 0)
+    {
+      chunk.valid = (element != 0) && chunk.valid;
+      return (element == 0) ? nullptr : (next == nullptr ? p : next);
+    }
+    p = next;
+    if(value > 0)
+    {
+      corner.index[slots[element]] = value - 1;
+    }
+    else
+    {
+      corner.index[slots[element]] = static_cast<int32_t>(counts[element]) + value;
+      corner.relativeMask |= uint8_t(1 << slots[element]);
+    }
+  }
+  return p;
+}
+
+void parseLine(const char* p, const char* end, Chunk& chunk)
+{
+  p = skipSpaces(p, end);
+  if(end - p < 2)
+  {
+    return;
+  }
+
+  if(p[0] == 'v' && isSpace(p[1]))
+  {
+    // x y z, optionally followed by w or by r g b
+    float       values[6] = {0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+    int         count     = 0;
+    const char* next      = p + 1;
+    while(count < 6 && (next = parseNumber(next, end, values[count])) != nullptr)
+    {
+      count++;
+    }
+    chunk.positions.insert(chunk.positions.end(), values, values + 3);
+    if(count == 6)
+    {
+      chunk.colors.insert(chunk.colors.end(), values + 3, values + 6);
+      chunk.hasColors = true;
+    }
+    else
+    {
+      chunk.colors.insert(chunk.colors.end(), {1.0f, 1.0f, 1.0f});
+    }
+  }
+  else if(p[0] == 'v' && p[1] == 'n')
+  {
+    float       values[3] = {0.0f, 0.0f, 0.0f};
+    const char* next      = p + 2;
+    for(int i = 0; i < 3 && next != nullptr; i++)
+    {
+      next = parseNumber(next, end, values[i]);
+    }
+    chunk.normals.insert(chunk.normals.end(), values, values + 3);
+  }
+  else if(p[0] == 'v' && p[1] == 't')
+  {
+    float       values[2] = {0.0f, 0.0f};
+    const char* next      = p + 2;
+    for(int i = 0; i < 2 && next != nullptr; i++)
+    {
+      next = parseNumber(next, end, values[i]);
+    }
+    chunk.texcoords.insert(chunk.texcoords.end(), values, values + 2);
+  }
+  else if(p[0] == 'f' && isSpace(p[1]))
+  {
+    // Triangulate the polygon as a fan around its first corner.
+    RawIndex    first, previous, current;
+    const char* next = parseCorner(p + 1, end, chunk, first);
+    if(next != nullptr)
+    {
+      next = parseCorner(next, end, chunk, previous);
+    }
+    while(next != nullptr && (next = parseCorner(next, end, chunk, current)) != nullptr)
+    {
+      chunk.corners.insert(chunk.corners.end(), {first, previous, current});
+      chunk.triangleMaterials.push_back(chunk.materialNames.empty() ? MATERIAL_INHERIT :
+                                                                      static_cast<int32_t>(chunk.materialNames.size()) - 1);
+      previous = current;
+    }
+  }
+  else if(strncmp(p, "usemtl", std::min<size_t>(6, end - p)) == 0 && end - p > 6 && isSpace(p[6]))
+  {
+    chunk.materialNames.push_back(parseName(p + 6, end));
+  }
+  else if(strncmp(p, "mtllib", std::min<size_t>(6, end - p)) == 0 && end - p > 6 && isSpace(p[6]))
+  {
+    // One or more file names separated by spaces
+    const char* name = skipSpaces(p + 6, end);
+    while(name < end)
+    {
+      const char* nameEnd = name;
+      while(nameEnd < end && !isSpace(*nameEnd))
+      {
+        nameEnd++;
+      }
+      chunk.mtllibs.emplace_back(name, nameEnd);
+      name = skipSpaces(nameEnd, end);
+    }
+  }
+}
+
+void parseChunk(Chunk& chunk)
+{
+  const char* p = chunk.begin;
+  while(p < chunk.end)
+  {
+    const char* lineEnd = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+    if(lineEnd == nullptr)
+    {
+      lineEnd = chunk.end;
+    }
+    parseLine(p, lineEnd, chunk);
+    p = lineEnd + 1;
+  }
+}
+}  // namespace
+
+bool parseObjParallel(const std::string& filename, ObjData& data, uint32_t numThreads)
+{
+  data = ObjData();
+
+  MappedFile file;
+  if(!file.open(filename))
+  {
+    return false;
+  }
+  const char*  text = static_cast<const char*>(file.data());
+  const size_t size = file.size();
+
+  if(numThreads == 0)
+  {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // Split the file into chunks of at least 1 MiB that end at line boundaries.
+  // There are more chunks than threads, so that threads that finish early can
+  // pick up more work.
+  const size_t       numChunks = std::clamp<size_t>(size >> 20, 1, size_t(numThreads) * 4);
+  std::vector<Chunk> chunks(numChunks);
+  const char*        chunkBegin = text;
+  for(size_t c = 0; c < numChunks; c++)
+  {
+    const char* chunkEnd = (c + 1 == numChunks) ? text + size : text + size * (c + 1) / numChunks;
+    chunkEnd             = std::max(chunkEnd, chunkBegin);
+    const char* newline  = static_cast<const char*>(memchr(chunkEnd, '\n', (text + size) - chunkEnd));
+    chunkEnd             = (newline == nullptr) ? text + size : newline + 1;
+    chunks[c].begin      = chunkBegin;
+    chunks[c].end        = chunkEnd;
+    chunkBegin           = chunkEnd;
+  }
+
+  parallelFor(static_cast<uint32_t>(numChunks), numThreads, [&](uint32_t c) { parseChunk(chunks[c]); });
+
+  // Load the materials of all material libraries, in order of appearance.
+  std::map<std::string, int> materialMap;
+  {
+    const size_t slash   = filename.find_last_of("/\\");
+    std::string  baseDir = (slash == std::string::npos) ? "" : filename.substr(0, slash + 1);
+    std::vector<std::string> loadedLibs;
+    for(const Chunk& chunk : chunks)
+    {
+      for(const std::string& mtllib : chunk.mtllibs)
+      {
+        if(std::find(loadedLibs.begin(), loadedLibs.end(), mtllib) != loadedLibs.end())
+        {
+          continue;
+        }
+        loadedLibs.push_back(mtllib);
+        std::ifstream stream(baseDir + mtllib);
+        if(stream)
+        {
+          std::string warning, error;
+          tinyobj::LoadMtl(&materialMap, &data.materials, &stream, &warning, &error);
+        }
+      }
+    }
+  }
+
+  // Compute where each chunk's data goes, and which material is current at the start of each chunk.
+  struct ChunkOffsets
+  {
+    size_t  vertex, normal, texcoord, triangle;
+    int32_t startMaterial;
+  };
+  std::vector<ChunkOffsets>         offsets(numChunks + 1);
+  std::vector<std::vector<int32_t>> chunkMaterialIDs(numChunks);
+  bool                              hasColors       = false;
+  int32_t                           currentMaterial = -1;
+  offsets[0]                                        = {0, 0, 0, 0, -1};
+  for(size_t c = 0; c < numChunks; c++)
+  {
+    const Chunk& chunk = chunks[c];
+    for(const std::string& name : chunk.materialNames)
+    {
+      auto it = materialMap.find(name);
+      chunkMaterialIDs[c].push_back(it == materialMap.end() ? -1 : it->second);
+    }
+    offsets[c].startMaterial = currentMaterial;
+    if(!chunkMaterialIDs[c].empty())
+    {
+      currentMaterial = chunkMaterialIDs[c].back();
+    }
+    offsets[c + 1] = {offsets[c].vertex + chunk.positions.size() / 3, offsets[c].normal + chunk.normals.size() / 3,
+                      offsets[c].texcoord + chunk.texcoords.size() / 2, offsets[c].triangle + chunk.corners.size() / 3, -1};
+    hasColors      = hasColors || chunk.hasColors;
+  }
+
+  const ChunkOffsets& totals = offsets[numChunks];
+  data.positions.resize(totals.vertex * 3);
+  data.colors.resize(hasColors ? totals.vertex * 3 : 0);
+  data.normals.resize(totals.normal * 3);
+  data.texcoords.resize(totals.texcoord * 2);
+  data.indices.resize(totals.triangle * 3);
+  data.materialIDs.resize(totals.triangle);
+
+  // Copy each chunk's data into place, resolving indices and materials.
+  std::atomic<bool> valid{true};
+  parallelFor(static_cast<uint32_t>(numChunks), numThreads, [&](uint32_t c) {
+    const Chunk&        chunk  = chunks[c];
+    const ChunkOffsets& offset = offsets[c];
+    std::copy(chunk.positions.begin(), chunk.positions.end(), data.positions.begin() + offset.vertex * 3);
+    if(hasColors)
+    {
+      std::copy(chunk.colors.begin(), chunk.colors.end(), data.colors.begin() + offset.vertex * 3);
+    }
+    std::copy(chunk.normals.begin(), chunk.normals.end(), data.normals.begin() + offset.normal * 3);
+    std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), data.texcoords.begin() + offset.texcoord * 2);
+
+    const size_t bases[3]  = {offset.vertex, offset.normal, offset.texcoord};
+    const size_t limits[3] = {totals.vertex, totals.normal, totals.texcoord};
+    bool         inRange   = chunk.valid;
+    for(size_t i = 0; i < chunk.corners.size(); i++)
+    {
+      const RawIndex& raw = chunk.corners[i];
+      int32_t         resolved[3];
+      for(int e = 0; e < 3; e++)
+      {
+        int64_t index = raw.index[e];
+        if(raw.relativeMask & (1 << e))
+        {
+          index += static_cast<int64_t>(bases[e]);
+        }
+        // Only the vertex index is required
+        if(index < (e == 0 ? 0 : -1) || index >= static_cast<int64_t>(limits[e]))
+        {
+          inRange = false;
+          index   = -1;
+        }
+        resolved[e] = static_cast<int32_t>(index);
+      }
+      data.indices[offset.triangle * 3 + i] = {resolved[0], resolved[1], resolved[2]};
+    }
+
+    for(size_t t = 0; t < chunk.triangleMaterials.size(); t++)
+    {
+      const int32_t local                 = chunk.triangleMaterials[t];
+      data.materialIDs[offset.triangle + t] = (local == MATERIAL_INHERIT) ? offset.startMaterial : chunkMaterialIDs[c][local];
+    }
+
+    if(!inRange)
+    {
+      valid = false;
+    }
+  });
+
+  return valid;
+}
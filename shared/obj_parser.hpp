@@ -0,0 +1,44 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// A multi-threaded Wavefront OBJ parser for large meshes.
+// The file is split into chunks at line boundaries, which are parsed in
+// parallel; then the per-chunk arrays are concatenated, and relative indices
+// and materials that carry over from one chunk to the next are resolved.
+// It understands v (with optional vertex colors), vn, vt, f (polygons are
+// triangulated as fans), usemtl and mtllib. Objects, groups and smoothing
+// groups are ignored, so all faces end up in a single mesh.
+#ifndef VK_MINI_PATH_TRACER_OBJ_PARSER_HPP
+#define VK_MINI_PATH_TRACER_OBJ_PARSER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <tiny_obj_loader.h>  // For tinyobj::material_t
+
+// Indices of the attributes of a face corner; -1 if the corner doesn't have one.
+struct ObjIndex
+{
+  int32_t vertex   = -1;
+  int32_t normal   = -1;
+  int32_t texcoord = -1;
+};
+
+struct ObjData
+{
+  std::vector<float>               positions;    // 3 floats per `v`
+  std::vector<float>               colors;       // 3 floats per `v`, or empty if no `v` has a color
+  std::vector<float>               normals;      // 3 floats per `vn`
+  std::vector<float>               texcoords;    // 2 floats per `vt`
+  std::vector<ObjIndex>            indices;      // 3 corners per triangle
+  std::vector<int32_t>             materialIDs;  // Index into `materials` per triangle, or -1
+  std::vector<tinyobj::material_t> materials;    // From the files named by `mtllib`
+};
+
+// Parses `filename` into `data` using `numThreads` threads (0 means one per
+// hardware thread). Returns false if the file couldn't be read or an index is
+// out of range.
+bool parseObjParallel(const std::string& filename, ObjData& data, uint32_t numThreads = 0);
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_OBJ_PARSER_HPP
@@ -0,0 +1,179 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "pipeline_cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <nvh/nvprint.hpp>
+#include <nvvk/error_vk.hpp>
+
+namespace {
+// Identifies the device and driver a cache file was written with.
+struct CacheFileHeader
+{
+  char     magic[8];
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint32_t driverVersion;
+  uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+  uint64_t dataSize;  // Size of the VkPipelineCache data that follows
+};
+
+const char s_magic[8] = {'V', 'K', 'P', 'C', 'A', 'C', 'H', '1'};
+
+CacheFileHeader makeHeader(VkPhysicalDevice physicalDevice, uint64_t dataSize)
+{
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  CacheFileHeader header{};
+  memcpy(header.magic, s_magic, sizeof(s_magic));
+  header.vendorID      = properties.vendorID;
+  header.deviceID      = properties.deviceID;
+  header.driverVersion = properties.driverVersion;
+  memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+  header.dataSize = dataSize;
+  return header;
+}
+
+FILE* openFile(const std::string& filename, const char* mode)
+{
+  FILE* file = nullptr;
+#ifdef _WIN32
+  if(fopen_s(&file, filename.c_str(), mode) != 0)
+  {
+    file = nullptr;
+  }
+#else
+  file = fopen(filename.c_str(), mode);
+#endif
+  return file;
+}
+
+// The size of an open file, which is then read from the start; 0 on an error
+uint64_t getFileSize(FILE* file)
+{
+  uint64_t size = 0;
+  if(fseek(file, 0, SEEK_END) == 0)
+  {
+    const long end = ftell(file);
+    size           = (end > 0) ? uint64_t(end) : 0;
+  }
+  rewind(file);
+  return size;
+}
+
+uint32_t getProcessID()
+{
+#ifdef _WIN32
+  return uint32_t(_getpid());
+#else
+  return uint32_t(getpid());
+#endif
+}
+
+// Reads the pipeline cache data from `filename`, or returns an empty vector if
+// it doesn't exist or doesn't match `expected`.
+std::vector<uint8_t> readCacheData(const std::string& filename, const CacheFileHeader& expected)
+{
+  std::vector<uint8_t> data;
+  FILE*                file = openFile(filename, "rb");
+  if(file == nullptr)
+  {
+    return data;
+  }
+
+  const uint64_t  fileSize = getFileSize(file);
+  CacheFileHeader header;
+  if(fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0
+     && header.vendorID == expected.vendorID && header.deviceID == expected.deviceID
+     && header.driverVersion == expected.driverVersion
+     && memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) == 0)
+  {
+    // A truncated or corrupted file mustn't make us allocate more than it holds.
+    if(header.dataSize == fileSize - sizeof(header))
+    {
+      data.resize(header.dataSize);
+      if(fread(data.data(), 1, data.size(), file) != data.size())
+      {
+        data.clear();
+      }
+    }
+  }
+  else
+  {
+    LOGI("Ignoring %s, since it was written by a different device or driver.\n", filename.c_str());
+  }
+  fclose(file);
+
+  // The data should itself start with the VkPipelineCacheHeaderVersionOne
+  // header the driver wrote; check it as well, instead of relying on every
+  // driver to reject corrupted data.
+  VkPipelineCacheHeaderVersionOne driverHeader;
+  if(data.size() < sizeof(driverHeader))
+  {
+    data.clear();
+    return data;
+  }
+  memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+  if(driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || driverHeader.vendorID != expected.vendorID
+     || driverHeader.deviceID != expected.deviceID
+     || memcmp(driverHeader.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+  {
+    data.clear();
+  }
+  return data;
+}
+}  // namespace
+
+VkPipelineCache loadPipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, const std::string& filename)
+{
+  const std::vector<uint8_t> data = readCacheData(filename, makeHeader(physicalDevice, 0));
+
+  VkPipelineCacheCreateInfo createInfo{.sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+                                       .initialDataSize = data.size(),
+                                       .pInitialData    = data.empty() ? nullptr : data.data()};
+  VkPipelineCache           cache;
+  NVVK_CHECK(vkCreatePipelineCache(device, &createInfo, nullptr, &cache));
+  return cache;
+}
+
+bool savePipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, VkPipelineCache cache, const std::string& filename)
+{
+  size_t dataSize = 0;
+  NVVK_CHECK(vkGetPipelineCacheData(device, cache, &dataSize, nullptr));
+  std::vector<uint8_t> data(dataSize);
+  NVVK_CHECK(vkGetPipelineCacheData(device, cache, &dataSize, data.data()));
+  data.resize(dataSize);
+
+  // Write to a temporary file first, so that a crash (or another process
+  // starting up) never sees a partially written cache. Its name is unique to
+  // this process, so that processes saving at the same time don't write into
+  // each other's file; the last rename wins.
+  const std::string tempFilename = filename + "." + std::to_string(getProcessID()) + ".tmp";
+  FILE*             file         = openFile(tempFilename, "wb");
+  if(file == nullptr)
+  {
+    return false;
+  }
+  const CacheFileHeader header = makeHeader(physicalDevice, data.size());
+  const bool            written =
+      fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data.data(), 1, data.size(), file) == data.size();
+  fclose(file);
+  if(!written)
+  {
+    remove(tempFilename.c_str());
+    return false;
+  }
+#ifdef _WIN32
+  remove(filename.c_str());  // rename() doesn't replace existing files on Windows
+#endif
+  return rename(tempFilename.c_str(), filename.c_str()) == 0;
+}
@@ -0,0 +1,22 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Persists a VkPipelineCache across runs, so that relaunching the renderer
+// doesn't recompile its pipelines in the driver.
+// The file starts with the device's vendor ID, device ID, driver version and
+// pipelineCacheUUID; if any of them don't match the current device, the file
+// is ignored and an empty cache is created instead.
+#ifndef VK_MINI_PATH_TRACER_PIPELINE_CACHE_HPP
+#define VK_MINI_PATH_TRACER_PIPELINE_CACHE_HPP
+
+#include <string>
+#include <vulkan/vulkan_core.h>
+
+// Creates a pipeline cache, initialized from `filename` if it was written on
+// the same device and driver.
+VkPipelineCache loadPipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, const std::string& filename);
+
+// Writes the contents of `cache` to `filename`. Returns false on failure.
+bool savePipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, VkPipelineCache cache, const std::string& filename);
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_PIPELINE_CACHE_HPP
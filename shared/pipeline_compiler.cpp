@@ -0,0 +1,196 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#include "pipeline_compiler.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+#include <nvvk/error_vk.hpp>
+
+namespace {
+template <typename Function>
+void loadFunction(VkDevice device, const char* name, Function& function)
+{
+  function = reinterpret_cast<Function>(vkGetDeviceProcAddr(device, name));
+  assert(function != nullptr);
+}
+}  // namespace
+
+void PipelineCompiler::init(VkDevice device, VkPipelineCache cache, uint32_t numThreads)
+{
+  m_device = device;
+  m_cache  = cache;
+  m_stop   = false;
+  loadFunction(device, "vkCreateRayTracingPipelinesKHR", m_createRayTracingPipelines);
+  loadFunction(device, "vkCreateDeferredOperationKHR", m_createDeferredOperation);
+  loadFunction(device, "vkDestroyDeferredOperationKHR", m_destroyDeferredOperation);
+  loadFunction(device, "vkGetDeferredOperationMaxConcurrencyKHR", m_getDeferredOperationMaxConcurrency);
+  loadFunction(device, "vkGetDeferredOperationResultKHR", m_getDeferredOperationResult);
+  loadFunction(device, "vkDeferredOperationJoinKHR", m_deferredOperationJoin);
+  if(numThreads == 0)
+  {
+    numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  for(uint32_t i = 1; i < numThreads; i++)
+  {
+    m_threads.emplace_back(&PipelineCompiler::workerLoop, this);
+  }
+}
+
+void PipelineCompiler::deinit()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for(std::thread& thread : m_threads)
+  {
+    thread.join();
+  }
+  m_threads.clear();
+  m_jobs.clear();
+  m_device = VK_NULL_HANDLE;
+}
+
+void PipelineCompiler::add(const VkRayTracingPipelineCreateInfoKHR& info, VkPipeline* pipeline)
+{
+  Job& job     = m_jobs.emplace_back();
+  job.info     = info;
+  job.pipeline = pipeline;
+}
+
+void PipelineCompiler::addLibrary(const VkRayTracingPipelineCreateInfoKHR&          info,
+                                  const VkRayTracingPipelineInterfaceCreateInfoKHR& libraryInterface,
+                                  VkPipeline*                                       library)
+{
+  Job& job                   = m_jobs.emplace_back();
+  job.libraryInterface       = libraryInterface;
+  job.info                   = info;
+  job.info.flags            |= VK_PIPELINE_CREATE_LIBRARY_BIT_KHR;
+  job.info.pLibraryInterface = &job.libraryInterface;
+  job.pipeline               = library;
+}
+
+void PipelineCompiler::addLinked(const VkRayTracingPipelineCreateInfoKHR&          info,
+                                 const std::vector<VkPipeline>&                    libraries,
+                                 const VkRayTracingPipelineInterfaceCreateInfoKHR& libraryInterface,
+                                 VkPipeline*                                       pipeline)
+{
+  Job& job                   = m_jobs.emplace_back();
+  job.libraryInterface       = libraryInterface;
+  job.libraries              = libraries;
+  job.libraryInfo            = {.sType        = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR,
+                                .libraryCount = static_cast<uint32_t>(job.libraries.size()),
+                                .pLibraries   = job.libraries.data()};
+  job.info                   = info;
+  job.info.pLibraryInfo      = &job.libraryInfo;
+  job.info.pLibraryInterface = &job.libraryInterface;
+  job.pipeline               = pipeline;
+}
+
+VkResult PipelineCompiler::wait()
+{
+  // Start all operations; the driver may finish some right away
+  std::vector<Job*> deferred;
+  for(Job& job : m_jobs)
+  {
+    NVVK_CHECK(m_createDeferredOperation(m_device, nullptr, &job.operation));
+    job.result = m_createRayTracingPipelines(m_device, job.operation, m_cache, 1, &job.info, nullptr, job.pipeline);
+    if(job.result == VK_OPERATION_DEFERRED_KHR)
+    {
+      deferred.push_back(&job);
+    }
+    else if(job.result == VK_OPERATION_NOT_DEFERRED_KHR)
+    {
+      job.result = VK_SUCCESS;
+    }
+  }
+
+  // Each operation is joined by as many threads as it can use
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(Job* job : deferred)
+    {
+      const uint32_t concurrency = std::clamp(m_getDeferredOperationMaxConcurrency(m_device, job->operation), 1u, getNumThreads());
+      m_joinQueue.insert(m_joinQueue.end(), concurrency, job->operation);
+      m_activeJoins += concurrency;
+    }
+  }
+  m_wake.notify_all();
+  while(joinNext())
+  {
+  }
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_activeJoins == 0; });
+  }
+
+  VkResult result = VK_SUCCESS;
+  for(Job& job : m_jobs)
+  {
+    if(job.result == VK_OPERATION_DEFERRED_KHR)
+    {
+      job.result = m_getDeferredOperationResult(m_device, job.operation);
+    }
+    if(result == VK_SUCCESS && job.result != VK_SUCCESS)
+    {
+      result = job.result;
+    }
+    m_destroyDeferredOperation(m_device, job.operation, nullptr);
+  }
+  m_jobs.clear();
+  return result;
+}
+
+VkResult PipelineCompiler::create(const VkRayTracingPipelineCreateInfoKHR& info, VkPipeline* pipeline)
+{
+  add(info, pipeline);
+  return wait();
+}
+
+void PipelineCompiler::workerLoop()
+{
+  while(true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [this] { return m_stop || !m_joinQueue.empty(); });
+      if(m_stop)
+      {
+        return;
+      }
+    }
+    joinNext();
+  }
+}
+
+bool PipelineCompiler::joinNext()
+{
+  VkDeferredOperationKHR operation;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_joinQueue.empty())
+    {
+      return false;
+    }
+    operation = m_joinQueue.back();
+    m_joinQueue.pop_back();
+  }
+
+  // VK_THREAD_IDLE_KHR means there's no work for this thread right now, but
+  // there may be later; VK_THREAD_DONE_KHR and VK_SUCCESS mean there won't be.
+  VkResult result = m_deferredOperationJoin(m_device, operation);
+  while(result == VK_THREAD_IDLE_KHR)
+  {
+    std::this_thread::yield();
+    result = m_deferredOperationJoin(m_device, operation);
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(--m_activeJoins == 0)
+  {
+    m_done.notify_all();
+  }
+  return true;
+}
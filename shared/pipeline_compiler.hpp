@@ -0,0 +1,96 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Compiles ray tracing pipelines on all host cores, using
+// VK_KHR_deferred_host_operations.
+// Each pipeline is created with its own VkDeferredOperationKHR, so the driver
+// returns right away; worker threads (one per core, counting the calling
+// thread) then join the operations until the driver has no more work for
+// them. Several pipelines added before one wait() are compiled concurrently,
+// which is where pipeline libraries (VK_KHR_pipeline_library) come in: a set
+// of shaders, such as the hit groups of each material, can be compiled into
+// separate libraries in parallel and then linked into a pipeline, which is
+// quick.
+// The compiler loads the extension commands it calls for its own device,
+// with vkGetDeviceProcAddr, so that it works with any of several devices.
+#ifndef VK_MINI_PATH_TRACER_PIPELINE_COMPILER_HPP
+#define VK_MINI_PATH_TRACER_PIPELINE_COMPILER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+class PipelineCompiler
+{
+public:
+  // Starts `numThreads` - 1 worker threads; 0 uses one per host core.
+  void init(VkDevice device, VkPipelineCache cache, uint32_t numThreads = 0);
+  void deinit();
+
+  // Adds a pipeline to compile. `info` is copied, but what it points to must
+  // stay valid until wait() returns; `*pipeline` is written by then.
+  void add(const VkRayTracingPipelineCreateInfoKHR& info, VkPipeline* pipeline);
+  // Adds a pipeline library of `info`'s stages and groups. All libraries of a
+  // pipeline, and the pipeline itself, need the same `libraryInterface`.
+  void addLibrary(const VkRayTracingPipelineCreateInfoKHR&          info,
+                  const VkRayTracingPipelineInterfaceCreateInfoKHR& libraryInterface,
+                  VkPipeline*                                       library);
+  // Adds a pipeline that links `libraries`, which must have been compiled by
+  // an earlier wait(). `info` provides the layout, flags and recursion depth,
+  // and may add stages and groups of its own.
+  void addLinked(const VkRayTracingPipelineCreateInfoKHR&          info,
+                 const std::vector<VkPipeline>&                    libraries,
+                 const VkRayTracingPipelineInterfaceCreateInfoKHR& libraryInterface,
+                 VkPipeline*                                       pipeline);
+
+  // Compiles everything added since the last call, on the calling thread and
+  // the worker threads. Returns the first error, or VK_SUCCESS.
+  VkResult wait();
+  // Compiles one pipeline.
+  VkResult create(const VkRayTracingPipelineCreateInfoKHR& info, VkPipeline* pipeline);
+
+  uint32_t getNumThreads() const { return static_cast<uint32_t>(m_threads.size()) + 1; }
+
+private:
+  struct Job
+  {
+    VkRayTracingPipelineCreateInfoKHR          info{};
+    VkRayTracingPipelineInterfaceCreateInfoKHR libraryInterface{};
+    VkPipelineLibraryCreateInfoKHR             libraryInfo{};
+    std::vector<VkPipeline>                    libraries;
+    VkPipeline*                                pipeline  = nullptr;
+    VkDeferredOperationKHR                     operation = VK_NULL_HANDLE;
+    VkResult                                   result    = VK_SUCCESS;
+  };
+
+  void workerLoop();
+  // Joins one queued operation; returns false if there's none left.
+  bool joinNext();
+
+  VkDevice                 m_device{VK_NULL_HANDLE};
+  VkPipelineCache          m_cache{VK_NULL_HANDLE};
+
+  // Loaded for m_device
+  PFN_vkCreateRayTracingPipelinesKHR          m_createRayTracingPipelines          = nullptr;
+  PFN_vkCreateDeferredOperationKHR            m_createDeferredOperation            = nullptr;
+  PFN_vkDestroyDeferredOperationKHR           m_destroyDeferredOperation           = nullptr;
+  PFN_vkGetDeferredOperationMaxConcurrencyKHR m_getDeferredOperationMaxConcurrency = nullptr;
+  PFN_vkGetDeferredOperationResultKHR         m_getDeferredOperationResult         = nullptr;
+  PFN_vkDeferredOperationJoinKHR              m_deferredOperationJoin              = nullptr;
+
+  std::deque<Job>          m_jobs;  // A deque, so that the pointers into create infos stay valid
+  std::vector<std::thread> m_threads;
+
+  // Operations for the threads to join; an operation is listed once per thread that may join it
+  std::mutex                          m_mutex;
+  std::condition_variable             m_wake;  // Operations were queued, or the threads must stop
+  std::condition_variable             m_done;  // All joins finished
+  std::vector<VkDeferredOperationKHR> m_joinQueue;
+  uint32_t                            m_activeJoins = 0;  // Joins queued or in progress
+  bool                                m_stop        = false;
+};
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_PIPELINE_COMPILER_HPP
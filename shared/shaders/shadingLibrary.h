@@ -0,0 +1,351 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// The shading library of all path tracers of this repository: the RNG, the
+// hit and payload structures, and the materials. The ray query megakernels
+// (vk_mini_path_tracer, checkpoints/e10_materials), the ray tracing pipeline
+// and the CPU backend of checkpoints/e11_rt_pipeline_3 all include it, so a
+// material and the random numbers it draws are the same on every backend.
+// It compiles as GLSL and as C++: in C++ it's in namespace shading, where
+// glm stands in for GLSL's types and functions; so it keeps to what both
+// languages read the same way: float literals have an f suffix, there are no
+// swizzles, and inout and out parameters are INOUT(T) and OUT(T), references
+// in C++. A tracer fills HitInfo from its hit and calls shadeMaterial (or one
+// of the shadeMaterialN), which writes where the path continues to
+// PassableInfo.
+#ifndef VK_MINI_PATH_TRACER_SHADING_LIBRARY_H
+#define VK_MINI_PATH_TRACER_SHADING_LIBRARY_H
+
+#ifdef __cplusplus
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#define INOUT(T) T&
+#define OUT(T) T&
+
+namespace shading {
+using uint  = uint32_t;
+using vec2  = glm::vec2;
+using vec3  = glm::vec3;
+using vec4  = glm::vec4;
+using ivec2 = glm::ivec2;
+using ivec3 = glm::ivec3;
+using mat3  = glm::mat3;
+// Calls with vector arguments find the glm functions by argument-dependent
+// lookup; these are the ones that are also called with scalars.
+using glm::floatBitsToInt;
+using glm::intBitsToFloat;
+using glm::mod;
+using std::abs;
+using std::cos;
+using std::log;
+using std::max;
+using std::pow;
+using std::sin;
+using std::sqrt;
+#else
+#define INOUT(T) inout T
+#define OUT(T) out T
+#endif  // #ifdef __cplusplus
+
+struct PassableInfo
+{
+  vec3  color;         // The reflectivity of the surface.
+  vec3  rayOrigin;     // The new ray origin in world-space.
+  vec3  rayDirection;  // The new ray direction in world-space.
+  uint  rngState;      // State of the random number generator.
+  bool  rayHitSky;     // True if the ray hit the sky.
+  float wavelength;    // The hero wavelength of a spectral path, and 550 nm otherwise; the tracer sets it.
+  bool  dispersed;     // The tracer clears it, and a material whose new direction depends on the
+                       // wavelength sets it. Only spectral tracers read it.
+};
+
+struct HitInfo
+{
+  vec3 objectPosition;
+  vec3 worldPosition;
+  vec3 worldNormal;
+  vec3 rayDirection;  // Of the ray that hit, in world space
+  int  primitiveID;
+  bool frontFace;     // If the ray hit the side the triangle's winding faces, i.e. enters a closed model
+};
+
+// Steps the RNG and returns a floating-point value between 0 and 1 inclusive.
+float stepAndOutputRNGFloat(INOUT(uint) rngState)
+{
+  // Condensed version of pcg_output_rxs_m_xs_32_32, with simple conversion to floating-point [0,1].
+  rngState  = rngState * 747796405u + 1u;
+  uint word = ((rngState >> ((rngState >> 28) + 4)) ^ rngState) * 277803737u;
+  word      = (word >> 22) ^ word;
+  return float(word) / 4294967295.0f;
+}
+
+const float k_pi = 3.14159265f;
+
+// Uses the Box-Muller transform to return a normally distributed (centered
+// at 0, standard deviation 1) 2D point.
+vec2 randomGaussian(INOUT(uint) rngState)
+{
+  // Almost uniform in (0, 1] - make sure the value is never 0:
+  const float u1    = max(1e-38f, stepAndOutputRNGFloat(rngState));
+  const float u2    = stepAndOutputRNGFloat(rngState);  // In [0, 1]
+  const float r     = sqrt(-2.0f * log(u1));
+  const float theta = 2 * k_pi * u2;  // Random in [0, 2pi]
+  return r * vec2(cos(theta), sin(theta));
+}
+
+// offsetPositionAlongNormal shifts a point on a triangle surface so that a
+// ray bouncing off the surface with tMin = 0.0 is no longer treated as
+// intersecting the surface it originated from.
+//
+// Here's the old implementation of it we used in earlier chapters:
+// vec3 offsetPositionAlongNormal(vec3 worldPosition, vec3 normal)
+// {
+//   return worldPosition + 0.0001 * normal;
+// }
+//
+// However, this code uses an improved technique by Carsten Wchter and
+// Nikolaus Binder from "A Fast and Robust Method for Avoiding
+// Self-Intersection" from Ray Tracing Gems (version 1.7, 2020).
+// The normal can be negated if one wants the ray to pass through
+// the surface instead.
+vec3 offsetPositionAlongNormal(vec3 worldPosition, vec3 normal)
+{
+  // Convert the normal to an integer offset.
+  const float int_scale = 256.0f;
+  const ivec3 of_i      = ivec3(int_scale * normal);
+
+  // Offset each component of worldPosition using its binary representation.
+  // Handle the sign bits correctly.
+  const vec3 p_i = vec3(  //
+      intBitsToFloat(floatBitsToInt(worldPosition.x) + ((worldPosition.x < 0) ? -of_i.x : of_i.x)),
+      intBitsToFloat(floatBitsToInt(worldPosition.y) + ((worldPosition.y < 0) ? -of_i.y : of_i.y)),
+      intBitsToFloat(floatBitsToInt(worldPosition.z) + ((worldPosition.z < 0) ? -of_i.z : of_i.z)));
+
+  // Use a floating-point offset instead for points near (0,0,0), the origin.
+  const float origin     = 1.0f / 32.0f;
+  const float floatScale = 1.0f / 65536.0f;
+  return vec3(  //
+      abs(worldPosition.x) < origin ? worldPosition.x + floatScale * normal.x : p_i.x,
+      abs(worldPosition.y) < origin ? worldPosition.y + floatScale * normal.y : p_i.y,
+      abs(worldPosition.z) < origin ? worldPosition.z + floatScale * normal.z : p_i.z);
+}
+
+// Returns a random diffuse (Lambertian) reflection for a surface with the
+// given normal, using the given random number generator state. This is
+// cosine-weighted, so directions closer to the normal are more likely to
+// be chosen.
+vec3 diffuseReflection(vec3 normal, INOUT(uint) rngState)
+{
+  // For a random diffuse bounce direction, we follow the approach of
+  // Ray Tracing in One Weekend, and generate a random point on a sphere
+  // of radius 1 centered at the normal. This uses the random_unit_vector
+  // function from chapter 8.5:
+  const float theta     = 2.0f * k_pi * stepAndOutputRNGFloat(rngState);  // Random in [0, 2pi]
+  const float u         = 2.0f * stepAndOutputRNGFloat(rngState) - 1.0f;  // Random in [-1, 1]
+  const float r         = sqrt(1.0f - u * u);
+  const vec3  direction = normal + vec3(r * cos(theta), r * sin(theta), u);
+
+  // Then normalize the ray direction:
+  return normalize(direction);
+}
+
+// The materials. Each one writes the color of the surface, and where the
+// path continues, to `pld`.
+
+// Diffuse
+void shadeMaterial0(HitInfo hitInfo, INOUT(PassableInfo) pld)
+{
+  pld.color        = vec3(0.7f);
+  pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
+  pld.rayDirection = diffuseReflection(hitInfo.worldNormal, pld.rngState);
+  pld.rayHitSky    = false;
+}
+
+// Mirror
+void shadeMaterial1(HitInfo hitInfo, INOUT(PassableInfo) pld)
+{
+  pld.color        = vec3(0.7f);
+  pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
+  pld.rayDirection = reflect(hitInfo.rayDirection, hitInfo.worldNormal);
+  pld.rayHitSky    = false;
+}
+
+// Diffuse, colored by the normal
+void shadeMaterial2(HitInfo hitInfo, INOUT(PassableInfo) pld)
+{
+  pld.color        = vec3(0.5f) + 0.5f * hitInfo.worldNormal;
+  pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
+  pld.rayDirection = diffuseReflection(hitInfo.worldNormal, pld.rngState);
+  pld.rayHitSky    = false;
+}
+
+// Diffuse with a specular component
+void shadeMaterial3(HitInfo hitInfo, INOUT(PassableInfo) pld)
+{
+  pld.color     = vec3(0.7f);
+  pld.rayOrigin = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
+  if(stepAndOutputRNGFloat(pld.rngState) < 0.2f)
+  {
+    pld.rayDirection = reflect(hitInfo.rayDirection, hitInfo.worldNormal);
+  }
+  else
+  {
+    pld.rayDirection = diffuseReflection(hitInfo.worldNormal, pld.rngState);
+  }
+  pld.rayHitSky = false;
+}
+
+// Diffuse, and transparent half of the time
+void shadeMaterial4(HitInfo hitInfo, INOUT(PassableInfo) pld)
+{
+  pld.color = vec3(0.7f);
+  if(stepAndOutputRNGFloat(pld.rngState) < 0.5f)
+  {
+    pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
+    pld.rayDirection = diffuseReflection(hitInfo.worldNormal, pld.rngState);
+  }
+  else
+  {
+    pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, -hitInfo.worldNormal);
+    pld.rayDirection = hitInfo.rayDirection;
+  }
+  pld.rayHitSky = false;
+}
+
+// Diffuse stripes, with holes between them
+void shadeMaterial5(HitInfo hitInfo, INOUT(PassableInfo) pld)
+{
+  if(mod(dot(hitInfo.objectPosition, vec3(1.0f)), 0.5f) >= 0.25f)
+  {
+    pld.color        = vec3(0.7f);
+    pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
+    pld.rayDirection = diffuseReflection(hitInfo.worldNormal, pld.rngState);
+  }
+  else
+  {
+    pld.color        = vec3(1.0f);
+    pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, -hitInfo.worldNormal);
+    pld.rayDirection = hitInfo.rayDirection;
+  }
+  pld.rayHitSky = false;
+}
+
+// Glossy, with a bumpy normal
+void shadeMaterial6(HitInfo hitInfo, INOUT(PassableInfo) pld)
+{
+  pld.color     = vec3(0.7f);
+  pld.rayOrigin = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
+
+  // Perturb the normal:
+  const float scaleFactor        = 80.0f;
+  const vec3  perturbationAmount = 0.03f
+                                  * vec3(sin(scaleFactor * hitInfo.worldPosition.x),  //
+                                         sin(scaleFactor * hitInfo.worldPosition.y),  //
+                                         sin(scaleFactor * hitInfo.worldPosition.z));
+  const vec3 shadingNormal = normalize(hitInfo.worldNormal + perturbationAmount);
+  if(stepAndOutputRNGFloat(pld.rngState) < 0.4f)
+  {
+    pld.rayDirection = reflect(hitInfo.rayDirection, shadingNormal);
+  }
+  else
+  {
+    pld.rayDirection = diffuseReflection(shadingNormal, pld.rngState);
+  }
+  // If the ray now points into the surface, reflect it across:
+  if(dot(pld.rayDirection, hitInfo.worldNormal) <= 0.0f)
+  {
+    pld.rayDirection = reflect(pld.rayDirection, hitInfo.worldNormal);
+  }
+  pld.rayHitSky = false;
+}
+
+// Diffuse, colored by the triangle
+void shadeMaterial7(HitInfo hitInfo, INOUT(PassableInfo) pld)
+{
+  const int primitiveID = hitInfo.primitiveID;
+  pld.color             = clamp(vec3(primitiveID / 36.0f, primitiveID / 9.0f, primitiveID / 18.0f), vec3(0.0f), vec3(1.0f));
+  pld.rayOrigin         = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
+  pld.rayDirection      = diffuseReflection(hitInfo.worldNormal, pld.rngState);
+  pld.rayHitSky         = false;
+}
+
+// Diffuse shells, with holes between them
+void shadeMaterial8(HitInfo hitInfo, INOUT(PassableInfo) pld)
+{
+  if(mod(length(hitInfo.objectPosition), 0.2f) >= 0.05f)
+  {
+    pld.color        = vec3(0.7f);
+    pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
+    pld.rayDirection = diffuseReflection(hitInfo.worldNormal, pld.rngState);
+  }
+  else
+  {
+    pld.color        = vec3(1.0f);
+    pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, -hitInfo.worldNormal);
+    pld.rayDirection = hitInfo.rayDirection;
+  }
+  pld.rayHitSky = false;
+}
+
+// Dispersive glass: reflects or refracts by the Fresnel term, with Schlick's
+// approximation. Its index of refraction follows Cauchy's equation, roughly
+// BK7's, at pld.wavelength: with SPECTRAL the path's hero wavelength, and
+// 550 nm for RGB renders, so they don't disperse. A reflected path keeps only
+// the hero wavelength too, since the Fresnel term that chose to reflect it
+// was the hero's.
+void shadeMaterial9(HitInfo hitInfo, INOUT(PassableInfo) pld)
+{
+  const float ior         = 1.5046f + 4200.0f / (pld.wavelength * pld.wavelength);
+  const float eta         = hitInfo.frontFace ? 1.0f / ior : ior;
+  const float cosIn       = -dot(hitInfo.rayDirection, hitInfo.worldNormal);
+  const float k           = 1.0f - eta * eta * (1.0f - cosIn * cosIn);
+  float       reflectance = 1.0f;  // Total internal reflection
+  if(k > 0.0f)
+  {
+    // With the angle on the side outside of the glass
+    const float cosOutside = hitInfo.frontFace ? cosIn : sqrt(k);
+    const float r0         = ((1.0f - ior) * (1.0f - ior)) / ((1.0f + ior) * (1.0f + ior));
+    reflectance            = r0 + (1.0f - r0) * pow(1.0f - cosOutside, 5.0f);
+  }
+
+  pld.color = vec3(1.0f);
+  if(stepAndOutputRNGFloat(pld.rngState) < reflectance)
+  {
+    pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, hitInfo.worldNormal);
+    pld.rayDirection = reflect(hitInfo.rayDirection, hitInfo.worldNormal);
+  }
+  else
+  {
+    pld.rayOrigin    = offsetPositionAlongNormal(hitInfo.worldPosition, -hitInfo.worldNormal);
+    pld.rayDirection = refract(hitInfo.rayDirection, hitInfo.worldNormal, eta);
+  }
+  pld.dispersed = true;
+  pld.rayHitSky = false;
+}
+
+// Shades a hit on `material`, for the backends that don't get a shader per material.
+void shadeMaterial(uint material, HitInfo hitInfo, INOUT(PassableInfo) pld)
+{
+  switch(material)
+  {
+    case 0: shadeMaterial0(hitInfo, pld); break;
+    case 1: shadeMaterial1(hitInfo, pld); break;
+    case 2: shadeMaterial2(hitInfo, pld); break;
+    case 3: shadeMaterial3(hitInfo, pld); break;
+    case 4: shadeMaterial4(hitInfo, pld); break;
+    case 5: shadeMaterial5(hitInfo, pld); break;
+    case 6: shadeMaterial6(hitInfo, pld); break;
+    case 7: shadeMaterial7(hitInfo, pld); break;
+    case 8: shadeMaterial8(hitInfo, pld); break;
+    default: shadeMaterial9(hitInfo, pld); break;
+  }
+}
+
+#ifdef __cplusplus
+}  // namespace shading
+#endif  // #ifdef __cplusplus
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_SHADING_LIBRARY_H
@@ -1,6 +1,7 @@
 // Copyright 2020-2024 NVIDIA Corporation
 // SPDX-License-Identifier: Apache-2.0
 #include <array>
+#include <cstring>
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
 #define TINYOBJLOADER_IMPLEMENTATION
@@ -14,10 +15,44 @@
 #include <nvvk/resourceallocator_vk.hpp>  // For NVVK memory allocators
 #include <nvvk/shaders_vk.hpp>            // For nvvk::createShaderModule
 
+#include "pipeline_cache.hpp"
+
 static const uint64_t render_width     = 800;
 static const uint64_t render_height    = 600;
+// These are passed to the compute shader as specialization constants, so they
+// can be tuned without recompiling the shader.
 static const uint32_t workgroup_width  = 16;
 static const uint32_t workgroup_height = 8;
+static const uint32_t num_samples      = 64;  // Samples per pixel
+static const uint32_t max_segments     = 32;  // Maximum number of segments traced per sample
+// The passes of the wavefront path tracer are one-dimensional, with this many invocations per workgroup.
+static const uint32_t wavefront_workgroup_size = workgroup_width * workgroup_height;
+
+// The push constants of the wavefront passes; must match wavefrontCommon.h.
+struct WavefrontPushConstants
+{
+  uint32_t sampleIndex;
+  uint32_t segment;
+};
+
+// The passes of the wavefront path tracer, in the order they run in; see shaders/wavefrontCommon.h.
+enum WavefrontPass
+{
+  eGenerate,
+  eStartSegment,
+  eExtend,
+  eSizeShading,
+  eShade,
+  eConnect,
+  eWavefrontPassCount
+};
+static const std::array<const char*, eWavefrontPassCount> wavefront_shaders{
+    "shaders/wavefrontGenerate.comp.glsl.spv", "shaders/wavefrontStartSegment.comp.glsl.spv",
+    "shaders/wavefrontExtend.comp.glsl.spv",   "shaders/wavefrontSizeShading.comp.glsl.spv",
+    "shaders/wavefrontShade.comp.glsl.spv",    "shaders/wavefrontConnect.comp.glsl.spv"};
+// The index of each queue in the queue counters and in the dispatch arguments, from wavefrontCommon.h
+static const uint32_t queue_hits   = 2;
+static const uint32_t queue_misses = 3;
 
 VkCommandBuffer AllocateAndBeginOneTimeCommandBuffer(VkDevice device, VkCommandPool cmdPool)
 {
@@ -50,6 +85,20 @@ VkDeviceAddress GetBufferDeviceAddress(VkDevice device, VkBuffer buffer)
 
 int main(int argc, const char** argv)
 {
+  // --wavefront traces with the wavefront passes instead of with the megakernel
+  bool wavefront = false;
+  for(int arg = 1; arg < argc; arg++)
+  {
+    if(strcmp(argv[arg], "--wavefront") == 0)
+    {
+      wavefront = true;
+    }
+    else
+    {
+      LOGW("Ignoring unknown argument %s.\n", argv[arg]);
+    }
+  }
+
   // Create the Vulkan context, consisting of an instance, device, physical device, and queues.
   nvvk::ContextCreateInfo deviceInfo;  // One can modify this to load different extensions or pick the Vulkan core version
   deviceInfo.apiMajor = 1;             // Specify the version of Vulkan we'll use
@@ -177,25 +226,77 @@ int main(int argc, const char** argv)
   }
   raytracingBuilder.buildTlas(instances, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
 
-  // Here's the list of bindings for the descriptor set layout, from raytrace.comp.glsl:
+  // The queues of the wavefront path tracer, from wavefrontCommon.h: their
+  // bindings, and the size of an element of each. Each queue array is a range
+  // of wavefrontBuffer; the ray queue arrays hold both ray queues.
+  struct WavefrontArray
+  {
+    uint32_t     binding;
+    VkDeviceSize elementSize;
+    VkDeviceSize numElements;
+    VkDeviceSize offset;
+  };
+  const VkDeviceSize            queueCapacity = render_width * render_height;  // One path per pixel
+  std::array<WavefrontArray, 11> wavefrontArrays{{
+      {4, sizeof(uint32_t), 4},                     // Queue counters: ray queues 0 and 1, hits, misses
+      {14, sizeof(VkDispatchIndirectCommand), 4},   // Dispatch arguments of the queues
+      {5, 3 * sizeof(float), 2 * queueCapacity},    // Ray origins
+      {6, 3 * sizeof(float), 2 * queueCapacity},    // Ray directions
+      {7, 3 * sizeof(float), 2 * queueCapacity},    // Ray colors
+      {8, sizeof(uint32_t), 2 * queueCapacity},     // Ray RNG states
+      {9, sizeof(uint32_t), 2 * queueCapacity},     // Ray pixels
+      {10, sizeof(uint32_t), queueCapacity},        // Hit rays
+      {11, sizeof(int32_t), queueCapacity},         // Hit primitives
+      {12, 2 * sizeof(float), queueCapacity},       // Hit barycentrics
+      {13, sizeof(uint32_t), queueCapacity},        // Miss rays
+  }};
+  nvvk::Buffer wavefrontBuffer;
+  if(wavefront)
+  {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(context.m_physicalDevice, &properties);
+    const VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+    VkDeviceSize       size      = 0;
+    for(WavefrontArray& array : wavefrontArrays)
+    {
+      array.offset = size;
+      size += (array.elementSize * array.numElements + alignment - 1) / alignment * alignment;
+    }
+    VkBufferCreateInfo wavefrontBufferInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                           .size  = size,
+                                           .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT};
+    wavefrontBuffer = allocator.createBuffer(wavefrontBufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  }
+
+  // Here's the list of bindings for the descriptor set layout, from shaderCommon.h:
   // 0 - a storage buffer (the buffer `buffer`)
   // 1 - an acceleration structure (the TLAS)
   // 2 - a storage buffer (the vertex buffer)
   // 3 - a storage buffer (the index buffer)
+  // 4 to 14 - storage buffers (the wavefront queue arrays), only written with --wavefront
   nvvk::DescriptorSetContainer descriptorSetContainer(context);
   descriptorSetContainer.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
   descriptorSetContainer.addBinding(1, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1, VK_SHADER_STAGE_COMPUTE_BIT);
   descriptorSetContainer.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
   descriptorSetContainer.addBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  for(const WavefrontArray& array : wavefrontArrays)
+  {
+    descriptorSetContainer.addBinding(array.binding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
   // Create a layout from the list of bindings
   descriptorSetContainer.initLayout();
   // Create a descriptor pool from the list of bindings with space for 1 set, and allocate that set
   descriptorSetContainer.initPool(1);
-  // Create a simple pipeline layout from the descriptor set layout:
-  descriptorSetContainer.initPipeLayout();
+  // Create a pipeline layout from the descriptor set layout, with the push
+  // constants of the wavefront passes (which the megakernel ignores):
+  VkPushConstantRange pushConstantRange{.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,  //
+                                        .offset     = 0,
+                                        .size       = sizeof(WavefrontPushConstants)};
+  descriptorSetContainer.initPipeLayout(1,                    // Number of push constant ranges
+                                        &pushConstantRange);  // Pointer to push constant ranges
 
   // Write values into the descriptor set.
-  std::array<VkWriteDescriptorSet, 4> writeDescriptorSets;
+  std::vector<VkWriteDescriptorSet> writeDescriptorSets(4);
   // 0
   VkDescriptorBufferInfo descriptorBufferInfo{.buffer = buffer.buffer,    // The VkBuffer object
                                               .range  = bufferSizeBytes};  // The length of memory to bind; offset is 0.
@@ -212,46 +313,155 @@ int main(int argc, const char** argv)
   // 3
   VkDescriptorBufferInfo indexDescriptorBufferInfo{.buffer = indexBuffer.buffer, .range = VK_WHOLE_SIZE};
   writeDescriptorSets[3] = descriptorSetContainer.makeWrite(0, 3, &indexDescriptorBufferInfo);
+  // 4 to 14
+  std::vector<VkDescriptorBufferInfo> wavefrontDescriptorBufferInfos(wavefrontArrays.size());
+  if(wavefront)
+  {
+    for(size_t i = 0; i < wavefrontArrays.size(); i++)
+    {
+      const WavefrontArray& array       = wavefrontArrays[i];
+      wavefrontDescriptorBufferInfos[i] = {.buffer = wavefrontBuffer.buffer,  //
+                                           .offset = array.offset,
+                                           .range  = array.elementSize * array.numElements};
+      writeDescriptorSets.push_back(descriptorSetContainer.makeWrite(0, array.binding, &wavefrontDescriptorBufferInfos[i]));
+    }
+  }
   vkUpdateDescriptorSets(context,                                            // The context
                          static_cast<uint32_t>(writeDescriptorSets.size()),  // Number of VkWriteDescriptorSet objects
                          writeDescriptorSets.data(),                         // Pointer to VkWriteDescriptorSet objects
                          0, nullptr);  // An array of VkCopyDescriptorSet objects (unused)
 
-  // Shader loading and pipeline creation
-  VkShaderModule rayTraceModule =
-      nvvk::createShaderModule(context, nvh::loadFile("shaders/raytrace.comp.glsl.spv", true, searchPaths));
-
-  // Describes the entrypoint and the stage to use for this shader module in the pipeline
-  VkPipelineShaderStageCreateInfo shaderStageCreateInfo{.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-                                                        .stage  = VK_SHADER_STAGE_COMPUTE_BIT,
-                                                        .module = rayTraceModule,
-                                                        .pName  = "main"};
-
-  // Create the compute pipeline
-  VkComputePipelineCreateInfo pipelineCreateInfo{.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-                                                 .stage  = shaderStageCreateInfo,
-                                                 .layout = descriptorSetContainer.getPipeLayout()};
-  // Don't modify flags, basePipelineHandle, or basePipelineIndex
-  VkPipeline computePipeline;
-  NVVK_CHECK(vkCreateComputePipelines(context,                 // Device
-                                      VK_NULL_HANDLE,          // Pipeline cache (uses default)
-                                      1, &pipelineCreateInfo,  // Compute pipeline create info
-                                      nullptr,                 // Allocator (uses default)
-                                      &computePipeline));      // Output
+  // Shader loading and pipeline creation: the megakernel, or the passes of the wavefront path tracer
+  std::vector<const char*> shaderFiles{"shaders/raytrace.comp.glsl.spv"};
+  if(wavefront)
+  {
+    shaderFiles.assign(wavefront_shaders.begin(), wavefront_shaders.end());
+  }
+  std::vector<VkShaderModule> shaderModules;
+  for(const char* shaderFile : shaderFiles)
+  {
+    shaderModules.push_back(nvvk::createShaderModule(context, nvh::loadFile(shaderFile, true, searchPaths)));
+  }
+
+  // The values of the shaders' specialization constants, in the order of their constant IDs:
+  const std::array<uint32_t, 5> specializationData{workgroup_width, workgroup_height, num_samples, max_segments,
+                                                   wavefront_workgroup_size};
+  std::array<VkSpecializationMapEntry, 5> specializationMapEntries;
+  for(uint32_t constantID = 0; constantID < specializationMapEntries.size(); constantID++)
+  {
+    specializationMapEntries[constantID] = {.constantID = constantID,                       //
+                                            .offset     = constantID * sizeof(uint32_t),  //
+                                            .size       = sizeof(uint32_t)};
+  }
+  VkSpecializationInfo specializationInfo{.mapEntryCount = static_cast<uint32_t>(specializationMapEntries.size()),
+                                          .pMapEntries   = specializationMapEntries.data(),
+                                          .dataSize      = sizeof(specializationData),
+                                          .pData         = specializationData.data()};
+
+  // Create the compute pipelines. They're compiled through a pipeline cache that's
+  // loaded from and saved to disk, so that later runs can skip compilation.
+  const std::string pipelineCacheFilename = PROJECT_NAME "_pipeline_cache.bin";
+  VkPipelineCache   pipelineCache         = loadPipelineCache(context, context.m_physicalDevice, pipelineCacheFilename);
+  std::vector<VkComputePipelineCreateInfo> pipelineCreateInfos;
+  for(VkShaderModule shaderModule : shaderModules)
+  {
+    // Describes the entrypoint and the stage to use for this shader module in the pipeline
+    VkPipelineShaderStageCreateInfo shaderStageCreateInfo{.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                                                          .stage  = VK_SHADER_STAGE_COMPUTE_BIT,
+                                                          .module = shaderModule,
+                                                          .pName  = "main",
+                                                          .pSpecializationInfo = &specializationInfo};
+    pipelineCreateInfos.push_back({.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+                                   .stage  = shaderStageCreateInfo,
+                                   .layout = descriptorSetContainer.getPipeLayout()});
+    // Don't modify flags, basePipelineHandle, or basePipelineIndex
+  }
+  std::vector<VkPipeline> computePipelines(pipelineCreateInfos.size());
+  NVVK_CHECK(vkCreateComputePipelines(context,                                             // Device
+                                      pipelineCache,                                       // Pipeline cache
+                                      static_cast<uint32_t>(pipelineCreateInfos.size()),  // Number of pipelines
+                                      pipelineCreateInfos.data(),                          // Compute pipeline create infos
+                                      nullptr,                                             // Allocator (uses default)
+                                      computePipelines.data()));                           // Output
 
   // Create and start recording a command buffer
   VkCommandBuffer cmdBuffer = AllocateAndBeginOneTimeCommandBuffer(context, cmdPool);
 
-  // Bind the compute shader pipeline
-  vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
   // Bind the descriptor set
   VkDescriptorSet descriptorSet = descriptorSetContainer.getSet(0);
   vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, descriptorSetContainer.getPipeLayout(), 0, 1,
                           &descriptorSet, 0, nullptr);
 
-  // Run the compute shader with enough workgroups to cover the entire buffer:
-  vkCmdDispatch(cmdBuffer, (uint32_t(render_width) + workgroup_width - 1) / workgroup_width,
-                (uint32_t(render_height) + workgroup_height - 1) / workgroup_height, 1);
+  if(!wavefront)
+  {
+    // Bind the compute shader pipeline
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelines[0]);
+
+    // Run the compute shader with enough workgroups to cover the entire buffer:
+    vkCmdDispatch(cmdBuffer, (uint32_t(render_width) + workgroup_width - 1) / workgroup_width,
+                  (uint32_t(render_height) + workgroup_height - 1) / workgroup_height, 1);
+  }
+  else
+  {
+    // The wavefront path tracer traces a sample of every pixel at a time, and
+    // each segment of it takes three passes: extend, then shade and connect
+    // (which don't depend on each other); see shaders/wavefrontCommon.h.
+    // These are dispatched indirectly, sized to their queues by single-invocation
+    // passes, so that once most paths have ended, so have most of their workgroups.
+    // Each pass reads what the previous ones wrote:
+    auto passBarrier = [&]() {
+      const VkPipelineStageFlags srcStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+      const VkPipelineStageFlags dstStages = srcStages | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+      VkMemoryBarrier memoryBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                                    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+                                                     | VK_ACCESS_INDIRECT_COMMAND_READ_BIT};
+      vkCmdPipelineBarrier(cmdBuffer, srcStages, dstStages, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    };
+    auto bindPass = [&](WavefrontPass pass, const WavefrontPushConstants& pushConstants) {
+      vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelines[pass]);
+      vkCmdPushConstants(cmdBuffer, descriptorSetContainer.getPipeLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                         sizeof(WavefrontPushConstants), &pushConstants);
+    };
+    // Runs `pass` over the entries of `queue`
+    const VkDeviceSize dispatchArgsOffset = wavefrontArrays[1].offset;  // Binding 14
+    auto dispatchQueuePass = [&](WavefrontPass pass, const WavefrontPushConstants& pushConstants, uint32_t queue) {
+      bindPass(pass, pushConstants);
+      vkCmdDispatchIndirect(cmdBuffer, wavefrontBuffer.buffer, dispatchArgsOffset + queue * sizeof(VkDispatchIndirectCommand));
+    };
+    // Runs `pass` as a single invocation
+    auto dispatchSinglePass = [&](WavefrontPass pass, const WavefrontPushConstants& pushConstants) {
+      bindPass(pass, pushConstants);
+      vkCmdDispatch(cmdBuffer, 1, 1, 1);
+    };
+
+    // The connect pass adds each sample to the image
+    vkCmdFillBuffer(cmdBuffer, buffer.buffer, 0, bufferSizeBytes, 0);
+    for(uint32_t sampleIndex = 0; sampleIndex < num_samples; sampleIndex++)
+    {
+      // Every pixel starts a path, so this pass covers the image
+      passBarrier();
+      bindPass(eGenerate, {.sampleIndex = sampleIndex, .segment = 0});
+      vkCmdDispatch(cmdBuffer, uint32_t((queueCapacity + wavefront_workgroup_size - 1) / wavefront_workgroup_size), 1, 1);
+      for(uint32_t segment = 0; segment < max_segments; segment++)
+      {
+        const WavefrontPushConstants pushConstants{.sampleIndex = sampleIndex, .segment = segment};
+        passBarrier();
+        dispatchSinglePass(eStartSegment, pushConstants);
+        passBarrier();
+        dispatchQueuePass(eExtend, pushConstants, segment % 2);
+        passBarrier();
+        dispatchSinglePass(eSizeShading, pushConstants);
+        passBarrier();
+        // Hits on the last segment end their paths, like in the megakernel
+        if(segment + 1 < max_segments)
+        {
+          dispatchQueuePass(eShade, pushConstants, queue_hits);
+        }
+        dispatchQueuePass(eConnect, pushConstants, queue_misses);
+      }
+    }
+  }
 
   // Add a command that says "Make it so that memory writes by the compute shader
   // are available to read from the CPU." (In other words, "Flush the GPU caches
@@ -276,13 +486,25 @@ int main(int argc, const char** argv)
   stbi_write_hdr("out.hdr", render_width, render_height, 3, reinterpret_cast<float*>(data));
   allocator.unmap(buffer);
 
-  vkDestroyPipeline(context, computePipeline, nullptr);
-  vkDestroyShaderModule(context, rayTraceModule, nullptr);
+  if(!savePipelineCache(context, context.m_physicalDevice, pipelineCache, pipelineCacheFilename))
+  {
+    LOGW("Could not save the pipeline cache to %s.\n", pipelineCacheFilename.c_str());
+  }
+  vkDestroyPipelineCache(context, pipelineCache, nullptr);
+  for(VkPipeline computePipeline : computePipelines)
+  {
+    vkDestroyPipeline(context, computePipeline, nullptr);
+  }
+  for(VkShaderModule shaderModule : shaderModules)
+  {
+    vkDestroyShaderModule(context, shaderModule, nullptr);
+  }
   descriptorSetContainer.deinit();
   raytracingBuilder.destroy();
   allocator.destroy(vertexBuffer);
   allocator.destroy(indexBuffer);
   vkDestroyCommandPool(context, cmdPool, nullptr);
+  allocator.destroy(wavefrontBuffer);
   allocator.destroy(buffer);
   allocator.deinit();
   context.deinit();  // Don't forget to clean up at the end of the program!
@@ -1,107 +1,20 @@
 // Copyright 2020 NVIDIA Corporation
 // SPDX-License-Identifier: Apache-2.0
 #version 460
-#extension GL_EXT_scalar_block_layout : require
 #extension GL_EXT_ray_query : require
+#extension GL_GOOGLE_include_directive : require
 
-layout(local_size_x = 16, local_size_y = 8, local_size_z = 1) in;
+// The megakernel path tracer: each invocation traces all samples of a pixel,
+// running the whole bounce loop itself. See wavefrontCommon.h for the
+// alternative that splits the loop into passes.
+#include "shaderCommon.h"
 
-// The scalar layout qualifier here means to align types according to the alignment
-// of their scalar components, instead of e.g. padding them to std140 rules.
-layout(binding = 0, set = 0, scalar) buffer storageBuffer
-{
-  vec3 imageData[];
-};
-layout(binding = 1, set = 0) uniform accelerationStructureEXT tlas;
-layout(binding = 2, set = 0, scalar) buffer Vertices
-{
-  vec3 vertices[];
-};
-layout(binding = 3, set = 0, scalar) buffer Indices
-{
-  uint indices[];
-};
-
-// Steps the RNG and returns a floating-point value between 0 and 1 inclusive.
-float stepAndOutputRNGFloat(inout uint rngState)
-{
-  // Condensed version of pcg_output_rxs_m_xs_32_32, with simple conversion to floating-point [0,1].
-  rngState  = rngState * 747796405 + 1;
-  uint word = ((rngState >> ((rngState >> 28) + 4)) ^ rngState) * 277803737;
-  word      = (word >> 22) ^ word;
-  return float(word) / 4294967295.0f;
-}
-
-// Returns the color of the sky in a given direction (in linear color space)
-vec3 skyColor(vec3 direction)
-{
-  // +y in world space is up, so:
-  if(direction.y > 0.0f)
-  {
-    return mix(vec3(1.0f), vec3(0.25f, 0.5f, 1.0f), direction.y);
-  }
-  else
-  {
-    return vec3(0.03f);
-  }
-}
-
-struct HitInfo
-{
-  vec3 color;
-  vec3 worldPosition;
-  vec3 worldNormal;
-};
-
-HitInfo getObjectHitInfo(rayQueryEXT rayQuery)
-{
-  HitInfo result;
-  // Get the ID of the triangle
-  const int primitiveID = rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, true);
-
-  // Get the indices of the vertices of the triangle
-  const uint i0 = indices[3 * primitiveID + 0];
-  const uint i1 = indices[3 * primitiveID + 1];
-  const uint i2 = indices[3 * primitiveID + 2];
-
-  // Get the vertices of the triangle
-  const vec3 v0 = vertices[i0];
-  const vec3 v1 = vertices[i1];
-  const vec3 v2 = vertices[i2];
-
-  // Get the barycentric coordinates of the intersection
-  vec3 barycentrics = vec3(0.0, rayQueryGetIntersectionBarycentricsEXT(rayQuery, true));
-  barycentrics.x    = 1.0 - barycentrics.y - barycentrics.z;
-
-  // Compute the coordinates of the intersection
-  const vec3 objectPos = v0 * barycentrics.x + v1 * barycentrics.y + v2 * barycentrics.z;
-  // For the main tutorial, object space is the same as world space:
-  result.worldPosition = objectPos;
-
-  // Compute the normal of the triangle in object space, using the right-hand rule:
-  //    v2      .
-  //    |\      .
-  //    | \     .
-  //    |/ \    .
-  //    /   \   .
-  //   /|    \  .
-  //  L v0---v1 .
-  // n
-  const vec3 objectNormal = normalize(cross(v1 - v0, v2 - v0));
-  // For the main tutorial, object space is the same as world space:
-  result.worldNormal = objectNormal;
-
-  result.color = vec3(0.7f);
-
-  return result;
-}
+// The workgroup size is a specialization constant too, like the loop bounds
+// in shaderCommon.h.
+layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z = 1) in;
 
 void main()
 {
-  // The resolution of the buffer, which in this case is a hardcoded vector
-  // of 2 unsigned integers:
-  const uvec2 resolution = uvec2(800, 600);
-
   // Get the coordinates of the pixel for this invocation:
   //
   // .-------.-> x
@@ -121,44 +34,19 @@ void main()
   // State of the random number generator.
   uint rngState = resolution.x * pixel.y + pixel.x;  // Initial seed
 
-  // This scene uses a right-handed coordinate system like the OBJ file format, where the
-  // +x axis points right, the +y axis points up, and the -z axis points into the screen.
-  // The camera is located at (-0.001, 1, 6).
-  const vec3 cameraOrigin = vec3(-0.001, 1.0, 6.0);
-  // Define the field of view by the vertical slope of the topmost rays:
-  const float fovVerticalSlope = 1.0 / 5.0;
-
   // The sum of the colors of all of the samples.
   vec3 summedPixelColor = vec3(0.0);
 
-  // Limit the kernel to trace at most 64 samples.
-  const int NUM_SAMPLES = 64;
+  // Limit the kernel to trace at most NUM_SAMPLES samples.
   for(int sampleIdx = 0; sampleIdx < NUM_SAMPLES; sampleIdx++)
   {
-    // Rays always originate at the camera for now. In the future, they'll
-    // bounce around the scene.
-    vec3 rayOrigin = cameraOrigin;
-    // Compute the direction of the ray for this pixel. To do this, we first
-    // transform the screen coordinates to look like this, where a is the
-    // aspect ratio (width/height) of the screen:
-    //           1
-    //    .------+------.
-    //    |      |      |
-    // -a + ---- 0 ---- + a
-    //    |      |      |
-    //    '------+------'
-    //          -1
-    const vec2 randomPixelCenter = vec2(pixel) + vec2(stepAndOutputRNGFloat(rngState), stepAndOutputRNGFloat(rngState));
-    const vec2 screenUV          = vec2((2.0 * randomPixelCenter.x - resolution.x) / resolution.y,    //
-                               -(2.0 * randomPixelCenter.y - resolution.y) / resolution.y);  // Flip the y axis
-    // Create a ray direction:
-    vec3 rayDirection = vec3(fovVerticalSlope * screenUV.x, fovVerticalSlope * screenUV.y, -1.0);
-    rayDirection      = normalize(rayDirection);
+    vec3 rayOrigin, rayDirection;
+    generateCameraRay(pixel, rngState, rayOrigin, rayDirection);
 
     vec3 accumulatedRayColor = vec3(1.0);  // The amount of light that made it to the end of the current ray.
 
-    // Limit the kernel to trace at most 32 segments.
-    for(int tracedSegments = 0; tracedSegments < 32; tracedSegments++)
+    // Limit the kernel to trace at most MAX_SEGMENTS segments.
+    for(int tracedSegments = 0; tracedSegments < MAX_SEGMENTS; tracedSegments++)
     {
       // Trace the ray and see if and where it intersects the scene!
       // First, initialize a ray query object:
@@ -183,27 +71,10 @@ void main()
       if(rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionTriangleEXT)
       {
         // Ray hit a triangle
-        HitInfo hitInfo = getObjectHitInfo(rayQuery);
-
-        // Apply color absorption
-        accumulatedRayColor *= hitInfo.color;
-
-        // Flip the normal so it points against the ray direction:
-        hitInfo.worldNormal = faceforward(hitInfo.worldNormal, rayDirection, hitInfo.worldNormal);
-
-        // Start a new ray at the hit position, but offset it slightly along the normal:
-        rayOrigin = hitInfo.worldPosition + 0.0001 * hitInfo.worldNormal;
-
-        // For a random diffuse bounce direction, we follow the approach of
-        // Ray Tracing in One Weekend, and generate a random point on a sphere
-        // of radius 1 centered at the normal. This uses the random_unit_vector
-        // function from chapter 8.5:
-        const float theta = 6.2831853 * stepAndOutputRNGFloat(rngState);  // Random in [0, 2pi]
-        const float u     = 2.0 * stepAndOutputRNGFloat(rngState) - 1.0;  // Random in [-1, 1]
-        const float r     = sqrt(1.0 - u * u);
-        rayDirection      = hitInfo.worldNormal + vec3(r * cos(theta), r * sin(theta), u);
-        // Then normalize the ray direction:
-        rayDirection = normalize(rayDirection);
+        const HitInfo hitInfo = getObjectHitInfo(rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, true),
+                                                 rayQueryGetIntersectionBarycentricsEXT(rayQuery, true),  //
+                                                 rayDirection);
+        bounceRay(hitInfo, rngState, rayOrigin, rayDirection, accumulatedRayColor);
       }
       else
       {
@@ -223,4 +94,4 @@ void main()
   // Get the index of this invocation in the buffer:
   uint linearIndex       = resolution.x * pixel.y + pixel.x;
   imageData[linearIndex] = summedPixelColor / float(NUM_SAMPLES);  // Take the average
-}
\ No newline at end of file
+}
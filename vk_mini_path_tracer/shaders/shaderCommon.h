@@ -0,0 +1,151 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Common GLSL file of the megakernel (raytrace.comp.glsl) and of the passes
+// of the wavefront path tracer (wavefront*.comp.glsl): the scene bindings, the
+// specialization constants, and the camera, sky and surface functions. The
+// RNG and the material come from the shading library
+// (shared/shaders/shadingLibrary.h).
+#ifndef VK_MINI_PATH_TRACER_SHADER_COMMON_H
+#define VK_MINI_PATH_TRACER_SHADER_COMMON_H
+
+#extension GL_EXT_scalar_block_layout : require
+#include "../../shared/shaders/shadingLibrary.h"
+
+// The loop bounds are specialization constants, set by main.cpp when it
+// creates the pipelines.
+layout(constant_id = 2) const int NUM_SAMPLES  = 64;
+layout(constant_id = 3) const int MAX_SEGMENTS = 32;
+
+// The scalar layout qualifier here means to align types according to the alignment
+// of their scalar components, instead of e.g. padding them to std140 rules.
+layout(binding = 0, set = 0, scalar) buffer storageBuffer
+{
+  vec3 imageData[];
+};
+layout(binding = 1, set = 0) uniform accelerationStructureEXT tlas;
+layout(binding = 2, set = 0, scalar) buffer Vertices
+{
+  vec3 vertices[];
+};
+layout(binding = 3, set = 0, scalar) buffer Indices
+{
+  uint indices[];
+};
+
+// The resolution of the buffer, which in this case is a hardcoded vector
+// of 2 unsigned integers:
+const uvec2 resolution = uvec2(800, 600);
+
+// Returns the color of the sky in a given direction (in linear color space)
+vec3 skyColor(vec3 direction)
+{
+  // +y in world space is up, so:
+  if(direction.y > 0.0f)
+  {
+    return mix(vec3(1.0f), vec3(0.25f, 0.5f, 1.0f), direction.y);
+  }
+  else
+  {
+    return vec3(0.03f);
+  }
+}
+
+// Returns the camera ray through a random point of `pixel`.
+void generateCameraRay(uvec2 pixel, inout uint rngState, out vec3 rayOrigin, out vec3 rayDirection)
+{
+  // This scene uses a right-handed coordinate system like the OBJ file format, where the
+  // +x axis points right, the +y axis points up, and the -z axis points into the screen.
+  // The camera is located at (-0.001, 1, 6).
+  const vec3 cameraOrigin = vec3(-0.001, 1.0, 6.0);
+  // Define the field of view by the vertical slope of the topmost rays:
+  const float fovVerticalSlope = 1.0 / 5.0;
+
+  // Rays always originate at the camera for now. In the future, they'll
+  // bounce around the scene.
+  rayOrigin = cameraOrigin;
+  // Compute the direction of the ray for this pixel. To do this, we first
+  // transform the screen coordinates to look like this, where a is the
+  // aspect ratio (width/height) of the screen:
+  //           1
+  //    .------+------.
+  //    |      |      |
+  // -a + ---- 0 ---- + a
+  //    |      |      |
+  //    '------+------'
+  //          -1
+  const vec2 randomPixelCenter = vec2(pixel) + vec2(stepAndOutputRNGFloat(rngState), stepAndOutputRNGFloat(rngState));
+  const vec2 screenUV          = vec2((2.0 * randomPixelCenter.x - resolution.x) / resolution.y,    //
+                             -(2.0 * randomPixelCenter.y - resolution.y) / resolution.y);  // Flip the y axis
+  // Create a ray direction:
+  rayDirection = vec3(fovVerticalSlope * screenUV.x, fovVerticalSlope * screenUV.y, -1.0);
+  rayDirection = normalize(rayDirection);
+}
+
+// Returns the surface at the given barycentric coordinates (those of vertices
+// 1 and 2) of triangle `primitiveID`, hit by a ray along `rayDirection`.
+HitInfo getObjectHitInfo(int primitiveID, vec2 hitBarycentrics, vec3 rayDirection)
+{
+  HitInfo result;
+  result.primitiveID  = primitiveID;
+  result.rayDirection = rayDirection;
+
+  // Get the indices of the vertices of the triangle
+  const uint i0 = indices[3 * primitiveID + 0];
+  const uint i1 = indices[3 * primitiveID + 1];
+  const uint i2 = indices[3 * primitiveID + 2];
+
+  // Get the vertices of the triangle
+  const vec3 v0 = vertices[i0];
+  const vec3 v1 = vertices[i1];
+  const vec3 v2 = vertices[i2];
+
+  // Get the barycentric coordinates of the intersection
+  vec3 barycentrics = vec3(0.0, hitBarycentrics);
+  barycentrics.x    = 1.0 - barycentrics.y - barycentrics.z;
+
+  // Compute the coordinates of the intersection
+  result.objectPosition = v0 * barycentrics.x + v1 * barycentrics.y + v2 * barycentrics.z;
+  // For the main tutorial, object space is the same as world space:
+  result.worldPosition = result.objectPosition;
+
+  // Compute the normal of the triangle in object space, using the right-hand rule:
+  //    v2      .
+  //    |\      .
+  //    | \     .
+  //    |/ \    .
+  //    /   \   .
+  //   /|    \  .
+  //  L v0---v1 .
+  // n
+  const vec3 objectNormal = normalize(cross(v1 - v0, v2 - v0));
+  // For the main tutorial, object space is the same as world space:
+  result.worldNormal = objectNormal;
+
+  // Flip the normal so it points against the ray direction:
+  result.frontFace   = dot(result.worldNormal, rayDirection) < 0.0;
+  result.worldNormal = faceforward(result.worldNormal, rayDirection, result.worldNormal);
+
+  return result;
+}
+
+// Absorbs the color of the surface the ray hit, and bounces the ray off it.
+// Every object of the main tutorial has the diffuse material 0.
+void bounceRay(HitInfo hitInfo, inout uint rngState, inout vec3 rayOrigin, inout vec3 rayDirection, inout vec3 accumulatedRayColor)
+{
+  PassableInfo pld;
+  pld.rngState   = rngState;
+  pld.wavelength = 550.0;  // The main tutorial renders in RGB
+  pld.dispersed  = false;
+  shadeMaterial0(hitInfo, pld);
+
+  // Apply color absorption
+  accumulatedRayColor *= pld.color;
+
+  // Start a new segment
+  rngState     = pld.rngState;
+  rayOrigin    = pld.rayOrigin;
+  rayDirection = pld.rayDirection;
+}
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_SHADER_COMMON_H
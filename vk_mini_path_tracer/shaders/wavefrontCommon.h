@@ -0,0 +1,132 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+
+// Common file of the passes of the wavefront path tracer (--wavefront). In
+// the megakernel, an invocation runs all segments of its paths, so a warp
+// stays busy until its longest path ends. The wavefront path tracer instead
+// traces one sample of every pixel at a time, a segment at a time, and each
+// pass works on a queue of the paths that need it:
+// - wavefrontGenerate.comp.glsl starts a path per pixel at the camera, filling
+//   ray queue 0;
+// - then, for each segment, wavefrontExtend.comp.glsl traces the rays of the
+//   current ray queue and appends them to the hit queue or to the miss queue;
+//   wavefrontShade.comp.glsl bounces the hits off their surfaces and appends
+//   the bounced rays of the paths that continue to the other ray queue; and wavefrontConnect.comp.glsl
+//   adds the sky color the missed rays carry to their pixels.
+// Appending compacts the queues, so finished paths take no lanes in later
+// passes. The ray queues alternate between segments.
+// The passes over a queue are dispatched indirectly, with as many workgroups
+// as the queue needs: wavefrontStartSegment.comp.glsl sizes the extend pass
+// and empties the queues the segment appends to, and
+// wavefrontSizeShading.comp.glsl sizes the shade and connect passes.
+// All queues are structures of arrays, so that each pass only reads the
+// fields it needs, in coalesced loads.
+#ifndef VK_MINI_PATH_TRACER_WAVEFRONT_COMMON_H
+#define VK_MINI_PATH_TRACER_WAVEFRONT_COMMON_H
+
+#extension GL_KHR_shader_subgroup_ballot : require
+#include "shaderCommon.h"
+
+// Each pass is one-dimensional, over the entries of its queue.
+layout(local_size_x_id = 4, local_size_y = 1, local_size_z = 1) in;
+
+// A queue holds at most one path per pixel.
+const uint QUEUE_CAPACITY = resolution.x * resolution.y;
+
+// Indices of the counters of the queues; the ray queues are 0 and 1.
+const uint QUEUE_HITS   = 2;
+const uint QUEUE_MISSES = 3;
+const uint NUM_QUEUES   = 4;
+
+layout(binding = 4, set = 0, scalar) buffer QueueCounts
+{
+  uint queueCounts[NUM_QUEUES];
+};
+
+// The VkDispatchIndirectCommand of each queue, with one invocation per entry.
+layout(binding = 14, set = 0, scalar) buffer DispatchArgs
+{
+  uvec3 dispatchArgs[NUM_QUEUES];
+};
+
+// The ray queues. Entry i of ray queue q is element q * QUEUE_CAPACITY + i.
+layout(binding = 5, set = 0, scalar) buffer RayOrigins
+{
+  vec3 rayOrigins[];
+};
+layout(binding = 6, set = 0, scalar) buffer RayDirections
+{
+  vec3 rayDirections[];
+};
+layout(binding = 7, set = 0, scalar) buffer RayColors
+{
+  vec3 rayColors[];  // The amount of light that makes it to the end of the ray
+};
+layout(binding = 8, set = 0, scalar) buffer RayRngStates
+{
+  uint rayRngStates[];
+};
+layout(binding = 9, set = 0, scalar) buffer RayPixels
+{
+  uint rayPixels[];  // The linear index of the pixel of the path
+};
+
+// The hit queue; hitRays are entries of the current ray queue.
+layout(binding = 10, set = 0, scalar) buffer HitRays
+{
+  uint hitRays[];
+};
+layout(binding = 11, set = 0, scalar) buffer HitPrimitives
+{
+  int hitPrimitives[];
+};
+layout(binding = 12, set = 0, scalar) buffer HitBarycentrics
+{
+  vec2 hitBarycentrics[];
+};
+
+// The miss queue, of entries of the current ray queue.
+layout(binding = 13, set = 0, scalar) buffer MissRays
+{
+  uint missRays[];
+};
+
+// Must match WavefrontPushConstants in main.cpp.
+layout(push_constant) uniform PushConsts
+{
+  uint sampleIndex;
+  uint segment;
+}
+pushConstants;
+
+// The ray queue the segment reads, and the one its bounced rays go to.
+uint currentRayQueue()
+{
+  return pushConstants.segment % 2;
+}
+uint nextRayQueue()
+{
+  return 1 - currentRayQueue();
+}
+
+// Sets the dispatch arguments of `queue` from its number of entries.
+void sizeDispatch(uint queue)
+{
+  dispatchArgs[queue] = uvec3((queueCounts[queue] + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x, 1, 1);
+}
+
+// Returns the entry `queue` has for this invocation if `append` is true.
+// All active invocations must call this, so that each subgroup increments the
+// counter with one atomic operation instead of one per invocation.
+uint queueAppend(uint queue, bool append)
+{
+  const uvec4 ballot = subgroupBallot(append);
+  uint        first  = 0;
+  if(subgroupElect())
+  {
+    first = atomicAdd(queueCounts[queue], subgroupBallotBitCount(ballot));
+  }
+  return subgroupBroadcastFirst(first) + subgroupBallotExclusiveBitCount(ballot);
+}
+
+#endif  // #ifndef VK_MINI_PATH_TRACER_WAVEFRONT_COMMON_H
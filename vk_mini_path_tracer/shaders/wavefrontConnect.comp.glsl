@@ -0,0 +1,23 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_EXT_ray_query : require
+#extension GL_GOOGLE_include_directive : require
+
+// Ends the path of each ray of the miss queue, adding the sky color it
+// carries to its pixel. A pixel has a single path per sample, so the pixels
+// of the queue are all different.
+#include "wavefrontCommon.h"
+
+void main()
+{
+  const uint entry = gl_GlobalInvocationID.x;
+  if(entry >= queueCounts[QUEUE_MISSES])
+  {
+    return;
+  }
+  const uint ray = currentRayQueue() * QUEUE_CAPACITY + missRays[entry];
+
+  // Each sample adds its share of the average
+  imageData[rayPixels[ray]] += rayColors[ray] * skyColor(rayDirections[ray]) / float(NUM_SAMPLES);
+}
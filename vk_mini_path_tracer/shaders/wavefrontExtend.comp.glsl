@@ -0,0 +1,40 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_EXT_ray_query : require
+#extension GL_GOOGLE_include_directive : require
+
+// Traces each ray of the current ray queue, and appends it to the hit queue
+// or to the miss queue.
+#include "wavefrontCommon.h"
+
+void main()
+{
+  const uint entry = gl_GlobalInvocationID.x;
+  if(entry >= queueCounts[currentRayQueue()])
+  {
+    return;
+  }
+  const uint ray = currentRayQueue() * QUEUE_CAPACITY + entry;
+
+  rayQueryEXT rayQuery;
+  rayQueryInitializeEXT(rayQuery, tlas, gl_RayFlagsOpaqueEXT, 0xFF, rayOrigins[ray], 0.0, rayDirections[ray], 10000.0);
+  while(rayQueryProceedEXT(rayQuery))
+  {
+  }
+  const bool hit = (rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionTriangleEXT);
+
+  // Both calls are made by all invocations, see queueAppend
+  const uint hitEntry  = queueAppend(QUEUE_HITS, hit);
+  const uint missEntry = queueAppend(QUEUE_MISSES, !hit);
+  if(hit)
+  {
+    hitRays[hitEntry]         = entry;
+    hitPrimitives[hitEntry]   = rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, true);
+    hitBarycentrics[hitEntry] = rayQueryGetIntersectionBarycentricsEXT(rayQuery, true);
+  }
+  else
+  {
+    missRays[missEntry] = entry;
+  }
+}
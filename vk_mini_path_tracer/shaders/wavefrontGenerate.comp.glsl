@@ -0,0 +1,34 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_EXT_ray_query : require
+#extension GL_GOOGLE_include_directive : require
+
+// Starts sample pushConstants.sampleIndex of each pixel at the camera, in ray
+// queue 0, which the first segment reads.
+#include "wavefrontCommon.h"
+
+void main()
+{
+  const uint pixelIndex = gl_GlobalInvocationID.x;
+  if(pixelIndex >= QUEUE_CAPACITY)
+  {
+    return;
+  }
+  if(pixelIndex == 0)
+  {
+    queueCounts[0] = QUEUE_CAPACITY;
+  }
+
+  const uvec2 pixel    = uvec2(pixelIndex % resolution.x, pixelIndex / resolution.x);
+  uint        rngState = pushConstants.sampleIndex * QUEUE_CAPACITY + pixelIndex;  // Initial seed, different for each sample
+  vec3        rayOrigin, rayDirection;
+  generateCameraRay(pixel, rngState, rayOrigin, rayDirection);
+
+  // The paths start in the same order as the pixels, so no counter is needed
+  rayOrigins[pixelIndex]    = rayOrigin;
+  rayDirections[pixelIndex] = rayDirection;
+  rayColors[pixelIndex]     = vec3(1.0);
+  rayRngStates[pixelIndex]  = rngState;
+  rayPixels[pixelIndex]     = pixelIndex;
+}
@@ -0,0 +1,54 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_EXT_ray_query : require
+#extension GL_GOOGLE_include_directive : require
+
+// Bounces each ray of the hit queue off the surface it hit, and appends the
+// bounced ray to the next ray queue unless its path ends here. A path ends
+// when it no longer carries any light, and after the first few segments by
+// Russian roulette, which keeps a path with a probability of its brightest
+// channel and divides the survivors by it, so the estimate stays unbiased
+// while dim paths stop taking lanes in the later passes. main.cpp skips this
+// pass on the last segment, whose hits end their paths.
+#include "wavefrontCommon.h"
+
+// Paths always survive their first segments, which carry most of the light.
+const uint ROULETTE_START_SEGMENT = 3;
+
+void main()
+{
+  const uint entry = gl_GlobalInvocationID.x;
+  if(entry >= queueCounts[QUEUE_HITS])
+  {
+    return;
+  }
+  const uint ray = currentRayQueue() * QUEUE_CAPACITY + hitRays[entry];
+
+  vec3          rayOrigin           = rayOrigins[ray];
+  vec3          rayDirection        = rayDirections[ray];
+  vec3          accumulatedRayColor = rayColors[ray];
+  uint          rngState            = rayRngStates[ray];
+  const HitInfo hitInfo             = getObjectHitInfo(hitPrimitives[entry], hitBarycentrics[entry], rayDirection);
+  bounceRay(hitInfo, rngState, rayOrigin, rayDirection, accumulatedRayColor);
+
+  // Russian roulette for path termination
+  const float survival = min(max(accumulatedRayColor.r, max(accumulatedRayColor.g, accumulatedRayColor.b)), 1.0);
+  bool        continues = (survival > 0.0);
+  if(continues && pushConstants.segment >= ROULETTE_START_SEGMENT)
+  {
+    continues = (stepAndOutputRNGFloat(rngState) < survival);
+    accumulatedRayColor /= survival;
+  }
+
+  // Called by every invocation; see queueAppend.
+  const uint next = nextRayQueue() * QUEUE_CAPACITY + queueAppend(nextRayQueue(), continues);
+  if(continues)
+  {
+    rayOrigins[next]    = rayOrigin;
+    rayDirections[next] = rayDirection;
+    rayColors[next]     = accumulatedRayColor;
+    rayRngStates[next]  = rngState;
+    rayPixels[next]     = rayPixels[ray];
+  }
+}
@@ -0,0 +1,19 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_EXT_ray_query : require
+#extension GL_GOOGLE_include_directive : require
+
+// Runs as a single invocation after the extend pass: sizes the shade and
+// connect passes to the hit and miss queues.
+#include "wavefrontCommon.h"
+
+void main()
+{
+  if(gl_GlobalInvocationID.x != 0)
+  {
+    return;
+  }
+  sizeDispatch(QUEUE_HITS);
+  sizeDispatch(QUEUE_MISSES);
+}
@@ -0,0 +1,21 @@
+// Copyright 2024 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+#version 460
+#extension GL_EXT_ray_query : require
+#extension GL_GOOGLE_include_directive : require
+
+// Runs as a single invocation before each segment: sizes the extend pass to
+// the current ray queue, and empties the queues the segment appends to.
+#include "wavefrontCommon.h"
+
+void main()
+{
+  if(gl_GlobalInvocationID.x != 0)
+  {
+    return;
+  }
+  sizeDispatch(currentRayQueue());
+  queueCounts[nextRayQueue()] = 0;
+  queueCounts[QUEUE_HITS]     = 0;
+  queueCounts[QUEUE_MISSES]   = 0;
+}